@@ -0,0 +1,948 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Characterizes each audio endpoint in the modes wasapisrc and wasapisink
+ * can open it in: shared, shared with the minimum period of IAudioClient3,
+ * and exclusive. Opens the endpoints with the same code as the plugin and
+ * streams silence, or drops what is captured, for a few seconds per mode.
+ *
+ * With --perf it runs wasapisrc ! fakesink and audiotestsrc ! wasapisink on
+ * the fake endpoints of GST_WASAPI_FAKE instead (see gstwasapifake.h, the
+ * defaults unless it's set), and reports the CPU time of the process per
+ * second of audio and how late the buffers were. The elements are the ones
+ * built into the bench, not those of an installed plugin.
+ *
+ * With --soak it runs wasapisrc on the endpoint of --device, the default
+ * one, or with --fake the fake one, for --duration seconds, which can be
+ * hours, and logs its wasapi-health every --interval seconds: timeshifts,
+ * drift, glitches, and the memory and handles of the process, whose growth
+ * is summed up at the end.
+ *
+ * With --scale it runs 1, 4, 16 and 64 wasapisrc and wasapisink pipelines
+ * at once for --duration seconds each, on the endpoint of --device, the
+ * default one or the fake one, and reports the CPU per stream from the
+ * process-cpu of their wasapi-stats, the context switches of the process
+ * per second and the glitches per stream and minute.
+ *
+ *   gst-wasapi-bench [--duration=SECONDS] [--device=ID] [--capture|--render]
+ *       [--perf] [--soak [--interval=SECONDS]] [--scale] [--fake]
+ */
+
+#include "config.h"
+
+#include "gstwasapiutil.h"
+#include "gstwasapidevice.h"
+#include "gstwasapicpu.h"
+#include "gstwasapidevicecache.h"
+#include "gstwasapisrc.h"
+#include "gstwasapisink.h"
+#include "gstwasapitrace.h"
+
+#include <stdlib.h>
+#include <winternl.h>
+
+GST_DEBUG_CATEGORY (gst_wasapi_debug);
+
+typedef enum
+{
+  BENCH_MODE_SHARED,
+  BENCH_MODE_AUDIOCLIENT3_MIN,
+  BENCH_MODE_EXCLUSIVE,
+  BENCH_N_MODES
+} BenchMode;
+
+static const gchar *bench_mode_names[BENCH_N_MODES] = {
+  "shared", "audioclient3-min", "exclusive"
+};
+
+typedef struct
+{
+  /* Engine periods in frames, 0 where the mode can't tell */
+  guint default_period;
+  guint fundamental_period;
+  guint min_period;
+  guint max_period;
+  guint rate;
+  guint device_period;
+  guint buffer_frames;
+  REFERENCE_TIME latency;
+  /* How far each wakeup was from one device period after the last, in
+   * microseconds, sorted */
+  GArray *jitter;
+  guint wakeups;
+  guint timeouts;
+  guint glitches;
+} BenchResult;
+
+static gint duration = 2;
+static gchar *only_device = NULL;
+static gboolean only_capture = FALSE;
+static gboolean only_render = FALSE;
+static gboolean perf = FALSE;
+static gboolean soak = FALSE;
+static gint interval = 60;
+static gboolean fake = FALSE;
+static gboolean scale = FALSE;
+
+static GOptionEntry entries[] = {
+  {"duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+      "Seconds to stream per endpoint and mode (default 2)", "SECONDS"},
+  {"device", 0, 0, G_OPTION_ARG_STRING, &only_device,
+      "Only the endpoint with this id", "ID"},
+  {"capture", 0, 0, G_OPTION_ARG_NONE, &only_capture,
+      "Only capture endpoints", NULL},
+  {"render", 0, 0, G_OPTION_ARG_NONE, &only_render,
+      "Only render endpoints", NULL},
+  {"perf", 0, 0, G_OPTION_ARG_NONE, &perf,
+      "Time wasapisrc and wasapisink on the fake endpoints instead", NULL},
+  {"soak", 0, 0, G_OPTION_ARG_NONE, &soak,
+      "Run wasapisrc for --duration seconds and log its health instead",
+      NULL},
+  {"interval", 'i', 0, G_OPTION_ARG_INT, &interval,
+      "Seconds between health reports of --soak (default 60)", "SECONDS"},
+  {"scale", 0, 0, G_OPTION_ARG_NONE, &scale,
+      "Run 1, 4, 16 and 64 pipelines at once and report how they scale "
+      "instead", NULL},
+  {"fake", 0, 0, G_OPTION_ARG_NONE, &fake,
+      "Stream on the fake endpoints of GST_WASAPI_FAKE", NULL},
+  {NULL}
+};
+
+static gint
+compare_gint64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static gdouble
+percentile_ms (GArray * sorted, guint percent)
+{
+  guint i;
+
+  if (sorted->len == 0)
+    return 0;
+
+  i = MIN ((sorted->len * percent + 99) / 100, sorted->len) - 1;
+  return g_array_index (sorted, gint64, i) / 1000.0;
+}
+
+static gboolean
+bench_initialize (BenchMode mode, IMMDevice * device, IAudioClient ** client,
+    WAVEFORMATEX * format, BenchResult * result)
+{
+  GstAudioRingBufferSpec spec = { 0, };
+  REFERENCE_TIME default_period, min_period;
+  guint sharemode = mode == BENCH_MODE_EXCLUSIVE ?
+      AUDCLNT_SHAREMODE_EXCLUSIVE : AUDCLNT_SHAREMODE_SHARED;
+
+  /* Only the rate matters to the initialization, the latency-time and
+   * buffer-time are the defaults of the elements */
+  gst_audio_info_set_format (&spec.info, GST_AUDIO_FORMAT_F32LE,
+      format->nSamplesPerSec, format->nChannels, NULL);
+  spec.latency_time = 10000;
+  spec.buffer_time = 200000;
+
+  if (mode == BENCH_MODE_AUDIOCLIENT3_MIN) {
+    if (!gst_wasapi_util_have_audioclient3 ())
+      return FALSE;
+    if (FAILED (IAudioClient3_GetSharedModeEnginePeriod ((IAudioClient3 *)
+                *client, format, &result->default_period,
+                &result->fundamental_period, &result->min_period,
+                &result->max_period)))
+      return FALSE;
+    return gst_wasapi_util_initialize_audioclient3 (NULL, &spec,
+        (IAudioClient3 *) * client, format, TRUE, FALSE,
+        &result->device_period);
+  }
+
+  if (SUCCEEDED (IAudioClient_GetDevicePeriod (*client, &default_period,
+              &min_period))) {
+    result->default_period = (guint) (default_period *
+        format->nSamplesPerSec / 10000000);
+    result->min_period = (guint) (min_period * format->nSamplesPerSec /
+        10000000);
+  }
+
+  return gst_wasapi_util_initialize_audioclient (NULL, &spec, device, client,
+      format, sharemode, mode == BENCH_MODE_EXCLUSIVE, FALSE, FALSE, FALSE,
+      &result->device_period);
+}
+
+/* Streams for --duration seconds, waking up like the elements do */
+static gboolean
+bench_run (IAudioClient * client, gboolean render, WAVEFORMATEX * format,
+    BenchResult * result)
+{
+  IAudioRenderClient *render_client = NULL;
+  IAudioCaptureClient *capture_client = NULL;
+  HANDLE event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  gint64 period_us, last = 0, deadline;
+  gboolean res = FALSE, first = TRUE;
+  DWORD wait_ms;
+  HRESULT hr;
+
+  result->jitter = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  if (FAILED (IAudioClient_GetBufferSize (client, &result->buffer_frames)) ||
+      FAILED (IAudioClient_GetStreamLatency (client, &result->latency)) ||
+      FAILED (IAudioClient_SetEventHandle (client, event)))
+    goto beach;
+
+  if (render ? !gst_wasapi_util_get_render_client (NULL, client,
+          &render_client) : !gst_wasapi_util_get_capture_client (NULL,
+          client, &capture_client))
+    goto beach;
+
+  period_us = gst_util_uint64_scale_int (MAX (result->device_period, 1),
+      G_USEC_PER_SEC, format->nSamplesPerSec);
+  wait_ms = (DWORD) (4 * period_us / 1000) + 1;
+
+  hr = IAudioClient_Start (client);
+  if (FAILED (hr))
+    goto beach;
+
+  deadline = g_get_monotonic_time () + (gint64) duration * G_USEC_PER_SEC;
+  while (g_get_monotonic_time () < deadline) {
+    gint64 now;
+
+    if (WaitForSingleObject (event, wait_ms) != WAIT_OBJECT_0) {
+      result->timeouts++;
+      continue;
+    }
+
+    now = (gint64) (gst_wasapi_util_get_qpc_position () / 10);
+    if (last != 0) {
+      gint64 off = ABS ((now - last) - period_us);
+
+      g_array_append_val (result->jitter, off);
+    }
+    last = now;
+    result->wakeups++;
+
+    if (render) {
+      guint32 padding;
+      BYTE *data;
+
+      if (FAILED (IAudioClient_GetCurrentPadding (client, &padding)))
+        break;
+      /* The device ran dry since the last wakeup */
+      if (padding == 0 && !first)
+        result->glitches++;
+      if (padding < result->buffer_frames &&
+          SUCCEEDED (IAudioRenderClient_GetBuffer (render_client,
+                  result->buffer_frames - padding, &data)))
+        IAudioRenderClient_ReleaseBuffer (render_client,
+            result->buffer_frames - padding, AUDCLNT_BUFFERFLAGS_SILENT);
+    } else {
+      guint32 n_frames;
+      DWORD flags;
+      BYTE *data;
+
+      while (IAudioCaptureClient_GetBuffer (capture_client, &data, &n_frames,
+              &flags, NULL, NULL) == S_OK) {
+        if ((flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) && !first)
+          result->glitches++;
+        IAudioCaptureClient_ReleaseBuffer (capture_client, n_frames);
+      }
+    }
+    first = FALSE;
+  }
+
+  IAudioClient_Stop (client);
+  g_array_sort (result->jitter, compare_gint64);
+  res = TRUE;
+
+beach:
+  if (render_client)
+    IUnknown_Release (render_client);
+  if (capture_client)
+    IUnknown_Release (capture_client);
+  CloseHandle (event);
+  return res;
+}
+
+static void
+bench_print (BenchMode mode, BenchResult * r)
+{
+  gdouble ms = 1000.0 / MAX (r->rate, 1);
+
+  g_print ("  %-17s period %7.3f ms", bench_mode_names[mode],
+      r->device_period * ms);
+  if (mode == BENCH_MODE_AUDIOCLIENT3_MIN)
+    g_print (" (engine default %.3f, fundamental %.3f, min %.3f, max %.3f)",
+        r->default_period * ms, r->fundamental_period * ms,
+        r->min_period * ms, r->max_period * ms);
+  else
+    g_print (" (device default %.3f, min %.3f)", r->default_period * ms,
+        r->min_period * ms);
+  g_print ("\n%20s buffer %u frames (%.3f ms), stream latency %.3f ms\n", "",
+      r->buffer_frames, r->buffer_frames * ms, r->latency / 10000.0);
+  g_print ("%20s %u wakeups, jitter p50 %.3f p95 %.3f p99 %.3f max %.3f ms, "
+      "%u timeouts, %u glitches\n", "", r->wakeups,
+      percentile_ms (r->jitter, 50), percentile_ms (r->jitter, 95),
+      percentile_ms (r->jitter, 99), percentile_ms (r->jitter, 100),
+      r->timeouts, r->glitches);
+}
+
+static void
+bench_device (GstWasapiDevice * dev, gboolean render)
+{
+  wchar_t *strid = g_utf8_to_utf16 (dev->strid, -1, NULL, NULL, NULL);
+  gchar *name = gst_device_get_display_name (GST_DEVICE (dev));
+  gint mode;
+
+  g_print ("%s [%s]\n  %s\n", name, render ? "render" : "capture",
+      dev->strid);
+
+  for (mode = 0; mode < BENCH_N_MODES; mode++) {
+    guint sharemode = mode == BENCH_MODE_EXCLUSIVE ?
+        AUDCLNT_SHAREMODE_EXCLUSIVE : AUDCLNT_SHAREMODE_SHARED;
+    BenchResult result = { 0, };
+    IMMDevice *device = NULL;
+    IAudioClient *client = NULL;
+    WAVEFORMATEX *format = NULL;
+
+    /* Each mode needs a client of its own, one can only be initialized
+     * once */
+    if (!gst_wasapi_util_get_device_client (NULL, render ? eRender : eCapture,
+            GST_WASAPI_DEVICE_ROLE_CONSOLE, strid, &device, &client) ||
+        !gst_wasapi_util_get_device_format (NULL, sharemode, device, client,
+            &format)) {
+      g_print ("  %-17s can't open the endpoint\n", bench_mode_names[mode]);
+    } else if (!bench_initialize (mode, device, &client, format, &result)) {
+      g_print ("  %-17s not supported\n", bench_mode_names[mode]);
+    } else {
+      result.rate = format->nSamplesPerSec;
+      if (bench_run (client, render, format, &result))
+        bench_print (mode, &result);
+      else
+        g_print ("  %-17s failed to stream\n", bench_mode_names[mode]);
+    }
+
+    if (result.jitter)
+      g_array_free (result.jitter, TRUE);
+    if (format)
+      CoTaskMemFree (format);
+    if (client)
+      IUnknown_Release (client);
+    if (device)
+      IUnknown_Release (device);
+  }
+
+  g_print ("\n");
+  g_free (name);
+  g_free (strid);
+}
+
+/* One of our elements streaming in a pipeline of its own */
+typedef struct
+{
+  GstElement *pipeline;
+  GstElement *element;
+  gboolean render;
+
+  /* From the streaming thread, read once it stopped. How long after its
+   * last sample was captured each buffer left wasapisrc, or how far ahead
+   * of its playback each reached wasapisink, in microseconds. */
+  GArray *latency;
+  GstClockTime audio;
+  guint buffers;
+} BenchStream;
+
+static GstPadProbeReturn
+bench_stream_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  BenchStream *stream = user_data;
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClock *clock = gst_element_get_clock (stream->element);
+
+  stream->buffers++;
+  if (GST_BUFFER_DURATION_IS_VALID (buf))
+    stream->audio += GST_BUFFER_DURATION (buf);
+
+  /* Both pipelines start their segment at 0, so the timestamps are running
+   * times */
+  if (clock != NULL && GST_BUFFER_PTS_IS_VALID (buf)) {
+    GstClockTimeDiff now = GST_CLOCK_DIFF (gst_element_get_base_time
+        (stream->element), gst_clock_get_time (clock));
+    GstClockTimeDiff late;
+
+    if (stream->render)
+      late = (GstClockTimeDiff) GST_BUFFER_PTS (buf) - now;
+    else
+      late = now - (GstClockTimeDiff) (GST_BUFFER_PTS (buf) +
+          (GST_BUFFER_DURATION_IS_VALID (buf) ? GST_BUFFER_DURATION (buf) :
+              0));
+    late /= GST_USECOND;
+    g_array_append_val (stream->latency, late);
+  }
+  if (clock != NULL)
+    gst_object_unref (clock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* wasapisrc ! fakesink or audiotestsrc ! wasapisink, on the endpoint with
+ * the id @device or the default one. The elements are made from the types
+ * built in, an installed wasapi plugin doesn't matter. */
+static BenchStream *
+bench_stream_new (gboolean render, const gchar * device)
+{
+  BenchStream *stream = g_new0 (BenchStream, 1);
+  GstElement *other;
+  GstPad *pad;
+
+  stream->render = render;
+  stream->latency = g_array_new (FALSE, FALSE, sizeof (gint64));
+  stream->pipeline = gst_pipeline_new (NULL);
+  stream->element = g_object_new (render ? GST_TYPE_WASAPI_SINK :
+      GST_TYPE_WASAPI_SRC, NULL);
+  other = gst_element_factory_make (render ? "audiotestsrc" : "fakesink",
+      NULL);
+  if (other == NULL) {
+    g_printerr ("No %s element, GStreamer isn't installed completely\n",
+        render ? "audiotestsrc" : "fakesink");
+    gst_object_unref (gst_object_ref_sink (stream->element));
+    gst_object_unref (stream->pipeline);
+    g_array_free (stream->latency, TRUE);
+    g_free (stream);
+    return NULL;
+  }
+
+  if (device != NULL)
+    g_object_set (stream->element, "device", device, NULL);
+  gst_bin_add_many (GST_BIN (stream->pipeline), stream->element, other,
+      NULL);
+  if (render) {
+    gst_util_set_object_arg (G_OBJECT (other), "wave", "silence");
+    gst_element_link (other, stream->element);
+  } else {
+    gst_element_link (stream->element, other);
+  }
+
+  pad = gst_element_get_static_pad (stream->element, render ? "sink" : "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, bench_stream_probe,
+      stream, NULL);
+  gst_object_unref (pad);
+
+  return stream;
+}
+
+static void
+bench_stream_free (BenchStream * stream)
+{
+  gst_element_set_state (stream->pipeline, GST_STATE_NULL);
+  gst_object_unref (stream->pipeline);
+  g_array_free (stream->latency, TRUE);
+  g_free (stream);
+}
+
+/* Called with the element messages of the stream, from the main thread */
+typedef void (*BenchElementFunc) (const GstStructure * s, gpointer user_data);
+
+/* Streams for --duration seconds, handing the element messages to @func.
+ * FALSE if the pipeline failed. */
+static gboolean
+bench_stream_run (BenchStream * stream, BenchElementFunc func,
+    gpointer user_data)
+{
+  GstBus *bus = gst_element_get_bus (stream->pipeline);
+  gint64 deadline;
+  gboolean res = TRUE;
+
+  if (gst_element_set_state (stream->pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE) {
+    gst_object_unref (bus);
+    return FALSE;
+  }
+
+  deadline = g_get_monotonic_time () + (gint64) duration * G_USEC_PER_SEC;
+  while (res) {
+    gint64 now = g_get_monotonic_time ();
+    GstMessage *msg;
+
+    if (now >= deadline)
+      break;
+    msg = gst_bus_timed_pop_filtered (bus, (deadline - now) * GST_USECOND,
+        GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ELEMENT);
+    if (msg == NULL)
+      break;
+
+    switch (GST_MESSAGE_TYPE (msg)) {
+      case GST_MESSAGE_ELEMENT:
+        if (func != NULL && GST_MESSAGE_SRC (msg) ==
+            GST_OBJECT (stream->element))
+          func (gst_message_get_structure (msg), user_data);
+        break;
+      case GST_MESSAGE_ERROR:{
+        GError *err = NULL;
+
+        gst_message_parse_error (msg, &err, NULL);
+        g_printerr ("  %s\n", err->message);
+        g_clear_error (&err);
+        res = FALSE;
+        break;
+      }
+      default:
+        res = FALSE;
+        break;
+    }
+    gst_message_unref (msg);
+  }
+
+  gst_element_set_state (stream->pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+
+  return res;
+}
+
+/* CPU per second of audio and latency of one element on the fake
+ * endpoints */
+static void
+bench_perf (gboolean render)
+{
+  BenchStream *stream = bench_stream_new (render, NULL);
+  GstClockTime cpu;
+  gdouble audio_s;
+
+  if (stream == NULL)
+    return;
+
+  g_print ("%s on the fake endpoints, %d s\n", render ?
+      "audiotestsrc ! wasapisink" : "wasapisrc ! fakesink", duration);
+
+  cpu = gst_wasapi_util_get_process_time ();
+  if (!bench_stream_run (stream, NULL, NULL)) {
+    g_print ("  failed to stream\n\n");
+    bench_stream_free (stream);
+    return;
+  }
+  cpu = gst_wasapi_util_get_process_time () - cpu;
+
+  g_array_sort (stream->latency, compare_gint64);
+  audio_s = (gdouble) stream->audio / GST_SECOND;
+  g_print ("  %u buffers, %.3f s of audio, cpu %.3f ms per second of audio "
+      "(%.2f %% of a core)\n", stream->buffers, audio_s,
+      audio_s > 0 ? (gdouble) cpu / GST_MSECOND / audio_s : 0,
+      100.0 * cpu / ((gdouble) duration * GST_SECOND));
+  g_print ("  %s p50 %.3f p95 %.3f p99 %.3f max %.3f ms\n\n", render ?
+      "ahead of playback" : "latency", percentile_ms (stream->latency, 50),
+      percentile_ms (stream->latency, 95), percentile_ms (stream->latency,
+          99), percentile_ms (stream->latency, 100));
+
+  bench_stream_free (stream);
+}
+
+/* The first and the latest wasapi-health of --soak */
+typedef struct
+{
+  GstStructure *first;
+  GstStructure *last;
+  guint reports;
+} BenchSoak;
+
+static guint64
+bench_health_get (const GstStructure * s, const gchar * field)
+{
+  guint64 v = 0;
+  guint u;
+
+  /* handles is a guint, the counters are guint64 */
+  if (gst_structure_get_uint (s, field, &u))
+    return u;
+  gst_structure_get_uint64 (s, field, &v);
+  return v;
+}
+
+static void
+bench_soak_health (const GstStructure * s, gpointer user_data)
+{
+  BenchSoak *health = user_data;
+  gdouble ppm = 0;
+
+  if (!gst_structure_has_name (s, "wasapi-health"))
+    return;
+
+  gst_structure_get_double (s, "drift-ppm", &ppm);
+  g_print ("%9.0f %11" G_GUINT64_FORMAT " %9.2f %11" G_GUINT64_FORMAT
+      " %8" G_GUINT64_FORMAT " %6" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+      " %9" G_GUINT64_FORMAT " %10.1f %10.1f %7" G_GUINT64_FORMAT "\n",
+      (gdouble) bench_health_get (s, "uptime") / GST_SECOND,
+      bench_health_get (s, "timeshifted"), ppm,
+      bench_health_get (s, "drift-corrections"),
+      bench_health_get (s, "glitches"), bench_health_get (s, "gaps"),
+      bench_health_get (s, "underruns"),
+      bench_health_get (s, "overflow-dropped"),
+      bench_health_get (s, "resident-bytes") / 1048576.0,
+      bench_health_get (s, "private-bytes") / 1048576.0,
+      bench_health_get (s, "handles"));
+
+  if (health->first == NULL)
+    health->first = gst_structure_copy (s);
+  if (health->last != NULL)
+    gst_structure_free (health->last);
+  health->last = gst_structure_copy (s);
+  health->reports++;
+}
+
+/* wasapisrc for --duration seconds, its health every --interval */
+static void
+bench_soak (void)
+{
+  BenchStream *stream = bench_stream_new (FALSE, fake ? NULL : only_device);
+  BenchSoak health = { NULL, NULL, 0 };
+  gboolean res;
+
+  if (stream == NULL)
+    return;
+
+  g_object_set (stream->element, "health-interval",
+      (guint64) MAX (interval, 1) * GST_SECOND, NULL);
+
+  g_print ("wasapisrc ! fakesink on the %s endpoint, %d s\n", fake ?
+      "fake" : only_device ? only_device : "default", duration);
+  g_print ("%9s %11s %9s %11s %8s %6s %8s %9s %10s %10s %7s\n", "uptime-s",
+      "timeshifted", "drift-ppm", "corrections", "glitches", "gaps",
+      "underrun", "dropped-b", "resident-m", "private-m", "handles");
+
+  res = bench_stream_run (stream, bench_soak_health, &health);
+
+  /* A leak shows as growth after the first report, once it warmed up */
+  if (health.reports > 1) {
+    g_print ("growth since the first report: resident %+.1f MB, private "
+        "%+.1f MB, %+" G_GINT64_FORMAT " handles\n",
+        ((gdouble) bench_health_get (health.last, "resident-bytes") -
+            bench_health_get (health.first, "resident-bytes")) / 1048576.0,
+        ((gdouble) bench_health_get (health.last, "private-bytes") -
+            bench_health_get (health.first, "private-bytes")) / 1048576.0,
+        (gint64) bench_health_get (health.last, "handles") -
+        (gint64) bench_health_get (health.first, "handles"));
+  }
+  if (!res)
+    g_print ("stopped, the pipeline failed\n");
+
+  if (health.first != NULL)
+    gst_structure_free (health.first);
+  if (health.last != NULL)
+    gst_structure_free (health.last);
+  bench_stream_free (stream);
+}
+
+/* Concurrent pipelines of each --scale step */
+static const guint scale_steps[] = { 1, 4, 16, 64 };
+
+/* What NtQuerySystemInformation() puts behind each process, the public
+ * SYSTEM_PROCESS_INFORMATION doesn't have it */
+typedef struct
+{
+  LARGE_INTEGER kernel_time;
+  LARGE_INTEGER user_time;
+  LARGE_INTEGER create_time;
+  ULONG wait_time;
+  PVOID start_address;
+  HANDLE unique_process;
+  HANDLE unique_thread;
+  LONG priority;
+  LONG base_priority;
+  ULONG context_switches;
+  ULONG thread_state;
+  ULONG wait_reason;
+} BenchThreadInformation;
+
+typedef NTSTATUS (WINAPI * BenchQuerySystemInformation) (ULONG,
+    PVOID, ULONG, PULONG);
+
+/* Context switches of all threads of the process so far, 0 if Windows
+ * doesn't tell. Those of threads that exited are gone, the pipelines are
+ * only stopped after the second call. */
+static guint64
+bench_get_context_switches (void)
+{
+  static BenchQuerySystemInformation query = NULL;
+  SYSTEM_PROCESS_INFORMATION *info;
+  HANDLE pid = (HANDLE) (gsize) GetCurrentProcessId ();
+  ULONG size = 256 * 1024;
+  guint8 *buf = NULL;
+  guint64 total = 0;
+  NTSTATUS status;
+
+  if (query == NULL)
+    query = (gpointer) GetProcAddress (GetModuleHandle (TEXT ("ntdll.dll")),
+        "NtQuerySystemInformation");
+  if (query == NULL)
+    return 0;
+
+  /* All processes of the system, STATUS_INFO_LENGTH_MISMATCH until the
+   * buffer is large enough */
+  do {
+    g_free (buf);
+    size *= 2;
+    buf = g_malloc (size);
+    status = query (SystemProcessInformation, buf, size, NULL);
+  } while (status == (NTSTATUS) 0xC0000004L && size < 64 * 1024 * 1024);
+
+  if (status < 0) {
+    g_free (buf);
+    return 0;
+  }
+
+  info = (SYSTEM_PROCESS_INFORMATION *) buf;
+  for (;;) {
+    if (info->UniqueProcessId == pid) {
+      BenchThreadInformation *threads = (BenchThreadInformation *) (info + 1);
+      ULONG i;
+
+      for (i = 0; i < info->NumberOfThreads; i++)
+        total += threads[i].context_switches;
+      break;
+    }
+    if (info->NextEntryOffset == 0)
+      break;
+    info = (SYSTEM_PROCESS_INFORMATION *) ((guint8 *) info +
+        info->NextEntryOffset);
+  }
+
+  g_free (buf);
+  return total;
+}
+
+/* The wasapi-stats of all streams of one --scale step */
+typedef struct
+{
+  GMainLoop *loop;
+  gboolean failed;
+
+  gdouble process_cpu;
+  guint reports;
+  gint streams;
+  guint64 glitches;
+} BenchScale;
+
+static gboolean
+bench_scale_bus (GstBus * bus, GstMessage * msg, gpointer user_data)
+{
+  BenchScale *step = user_data;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ELEMENT:{
+      const GstStructure *s = gst_message_get_structure (msg);
+      guint64 glitches = 0, underruns = 0;
+      gdouble cpu = 0;
+      gint streams = 0;
+
+      if (!gst_structure_has_name (s, "wasapi-stats"))
+        break;
+
+      /* Of the whole process, every stream reports the same */
+      gst_structure_get_double (s, "process-cpu", &cpu);
+      gst_structure_get_int (s, "streams", &streams);
+      gst_structure_get_uint64 (s, "glitches", &glitches);
+      gst_structure_get_uint64 (s, "underruns", &underruns);
+      step->process_cpu += cpu;
+      step->reports++;
+      step->streams = MAX (step->streams, streams);
+      step->glitches += glitches + underruns;
+      break;
+    }
+    case GST_MESSAGE_ERROR:{
+      GError *err = NULL;
+
+      gst_message_parse_error (msg, &err, NULL);
+      g_printerr ("  %s\n", err->message);
+      g_clear_error (&err);
+      step->failed = TRUE;
+      g_main_loop_quit (step->loop);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+bench_scale_timeout (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* @n pipelines at once for --duration seconds. FALSE if one failed. */
+static gboolean
+bench_scale_step (gboolean render, guint n)
+{
+  BenchScale step = { NULL, };
+  GPtrArray *streams = g_ptr_array_new ();
+  guint64 switches;
+  gdouble minutes = duration / 60.0;
+  guint i;
+
+  step.loop = g_main_loop_new (NULL, FALSE);
+
+  for (i = 0; i < n; i++) {
+    BenchStream *stream = bench_stream_new (render, fake ? NULL :
+        only_device);
+    GstBus *bus;
+
+    if (stream == NULL) {
+      step.failed = TRUE;
+      break;
+    }
+    g_object_set (stream->element, "stats-interval", (guint64) GST_SECOND,
+        NULL);
+    bus = gst_element_get_bus (stream->pipeline);
+    gst_bus_add_watch (bus, bench_scale_bus, &step);
+    gst_object_unref (bus);
+    g_ptr_array_add (streams, stream);
+  }
+
+  for (i = 0; i < streams->len && !step.failed; i++) {
+    BenchStream *stream = g_ptr_array_index (streams, i);
+
+    if (gst_element_set_state (stream->pipeline, GST_STATE_PLAYING) ==
+        GST_STATE_CHANGE_FAILURE)
+      step.failed = TRUE;
+  }
+
+  switches = bench_get_context_switches ();
+  if (!step.failed) {
+    g_timeout_add_seconds (duration, bench_scale_timeout, step.loop);
+    g_main_loop_run (step.loop);
+  }
+  switches = bench_get_context_switches () - switches;
+
+  for (i = 0; i < streams->len; i++) {
+    BenchStream *stream = g_ptr_array_index (streams, i);
+    GstBus *bus = gst_element_get_bus (stream->pipeline);
+
+    gst_bus_remove_watch (bus);
+    gst_object_unref (bus);
+    bench_stream_free (stream);
+  }
+  g_ptr_array_free (streams, TRUE);
+  g_main_loop_unref (step.loop);
+
+  if (step.failed) {
+    g_print ("%5u failed to stream\n", n);
+    return FALSE;
+  }
+
+  g_print ("%5u %7d %12.3f %15.0f %9" G_GUINT64_FORMAT " %17.3f\n", n,
+      step.streams, step.reports > 0 ? step.process_cpu / step.reports / n :
+      0, (gdouble) switches / MAX (duration, 1), step.glitches,
+      minutes > 0 ? step.glitches / (n * minutes) : 0);
+
+  return TRUE;
+}
+
+/* How CPU, context switches and glitches grow with the pipelines */
+static void
+bench_scale (gboolean render)
+{
+  guint i;
+
+  g_print ("%s on the %s endpoint, %d s per step\n", render ?
+      "audiotestsrc ! wasapisink" : "wasapisrc ! fakesink", fake ? "fake" :
+      only_device ? only_device : "default", duration);
+  g_print ("%5s %7s %12s %15s %9s %17s\n", "n", "streams", "cpu/stream-%",
+      "ctx-switches/s", "glitches", "glitches/stream-m");
+
+  for (i = 0; i < G_N_ELEMENTS (scale_steps); i++)
+    if (!bench_scale_step (render, scale_steps[i]))
+      break;
+
+  g_print ("\n");
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GList *devices = NULL, *l;
+
+  ctx = g_option_context_new ("- characterize the WASAPI endpoints");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (ctx);
+
+  /* Before anything asks gst_wasapi_fake_enabled(), which reads it once */
+  if (perf || fake)
+    g_setenv ("GST_WASAPI_FAKE", "1", FALSE);
+
+  GST_DEBUG_CATEGORY_INIT (gst_wasapi_debug, "wasapi", 0,
+      "Windows audio session API generic");
+  /* Like plugin_init() */
+  gst_wasapi_trace_register ();
+  gst_wasapi_cpu_init ();
+  gst_wasapi_device_cache_load ();
+  gst_wasapi_util_init_com ();
+
+  if (perf) {
+    if (!only_render)
+      bench_perf (FALSE);
+    if (!only_capture)
+      bench_perf (TRUE);
+    return EXIT_SUCCESS;
+  }
+
+  if (soak) {
+    bench_soak ();
+    return EXIT_SUCCESS;
+  }
+
+  if (scale) {
+    if (!only_render)
+      bench_scale (FALSE);
+    if (!only_capture)
+      bench_scale (TRUE);
+    return EXIT_SUCCESS;
+  }
+
+  if (!gst_wasapi_util_get_devices (NULL, TRUE, FALSE, &devices)) {
+    g_printerr ("Failed to enumerate the endpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  for (l = devices; l != NULL; l = l->next) {
+    GstWasapiDevice *dev = l->data;
+    gchar *klass = gst_device_get_device_class (GST_DEVICE (dev));
+    gboolean render = g_str_has_suffix (klass, "Sink");
+
+    g_free (klass);
+    if (dev->loopback || (only_device && g_strcmp0 (dev->strid,
+                only_device) != 0) || (only_capture && render) ||
+        (only_render && !render))
+      continue;
+
+    bench_device (dev, render);
+  }
+
+  g_list_free_full (devices, gst_object_unref);
+
+  return EXIT_SUCCESS;
+}
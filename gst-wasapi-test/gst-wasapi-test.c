@@ -0,0 +1,355 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the segment and offset math of wasapisrc without audio hardware,
+ * and times the paths create() takes for every buffer.
+ *
+ * The tests draw random cases, with segbase anywhere up to where segdone
+ * wraps around, and check what create() relies on: a reader that keeps up
+ * continues where it was, one that fell behind skips to the segment being
+ * written, and the ringbuffer hands out the segment of the sample asked
+ * for, or silence once it was overwritten. A failing case is reproduced
+ * with the --seed it prints. The benchmarks only run with -m perf and
+ * report nanoseconds per call.
+ *
+ *   gst-wasapi-test [-m perf] [--seed=SEED] [-p /offset/continue]
+ */
+
+#include "config.h"
+
+#include "gstwasapisrc.h"
+#include "gstwasapisrcringbuffer.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY (gst_wasapi_debug);
+
+/* Random cases per test */
+#define N_CASES 10000
+#define N_RING_CASES 1000
+
+/* Calls per benchmark */
+#define N_CALLS 1000000
+
+/* Keeps the benchmarked calls from being optimized away */
+static volatile guint64 bench_sink;
+
+static gint
+random_sps (void)
+{
+  /* From a single frame up to 100 ms at 48 kHz */
+  return g_test_rand_int_range (1, 4801);
+}
+
+static gint
+random_segtotal (void)
+{
+  return g_test_rand_int_range (2, 65);
+}
+
+/* A reader that is no more than a ringbuffer behind continues where it
+ * left off, also when it is ahead of the writer and will wait */
+static void
+test_offset_continue (void)
+{
+  guint i;
+
+  for (i = 0; i < N_CASES; i++) {
+    gint sps = random_sps (), segtotal = random_segtotal ();
+    gint readseg = g_test_rand_int_range (0, G_MAXINT / 2);
+    gint segdone = MAX (readseg + g_test_rand_int_range (-2, segtotal), 0);
+    guint64 next = (guint64) readseg * sps + g_test_rand_int_range (0, sps);
+
+    g_assert_cmpuint (gst_wasapi_src_get_read_offset (next, segdone,
+            segtotal, sps, 0), ==, next);
+  }
+}
+
+/* A reader a whole ringbuffer behind skips to the start of the segment
+ * being written, which is always ahead of it */
+static void
+test_offset_overrun (void)
+{
+  guint i;
+
+  for (i = 0; i < N_CASES; i++) {
+    gint sps = random_sps (), segtotal = random_segtotal ();
+    gint readseg = g_test_rand_int_range (0, G_MAXINT / 2);
+    gint segdone = readseg + segtotal + g_test_rand_int_range (0, 1000);
+    guint64 next = (guint64) readseg * sps + g_test_rand_int_range (0, sps);
+    guint64 sample;
+
+    sample = gst_wasapi_src_get_read_offset (next, segdone, segtotal, sps,
+        g_test_rand_int_range (0, 2 * segtotal));
+    g_assert_cmpuint (sample, ==, (guint64) segdone * sps);
+    g_assert_cmpuint (sample, >, next);
+  }
+}
+
+/* The first buffer starts on a segment boundary, as far back as preroll
+ * asks for but never before segbase or a ringbuffer back */
+static void
+test_offset_first (void)
+{
+  guint i;
+
+  for (i = 0; i < N_CASES; i++) {
+    gint sps = random_sps (), segtotal = random_segtotal ();
+    gint segdone = g_test_rand_int_range (0, G_MAXINT / 2);
+    gint preroll = g_test_rand_int_range (0, 2 * segtotal);
+    guint64 sample;
+
+    /* Right after start */
+    if (g_test_rand_bit ())
+      segdone = g_test_rand_int_range (0, segtotal);
+
+    sample = gst_wasapi_src_get_read_offset (-1, segdone, segtotal, sps,
+        preroll);
+    g_assert_cmpuint (sample % sps, ==, 0);
+    g_assert_cmpint (segdone - (gint) (sample / sps), ==,
+        MIN (MIN (preroll, segtotal - 1), segdone));
+  }
+}
+
+static GstAudioRingBuffer *
+ring_buffer_new (gint sps, gint segtotal)
+{
+  GstAudioRingBuffer *buf;
+  gint seg, i;
+
+  buf = g_object_new (GST_TYPE_WASAPI_SRC_RING_BUFFER, NULL);
+  gst_object_ref_sink (buf);
+
+  gst_audio_info_set_format (&buf->spec.info, GST_AUDIO_FORMAT_S16LE, 48000,
+      2, NULL);
+  buf->spec.segsize = sps * GST_AUDIO_INFO_BPF (&buf->spec.info);
+  buf->spec.segtotal = segtotal;
+  buf->samples_per_seg = sps;
+  buf->empty_seg = g_malloc0 (buf->spec.segsize);
+  buf->memory = g_malloc ((gsize) buf->spec.segsize * segtotal);
+
+  /* Every frame says where it is: the slot plus one, and the offset in it */
+  for (seg = 0; seg < segtotal; seg++) {
+    gint16 *frame = (gint16 *) (buf->memory + (gsize) seg *
+        buf->spec.segsize);
+
+    for (i = 0; i < sps; i++) {
+      frame[2 * i] = (gint16) (seg + 1);
+      frame[2 * i + 1] = (gint16) i;
+    }
+  }
+
+  return buf;
+}
+
+static void
+ring_buffer_free (GstAudioRingBuffer * buf)
+{
+  g_clear_pointer (&buf->memory, g_free);
+  g_clear_pointer (&buf->empty_seg, g_free);
+  gst_object_unref (buf);
+}
+
+/* Segbase anywhere, up to where the segdone counter wraps around */
+static gint
+random_segbase (void)
+{
+  switch (g_test_rand_int_range (0, 3)) {
+    case 0:
+      return 0;
+    case 1:
+      return G_MAXINT - g_test_rand_int_range (0, 1000);
+    default:
+      return g_test_rand_int ();
+  }
+}
+
+/* Reads what was written, segment by segment and across the end of the
+ * ringbuffer, and silence for what was overwritten before the read */
+static void
+test_ring_buffer_read (void)
+{
+  guint i;
+
+  for (i = 0; i < N_RING_CASES; i++) {
+    gint sps = g_test_rand_int_range (1, 481);
+    gint segtotal = random_segtotal ();
+    GstAudioRingBuffer *buf = ring_buffer_new (sps, segtotal);
+    gint done = g_test_rand_int_range (1, 100000);
+    gint readseg = MAX (done - g_test_rand_int_range (1, 2 * segtotal), 0);
+    guint64 sample = (guint64) readseg * sps + g_test_rand_int_range (0, sps);
+    guint len, read, f;
+    GstClockTime timestamp;
+    gint16 *data;
+
+    /* segdone - segbase is what counts, segdone itself may have wrapped.
+     * Never more than what is done, so it doesn't wait for the writer. */
+    buf->segbase = random_segbase ();
+    buf->segdone = (gint) ((guint) buf->segbase + (guint) done);
+    len = g_test_rand_int_range (1, (gint) ((guint64) done * sps - sample) +
+        1);
+    data = g_new (gint16, 2 * len);
+
+    read = gst_wasapi_src_ring_buffer_read (buf, sample, (guint8 *) data,
+        len, &timestamp);
+    g_assert_cmpuint (read, ==, len);
+
+    for (f = 0; f < len; f++) {
+      gint seg = (gint) ((sample + f) / sps);
+
+      if (done - seg >= segtotal) {
+        g_assert_cmpint (data[2 * f], ==, 0);
+        g_assert_cmpint (data[2 * f + 1], ==, 0);
+      } else {
+        g_assert_cmpint (data[2 * f], ==, seg % segtotal + 1);
+        g_assert_cmpint (data[2 * f + 1], ==, (gint) ((sample + f) % sps));
+      }
+    }
+
+    g_free (data);
+    ring_buffer_free (buf);
+  }
+}
+
+/* A read that starts in the middle of an overwritten segment gets silence
+ * for the rest of that one only, the live segments after it come through
+ * unshifted */
+static void
+test_ring_buffer_read_overwritten (void)
+{
+  GstAudioRingBuffer *buf = ring_buffer_new (4, 3);
+  static const gint16 expected[8][2] = {
+    {0, 0}, {0, 0}, {1, 0}, {1, 1}, {1, 2}, {1, 3}, {2, 0}, {2, 1}
+  };
+  GstClockTime timestamp;
+  gint16 data[2 * 8];
+  guint f;
+
+  /* Segments 3 and 4 are live, 2 was overwritten by 5, and segdone wraps */
+  buf->segbase = G_MAXINT - 2;
+  buf->segdone = (gint) ((guint) buf->segbase + 5);
+
+  g_assert_cmpuint (gst_wasapi_src_ring_buffer_read (buf, 2 * 4 + 2,
+          (guint8 *) data, 8, &timestamp), ==, 8);
+  for (f = 0; f < 8; f++) {
+    g_assert_cmpint (data[2 * f], ==, expected[f][0]);
+    g_assert_cmpint (data[2 * f + 1], ==, expected[f][1]);
+  }
+
+  ring_buffer_free (buf);
+}
+
+/* What create() reads next, once per buffer */
+static void
+bench_offset (void)
+{
+  gint segdone = 1000;
+  guint64 next = 999 * 480;
+  guint i;
+
+  g_test_timer_start ();
+  for (i = 0; i < N_CALLS; i++) {
+    next = gst_wasapi_src_get_read_offset (next, segdone, 20, 480, 0);
+    bench_sink += next;
+  }
+  g_test_minimized_result (g_test_timer_elapsed () * 1e9 / N_CALLS,
+      "get_read_offset: %.1f ns per call",
+      g_test_timer_elapsed () * 1e9 / N_CALLS);
+}
+
+/* The timestamp and duration of a buffer from its samples */
+static void
+bench_timestamp (void)
+{
+  guint64 sample = 0;
+  guint i;
+
+  g_test_timer_start ();
+  for (i = 0; i < N_CALLS; i++) {
+    bench_sink += gst_util_uint64_scale_int (sample, GST_SECOND, 48000);
+    bench_sink += gst_util_uint64_scale_int (480, GST_SECOND, 48000);
+    sample += 480;
+  }
+  g_test_minimized_result (g_test_timer_elapsed () * 1e9 / N_CALLS,
+      "timestamp and duration: %.1f ns per buffer",
+      g_test_timer_elapsed () * 1e9 / N_CALLS);
+}
+
+/* One query of the system clock, as the slaving code does per buffer */
+static void
+bench_clock (void)
+{
+  GstClock *clock = gst_system_clock_obtain ();
+  guint i;
+
+  g_test_timer_start ();
+  for (i = 0; i < N_CALLS; i++)
+    bench_sink += gst_clock_get_time (clock);
+  g_test_minimized_result (g_test_timer_elapsed () * 1e9 / N_CALLS,
+      "gst_clock_get_time: %.1f ns per call",
+      g_test_timer_elapsed () * 1e9 / N_CALLS);
+
+  gst_object_unref (clock);
+}
+
+/* Reading one 10 ms segment of stereo out of the ringbuffer */
+static void
+bench_ring_buffer_read (void)
+{
+  GstAudioRingBuffer *buf = ring_buffer_new (480, 20);
+  guint8 *data = g_malloc (buf->spec.segsize);
+  GstClockTime timestamp;
+  guint i;
+
+  buf->segdone = G_MAXINT;
+  g_test_timer_start ();
+  for (i = 0; i < N_CALLS; i++)
+    bench_sink += gst_wasapi_src_ring_buffer_read (buf,
+        (guint64) (G_MAXINT - 1 - i % 19) * 480, data, 480, &timestamp);
+  g_test_minimized_result (g_test_timer_elapsed () * 1e9 / N_CALLS,
+      "ring_buffer_read: %.1f ns per segment",
+      g_test_timer_elapsed () * 1e9 / N_CALLS);
+
+  g_free (data);
+  ring_buffer_free (buf);
+}
+
+int
+main (int argc, char **argv)
+{
+  gst_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  GST_DEBUG_CATEGORY_INIT (gst_wasapi_debug, "wasapi", 0,
+      "Windows audio session API generic");
+
+  g_test_add_func ("/offset/continue", test_offset_continue);
+  g_test_add_func ("/offset/overrun", test_offset_overrun);
+  g_test_add_func ("/offset/first", test_offset_first);
+  g_test_add_func ("/ringbuffer/read", test_ring_buffer_read);
+  g_test_add_func ("/ringbuffer/read-overwritten",
+      test_ring_buffer_read_overwritten);
+
+  if (g_test_perf ()) {
+    g_test_add_func ("/perf/offset", bench_offset);
+    g_test_add_func ("/perf/timestamp", bench_timestamp);
+    g_test_add_func ("/perf/clock", bench_clock);
+    g_test_add_func ("/perf/ringbuffer-read", bench_ring_buffer_read);
+  }
+
+  return g_test_run ();
+}
@@ -0,0 +1,40 @@
+/*
+ * Structure and enum definitions are from audioclientactivationparams.h in
+ * the Windows 10 SDK 10.0.20348
+ *
+ * Older SDKs and MinGW don't have them, so we keep a copy in our tree. All
+ * definitions are guarded, so it should be fine to always include this even
+ * when building with a new SDK.
+ */
+#pragma once
+
+#ifndef VIRTUAL_AUDIO_DEVICE_PROCESS_LOOPBACK
+#define VIRTUAL_AUDIO_DEVICE_PROCESS_LOOPBACK L"VAD\\Process_Loopback"
+
+typedef enum AUDIOCLIENT_ACTIVATION_TYPE
+{
+    AUDIOCLIENT_ACTIVATION_TYPE_DEFAULT	         = 0,
+    AUDIOCLIENT_ACTIVATION_TYPE_PROCESS_LOOPBACK = 1
+} AUDIOCLIENT_ACTIVATION_TYPE;
+
+typedef enum PROCESS_LOOPBACK_MODE
+{
+    PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE = 0,
+    PROCESS_LOOPBACK_MODE_EXCLUDE_TARGET_PROCESS_TREE = 1
+} PROCESS_LOOPBACK_MODE;
+
+typedef struct AUDIOCLIENT_PROCESS_LOOPBACK_PARAMS
+{
+    DWORD TargetProcessId;
+    PROCESS_LOOPBACK_MODE ProcessLoopbackMode;
+} AUDIOCLIENT_PROCESS_LOOPBACK_PARAMS;
+
+typedef struct AUDIOCLIENT_ACTIVATION_PARAMS
+{
+    AUDIOCLIENT_ACTIVATION_TYPE ActivationType;
+    union
+    {
+        AUDIOCLIENT_PROCESS_LOOPBACK_PARAMS ProcessLoopbackParams;
+    };
+} AUDIOCLIENT_ACTIVATION_PARAMS;
+#endif /* VIRTUAL_AUDIO_DEVICE_PROCESS_LOOPBACK */
@@ -0,0 +1,82 @@
+/*
+ * Structure, enum and interface definitions are from audioclient.h and
+ * ksmedia.h in the Windows 11 SDK 10.0.22000
+ *
+ * Older SDKs and MinGW don't have them, so we keep a copy in our tree. All
+ * definitions are guarded, so it should be fine to always include this even
+ * when building with a new SDK.
+ */
+#pragma once
+
+#ifndef __IAudioEffectsManager_INTERFACE_DEFINED__
+#define __IAudioEffectsManager_INTERFACE_DEFINED__
+
+typedef enum AUDIO_EFFECT_STATE
+{
+    AUDIO_EFFECT_STATE_OFF  = 0,
+    AUDIO_EFFECT_STATE_ON   = 1
+} AUDIO_EFFECT_STATE;
+
+typedef struct AUDIO_EFFECT
+{
+    GUID id;
+    BOOL canSetState;
+    AUDIO_EFFECT_STATE state;
+} AUDIO_EFFECT;
+
+typedef struct IAudioEffectsManager IAudioEffectsManager;
+
+EXTERN_C const IID IID_IAudioEffectsManager;
+
+typedef struct IAudioEffectsManagerVtbl
+{
+    BEGIN_INTERFACE
+
+    HRESULT ( STDMETHODCALLTYPE *QueryInterface )(
+        IAudioEffectsManager * This,
+        REFIID riid,
+        void **ppvObject);
+
+    ULONG ( STDMETHODCALLTYPE *AddRef )(
+        IAudioEffectsManager * This);
+
+    ULONG ( STDMETHODCALLTYPE *Release )(
+        IAudioEffectsManager * This);
+
+    /* Takes an IAudioEffectsChangedNotificationClient, which we don't use */
+    HRESULT ( STDMETHODCALLTYPE *RegisterAudioEffectsChangedNotificationCallback )(
+        IAudioEffectsManager * This,
+        IUnknown *client);
+
+    HRESULT ( STDMETHODCALLTYPE *UnregisterAudioEffectsChangedNotificationCallback )(
+        IAudioEffectsManager * This,
+        IUnknown *client);
+
+    HRESULT ( STDMETHODCALLTYPE *GetAudioEffects )(
+        IAudioEffectsManager * This,
+        AUDIO_EFFECT **effects,
+        UINT32 *numEffects);
+
+    HRESULT ( STDMETHODCALLTYPE *SetAudioEffectState )(
+        IAudioEffectsManager * This,
+        GUID effectId,
+        AUDIO_EFFECT_STATE state);
+
+    END_INTERFACE
+} IAudioEffectsManagerVtbl;
+
+struct IAudioEffectsManager
+{
+    CONST_VTBL struct IAudioEffectsManagerVtbl *lpVtbl;
+};
+
+#define IAudioEffectsManager_Release(This)	\
+    ( (This)->lpVtbl -> Release(This) )
+
+#define IAudioEffectsManager_GetAudioEffects(This,effects,numEffects)	\
+    ( (This)->lpVtbl -> GetAudioEffects(This,effects,numEffects) )
+
+#define IAudioEffectsManager_SetAudioEffectState(This,effectId,state)	\
+    ( (This)->lpVtbl -> SetAudioEffectState(This,effectId,state) )
+
+#endif 	/* __IAudioEffectsManager_INTERFACE_DEFINED__ */
@@ -23,7 +23,16 @@
 
 #include "gstwasapisink.h"
 #include "gstwasapisrc.h"
+#include "gstwasapiaggregatesrc.h"
+#include "gstwasapiaggregatesink.h"
+#include "gstwasapispatialsink.h"
+#include "gstwasapimonitor.h"
 #include "gstwasapidevice.h"
+#include "gstwasapicpu.h"
+#include "gstwasapidevicecache.h"
+#include "gstwasapitrace.h"
+#include "gstwasapitracer.h"
+#include "gstwasapiutil.h"
 
 GST_DEBUG_CATEGORY (gst_wasapi_debug);
 
@@ -38,13 +47,40 @@ plugin_init (GstPlugin * plugin)
           GST_TYPE_WASAPI_SRC))
     return FALSE;
 
+  if (!gst_element_register (plugin, "wasapiaggregatesrc", GST_RANK_NONE,
+          GST_TYPE_WASAPI_AGGREGATE_SRC))
+    return FALSE;
+
+  if (!gst_element_register (plugin, "wasapiaggregatesink", GST_RANK_NONE,
+          GST_TYPE_WASAPI_AGGREGATE_SINK))
+    return FALSE;
+
+  if (!gst_element_register (plugin, "wasapispatialsink", GST_RANK_NONE,
+          GST_TYPE_WASAPI_SPATIAL_SINK))
+    return FALSE;
+
+  if (!gst_element_register (plugin, "wasapimonitor", GST_RANK_NONE,
+          GST_TYPE_WASAPI_MONITOR))
+    return FALSE;
+
   if (!gst_device_provider_register (plugin, "wasapideviceprovider",
           GST_RANK_PRIMARY, GST_TYPE_WASAPI_DEVICE_PROVIDER))
     return FALSE;
 
+  if (!gst_wasapi_tracer_register (plugin))
+    return FALSE;
+
   GST_DEBUG_CATEGORY_INIT (gst_wasapi_debug, "wasapi",
       0, "Windows audio session API generic");
 
+  gst_wasapi_trace_register ();
+
+  gst_wasapi_cpu_init ();
+
+  gst_wasapi_device_cache_load ();
+
+  gst_wasapi_util_init_com ();
+
   return TRUE;
 }
 
@@ -0,0 +1,334 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiaecref.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Packets after which timing continued are merged, so this only has to
+ * hold the ones after resets and clock corrections */
+#define N_PACKETS 64
+/* A packet that starts this close to where the last one ends continues it,
+ * in 100 ns. Keeps the IAudioClock jitter out of the alignment. */
+#define CONTINUE_TOLERANCE 10000
+
+typedef struct
+{
+  /* Stream position of the first frame, the ring offset is this modulo
+   * ring_frames */
+  guint64 position;
+  guint64 qpcpos;
+  guint frames;
+} GstWasapiAecRefPacket;
+
+struct _GstWasapiAecRef
+{
+  gchar *id;
+  /* Protected by refs_lock */
+  gint refcount;
+
+  /* Protects everything below */
+  GMutex lock;
+  GstElement *publisher;
+  guint rate;
+  guint channels;
+  guint bpf;
+  guint bits;
+  /* Power of two, two seconds at least */
+  guint8 *ring;
+  guint ring_frames;
+  guint64 write_position;
+  /* Oldest first, n_packets from first on */
+  GstWasapiAecRefPacket packets[N_PACKETS];
+  guint first;
+  guint n_packets;
+};
+
+static GMutex refs_lock;
+static GHashTable *refs;
+
+GstWasapiAecRef *
+gst_wasapi_aec_ref_get (const gchar * id)
+{
+  GstWasapiAecRef *ref;
+
+  g_mutex_lock (&refs_lock);
+  if (refs == NULL)
+    refs = g_hash_table_new (g_str_hash, g_str_equal);
+
+  ref = g_hash_table_lookup (refs, id);
+  if (ref == NULL) {
+    ref = g_slice_new0 (GstWasapiAecRef);
+    ref->id = g_strdup (id);
+    g_mutex_init (&ref->lock);
+    g_hash_table_insert (refs, ref->id, ref);
+  }
+  ref->refcount++;
+  g_mutex_unlock (&refs_lock);
+
+  return ref;
+}
+
+void
+gst_wasapi_aec_ref_unref (GstWasapiAecRef * ref)
+{
+  gboolean last;
+
+  g_mutex_lock (&refs_lock);
+  last = --ref->refcount == 0;
+  if (last)
+    g_hash_table_remove (refs, ref->id);
+  g_mutex_unlock (&refs_lock);
+
+  if (!last)
+    return;
+
+  g_free (ref->ring);
+  g_mutex_clear (&ref->lock);
+  g_free (ref->id);
+  g_slice_free (GstWasapiAecRef, ref);
+}
+
+gboolean
+gst_wasapi_aec_ref_start (GstWasapiAecRef * ref, GstElement * element,
+    const WAVEFORMATEX * format)
+{
+  guint ring_frames;
+
+  g_mutex_lock (&ref->lock);
+  if (ref->publisher != NULL && ref->publisher != element) {
+    g_mutex_unlock (&ref->lock);
+    GST_WARNING_OBJECT (element, "%" GST_PTR_FORMAT " already publishes the "
+        "echo cancellation reference of %s", ref->publisher, ref->id);
+    return FALSE;
+  }
+
+  ring_frames = 1 << g_bit_storage (format->nSamplesPerSec * 2 - 1);
+  if (ref->ring == NULL || ref->bpf != format->nBlockAlign ||
+      ref->ring_frames != ring_frames) {
+    g_free (ref->ring);
+    ref->ring = g_malloc (ring_frames * format->nBlockAlign);
+    ref->ring_frames = ring_frames;
+  }
+
+  ref->publisher = element;
+  ref->rate = format->nSamplesPerSec;
+  ref->channels = format->nChannels;
+  ref->bpf = format->nBlockAlign;
+  ref->bits = format->wBitsPerSample;
+  ref->write_position = 0;
+  ref->first = 0;
+  ref->n_packets = 0;
+  g_mutex_unlock (&ref->lock);
+
+  GST_INFO_OBJECT (element, "publishing the echo cancellation reference of "
+      "%s", ref->id);
+
+  return TRUE;
+}
+
+void
+gst_wasapi_aec_ref_stop (GstWasapiAecRef * ref, GstElement * element)
+{
+  g_mutex_lock (&ref->lock);
+  if (ref->publisher == element) {
+    ref->publisher = NULL;
+    ref->n_packets = 0;
+  }
+  g_mutex_unlock (&ref->lock);
+}
+
+/* Called with the lock */
+static inline GstWasapiAecRefPacket *
+gst_wasapi_aec_ref_packet (GstWasapiAecRef * ref, guint i)
+{
+  return &ref->packets[(ref->first + i) % N_PACKETS];
+}
+
+/* Called with the lock */
+static inline guint64
+gst_wasapi_aec_ref_packet_end (GstWasapiAecRef * ref,
+    const GstWasapiAecRefPacket * packet)
+{
+  return packet->qpcpos + gst_util_uint64_scale_int (packet->frames,
+      10000000, ref->rate);
+}
+
+void
+gst_wasapi_aec_ref_write (GstWasapiAecRef * ref, const guint8 * data,
+    guint n_frames, guint64 qpcpos)
+{
+  GstWasapiAecRefPacket *last = NULL;
+  guint pos, chunk;
+
+  g_mutex_lock (&ref->lock);
+  if (ref->publisher == NULL || n_frames == 0) {
+    g_mutex_unlock (&ref->lock);
+    return;
+  }
+
+  /* More than the ring can never be read back */
+  if (n_frames > ref->ring_frames) {
+    if (data != NULL)
+      data += (n_frames - ref->ring_frames) * ref->bpf;
+    qpcpos += gst_util_uint64_scale_int (n_frames - ref->ring_frames,
+        10000000, ref->rate);
+    n_frames = ref->ring_frames;
+  }
+
+  pos = ref->write_position & (ref->ring_frames - 1);
+  chunk = MIN (n_frames, ref->ring_frames - pos);
+  if (data != NULL) {
+    memcpy (ref->ring + pos * ref->bpf, data, chunk * ref->bpf);
+    memcpy (ref->ring, data + chunk * ref->bpf,
+        (n_frames - chunk) * ref->bpf);
+  } else {
+    memset (ref->ring + pos * ref->bpf, 0, chunk * ref->bpf);
+    memset (ref->ring, 0, (n_frames - chunk) * ref->bpf);
+  }
+
+  if (ref->n_packets > 0) {
+    guint64 end;
+
+    last = gst_wasapi_aec_ref_packet (ref, ref->n_packets - 1);
+    end = gst_wasapi_aec_ref_packet_end (ref, last);
+    if (last->position + last->frames != ref->write_position ||
+        qpcpos + CONTINUE_TOLERANCE < end || qpcpos > end + CONTINUE_TOLERANCE)
+      last = NULL;
+  }
+
+  if (last != NULL) {
+    last->frames += n_frames;
+  } else {
+    if (ref->n_packets == N_PACKETS) {
+      ref->first = (ref->first + 1) % N_PACKETS;
+      ref->n_packets--;
+    }
+    last = gst_wasapi_aec_ref_packet (ref, ref->n_packets++);
+    last->position = ref->write_position;
+    last->qpcpos = qpcpos;
+    last->frames = n_frames;
+  }
+  ref->write_position += n_frames;
+  g_mutex_unlock (&ref->lock);
+}
+
+void
+gst_wasapi_aec_ref_flush (GstWasapiAecRef * ref, guint64 qpcpos)
+{
+  g_mutex_lock (&ref->lock);
+  while (ref->n_packets > 0) {
+    GstWasapiAecRefPacket *packet =
+        gst_wasapi_aec_ref_packet (ref, ref->n_packets - 1);
+
+    if (packet->qpcpos >= qpcpos) {
+      ref->n_packets--;
+      continue;
+    }
+    if (gst_wasapi_aec_ref_packet_end (ref, packet) > qpcpos)
+      packet->frames = (guint) gst_util_uint64_scale_int (qpcpos -
+          packet->qpcpos, ref->rate, 10000000);
+    break;
+  }
+  g_mutex_unlock (&ref->lock);
+}
+
+/* Called with the lock. The newest packet that plays at @qpcpos, or NULL
+ * and in @next the start of the first one after it, G_MAXUINT64 if none */
+static GstWasapiAecRefPacket *
+gst_wasapi_aec_ref_find (GstWasapiAecRef * ref, guint64 qpcpos,
+    guint64 * next)
+{
+  guint i;
+
+  *next = G_MAXUINT64;
+  for (i = ref->n_packets; i > 0; i--) {
+    GstWasapiAecRefPacket *packet = gst_wasapi_aec_ref_packet (ref, i - 1);
+
+    if (packet->qpcpos > qpcpos) {
+      *next = MIN (*next, packet->qpcpos);
+      continue;
+    }
+    if (gst_wasapi_aec_ref_packet_end (ref, packet) > qpcpos)
+      return packet;
+  }
+
+  return NULL;
+}
+
+gboolean
+gst_wasapi_aec_ref_read (GstWasapiAecRef * ref, const WAVEFORMATEX * format,
+    guint8 * dst, guint n_frames, guint64 qpcpos)
+{
+  guint done = 0;
+
+  g_mutex_lock (&ref->lock);
+  if (ref->publisher == NULL || ref->rate != format->nSamplesPerSec ||
+      ref->channels != format->nChannels || ref->bpf != format->nBlockAlign ||
+      ref->bits != format->wBitsPerSample) {
+    g_mutex_unlock (&ref->lock);
+    return FALSE;
+  }
+
+  while (done < n_frames) {
+    guint64 t = qpcpos + gst_util_uint64_scale_int (done, 10000000, ref->rate);
+    guint64 next, position;
+    GstWasapiAecRefPacket *packet = gst_wasapi_aec_ref_find (ref, t, &next);
+    guint n, offset;
+
+    if (packet == NULL) {
+      /* Nothing played until the next packet starts */
+      n = n_frames - done;
+      if (next != G_MAXUINT64)
+        n = MIN (n, MAX (1, (guint) gst_util_uint64_scale_int (next - t,
+                    ref->rate, 10000000)));
+      memset (dst + done * ref->bpf, 0, n * ref->bpf);
+      done += n;
+      continue;
+    }
+
+    offset = (guint) gst_util_uint64_scale_int_round (t - packet->qpcpos,
+        ref->rate, 10000000);
+    offset = MIN (offset, packet->frames - 1);
+    n = MIN (packet->frames - offset, n_frames - done);
+    position = packet->position + offset;
+
+    /* Overwritten already, the reader is too far behind */
+    if (position + ref->ring_frames < ref->write_position) {
+      memset (dst + done * ref->bpf, 0, n * ref->bpf);
+    } else {
+      guint pos = position & (ref->ring_frames - 1);
+      guint chunk = MIN (n, ref->ring_frames - pos);
+
+      memcpy (dst + done * ref->bpf, ref->ring + pos * ref->bpf,
+          chunk * ref->bpf);
+      memcpy (dst + (done + chunk) * ref->bpf, ref->ring,
+          (n - chunk) * ref->bpf);
+    }
+    done += n;
+  }
+  g_mutex_unlock (&ref->lock);
+
+  return TRUE;
+}
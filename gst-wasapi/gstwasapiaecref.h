@@ -0,0 +1,68 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_AEC_REF_H__
+#define __GST_WASAPI_AEC_REF_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Process-wide echo cancellation reference of a render endpoint, for
+ * wasapisink and a loopback wasapisrc with aec-reference=true.
+ *
+ * The sink publishes each packet it renders, in device channel order,
+ * with the QPC position at which its first frame leaves the speakers,
+ * from the IAudioClock position. The source then takes for each loopback
+ * packet the frames that were played at the capture time of the packet,
+ * so the reference is already aligned with what a microphone captured at
+ * the same time. Where nothing was played it gets silence.
+ *
+ * There is one ring per endpoint, both sides may come first. Only one sink
+ * publishes at a time, that of others is ignored until it stops. */
+typedef struct _GstWasapiAecRef GstWasapiAecRef;
+
+/* The reference of the endpoint @id, created if nobody uses it yet */
+GstWasapiAecRef *gst_wasapi_aec_ref_get (const gchar * id);
+
+void gst_wasapi_aec_ref_unref (GstWasapiAecRef * ref);
+
+/* Makes @element the publisher, FALSE if another one already is */
+gboolean gst_wasapi_aec_ref_start (GstWasapiAecRef * ref,
+    GstElement * element, const WAVEFORMATEX * format);
+
+void gst_wasapi_aec_ref_stop (GstWasapiAecRef * ref, GstElement * element);
+
+/* Appends @n_frames that start playing at @qpcpos (in 100 ns), silence if
+ * @data is NULL */
+void gst_wasapi_aec_ref_write (GstWasapiAecRef * ref, const guint8 * data,
+    guint n_frames, guint64 qpcpos);
+
+/* Forgets what would only be played after @qpcpos, after the client was
+ * reset and dropped it */
+void gst_wasapi_aec_ref_flush (GstWasapiAecRef * ref, guint64 qpcpos);
+
+/* Copies the @n_frames of @format that were played from @qpcpos on to
+ * @dst. FALSE and @dst untouched if nothing is published in @format, i.e.
+ * the caller keeps what it has. */
+gboolean gst_wasapi_aec_ref_read (GstWasapiAecRef * ref,
+    const WAVEFORMATEX * format, guint8 * dst, guint n_frames,
+    guint64 qpcpos);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_AEC_REF_H__ */
@@ -0,0 +1,1009 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/**
+ * SECTION:element-wasapiaggregatesink
+ * @title: wasapiaggregatesink
+ *
+ * Renders one stream to several endpoints at once and keeps them in sync,
+ * for multi-zone playback or a multichannel stream spread over several
+ * devices.
+ *
+ * With split=true, the first endpoint gets the first channels of the input,
+ * the next one the channels after them and so on. Otherwise every endpoint
+ * gets the same channels.
+ *
+ * All endpoints are serviced by one render thread instead of a wasapisink
+ * and its MMCSS thread each. The first endpoint is the master, it gets the
+ * input as is. Every other one has a drift estimator and a resampler that
+ * slave it to the master: the IAudioClock positions of both tell where a
+ * frame that the master plays at some time has to go in the stream of the
+ * endpoint, and the resampler converges on that. Offsets it can't take
+ * care of quickly, like at the start or after an underrun, are fixed by
+ * inserting silence or dropping frames once. Endpoints in the container of
+ * the master, like the other outputs of the same interface, run off its
+ * clock and get the input as is too, only lined up once.
+ *
+ * ## Example pipelines
+ * |[
+ * gst-launch-1.0 -v audiotestsrc ! audioconvert ! audio/x-raw,channels=4 ! wasapiaggregatesink devices="{id1},{id2}"
+ * ]| Play the front channels on one device and the rear ones on another.
+ *
+ * |[
+ * gst-launch-1.0 -v filesrc location=music.ogg ! decodebin ! audioconvert ! audioresample ! wasapiaggregatesink devices="{id1},{id2},{id3}" split=false
+ * ]| Play the same stream in three rooms.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "gstwasapiaggregatesink.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_wasapi_aggregate_sink_debug);
+#define GST_CAT_DEFAULT gst_wasapi_aggregate_sink_debug
+
+#define DEFAULT_DEVICES       "default"
+#define DEFAULT_CHANNELS      2
+#define DEFAULT_SPLIT         TRUE
+#define DEFAULT_LATENCY_TIME  10000
+#define DEFAULT_BUFFER_TIME   200000
+
+/* The stop and wake handles take the other two */
+#define MAX_OUTPUTS (MAXIMUM_WAIT_OBJECTS - 2)
+
+/* Offsets above these are fixed by a step instead of the resampler. Small
+ * while the endpoints settle after the start, so they begin in sync. */
+#define SETTLE_TIME (G_USEC_PER_SEC)
+#define SETTLE_THRESHOLD (2 * GST_MSECOND)
+#define STEP_THRESHOLD (20 * GST_MSECOND)
+
+/* Added to the capture times of the resamplers, whose output timelines
+ * must not start before 0 */
+#define TIMELINE_BASE (GST_SECOND)
+
+enum
+{
+  PROP_0,
+  PROP_DEVICES,
+  PROP_CHANNELS,
+  PROP_SPLIT,
+  PROP_LATENCY_TIME,
+  PROP_BUFFER_TIME
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) " GST_AUDIO_NE (F32) ", "
+        "layout = (string) interleaved, "
+        "rate = " GST_AUDIO_RATE_RANGE ", "
+        "channels = " GST_AUDIO_CHANNELS_RANGE));
+
+static void gst_wasapi_aggregate_sink_finalize (GObject * object);
+static void gst_wasapi_aggregate_sink_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_wasapi_aggregate_sink_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstCaps *gst_wasapi_aggregate_sink_get_caps (GstBaseSink * bsink,
+    GstCaps * filter);
+static gboolean gst_wasapi_aggregate_sink_set_caps (GstBaseSink * bsink,
+    GstCaps * caps);
+static gboolean gst_wasapi_aggregate_sink_stop (GstBaseSink * bsink);
+static gboolean gst_wasapi_aggregate_sink_unlock (GstBaseSink * bsink);
+static gboolean gst_wasapi_aggregate_sink_unlock_stop (GstBaseSink * bsink);
+static gboolean gst_wasapi_aggregate_sink_event (GstBaseSink * bsink,
+    GstEvent * event);
+static GstFlowReturn gst_wasapi_aggregate_sink_render (GstBaseSink * bsink,
+    GstBuffer * buffer);
+
+#define gst_wasapi_aggregate_sink_parent_class parent_class
+G_DEFINE_TYPE (GstWasapiAggregateSink, gst_wasapi_aggregate_sink,
+    GST_TYPE_BASE_SINK);
+
+static void
+gst_wasapi_aggregate_sink_class_init (GstWasapiAggregateSinkClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSinkClass *gstbasesink_class = GST_BASE_SINK_CLASS (klass);
+
+  gobject_class->finalize = gst_wasapi_aggregate_sink_finalize;
+  gobject_class->set_property = gst_wasapi_aggregate_sink_set_property;
+  gobject_class->get_property = gst_wasapi_aggregate_sink_get_property;
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICES,
+      g_param_spec_string ("devices", "Devices",
+          "Comma separated render endpoints: a device ID, or \"default\" for "
+          "the default render device. The first one is the master the others "
+          "follow. Takes effect when the caps are set", DEFAULT_DEVICES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNELS,
+      g_param_spec_int ("channels", "Channels",
+          "Channels of each endpoint, the audio engine mixes up or down to "
+          "what the device has", 1, 8, DEFAULT_CHANNELS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SPLIT,
+      g_param_spec_boolean ("split", "Split",
+          "Split the channels of the input over the endpoints, in the order of "
+          "devices, instead of playing the same ones everywhere",
+          DEFAULT_SPLIT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LATENCY_TIME,
+      g_param_spec_uint64 ("latency-time", "Latency time",
+          "How much is queued before the endpoints start, in microseconds",
+          1000, G_MAXUINT64, DEFAULT_LATENCY_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_BUFFER_TIME,
+      g_param_spec_uint64 ("buffer-time", "Buffer time",
+          "How much may be queued for each endpoint at most, in microseconds",
+          1000, G_MAXUINT64, DEFAULT_BUFFER_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (gstelement_class,
+      &sink_template);
+  gst_element_class_set_static_metadata (gstelement_class,
+      "WasapiAggregateSink", "Sink/Audio",
+      "Render to several audio endpoints in sync through WASAPI", "Bebo");
+
+  gstbasesink_class->get_caps =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_get_caps);
+  gstbasesink_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_set_caps);
+  gstbasesink_class->stop = GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_stop);
+  gstbasesink_class->unlock =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_unlock);
+  gstbasesink_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_unlock_stop);
+  gstbasesink_class->event =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_event);
+  gstbasesink_class->render =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_sink_render);
+
+  GST_DEBUG_CATEGORY_INIT (gst_wasapi_aggregate_sink_debug,
+      "wasapiaggregatesink", 0, "Windows audio session API aggregate sink");
+}
+
+static void
+gst_wasapi_aggregate_output_free (GstWasapiAggregateOutput * output)
+{
+  if (output->client != NULL)
+    IAudioClient_Stop (output->client);
+  if (output->client_clock != NULL)
+    IUnknown_Release (output->client_clock);
+  if (output->render_client != NULL)
+    IUnknown_Release (output->render_client);
+  if (output->client != NULL)
+    IUnknown_Release (output->client);
+  if (output->device != NULL)
+    IUnknown_Release (output->device);
+  if (output->client_event != NULL)
+    CloseHandle (output->client_event);
+  if (output->resampler != NULL)
+    gst_wasapi_resampler_free (output->resampler);
+  if (output->drift != NULL)
+    gst_wasapi_drift_free (output->drift);
+  g_object_unref (output->queue);
+  g_free (output->container_id);
+  g_free (output->name);
+  g_slice_free (GstWasapiAggregateOutput, output);
+}
+
+static void
+gst_wasapi_aggregate_sink_init (GstWasapiAggregateSink * self)
+{
+  self->stop_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  self->wake_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  self->outputs = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      gst_wasapi_aggregate_output_free);
+
+  self->devices = g_strsplit (DEFAULT_DEVICES, ",", -1);
+  self->channels = DEFAULT_CHANNELS;
+  self->split = DEFAULT_SPLIT;
+  self->latency_time = DEFAULT_LATENCY_TIME;
+  self->buffer_time = DEFAULT_BUFFER_TIME;
+}
+
+static void
+gst_wasapi_aggregate_sink_finalize (GObject * object)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (object);
+
+  g_ptr_array_unref (self->outputs);
+  CloseHandle (self->stop_handle);
+  CloseHandle (self->wake_handle);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_strfreev (self->devices);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_wasapi_aggregate_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (object);
+
+  switch (prop_id) {
+    case PROP_DEVICES:
+    {
+      const gchar *list = g_value_get_string (value);
+      GPtrArray *array = g_ptr_array_new ();
+
+      if (list != NULL) {
+        gchar **split = g_strsplit (list, ",", -1);
+        gint i;
+
+        for (i = 0; split[i] != NULL; i++) {
+          g_strstrip (split[i]);
+          if (*split[i] != '\0')
+            g_ptr_array_add (array, g_strdup (split[i]));
+        }
+        g_strfreev (split);
+      }
+      g_ptr_array_add (array, NULL);
+
+      GST_OBJECT_LOCK (self);
+      g_strfreev (self->devices);
+      self->devices = (gchar **) g_ptr_array_free (array, FALSE);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    }
+    case PROP_CHANNELS:
+      self->channels = g_value_get_int (value);
+      break;
+    case PROP_SPLIT:
+      self->split = g_value_get_boolean (value);
+      break;
+    case PROP_LATENCY_TIME:
+      self->latency_time = g_value_get_uint64 (value);
+      break;
+    case PROP_BUFFER_TIME:
+      self->buffer_time = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_aggregate_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (object);
+
+  switch (prop_id) {
+    case PROP_DEVICES:
+      GST_OBJECT_LOCK (self);
+      g_value_take_string (value, g_strjoinv (",", self->devices));
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHANNELS:
+      g_value_set_int (value, self->channels);
+      break;
+    case PROP_SPLIT:
+      g_value_set_boolean (value, self->split);
+      break;
+    case PROP_LATENCY_TIME:
+      g_value_set_uint64 (value, self->latency_time);
+      break;
+    case PROP_BUFFER_TIME:
+      g_value_set_uint64 (value, self->buffer_time);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Input channels for @n_devices endpoints */
+static gint
+gst_wasapi_aggregate_sink_input_channels (GstWasapiAggregateSink * self,
+    guint n_devices)
+{
+  return self->split ? self->channels * n_devices : self->channels;
+}
+
+static GstCaps *
+gst_wasapi_aggregate_sink_get_caps (GstBaseSink * bsink, GstCaps * filter)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+  GstCaps *caps;
+  guint n_devices;
+  gint channels;
+
+  GST_OBJECT_LOCK (self);
+  n_devices = self->devices ? g_strv_length (self->devices) : 0;
+  GST_OBJECT_UNLOCK (self);
+
+  caps = gst_pad_get_pad_template_caps (bsink->sinkpad);
+  channels = gst_wasapi_aggregate_sink_input_channels (self, n_devices);
+  if (n_devices > 0 && channels <= 64) {
+    caps = gst_caps_make_writable (caps);
+    gst_caps_set_simple (caps, "channels", G_TYPE_INT, channels, NULL);
+  }
+
+  if (filter) {
+    GstCaps *filtered =
+        gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = filtered;
+  }
+
+  return caps;
+}
+
+static inline guint
+gst_wasapi_aggregate_output_queued (GstWasapiAggregateSink * self,
+    GstWasapiAggregateOutput * output)
+{
+  return gst_adapter_available (output->queue) /
+      GST_AUDIO_INFO_BPF (&self->output_info);
+}
+
+/* Called with the lock. The stream frame the next queued one will be. */
+static inline guint64
+gst_wasapi_aggregate_output_next (GstWasapiAggregateSink * self,
+    GstWasapiAggregateOutput * output)
+{
+  return output->frames_written + gst_wasapi_aggregate_output_queued (self,
+      output);
+}
+
+/* Called with the lock. Drops the oldest @n_frames of the queue, what comes
+ * after them plays earlier now. */
+static void
+gst_wasapi_aggregate_output_trim (GstWasapiAggregateSink * self,
+    GstWasapiAggregateOutput * output, guint n_frames)
+{
+  n_frames = MIN (n_frames, gst_wasapi_aggregate_output_queued (self,
+          output));
+  gst_adapter_flush (output->queue, n_frames *
+      GST_AUDIO_INFO_BPF (&self->output_info));
+  output->offset -= n_frames;
+}
+
+/* Opens "<device id>|default" and initializes the client to take the
+ * output format, NULL on errors. @master is NULL for the master itself. */
+static GstWasapiAggregateOutput *
+gst_wasapi_aggregate_output_open (GstWasapiAggregateSink * self,
+    const gchar * entry, GstWasapiAggregateOutput * master)
+{
+  GstWasapiAggregateOutput *output;
+  GstAudioRingBufferSpec spec;
+  WAVEFORMATEX *mix_format = NULL, *format;
+  wchar_t *strid = NULL;
+  guint devicep_frames;
+  gboolean ok;
+  HRESULT hr;
+
+  output = g_slice_new0 (GstWasapiAggregateOutput);
+  output->name = g_strdup (entry);
+  output->queue = gst_adapter_new ();
+  output->client_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+
+  if (g_strcmp0 (entry, "default") != 0)
+    strid = g_utf8_to_utf16 (entry, -1, NULL, NULL, NULL);
+
+  ok = gst_wasapi_util_get_device_client (GST_ELEMENT (self), eRender,
+      eConsole, strid, &output->device, &output->client);
+  g_free (strid);
+  if (!ok)
+    goto failed;
+  output->container_id = gst_wasapi_util_get_container_id (output->device);
+
+  /* Only for the channel mask, which the engine maps to ours */
+  hr = IAudioClient_GetMixFormat (output->client, &mix_format);
+  HR_FAILED_AND (hr, IAudioClient::GetMixFormat, goto failed);
+  format = gst_wasapi_util_audio_info_to_waveformatex (&self->output_info,
+      mix_format);
+  CoTaskMemFree (mix_format);
+
+  memset (&spec, 0, sizeof (spec));
+  spec.info = self->output_info;
+  spec.latency_time = self->latency_time;
+  spec.buffer_time = self->buffer_time;
+  ok = gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), &spec,
+      output->device, &output->client, format, AUDCLNT_SHAREMODE_SHARED,
+      FALSE, FALSE, TRUE, FALSE, &devicep_frames);
+  CoTaskMemFree (format);
+  if (!ok)
+    goto failed;
+
+  hr = IAudioClient_GetBufferSize (output->client, &output->buffer_frames);
+  HR_FAILED_AND (hr, IAudioClient::GetBufferSize, goto failed);
+  output->period_frames = MAX (MIN (devicep_frames, output->buffer_frames),
+      1);
+  hr = IAudioClient_SetEventHandle (output->client, output->client_event);
+  HR_FAILED_AND (hr, IAudioClient::SetEventHandle, goto failed);
+
+  if (!gst_wasapi_util_get_render_client (GST_ELEMENT (self), output->client,
+          &output->render_client))
+    goto failed;
+  if (!gst_wasapi_util_get_clock (GST_ELEMENT (self), output->client,
+          &output->client_clock))
+    goto failed;
+  hr = IAudioClock_GetFrequency (output->client_clock, &output->clock_freq);
+  HR_FAILED_AND (hr, IAudioClock::GetFrequency, goto failed);
+
+  output->drift = gst_wasapi_drift_new (GST_AUDIO_INFO_RATE (&self->info));
+  /* In the container of the master it runs off the same clock, and only
+   * needs to start in the right place */
+  output->clock_locked = master != NULL && output->container_id != NULL &&
+      g_strcmp0 (output->container_id, master->container_id) == 0;
+  if (master != NULL && !output->clock_locked) {
+    output->resampler = gst_wasapi_resampler_new (&self->output_info);
+    if (output->resampler == NULL)
+      goto failed;
+    output->resampler_latency =
+        gst_wasapi_resampler_get_latency (output->resampler);
+  }
+
+  GST_INFO_OBJECT (self, "opened %s%s, device period %u frames, buffer %u "
+      "frames", entry, master == NULL ? " as the master" :
+      output->clock_locked ? " on the clock of the master" : "",
+      devicep_frames, output->buffer_frames);
+
+  return output;
+
+failed:
+  GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+      ("Failed to open %s", entry));
+  gst_wasapi_aggregate_output_free (output);
+  return NULL;
+}
+
+/* Called with the lock from the render thread. Moves what is queued for
+ * @output to its client, and tops it up with silence to a device period
+ * once it runs. */
+static gboolean
+gst_wasapi_aggregate_output_fill (GstWasapiAggregateSink * self,
+    GstWasapiAggregateOutput * output)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->output_info);
+  guint32 padding, n_frames, silence = 0;
+  UINT64 pos, qpcpos;
+  BYTE *dst;
+  HRESULT hr;
+
+  hr = IAudioClient_GetCurrentPadding (output->client, &padding);
+  HR_FAILED_RET (hr, IAudioClient::GetCurrentPadding, FALSE);
+
+  n_frames = MIN (output->buffer_frames - padding,
+      gst_wasapi_aggregate_output_queued (self, output));
+  if (self->started && padding + n_frames < output->period_frames)
+    silence = output->period_frames - padding - n_frames;
+
+  if (n_frames + silence > 0) {
+    hr = IAudioRenderClient_GetBuffer (output->render_client,
+        n_frames + silence, &dst);
+    HR_FAILED_RET (hr, IAudioRenderClient::GetBuffer, FALSE);
+
+    gst_adapter_copy (output->queue, dst, 0, n_frames * bpf);
+    gst_adapter_flush (output->queue, n_frames * bpf);
+    memset (dst + n_frames * bpf, 0, silence * bpf);
+
+    hr = IAudioRenderClient_ReleaseBuffer (output->render_client,
+        n_frames + silence, n_frames == 0 ? AUDCLNT_BUFFERFLAGS_SILENT : 0);
+    HR_FAILED_RET (hr, IAudioRenderClient::ReleaseBuffer, FALSE);
+
+    output->frames_written += n_frames + silence;
+    if (silence > 0) {
+      /* Everything queued after it plays that much later */
+      output->silence_frames += silence;
+      output->offset += silence;
+      GST_LOG_OBJECT (self, "%s underran, %u frames of silence",
+          output->name, silence);
+    }
+  }
+
+  hr = IAudioClock_GetPosition (output->client_clock, &pos, &qpcpos);
+  if (SUCCEEDED (hr) && pos > 0) {
+    output->devpos = gst_util_uint64_scale (pos,
+        GST_AUDIO_INFO_RATE (&self->output_info), output->clock_freq);
+    output->qpcpos = qpcpos;
+    output->position_valid = TRUE;
+    gst_wasapi_drift_push (output->drift, output->devpos, qpcpos * 100);
+  }
+
+  return TRUE;
+}
+
+/* Called with the lock from the render thread. Starts all clients on what
+ * is queued, as close together as we can. */
+static gboolean
+gst_wasapi_aggregate_sink_start_outputs (GstWasapiAggregateSink * self)
+{
+  guint i;
+  HRESULT hr;
+
+  for (i = 0; i < self->outputs->len; i++)
+    if (!gst_wasapi_aggregate_output_fill (self,
+            g_ptr_array_index (self->outputs, i)))
+      return FALSE;
+
+  for (i = 0; i < self->outputs->len; i++) {
+    GstWasapiAggregateOutput *output = g_ptr_array_index (self->outputs, i);
+
+    hr = IAudioClient_Start (output->client);
+    HR_FAILED_RET (hr, IAudioClient::Start, FALSE);
+  }
+
+  self->started = TRUE;
+  self->start_time = g_get_monotonic_time ();
+  GST_INFO_OBJECT (self, "started %u endpoints", self->outputs->len);
+
+  return TRUE;
+}
+
+static gpointer
+gst_wasapi_aggregate_sink_thread_func (gpointer user_data)
+{
+  GstWasapiAggregateSink *self = user_data;
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  HANDLE priority_handle;
+  guint i, n_handles = 2;
+  DWORD res;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  priority_handle =
+      gst_wasapi_util_set_thread_characteristics (GST_WASAPI_DEFAULT_MMCSS_TASK,
+      GST_WASAPI_MMCSS_PRIORITY_NORMAL);
+
+  handles[0] = self->stop_handle;
+  handles[1] = self->wake_handle;
+  for (i = 0; i < self->outputs->len; i++) {
+    GstWasapiAggregateOutput *output = g_ptr_array_index (self->outputs, i);
+
+    handles[n_handles++] = output->client_event;
+  }
+
+  for (;;) {
+    gboolean ok = TRUE;
+
+    res = WaitForMultipleObjects (n_handles, handles, FALSE, INFINITE);
+    if (res == WAIT_OBJECT_0)
+      break;
+    if (res >= WAIT_OBJECT_0 + n_handles) {
+      GST_ERROR_OBJECT (self, "Error waiting for the render events: %x",
+          (guint) res);
+      ok = FALSE;
+    }
+
+    g_mutex_lock (&self->lock);
+    if (!ok) {
+      /* Already failed */
+    } else if (!self->started) {
+      GstWasapiAggregateOutput *master = g_ptr_array_index (self->outputs, 0);
+
+      if (self->draining || gst_wasapi_aggregate_output_queued (self,
+              master) >= self->start_frames)
+        ok = gst_wasapi_aggregate_sink_start_outputs (self);
+    } else {
+      /* Any event is a good time to serve all of them */
+      for (i = 0; ok && i < self->outputs->len; i++)
+        ok = gst_wasapi_aggregate_output_fill (self,
+            g_ptr_array_index (self->outputs, i));
+    }
+    if (!ok)
+      self->failed = TRUE;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->lock);
+
+    if (!ok)
+      break;
+  }
+
+  if (priority_handle != NULL)
+    gst_wasapi_util_revert_thread_characteristics (priority_handle);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static void
+gst_wasapi_aggregate_sink_close (GstWasapiAggregateSink * self)
+{
+  guint i;
+
+  if (self->thread != NULL) {
+    SetEvent (self->stop_handle);
+    g_thread_join (self->thread);
+    self->thread = NULL;
+    ResetEvent (self->stop_handle);
+  }
+
+  for (i = 0; i < self->outputs->len; i++) {
+    GstWasapiAggregateOutput *output = g_ptr_array_index (self->outputs, i);
+
+    if (output->silence_frames > 0)
+      GST_INFO_OBJECT (self, "%s underran by %" G_GUINT64_FORMAT " frames",
+          output->name, output->silence_frames);
+  }
+  g_ptr_array_set_size (self->outputs, 0);
+  self->started = FALSE;
+  self->failed = FALSE;
+  self->draining = FALSE;
+}
+
+static gboolean
+gst_wasapi_aggregate_sink_set_caps (GstBaseSink * bsink, GstCaps * caps)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+  GstAudioInfo info;
+  GstClockTime delay;
+  gchar **devices;
+  guint i, n_devices, buffer_frames = 0;
+  gint rate;
+
+  if (!gst_audio_info_from_caps (&info, caps))
+    return FALSE;
+
+  if (self->outputs->len > 0 && gst_audio_info_is_equal (&info, &self->info))
+    return TRUE;
+
+  gst_wasapi_aggregate_sink_close (self);
+
+  GST_OBJECT_LOCK (self);
+  devices = g_strdupv (self->devices);
+  GST_OBJECT_UNLOCK (self);
+
+  n_devices = devices ? g_strv_length (devices) : 0;
+  if (n_devices == 0 || n_devices > MAX_OUTPUTS) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS, (NULL),
+        ("Need 1 to %u endpoints in devices, not %u", MAX_OUTPUTS,
+            n_devices));
+    goto failed;
+  }
+  if (GST_AUDIO_INFO_CHANNELS (&info) !=
+      gst_wasapi_aggregate_sink_input_channels (self, n_devices)) {
+    GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+        ("%d channels don't fit %u endpoints of %d channels",
+            GST_AUDIO_INFO_CHANNELS (&info), n_devices, self->channels));
+    goto failed;
+  }
+
+  rate = GST_AUDIO_INFO_RATE (&info);
+  self->info = info;
+  gst_audio_info_set_format (&self->output_info, GST_AUDIO_FORMAT_F32, rate,
+      self->channels, NULL);
+  self->start_frames = MAX (gst_util_uint64_scale_int (self->latency_time,
+          rate, G_USEC_PER_SEC), 1);
+  self->max_frames = MAX (gst_util_uint64_scale_int (self->buffer_time,
+          rate, G_USEC_PER_SEC), self->start_frames);
+
+  for (i = 0; i < n_devices; i++) {
+    GstWasapiAggregateOutput *output =
+        gst_wasapi_aggregate_output_open (self, devices[i],
+        i == 0 ? NULL : g_ptr_array_index (self->outputs, 0));
+
+    if (output == NULL)
+      goto failed;
+    g_ptr_array_add (self->outputs, output);
+    buffer_frames = MAX (buffer_frames, output->buffer_frames);
+  }
+  g_strfreev (devices);
+
+  /* What waits in the queue and in the client before it plays */
+  delay = gst_util_uint64_scale_int (self->start_frames + buffer_frames,
+      GST_SECOND, rate);
+  gst_base_sink_set_render_delay (bsink, delay);
+
+  self->thread = g_thread_new ("wasapi-aggregate",
+      gst_wasapi_aggregate_sink_thread_func, self);
+
+  return TRUE;
+
+failed:
+  g_ptr_array_set_size (self->outputs, 0);
+  g_strfreev (devices);
+  return FALSE;
+}
+
+static gboolean
+gst_wasapi_aggregate_sink_stop (GstBaseSink * bsink)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+
+  gst_wasapi_aggregate_sink_close (self);
+  gst_audio_info_init (&self->info);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_aggregate_sink_unlock (GstBaseSink * bsink)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+
+  g_mutex_lock (&self->lock);
+  self->flushing = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_aggregate_sink_unlock_stop (GstBaseSink * bsink)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+  guint i;
+
+  /* Whatever comes next starts over, the clients keep running on silence */
+  g_mutex_lock (&self->lock);
+  self->flushing = FALSE;
+  self->draining = FALSE;
+  for (i = 0; i < self->outputs->len; i++) {
+    GstWasapiAggregateOutput *output = g_ptr_array_index (self->outputs, i);
+
+    gst_wasapi_aggregate_output_trim (self, output, G_MAXUINT);
+    output->resampler_started = FALSE;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_aggregate_sink_event (GstBaseSink * bsink, GstEvent * event)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && self->outputs->len > 0) {
+    guint i;
+
+    /* Play out what is queued, also when it was too short to start */
+    g_mutex_lock (&self->lock);
+    self->draining = TRUE;
+    SetEvent (self->wake_handle);
+    for (i = 0; i < self->outputs->len && !self->flushing && !self->failed;) {
+      if (gst_wasapi_aggregate_output_queued (self,
+              g_ptr_array_index (self->outputs, i)) > 0)
+        g_cond_wait (&self->cond, &self->lock);
+      else
+        i++;
+    }
+    g_mutex_unlock (&self->lock);
+  }
+
+  return GST_BASE_SINK_CLASS (parent_class)->event (bsink, event);
+}
+
+/* Copies the channels of endpoint @index out of @in */
+static GstBuffer *
+gst_wasapi_aggregate_sink_extract (GstWasapiAggregateSink * self,
+    const gfloat * in, guint n_frames, guint index)
+{
+  gint in_channels = GST_AUDIO_INFO_CHANNELS (&self->info);
+  gint channels = self->channels;
+  GstBuffer *buf;
+  GstMapInfo map;
+  gfloat *out;
+  guint f;
+  gint c;
+
+  buf = gst_buffer_new_allocate (NULL, n_frames *
+      GST_AUDIO_INFO_BPF (&self->output_info), NULL);
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  out = (gfloat *) map.data;
+  if (in_channels == channels) {
+    memcpy (out, in, map.size);
+  } else {
+    in += index * channels;
+    for (f = 0; f < n_frames; f++)
+      for (c = 0; c < channels; c++)
+        out[f * channels + c] = in[f * in_channels + c];
+  }
+  gst_buffer_unmap (buf, &map);
+
+  return buf;
+}
+
+/* Called with the lock. The stream frame of @output at which the frame the
+ * master gets at @master_next has to be, for both to play it at the same
+ * time. */
+static gint64
+gst_wasapi_aggregate_output_target (GstWasapiAggregateSink * self,
+    GstWasapiAggregateOutput * master, GstWasapiAggregateOutput * output,
+    guint64 master_next)
+{
+  gdouble qpc_diff;
+
+  /* They all started together on nothing but what was queued */
+  if (!master->position_valid || !output->position_valid)
+    return (gint64) master_next;
+
+  qpc_diff = (gdouble) ((gint64) master->qpcpos - (gint64) output->qpcpos);
+  return (gint64) output->devpos + ((gint64) master_next -
+      (gint64) master->devpos) + (gint64) (qpc_diff *
+      GST_AUDIO_INFO_RATE (&self->output_info) / 1e7);
+}
+
+/* Called with the lock. Queues the resampled @buf for @output, where its
+ * first frame goes to stream frame @target when @discont and right after
+ * the queue otherwise. */
+static void
+gst_wasapi_aggregate_output_queue (GstWasapiAggregateSink * self,
+    GstWasapiAggregateOutput * output, GstBuffer * buf, gboolean discont)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->output_info);
+  gint64 target, next;
+
+  if (discont) {
+    target = (gint64) gst_util_uint64_scale_int_round (GST_BUFFER_PTS (buf),
+        GST_AUDIO_INFO_RATE (&self->output_info), GST_SECOND) -
+        (gint64) gst_util_uint64_scale_int_round (TIMELINE_BASE,
+        GST_AUDIO_INFO_RATE (&self->output_info), GST_SECOND) +
+        output->offset;
+    next = (gint64) gst_wasapi_aggregate_output_next (self, output);
+
+    if (target > next) {
+      GstBuffer *silence = gst_buffer_new_allocate (NULL,
+          (target - next) * bpf, NULL);
+
+      gst_buffer_memset (silence, 0, 0, (target - next) * bpf);
+      gst_adapter_push (output->queue, silence);
+    } else if (target < next) {
+      gsize size = gst_buffer_get_size (buf);
+      gsize skip = MIN ((gsize) (next - target) * bpf, size);
+
+      buf = gst_buffer_copy_region (buf, GST_BUFFER_COPY_ALL, skip,
+          size - skip);
+    } else {
+      gst_buffer_ref (buf);
+    }
+    GST_DEBUG_OBJECT (self, "stepped %s by %" G_GINT64_FORMAT " frames",
+        output->name, target - next);
+  } else {
+    gst_buffer_ref (buf);
+  }
+
+  gst_adapter_push (output->queue, buf);
+
+  /* Nobody takes from a stalled endpoint */
+  if (gst_wasapi_aggregate_output_queued (self, output) > 2 * self->max_frames)
+    gst_wasapi_aggregate_output_trim (self, output,
+        gst_wasapi_aggregate_output_queued (self, output) - self->max_frames);
+}
+
+static GstFlowReturn
+gst_wasapi_aggregate_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
+{
+  GstWasapiAggregateSink *self = GST_WASAPI_AGGREGATE_SINK (bsink);
+  GstWasapiAggregateOutput *master;
+  GstBuffer *bufs[MAX_OUTPUTS];
+  gint64 targets[MAX_OUTPUTS];
+  gboolean discont[MAX_OUTPUTS];
+  GstClockTime threshold;
+  GstMapInfo map;
+  guint64 master_next;
+  gdouble master_ppm = 0;
+  gboolean master_ppm_valid;
+  guint i, n_frames;
+  gint rate = GST_AUDIO_INFO_RATE (&self->info);
+
+  if (self->outputs->len == 0)
+    return GST_FLOW_NOT_NEGOTIATED;
+  master = g_ptr_array_index (self->outputs, 0);
+
+  g_mutex_lock (&self->lock);
+  while (!self->flushing && !self->failed &&
+      gst_wasapi_aggregate_output_queued (self, master) >= self->max_frames)
+    g_cond_wait (&self->cond, &self->lock);
+  if (self->flushing) {
+    g_mutex_unlock (&self->lock);
+    return GST_FLOW_FLUSHING;
+  }
+  if (self->failed) {
+    g_mutex_unlock (&self->lock);
+    GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
+        ("Failed to render to the endpoints"));
+    return GST_FLOW_ERROR;
+  }
+
+  master_next = gst_wasapi_aggregate_output_next (self, master);
+  threshold = self->started && g_get_monotonic_time () - self->start_time >=
+      SETTLE_TIME ? STEP_THRESHOLD : SETTLE_THRESHOLD;
+  for (i = 1; i < self->outputs->len; i++) {
+    GstWasapiAggregateOutput *output = g_ptr_array_index (self->outputs, i);
+    gint64 error;
+
+    targets[i] = gst_wasapi_aggregate_output_target (self, master, output,
+        master_next);
+    /* Where the first frame would go when it only continues the queue */
+    error = targets[i] - (gint64) (gst_wasapi_aggregate_output_next (self,
+            output) + output->resampler_latency);
+    discont[i] = !output->resampler_started ||
+        (GstClockTime) gst_util_uint64_scale_int (ABS (error), GST_SECOND,
+        rate) > threshold;
+    /* On the timeline of the resampler */
+    targets[i] -= output->offset;
+    if (discont[i] && output->resampler_started)
+      GST_INFO_OBJECT (self, "%s is off by %" G_GINT64_FORMAT " frames",
+          output->name, error);
+  }
+  g_mutex_unlock (&self->lock);
+
+  /* The heavy part without the lock, the render thread waits for it */
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  n_frames = map.size / GST_AUDIO_INFO_BPF (&self->info);
+  for (i = 0; i < self->outputs->len; i++)
+    bufs[i] = gst_wasapi_aggregate_sink_extract (self,
+        (const gfloat *) map.data, n_frames, self->split ? i : 0);
+  gst_buffer_unmap (buffer, &map);
+
+  master_ppm_valid = gst_wasapi_drift_get_ppm (master->drift, &master_ppm);
+  for (i = 1; i < self->outputs->len; i++) {
+    GstWasapiAggregateOutput *output = g_ptr_array_index (self->outputs, i);
+    GstClockTime capture_time;
+    gdouble ppm;
+
+    capture_time = gst_util_uint64_scale_int (MAX (targets[i], 0), GST_SECOND,
+        rate) + TIMELINE_BASE;
+    if (output->clock_locked) {
+      /* Continues the queue as is, the timeline of a resampler that
+       * doesn't resample */
+      GST_BUFFER_PTS (bufs[i]) = capture_time;
+      output->resampler_started = TRUE;
+      continue;
+    }
+
+    /* The endpoint consumes that much faster than the master, so it needs
+     * more frames than it gets */
+    if (master_ppm_valid && gst_wasapi_drift_get_ppm (output->drift, &ppm))
+      gst_wasapi_resampler_set_rate_hint (output->resampler,
+          -(ppm - master_ppm));
+
+    if (discont[i])
+      GST_BUFFER_FLAG_SET (bufs[i], GST_BUFFER_FLAG_DISCONT);
+    bufs[i] = gst_wasapi_resampler_process (output->resampler, bufs[i],
+        capture_time);
+    output->resampler_started = TRUE;
+    /* A restart of its own after a large error */
+    discont[i] |= GST_BUFFER_FLAG_IS_SET (bufs[i], GST_BUFFER_FLAG_DISCONT);
+  }
+
+  g_mutex_lock (&self->lock);
+  gst_adapter_push (master->queue, bufs[0]);
+  for (i = 1; i < self->outputs->len; i++) {
+    gst_wasapi_aggregate_output_queue (self, g_ptr_array_index (self->outputs,
+            i), bufs[i], discont[i]);
+    gst_buffer_unref (bufs[i]);
+  }
+  if (!self->started)
+    SetEvent (self->wake_handle);
+  g_mutex_unlock (&self->lock);
+
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,125 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef __GST_WASAPI_AGGREGATE_SINK_H__
+#define __GST_WASAPI_AGGREGATE_SINK_H__
+
+#include <gst/base/gstbasesink.h>
+#include <gst/base/gstadapter.h>
+
+#include "gstwasapiutil.h"
+#include "gstwasapiresampler.h"
+#include "gstwasapidrift.h"
+
+G_BEGIN_DECLS
+#define GST_TYPE_WASAPI_AGGREGATE_SINK \
+  (gst_wasapi_aggregate_sink_get_type ())
+#define GST_WASAPI_AGGREGATE_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_WASAPI_AGGREGATE_SINK, GstWasapiAggregateSink))
+#define GST_WASAPI_AGGREGATE_SINK_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_WASAPI_AGGREGATE_SINK, GstWasapiAggregateSinkClass))
+#define GST_IS_WASAPI_AGGREGATE_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_WASAPI_AGGREGATE_SINK))
+#define GST_IS_WASAPI_AGGREGATE_SINK_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_WASAPI_AGGREGATE_SINK))
+typedef struct _GstWasapiAggregateSink GstWasapiAggregateSink;
+typedef struct _GstWasapiAggregateSinkClass GstWasapiAggregateSinkClass;
+
+/* One endpoint of wasapiaggregatesink. render() queues its channels, the
+ * render thread moves them to the client. Stream frames count everything
+ * the client got, silence included, from the start of the client on. */
+typedef struct
+{
+  gchar *name;
+  IMMDevice *device;
+  IAudioClient *client;
+  IAudioRenderClient *render_client;
+  IAudioClock *client_clock;
+  guint64 clock_freq;
+  HANDLE client_event;
+  guint buffer_frames;
+  guint period_frames;
+  /* Rate of the endpoint against QPC */
+  GstWasapiDrift *drift;
+  /* See gst_wasapi_util_get_container_id() */
+  gchar *container_id;
+  /* In the container of the master, so not resampled */
+  gboolean clock_locked;
+  /* NULL for the master and the clock-locked ones, resamples the others
+   * onto their own stream */
+  GstWasapiResampler *resampler;
+  guint resampler_latency;
+  gboolean resampler_started;
+
+  /* Under the lock of the sink */
+  GstAdapter *queue;
+  guint64 frames_written;
+  /* Last IAudioClock reading, stream frame @devpos played at QPC @qpcpos */
+  gboolean position_valid;
+  guint64 devpos;
+  guint64 qpcpos;
+  guint64 silence_frames;
+  /* Stream frame of resampler output frame 0, moves with the silence the
+   * render thread inserts and the frames it drops */
+  gint64 offset;
+} GstWasapiAggregateOutput;
+
+struct _GstWasapiAggregateSink
+{
+  GstBaseSink parent;
+
+  GThread *thread;
+  /* Manual-reset, stops the render thread */
+  HANDLE stop_handle;
+  /* Wakes the render thread when there is something to start with */
+  HANDLE wake_handle;
+
+  /* Protects the queues and everything below */
+  GMutex lock;
+  GCond cond;
+  gboolean flushing;
+  gboolean started;
+  gboolean failed;
+  gboolean draining;
+  /* g_get_monotonic_time () when the clients started */
+  gint64 start_time;
+
+  GPtrArray *outputs;
+  GstAudioInfo info;
+  GstAudioInfo output_info;
+  guint start_frames;
+  guint max_frames;
+
+  /* properties */
+  gchar **devices;
+  gint channels;
+  gboolean split;
+  guint64 latency_time;
+  guint64 buffer_time;
+};
+
+struct _GstWasapiAggregateSinkClass
+{
+  GstBaseSinkClass parent_class;
+};
+
+GType gst_wasapi_aggregate_sink_get_type (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_AGGREGATE_SINK_H__ */
@@ -0,0 +1,1013 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/**
+ * SECTION:element-wasapiaggregatesrc
+ * @title: wasapiaggregatesrc
+ *
+ * Captures several endpoints at once and outputs them aligned on one
+ * timeline, mixed or with their channels side by side.
+ *
+ * All endpoints are serviced by the shared capture thread of wasapisrc
+ * shared-engine=true instead of a ringbuffer thread each. Every packet is
+ * placed by its QPC capture time, and every endpoint has a resampler of its
+ * own that slaves it to the pipeline clock, so the endpoints can't drift
+ * apart. Endpoints in one container, like the microphone of a USB headset
+ * and the loopback of its speakers, share a clock, so they all follow the
+ * rate estimate of the first of them instead of each estimating its own.
+ * An endpoint without data, like a loopback capture while nothing plays,
+ * is silent in the output.
+ *
+ * With redundant=true only one endpoint is output at a time, the first
+ * one in devices that is healthy, while the others keep running as hot
+ * standbys. As they all are on the same timeline, switching over to
+ * another one between two buffers loses or repeats no frames. An endpoint
+ * stops being healthy when it goes away, when it has nothing for a buffer
+ * by the time it is due, when it has been digitally silent for
+ * silence-time, or when it glitches glitch-threshold times within a
+ * second. Unless it went away it is trusted again after a second without
+ * any of these, and then output again if it comes before the active one.
+ * Every switch posts a "wasapi-redundant-switch" element message with the
+ * "from" and "to" endpoints and the "reason".
+ *
+ * ## Example pipelines
+ * |[
+ * gst-launch-1.0 -v wasapiaggregatesrc devices="default,loopback:default" ! audioconvert ! autoaudiosink
+ * ]| Mix the default microphone with what the default speakers play.
+ *
+ * |[
+ * gst-launch-1.0 -v wasapiaggregatesrc mix=false ! deinterleave name=d d.src_0 ! fakesink d.src_2 ! fakesink
+ * ]| Capture both into one four channel stream, and split it again.
+ *
+ * |[
+ * gst-launch-1.0 -v wasapiaggregatesrc redundant=true devices="{primary id},{standby id}" ! audioconvert ! autoaudiosink
+ * ]| Capture the primary microphone, and the standby one when it fails.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "gstwasapiaggregatesrc.h"
+
+#include <math.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_wasapi_aggregate_src_debug);
+#define GST_CAT_DEFAULT gst_wasapi_aggregate_src_debug
+
+#define DEFAULT_DEVICES       "default,loopback:default"
+#define DEFAULT_RATE          48000
+#define DEFAULT_CHANNELS      2
+#define DEFAULT_MIX           TRUE
+#define DEFAULT_REDUNDANT     FALSE
+#define DEFAULT_SILENCE_TIME  2000000
+#define DEFAULT_GLITCH_THRESHOLD 5
+#define DEFAULT_LATENCY_TIME  10000
+#define DEFAULT_BUFFER_TIME   200000
+
+#define LOOPBACK_PREFIX "loopback:"
+
+/* Below about -100 dBFS, what a live microphone never gets down to */
+#define SILENCE_LEVEL 1e-5f
+
+enum
+{
+  PROP_0,
+  PROP_DEVICES,
+  PROP_RATE,
+  PROP_CHANNELS,
+  PROP_MIX,
+  PROP_REDUNDANT,
+  PROP_SILENCE_TIME,
+  PROP_GLITCH_THRESHOLD,
+  PROP_LATENCY_TIME,
+  PROP_BUFFER_TIME
+};
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) " GST_AUDIO_NE (F32) ", "
+        "layout = (string) interleaved, "
+        "rate = " GST_AUDIO_RATE_RANGE ", "
+        "channels = " GST_AUDIO_CHANNELS_RANGE));
+
+static void gst_wasapi_aggregate_src_finalize (GObject * object);
+static void gst_wasapi_aggregate_src_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_wasapi_aggregate_src_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstCaps *gst_wasapi_aggregate_src_get_caps (GstBaseSrc * bsrc,
+    GstCaps * filter);
+static gboolean gst_wasapi_aggregate_src_start (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_aggregate_src_stop (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_aggregate_src_query (GstBaseSrc * bsrc,
+    GstQuery * query);
+static gboolean gst_wasapi_aggregate_src_unlock (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_aggregate_src_unlock_stop (GstBaseSrc * bsrc);
+static GstFlowReturn gst_wasapi_aggregate_src_create (GstPushSrc * psrc,
+    GstBuffer ** outbuf);
+
+#define gst_wasapi_aggregate_src_parent_class parent_class
+G_DEFINE_TYPE (GstWasapiAggregateSrc, gst_wasapi_aggregate_src,
+    GST_TYPE_PUSH_SRC);
+
+static void
+gst_wasapi_aggregate_src_class_init (GstWasapiAggregateSrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *gstbasesrc_class = GST_BASE_SRC_CLASS (klass);
+  GstPushSrcClass *gstpushsrc_class = GST_PUSH_SRC_CLASS (klass);
+
+  gobject_class->finalize = gst_wasapi_aggregate_src_finalize;
+  gobject_class->set_property = gst_wasapi_aggregate_src_set_property;
+  gobject_class->get_property = gst_wasapi_aggregate_src_get_property;
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICES,
+      g_param_spec_string ("devices", "Devices",
+          "Comma separated endpoints to capture: a device ID, or \"default\" "
+          "for the default capture device. With a \"" LOOPBACK_PREFIX "\" "
+          "prefix, what a render endpoint plays. Takes effect when going to "
+          "PAUSED", DEFAULT_DEVICES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RATE,
+      g_param_spec_int ("rate", "Rate",
+          "Sample rate of the output, the audio engine converts to it", 1,
+          G_MAXINT, DEFAULT_RATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNELS,
+      g_param_spec_int ("channels", "Channels",
+          "Channels of each endpoint, the audio engine mixes up or down to "
+          "it", 1, 8, DEFAULT_CHANNELS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MIX,
+      g_param_spec_boolean ("mix", "Mix",
+          "Mix the endpoints together, instead of outputting the channels of "
+          "each side by side, in the order of devices", DEFAULT_MIX,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_REDUNDANT,
+      g_param_spec_boolean ("redundant", "Redundant",
+          "Output only the first healthy endpoint in devices, and keep the "
+          "others running to switch over to", DEFAULT_REDUNDANT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SILENCE_TIME,
+      g_param_spec_uint64 ("silence-time", "Silence time",
+          "With redundant, how long an endpoint can be digitally silent "
+          "before it is switched away from, in microseconds (0 = never)", 0,
+          G_MAXUINT64, DEFAULT_SILENCE_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_GLITCH_THRESHOLD,
+      g_param_spec_uint ("glitch-threshold", "Glitch threshold",
+          "With redundant, how many glitches within a second an endpoint "
+          "can have before it is switched away from (0 = any number)", 0,
+          G_MAXUINT, DEFAULT_GLITCH_THRESHOLD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LATENCY_TIME,
+      g_param_spec_uint64 ("latency-time", "Latency time",
+          "Duration of the output buffers, in microseconds. An endpoint that "
+          "is late by more than one of them is silent in the buffer", 1000,
+          G_MAXUINT64, DEFAULT_LATENCY_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_BUFFER_TIME,
+      g_param_spec_uint64 ("buffer-time", "Buffer time",
+          "Size of the buffer of each endpoint, in microseconds. Output "
+          "starts over after a stall longer than this", 1000, G_MAXUINT64,
+          DEFAULT_BUFFER_TIME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (gstelement_class, &src_template);
+  gst_element_class_set_static_metadata (gstelement_class,
+      "WasapiAggregateSrc", "Source/Audio",
+      "Capture several audio endpoints on one timeline through WASAPI",
+      "Bebo");
+
+  gstbasesrc_class->get_caps =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_get_caps);
+  gstbasesrc_class->start = GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_start);
+  gstbasesrc_class->stop = GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_stop);
+  gstbasesrc_class->query = GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_query);
+  gstbasesrc_class->unlock =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_unlock);
+  gstbasesrc_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_unlock_stop);
+  gstpushsrc_class->create =
+      GST_DEBUG_FUNCPTR (gst_wasapi_aggregate_src_create);
+
+  GST_DEBUG_CATEGORY_INIT (gst_wasapi_aggregate_src_debug,
+      "wasapiaggregatesrc", 0, "Windows audio session API aggregate source");
+}
+
+static void
+gst_wasapi_aggregate_input_free (GstWasapiAggregateInput * input)
+{
+  /* The client stops signalling before the capture thread lets go */
+  if (input->client != NULL)
+    IAudioClient_Stop (input->client);
+  if (input->stream != NULL)
+    gst_wasapi_capture_detach (input->stream);
+  if (input->capture_client != NULL)
+    IUnknown_Release (input->capture_client);
+  if (input->client != NULL)
+    IUnknown_Release (input->client);
+  if (input->device != NULL)
+    IUnknown_Release (input->device);
+  if (input->client_event != NULL)
+    CloseHandle (input->client_event);
+  if (input->resampler != NULL)
+    gst_wasapi_resampler_free (input->resampler);
+  if (input->drift != NULL)
+    gst_wasapi_drift_free (input->drift);
+  g_object_unref (input->adapter);
+  g_free (input->scratch);
+  g_free (input->container_id);
+  g_free (input->name);
+  g_slice_free (GstWasapiAggregateInput, input);
+}
+
+static void
+gst_wasapi_aggregate_src_init (GstWasapiAggregateSrc * self)
+{
+  self->ready_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  /* Manual-reset, stays signalled until unlock_stop() */
+  self->cancel_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  self->inputs = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      gst_wasapi_aggregate_input_free);
+  self->next_out = -1;
+
+  self->devices = g_strsplit (DEFAULT_DEVICES, ",", -1);
+  self->rate = DEFAULT_RATE;
+  self->channels = DEFAULT_CHANNELS;
+  self->mix = DEFAULT_MIX;
+  self->redundant = DEFAULT_REDUNDANT;
+  self->silence_time = DEFAULT_SILENCE_TIME;
+  self->glitch_threshold = DEFAULT_GLITCH_THRESHOLD;
+  self->latency_time = DEFAULT_LATENCY_TIME;
+  self->buffer_time = DEFAULT_BUFFER_TIME;
+
+  gst_base_src_set_live (GST_BASE_SRC (self), TRUE);
+  gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
+}
+
+static void
+gst_wasapi_aggregate_src_finalize (GObject * object)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (object);
+
+  g_ptr_array_unref (self->inputs);
+  CloseHandle (self->ready_event);
+  CloseHandle (self->cancel_handle);
+  g_strfreev (self->devices);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_wasapi_aggregate_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (object);
+
+  switch (prop_id) {
+    case PROP_DEVICES:
+    {
+      const gchar *list = g_value_get_string (value);
+      GPtrArray *array = g_ptr_array_new ();
+
+      if (list != NULL) {
+        gchar **split = g_strsplit (list, ",", -1);
+        gint i;
+
+        for (i = 0; split[i] != NULL; i++) {
+          g_strstrip (split[i]);
+          if (*split[i] != '\0')
+            g_ptr_array_add (array, g_strdup (split[i]));
+        }
+        g_strfreev (split);
+      }
+      g_ptr_array_add (array, NULL);
+
+      GST_OBJECT_LOCK (self);
+      g_strfreev (self->devices);
+      self->devices = (gchar **) g_ptr_array_free (array, FALSE);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    }
+    case PROP_RATE:
+      self->rate = g_value_get_int (value);
+      break;
+    case PROP_CHANNELS:
+      self->channels = g_value_get_int (value);
+      break;
+    case PROP_MIX:
+      self->mix = g_value_get_boolean (value);
+      break;
+    case PROP_REDUNDANT:
+      self->redundant = g_value_get_boolean (value);
+      break;
+    case PROP_SILENCE_TIME:
+      self->silence_time = g_value_get_uint64 (value);
+      break;
+    case PROP_GLITCH_THRESHOLD:
+      self->glitch_threshold = g_value_get_uint (value);
+      break;
+    case PROP_LATENCY_TIME:
+      self->latency_time = g_value_get_uint64 (value);
+      break;
+    case PROP_BUFFER_TIME:
+      self->buffer_time = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_aggregate_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (object);
+
+  switch (prop_id) {
+    case PROP_DEVICES:
+      GST_OBJECT_LOCK (self);
+      g_value_take_string (value, g_strjoinv (",", self->devices));
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_RATE:
+      g_value_set_int (value, self->rate);
+      break;
+    case PROP_CHANNELS:
+      g_value_set_int (value, self->channels);
+      break;
+    case PROP_MIX:
+      g_value_set_boolean (value, self->mix);
+      break;
+    case PROP_REDUNDANT:
+      g_value_set_boolean (value, self->redundant);
+      break;
+    case PROP_SILENCE_TIME:
+      g_value_set_uint64 (value, self->silence_time);
+      break;
+    case PROP_GLITCH_THRESHOLD:
+      g_value_set_uint (value, self->glitch_threshold);
+      break;
+    case PROP_LATENCY_TIME:
+      g_value_set_uint64 (value, self->latency_time);
+      break;
+    case PROP_BUFFER_TIME:
+      g_value_set_uint64 (value, self->buffer_time);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* The caps follow from the properties, and the endpoints convert to them */
+static gboolean
+gst_wasapi_aggregate_src_setup_info (GstWasapiAggregateSrc * self,
+    guint n_inputs)
+{
+  GstAudioChannelPosition positions[64];
+  gboolean one = self->mix || self->redundant;
+  gint channels = one ? self->channels : self->channels * n_inputs;
+  gint i;
+
+  if (channels > 64) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS, (NULL),
+        ("%u endpoints of %d channels side by side are too many channels",
+            n_inputs, self->channels));
+    return FALSE;
+  }
+
+  gst_audio_info_set_format (&self->input_info, GST_AUDIO_FORMAT_F32,
+      self->rate, self->channels, NULL);
+
+  if (one) {
+    self->info = self->input_info;
+  } else {
+    for (i = 0; i < channels; i++)
+      positions[i] = GST_AUDIO_CHANNEL_POSITION_NONE;
+    gst_audio_info_set_format (&self->info, GST_AUDIO_FORMAT_F32, self->rate,
+        channels, positions);
+  }
+
+  self->segment_frames = MAX (gst_util_uint64_scale_int (self->latency_time,
+          self->rate, G_USEC_PER_SEC), 1);
+
+  return TRUE;
+}
+
+static GstCaps *
+gst_wasapi_aggregate_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (bsrc);
+  GstCaps *caps;
+
+  if (self->inputs->len == 0) {
+    caps = gst_pad_get_pad_template_caps (bsrc->srcpad);
+  } else {
+    caps = gst_audio_info_to_caps (&self->info);
+  }
+
+  if (filter) {
+    GstCaps *filtered =
+        gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = filtered;
+  }
+
+  return caps;
+}
+
+/* Opens "[loopback:]<device id>|default" and initializes the client to
+ * deliver the input format, NULL on errors */
+static GstWasapiAggregateInput *
+gst_wasapi_aggregate_input_open (GstWasapiAggregateSrc * self,
+    const gchar * entry)
+{
+  GstWasapiAggregateInput *input;
+  GstAudioRingBufferSpec spec;
+  WAVEFORMATEX *mix_format = NULL, *format;
+  const gchar *id = entry;
+  wchar_t *strid = NULL;
+  guint devicep_frames, buffer_frames;
+  gboolean ok;
+  HRESULT hr;
+
+  input = g_slice_new0 (GstWasapiAggregateInput);
+  input->name = g_strdup (entry);
+  input->adapter = gst_adapter_new ();
+  input->start = -1;
+  input->client_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+
+  if (g_str_has_prefix (id, LOOPBACK_PREFIX)) {
+    input->loopback = TRUE;
+    id += strlen (LOOPBACK_PREFIX);
+  }
+  if (g_strcmp0 (id, "default") != 0)
+    strid = g_utf8_to_utf16 (id, -1, NULL, NULL, NULL);
+
+  ok = gst_wasapi_util_get_device_client (GST_ELEMENT (self),
+      input->loopback ? eRender : eCapture, eConsole, strid, &input->device,
+      &input->client);
+  g_free (strid);
+  if (!ok)
+    goto failed;
+  input->container_id = gst_wasapi_util_get_container_id (input->device);
+
+  /* Only for the channel mask, which the engine maps to ours */
+  hr = IAudioClient_GetMixFormat (input->client, &mix_format);
+  HR_FAILED_AND (hr, IAudioClient::GetMixFormat, goto failed);
+  format = gst_wasapi_util_audio_info_to_waveformatex (&self->input_info,
+      mix_format);
+  CoTaskMemFree (mix_format);
+
+  memset (&spec, 0, sizeof (spec));
+  spec.info = self->input_info;
+  spec.latency_time = self->latency_time;
+  spec.buffer_time = self->buffer_time;
+  ok = gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), &spec,
+      input->device, &input->client, format, AUDCLNT_SHAREMODE_SHARED, FALSE,
+      input->loopback, TRUE, FALSE, &devicep_frames);
+  CoTaskMemFree (format);
+  if (!ok)
+    goto failed;
+
+  hr = IAudioClient_GetBufferSize (input->client, &buffer_frames);
+  HR_FAILED_AND (hr, IAudioClient::GetBufferSize, goto failed);
+  hr = IAudioClient_SetEventHandle (input->client, input->client_event);
+  HR_FAILED_AND (hr, IAudioClient::SetEventHandle, goto failed);
+
+  if (!gst_wasapi_util_get_capture_client (GST_ELEMENT (self), input->client,
+          &input->capture_client))
+    goto failed;
+
+  input->stream = gst_wasapi_capture_attach (GST_ELEMENT (self),
+      input->capture_client, input->client_event, self->ready_event,
+      GST_AUDIO_INFO_BPF (&self->input_info), buffer_frames, FALSE);
+  if (input->stream == NULL)
+    goto failed;
+
+  input->resampler = gst_wasapi_resampler_new (&self->input_info);
+  if (input->resampler == NULL)
+    goto failed;
+  input->drift = gst_wasapi_drift_new (self->rate);
+  if (self->redundant)
+    input->scratch = g_new (gfloat, self->segment_frames * self->channels);
+  input->glitch_window = -1;
+
+  GST_INFO_OBJECT (self, "opened %s, device period %u frames, buffer %u "
+      "frames", entry, devicep_frames, buffer_frames);
+
+  return input;
+
+failed:
+  GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+      ("Failed to open %s", entry));
+  gst_wasapi_aggregate_input_free (input);
+  return NULL;
+}
+
+static gboolean
+gst_wasapi_aggregate_src_start (GstBaseSrc * bsrc)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (bsrc);
+  gchar **devices;
+  guint i, j, n_devices;
+  HRESULT hr;
+
+  GST_OBJECT_LOCK (self);
+  devices = g_strdupv (self->devices);
+  GST_OBJECT_UNLOCK (self);
+
+  n_devices = devices ? g_strv_length (devices) : 0;
+  if (n_devices == 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS, (NULL),
+        ("No endpoints in devices"));
+    goto failed;
+  }
+
+  if (!gst_wasapi_aggregate_src_setup_info (self, n_devices))
+    goto failed;
+
+  for (i = 0; i < n_devices; i++) {
+    GstWasapiAggregateInput *input =
+        gst_wasapi_aggregate_input_open (self, devices[i]);
+
+    if (input == NULL)
+      goto failed;
+
+    /* The first endpoint of a container leads the others */
+    for (j = 0; j < self->inputs->len && input->container_id; j++) {
+      GstWasapiAggregateInput *other = g_ptr_array_index (self->inputs, j);
+
+      if (other->clock_leader == NULL &&
+          g_strcmp0 (other->container_id, input->container_id) == 0) {
+        input->clock_leader = other;
+        GST_INFO_OBJECT (self, "%s runs off the clock of %s", input->name,
+            other->name);
+        break;
+      }
+    }
+    g_ptr_array_add (self->inputs, input);
+  }
+
+  /* As close together as we can, packets before the first buffer are
+   * dropped anyway */
+  for (i = 0; i < self->inputs->len; i++) {
+    GstWasapiAggregateInput *input = g_ptr_array_index (self->inputs, i);
+
+    hr = IAudioClient_Start (input->client);
+    HR_FAILED_AND (hr, IAudioClient::Start, goto failed);
+  }
+
+  self->next_out = -1;
+  self->active = 0;
+  g_strfreev (devices);
+
+  return TRUE;
+
+failed:
+  g_ptr_array_set_size (self->inputs, 0);
+  g_strfreev (devices);
+  return FALSE;
+}
+
+static gboolean
+gst_wasapi_aggregate_src_stop (GstBaseSrc * bsrc)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (bsrc);
+
+  g_ptr_array_set_size (self->inputs, 0);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_aggregate_src_query (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (bsrc);
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY) {
+    GstClockTime segment;
+
+    if (self->inputs->len == 0)
+      return FALSE;
+
+    /* A buffer goes out one segment after it is complete at the latest */
+    segment = gst_util_uint64_scale_int (self->segment_frames, GST_SECOND,
+        self->rate);
+    gst_query_set_latency (query, TRUE, 2 * segment,
+        self->buffer_time * GST_USECOND);
+    return TRUE;
+  }
+
+  return GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+}
+
+static gboolean
+gst_wasapi_aggregate_src_unlock (GstBaseSrc * bsrc)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (bsrc);
+
+  SetEvent (self->cancel_handle);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_aggregate_src_unlock_stop (GstBaseSrc * bsrc)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (bsrc);
+
+  ResetEvent (self->cancel_handle);
+
+  return TRUE;
+}
+
+/* Resamples everything queued for @input onto the output timeline */
+static gboolean
+gst_wasapi_aggregate_input_drain (GstWasapiAggregateSrc * self,
+    GstWasapiAggregateInput * input, GstClock * clock, GstClockTime base_time)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->input_info);
+
+  for (;;) {
+    GstBuffer *buf;
+    GstClockTime capture_time = GST_CLOCK_TIME_NONE;
+    BYTE *data;
+    UINT32 n_frames;
+    DWORD flags;
+    UINT64 devpos, qpcpos;
+    gint64 pos;
+    HRESULT hr;
+
+    hr = gst_wasapi_capture_stream_get_buffer (input->stream, &data,
+        &n_frames, &flags, &devpos, &qpcpos);
+    if (hr == AUDCLNT_S_BUFFER_EMPTY)
+      break;
+    HR_FAILED_AND (hr, IAudioCaptureClient::GetBuffer, return FALSE);
+
+    buf = gst_buffer_new_allocate (NULL, n_frames * bpf, NULL);
+    if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
+      gst_buffer_memset (buf, 0, 0, n_frames * bpf);
+    else
+      gst_buffer_fill (buf, 0, data, n_frames * bpf);
+    gst_wasapi_capture_stream_release_buffer (input->stream);
+
+    if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+      input->glitches++;
+    }
+    if (!(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+      gdouble ppm;
+
+      capture_time = gst_wasapi_util_qpc_to_clock_time (clock, qpcpos);
+      gst_wasapi_drift_push (input->drift, devpos, capture_time);
+      if (gst_wasapi_drift_get_ppm (input->clock_leader != NULL &&
+              !input->clock_leader->invalid ? input->clock_leader->drift :
+              input->drift, &ppm))
+        gst_wasapi_resampler_set_rate_hint (input->resampler, ppm);
+      capture_time = capture_time > base_time ? capture_time - base_time : 0;
+    }
+
+    buf = gst_wasapi_resampler_process (input->resampler, buf, capture_time);
+
+    /* The resampler starts a new timeline with a discont */
+    pos = (gint64) gst_util_uint64_scale_int_round (GST_BUFFER_PTS (buf),
+        self->rate, GST_SECOND);
+    if (input->start < 0 || GST_BUFFER_FLAG_IS_SET (buf,
+            GST_BUFFER_FLAG_DISCONT)) {
+      gst_adapter_clear (input->adapter);
+      input->start = pos;
+    }
+    gst_adapter_push (input->adapter, buf);
+  }
+
+  return TRUE;
+}
+
+/* Whether @input has everything up to the end of the next buffer */
+static gboolean
+gst_wasapi_aggregate_input_is_ready (GstWasapiAggregateSrc * self,
+    GstWasapiAggregateInput * input)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->input_info);
+
+  return input->start >= 0 && input->start +
+      (gint64) (gst_adapter_available (input->adapter) / bpf) >=
+      self->next_out + self->segment_frames;
+}
+
+/* Moves the frames of @input for the next buffer into @out, mixed or into
+ * the channels of input @index. Frames before the buffer are dropped,
+ * missing ones stay silent. */
+static void
+gst_wasapi_aggregate_input_take (GstWasapiAggregateSrc * self,
+    GstWasapiAggregateInput * input, guint index, gfloat * out)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->input_info);
+  gint channels = self->channels;
+  gint out_channels = GST_AUDIO_INFO_CHANNELS (&self->info);
+  gint64 avail, skip, offset, count;
+  const gfloat *in;
+  gint64 f;
+  gint c;
+
+  if (input->start < 0)
+    return;
+
+  avail = gst_adapter_available (input->adapter) / bpf;
+  if (input->start < self->next_out) {
+    skip = MIN (self->next_out - input->start, avail);
+    gst_adapter_flush (input->adapter, skip * bpf);
+    input->start += skip;
+    input->late_frames += skip;
+    avail -= skip;
+    if (skip > 0)
+      GST_LOG_OBJECT (self, "dropped %" G_GINT64_FORMAT " late frames of %s",
+          skip, input->name);
+  }
+
+  offset = input->start - self->next_out;
+  if (avail == 0 || offset >= self->segment_frames)
+    return;
+  count = MIN (avail, self->segment_frames - offset);
+
+  in = (const gfloat *) gst_adapter_map (input->adapter, count * bpf);
+  out += offset * out_channels;
+  if (self->mix || self->redundant) {
+    for (f = 0; f < count * channels; f++)
+      out[f] += in[f];
+  } else {
+    out += index * channels;
+    for (f = 0; f < count; f++)
+      for (c = 0; c < channels; c++)
+        out[f * out_channels + c] = in[f * channels + c];
+  }
+  gst_adapter_unmap (input->adapter);
+  gst_adapter_flush (input->adapter, count * bpf);
+  input->start += count;
+}
+
+/* Takes @input out of use for redundant until it has been healthy for a
+ * second after the next buffer */
+static void
+gst_wasapi_aggregate_input_fail (GstWasapiAggregateSrc * self,
+    GstWasapiAggregateInput * input, const gchar * fault)
+{
+  if (self->next_out >= input->healthy_from)
+    GST_INFO_OBJECT (self, "%s is unhealthy: %s", input->name, fault);
+  input->fault = fault;
+  input->healthy_from = self->next_out + self->segment_frames + self->rate;
+}
+
+/* Judges @input by what it has for the next buffer, in its scratch */
+static void
+gst_wasapi_aggregate_input_check (GstWasapiAggregateSrc * self,
+    GstWasapiAggregateInput * input, gboolean ready)
+{
+  if (!ready)
+    gst_wasapi_aggregate_input_fail (self, input, "stalled");
+
+  if (self->silence_time > 0) {
+    gint64 f, n = self->segment_frames * self->channels;
+
+    for (f = 0; f < n; f++)
+      if (fabsf (input->scratch[f]) >= SILENCE_LEVEL)
+        break;
+    input->silent_frames = f < n ? 0 : input->silent_frames +
+        self->segment_frames;
+    if (input->silent_frames >= (gint64) gst_util_uint64_scale_int
+        (self->silence_time, self->rate, G_USEC_PER_SEC))
+      gst_wasapi_aggregate_input_fail (self, input, "silence");
+  }
+
+  if (self->glitch_threshold > 0 && input->glitches >= self->glitch_threshold) {
+    gst_wasapi_aggregate_input_fail (self, input, "glitches");
+    input->glitch_window = -1;
+  }
+  if (input->glitch_window < 0 || self->next_out - input->glitch_window >=
+      self->rate) {
+    input->glitch_window = self->next_out;
+    input->glitches = 0;
+  }
+}
+
+/* Makes the first healthy input the active one, or any that is still
+ * there if none is */
+static void
+gst_wasapi_aggregate_src_choose (GstWasapiAggregateSrc * self)
+{
+  GstWasapiAggregateInput *from, *to;
+  guint i, active = self->active;
+
+  from = g_ptr_array_index (self->inputs, self->active);
+  for (i = 0; i < self->inputs->len; i++) {
+    GstWasapiAggregateInput *input = g_ptr_array_index (self->inputs, i);
+
+    if (!input->invalid && self->next_out >= input->healthy_from) {
+      active = i;
+      break;
+    }
+  }
+  if (i == self->inputs->len && from->invalid) {
+    for (i = 0; i < self->inputs->len; i++) {
+      if (!((GstWasapiAggregateInput *) g_ptr_array_index (self->inputs,
+                  i))->invalid) {
+        active = i;
+        break;
+      }
+    }
+  }
+  if (active == self->active)
+    return;
+
+  to = g_ptr_array_index (self->inputs, active);
+  GST_WARNING_OBJECT (self, "switching from %s to %s", from->name, to->name);
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self),
+          gst_structure_new ("wasapi-redundant-switch",
+              "from", G_TYPE_STRING, from->name,
+              "to", G_TYPE_STRING, to->name,
+              "reason", G_TYPE_STRING,
+              self->next_out < from->healthy_from ? from->fault : "recovered",
+              NULL)));
+  self->active = active;
+}
+
+/* Takes the next buffer from every input to keep them all aligned, but only
+ * outputs the active one */
+static void
+gst_wasapi_aggregate_src_take_redundant (GstWasapiAggregateSrc * self,
+    gboolean * ready, gfloat * out)
+{
+  gsize size = self->segment_frames * self->channels * sizeof (gfloat);
+  guint i;
+
+  for (i = 0; i < self->inputs->len; i++) {
+    GstWasapiAggregateInput *input = g_ptr_array_index (self->inputs, i);
+
+    if (input->invalid)
+      continue;
+    memset (input->scratch, 0, size);
+    gst_wasapi_aggregate_input_take (self, input, 0, input->scratch);
+    gst_wasapi_aggregate_input_check (self, input, ready[i]);
+  }
+
+  gst_wasapi_aggregate_src_choose (self);
+  memcpy (out, ((GstWasapiAggregateInput *) g_ptr_array_index (self->inputs,
+              self->active))->scratch, size);
+}
+
+static GstFlowReturn
+gst_wasapi_aggregate_src_create (GstPushSrc * psrc, GstBuffer ** outbuf)
+{
+  GstWasapiAggregateSrc *self = GST_WASAPI_AGGREGATE_SRC (psrc);
+  HANDLE handles[2] = { self->ready_event, self->cancel_handle };
+  GstClock *clock;
+  GstClockTime base_time, now, deadline;
+  GstBuffer *buf;
+  GstMapInfo map;
+  gboolean *ready = g_newa (gboolean, self->inputs->len);
+  gboolean discont = FALSE;
+  gint64 now_frames;
+  guint i;
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (clock == NULL)
+    clock = gst_system_clock_obtain ();
+  base_time = gst_element_get_base_time (GST_ELEMENT (self));
+
+  now = gst_clock_get_time (clock);
+  now = now > base_time ? now - base_time : 0;
+  now_frames = (gint64) gst_util_uint64_scale_int (now, self->rate,
+      GST_SECOND);
+
+  /* Start from now, also when downstream stalled for longer than the
+   * endpoints can buffer */
+  if (self->next_out < 0 || now_frames - self->next_out >
+      (gint64) gst_util_uint64_scale_int (self->buffer_time, self->rate,
+          G_USEC_PER_SEC)) {
+    if (self->next_out >= 0)
+      GST_WARNING_OBJECT (self, "stalled, starting over");
+    self->next_out = now_frames;
+    discont = TRUE;
+  }
+
+  /* Wait for all endpoints, but no longer than one more segment */
+  deadline = gst_util_uint64_scale_int (self->next_out +
+      2 * self->segment_frames, GST_SECOND, self->rate);
+
+  for (;;) {
+    gboolean all_ready = TRUE, any_valid = FALSE;
+    DWORD timeout;
+
+    for (i = 0; i < self->inputs->len; i++) {
+      GstWasapiAggregateInput *input = g_ptr_array_index (self->inputs, i);
+
+      ready[i] = FALSE;
+      if (input->invalid)
+        continue;
+      if (!gst_wasapi_aggregate_input_drain (self, input, clock, base_time)) {
+        if (!self->redundant) {
+          GST_ELEMENT_ERROR (self, RESOURCE, READ, (NULL),
+              ("Failed to capture from %s", input->name));
+          gst_object_unref (clock);
+          return GST_FLOW_ERROR;
+        }
+        /* Most likely unplugged, the others go on without it */
+        GST_ELEMENT_WARNING (self, RESOURCE, READ, (NULL),
+            ("Failed to capture from %s", input->name));
+        gst_wasapi_aggregate_input_fail (self, input, "invalidated");
+        input->invalid = TRUE;
+        continue;
+      }
+      any_valid = TRUE;
+      ready[i] = gst_wasapi_aggregate_input_is_ready (self, input);
+      all_ready &= ready[i];
+    }
+    if (!any_valid) {
+      GST_ELEMENT_ERROR (self, RESOURCE, READ, (NULL),
+          ("Failed to capture from any of the endpoints"));
+      gst_object_unref (clock);
+      return GST_FLOW_ERROR;
+    }
+    if (all_ready)
+      break;
+
+    now = gst_clock_get_time (clock);
+    now = now > base_time ? now - base_time : 0;
+    if (now >= deadline)
+      break;
+
+    timeout = (DWORD) ((deadline - now + GST_MSECOND - 1) / GST_MSECOND);
+    if (WaitForMultipleObjects (2, handles, FALSE, timeout) ==
+        WAIT_OBJECT_0 + 1) {
+      gst_object_unref (clock);
+      return GST_FLOW_FLUSHING;
+    }
+  }
+  gst_object_unref (clock);
+
+  buf = gst_buffer_new_allocate (NULL, self->segment_frames *
+      GST_AUDIO_INFO_BPF (&self->info), NULL);
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  memset (map.data, 0, map.size);
+  if (self->redundant) {
+    gst_wasapi_aggregate_src_take_redundant (self, ready, (gfloat *) map.data);
+  } else {
+    for (i = 0; i < self->inputs->len; i++)
+      gst_wasapi_aggregate_input_take (self, g_ptr_array_index (self->inputs,
+              i), i, (gfloat *) map.data);
+  }
+  gst_buffer_unmap (buf, &map);
+
+  GST_BUFFER_PTS (buf) = gst_util_uint64_scale_int (self->next_out,
+      GST_SECOND, self->rate);
+  GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (self->next_out +
+      self->segment_frames, GST_SECOND, self->rate) - GST_BUFFER_PTS (buf);
+  GST_BUFFER_OFFSET (buf) = self->next_out;
+  GST_BUFFER_OFFSET_END (buf) = self->next_out + self->segment_frames;
+  if (discont)
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+  self->next_out += self->segment_frames;
+
+  *outbuf = buf;
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,123 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_AGGREGATE_SRC_H__
+#define __GST_WASAPI_AGGREGATE_SRC_H__
+
+#include <gst/base/gstpushsrc.h>
+#include <gst/base/gstadapter.h>
+
+#include "gstwasapiutil.h"
+#include "gstwasapicapture.h"
+#include "gstwasapiresampler.h"
+#include "gstwasapidrift.h"
+
+G_BEGIN_DECLS
+#define GST_TYPE_WASAPI_AGGREGATE_SRC \
+  (gst_wasapi_aggregate_src_get_type ())
+#define GST_WASAPI_AGGREGATE_SRC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_WASAPI_AGGREGATE_SRC, GstWasapiAggregateSrc))
+#define GST_WASAPI_AGGREGATE_SRC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_WASAPI_AGGREGATE_SRC, GstWasapiAggregateSrcClass))
+#define GST_IS_WASAPI_AGGREGATE_SRC(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_WASAPI_AGGREGATE_SRC))
+#define GST_IS_WASAPI_AGGREGATE_SRC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_WASAPI_AGGREGATE_SRC))
+typedef struct _GstWasapiAggregateSrc GstWasapiAggregateSrc;
+typedef struct _GstWasapiAggregateSrcClass GstWasapiAggregateSrcClass;
+
+/* One endpoint of wasapiaggregatesrc. The shared capture thread drains the
+ * client, create() resamples the packets onto the output timeline. */
+typedef struct _GstWasapiAggregateInput
+{
+  gchar *name;
+  gboolean loopback;
+  IMMDevice *device;
+  IAudioClient *client;
+  IAudioCaptureClient *capture_client;
+  HANDLE client_event;
+  GstWasapiCaptureStream *stream;
+  /* Rate of the endpoint against the clock, and the resampler that slaves
+   * the endpoint to it */
+  GstWasapiDrift *drift;
+  GstWasapiResampler *resampler;
+  /* See gst_wasapi_util_get_container_id(). An earlier input in the same
+   * container is the @clock_leader, whose rate this one follows. */
+  gchar *container_id;
+  struct _GstWasapiAggregateInput *clock_leader;
+  /* Resampled frames not output yet, the first of them is frame @start of
+   * the output timeline, -1 before the first packet */
+  GstAdapter *adapter;
+  gint64 start;
+  /* Frames that came after their output buffer was gone */
+  guint64 late_frames;
+  /* With redundant, what create() takes from the input, whether or not it
+   * is the one output, and its health. @invalid once the endpoint is gone,
+   * otherwise it is trusted again from output frame @healthy_from on.
+   * @fault is why it was last taken out of use. @glitches are the
+   * discontinuities since @glitch_window started, and @silent_frames how
+   * long it has been silent. */
+  gfloat *scratch;
+  gboolean invalid;
+  gint64 healthy_from;
+  const gchar *fault;
+  guint glitches;
+  gint64 glitch_window;
+  gint64 silent_frames;
+} GstWasapiAggregateInput;
+
+struct _GstWasapiAggregateSrc
+{
+  GstPushSrc parent;
+
+  /* Signalled by the capture thread for every input, and by unlock() */
+  HANDLE ready_event;
+  HANDLE cancel_handle;
+
+  GPtrArray *inputs;
+  /* What the endpoints deliver, and what we output */
+  GstAudioInfo input_info;
+  GstAudioInfo info;
+  guint segment_frames;
+  /* Output timeline position of the next buffer in frames of running time,
+   * -1 before the first one */
+  gint64 next_out;
+  /* With redundant, the index of the input that is output */
+  guint active;
+
+  /* properties */
+  gchar **devices;
+  gint rate;
+  gint channels;
+  gboolean mix;
+  gboolean redundant;
+  guint64 silence_time;
+  guint glitch_threshold;
+  guint64 latency_time;
+  guint64 buffer_time;
+};
+
+struct _GstWasapiAggregateSrcClass
+{
+  GstPushSrcClass parent_class;
+};
+
+GType gst_wasapi_aggregate_src_get_type (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_AGGREGATE_SRC_H__ */
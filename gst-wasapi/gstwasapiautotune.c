@@ -0,0 +1,362 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiautotune.h"
+
+#include <glib/gstdio.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* How long each candidate streams */
+#define MEASURE_TIME (300 * G_TIME_SPAN_MILLISECOND)
+
+/* Lowest expected latency first, so the log reads in order */
+static const GstWasapiAutoTuneConfig candidates[] = {
+  {TRUE, TRUE, FALSE},
+  {FALSE, TRUE, TRUE},
+  {TRUE, FALSE, FALSE},
+  {FALSE, TRUE, FALSE},
+  {FALSE, FALSE, TRUE},
+  {FALSE, FALSE, FALSE},
+};
+
+static GMutex autotune_lock;
+/* Loaded from the cache directory on first use. PROTECTED by autotune_lock */
+static GKeyFile *autotune_file;
+/* IDs of the endpoints that are being measured, whoever else wants one of
+ * them waits on autotune_cond. PROTECTED by autotune_lock */
+static GHashTable *autotune_measuring;
+static GCond autotune_cond;
+
+static gchar *
+gst_wasapi_autotune_get_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gstreamer-1.0",
+      "wasapi-autotune.ini", NULL);
+}
+
+/* With autotune_lock held */
+static GKeyFile *
+gst_wasapi_autotune_get_file (void)
+{
+  gchar *path;
+
+  if (autotune_file != NULL)
+    return autotune_file;
+
+  autotune_file = g_key_file_new ();
+  path = gst_wasapi_autotune_get_path ();
+  /* Not there yet on the first run */
+  g_key_file_load_from_file (autotune_file, path, G_KEY_FILE_NONE, NULL);
+  g_free (path);
+
+  return autotune_file;
+}
+
+/* With autotune_lock held */
+static void
+gst_wasapi_autotune_save_file (void)
+{
+  GError *err = NULL;
+  gchar *path, *dir;
+
+  path = gst_wasapi_autotune_get_path ();
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+
+  if (!g_key_file_save_to_file (autotune_file, path, &err)) {
+    GST_WARNING ("Failed to save %s: %s", path, err->message);
+    g_clear_error (&err);
+  }
+
+  g_free (dir);
+  g_free (path);
+}
+
+/* With autotune_lock held. FALSE if @group isn't in the file yet. */
+static gboolean
+gst_wasapi_autotune_lookup (const gchar * group,
+    GstWasapiAutoTuneConfig * config)
+{
+  GKeyFile *file = gst_wasapi_autotune_get_file ();
+
+  if (!g_key_file_has_group (file, group))
+    return FALSE;
+
+  config->exclusive = g_key_file_get_boolean (file, group, "exclusive", NULL);
+  config->low_latency = g_key_file_get_boolean (file, group, "low-latency",
+      NULL);
+  config->audioclient3 = g_key_file_get_boolean (file, group, "audioclient3",
+      NULL);
+
+  return TRUE;
+}
+
+/* Streams with @config for MEASURE_TIME. FALSE if the endpoint doesn't
+ * accept it. */
+static gboolean
+gst_wasapi_autotune_measure (GstElement * self, IMMDevice * device,
+    const gchar * direction, const GstWasapiAutoTuneConfig * config,
+    GstClockTime * ret_latency, guint * ret_glitches)
+{
+  IAudioClient *client = NULL;
+  IAudioRenderClient *render_client = NULL;
+  IAudioCaptureClient *capture_client = NULL;
+  WAVEFORMATEX *format = NULL;
+  GstAudioRingBufferSpec spec = { 0, };
+  HANDLE event_handle = NULL;
+  REFERENCE_TIME latency_rt;
+  guint64 latency_time, buffer_time;
+  guint devicep_frames, buffer_frames;
+  guint sharemode, glitches = 0, events = 0;
+  gboolean render = g_str_equal (direction, "render");
+  gboolean loopback = g_str_equal (direction, "loopback");
+  gboolean started = FALSE, res = FALSE;
+  DWORD timeout;
+  gint64 end;
+  BYTE *data;
+  HRESULT hr;
+
+  sharemode = config->exclusive ? AUDCLNT_SHAREMODE_EXCLUSIVE :
+      AUDCLNT_SHAREMODE_SHARED;
+
+  if (config->audioclient3 && !gst_wasapi_util_have_audioclient3 ())
+    return FALSE;
+  if (config->exclusive && loopback)
+    return FALSE;
+
+  hr = IMMDevice_Activate (device, gst_wasapi_util_have_audioclient3 () ?
+      &IID_IAudioClient3 : &IID_IAudioClient, CLSCTX_ALL, NULL,
+      (void **) &client);
+  HR_FAILED_GOTO (hr, IMMDevice::Activate, beach);
+
+  if (!gst_wasapi_util_get_device_format (self, sharemode, device, client,
+          &format))
+    goto beach;
+
+  /* What the element will ask for. Initializing only looks at the rate. */
+  g_object_get (self, "latency-time", &latency_time, "buffer-time",
+      &buffer_time, NULL);
+  spec.latency_time = latency_time;
+  spec.buffer_time = buffer_time;
+  gst_audio_info_set_format (&spec.info, GST_AUDIO_FORMAT_F32,
+      format->nSamplesPerSec, format->nChannels, NULL);
+
+  if (config->audioclient3) {
+    if (!gst_wasapi_util_initialize_audioclient3 (self, &spec,
+            (IAudioClient3 *) client, format, config->low_latency, loopback,
+            &devicep_frames))
+      goto beach;
+  } else if (!gst_wasapi_util_initialize_audioclient (self, &spec, device,
+          &client, format, sharemode, config->low_latency, loopback, FALSE,
+          FALSE, &devicep_frames)) {
+    goto beach;
+  }
+
+  hr = IAudioClient_GetBufferSize (client, &buffer_frames);
+  HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
+
+  hr = IAudioClient_GetStreamLatency (client, &latency_rt);
+  HR_FAILED_GOTO (hr, IAudioClient::GetStreamLatency, beach);
+
+  event_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  hr = IAudioClient_SetEventHandle (client, event_handle);
+  HR_FAILED_GOTO (hr, IAudioClient::SetEventHandle, beach);
+
+  if (render) {
+    if (!gst_wasapi_util_get_render_client (self, client, &render_client))
+      goto beach;
+
+    /* Exclusive mode wants a full buffer before starting */
+    hr = IAudioRenderClient_GetBuffer (render_client, buffer_frames, &data);
+    HR_FAILED_GOTO (hr, IAudioRenderClient::GetBuffer, beach);
+    hr = IAudioRenderClient_ReleaseBuffer (render_client, buffer_frames,
+        AUDCLNT_BUFFERFLAGS_SILENT);
+    HR_FAILED_GOTO (hr, IAudioRenderClient::ReleaseBuffer, beach);
+  } else if (!gst_wasapi_util_get_capture_client (self, client,
+          &capture_client)) {
+    goto beach;
+  }
+
+  hr = IAudioClient_Start (client);
+  HR_FAILED_GOTO (hr, IAudioClient::Start, beach);
+  started = TRUE;
+
+  /* An event later than two periods is a glitch */
+  timeout = MAX (2 * devicep_frames * 1000 / format->nSamplesPerSec, 2);
+  end = g_get_monotonic_time () + MEASURE_TIME;
+
+  while (g_get_monotonic_time () < end) {
+    if (WaitForSingleObject (event_handle, timeout) != WAIT_OBJECT_0) {
+      /* Loopback gets no events while nothing plays */
+      if (!loopback)
+        glitches++;
+      continue;
+    }
+    events++;
+
+    if (render) {
+      guint n_frames = buffer_frames;
+
+      if (sharemode == AUDCLNT_SHAREMODE_SHARED) {
+        guint padding;
+
+        hr = IAudioClient_GetCurrentPadding (client, &padding);
+        HR_FAILED_GOTO (hr, IAudioClient::GetCurrentPadding, beach);
+        if (padding == 0)
+          glitches++;
+        n_frames -= padding;
+      }
+      if (n_frames == 0)
+        continue;
+
+      hr = IAudioRenderClient_GetBuffer (render_client, n_frames, &data);
+      if (hr != S_OK) {
+        glitches++;
+        continue;
+      }
+      IAudioRenderClient_ReleaseBuffer (render_client, n_frames,
+          AUDCLNT_BUFFERFLAGS_SILENT);
+    } else {
+      UINT32 n_frames;
+      DWORD flags;
+
+      while (IAudioCaptureClient_GetBuffer (capture_client, &data, &n_frames,
+              &flags, NULL, NULL) == S_OK) {
+        /* The first packet always has it */
+        if ((flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) && events > 1)
+          glitches++;
+        IAudioCaptureClient_ReleaseBuffer (capture_client, n_frames);
+      }
+    }
+  }
+
+  /* One period in flight, plus what the engine adds */
+  *ret_latency = gst_util_uint64_scale_int (devicep_frames, GST_SECOND,
+      format->nSamplesPerSec) + latency_rt * 100;
+  *ret_glitches = glitches;
+  res = events > 0;
+
+beach:
+  if (started)
+    IAudioClient_Stop (client);
+  if (render_client != NULL)
+    IUnknown_Release (render_client);
+  if (capture_client != NULL)
+    IUnknown_Release (capture_client);
+  if (client != NULL)
+    IUnknown_Release (client);
+  if (event_handle != NULL)
+    CloseHandle (event_handle);
+  CoTaskMemFree (format);
+
+  return res;
+}
+
+gboolean
+gst_wasapi_autotune_get_config (GstElement * element, IMMDevice * device,
+    const gchar * direction, GstWasapiAutoTuneConfig * config)
+{
+  GstWasapiAutoTuneConfig best = { 0, };
+  GstClockTime best_latency = GST_CLOCK_TIME_NONE;
+  guint best_glitches = G_MAXUINT;
+  GKeyFile *file;
+  gchar *id, *group;
+  guint i;
+
+  id = gst_wasapi_util_get_device_id (device);
+  if (id == NULL)
+    return FALSE;
+  group = g_strdup_printf ("%s %s", direction, id);
+
+  /* Only the cache and the file are under the lock. One endpoint is only
+   * measured by one element at a time, in any direction, so two elements
+   * don't measure each other. Others wait for the result then, elements
+   * on other endpoints go ahead right away. */
+  g_mutex_lock (&autotune_lock);
+  if (autotune_measuring == NULL)
+    autotune_measuring = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+  while (g_hash_table_contains (autotune_measuring, id))
+    g_cond_wait (&autotune_cond, &autotune_lock);
+  if (gst_wasapi_autotune_lookup (group, config)) {
+    g_mutex_unlock (&autotune_lock);
+    g_free (id);
+    goto out;
+  }
+  g_hash_table_add (autotune_measuring, id);
+  g_mutex_unlock (&autotune_lock);
+
+  for (i = 0; i < G_N_ELEMENTS (candidates); i++) {
+    GstClockTime latency;
+    guint glitches;
+
+    if (!gst_wasapi_autotune_measure (element, device, direction,
+            &candidates[i], &latency, &glitches)) {
+      GST_INFO_OBJECT (element, "exclusive %d, low-latency %d, audioclient3 "
+          "%d: not supported", candidates[i].exclusive,
+          candidates[i].low_latency, candidates[i].audioclient3);
+      continue;
+    }
+
+    GST_INFO_OBJECT (element, "exclusive %d, low-latency %d, audioclient3 "
+        "%d: latency %" GST_TIME_FORMAT ", %u glitches",
+        candidates[i].exclusive, candidates[i].low_latency,
+        candidates[i].audioclient3, GST_TIME_ARGS (latency), glitches);
+
+    if (glitches < best_glitches ||
+        (glitches == best_glitches && latency < best_latency)) {
+      best = candidates[i];
+      best_latency = latency;
+      best_glitches = glitches;
+    }
+  }
+
+  g_mutex_lock (&autotune_lock);
+  if (best_glitches != G_MAXUINT) {
+    file = gst_wasapi_autotune_get_file ();
+    g_key_file_set_boolean (file, group, "exclusive", best.exclusive);
+    g_key_file_set_boolean (file, group, "low-latency", best.low_latency);
+    g_key_file_set_boolean (file, group, "audioclient3", best.audioclient3);
+    gst_wasapi_autotune_save_file ();
+  }
+  /* Frees @id */
+  g_hash_table_remove (autotune_measuring, id);
+  g_cond_broadcast (&autotune_cond);
+  g_mutex_unlock (&autotune_lock);
+
+  if (best_glitches == G_MAXUINT) {
+    GST_WARNING_OBJECT (element, "could not measure any mode");
+    g_free (group);
+    return FALSE;
+  }
+  *config = best;
+
+out:
+  GST_INFO_OBJECT (element, "using exclusive %d, low-latency %d, audioclient3 "
+      "%d for %s", config->exclusive, config->low_latency,
+      config->audioclient3, group);
+  g_free (group);
+
+  return TRUE;
+}
@@ -0,0 +1,50 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_AUTOTUNE_H__
+#define __GST_WASAPI_AUTOTUNE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Mode selection for auto-tune=true on wasapisrc and wasapisink.
+ *
+ * The first time an endpoint is opened, each combination of exclusive,
+ * low-latency and audioclient3 that it accepts is streamed for a short
+ * while with the latency-time and buffer-time of the element, silence for
+ * the sink. Late events, underruns and data discontinuities count as
+ * glitches. The glitch free candidate with the lowest latency wins, else
+ * the one with the fewest glitches. The result is kept per endpoint ID in
+ * the user cache directory, so later runs use it right away. */
+typedef struct
+{
+  gboolean exclusive;
+  gboolean low_latency;
+  gboolean audioclient3;
+} GstWasapiAutoTuneConfig;
+
+/* @direction is "render", "capture" or "loopback". Loopback never tries
+ * exclusive mode. FALSE if nothing could be measured, keep the properties
+ * as they are then. */
+gboolean gst_wasapi_autotune_get_config (GstElement * element,
+    IMMDevice * device, const gchar * direction,
+    GstWasapiAutoTuneConfig * config);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_AUTOTUNE_H__ */
@@ -0,0 +1,167 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapibusqueue.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Notifications that can be waiting, a power of 2. Only a handful come per
+ * second, and the helper is woken for each. */
+#define BUS_QUEUE_SIZE 64
+
+/* A slot is free for the push of position n while its sequence is n, and
+ * holds that notification once it is n + 1 */
+typedef struct
+{
+  gint sequence;
+  GstWasapiNotification notification;
+} GstWasapiBusQueueSlot;
+
+struct _GstWasapiBusQueue
+{
+  GstElement *element;
+  GstWasapiBusQueueFunc func;
+
+  GstWasapiBusQueueSlot slots[BUS_QUEUE_SIZE];
+  /* Next position to push, and to pop, which only the helper does */
+  gint tail;
+  guint head;
+  gint dropped;
+
+  HANDLE wake;
+  gint stopping;
+  GThread *thread;
+};
+
+/* Hands the ready ones to the element in order */
+static void
+gst_wasapi_bus_queue_drain (GstWasapiBusQueue * self)
+{
+  GstWasapiNotification notification;
+  GstWasapiBusQueueSlot *slot;
+  gint dropped;
+
+  for (;;) {
+    slot = &self->slots[self->head & (BUS_QUEUE_SIZE - 1)];
+    if ((guint) g_atomic_int_get (&slot->sequence) != self->head + 1)
+      break;
+
+    notification = slot->notification;
+    g_atomic_int_set (&slot->sequence, (gint) (self->head + BUS_QUEUE_SIZE));
+    self->head++;
+
+    self->func (self->element, &notification);
+  }
+
+  dropped = g_atomic_int_get (&self->dropped);
+  if (dropped == 0)
+    return;
+  g_atomic_int_add (&self->dropped, -dropped);
+  GST_WARNING_OBJECT (self->element, "dropped %d notifications, the bus "
+      "queue was full", dropped);
+}
+
+static gpointer
+gst_wasapi_bus_queue_thread (gpointer user_data)
+{
+  GstWasapiBusQueue *self = user_data;
+
+  while (!g_atomic_int_get (&self->stopping)) {
+    WaitForSingleObject (self->wake, INFINITE);
+    gst_wasapi_bus_queue_drain (self);
+  }
+
+  return NULL;
+}
+
+GstWasapiBusQueue *
+gst_wasapi_bus_queue_new (GstElement * element, GstWasapiBusQueueFunc func)
+{
+  GstWasapiBusQueue *self = g_new0 (GstWasapiBusQueue, 1);
+  gint i;
+
+  self->element = element;
+  self->func = func;
+  for (i = 0; i < BUS_QUEUE_SIZE; i++)
+    self->slots[i].sequence = i;
+
+  self->wake = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->thread = g_thread_new ("wasapi-bus-queue",
+      gst_wasapi_bus_queue_thread, self);
+
+  return self;
+}
+
+void
+gst_wasapi_bus_queue_free (GstWasapiBusQueue * self)
+{
+  g_atomic_int_set (&self->stopping, TRUE);
+  SetEvent (self->wake);
+  g_thread_join (self->thread);
+  /* Pushed after its last look */
+  gst_wasapi_bus_queue_drain (self);
+
+  CloseHandle (self->wake);
+  g_free (self);
+}
+
+static gboolean
+gst_wasapi_bus_queue_push_notification (GstWasapiBusQueue * self,
+    const GstWasapiNotification * notification)
+{
+  GstWasapiBusQueueSlot *slot;
+  gint pos = g_atomic_int_get (&self->tail), diff;
+
+  for (;;) {
+    slot = &self->slots[pos & (BUS_QUEUE_SIZE - 1)];
+    diff = (gint) ((guint) g_atomic_int_get (&slot->sequence) - (guint) pos);
+
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&self->tail, pos,
+              (gint) ((guint) pos + 1)))
+        break;
+    } else if (diff < 0) {
+      /* Not popped yet from the last round */
+      g_atomic_int_inc (&self->dropped);
+      return FALSE;
+    }
+    pos = g_atomic_int_get (&self->tail);
+  }
+
+  slot->notification = *notification;
+  g_atomic_int_set (&slot->sequence, (gint) ((guint) pos + 1));
+  SetEvent (self->wake);
+
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_bus_queue_push (GstWasapiBusQueue * self, guint kind,
+    guint64 arg0, guint64 arg1, guint64 arg2)
+{
+  GstWasapiNotification notification = { kind, {arg0, arg1, arg2} };
+
+  g_return_val_if_fail (kind != 0, FALSE);
+
+  return gst_wasapi_bus_queue_push_notification (self, &notification);
+}
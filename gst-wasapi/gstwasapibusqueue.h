@@ -0,0 +1,62 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_BUS_QUEUE_H__
+#define __GST_WASAPI_BUS_QUEUE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Deferred bus messages of the threads that read or write the device.
+ *
+ * Posting takes the bus lock, and the messages and warnings are allocated
+ * and formatted, none of which should happen on a thread a glitch depends
+ * on. Those threads push a small notification into a preallocated ring
+ * instead, without locks or allocations. A helper thread of the queue
+ * wakes up for it, formats it through the function of the element and
+ * posts it. A notification only carries a kind and a few plain values,
+ * what is measured stays with the element until the helper takes it.
+ *
+ * Any number of threads can push. When the ring is full the notification
+ * is dropped and counted, a slow bus is no reason to stall the audio. */
+typedef struct _GstWasapiBusQueue GstWasapiBusQueue;
+
+/* Kinds are the element's, from 1 */
+typedef struct
+{
+  guint kind;
+  guint64 args[3];
+} GstWasapiNotification;
+
+/* Called on the helper thread for each notification */
+typedef void (*GstWasapiBusQueueFunc) (GstElement * element,
+    const GstWasapiNotification * notification);
+
+GstWasapiBusQueue *gst_wasapi_bus_queue_new (GstElement * element,
+    GstWasapiBusQueueFunc func);
+
+/* Stops the helper thread after it posted what was still queued */
+void gst_wasapi_bus_queue_free (GstWasapiBusQueue * queue);
+
+/* FALSE if the ring was full */
+gboolean gst_wasapi_bus_queue_push (GstWasapiBusQueue * queue, guint kind,
+    guint64 arg0, guint64 arg1, guint64 arg2);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_BUS_QUEUE_H__ */
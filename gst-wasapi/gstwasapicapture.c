@@ -0,0 +1,846 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapicapture.h"
+
+#include <string.h>
+#include <rtworkq.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+#define CAPTURE_WARNING(hr,func) \
+  GST_WARNING (#func " failed (%x): %s", (guint) hr, \
+      gst_wasapi_util_hresult_to_static_string (hr))
+
+/* One handle of each thread is for waking it up */
+#define MAX_STREAMS (MAXIMUM_WAIT_OBJECTS - 1)
+
+/* Packets a stream can hold, drivers hand over a few per period */
+#define N_PACKETS 32
+
+/* RTWorkQ.dll, Windows 10 and later */
+static struct
+{
+  gboolean available;
+  DWORD queue;
+  HRESULT (WINAPI * RtwqCreateAsyncResult) (IUnknown *, IRtwqAsyncCallback *,
+      IUnknown *, IRtwqAsyncResult **);
+  HRESULT (WINAPI * RtwqPutWaitingWorkItem) (HANDLE, LONG, IRtwqAsyncResult *,
+      RTWQWORKITEM_KEY *);
+} gst_wasapi_rtwq_tbl;
+
+typedef struct
+{
+  guint8 *data;
+  UINT32 n_frames;
+  DWORD flags;
+  UINT64 devpos;
+  UINT64 qpcpos;
+} GstWasapiCapturePacket;
+
+struct _GstWasapiCapture
+{
+  /* Attached streams, protected by captures_lock */
+  guint n_streams;
+  /* The work items of the streams wait for their events instead of the
+   * thread, there is no limit of streams then */
+  gboolean rtwq;
+
+  GThread *thread;
+  /* Signalled when streams changed or the thread has to stop */
+  HANDLE wake_handle;
+
+  /* Protects the below and the queues of the streams, cond is signalled
+   * when a work item is done for good */
+  GMutex lock;
+  GCond cond;
+  GList *streams;
+  /* Incremented whenever streams changes */
+  guint cookie;
+  gboolean stopping;
+};
+
+struct _GstWasapiCaptureStream
+{
+  /* First, Invoke gets it as This */
+  IRtwqAsyncCallback callback;
+  IRtwqAsyncResult *result;
+  RTWQWORKITEM_KEY key;
+  /* Our work item waits for client_event, until @detaching */
+  gboolean pending;
+  gboolean detaching;
+
+  GstWasapiCapture *capture;
+  IAudioCaptureClient *capture_client;
+  HANDLE client_event;
+  HANDLE ready_event;
+  guint bpf;
+  guint packet_frames;
+  guint8 *memory;
+
+  /* Ring of N_PACKETS packets of up to packet_frames each, fill of them
+   * from read on */
+  GstWasapiCapturePacket packets[N_PACKETS];
+  guint read;
+  guint fill;
+  /* The queue was full, the next packet starts after a gap */
+  gboolean dropped;
+  guint64 n_dropped;
+  /* The first failure of the client, we stop draining it then */
+  HRESULT error;
+
+  /* Shared with other sources as @key by the stream that drains it, the
+   * leader. Followers only have a queue, filled with what the leader
+   * drains. An @orphan leader has been detached by its source and only
+   * drains for its followers. */
+  gchar *key;
+  IAudioClient *client;
+  GstWasapiCaptureStream *leader;
+  GList *followers;
+  gboolean orphan;
+  /* Members that are started, of the leader, and whether this one is */
+  guint n_started;
+  gboolean started;
+  guint period_frames;
+};
+
+static GMutex captures_lock;
+static GList *captures;
+/* Leaders with a key, protected by captures_lock */
+static GList *shared_streams;
+
+/* Called with the capture lock */
+static void
+gst_wasapi_capture_queue (GstWasapiCaptureStream * stream, const BYTE * data,
+    UINT32 n_frames, DWORD flags, UINT64 devpos, UINT64 qpcpos)
+{
+  GstWasapiCapturePacket *packet;
+
+  if (stream->fill == N_PACKETS) {
+    if (!stream->dropped)
+      GST_WARNING ("queue of capture stream %p is full, dropping packets",
+          stream);
+    stream->dropped = TRUE;
+    stream->n_dropped++;
+    return;
+  }
+
+  packet = &stream->packets[(stream->read + stream->fill) % N_PACKETS];
+  packet->n_frames = MIN (n_frames, stream->packet_frames);
+  packet->flags = flags;
+  /* The source fills what we dropped from the device positions */
+  if (stream->dropped)
+    packet->flags |= AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY;
+  packet->devpos = devpos;
+  packet->qpcpos = qpcpos;
+  if (!(flags & AUDCLNT_BUFFERFLAGS_SILENT))
+    memcpy (packet->data, data, packet->n_frames * stream->bpf);
+
+  stream->dropped = FALSE;
+  stream->fill++;
+}
+
+/* Called with the capture lock */
+static void
+gst_wasapi_capture_drain (GstWasapiCaptureStream * stream)
+{
+  BYTE *data;
+  UINT32 n_frames;
+  DWORD flags;
+  UINT64 devpos, qpcpos;
+  gboolean queued = FALSE;
+  GList *l;
+  HRESULT hr;
+
+  if (FAILED (stream->error))
+    return;
+
+  while ((hr = IAudioCaptureClient_GetBuffer (stream->capture_client, &data,
+              &n_frames, &flags, &devpos, &qpcpos)) == S_OK) {
+    /* Each follower gets its own copy, only of what fits its queue */
+    if (!stream->orphan)
+      gst_wasapi_capture_queue (stream, data, n_frames, flags, devpos, qpcpos);
+    for (l = stream->followers; l != NULL; l = l->next)
+      gst_wasapi_capture_queue (l->data, data, n_frames, flags, devpos,
+          qpcpos);
+    queued = TRUE;
+
+    hr = IAudioCaptureClient_ReleaseBuffer (stream->capture_client, n_frames);
+    if (FAILED (hr))
+      break;
+  }
+
+  if (FAILED (hr)) {
+    CAPTURE_WARNING (hr, IAudioCaptureClient::GetBuffer);
+    stream->error = hr;
+    for (l = stream->followers; l != NULL; l = l->next)
+      ((GstWasapiCaptureStream *) l->data)->error = hr;
+    queued = TRUE;
+  }
+
+  if (!queued)
+    return;
+
+  if (!stream->orphan)
+    SetEvent (stream->ready_event);
+  for (l = stream->followers; l != NULL; l = l->next)
+    SetEvent (((GstWasapiCaptureStream *) l->data)->ready_event);
+}
+
+static gpointer
+gst_wasapi_capture_thread_func (gpointer user_data)
+{
+  GstWasapiCapture *capture = user_data;
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  GstWasapiCaptureStream *streams[MAXIMUM_WAIT_OBJECTS];
+  HANDLE priority_handle;
+  guint ii, n_handles = 0, cookie = 0;
+  DWORD res;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  priority_handle =
+      gst_wasapi_util_set_thread_characteristics (GST_WASAPI_DEFAULT_MMCSS_TASK,
+      GST_WASAPI_MMCSS_PRIORITY_NORMAL);
+
+  g_mutex_lock (&capture->lock);
+  while (!capture->stopping) {
+    if (n_handles == 0 || cookie != capture->cookie) {
+      GList *l;
+
+      handles[0] = capture->wake_handle;
+      n_handles = 1;
+      for (l = capture->streams; l; l = l->next, n_handles++) {
+        streams[n_handles] = l->data;
+        handles[n_handles] = streams[n_handles]->client_event;
+      }
+      cookie = capture->cookie;
+    }
+    g_mutex_unlock (&capture->lock);
+
+    res = WaitForMultipleObjects (n_handles, handles, FALSE, INFINITE);
+
+    g_mutex_lock (&capture->lock);
+    if (res == WAIT_OBJECT_0)
+      continue;
+    if (res >= WAIT_OBJECT_0 + n_handles) {
+      GST_ERROR ("Error waiting for the capture events: %x", (guint) res);
+      break;
+    }
+
+    /* Take care of the others that are ready as well, the wait only
+     * reports the first one */
+    for (ii = res - WAIT_OBJECT_0; ii < n_handles; ii++) {
+      if (ii != res - WAIT_OBJECT_0 &&
+          WaitForSingleObject (handles[ii], 0) != WAIT_OBJECT_0)
+        continue;
+      /* Might have been detached while we waited */
+      if (cookie == capture->cookie ||
+          g_list_find (capture->streams, streams[ii]))
+        gst_wasapi_capture_drain (streams[ii]);
+    }
+  }
+  g_mutex_unlock (&capture->lock);
+
+  if (priority_handle != NULL)
+    gst_wasapi_util_revert_thread_characteristics (priority_handle);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static gpointer
+gst_wasapi_capture_init_rtwq (gpointer user_data)
+{
+  HRESULT (WINAPI * startup) (void);
+  HRESULT (WINAPI * lock_shared_work_queue) (LPCWSTR, LONG, DWORD *,
+      DWORD *);
+  DWORD task_id = 0;
+  HMODULE dll;
+  HRESULT hr;
+
+  dll = LoadLibrary (TEXT ("RTWorkQ.dll"));
+  if (dll == NULL) {
+    GST_INFO ("can't find RTWorkQ.dll");
+    return NULL;
+  }
+
+  startup = (gpointer) GetProcAddress (dll, "RtwqStartup");
+  lock_shared_work_queue = (gpointer) GetProcAddress (dll,
+      "RtwqLockSharedWorkQueue");
+  gst_wasapi_rtwq_tbl.RtwqCreateAsyncResult =
+      (gpointer) GetProcAddress (dll, "RtwqCreateAsyncResult");
+  gst_wasapi_rtwq_tbl.RtwqPutWaitingWorkItem =
+      (gpointer) GetProcAddress (dll, "RtwqPutWaitingWorkItem");
+  if (!startup || !lock_shared_work_queue ||
+      !gst_wasapi_rtwq_tbl.RtwqCreateAsyncResult ||
+      !gst_wasapi_rtwq_tbl.RtwqPutWaitingWorkItem) {
+    GST_WARNING ("RTWorkQ.dll lacks the functions we need");
+    return NULL;
+  }
+
+  hr = startup ();
+  if (FAILED (hr)) {
+    CAPTURE_WARNING (hr, RtwqStartup);
+    return NULL;
+  }
+
+  /* Kept for the lifetime of the process, like the notification client */
+  hr = lock_shared_work_queue (L"" GST_WASAPI_DEFAULT_MMCSS_TASK, 0, &task_id,
+      &gst_wasapi_rtwq_tbl.queue);
+  if (FAILED (hr)) {
+    CAPTURE_WARNING (hr, RtwqLockSharedWorkQueue);
+    return NULL;
+  }
+
+  GST_INFO ("servicing capture clients from RTWQ queue %lu",
+      gst_wasapi_rtwq_tbl.queue);
+  gst_wasapi_rtwq_tbl.available = TRUE;
+
+  return NULL;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_capture_QueryInterface (IRtwqAsyncCallback * This, REFIID riid,
+    void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IRtwqAsyncCallback, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+/* Part of the stream, detach() waits for the work item instead */
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_capture_AddRef (IRtwqAsyncCallback * This)
+{
+  return 1;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_capture_Release (IRtwqAsyncCallback * This)
+{
+  return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_capture_GetParameters (IRtwqAsyncCallback * This, DWORD * flags,
+    DWORD * queue)
+{
+  *flags = 0;
+  *queue = gst_wasapi_rtwq_tbl.queue;
+  return S_OK;
+}
+
+/* Called with the capture lock */
+static gboolean
+gst_wasapi_capture_put_work_item (GstWasapiCaptureStream * stream)
+{
+  HRESULT hr;
+
+  hr = gst_wasapi_rtwq_tbl.RtwqPutWaitingWorkItem (stream->client_event, 0,
+      stream->result, &stream->key);
+  if (FAILED (hr)) {
+    CAPTURE_WARNING (hr, RtwqPutWaitingWorkItem);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* On a thread of the MMCSS queue, once client_event was signalled */
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_capture_Invoke (IRtwqAsyncCallback * This,
+    IRtwqAsyncResult * result)
+{
+  GstWasapiCaptureStream *stream = (GstWasapiCaptureStream *) This;
+  GstWasapiCapture *capture = stream->capture;
+
+  g_mutex_lock (&capture->lock);
+  if (!stream->detaching) {
+    gst_wasapi_capture_drain (stream);
+    stream->pending = gst_wasapi_capture_put_work_item (stream);
+  } else {
+    stream->pending = FALSE;
+  }
+  if (!stream->pending)
+    g_cond_broadcast (&capture->cond);
+  g_mutex_unlock (&capture->lock);
+
+  return S_OK;
+}
+
+static CONST_VTBL IRtwqAsyncCallbackVtbl capture_callback_vtbl = {
+  .QueryInterface = gst_wasapi_capture_QueryInterface,
+  .AddRef = gst_wasapi_capture_AddRef,
+  .Release = gst_wasapi_capture_Release,
+  .GetParameters = gst_wasapi_capture_GetParameters,
+  .Invoke = gst_wasapi_capture_Invoke,
+};
+
+static GstWasapiCapture *
+gst_wasapi_capture_new (gboolean rtwq)
+{
+  GstWasapiCapture *capture;
+
+  capture = g_slice_new0 (GstWasapiCapture);
+  g_mutex_init (&capture->lock);
+  g_cond_init (&capture->cond);
+  capture->rtwq = rtwq;
+  if (!rtwq) {
+    capture->wake_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+    capture->thread = g_thread_new ("wasapi-capture",
+        gst_wasapi_capture_thread_func, capture);
+  }
+
+  return capture;
+}
+
+static void
+gst_wasapi_capture_free (GstWasapiCapture * capture)
+{
+  if (capture->thread != NULL) {
+    g_mutex_lock (&capture->lock);
+    capture->stopping = TRUE;
+    g_mutex_unlock (&capture->lock);
+    SetEvent (capture->wake_handle);
+    g_thread_join (capture->thread);
+  }
+
+  if (capture->wake_handle != NULL)
+    CloseHandle (capture->wake_handle);
+  g_mutex_clear (&capture->lock);
+  g_cond_clear (&capture->cond);
+  g_slice_free (GstWasapiCapture, capture);
+}
+
+/* Drops a stream from captures_lock again, attach() failed */
+static void
+gst_wasapi_capture_unref (GstWasapiCapture * capture)
+{
+  gboolean last;
+
+  g_mutex_lock (&captures_lock);
+  last = --capture->n_streams == 0;
+  if (last)
+    captures = g_list_remove (captures, capture);
+  g_mutex_unlock (&captures_lock);
+
+  if (last) {
+    GST_INFO ("last stream of capture %p is gone", capture);
+    gst_wasapi_capture_free (capture);
+  }
+}
+
+GstWasapiCaptureStream *
+gst_wasapi_capture_attach (GstElement * self,
+    IAudioCaptureClient * capture_client, HANDLE client_event,
+    HANDLE ready_event, guint bpf, guint buffer_frames, gboolean rtwq)
+{
+  static GOnce rtwq_once = G_ONCE_INIT;
+  GstWasapiCapture *capture = NULL;
+  GstWasapiCaptureStream *stream;
+  GList *l;
+  guint ii;
+
+  if (rtwq) {
+    g_once (&rtwq_once, gst_wasapi_capture_init_rtwq, NULL);
+    if (!gst_wasapi_rtwq_tbl.available) {
+      GST_WARNING_OBJECT (self, "RTWQ is not available, using a capture "
+          "thread");
+      rtwq = FALSE;
+    }
+  }
+
+  g_mutex_lock (&captures_lock);
+  for (l = captures; l; l = l->next) {
+    GstWasapiCapture *c = l->data;
+
+    if (c->rtwq == rtwq && (rtwq || c->n_streams < MAX_STREAMS)) {
+      capture = c;
+      break;
+    }
+  }
+  if (capture == NULL) {
+    capture = gst_wasapi_capture_new (rtwq);
+    captures = g_list_append (captures, capture);
+  }
+  capture->n_streams++;
+  g_mutex_unlock (&captures_lock);
+
+  stream = g_slice_new0 (GstWasapiCaptureStream);
+  stream->callback.lpVtbl = &capture_callback_vtbl;
+  stream->capture = capture;
+  stream->capture_client = capture_client;
+  IUnknown_AddRef (capture_client);
+  stream->client_event = client_event;
+  stream->ready_event = ready_event;
+  stream->bpf = bpf;
+  stream->packet_frames = buffer_frames;
+  stream->memory = g_malloc ((gsize) N_PACKETS * buffer_frames * bpf);
+  for (ii = 0; ii < N_PACKETS; ii++)
+    stream->packets[ii].data = stream->memory + (gsize) ii * buffer_frames *
+        bpf;
+  stream->error = S_OK;
+
+  if (rtwq) {
+    HRESULT hr;
+
+    hr = gst_wasapi_rtwq_tbl.RtwqCreateAsyncResult (NULL, &stream->callback,
+        NULL, &stream->result);
+    if (FAILED (hr)) {
+      CAPTURE_WARNING (hr, RtwqCreateAsyncResult);
+      goto failed;
+    }
+
+    g_mutex_lock (&capture->lock);
+    stream->pending = gst_wasapi_capture_put_work_item (stream);
+    g_mutex_unlock (&capture->lock);
+    if (!stream->pending)
+      goto failed;
+  }
+
+  g_mutex_lock (&capture->lock);
+  capture->streams = g_list_append (capture->streams, stream);
+  capture->cookie++;
+  g_mutex_unlock (&capture->lock);
+  if (capture->wake_handle != NULL)
+    SetEvent (capture->wake_handle);
+
+  GST_INFO_OBJECT (self, "attached to capture %p%s, %u streams",
+      capture, rtwq ? " on RTWQ" : "", capture->n_streams);
+
+  return stream;
+
+failed:
+  if (stream->result != NULL)
+    IUnknown_Release (stream->result);
+  IUnknown_Release (stream->capture_client);
+  g_free (stream->memory);
+  g_slice_free (GstWasapiCaptureStream, stream);
+  gst_wasapi_capture_unref (capture);
+  return NULL;
+}
+
+GstWasapiCaptureStream *
+gst_wasapi_capture_attach_shared (GstElement * self, const gchar * key,
+    IAudioClient * client, IAudioCaptureClient * capture_client,
+    HANDLE client_event, HANDLE ready_event, guint bpf, guint buffer_frames,
+    guint period_frames, gboolean rtwq)
+{
+  GstWasapiCaptureStream *stream;
+  HANDLE event;
+
+  /* Orphaned, the stream outlives the source and its event */
+  if (!DuplicateHandle (GetCurrentProcess (), client_event,
+          GetCurrentProcess (), &event, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+    GST_WARNING_OBJECT (self, "can't duplicate the event handle: %lu",
+        GetLastError ());
+    return NULL;
+  }
+
+  stream = gst_wasapi_capture_attach (self, capture_client, event,
+      ready_event, bpf, buffer_frames, rtwq);
+  if (stream == NULL) {
+    CloseHandle (event);
+    return NULL;
+  }
+
+  stream->key = g_strdup (key);
+  stream->client = client;
+  IUnknown_AddRef (client);
+  stream->period_frames = period_frames;
+
+  g_mutex_lock (&captures_lock);
+  shared_streams = g_list_append (shared_streams, stream);
+  g_mutex_unlock (&captures_lock);
+
+  GST_INFO_OBJECT (self, "sharing capture stream %p as %s", stream, key);
+
+  return stream;
+}
+
+GstWasapiCaptureStream *
+gst_wasapi_capture_follow (GstElement * self, const gchar * key,
+    HANDLE ready_event, IAudioClient ** client, guint * buffer_frames,
+    guint * period_frames)
+{
+  GstWasapiCaptureStream *leader = NULL, *stream;
+  GList *l;
+  guint ii;
+
+  g_mutex_lock (&captures_lock);
+  for (l = shared_streams; l != NULL; l = l->next) {
+    if (g_str_equal (((GstWasapiCaptureStream *) l->data)->key, key)) {
+      leader = l->data;
+      break;
+    }
+  }
+  if (leader == NULL) {
+    g_mutex_unlock (&captures_lock);
+    return NULL;
+  }
+
+  stream = g_slice_new0 (GstWasapiCaptureStream);
+  stream->capture = leader->capture;
+  stream->leader = leader;
+  stream->ready_event = ready_event;
+  stream->bpf = leader->bpf;
+  stream->packet_frames = leader->packet_frames;
+  stream->memory = g_malloc ((gsize) N_PACKETS * stream->packet_frames *
+      stream->bpf);
+  for (ii = 0; ii < N_PACKETS; ii++)
+    stream->packets[ii].data = stream->memory + (gsize) ii *
+        stream->packet_frames * stream->bpf;
+  stream->error = S_OK;
+
+  g_mutex_lock (&leader->capture->lock);
+  leader->followers = g_list_append (leader->followers, stream);
+  g_mutex_unlock (&leader->capture->lock);
+
+  *client = leader->client;
+  IUnknown_AddRef (leader->client);
+  *buffer_frames = leader->packet_frames;
+  *period_frames = leader->period_frames;
+  g_mutex_unlock (&captures_lock);
+
+  GST_INFO_OBJECT (self, "following capture stream %p of %s", leader, key);
+
+  return stream;
+}
+
+/* What detach() does once nobody needs the stream any more */
+static void
+gst_wasapi_capture_release (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+
+  /* The thread only drains streams it still finds in the list. A work
+   * item is fired instead, and not put again. */
+  g_mutex_lock (&capture->lock);
+  capture->streams = g_list_remove (capture->streams, stream);
+  capture->cookie++;
+  stream->detaching = TRUE;
+  if (stream->pending)
+    SetEvent (stream->client_event);
+  while (stream->pending)
+    g_cond_wait (&capture->cond, &capture->lock);
+  g_mutex_unlock (&capture->lock);
+  if (capture->wake_handle != NULL)
+    SetEvent (capture->wake_handle);
+
+  if (stream->n_dropped > 0)
+    GST_INFO ("capture stream %p dropped %" G_GUINT64_FORMAT " packets",
+        stream, stream->n_dropped);
+
+  if (stream->result != NULL)
+    IUnknown_Release (stream->result);
+  IUnknown_Release (stream->capture_client);
+  if (stream->key != NULL) {
+    g_mutex_lock (&captures_lock);
+    shared_streams = g_list_remove (shared_streams, stream);
+    g_mutex_unlock (&captures_lock);
+    IUnknown_Release (stream->client);
+    CloseHandle (stream->client_event);
+    g_free (stream->key);
+  }
+  g_free (stream->memory);
+  g_slice_free (GstWasapiCaptureStream, stream);
+
+  gst_wasapi_capture_unref (capture);
+}
+
+void
+gst_wasapi_capture_detach (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+  GstWasapiCaptureStream *leader = stream->leader;
+  gboolean release;
+
+  g_mutex_lock (&captures_lock);
+  g_mutex_lock (&capture->lock);
+  if (leader != NULL) {
+    leader->followers = g_list_remove (leader->followers, stream);
+    release = leader->orphan && leader->followers == NULL;
+  } else {
+    /* Keeps draining for the followers, into their queues only */
+    stream->orphan = stream->followers != NULL;
+    stream->read = stream->fill = 0;
+    release = !stream->orphan;
+  }
+  g_mutex_unlock (&capture->lock);
+  g_mutex_unlock (&captures_lock);
+
+  if (leader != NULL) {
+    if (stream->n_dropped > 0)
+      GST_INFO ("capture stream %p dropped %" G_GUINT64_FORMAT " packets",
+          stream, stream->n_dropped);
+    g_free (stream->memory);
+    g_slice_free (GstWasapiCaptureStream, stream);
+    if (release)
+      gst_wasapi_capture_release (leader);
+  } else if (release) {
+    gst_wasapi_capture_release (stream);
+  } else {
+    GST_INFO ("capture stream %p still drained for its followers", stream);
+  }
+}
+
+HRESULT
+gst_wasapi_capture_stream_start (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+  GstWasapiCaptureStream *leader = stream->leader ? stream->leader : stream;
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&capture->lock);
+  if (!stream->started) {
+    if (leader->n_started == 0)
+      hr = IAudioClient_Start (leader->client);
+    if (hr == AUDCLNT_E_NOT_STOPPED)
+      hr = S_OK;
+    if (SUCCEEDED (hr)) {
+      stream->started = TRUE;
+      leader->n_started++;
+    }
+  }
+  g_mutex_unlock (&capture->lock);
+
+  return hr;
+}
+
+void
+gst_wasapi_capture_stream_stop (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+  GstWasapiCaptureStream *leader = stream->leader ? stream->leader : stream;
+  GList *l;
+
+  g_mutex_lock (&capture->lock);
+  if (stream->started) {
+    stream->started = FALSE;
+    if (--leader->n_started == 0) {
+      IAudioClient_Stop (leader->client);
+      IAudioClient_Reset (leader->client);
+      leader->read = leader->fill = 0;
+      leader->dropped = FALSE;
+      leader->error = S_OK;
+      for (l = leader->followers; l != NULL; l = l->next) {
+        GstWasapiCaptureStream *follower = l->data;
+
+        follower->read = follower->fill = 0;
+        follower->dropped = FALSE;
+        follower->error = S_OK;
+      }
+    }
+  }
+  g_mutex_unlock (&capture->lock);
+}
+
+HRESULT
+gst_wasapi_capture_stream_get_buffer (GstWasapiCaptureStream * stream,
+    BYTE ** data, UINT32 * n_frames, DWORD * flags, UINT64 * devpos,
+    UINT64 * qpcpos)
+{
+  GstWasapiCapture *capture = stream->capture;
+  GstWasapiCapturePacket *packet;
+  HRESULT hr;
+
+  g_mutex_lock (&capture->lock);
+  if (stream->fill == 0) {
+    hr = FAILED (stream->error) ? stream->error : AUDCLNT_S_BUFFER_EMPTY;
+  } else {
+    packet = &stream->packets[stream->read];
+    *data = packet->data;
+    *n_frames = packet->n_frames;
+    *flags = packet->flags;
+    if (devpos)
+      *devpos = packet->devpos;
+    if (qpcpos)
+      *qpcpos = packet->qpcpos;
+    hr = S_OK;
+  }
+  g_mutex_unlock (&capture->lock);
+
+  return hr;
+}
+
+HRESULT
+gst_wasapi_capture_stream_get_next_packet_size (GstWasapiCaptureStream *
+    stream, UINT32 * n_frames)
+{
+  GstWasapiCapture *capture = stream->capture;
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&capture->lock);
+  if (stream->fill > 0)
+    *n_frames = stream->packets[stream->read].n_frames;
+  else if (FAILED (stream->error))
+    hr = stream->error;
+  else
+    *n_frames = 0;
+  g_mutex_unlock (&capture->lock);
+
+  return hr;
+}
+
+void
+gst_wasapi_capture_stream_release_buffer (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+
+  g_mutex_lock (&capture->lock);
+  if (stream->fill > 0) {
+    stream->read = (stream->read + 1) % N_PACKETS;
+    stream->fill--;
+  }
+  g_mutex_unlock (&capture->lock);
+}
+
+void
+gst_wasapi_capture_stream_reset (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+
+  g_mutex_lock (&capture->lock);
+  stream->read = 0;
+  stream->fill = 0;
+  stream->dropped = FALSE;
+  stream->error = S_OK;
+  g_mutex_unlock (&capture->lock);
+}
+
+guint
+gst_wasapi_capture_stream_get_queued (GstWasapiCaptureStream * stream)
+{
+  GstWasapiCapture *capture = stream->capture;
+  guint ii, queued = 0;
+
+  g_mutex_lock (&capture->lock);
+  for (ii = 0; ii < stream->fill; ii++)
+    queued += stream->packets[(stream->read + ii) % N_PACKETS].n_frames;
+  g_mutex_unlock (&capture->lock);
+
+  return queued;
+}
@@ -0,0 +1,101 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_CAPTURE_H__
+#define __GST_WASAPI_CAPTURE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Process-wide capture thread, for wasapisrc with shared-engine=true.
+ *
+ * Instead of a realtime ringbuffer thread each, sources attach their
+ * capture client and one MMCSS thread waits for the events of up to 63 of
+ * them at once. It drains every client into packet queues of the stream
+ * and signals the ready event of the source, whose read() then takes the
+ * packets from there like it would from the client. More sources start
+ * another thread.
+ *
+ * With share-client, sources capturing the same endpoint in the same
+ * format follow the stream of the first one instead of opening a client
+ * of their own, so the engine runs a single stream for all of them.
+ *
+ * With RTWQ, a work item on the shared MMCSS queue of the Real-Time Work
+ * Queue API waits for each event instead, and the OS runs them on the
+ * threads it manages. */
+typedef struct _GstWasapiCapture GstWasapiCapture;
+typedef struct _GstWasapiCaptureStream GstWasapiCaptureStream;
+
+/* Services @capture_client whenever @client_event, the event handle of its
+ * client, is signalled, and signals @ready_event after queueing packets.
+ * The client has to be started after this. With @rtwq from RTWQ work
+ * items if available, from a thread otherwise. NULL on errors. */
+GstWasapiCaptureStream *gst_wasapi_capture_attach (GstElement * element,
+    IAudioCaptureClient * capture_client, HANDLE client_event,
+    HANDLE ready_event, guint bpf, guint buffer_frames, gboolean rtwq);
+
+/* Like attach(), and offers the stream to other sources as @key. Those get
+ * its packets as well and share @client, which is started and stopped
+ * with gst_wasapi_capture_stream_start() and _stop() then. The stream
+ * lives on, and keeps draining the client, as long as it has followers. */
+GstWasapiCaptureStream *gst_wasapi_capture_attach_shared (GstElement * element,
+    const gchar * key, IAudioClient * client,
+    IAudioCaptureClient * capture_client, HANDLE client_event,
+    HANDLE ready_event, guint bpf, guint buffer_frames, guint period_frames,
+    gboolean rtwq);
+
+/* A queue of the stream another source shares as @key, with its client in
+ * @client and its sizes in @buffer_frames and @period_frames. NULL if
+ * nobody shares @key. */
+GstWasapiCaptureStream *gst_wasapi_capture_follow (GstElement * element,
+    const gchar * key, HANDLE ready_event, IAudioClient ** client,
+    guint * buffer_frames, guint * period_frames);
+
+void gst_wasapi_capture_detach (GstWasapiCaptureStream * stream);
+
+/* For streams of attach_shared() and follow(). The shared client runs while
+ * any of them is started, and is reset once the last one stops. */
+HRESULT gst_wasapi_capture_stream_start (GstWasapiCaptureStream * stream);
+
+void gst_wasapi_capture_stream_stop (GstWasapiCaptureStream * stream);
+
+/* Like IAudioCaptureClient::GetBuffer on the queue. Returns
+ * AUDCLNT_S_BUFFER_EMPTY when nothing is queued, or the error of the client
+ * once everything before it was read. Packets that didn't fit into the
+ * queue are dropped, the next one has the discontinuity flag. */
+HRESULT gst_wasapi_capture_stream_get_buffer (GstWasapiCaptureStream * stream,
+    BYTE ** data, UINT32 * n_frames, DWORD * flags, UINT64 * devpos,
+    UINT64 * qpcpos);
+
+/* Like IAudioCaptureClient::GetNextPacketSize on the queue, 0 frames when
+ * nothing is queued. Returns the error of the client like get_buffer. */
+HRESULT gst_wasapi_capture_stream_get_next_packet_size (GstWasapiCaptureStream
+    * stream, UINT32 * n_frames);
+
+/* Releases the packet of the last get_buffer */
+void gst_wasapi_capture_stream_release_buffer (GstWasapiCaptureStream *
+    stream);
+
+/* Drops what is queued, after the client was reset */
+void gst_wasapi_capture_stream_reset (GstWasapiCaptureStream * stream);
+
+/* Frames queued and not read yet */
+guint gst_wasapi_capture_stream_get_queued (GstWasapiCaptureStream * stream);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_CAPTURE_H__ */
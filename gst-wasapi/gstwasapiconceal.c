@@ -0,0 +1,228 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiconceal.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* The concealment fades to silence over this */
+#define FADE_OUT_MS 40
+/* And real frames take over within this */
+#define CROSSFADE_MS 5
+
+struct _GstWasapiConceal
+{
+  gboolean is_float;
+  guint channels;
+  guint bpf;
+
+  /* The last real frames, a period at most */
+  guint8 *history;
+  guint history_frames;
+  guint n_history;
+
+  /* Set from the first missing frame until the crossfade back is done */
+  gboolean active;
+  /* Where we are in the history, going back and forth */
+  gint pos;
+  gint dir;
+  /* Of the concealment, 0 once it faded out or after a dropout */
+  gdouble gain;
+  gdouble fade_step;
+  guint crossfade_frames;
+  guint crossfade_done;
+};
+
+GstWasapiConceal *
+gst_wasapi_conceal_new (const WAVEFORMATEX * format, guint period_frames)
+{
+  GstWasapiConceal *self;
+  gboolean is_float;
+
+  if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    is_float = TRUE;
+  else if (format->wFormatTag == WAVE_FORMAT_PCM)
+    is_float = FALSE;
+  else if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    is_float = IsEqualGUID (&((WAVEFORMATEXTENSIBLE *) format)->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+  else
+    return NULL;
+
+  if ((is_float && format->wBitsPerSample != 32) ||
+      (!is_float && format->wBitsPerSample != 16))
+    return NULL;
+
+  self = g_slice_new0 (GstWasapiConceal);
+  self->is_float = is_float;
+  self->channels = format->nChannels;
+  self->bpf = format->nBlockAlign;
+  self->history_frames = MAX (period_frames, 1);
+  self->history = g_malloc ((gsize) self->history_frames * self->bpf);
+  self->fade_step = 1000.0 / (format->nSamplesPerSec * FADE_OUT_MS);
+  self->crossfade_frames = MAX (format->nSamplesPerSec * CROSSFADE_MS / 1000,
+      1);
+
+  return self;
+}
+
+void
+gst_wasapi_conceal_free (GstWasapiConceal * self)
+{
+  g_free (self->history);
+  g_slice_free (GstWasapiConceal, self);
+}
+
+void
+gst_wasapi_conceal_reset (GstWasapiConceal * self)
+{
+  self->n_history = 0;
+  self->active = FALSE;
+}
+
+static inline gdouble
+gst_wasapi_conceal_get (GstWasapiConceal * self, const guint8 * frame,
+    guint c)
+{
+  if (self->is_float)
+    return ((const gfloat *) frame)[c];
+
+  return ((const gint16 *) frame)[c] / 32768.0;
+}
+
+static inline void
+gst_wasapi_conceal_set (GstWasapiConceal * self, guint8 * frame, guint c,
+    gdouble v)
+{
+  if (self->is_float)
+    ((gfloat *) frame)[c] = (gfloat) v;
+  else
+    ((gint16 *) frame)[c] = (gint16) CLAMP (v * 32768.0, G_MININT16,
+        G_MAXINT16);
+}
+
+/* Channel @c of the current concealment frame */
+static inline gdouble
+gst_wasapi_conceal_sample (GstWasapiConceal * self, guint c)
+{
+  if (self->gain <= 0 || self->n_history == 0)
+    return 0;
+
+  return self->gain * gst_wasapi_conceal_get (self,
+      self->history + (gsize) self->pos * self->bpf, c);
+}
+
+static void
+gst_wasapi_conceal_step (GstWasapiConceal * self)
+{
+  if (self->gain <= 0)
+    return;
+
+  self->gain -= self->fade_step;
+
+  /* Turning around repeats a frame instead of jumping to the other end */
+  if ((self->dir < 0 && self->pos == 0) ||
+      (self->dir > 0 && self->pos + 1 >= (gint) self->n_history))
+    self->dir = -self->dir;
+  else
+    self->pos += self->dir;
+}
+
+gboolean
+gst_wasapi_conceal_fill (GstWasapiConceal * self, guint8 * dst,
+    guint n_frames)
+{
+  guint i, c;
+
+  if (!self->active) {
+    GST_DEBUG ("concealing from %u frames", self->n_history);
+    self->active = TRUE;
+    self->gain = self->n_history > 0 ? 1.0 : 0.0;
+    /* Backwards from the last frame that was played */
+    self->pos = MAX ((gint) self->n_history - 1, 0);
+    self->dir = -1;
+  }
+  /* Real frames that came meanwhile start the crossfade over */
+  self->crossfade_done = 0;
+
+  if (self->gain <= 0)
+    return FALSE;
+
+  for (i = 0; i < n_frames; i++) {
+    guint8 *frame = dst + (gsize) i * self->bpf;
+
+    for (c = 0; c < self->channels; c++)
+      gst_wasapi_conceal_set (self, frame, c,
+          gst_wasapi_conceal_sample (self, c));
+    gst_wasapi_conceal_step (self);
+  }
+
+  return TRUE;
+}
+
+void
+gst_wasapi_conceal_real (GstWasapiConceal * self, guint8 * dst,
+    guint n_frames)
+{
+  guint i, c, keep;
+
+  for (i = 0; self->active && i < n_frames; i++) {
+    guint8 *frame = dst + (gsize) i * self->bpf;
+    gdouble w = (gdouble) ++self->crossfade_done / self->crossfade_frames;
+
+    for (c = 0; c < self->channels; c++)
+      gst_wasapi_conceal_set (self, frame, c,
+          gst_wasapi_conceal_get (self, frame, c) * w +
+          gst_wasapi_conceal_sample (self, c) * (1.0 - w));
+    gst_wasapi_conceal_step (self);
+
+    if (self->crossfade_done >= self->crossfade_frames)
+      self->active = FALSE;
+  }
+
+  /* The history is still read until the crossfade is done */
+  if (self->active)
+    return;
+
+  keep = MIN (n_frames, self->history_frames);
+  if (self->n_history + keep > self->history_frames) {
+    guint drop = self->n_history + keep - self->history_frames;
+
+    memmove (self->history, self->history + (gsize) drop * self->bpf,
+        (gsize) (self->n_history - drop) * self->bpf);
+    self->n_history -= drop;
+  }
+  memcpy (self->history + (gsize) self->n_history * self->bpf,
+      dst + (gsize) (n_frames - keep) * self->bpf, (gsize) keep * self->bpf);
+  self->n_history += keep;
+}
+
+void
+gst_wasapi_conceal_dropout (GstWasapiConceal * self)
+{
+  /* Crossfading from a silent concealment is fading in */
+  self->active = TRUE;
+  self->gain = 0;
+  self->crossfade_done = 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_CONCEAL_H__
+#define __GST_WASAPI_CONCEAL_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Underrun concealment of wasapisink with conceal=true.
+ *
+ * Keeps the last device period of what was rendered, in device order.
+ * Where there is nothing to render, it plays that period back and forth
+ * instead of silence, so it never jumps, fading out over 40 ms. When the
+ * real frames come back they are crossfaded in over 5 ms. When the device
+ * ran dry before we could do anything, the engine played silence, so the
+ * real frames fade in from that. */
+typedef struct _GstWasapiConceal GstWasapiConceal;
+
+/* NULL unless @format is 32 bit float or 16 bit integer PCM */
+GstWasapiConceal *gst_wasapi_conceal_new (const WAVEFORMATEX * format,
+    guint period_frames);
+
+void gst_wasapi_conceal_free (GstWasapiConceal * conceal);
+
+/* Forgets the last period, after a flush */
+void gst_wasapi_conceal_reset (GstWasapiConceal * conceal);
+
+/* Writes @n_frames of concealment to @dst. FALSE if there is nothing left
+ * to conceal with, then @dst is untouched and should be silence. */
+gboolean gst_wasapi_conceal_fill (GstWasapiConceal * conceal, guint8 * dst,
+    guint n_frames);
+
+/* The @n_frames at @dst are real, crossfades them in after a concealment
+ * or a dropout and remembers them */
+void gst_wasapi_conceal_real (GstWasapiConceal * conceal, guint8 * dst,
+    guint n_frames);
+
+/* The device played silence since the last frames we gave it */
+void gst_wasapi_conceal_dropout (GstWasapiConceal * conceal);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_CONCEAL_H__ */
@@ -0,0 +1,657 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiconvert.h"
+#include "gstwasapicpu.h"
+
+#ifdef GST_WASAPI_CPU_X86
+#include <immintrin.h>
+#elif defined(GST_WASAPI_CPU_ARM64)
+#include <arm_neon.h>
+#endif
+
+typedef void (*GstWasapiConvertFunc) (GstWasapiConvert * self,
+    gconstpointer in, gpointer out, guint n_frames);
+
+struct _GstWasapiConvert
+{
+  /* Picked once in new(), for the format, the dither and the channels */
+  GstWasapiConvertFunc func;
+
+  GstAudioFormat format;
+  gint in_channels;
+  gint channels;
+  gboolean dither;
+  /* State of the dither noise generator */
+  guint32 seed;
+
+  /* Mixing matrix, out_channels rows of in_channels gains */
+  gfloat *matrix;
+
+  /* Only for channel counts without a kernel, NULL otherwise */
+  GstAudioChannelMixer *mixer;
+  /* Mixed samples, when they still need converting. Loaded ones for @mix
+   * otherwise. */
+  gfloat *mix_data;
+  gsize mix_size;
+
+  /* Integer to float of the same channels, then @mix changes those unless
+   * it's NULL */
+  GstWasapiConvertFunc load;
+  GstWasapiConvert *mix;
+};
+
+/* Uniform in [-0.5, 0.5), one LCG step */
+static inline gfloat
+gst_wasapi_convert_noise (guint32 * seed)
+{
+  *seed = *seed * 1664525 + 1013904223;
+  return (gfloat) (*seed >> 8) / (1 << 24) - 0.5f;
+}
+
+/* How one float sample @v is stored to @dst per output format. The dither
+ * is triangular noise of +-1 LSB, from the sum of two uniform values. Needs
+ * double for S32, float can't hold G_MAXINT32. */
+#define STORE_F32(dst, v) \
+  (dst) = (v)
+#define STORE_S16(dst, v) \
+  G_STMT_START { \
+    gfloat _v = CLAMP ((v) * 32768.0f, -32768.0f, 32767.0f); \
+    (dst) = (gint16) (_v < 0 ? _v - 0.5f : _v + 0.5f); \
+  } G_STMT_END
+#define STORE_S16_DITHER(dst, v) \
+  G_STMT_START { \
+    gfloat _v = (v) * 32768.0f + gst_wasapi_convert_noise (&seed) + \
+        gst_wasapi_convert_noise (&seed); \
+    _v = CLAMP (_v, -32768.0f, 32767.0f); \
+    (dst) = (gint16) (_v < 0 ? _v - 0.5f : _v + 0.5f); \
+  } G_STMT_END
+#define STORE_S32(dst, v) \
+  G_STMT_START { \
+    gdouble _v = CLAMP ((gdouble) (v) * 2147483648.0, -2147483648.0, \
+        2147483647.0); \
+    (dst) = (gint32) (_v < 0 ? _v - 0.5 : _v + 0.5); \
+  } G_STMT_END
+
+/* Sample format conversion only, the channel count doesn't matter. The
+ * loops are kept simple enough for the compiler to vectorize. */
+#define DEFINE_CONVERT(name, type, STORE) \
+static void \
+convert_##name (GstWasapiConvert * self, gconstpointer in_data, \
+    gpointer data, guint n_frames) \
+{ \
+  const gfloat *in = in_data; \
+  type *out = data; \
+  guint n = n_frames * self->channels; \
+  guint32 seed = self->seed; \
+  \
+  for (guint ii = 0; ii < n; ii++) \
+    STORE (out[ii], in[ii]); \
+  \
+  self->seed = seed; \
+}
+
+DEFINE_CONVERT (s16, gint16, STORE_S16);
+DEFINE_CONVERT (s16_dither, gint16, STORE_S16_DITHER);
+DEFINE_CONVERT (s32, gint32, STORE_S32);
+
+/* How one integer sample @v becomes float, the reverse of the STOREs.
+ * S24_32 only has the low 24 bits, the shifts sign extend them. */
+#define LOAD_S16(v) \
+  ((gfloat) (v) * (1.0f / 32768.0f))
+#define LOAD_S24_32(v) \
+  ((gfloat) ((gint32) ((guint32) (v) << 8) >> 8) * (1.0f / 8388608.0f))
+#define LOAD_S32(v) \
+  ((gfloat) ((gdouble) (v) * (1.0 / 2147483648.0)))
+
+/* Integer to float, also simple enough to vectorize */
+#define DEFINE_LOAD(name, type, LOAD) \
+static void \
+load_##name (GstWasapiConvert * self, gconstpointer in_data, gpointer data, \
+    guint n_frames) \
+{ \
+  const type *in = in_data; \
+  gfloat *out = data; \
+  guint n = n_frames * self->in_channels; \
+  \
+  for (guint ii = 0; ii < n; ii++) \
+    out[ii] = LOAD (in[ii]); \
+}
+
+DEFINE_LOAD (s16, gint16, LOAD_S16);
+DEFINE_LOAD (s24_32, gint32, LOAD_S24_32);
+DEFINE_LOAD (s32, gint32, LOAD_S32);
+
+#ifdef GST_WASAPI_CPU_X86
+/* AVX2 versions of the kernels above with the most samples through them,
+ * for when the compiler only vectorizes for the baseline. Rounded and
+ * clipped exactly like the STOREs: half away from zero, then truncated. */
+static GST_WASAPI_TARGET ("avx2") void
+convert_s16_avx2 (GstWasapiConvert * self, gconstpointer in_data,
+    gpointer data, guint n_frames)
+{
+  const gfloat *in = in_data;
+  gint16 *out = data;
+  guint n = n_frames * self->channels, ii = 0;
+  const __m256 scale = _mm256_set1_ps (32768.0f);
+  const __m256 lo = _mm256_set1_ps (-32768.0f);
+  const __m256 hi = _mm256_set1_ps (32767.0f);
+  const __m256 half = _mm256_set1_ps (0.5f);
+  const __m256 sign = _mm256_set1_ps (-0.0f);
+
+  for (; ii + 16 <= n; ii += 16) {
+    __m256 a = _mm256_mul_ps (_mm256_loadu_ps (in + ii), scale);
+    __m256 b = _mm256_mul_ps (_mm256_loadu_ps (in + ii + 8), scale);
+    __m256i packed;
+
+    a = _mm256_min_ps (_mm256_max_ps (a, lo), hi);
+    b = _mm256_min_ps (_mm256_max_ps (b, lo), hi);
+    a = _mm256_add_ps (a, _mm256_or_ps (_mm256_and_ps (a, sign), half));
+    b = _mm256_add_ps (b, _mm256_or_ps (_mm256_and_ps (b, sign), half));
+    /* Packing works per 128 bit lane, the permute puts them in order */
+    packed = _mm256_packs_epi32 (_mm256_cvttps_epi32 (a),
+        _mm256_cvttps_epi32 (b));
+    _mm256_storeu_si256 ((__m256i *) (out + ii),
+        _mm256_permute4x64_epi64 (packed, 0xd8));
+  }
+
+  for (; ii < n; ii++)
+    STORE_S16 (out[ii], in[ii]);
+}
+
+static GST_WASAPI_TARGET ("avx2") void
+convert_s32_avx2 (GstWasapiConvert * self, gconstpointer in_data,
+    gpointer data, guint n_frames)
+{
+  const gfloat *in = in_data;
+  gint32 *out = data;
+  guint n = n_frames * self->channels, ii = 0;
+  const __m256d scale = _mm256_set1_pd (2147483648.0);
+  const __m256d lo = _mm256_set1_pd (-2147483648.0);
+  const __m256d hi = _mm256_set1_pd (2147483647.0);
+  const __m256d half = _mm256_set1_pd (0.5);
+  const __m256d sign = _mm256_set1_pd (-0.0);
+
+  for (; ii + 4 <= n; ii += 4) {
+    __m256d v = _mm256_mul_pd (_mm256_cvtps_pd (_mm_loadu_ps (in + ii)),
+        scale);
+
+    v = _mm256_min_pd (_mm256_max_pd (v, lo), hi);
+    v = _mm256_add_pd (v, _mm256_or_pd (_mm256_and_pd (v, sign), half));
+    _mm_storeu_si128 ((__m128i *) (out + ii), _mm256_cvttpd_epi32 (v));
+  }
+
+  for (; ii < n; ii++)
+    STORE_S32 (out[ii], in[ii]);
+}
+
+static GST_WASAPI_TARGET ("avx2") void
+load_s16_avx2 (GstWasapiConvert * self, gconstpointer in_data,
+    gpointer data, guint n_frames)
+{
+  const gint16 *in = in_data;
+  gfloat *out = data;
+  guint n = n_frames * self->in_channels, ii = 0;
+  const __m256 scale = _mm256_set1_ps (1.0f / 32768.0f);
+
+  for (; ii + 8 <= n; ii += 8) {
+    __m256i v =
+        _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) (in + ii)));
+
+    _mm256_storeu_ps (out + ii, _mm256_mul_ps (_mm256_cvtepi32_ps (v),
+            scale));
+  }
+
+  for (; ii < n; ii++)
+    out[ii] = LOAD_S16 (in[ii]);
+}
+#elif defined(GST_WASAPI_CPU_ARM64)
+/* NEON versions of the same kernels, rounded and clipped the same way. The
+ * half gets the sign of the sample with a bit select, the conversions to
+ * integer truncate. */
+static void
+convert_s16_neon (GstWasapiConvert * self, gconstpointer in_data,
+    gpointer data, guint n_frames)
+{
+  const gfloat *in = in_data;
+  gint16 *out = data;
+  guint n = n_frames * self->channels, ii = 0;
+  const float32x4_t lo = vdupq_n_f32 (-32768.0f);
+  const float32x4_t hi = vdupq_n_f32 (32767.0f);
+  const float32x4_t half = vdupq_n_f32 (0.5f);
+  const uint32x4_t sign = vdupq_n_u32 (0x80000000);
+
+  for (; ii + 8 <= n; ii += 8) {
+    float32x4_t a = vmulq_n_f32 (vld1q_f32 (in + ii), 32768.0f);
+    float32x4_t b = vmulq_n_f32 (vld1q_f32 (in + ii + 4), 32768.0f);
+
+    a = vminq_f32 (vmaxq_f32 (a, lo), hi);
+    b = vminq_f32 (vmaxq_f32 (b, lo), hi);
+    a = vaddq_f32 (a, vbslq_f32 (sign, a, half));
+    b = vaddq_f32 (b, vbslq_f32 (sign, b, half));
+    vst1q_s16 (out + ii, vcombine_s16 (vqmovn_s32 (vcvtq_s32_f32 (a)),
+            vqmovn_s32 (vcvtq_s32_f32 (b))));
+  }
+
+  for (; ii < n; ii++)
+    STORE_S16 (out[ii], in[ii]);
+}
+
+static void
+convert_s32_neon (GstWasapiConvert * self, gconstpointer in_data,
+    gpointer data, guint n_frames)
+{
+  const gfloat *in = in_data;
+  gint32 *out = data;
+  guint n = n_frames * self->channels, ii = 0;
+  const float64x2_t lo = vdupq_n_f64 (-2147483648.0);
+  const float64x2_t hi = vdupq_n_f64 (2147483647.0);
+  const float64x2_t half = vdupq_n_f64 (0.5);
+  const uint64x2_t sign = vdupq_n_u64 (G_GUINT64_CONSTANT (1) << 63);
+
+  for (; ii + 4 <= n; ii += 4) {
+    float32x4_t v = vld1q_f32 (in + ii);
+    float64x2_t a = vmulq_n_f64 (vcvt_f64_f32 (vget_low_f32 (v)),
+        2147483648.0);
+    float64x2_t b = vmulq_n_f64 (vcvt_f64_f32 (vget_high_f32 (v)),
+        2147483648.0);
+
+    a = vminq_f64 (vmaxq_f64 (a, lo), hi);
+    b = vminq_f64 (vmaxq_f64 (b, lo), hi);
+    a = vaddq_f64 (a, vbslq_f64 (sign, a, half));
+    b = vaddq_f64 (b, vbslq_f64 (sign, b, half));
+    vst1q_s32 (out + ii, vcombine_s32 (vmovn_s64 (vcvtq_s64_f64 (a)),
+            vmovn_s64 (vcvtq_s64_f64 (b))));
+  }
+
+  for (; ii < n; ii++)
+    STORE_S32 (out[ii], in[ii]);
+}
+
+static void
+load_s16_neon (GstWasapiConvert * self, gconstpointer in_data,
+    gpointer data, guint n_frames)
+{
+  const gint16 *in = in_data;
+  gfloat *out = data;
+  guint n = n_frames * self->in_channels, ii = 0;
+
+  for (; ii + 8 <= n; ii += 8) {
+    int16x8_t v = vld1q_s16 (in + ii);
+
+    vst1q_f32 (out + ii, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16
+                (vget_low_s16 (v))), 1.0f / 32768.0f));
+    vst1q_f32 (out + ii + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16
+                (vget_high_s16 (v))), 1.0f / 32768.0f));
+  }
+
+  for (; ii < n; ii++)
+    out[ii] = LOAD_S16 (in[ii]);
+}
+#endif
+
+/* The fastest version of @func this CPU runs, picked once in new() */
+static GstWasapiConvertFunc
+gst_wasapi_convert_dispatch (GstWasapiConvertFunc func)
+{
+#ifdef GST_WASAPI_CPU_X86
+  if (gst_wasapi_cpu_get_flags () & GST_WASAPI_CPU_AVX2) {
+    if (func == convert_s16)
+      return convert_s16_avx2;
+    if (func == convert_s32)
+      return convert_s32_avx2;
+    if (func == load_s16)
+      return load_s16_avx2;
+  }
+#elif defined(GST_WASAPI_CPU_ARM64)
+  if (gst_wasapi_cpu_get_flags () & GST_WASAPI_CPU_NEON) {
+    if (func == convert_s16)
+      return convert_s16_neon;
+    if (func == convert_s32)
+      return convert_s32_neon;
+    if (func == load_s16)
+      return load_s16_neon;
+  }
+#endif
+
+  return func;
+}
+
+/* Integer samples with other channels: loaded first, then mixed */
+static void
+load_mix (GstWasapiConvert * self, gconstpointer in, gpointer out,
+    guint n_frames)
+{
+  guint n_samples = n_frames * self->in_channels;
+
+  if (self->mix_size < n_samples) {
+    g_free (self->mix_data);
+    self->mix_size = n_samples;
+    self->mix_data = g_new (gfloat, n_samples);
+  }
+
+  self->load (self, in, self->mix_data, n_frames);
+  gst_wasapi_convert_process (self->mix, self->mix_data, out, n_frames);
+}
+
+/* Downmix or upmix and conversion in one pass, for channel counts fixed at
+ * compile time, so the matrix loops are unrolled */
+#define DEFINE_MIX(IN, OUT, name, type, STORE) \
+static void \
+mix_##IN##_##OUT##_##name (GstWasapiConvert * self, \
+    gconstpointer in_data, gpointer data, guint n_frames) \
+{ \
+  const gfloat *in = in_data; \
+  const gfloat *m = self->matrix; \
+  type *out = data; \
+  guint32 seed = self->seed; \
+  \
+  for (guint ii = 0; ii < n_frames; ii++) { \
+    for (gint oo = 0; oo < OUT; oo++) { \
+      gfloat v = 0; \
+      \
+      for (gint cc = 0; cc < IN; cc++) \
+        v += m[oo * IN + cc] * in[cc]; \
+      STORE (out[oo], v); \
+    } \
+    in += IN; \
+    out += OUT; \
+  } \
+  \
+  self->seed = seed; \
+}
+
+#define DEFINE_MIX_FORMATS(IN, OUT) \
+  DEFINE_MIX (IN, OUT, f32, gfloat, STORE_F32) \
+  DEFINE_MIX (IN, OUT, s16, gint16, STORE_S16) \
+  DEFINE_MIX (IN, OUT, s16_dither, gint16, STORE_S16_DITHER) \
+  DEFINE_MIX (IN, OUT, s32, gint32, STORE_S32)
+
+DEFINE_MIX_FORMATS (2, 1);
+DEFINE_MIX_FORMATS (6, 1);
+DEFINE_MIX_FORMATS (6, 2);
+DEFINE_MIX_FORMATS (8, 1);
+DEFINE_MIX_FORMATS (8, 2);
+DEFINE_MIX_FORMATS (1, 2);
+DEFINE_MIX_FORMATS (2, 6);
+DEFINE_MIX_FORMATS (2, 8);
+DEFINE_MIX_FORMATS (6, 8);
+
+static const struct
+{
+  gint in_channels;
+  gint out_channels;
+  /* For F32LE, S16LE, S16LE with dither and S32LE */
+  GstWasapiConvertFunc funcs[4];
+} mix_kernels[] = {
+#define MIX_KERNEL(IN, OUT) \
+  {IN, OUT, {mix_##IN##_##OUT##_f32, mix_##IN##_##OUT##_s16, \
+      mix_##IN##_##OUT##_s16_dither, mix_##IN##_##OUT##_s32}}
+  MIX_KERNEL (2, 1),
+  MIX_KERNEL (6, 1),
+  MIX_KERNEL (6, 2),
+  MIX_KERNEL (8, 1),
+  MIX_KERNEL (8, 2),
+  MIX_KERNEL (1, 2),
+  MIX_KERNEL (2, 6),
+  MIX_KERNEL (2, 8),
+  MIX_KERNEL (6, 8),
+#undef MIX_KERNEL
+};
+
+/* Unpositioned channels on both sides, like the many of pro interfaces, map
+ * one to one, as in the identity matrix GstAudioChannelMixer would build for
+ * them: the first ones are copied, the others of the output are silent */
+#define DEFINE_SELECT(name, type, STORE) \
+static void \
+select_##name (GstWasapiConvert * self, gconstpointer in_data, \
+    gpointer data, guint n_frames) \
+{ \
+  const gfloat *in = in_data; \
+  type *out = data; \
+  gint n = MIN (self->in_channels, self->channels); \
+  guint32 seed = self->seed; \
+  \
+  for (guint ii = 0; ii < n_frames; ii++) { \
+    gint cc; \
+    \
+    for (cc = 0; cc < n; cc++) \
+      STORE (out[cc], in[cc]); \
+    for (; cc < self->channels; cc++) \
+      out[cc] = 0; \
+    in += self->in_channels; \
+    out += self->channels; \
+  } \
+  \
+  self->seed = seed; \
+}
+
+DEFINE_SELECT (f32, gfloat, STORE_F32);
+DEFINE_SELECT (s16, gint16, STORE_S16);
+DEFINE_SELECT (s16_dither, gint16, STORE_S16_DITHER);
+DEFINE_SELECT (s32, gint32, STORE_S32);
+
+/* For F32LE, S16LE, S16LE with dither and S32LE */
+static const GstWasapiConvertFunc select_funcs[] = {
+  select_f32, select_s16, select_s16_dither, select_s32
+};
+
+/* Any other channel counts: GstAudioChannelMixer, then the conversion */
+static void
+convert_mixer (GstWasapiConvert * self, gconstpointer in, gpointer out,
+    guint n_frames)
+{
+  guint n_samples = n_frames * self->channels;
+  gpointer mix_in[1] = { (gpointer) in };
+  gpointer mix_out[1] = { out };
+
+  /* Float output takes the mix as it is */
+  if (self->format != GST_AUDIO_FORMAT_F32LE) {
+    if (self->mix_size < n_samples) {
+      g_free (self->mix_data);
+      self->mix_size = n_samples;
+      self->mix_data = g_new (gfloat, n_samples);
+    }
+    mix_out[0] = self->mix_data;
+  }
+
+  gst_audio_channel_mixer_samples (self->mixer, mix_in, mix_out, n_frames);
+
+  if (self->format == GST_AUDIO_FORMAT_S32LE)
+    convert_s32 (self, self->mix_data, out, n_frames);
+  else if (self->format == GST_AUDIO_FORMAT_S16LE && self->dither)
+    convert_s16_dither (self, self->mix_data, out, n_frames);
+  else if (self->format == GST_AUDIO_FORMAT_S16LE)
+    convert_s16 (self, self->mix_data, out, n_frames);
+}
+
+/* The mixer has no getter for its matrix, so we pass it one impulse per
+ * input channel and read the gains off the output */
+static void
+gst_wasapi_convert_fill_matrix (GstWasapiConvert * self)
+{
+  gint in_channels = self->in_channels, out_channels = self->channels;
+  gfloat *impulses = g_new0 (gfloat, in_channels * in_channels);
+  gfloat *response = g_new0 (gfloat, in_channels * out_channels);
+  gpointer in[1] = { impulses };
+  gpointer out[1] = { response };
+
+  for (gint cc = 0; cc < in_channels; cc++)
+    impulses[cc * in_channels + cc] = 1.0f;
+
+  gst_audio_channel_mixer_samples (self->mixer, in, out, in_channels);
+
+  self->matrix = g_new (gfloat, out_channels * in_channels);
+  for (gint oo = 0; oo < out_channels; oo++)
+    for (gint cc = 0; cc < in_channels; cc++)
+      self->matrix[oo * in_channels + cc] = response[cc * out_channels + oo];
+
+  g_free (impulses);
+  g_free (response);
+}
+
+static guint
+gst_wasapi_convert_format_index (GstWasapiConvert * self)
+{
+  switch (self->format) {
+    case GST_AUDIO_FORMAT_S16LE:
+      return self->dither ? 2 : 1;
+    case GST_AUDIO_FORMAT_S32LE:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+GstWasapiConvert *
+gst_wasapi_convert_new (const GstAudioInfo * in_info,
+    const GstAudioInfo * out_info, gboolean dither)
+{
+  GstWasapiConvert *self;
+  GstAudioFormat format = GST_AUDIO_INFO_FORMAT (out_info);
+  GstAudioChannelMixerFlags flags = GST_AUDIO_CHANNEL_MIXER_FLAGS_NONE;
+  gint in_channels = GST_AUDIO_INFO_CHANNELS (in_info);
+  gint out_channels = GST_AUDIO_INFO_CHANNELS (out_info);
+
+  if (format == GST_AUDIO_FORMAT_F32LE &&
+      GST_AUDIO_INFO_FORMAT (in_info) != GST_AUDIO_FORMAT_F32LE) {
+    GstWasapiConvertFunc func;
+
+    switch (GST_AUDIO_INFO_FORMAT (in_info)) {
+      case GST_AUDIO_FORMAT_S16LE:
+        func = load_s16;
+        break;
+      case GST_AUDIO_FORMAT_S24_32LE:
+        func = load_s24_32;
+        break;
+      case GST_AUDIO_FORMAT_S32LE:
+        func = load_s32;
+        break;
+      default:
+        return NULL;
+    }
+    if (GST_AUDIO_INFO_RATE (in_info) != GST_AUDIO_INFO_RATE (out_info))
+      return NULL;
+
+    self = g_slice_new0 (GstWasapiConvert);
+    self->format = format;
+    self->in_channels = in_channels;
+    self->channels = out_channels;
+    self->load = self->func = gst_wasapi_convert_dispatch (func);
+
+    if (out_channels != in_channels) {
+      GstAudioInfo float_info = *in_info;
+
+      float_info.finfo = gst_audio_format_get_info (GST_AUDIO_FORMAT_F32LE);
+      float_info.bpf = in_channels * 4;
+      self->mix = gst_wasapi_convert_new (&float_info, out_info, FALSE);
+      if (self->mix == NULL) {
+        g_slice_free (GstWasapiConvert, self);
+        return NULL;
+      }
+      self->func = load_mix;
+    }
+    return self;
+  }
+
+  if (GST_AUDIO_INFO_FORMAT (in_info) != GST_AUDIO_FORMAT_F32LE ||
+      GST_AUDIO_INFO_RATE (in_info) != GST_AUDIO_INFO_RATE (out_info))
+    return NULL;
+
+  if (format != GST_AUDIO_FORMAT_F32LE && format != GST_AUDIO_FORMAT_S16LE &&
+      format != GST_AUDIO_FORMAT_S32LE)
+    return NULL;
+
+  if (format == GST_AUDIO_FORMAT_F32LE && out_channels == in_channels)
+    return NULL;
+
+  self = g_slice_new0 (GstWasapiConvert);
+  self->format = format;
+  self->in_channels = in_channels;
+  self->channels = out_channels;
+  /* 32 bits have no quantization noise worth masking */
+  self->dither = dither && format == GST_AUDIO_FORMAT_S16LE;
+  self->seed = 0x12345678;
+
+  if (out_channels == in_channels) {
+    if (format == GST_AUDIO_FORMAT_S32LE)
+      self->func = convert_s32;
+    else if (self->dither)
+      self->func = convert_s16_dither;
+    else
+      self->func = convert_s16;
+    self->func = gst_wasapi_convert_dispatch (self->func);
+    return self;
+  }
+
+  /* A full matrix per frame only to keep the first channels otherwise */
+  if (GST_AUDIO_INFO_IS_UNPOSITIONED (in_info) &&
+      GST_AUDIO_INFO_IS_UNPOSITIONED (out_info)) {
+    self->func = select_funcs[gst_wasapi_convert_format_index (self)];
+    return self;
+  }
+
+  if (GST_AUDIO_INFO_IS_UNPOSITIONED (in_info))
+    flags |= GST_AUDIO_CHANNEL_MIXER_FLAGS_UNPOSITIONED_IN;
+  if (GST_AUDIO_INFO_IS_UNPOSITIONED (out_info))
+    flags |= GST_AUDIO_CHANNEL_MIXER_FLAGS_UNPOSITIONED_OUT;
+
+  self->mixer = gst_audio_channel_mixer_new (flags, GST_AUDIO_FORMAT_F32,
+      in_channels, (GstAudioChannelPosition *) in_info->position,
+      out_channels, (GstAudioChannelPosition *) out_info->position);
+  if (self->mixer == NULL) {
+    g_slice_free (GstWasapiConvert, self);
+    return NULL;
+  }
+  self->func = convert_mixer;
+
+  for (guint ii = 0; ii < G_N_ELEMENTS (mix_kernels); ii++) {
+    if (mix_kernels[ii].in_channels == in_channels &&
+        mix_kernels[ii].out_channels == out_channels) {
+      gst_wasapi_convert_fill_matrix (self);
+      self->func =
+          mix_kernels[ii].funcs[gst_wasapi_convert_format_index (self)];
+      g_clear_pointer (&self->mixer, gst_audio_channel_mixer_free);
+      break;
+    }
+  }
+
+  return self;
+}
+
+void
+gst_wasapi_convert_free (GstWasapiConvert * self)
+{
+  if (self->mixer)
+    gst_audio_channel_mixer_free (self->mixer);
+  if (self->mix)
+    gst_wasapi_convert_free (self->mix);
+  g_free (self->matrix);
+  g_free (self->mix_data);
+  g_slice_free (GstWasapiConvert, self);
+}
+
+void
+gst_wasapi_convert_process (GstWasapiConvert * self, gconstpointer in,
+    gpointer out, guint n_frames)
+{
+  self->func (self, in, out, n_frames);
+}
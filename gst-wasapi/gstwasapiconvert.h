@@ -0,0 +1,53 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_CONVERT_H__
+#define __GST_WASAPI_CONVERT_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* Conversion of the float mix format to the caps, applied by wasapisrc
+ * while copying out of the capture buffer, so no audioconvert is needed
+ * downstream. Channels are downmixed first, with the matrix of
+ * GstAudioChannelMixer for the positions of both sides, unpositioned ones
+ * on both sides are copied one to one. Samples are then rounded to the
+ * nearest integer and clipped, 16 bit output can use TPDF dither.
+ *
+ * The other way, wasapisink converts integer samples of the caps to the
+ * float mix format while copying into the render buffer, so decoders don't
+ * need an audioconvert in front of it. Other channel counts are upmixed or
+ * downmixed to the positions of the endpoint in the same pass. */
+typedef struct _GstWasapiConvert GstWasapiConvert;
+
+/* NULL if float samples of @in_info can't be converted to @out_info, which
+ * may only differ in format and channels. Or if S16LE, S24_32LE or S32LE of
+ * @in_info can't be converted to float @out_info, which may only differ in
+ * format and channels then. */
+GstWasapiConvert *gst_wasapi_convert_new (const GstAudioInfo * in_info,
+    const GstAudioInfo * out_info, gboolean dither);
+
+void gst_wasapi_convert_free (GstWasapiConvert * convert);
+
+/* Converts @n_frames frames from @in into @out */
+void gst_wasapi_convert_process (GstWasapiConvert * convert,
+    gconstpointer in, gpointer out, guint n_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_CONVERT_H__ */
@@ -0,0 +1,135 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapicpu.h"
+
+#ifdef GST_WASAPI_CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Written once in plugin_init, before any element exists */
+static GstWasapiCpuFlags cpu_flags;
+
+#ifdef GST_WASAPI_CPU_X86
+static void
+gst_wasapi_cpu_cpuid (guint32 leaf, guint32 subleaf, guint32 regs[4])
+{
+#ifdef _MSC_VER
+  __cpuidex ((int *) regs, (int) leaf, (int) subleaf);
+#else
+  __cpuid_count (leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* The register state the OS saves on a context switch, XCR0 */
+static guint64
+gst_wasapi_cpu_xgetbv (void)
+{
+#ifdef _MSC_VER
+  return _xgetbv (0);
+#else
+  guint32 eax, edx;
+
+  __asm__ volatile ("xgetbv":"=a" (eax), "=d" (edx):"c" (0));
+  return ((guint64) edx << 32) | eax;
+#endif
+}
+
+static GstWasapiCpuFlags
+gst_wasapi_cpu_detect (void)
+{
+  GstWasapiCpuFlags flags = 0;
+  guint32 regs[4], max_leaf;
+  guint64 xcr0 = 0;
+
+  gst_wasapi_cpu_cpuid (0, 0, regs);
+  max_leaf = regs[0];
+  if (max_leaf < 1)
+    return 0;
+
+  gst_wasapi_cpu_cpuid (1, 0, regs);
+  if (regs[3] & (1 << 26))
+    flags |= GST_WASAPI_CPU_SSE2;
+  if (regs[2] & (1 << 9))
+    flags |= GST_WASAPI_CPU_SSSE3;
+  if (regs[2] & (1 << 19))
+    flags |= GST_WASAPI_CPU_SSE4_1;
+  /* AVX faults unless the OS saves the wider registers, OSXSAVE and AVX */
+  if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28)))
+    xcr0 = gst_wasapi_cpu_xgetbv ();
+
+  /* XMM and YMM state, plus the opmask and ZMM state for AVX-512 */
+  if (max_leaf >= 7 && (xcr0 & 0x6) == 0x6) {
+    gst_wasapi_cpu_cpuid (7, 0, regs);
+    if (regs[1] & (1 << 5))
+      flags |= GST_WASAPI_CPU_AVX2;
+    if ((regs[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+      flags |= GST_WASAPI_CPU_AVX512F;
+  }
+
+  return flags;
+}
+#elif defined(GST_WASAPI_CPU_ARM64)
+static GstWasapiCpuFlags
+gst_wasapi_cpu_detect (void)
+{
+  /* Part of the baseline of ARM64 */
+  return GST_WASAPI_CPU_NEON;
+}
+#else
+static GstWasapiCpuFlags
+gst_wasapi_cpu_detect (void)
+{
+  return 0;
+}
+#endif
+
+void
+gst_wasapi_cpu_init (void)
+{
+  cpu_flags = gst_wasapi_cpu_detect ();
+
+  GST_INFO ("CPU:%s%s%s%s%s%s",
+      (cpu_flags & GST_WASAPI_CPU_SSE2) ? " sse2" : "",
+      (cpu_flags & GST_WASAPI_CPU_SSSE3) ? " ssse3" : "",
+      (cpu_flags & GST_WASAPI_CPU_SSE4_1) ? " sse4.1" : "",
+      (cpu_flags & GST_WASAPI_CPU_AVX2) ? " avx2" : "",
+      (cpu_flags & GST_WASAPI_CPU_AVX512F) ? " avx512f" : "",
+      (cpu_flags & GST_WASAPI_CPU_NEON) ? " neon" : "");
+
+  if (g_getenv ("GST_WASAPI_DISABLE_SIMD") != NULL) {
+    GST_INFO ("not using any of it, GST_WASAPI_DISABLE_SIMD is set");
+    cpu_flags = 0;
+  }
+}
+
+GstWasapiCpuFlags
+gst_wasapi_cpu_get_flags (void)
+{
+  return cpu_flags;
+}
@@ -0,0 +1,62 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_CPU_H__
+#define __GST_WASAPI_CPU_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* What the CPU we run on can do beyond the baseline of the build, read
+ * with cpuid once in plugin_init. The modules with sample kernels pick
+ * their versions from these in their new(), so nothing is checked per
+ * call. GST_WASAPI_DISABLE_SIMD in the environment leaves the flags empty,
+ * for comparing with the plain C kernels. */
+typedef enum
+{
+  GST_WASAPI_CPU_SSE2 = (1 << 0),
+  GST_WASAPI_CPU_SSSE3 = (1 << 1),
+  GST_WASAPI_CPU_SSE4_1 = (1 << 2),
+  GST_WASAPI_CPU_AVX2 = (1 << 3),
+  GST_WASAPI_CPU_AVX512F = (1 << 4),
+  GST_WASAPI_CPU_NEON = (1 << 5),
+} GstWasapiCpuFlags;
+
+/* Whether kernels for x86 can be built, and how to build one for an
+ * instruction set beyond the baseline. MSVC takes any intrinsics without
+ * a flag. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+    defined(__i386__)
+#define GST_WASAPI_CPU_X86 1
+#if defined(__GNUC__) || defined(__clang__)
+#define GST_WASAPI_TARGET(isa) __attribute__ ((target (isa)))
+#else
+#define GST_WASAPI_TARGET(isa)
+#endif
+/* NEON is part of the baseline of ARM64, its kernels need no flag */
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define GST_WASAPI_CPU_ARM64 1
+#endif
+
+void gst_wasapi_cpu_init (void);
+
+GstWasapiCpuFlags gst_wasapi_cpu_get_flags (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_CPU_H__ */
@@ -22,12 +22,53 @@
 #endif
 
 #include "gstwasapidevice.h"
+#include "gstwasapidevicecache.h"
+#include "gstwasapinotify.h"
+
+#if defined(_MSC_VER)
+#include <functiondiscoverykeys_devpkey.h>
+#elif !defined(PKEY_Device_FriendlyName)
+#include <initguid.h>
+#include <propkey.h>
+DEFINE_PROPERTYKEY (PKEY_Device_FriendlyName, 0xa45c254e, 0xdf1c, 0x4efd, 0x80,
+    0x20, 0x67, 0xd1, 0x46, 0xa8, 0x50, 0xe0, 14);
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* PKEY_AudioEngine_DeviceFormat, not every SDK declares it */
+static const PROPERTYKEY device_format_key = {
+  {0xf19f064d, 0x82c, 0x4e27, {0xbc, 0x73, 0x68, 0x82, 0xa1, 0xbb, 0x8e,
+          0x4c}}, 0
+};
+
+typedef struct
+{
+  gchar *strid;
+  /* What describes the device changed, not only whether it's there */
+  gboolean changed;
+} GstWasapiDeviceUpdate;
+
+enum
+{
+  PROP_0,
+  PROP_PROBE_CAPABILITIES,
+};
+
+#define DEFAULT_PROBE_CAPABILITIES FALSE
 
 G_DEFINE_TYPE (GstWasapiDeviceProvider, gst_wasapi_device_provider,
     GST_TYPE_DEVICE_PROVIDER);
 
 static void gst_wasapi_device_provider_finalize (GObject * object);
+static void gst_wasapi_device_provider_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_wasapi_device_provider_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
 static GList *gst_wasapi_device_provider_probe (GstDeviceProvider * provider);
+static gboolean gst_wasapi_device_provider_start (GstDeviceProvider * provider);
+static void gst_wasapi_device_provider_stop (GstDeviceProvider * provider);
 
 static void
 gst_wasapi_device_provider_class_init (GstWasapiDeviceProviderClass * klass)
@@ -36,8 +77,19 @@ gst_wasapi_device_provider_class_init (GstWasapiDeviceProviderClass * klass)
   GstDeviceProviderClass *dm_class = GST_DEVICE_PROVIDER_CLASS (klass);
 
   gobject_class->finalize = gst_wasapi_device_provider_finalize;
+  gobject_class->set_property = gst_wasapi_device_provider_set_property;
+  gobject_class->get_property = gst_wasapi_device_provider_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PROBE_CAPABILITIES,
+      g_param_spec_boolean ("probe-capabilities", "Probe capabilities",
+          "Add the device periods, the low latency support and the exclusive "
+          "mode caps to the device properties. This activates each endpoint "
+          "that isn't cached yet", DEFAULT_PROBE_CAPABILITIES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   dm_class->probe = gst_wasapi_device_provider_probe;
+  dm_class->start = gst_wasapi_device_provider_start;
+  dm_class->stop = gst_wasapi_device_provider_stop;
 
   gst_device_provider_class_set_static_metadata (dm_class,
       "WASAPI (Windows Audio Session API) Device Provider",
@@ -48,13 +100,61 @@ gst_wasapi_device_provider_class_init (GstWasapiDeviceProviderClass * klass)
 static void
 gst_wasapi_device_provider_init (GstWasapiDeviceProvider * provider)
 {
-  CoInitialize (NULL);
+  provider->probe_capabilities = DEFAULT_PROBE_CAPABILITIES;
+}
+
+static void
+gst_wasapi_device_provider_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstWasapiDeviceProvider *self = GST_WASAPI_DEVICE_PROVIDER (object);
+
+  switch (prop_id) {
+    case PROP_PROBE_CAPABILITIES:
+      GST_OBJECT_LOCK (self);
+      self->probe_capabilities = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_device_provider_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstWasapiDeviceProvider *self = GST_WASAPI_DEVICE_PROVIDER (object);
+
+  switch (prop_id) {
+    case PROP_PROBE_CAPABILITIES:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->probe_capabilities);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_wasapi_device_provider_get_probe (GstWasapiDeviceProvider * self)
+{
+  gboolean probe;
+
+  GST_OBJECT_LOCK (self);
+  probe = self->probe_capabilities;
+  GST_OBJECT_UNLOCK (self);
+
+  return probe;
 }
 
 static void
 gst_wasapi_device_provider_finalize (GObject * object)
 {
-  CoUninitialize ();
+  G_OBJECT_CLASS (gst_wasapi_device_provider_parent_class)->finalize (object);
 }
 
 static GList *
@@ -63,12 +163,201 @@ gst_wasapi_device_provider_probe (GstDeviceProvider * provider)
   GstWasapiDeviceProvider *self = GST_WASAPI_DEVICE_PROVIDER (provider);
   GList *devices = NULL;
 
-  if (!gst_wasapi_util_get_devices (GST_ELEMENT (self), TRUE, &devices))
+  if (!gst_wasapi_util_get_devices (GST_ELEMENT (self), TRUE,
+          gst_wasapi_device_provider_get_probe (self), &devices))
     GST_ERROR_OBJECT (self, "Failed to enumerate devices");
 
   return devices;
 }
 
+/* With the object lock. A render endpoint is there twice, as itself and
+ * for loopback. */
+static GstDevice *
+gst_wasapi_device_provider_find (GstWasapiDeviceProvider * self,
+    const gchar * strid, gboolean loopback)
+{
+  GList *l;
+
+  for (l = GST_DEVICE_PROVIDER (self)->devices; l; l = l->next) {
+    GstWasapiDevice *device = l->data;
+
+    if (g_strcmp0 (device->strid, strid) == 0 &&
+        device->loopback == loopback)
+      return gst_object_ref (device);
+  }
+
+  return NULL;
+}
+
+/* Brings the device list in line with the endpoint @update is about. There's
+ * no device-changed message before GStreamer 1.16, a changed device is
+ * removed and added again. */
+static void
+gst_wasapi_device_provider_update (GstWasapiDeviceUpdate * update,
+    GstWasapiDeviceProvider * self)
+{
+  GstDeviceProvider *provider = GST_DEVICE_PROVIDER (self);
+  GstDevice *old, *old_loopback, *device = NULL, *loopback = NULL;
+  IMMDevice *item = NULL;
+  gboolean active = FALSE;
+  gunichar2 *wstrid;
+  DWORD state;
+  HRESULT hr;
+
+  wstrid = g_utf8_to_utf16 (update->strid, -1, NULL, NULL, NULL);
+  hr = IMMDeviceEnumerator_GetDevice (self->enumerator, (LPCWSTR) wstrid,
+      &item);
+  if (hr == S_OK) {
+    hr = IMMDevice_GetState (item, &state);
+    active = hr == S_OK && state == DEVICE_STATE_ACTIVE;
+  }
+
+  GST_OBJECT_LOCK (self);
+  old = gst_wasapi_device_provider_find (self, update->strid, FALSE);
+  old_loopback = gst_wasapi_device_provider_find (self, update->strid, TRUE);
+  GST_OBJECT_UNLOCK (self);
+
+  if (active && (old == NULL || update->changed)) {
+    /* The cache may not have been notified yet */
+    if (update->changed)
+      gst_wasapi_device_cache_invalidate (update->strid);
+    device = gst_wasapi_util_new_device (GST_ELEMENT (self), item,
+        gst_wasapi_device_provider_get_probe (self));
+    if (device != NULL)
+      loopback = gst_wasapi_util_new_loopback_device (device);
+  }
+
+  if (old != NULL && (!active || device != NULL)) {
+    GST_INFO_OBJECT (self, "removing %s", update->strid);
+    gst_device_provider_device_remove (provider, old);
+  }
+  if (old_loopback != NULL && (!active || device != NULL))
+    gst_device_provider_device_remove (provider, old_loopback);
+  if (device != NULL) {
+    GST_INFO_OBJECT (self, "adding %s", update->strid);
+    gst_device_provider_device_add (provider, device);
+  }
+  if (loopback != NULL)
+    gst_device_provider_device_add (provider, loopback);
+
+  if (old)
+    gst_object_unref (old);
+  if (old_loopback)
+    gst_object_unref (old_loopback);
+  if (item)
+    IUnknown_Release (item);
+  g_free (wstrid);
+  g_free (update->strid);
+  g_slice_free (GstWasapiDeviceUpdate, update);
+}
+
+static void
+gst_wasapi_device_provider_queue (GstWasapiDeviceProvider * self,
+    const gchar * id, gboolean changed)
+{
+  GstWasapiDeviceUpdate *update;
+
+  if (id == NULL)
+    return;
+
+  update = g_slice_new (GstWasapiDeviceUpdate);
+  update->strid = g_strdup (id);
+  update->changed = changed;
+  g_thread_pool_push (self->pool, update, NULL);
+}
+
+static void
+gst_wasapi_device_provider_state_changed (const gchar * id, DWORD state,
+    gpointer user_data)
+{
+  gst_wasapi_device_provider_queue (user_data, id, FALSE);
+}
+
+static void
+gst_wasapi_device_provider_added (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_device_provider_queue (user_data, id, FALSE);
+}
+
+static void
+gst_wasapi_device_provider_removed (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_device_provider_queue (user_data, id, FALSE);
+}
+
+/* The name and the caps are all a GstWasapiDevice describes */
+static void
+gst_wasapi_device_provider_property_changed (const gchar * id,
+    const PROPERTYKEY * key, gpointer user_data)
+{
+  if ((IsEqualGUID (&key->fmtid, &device_format_key.fmtid) &&
+          key->pid == device_format_key.pid) ||
+      (IsEqualGUID (&key->fmtid, &PKEY_Device_FriendlyName.fmtid) &&
+          key->pid == PKEY_Device_FriendlyName.pid))
+    gst_wasapi_device_provider_queue (user_data, id, TRUE);
+}
+
+static const GstWasapiNotifyFuncs notify_funcs = {
+  .device_state_changed = gst_wasapi_device_provider_state_changed,
+  .device_added = gst_wasapi_device_provider_added,
+  .device_removed = gst_wasapi_device_provider_removed,
+  .property_value_changed = gst_wasapi_device_provider_property_changed,
+};
+
+static gboolean
+gst_wasapi_device_provider_start (GstDeviceProvider * provider)
+{
+  GstWasapiDeviceProvider *self = GST_WASAPI_DEVICE_PROVIDER (provider);
+  GList *devices = NULL, *l;
+
+  self->enumerator = gst_wasapi_notify_get_enumerator (GST_ELEMENT (self));
+  if (self->enumerator == NULL)
+    return FALSE;
+
+  self->pool = g_thread_pool_new ((GFunc) gst_wasapi_device_provider_update,
+      self, 1, FALSE, NULL);
+
+  /* Subscribed before enumerating, so nothing is missed in between. An
+   * update for a device we already have is a no-op. */
+  self->notify_id = gst_wasapi_notify_subscribe (GST_ELEMENT (self),
+      &notify_funcs, self);
+  if (self->notify_id == 0)
+    goto failed;
+
+  if (!gst_wasapi_util_get_devices (GST_ELEMENT (self), TRUE,
+          gst_wasapi_device_provider_get_probe (self), &devices))
+    GST_ERROR_OBJECT (self, "Failed to enumerate devices");
+
+  for (l = devices; l; l = l->next)
+    gst_device_provider_device_add (provider, l->data);
+  g_list_free (devices);
+
+  return TRUE;
+
+failed:
+  g_thread_pool_free (self->pool, TRUE, FALSE);
+  self->pool = NULL;
+  IUnknown_Release (self->enumerator);
+  self->enumerator = NULL;
+  return FALSE;
+}
+
+static void
+gst_wasapi_device_provider_stop (GstDeviceProvider * provider)
+{
+  GstWasapiDeviceProvider *self = GST_WASAPI_DEVICE_PROVIDER (provider);
+
+  gst_wasapi_notify_unsubscribe (self->notify_id);
+  self->notify_id = 0;
+
+  /* Finish what was queued, the device list is cleared after this */
+  g_thread_pool_free (self->pool, FALSE, TRUE);
+  self->pool = NULL;
+
+  IUnknown_Release (self->enumerator);
+  self->enumerator = NULL;
+}
+
 /* GstWasapiDevice begins */
 
 enum
@@ -128,6 +417,8 @@ gst_wasapi_device_create_element (GstDevice * device, const gchar * name)
   elem = gst_element_factory_make (wasapi_dev->element, name);
 
   g_object_set (elem, "device", wasapi_dev->strid, NULL);
+  if (wasapi_dev->loopback)
+    g_object_set (elem, "loopback", TRUE, NULL);
 
   return elem;
 }
@@ -38,6 +38,16 @@ typedef struct _GstWasapiDeviceProviderClass GstWasapiDeviceProviderClass;
 struct _GstWasapiDeviceProvider
 {
   GstDeviceProvider parent;
+
+  /* properties */
+  gboolean probe_capabilities;
+
+  /* Set between start() and stop(). The endpoint notifications are handed
+   * to @pool, a single thread, since they must not block and updating a
+   * device may have to activate it. */
+  IMMDeviceEnumerator *enumerator;
+  guint notify_id;
+  GThreadPool *pool;
 };
 
 struct _GstWasapiDeviceProviderClass
@@ -65,6 +75,8 @@ struct _GstWasapiDevice
 
   gchar *strid;
   const gchar *element;
+  /* A wasapisrc capturing what the render endpoint @strid plays */
+  gboolean loopback;
 };
 
 struct _GstWasapiDeviceClass
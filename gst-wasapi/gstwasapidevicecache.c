@@ -0,0 +1,1113 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapidevicecache.h"
+#include "gstwasapinotify.h"
+
+#include <glib/gstdio.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* PKEY_AudioEngine_DeviceFormat, not every SDK declares it */
+static const PROPERTYKEY device_format_key = {
+  {0xf19f064d, 0x82c, 0x4e27, {0xbc, 0x73, 0x68, 0x82, 0xa1, 0xbb, 0x8e,
+          0x4c}}, 0
+};
+
+/* PKEY_Device_FriendlyName */
+static const PROPERTYKEY friendly_name_key = {
+  {0xa45c254e, 0xdf1c, 0x4efd, {0x80, 0x20, 0x67, 0xd1, 0x46, 0xa8, 0x50,
+          0xe0}}, 14
+};
+
+/* PKEY_Device_DriverVersion */
+static const PROPERTYKEY driver_version_key = {
+  {0xa8b865dd, 0x2e3d, 0x4094, {0xad, 0x97, 0xe5, 0x93, 0xa7, 0x0c, 0x75,
+          0xd6}}, 3
+};
+
+typedef struct
+{
+  /* The key in the cache */
+  const gchar *id;
+
+  /* Indexed by the share mode, NULL until asked for */
+  WAVEFORMATEX *format[2];
+  GstCaps *caps[2];
+  GstAudioChannelPosition *positions[2];
+
+  GstCaps *exclusive_caps;
+
+  /* Interned, so not freed with the entry */
+  gboolean have_description;
+  const gchar *description;
+
+  gboolean have_periods;
+  REFERENCE_TIME default_period;
+  REFERENCE_TIME min_period;
+
+  /* Also set when the endpoint has no IAudioClient3, with all of them 0 */
+  gboolean have_engine_periods;
+  guint engine_periods[4];
+
+  /* 1 if small engine periods work for loopback capture, -1 if they don't
+   * and 0 if we didn't try yet */
+  gint loopback_engine_period;
+
+  /* Extra ringbuffer segments of adaptive-buffer */
+  guint ring_extra;
+
+  /* The rate the endpoint was measured at */
+  gboolean have_rate;
+  gdouble rate_ppm;
+} GstWasapiDeviceCacheEntry;
+
+/* Group of the key file of rates, one key per endpoint id */
+#define RATES_GROUP "rates"
+
+/* The profiles file has a group per endpoint id besides this one. Bump the
+ * version when what is stored changes, older files are dropped then. */
+#define PROFILES_GROUP "profiles"
+#define PROFILES_VERSION 1
+
+/* Protects everything below. Held over the COM calls of a miss, so elements
+ * opening the same endpoint at once only query it once. */
+static GMutex cache_lock;
+static GHashTable *cache;
+/* "<data flow>:<pattern>" to the endpoint id it resolved to */
+static GHashTable *names;
+
+/* Subscribed for the lifetime of the process on first use, 0 if we can't
+ * watch the endpoints */
+static guint notify_id;
+
+/* What earlier processes found out about the endpoints, loaded by
+ * gst_wasapi_device_cache_load(). An endpoint's group is only used once
+ * its driver version and device format are checked to still match, when
+ * it is first looked up. NULL if there is no file. */
+static GKeyFile *profiles;
+
+static void
+gst_wasapi_device_cache_entry_free (GstWasapiDeviceCacheEntry * entry)
+{
+  for (guint ii = 0; ii < G_N_ELEMENTS (entry->format); ii++) {
+    CoTaskMemFree (entry->format[ii]);
+    if (entry->caps[ii])
+      gst_caps_unref (entry->caps[ii]);
+    g_free (entry->positions[ii]);
+  }
+  if (entry->exclusive_caps)
+    gst_caps_unref (entry->exclusive_caps);
+  g_slice_free (GstWasapiDeviceCacheEntry, entry);
+}
+
+static gchar *
+gst_wasapi_device_cache_get_profiles_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gstreamer-1.0",
+      "wasapi-profiles.ini", NULL);
+}
+
+/* With cache_lock */
+static void
+gst_wasapi_device_cache_save_profiles (void)
+{
+  GError *err = NULL;
+  gchar *path, *dir;
+
+  path = gst_wasapi_device_cache_get_profiles_path ();
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+
+  if (!g_key_file_save_to_file (profiles, path, &err)) {
+    GST_WARNING ("Failed to save %s: %s", path, err->message);
+    g_clear_error (&err);
+  }
+
+  g_free (dir);
+  g_free (path);
+}
+
+void
+gst_wasapi_device_cache_load (void)
+{
+  gchar *path = gst_wasapi_device_cache_get_profiles_path ();
+
+  g_mutex_lock (&cache_lock);
+  profiles = g_key_file_new ();
+  /* Not there yet on the first run */
+  if (g_key_file_load_from_file (profiles, path, G_KEY_FILE_NONE, NULL) &&
+      g_key_file_get_integer (profiles, PROFILES_GROUP, "version",
+          NULL) != PROFILES_VERSION) {
+    GST_INFO ("dropping the endpoint profiles of another version");
+    g_key_file_free (profiles);
+    profiles = g_key_file_new ();
+  }
+  g_key_file_set_integer (profiles, PROFILES_GROUP, "version",
+      PROFILES_VERSION);
+  g_mutex_unlock (&cache_lock);
+
+  g_free (path);
+}
+
+void
+gst_wasapi_device_cache_invalidate (const gchar * id)
+{
+  if (id == NULL)
+    return;
+
+  g_mutex_lock (&cache_lock);
+  if (cache != NULL && g_hash_table_remove (cache, id))
+    GST_INFO ("dropped the cached formats of %s", id);
+  if (profiles != NULL && g_key_file_remove_group (profiles, id, NULL))
+    gst_wasapi_device_cache_save_profiles ();
+  g_mutex_unlock (&cache_lock);
+}
+
+/* Any endpoint that comes, goes or gets renamed may change what a name
+ * resolves to */
+static void
+gst_wasapi_device_cache_forget_names (void)
+{
+  g_mutex_lock (&cache_lock);
+  if (names != NULL)
+    g_hash_table_remove_all (names);
+  g_mutex_unlock (&cache_lock);
+}
+
+static void
+gst_wasapi_device_cache_state_changed (const gchar * id, DWORD state,
+    gpointer user_data)
+{
+  gst_wasapi_device_cache_invalidate (id);
+  gst_wasapi_device_cache_forget_names ();
+}
+
+static void
+gst_wasapi_device_cache_added (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_device_cache_forget_names ();
+}
+
+static void
+gst_wasapi_device_cache_removed (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_device_cache_invalidate (id);
+  gst_wasapi_device_cache_forget_names ();
+}
+
+static void
+gst_wasapi_device_cache_property_changed (const gchar * id,
+    const PROPERTYKEY * key, gpointer user_data)
+{
+  if (IsEqualGUID (&key->fmtid, &device_format_key.fmtid) &&
+      key->pid == device_format_key.pid)
+    gst_wasapi_device_cache_invalidate (id);
+
+  if (IsEqualGUID (&key->fmtid, &friendly_name_key.fmtid) &&
+      key->pid == friendly_name_key.pid) {
+    gst_wasapi_device_cache_invalidate (id);
+    gst_wasapi_device_cache_forget_names ();
+  }
+}
+
+static const GstWasapiNotifyFuncs notify_funcs = {
+  .device_state_changed = gst_wasapi_device_cache_state_changed,
+  .device_added = gst_wasapi_device_cache_added,
+  .device_removed = gst_wasapi_device_cache_removed,
+  .property_value_changed = gst_wasapi_device_cache_property_changed,
+};
+
+/* Without cache_lock, the callbacks take it while the hub holds its lock */
+static void
+gst_wasapi_device_cache_subscribe (GstElement * self)
+{
+  static gsize subscribed = 0;
+
+  if (g_once_init_enter (&subscribed)) {
+    notify_id = gst_wasapi_notify_subscribe (self, &notify_funcs, NULL);
+    if (notify_id == 0)
+      GST_WARNING_OBJECT (self, "can't watch endpoints, not caching formats");
+    g_once_init_leave (&subscribed, 1);
+  }
+}
+
+/* With cache_lock. Without notifications we can't know when an entry gets
+ * stale, so nothing is cached then. */
+static gboolean
+gst_wasapi_device_cache_ensure (GstElement * self)
+{
+  if (cache != NULL)
+    return TRUE;
+
+  if (notify_id == 0)
+    return FALSE;
+
+  cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) gst_wasapi_device_cache_entry_free);
+  return TRUE;
+}
+
+static gchar *
+gst_wasapi_device_cache_to_hex (gconstpointer data, gsize size)
+{
+  const guint8 *bytes = data;
+  gchar *hex = g_malloc (size * 2 + 1);
+  gsize ii;
+
+  for (ii = 0; ii < size; ii++)
+    g_snprintf (hex + ii * 2, 3, "%02x", bytes[ii]);
+  hex[size * 2] = '\0';
+
+  return hex;
+}
+
+/* NULL unless @hex is a whole number of bytes */
+static guint8 *
+gst_wasapi_device_cache_from_hex (const gchar * hex, gsize * ret_size)
+{
+  gsize len = strlen (hex), ii;
+  guint8 *bytes;
+
+  if (len == 0 || len % 2 != 0)
+    return NULL;
+
+  bytes = g_malloc (len / 2);
+  for (ii = 0; ii < len / 2; ii++) {
+    gint hi = g_ascii_xdigit_value (hex[ii * 2]);
+    gint lo = g_ascii_xdigit_value (hex[ii * 2 + 1]);
+
+    if (hi < 0 || lo < 0) {
+      g_free (bytes);
+      return NULL;
+    }
+    bytes[ii] = (hi << 4) | lo;
+  }
+  *ret_size = len / 2;
+
+  return bytes;
+}
+
+/* What a stored profile has to match to still be valid: the driver version
+ * and the device format the user picked, as hex. Either may be missing. */
+static gchar *
+gst_wasapi_device_cache_query_signature (GstElement * self,
+    IMMDevice * device)
+{
+  IPropertyStore *prop_store = NULL;
+  PROPVARIANT var;
+  gchar *version = NULL, *format = NULL, *signature;
+  HRESULT hr;
+
+  hr = IMMDevice_OpenPropertyStore (device, STGM_READ, &prop_store);
+  HR_FAILED_RET (hr, IMMDevice::OpenPropertyStore, NULL);
+
+  PropVariantInit (&var);
+  if (SUCCEEDED (IPropertyStore_GetValue (prop_store, &driver_version_key,
+              &var)) && var.vt == VT_LPWSTR && var.pwszVal != NULL)
+    version = g_utf16_to_utf8 (var.pwszVal, -1, NULL, NULL, NULL);
+  PropVariantClear (&var);
+
+  PropVariantInit (&var);
+  if (SUCCEEDED (IPropertyStore_GetValue (prop_store, &device_format_key,
+              &var)) && var.vt == VT_BLOB && var.blob.pBlobData != NULL)
+    format = gst_wasapi_device_cache_to_hex (var.blob.pBlobData,
+        var.blob.cbSize);
+  PropVariantClear (&var);
+  IUnknown_Release (prop_store);
+
+  signature = g_strdup_printf ("%s/%s", version ? version : "",
+      format ? format : "");
+  g_free (version);
+  g_free (format);
+
+  return signature;
+}
+
+/* With cache_lock. A format written by store_format(), NULL if there is
+ * none or it doesn't look like one. */
+static WAVEFORMATEX *
+gst_wasapi_device_cache_load_format (const gchar * id, const gchar * key)
+{
+  WAVEFORMATEX *format = NULL;
+  guint8 *bytes;
+  gchar *hex;
+  gsize size;
+
+  if (!(hex = g_key_file_get_string (profiles, id, key, NULL)))
+    return NULL;
+
+  bytes = gst_wasapi_device_cache_from_hex (hex, &size);
+  g_free (hex);
+  if (bytes == NULL)
+    return NULL;
+
+  if (size >= sizeof (WAVEFORMATEX) &&
+      size == sizeof (WAVEFORMATEX) + (((WAVEFORMATEX *) bytes)->wFormatTag ==
+          WAVE_FORMAT_PCM ? 0 : ((WAVEFORMATEX *) bytes)->cbSize)) {
+    format = CoTaskMemAlloc (size);
+    memcpy (format, bytes, size);
+  }
+  g_free (bytes);
+
+  return format;
+}
+
+/* With cache_lock. Fills @entry from the profile of an earlier process, if
+ * that was for the same driver and device format, and drops it otherwise. */
+static void
+gst_wasapi_device_cache_restore (GstElement * self, IMMDevice * device,
+    GstWasapiDeviceCacheEntry * entry)
+{
+  static GstStaticCaps raw_caps = GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS);
+  const gchar *id = entry->id;
+  gchar *signature, *stored, *str;
+  gint *periods;
+  gsize n;
+
+  if (profiles == NULL || !g_key_file_has_group (profiles, id))
+    return;
+
+  signature = gst_wasapi_device_cache_query_signature (self, device);
+  stored = g_key_file_get_string (profiles, id, "signature", NULL);
+  if (signature == NULL || g_strcmp0 (signature, stored) != 0) {
+    GST_INFO_OBJECT (self, "driver or format of %s changed, dropping its "
+        "profile", id);
+    g_key_file_remove_group (profiles, id, NULL);
+    gst_wasapi_device_cache_save_profiles ();
+    g_free (signature);
+    g_free (stored);
+    return;
+  }
+  g_free (signature);
+  g_free (stored);
+
+  for (guint ii = 0; ii < G_N_ELEMENTS (entry->format); ii++) {
+    GstCaps *template_caps;
+    WAVEFORMATEX *format;
+
+    format = gst_wasapi_device_cache_load_format (id,
+        ii ? "exclusive-format" : "shared-format");
+    if (format == NULL)
+      continue;
+
+    template_caps = gst_static_caps_get (&raw_caps);
+    gst_wasapi_util_parse_waveformatex ((WAVEFORMATEXTENSIBLE *) format,
+        template_caps, &entry->caps[ii], &entry->positions[ii]);
+    gst_caps_unref (template_caps);
+    if (entry->caps[ii] != NULL) {
+      entry->format[ii] = format;
+    } else {
+      g_clear_pointer (&entry->positions[ii], g_free);
+      CoTaskMemFree (format);
+    }
+  }
+
+  /* Only with the exclusive format it was probed for */
+  if (entry->format[1] != NULL &&
+      (str = g_key_file_get_string (profiles, id, "exclusive-caps", NULL))) {
+    entry->exclusive_caps = gst_caps_from_string (str);
+    g_free (str);
+  }
+
+  periods = g_key_file_get_integer_list (profiles, id, "periods", &n, NULL);
+  if (periods != NULL && n == 2) {
+    entry->default_period = periods[0];
+    entry->min_period = periods[1];
+    entry->have_periods = TRUE;
+  }
+  g_free (periods);
+
+  periods = g_key_file_get_integer_list (profiles, id, "engine-periods", &n,
+      NULL);
+  if (periods != NULL && n == G_N_ELEMENTS (entry->engine_periods)) {
+    for (guint ii = 0; ii < n; ii++)
+      entry->engine_periods[ii] = periods[ii];
+    entry->have_engine_periods = TRUE;
+  }
+  g_free (periods);
+
+  entry->loopback_engine_period = CLAMP (g_key_file_get_integer (profiles, id,
+          "loopback-engine-period", NULL), -1, 1);
+  entry->ring_extra = g_key_file_get_integer (profiles, id, "ring-extra",
+      NULL);
+  if (g_key_file_has_key (profiles, id, "rate-ppm", NULL)) {
+    entry->rate_ppm = g_key_file_get_double (profiles, id, "rate-ppm", NULL);
+    entry->have_rate = TRUE;
+  }
+
+  GST_INFO_OBJECT (self, "restored the profile of %s", id);
+}
+
+/* With cache_lock. Writes what @entry knows to the profiles file, for the
+ * processes after us. */
+static void
+gst_wasapi_device_cache_persist (GstElement * self, IMMDevice * device,
+    GstWasapiDeviceCacheEntry * entry)
+{
+  const gchar *id = entry->id;
+  gchar *str;
+
+  if (profiles == NULL)
+    return;
+
+  if (!g_key_file_has_group (profiles, id)) {
+    if (!(str = gst_wasapi_device_cache_query_signature (self, device)))
+      return;
+    g_key_file_set_string (profiles, id, "signature", str);
+    g_free (str);
+  }
+
+  for (guint ii = 0; ii < G_N_ELEMENTS (entry->format); ii++) {
+    WAVEFORMATEX *format = entry->format[ii];
+
+    if (format == NULL)
+      continue;
+
+    str = gst_wasapi_device_cache_to_hex (format, sizeof (WAVEFORMATEX) +
+        (format->wFormatTag == WAVE_FORMAT_PCM ? 0 : format->cbSize));
+    g_key_file_set_string (profiles, id,
+        ii ? "exclusive-format" : "shared-format", str);
+    g_free (str);
+  }
+
+  if (entry->exclusive_caps != NULL) {
+    str = gst_caps_to_string (entry->exclusive_caps);
+    g_key_file_set_string (profiles, id, "exclusive-caps", str);
+    g_free (str);
+  }
+
+  if (entry->have_periods) {
+    gint periods[2] = { (gint) entry->default_period,
+      (gint) entry->min_period
+    };
+
+    g_key_file_set_integer_list (profiles, id, "periods", periods, 2);
+  }
+
+  if (entry->have_engine_periods) {
+    gint periods[G_N_ELEMENTS (entry->engine_periods)];
+
+    for (guint ii = 0; ii < G_N_ELEMENTS (periods); ii++)
+      periods[ii] = entry->engine_periods[ii];
+    g_key_file_set_integer_list (profiles, id, "engine-periods", periods,
+        G_N_ELEMENTS (periods));
+  }
+
+  g_key_file_set_integer (profiles, id, "loopback-engine-period",
+      entry->loopback_engine_period);
+  g_key_file_set_integer (profiles, id, "ring-extra", entry->ring_extra);
+  if (entry->have_rate)
+    g_key_file_set_double (profiles, id, "rate-ppm", entry->rate_ppm);
+
+  gst_wasapi_device_cache_save_profiles ();
+}
+
+/* With cache_lock, NULL if nothing can be cached */
+static GstWasapiDeviceCacheEntry *
+gst_wasapi_device_cache_lookup (GstElement * self, IMMDevice * device)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  LPWSTR wid = NULL;
+  gchar *id;
+  HRESULT hr;
+
+  if (!gst_wasapi_device_cache_ensure (self))
+    return NULL;
+
+  hr = IMMDevice_GetId (device, &wid);
+  HR_FAILED_RET (hr, IMMDevice::GetId, NULL);
+  id = g_utf16_to_utf8 (wid, -1, NULL, NULL, NULL);
+  CoTaskMemFree (wid);
+
+  entry = g_hash_table_lookup (cache, id);
+  if (entry == NULL) {
+    entry = g_slice_new0 (GstWasapiDeviceCacheEntry);
+    entry->id = id;
+    g_hash_table_insert (cache, id, entry);
+    gst_wasapi_device_cache_restore (self, device, entry);
+  } else {
+    g_free (id);
+  }
+
+  return entry;
+}
+
+static WAVEFORMATEX *
+gst_wasapi_device_cache_copy_format (WAVEFORMATEX * format)
+{
+  gsize size = sizeof (WAVEFORMATEX);
+  WAVEFORMATEX *copy;
+
+  if (format->wFormatTag != WAVE_FORMAT_PCM)
+    size += format->cbSize;
+
+  copy = CoTaskMemAlloc (size);
+  memcpy (copy, format, size);
+
+  return copy;
+}
+
+/* Activates @device if @client is NULL. Release the result. */
+static IAudioClient *
+gst_wasapi_device_cache_get_client (GstElement * self, IMMDevice * device,
+    IAudioClient * client)
+{
+  HRESULT hr;
+
+  if (client != NULL) {
+    IUnknown_AddRef (client);
+    return client;
+  }
+
+  hr = IMMDevice_Activate (device, &IID_IAudioClient, CLSCTX_ALL, NULL,
+      (void **) &client);
+  HR_FAILED_RET (hr, IMMDevice::Activate (IID_IAudioClient), NULL);
+
+  return client;
+}
+
+static gboolean
+gst_wasapi_device_cache_query_format (GstElement * self, IMMDevice * device,
+    IAudioClient * client, gint sharemode, WAVEFORMATEX ** ret_format,
+    GstCaps ** ret_caps, GstAudioChannelPosition ** ret_positions)
+{
+  static GstStaticCaps raw_caps = GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS);
+  GstCaps *template_caps;
+  gboolean ret;
+
+  if (!(client = gst_wasapi_device_cache_get_client (self, device, client)))
+    return FALSE;
+
+  ret = gst_wasapi_util_get_device_format (self, sharemode, device, client,
+      ret_format);
+  IUnknown_Release (client);
+  if (!ret)
+    return FALSE;
+
+  template_caps = gst_static_caps_get (&raw_caps);
+  *ret_positions = NULL;
+  gst_wasapi_util_parse_waveformatex ((WAVEFORMATEXTENSIBLE *) * ret_format,
+      template_caps, ret_caps, ret_positions);
+  gst_caps_unref (template_caps);
+
+  if (*ret_caps == NULL) {
+    GST_WARNING_OBJECT (self, "unknown device format");
+    CoTaskMemFree (*ret_format);
+    g_free (*ret_positions);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_device_cache_get_format (GstElement * self, IMMDevice * device,
+    IAudioClient * client, gint sharemode, WAVEFORMATEX ** ret_format,
+    GstCaps ** ret_caps, GstAudioChannelPosition ** ret_positions)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  guint mode = sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE ? 1 : 0;
+  gboolean ret = TRUE;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+
+  if (entry == NULL) {
+    ret = gst_wasapi_device_cache_query_format (self, device, client,
+        sharemode, ret_format, ret_caps, ret_positions);
+    goto out;
+  }
+
+  if (entry->format[mode] == NULL) {
+    ret = gst_wasapi_device_cache_query_format (self, device, client,
+        sharemode, &entry->format[mode], &entry->caps[mode],
+        &entry->positions[mode]);
+    if (!ret)
+      goto out;
+    gst_wasapi_device_cache_persist (self, device, entry);
+  } else {
+    GST_DEBUG_OBJECT (self, "using the cached device format");
+  }
+
+  *ret_format = gst_wasapi_device_cache_copy_format (entry->format[mode]);
+  *ret_caps = gst_caps_copy (entry->caps[mode]);
+  *ret_positions = g_memdup (entry->positions[mode],
+      entry->format[mode]->nChannels * sizeof (GstAudioChannelPosition));
+
+out:
+  g_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
+static const gchar *
+gst_wasapi_device_cache_query_description (GstElement * self,
+    IMMDevice * device)
+{
+  IPropertyStore *prop_store = NULL;
+  const gchar *description = NULL;
+  PROPVARIANT var;
+  gchar *str;
+  HRESULT hr;
+
+  hr = IMMDevice_OpenPropertyStore (device, STGM_READ, &prop_store);
+  HR_FAILED_RET (hr, IMMDevice::OpenPropertyStore, NULL);
+
+  PropVariantInit (&var);
+  hr = IPropertyStore_GetValue (prop_store, &friendly_name_key, &var);
+  IUnknown_Release (prop_store);
+  HR_FAILED_RET (hr, IPropertyStore::GetValue, NULL);
+
+  if (var.vt == VT_LPWSTR && var.pwszVal != NULL &&
+      (str = g_utf16_to_utf8 (var.pwszVal, -1, NULL, NULL, NULL))) {
+    description = g_intern_string (str);
+    g_free (str);
+  }
+  PropVariantClear (&var);
+
+  return description;
+}
+
+const gchar *
+gst_wasapi_device_cache_get_description (GstElement * self,
+    IMMDevice * device)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  const gchar *description;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+
+  if (entry != NULL && entry->have_description) {
+    description = entry->description;
+  } else {
+    description = gst_wasapi_device_cache_query_description (self, device);
+    if (entry != NULL) {
+      entry->description = description;
+      entry->have_description = TRUE;
+    }
+  }
+  g_mutex_unlock (&cache_lock);
+
+  return description;
+}
+
+/* Without cache_lock, the descriptions take it */
+static gchar *
+gst_wasapi_device_cache_match_name (GstElement * self, gint data_flow,
+    const gchar * pattern)
+{
+  IMMDeviceEnumerator *enumerator;
+  IMMDeviceCollection *collection = NULL;
+  GPatternSpec *spec;
+  gchar *id = NULL;
+  UINT count = 0, ii;
+  HRESULT hr;
+
+  if (!(enumerator = gst_wasapi_notify_get_enumerator (self)))
+    return NULL;
+
+  hr = IMMDeviceEnumerator_EnumAudioEndpoints (enumerator, data_flow,
+      DEVICE_STATE_ACTIVE, &collection);
+  IUnknown_Release (enumerator);
+  HR_FAILED_RET (hr, IMMDeviceEnumerator::EnumAudioEndpoints, NULL);
+
+  hr = IMMDeviceCollection_GetCount (collection, &count);
+  HR_FAILED_AND (hr, IMMDeviceCollection::GetCount, count = 0);
+
+  spec = g_pattern_spec_new (pattern);
+  for (ii = 0; ii < count && id == NULL; ii++) {
+    IMMDevice *device = NULL;
+    const gchar *description;
+
+    hr = IMMDeviceCollection_Item (collection, ii, &device);
+    if (hr != S_OK)
+      continue;
+
+    description = gst_wasapi_device_cache_get_description (self, device);
+    if (description != NULL && g_pattern_match_string (spec, description))
+      id = gst_wasapi_util_get_device_id (device);
+    IUnknown_Release (device);
+  }
+  g_pattern_spec_free (spec);
+  IUnknown_Release (collection);
+
+  return id;
+}
+
+gchar *
+gst_wasapi_device_cache_find_by_name (GstElement * self, gint data_flow,
+    const gchar * pattern)
+{
+  gchar *key, *id = NULL;
+
+  key = g_strdup_printf ("%d:%s", data_flow, pattern);
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  if (names != NULL)
+    id = g_strdup (g_hash_table_lookup (names, key));
+  g_mutex_unlock (&cache_lock);
+
+  if (id != NULL) {
+    GST_DEBUG_OBJECT (self, "\"%s\" is %s, cached", pattern, id);
+    g_free (key);
+    return id;
+  }
+
+  id = gst_wasapi_device_cache_match_name (self, data_flow, pattern);
+  if (id == NULL) {
+    GST_WARNING_OBJECT (self, "no active endpoint matches \"%s\"", pattern);
+    g_free (key);
+    return NULL;
+  }
+  GST_INFO_OBJECT (self, "\"%s\" is %s", pattern, id);
+
+  /* Only with notifications, or it could never be forgotten */
+  g_mutex_lock (&cache_lock);
+  if (notify_id != 0) {
+    if (names == NULL)
+      names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_replace (names, key, g_strdup (id));
+    key = NULL;
+  }
+  g_mutex_unlock (&cache_lock);
+  g_free (key);
+
+  return id;
+}
+
+GstCaps *
+gst_wasapi_device_cache_get_exclusive_caps (GstElement * self,
+    IMMDevice * device, IAudioClient * client)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  WAVEFORMATEX *format = NULL;
+  GstCaps *caps = NULL;
+  GstAudioChannelPosition *positions = NULL;
+
+  /* Fills in the exclusive format of the entry as well */
+  if (!gst_wasapi_device_cache_get_format (self, device, client,
+          AUDCLNT_SHAREMODE_EXCLUSIVE, &format, &caps, &positions))
+    return gst_caps_new_empty ();
+  gst_caps_unref (caps);
+  caps = NULL;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+
+  if (entry != NULL && entry->exclusive_caps != NULL) {
+    caps = gst_caps_ref (entry->exclusive_caps);
+  } else if ((client = gst_wasapi_device_cache_get_client (self, device,
+              client))) {
+    caps = gst_wasapi_util_probe_exclusive_caps (self, client, format,
+        positions);
+    IUnknown_Release (client);
+    if (entry != NULL) {
+      entry->exclusive_caps = gst_caps_ref (caps);
+      gst_wasapi_device_cache_persist (self, device, entry);
+    }
+  } else {
+    caps = gst_caps_new_empty ();
+  }
+  g_mutex_unlock (&cache_lock);
+
+  CoTaskMemFree (format);
+  g_free (positions);
+
+  return caps;
+}
+
+gboolean
+gst_wasapi_device_cache_get_periods (GstElement * self, IMMDevice * device,
+    IAudioClient * client, REFERENCE_TIME * ret_default_period,
+    REFERENCE_TIME * ret_min_period)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  gboolean ret = TRUE;
+  HRESULT hr;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+
+  if (entry != NULL && entry->have_periods) {
+    *ret_default_period = entry->default_period;
+    *ret_min_period = entry->min_period;
+    goto out;
+  }
+
+  if (!(client = gst_wasapi_device_cache_get_client (self, device, client))) {
+    ret = FALSE;
+    goto out;
+  }
+
+  hr = IAudioClient_GetDevicePeriod (client, ret_default_period,
+      ret_min_period);
+  IUnknown_Release (client);
+  if (FAILED (hr)) {
+    GST_WARNING_OBJECT (self, "IAudioClient::GetDevicePeriod failed: %s",
+        gst_wasapi_util_hresult_to_static_string (hr));
+    ret = FALSE;
+    goto out;
+  }
+
+  if (entry != NULL) {
+    entry->default_period = *ret_default_period;
+    entry->min_period = *ret_min_period;
+    entry->have_periods = TRUE;
+    gst_wasapi_device_cache_persist (self, device, entry);
+  }
+
+out:
+  g_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
+/* With cache_lock */
+static gboolean
+gst_wasapi_device_cache_query_engine_periods (GstElement * self,
+    IMMDevice * device, IAudioClient * client, guint * periods)
+{
+  IAudioClient3 *client3 = NULL;
+  WAVEFORMATEX *format = NULL;
+  gboolean ret = FALSE;
+  HRESULT hr;
+
+  memset (periods, 0, 4 * sizeof (guint));
+
+  if (!gst_wasapi_util_have_audioclient3 ())
+    return TRUE;
+
+  if (!(client = gst_wasapi_device_cache_get_client (self, device, client)))
+    return FALSE;
+
+  hr = IUnknown_QueryInterface (client, &IID_IAudioClient3,
+      (void **) &client3);
+  if (FAILED (hr)) {
+    ret = TRUE;
+    goto out;
+  }
+
+  hr = IAudioClient3_GetMixFormat (client3, &format);
+  HR_FAILED_AND (hr, IAudioClient3::GetMixFormat, goto out);
+
+  hr = IAudioClient3_GetSharedModeEnginePeriod (client3, format, &periods[0],
+      &periods[1], &periods[2], &periods[3]);
+  HR_FAILED_AND (hr, IAudioClient3::GetSharedModeEnginePeriod, goto out);
+
+  ret = TRUE;
+
+out:
+  CoTaskMemFree (format);
+  if (client3)
+    IUnknown_Release (client3);
+  IUnknown_Release (client);
+  return ret;
+}
+
+gboolean
+gst_wasapi_device_cache_get_engine_periods (GstElement * self,
+    IMMDevice * device, IAudioClient * client, guint * ret_default_period,
+    guint * ret_fundamental_period, guint * ret_min_period,
+    guint * ret_max_period)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  guint periods[4];
+  gboolean ret = TRUE;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+
+  if (entry != NULL && entry->have_engine_periods) {
+    memcpy (periods, entry->engine_periods, sizeof (periods));
+  } else {
+    ret = gst_wasapi_device_cache_query_engine_periods (self, device, client,
+        periods);
+    if (ret && entry != NULL) {
+      memcpy (entry->engine_periods, periods, sizeof (periods));
+      entry->have_engine_periods = TRUE;
+      gst_wasapi_device_cache_persist (self, device, entry);
+    }
+  }
+  g_mutex_unlock (&cache_lock);
+
+  if (ret && periods[0] == 0)
+    ret = FALSE;
+
+  if (ret) {
+    *ret_default_period = periods[0];
+    *ret_fundamental_period = periods[1];
+    *ret_min_period = periods[2];
+    *ret_max_period = periods[3];
+  }
+
+  return ret;
+}
+
+gboolean
+gst_wasapi_device_cache_get_loopback_engine_period (GstElement * self,
+    IMMDevice * device)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  gboolean ret = TRUE;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+  if (entry != NULL)
+    ret = entry->loopback_engine_period >= 0;
+  g_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
+void
+gst_wasapi_device_cache_set_loopback_engine_period (GstElement * self,
+    IMMDevice * device, gboolean works)
+{
+  GstWasapiDeviceCacheEntry *entry;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+  if (entry != NULL && entry->loopback_engine_period != (works ? 1 : -1)) {
+    entry->loopback_engine_period = works ? 1 : -1;
+    gst_wasapi_device_cache_persist (self, device, entry);
+  }
+  g_mutex_unlock (&cache_lock);
+}
+
+guint
+gst_wasapi_device_cache_get_ring_extra (GstElement * self, IMMDevice * device)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  guint ret = 0;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+  if (entry != NULL)
+    ret = entry->ring_extra;
+  g_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
+void
+gst_wasapi_device_cache_set_ring_extra (GstElement * self,
+    IMMDevice * device, guint extra)
+{
+  GstWasapiDeviceCacheEntry *entry;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+  if (entry != NULL && entry->ring_extra != extra) {
+    entry->ring_extra = extra;
+    gst_wasapi_device_cache_persist (self, device, entry);
+  }
+  g_mutex_unlock (&cache_lock);
+}
+
+gboolean
+gst_wasapi_device_cache_get_rate_ppm (GstElement * self, IMMDevice * device,
+    const gchar * path, gdouble * ret_ppm)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  GKeyFile *file;
+  GError *err = NULL;
+  gboolean ret = FALSE;
+  gchar *id;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+  if (entry != NULL && entry->have_rate) {
+    *ret_ppm = entry->rate_ppm;
+    ret = TRUE;
+  }
+  g_mutex_unlock (&cache_lock);
+
+  if (ret || path == NULL || (id = gst_wasapi_util_get_device_id (device)) ==
+      NULL)
+    return ret;
+
+  /* Not there yet is fine, the first stream writes it */
+  file = g_key_file_new ();
+  if (g_key_file_load_from_file (file, path, G_KEY_FILE_NONE, NULL)) {
+    gdouble ppm = g_key_file_get_double (file, RATES_GROUP, id, &err);
+
+    if (err == NULL) {
+      *ret_ppm = ppm;
+      ret = TRUE;
+    }
+    g_clear_error (&err);
+  }
+  g_key_file_free (file);
+  g_free (id);
+
+  if (ret)
+    gst_wasapi_device_cache_set_rate_ppm (self, device, NULL, *ret_ppm);
+
+  return ret;
+}
+
+void
+gst_wasapi_device_cache_set_rate_ppm (GstElement * self, IMMDevice * device,
+    const gchar * path, gdouble ppm)
+{
+  GstWasapiDeviceCacheEntry *entry;
+  GKeyFile *file;
+  GError *err = NULL;
+  gchar *id;
+
+  gst_wasapi_device_cache_subscribe (self);
+  g_mutex_lock (&cache_lock);
+  entry = gst_wasapi_device_cache_lookup (self, device);
+  if (entry != NULL) {
+    entry->have_rate = TRUE;
+    entry->rate_ppm = ppm;
+    gst_wasapi_device_cache_persist (self, device, entry);
+  }
+  g_mutex_unlock (&cache_lock);
+
+  if (path == NULL || (id = gst_wasapi_util_get_device_id (device)) == NULL)
+    return;
+
+  /* The rates of the other endpoints stay */
+  file = g_key_file_new ();
+  g_key_file_load_from_file (file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+  g_key_file_set_double (file, RATES_GROUP, id, ppm);
+  if (!g_key_file_save_to_file (file, path, &err)) {
+    GST_WARNING_OBJECT (self, "failed to write %s: %s", path, err->message);
+    g_clear_error (&err);
+  }
+  g_key_file_free (file);
+  g_free (id);
+}
@@ -0,0 +1,106 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_DEVICE_CACHE_H__
+#define __GST_WASAPI_DEVICE_CACHE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Process-wide cache of what we learn about an endpoint while negotiating:
+ * the device format of each share mode with its caps and channel positions,
+ * the probed exclusive caps and the device periods. Keyed by the endpoint
+ * id, so all elements and the device provider share it. An entry is dropped
+ * when the device format or the state of the endpoint changes.
+ *
+ * Entries are also kept in a profiles file in the user cache directory,
+ * so the next process doesn't have to probe the endpoint again unless its
+ * driver version or device format changed in between.
+ *
+ * @client may be NULL, the device is then activated if it's not cached. */
+
+/* Copies of the device format for @sharemode, the raw caps parsed from it
+ * and its channel positions. Free the format with CoTaskMemFree() and the
+ * positions with g_free(). */
+gboolean gst_wasapi_device_cache_get_format (GstElement * element,
+    IMMDevice * device, IAudioClient * client, gint sharemode,
+    WAVEFORMATEX ** ret_format, GstCaps ** ret_caps,
+    GstAudioChannelPosition ** ret_positions);
+
+/* The friendly name of the endpoint, interned so it's never freed and the
+ * elements can keep it. NULL if the endpoint doesn't have one. */
+const gchar *gst_wasapi_device_cache_get_description (GstElement * element,
+    IMMDevice * device);
+
+/* The id of the first active endpoint of @data_flow whose friendly name
+ * matches the glob @pattern, NULL if none does. Walks the endpoints without
+ * activating them, and remembers the result until endpoints come, go or
+ * get renamed. */
+gchar *gst_wasapi_device_cache_find_by_name (GstElement * element,
+    gint data_flow, const gchar * pattern);
+
+/* See gst_wasapi_util_probe_exclusive_caps(), maybe empty */
+GstCaps *gst_wasapi_device_cache_get_exclusive_caps (GstElement * element,
+    IMMDevice * device, IAudioClient * client);
+
+gboolean gst_wasapi_device_cache_get_periods (GstElement * element,
+    IMMDevice * device, IAudioClient * client,
+    REFERENCE_TIME * ret_default_period, REFERENCE_TIME * ret_min_period);
+
+/* The periods of the shared mode engine in frames of the mix format, as
+ * told by IAudioClient3. FALSE if the endpoint doesn't have it. */
+gboolean gst_wasapi_device_cache_get_engine_periods (GstElement * element,
+    IMMDevice * device, IAudioClient * client, guint * ret_default_period,
+    guint * ret_fundamental_period, guint * ret_min_period,
+    guint * ret_max_period);
+
+/* Whether a loopback capture stream on the endpoint got the engine period
+ * it asked IAudioClient3 for. TRUE until it's known not to. */
+gboolean gst_wasapi_device_cache_get_loopback_engine_period (GstElement *
+    element, IMMDevice * device);
+
+void gst_wasapi_device_cache_set_loopback_engine_period (GstElement * element,
+    IMMDevice * device, gboolean works);
+
+/* Extra ringbuffer segments adaptive-buffer learned for the endpoint, 0
+ * until it learned something */
+guint gst_wasapi_device_cache_get_ring_extra (GstElement * element,
+    IMMDevice * device);
+
+void gst_wasapi_device_cache_set_ring_extra (GstElement * element,
+    IMMDevice * device, guint extra);
+
+/* How much faster than the pipeline clock the endpoint captured last, in
+ * ppm. With @path, also kept in that key file for the next processes: read
+ * from it while this one doesn't know, and written there by set. */
+gboolean gst_wasapi_device_cache_get_rate_ppm (GstElement * element,
+    IMMDevice * device, const gchar * path, gdouble * ret_ppm);
+
+void gst_wasapi_device_cache_set_rate_ppm (GstElement * element,
+    IMMDevice * device, const gchar * path, gdouble ppm);
+
+/* Drops what is known about the endpoint with id @id, when the caller got
+ * notified of a change before the cache was */
+void gst_wasapi_device_cache_invalidate (const gchar * id);
+
+/* Loads what earlier processes stored about the endpoints, from
+ * plugin_init. Entries are checked against the endpoint when first used. */
+void gst_wasapi_device_cache_load (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_DEVICE_CACHE_H__ */
@@ -0,0 +1,355 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapideviceclock.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Only extrapolate the position over this many device periods */
+#define MAX_EXTRAPOLATION_PERIODS 2
+
+void
+gst_wasapi_device_clock_init (GstWasapiDeviceClock * clock)
+{
+  g_mutex_init (&clock->lock);
+  clock->client_clock = NULL;
+  clock->freq = 0;
+  clock->max_extrapolation = 0;
+  clock->last = 0;
+  clock->offset = 0;
+  clock->rebase = FALSE;
+}
+
+void
+gst_wasapi_device_clock_clear (GstWasapiDeviceClock * clock)
+{
+  gst_wasapi_device_clock_set_client (clock, NULL, 0);
+  g_mutex_clear (&clock->lock);
+}
+
+gboolean
+gst_wasapi_device_clock_set_client (GstWasapiDeviceClock * clock,
+    IAudioClock * client_clock, GstClockTime device_period)
+{
+  guint64 freq = 0;
+  HRESULT hr;
+
+  if (client_clock != NULL) {
+    hr = IAudioClock_GetFrequency (client_clock, &freq);
+    if (FAILED (hr)) {
+      GST_WARNING ("IAudioClock::GetFrequency failed (%x): %s", (guint) hr,
+          gst_wasapi_util_hresult_to_static_string (hr));
+      return FALSE;
+    }
+    IUnknown_AddRef (client_clock);
+  }
+
+  g_mutex_lock (&clock->lock);
+  if (clock->client_clock != NULL)
+    IUnknown_Release (clock->client_clock);
+  clock->client_clock = client_clock;
+  clock->freq = freq;
+  clock->max_extrapolation = MAX_EXTRAPOLATION_PERIODS * device_period;
+  /* Continue from wherever the clock was */
+  clock->rebase = TRUE;
+  g_mutex_unlock (&clock->lock);
+
+  return TRUE;
+}
+
+void
+gst_wasapi_device_clock_rebase (GstWasapiDeviceClock * clock)
+{
+  g_mutex_lock (&clock->lock);
+  clock->rebase = TRUE;
+  g_mutex_unlock (&clock->lock);
+}
+
+GstClockTime
+gst_wasapi_device_clock_get_time (GstWasapiDeviceClock * clock)
+{
+  guint64 devpos, qpcpos, now;
+  GstClockTime position, elapsed;
+  GstClockTime result = GST_CLOCK_TIME_NONE;
+  HRESULT hr;
+
+  g_mutex_lock (&clock->lock);
+  if (G_UNLIKELY (clock->client_clock == NULL || clock->freq == 0))
+    goto out;
+
+  hr = IAudioClock_GetPosition (clock->client_clock, &devpos, &qpcpos);
+  if (FAILED (hr)) {
+    GST_WARNING ("IAudioClock::GetPosition failed (%x): %s", (guint) hr,
+        gst_wasapi_util_hresult_to_static_string (hr));
+    goto out;
+  }
+
+  position = gst_util_uint64_scale (devpos, GST_SECOND, clock->freq);
+
+  now = gst_wasapi_util_get_qpc_position ();
+  elapsed = now > qpcpos ? (now - qpcpos) * 100 : 0;
+  position += MIN (elapsed, clock->max_extrapolation);
+
+  if (clock->rebase) {
+    clock->offset = GST_CLOCK_DIFF (position, clock->last);
+    clock->rebase = FALSE;
+  }
+
+  result = position + clock->offset;
+  if (result < clock->last)
+    result = clock->last;
+  clock->last = result;
+
+out:
+  g_mutex_unlock (&clock->lock);
+
+  return result;
+}
+
+/* Shared clocks, by container or endpoint id */
+typedef struct
+{
+  IAudioClock *client_clock;
+  GstClockTime device_period;
+} SharedClient;
+
+typedef struct
+{
+  gchar *id;
+  GWeakRef clock;
+  GstWasapiDeviceClock time;
+  /* SharedClient, the first one drives the clock */
+  GList *clients;
+} SharedEntry;
+
+static GMutex shared_lock;
+static GHashTable *shared_clocks;
+
+/* A GstAudioClock, as GstAudioBaseSink and GstAudioBaseSrc expect of the
+ * clock they provide, but with its own internal time. Every element resets
+ * its provided clock when going to PAUSED, and the time_offset that sets
+ * would shift the time base that all the elements on the endpoint share. */
+typedef GstAudioClock GstWasapiSharedClock;
+typedef GstAudioClockClass GstWasapiSharedClockClass;
+
+static GType gst_wasapi_shared_clock_get_type (void);
+G_DEFINE_TYPE (GstWasapiSharedClock, gst_wasapi_shared_clock,
+    GST_TYPE_AUDIO_CLOCK);
+
+static GstClockTime
+gst_wasapi_device_clock_shared_get_time (GstClock * clock, gpointer user_data)
+{
+  SharedEntry *entry = user_data;
+
+  return gst_wasapi_device_clock_get_time (&entry->time);
+}
+
+static GstClockTime
+gst_wasapi_shared_clock_get_internal_time (GstClock * clock)
+{
+  SharedEntry *entry = GST_AUDIO_CLOCK_CAST (clock)->user_data;
+  GstClockTime time;
+
+  time = gst_wasapi_device_clock_shared_get_time (clock, entry);
+  /* Stands still while no element has a client */
+  if (!GST_CLOCK_TIME_IS_VALID (time)) {
+    g_mutex_lock (&entry->time.lock);
+    time = entry->time.last;
+    g_mutex_unlock (&entry->time.lock);
+  }
+
+  return time;
+}
+
+static void
+gst_wasapi_shared_clock_class_init (GstWasapiSharedClockClass * klass)
+{
+  GstClockClass *clock_class = GST_CLOCK_CLASS (klass);
+
+  clock_class->get_internal_time = gst_wasapi_shared_clock_get_internal_time;
+}
+
+static void
+gst_wasapi_shared_clock_init (GstWasapiSharedClock * self)
+{
+}
+
+static void
+gst_wasapi_device_clock_shared_entry_free (gpointer user_data)
+{
+  SharedEntry *entry = user_data;
+  GList *l;
+
+  g_mutex_lock (&shared_lock);
+  if (g_hash_table_lookup (shared_clocks, entry->id) == entry)
+    g_hash_table_remove (shared_clocks, entry->id);
+  g_mutex_unlock (&shared_lock);
+
+  for (l = entry->clients; l; l = l->next) {
+    SharedClient *client = l->data;
+
+    IUnknown_Release (client->client_clock);
+    g_slice_free (SharedClient, client);
+  }
+  g_list_free (entry->clients);
+
+  gst_wasapi_device_clock_clear (&entry->time);
+  g_weak_ref_clear (&entry->clock);
+  g_free (entry->id);
+  g_slice_free (SharedEntry, entry);
+}
+
+GstClock *
+gst_wasapi_device_clock_get_shared (IMMDevice * device)
+{
+  SharedEntry *entry;
+  GstClock *clock = NULL;
+  LPWSTR wid = NULL;
+  gchar *id, *container, *name;
+  HRESULT hr;
+
+  hr = IMMDevice_GetId (device, &wid);
+  if (FAILED (hr)) {
+    GST_WARNING ("IMMDevice::GetId failed (%x): %s", (guint) hr,
+        gst_wasapi_util_hresult_to_static_string (hr));
+    return NULL;
+  }
+  id = g_utf16_to_utf8 (wid, -1, NULL, NULL, NULL);
+  CoTaskMemFree (wid);
+
+  /* The endpoints of one container share a crystal, so they can share a
+   * clock too, and elements on them don't slave to each other */
+  if ((container = gst_wasapi_util_get_container_id (device))) {
+    g_free (id);
+    id = g_strdup_printf ("container-%s", container);
+    g_free (container);
+  }
+
+  g_mutex_lock (&shared_lock);
+  if (shared_clocks == NULL)
+    shared_clocks = g_hash_table_new (g_str_hash, g_str_equal);
+
+  entry = g_hash_table_lookup (shared_clocks, id);
+  if (entry != NULL)
+    clock = g_weak_ref_get (&entry->clock);
+
+  /* An entry without a clock is about to be freed, replace it */
+  if (clock == NULL) {
+    entry = g_slice_new0 (SharedEntry);
+    entry->id = id;
+    id = NULL;
+    gst_wasapi_device_clock_init (&entry->time);
+
+    name = g_strdup_printf ("GstWasapiClock-%s", entry->id);
+    clock = g_object_new (gst_wasapi_shared_clock_get_type (), "name", name,
+        NULL);
+    gst_object_ref_sink (clock);
+    GST_AUDIO_CLOCK_CAST (clock)->func =
+        gst_wasapi_device_clock_shared_get_time;
+    GST_AUDIO_CLOCK_CAST (clock)->user_data = entry;
+    GST_AUDIO_CLOCK_CAST (clock)->destroy_notify =
+        gst_wasapi_device_clock_shared_entry_free;
+    g_free (name);
+
+    g_weak_ref_init (&entry->clock, clock);
+    g_hash_table_replace (shared_clocks, entry->id, entry);
+
+    GST_INFO ("new shared clock for %s", entry->id);
+  }
+  g_mutex_unlock (&shared_lock);
+
+  g_free (id);
+
+  return clock;
+}
+
+static SharedEntry *
+gst_wasapi_device_clock_shared_entry (GstClock * shared)
+{
+  return GST_AUDIO_CLOCK_CAST (shared)->user_data;
+}
+
+gboolean
+gst_wasapi_device_clock_add_client (GstClock * shared,
+    IAudioClock * client_clock, GstClockTime device_period)
+{
+  SharedEntry *entry = gst_wasapi_device_clock_shared_entry (shared);
+  SharedClient *client;
+  gboolean res = TRUE;
+
+  client = g_slice_new (SharedClient);
+  client->client_clock = client_clock;
+  client->device_period = device_period;
+  IUnknown_AddRef (client_clock);
+
+  g_mutex_lock (&shared_lock);
+  entry->clients = g_list_append (entry->clients, client);
+  if (entry->clients->data == client)
+    res = gst_wasapi_device_clock_set_client (&entry->time, client_clock,
+        device_period);
+  g_mutex_unlock (&shared_lock);
+
+  return res;
+}
+
+void
+gst_wasapi_device_clock_remove_client (GstClock * shared,
+    IAudioClock * client_clock)
+{
+  SharedEntry *entry = gst_wasapi_device_clock_shared_entry (shared);
+  GList *l;
+
+  g_mutex_lock (&shared_lock);
+  for (l = entry->clients; l; l = l->next) {
+    SharedClient *client = l->data;
+
+    if (client->client_clock != client_clock)
+      continue;
+
+    /* Hand over to the next client, the time continues from where it was */
+    if (l == entry->clients) {
+      SharedClient *next = l->next ? l->next->data : NULL;
+
+      gst_wasapi_device_clock_set_client (&entry->time,
+          next ? next->client_clock : NULL, next ? next->device_period : 0);
+    }
+
+    entry->clients = g_list_delete_link (entry->clients, l);
+    IUnknown_Release (client->client_clock);
+    g_slice_free (SharedClient, client);
+    break;
+  }
+  g_mutex_unlock (&shared_lock);
+}
+
+void
+gst_wasapi_device_clock_client_reset (GstClock * shared,
+    IAudioClock * client_clock)
+{
+  SharedEntry *entry = gst_wasapi_device_clock_shared_entry (shared);
+
+  g_mutex_lock (&shared_lock);
+  if (entry->clients &&
+      ((SharedClient *) entry->clients->data)->client_clock == client_clock)
+    gst_wasapi_device_clock_rebase (&entry->time);
+  g_mutex_unlock (&shared_lock);
+}
@@ -0,0 +1,78 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_DEVICE_CLOCK_H__
+#define __GST_WASAPI_DEVICE_CLOCK_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Time of an audio endpoint, from the IAudioClock position.
+ *
+ * The position only advances once per device period, but GetPosition()
+ * also tells when it was sampled, so we extrapolate from there for a smooth
+ * clock. The time stays monotonic over jitter, and continues from where it
+ * was when the client changes or its position starts over. It can be read
+ * from any thread. */
+typedef struct
+{
+  GMutex lock;
+  IAudioClock *client_clock;
+  guint64 freq;
+  GstClockTime max_extrapolation;
+  GstClockTime last;
+  GstClockTimeDiff offset;
+  gboolean rebase;
+} GstWasapiDeviceClock;
+
+void gst_wasapi_device_clock_init (GstWasapiDeviceClock * clock);
+
+void gst_wasapi_device_clock_clear (GstWasapiDeviceClock * clock);
+
+/* Follows @client_clock from now on, or nothing if NULL. The time is
+ * extrapolated over at most two periods of @device_period, so it stands
+ * still when the device stops. */
+gboolean gst_wasapi_device_clock_set_client (GstWasapiDeviceClock * clock,
+    IAudioClock * client_clock, GstClockTime device_period);
+
+/* The device position started over, e.g. after IAudioClient::Reset() */
+void gst_wasapi_device_clock_rebase (GstWasapiDeviceClock * clock);
+
+/* GST_CLOCK_TIME_NONE without a client */
+GstClockTime gst_wasapi_device_clock_get_time (GstWasapiDeviceClock * clock);
+
+/* Process-wide clock of the endpoint of @device, shared by every element
+ * that asks for it, so elements on the same hardware have one time base.
+ * Endpoints in the same container, see gst_wasapi_util_get_container_id(),
+ * get the same clock.
+ * It follows the first registered client, then the next when that one goes
+ * away. Returns a new reference. */
+GstClock *gst_wasapi_device_clock_get_shared (IMMDevice * device);
+
+gboolean gst_wasapi_device_clock_add_client (GstClock * shared,
+    IAudioClock * client_clock, GstClockTime device_period);
+
+void gst_wasapi_device_clock_remove_client (GstClock * shared,
+    IAudioClock * client_clock);
+
+/* The position of @client_clock started over */
+void gst_wasapi_device_clock_client_reset (GstClock * shared,
+    IAudioClock * client_clock);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_DEVICE_CLOCK_H__ */
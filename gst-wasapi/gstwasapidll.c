@@ -0,0 +1,136 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapidll.h"
+
+#include <math.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* An error beyond this is a jump of the timeline, not jitter */
+#define RESET_THRESHOLD (50 * GST_MSECOND)
+
+/* Keeps the loop stable over long gaps between observations, where the
+ * loop gain for the gap would otherwise exceed 1 */
+#define MAX_OMEGA 0.5
+
+/* The period estimate is never off by more than this, in ppm */
+#define MAX_PPM 5000
+
+struct _GstWasapiDll
+{
+  gint rate;
+  gdouble bandwidth;
+
+  gboolean valid;
+  /* Filtered time of frame @position and the estimated frame period, in
+   * ns. Doubles, the correction is a fraction of a nanosecond per frame. */
+  guint64 position;
+  gdouble time;
+  gdouble period;
+  /* What we returned last, so the output never goes back */
+  GstClockTime last;
+};
+
+GstWasapiDll *
+gst_wasapi_dll_new (gint rate, gdouble bandwidth)
+{
+  GstWasapiDll *self = g_slice_new0 (GstWasapiDll);
+
+  self->rate = rate;
+  self->bandwidth = bandwidth;
+
+  return self;
+}
+
+void
+gst_wasapi_dll_free (GstWasapiDll * self)
+{
+  g_slice_free (GstWasapiDll, self);
+}
+
+void
+gst_wasapi_dll_reset (GstWasapiDll * self)
+{
+  self->valid = FALSE;
+}
+
+static GstClockTime
+gst_wasapi_dll_start (GstWasapiDll * self, guint64 position, GstClockTime time)
+{
+  self->valid = TRUE;
+  self->position = position;
+  self->time = (gdouble) time;
+  self->period = (gdouble) GST_SECOND / self->rate;
+  self->last = time;
+
+  return time;
+}
+
+GstClockTime
+gst_wasapi_dll_update (GstWasapiDll * self, guint64 position,
+    GstClockTime time)
+{
+  gdouble nominal = (gdouble) GST_SECOND / self->rate;
+  gdouble predicted, error, omega;
+  guint64 n;
+
+  if (!self->valid || position < self->position)
+    return gst_wasapi_dll_start (self, position, time);
+
+  n = position - self->position;
+  predicted = self->time + n * self->period;
+  error = (gdouble) time - predicted;
+
+  if (fabs (error) > RESET_THRESHOLD) {
+    GST_DEBUG ("timestamp off by %.3f ms, starting over", error / GST_MSECOND);
+    return gst_wasapi_dll_start (self, position, time);
+  }
+
+  /* A second order loop, with the gains for the @n frames since the last
+   * observation */
+  omega = MIN (2 * G_PI * self->bandwidth * n / self->rate, MAX_OMEGA);
+  self->time = predicted + G_SQRT2 * omega * error;
+  if (n > 0)
+    self->period = CLAMP (self->period + omega * omega * error / n,
+        nominal * (1 - MAX_PPM / 1e6), nominal * (1 + MAX_PPM / 1e6));
+  self->position = position;
+
+  self->last = MAX (self->last, (GstClockTime) self->time);
+
+  return self->last;
+}
+
+GstClockTime
+gst_wasapi_dll_predict (GstWasapiDll * self, guint64 position)
+{
+  if (!self->valid)
+    return GST_CLOCK_TIME_NONE;
+
+  /* Only forwards from the last observation, and an update after this
+   * doesn't go back behind it either */
+  if (position > self->position)
+    self->last = MAX (self->last, (GstClockTime) (self->time +
+            (position - self->position) * self->period));
+
+  return self->last;
+}
@@ -0,0 +1,56 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_DLL_H__
+#define __GST_WASAPI_DLL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Smooths the timestamps of a stream of frames with a second-order delay
+ * locked loop, as in "Using a DLL to filter time" by F. Adriaensen.
+ *
+ * Each observation is the time at which a frame position was seen, with
+ * the jitter of whatever took it. The loop predicts that time from the
+ * filtered time of the last observation and its estimate of the frame
+ * period, and moves both towards the observation by a fraction of the
+ * error, given by the bandwidth. The output follows the observations
+ * without their jitter and never goes backwards. An error well beyond any
+ * jitter, after a discontinuity, starts the loop over at the observation.
+ * From the streaming thread only. */
+typedef struct _GstWasapiDll GstWasapiDll;
+
+/* @bandwidth in Hz, lower is smoother but follows rate changes slower */
+GstWasapiDll *gst_wasapi_dll_new (gint rate, gdouble bandwidth);
+
+void gst_wasapi_dll_free (GstWasapiDll * dll);
+
+void gst_wasapi_dll_reset (GstWasapiDll * dll);
+
+/* Frame @position was seen at @time, returns its filtered time */
+GstClockTime gst_wasapi_dll_update (GstWasapiDll * dll, guint64 position,
+    GstClockTime time);
+
+/* The filtered time of @position without an observation, e.g. for a
+ * buffer nothing was measured for. GST_CLOCK_TIME_NONE before the first
+ * update. */
+GstClockTime gst_wasapi_dll_predict (GstWasapiDll * dll, guint64 position);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_DLL_H__ */
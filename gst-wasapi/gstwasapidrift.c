@@ -0,0 +1,201 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapidrift.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* One point every 250ms, over a window of 32 seconds */
+#define POINT_INTERVAL (250 * GST_MSECOND)
+#define WINDOW_SIZE 128
+
+/* Don't estimate from less than this much time */
+#define MIN_SPAN (2 * GST_SECOND)
+
+/* An estimate over this much time is good enough to seed the next stream */
+#define MEASURED_SPAN (10 * GST_SECOND)
+
+/* Anything beyond this is a broken timestamp, not drift */
+#define MAX_PPM 5000
+
+struct _GstWasapiDrift
+{
+  gint rate;
+
+  /* Ring of points, @head is the oldest */
+  guint64 devpos[WINDOW_SIZE];
+  GstClockTime time[WINDOW_SIZE];
+  guint head;
+  guint n_points;
+
+  /* Published estimate in ppb, only accessed atomically */
+  gint ppb;
+  gint valid;
+  /* Also atomic. Survive resets, the device keeps its rate. */
+  gint seed_ppb;
+  gint seeded;
+  gint measured_ppb;
+  gint measured;
+};
+
+GstWasapiDrift *
+gst_wasapi_drift_new (gint rate)
+{
+  GstWasapiDrift *self = g_slice_new0 (GstWasapiDrift);
+
+  self->rate = rate;
+
+  return self;
+}
+
+void
+gst_wasapi_drift_free (GstWasapiDrift * self)
+{
+  g_slice_free (GstWasapiDrift, self);
+}
+
+void
+gst_wasapi_drift_reset (GstWasapiDrift * self)
+{
+  self->head = 0;
+  self->n_points = 0;
+  g_atomic_int_set (&self->ppb, g_atomic_int_get (&self->seed_ppb));
+  g_atomic_int_set (&self->valid, g_atomic_int_get (&self->seeded));
+}
+
+/* Least squares fit of time over position, relative to the oldest point to
+ * keep the sums well within double precision */
+static void
+gst_wasapi_drift_update (GstWasapiDrift * self)
+{
+  guint64 devpos0 = self->devpos[self->head];
+  GstClockTime time0 = self->time[self->head];
+  gdouble sx = 0, sy = 0, sxx = 0, sxy = 0, n = self->n_points;
+  gdouble slope, nominal, ppm;
+  GstClockTime span;
+  guint i;
+
+  span = self->time[(self->head + self->n_points - 1) % WINDOW_SIZE] - time0;
+  if (span < MIN_SPAN)
+    return;
+
+  for (i = 0; i < self->n_points; i++) {
+    guint idx = (self->head + i) % WINDOW_SIZE;
+    gdouble x = (gdouble) (self->devpos[idx] - devpos0);
+    gdouble y = (gdouble) (self->time[idx] - time0);
+
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+
+  if (n * sxx - sx * sx <= 0)
+    return;
+
+  /* Clock nanoseconds per device frame */
+  slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  nominal = (gdouble) GST_SECOND / self->rate;
+  ppm = (nominal / slope - 1.0) * 1e6;
+
+  if (ABS (ppm) > MAX_PPM) {
+    GST_DEBUG ("ignoring estimate of %.1f ppm", ppm);
+    return;
+  }
+
+  g_atomic_int_set (&self->ppb, (gint) (ppm * 1000));
+  g_atomic_int_set (&self->valid, TRUE);
+  if (span >= MEASURED_SPAN) {
+    g_atomic_int_set (&self->measured_ppb, (gint) (ppm * 1000));
+    g_atomic_int_set (&self->measured, TRUE);
+  }
+
+  GST_LOG ("drift %.3f ppm over %u points", ppm, self->n_points);
+}
+
+void
+gst_wasapi_drift_push (GstWasapiDrift * self, guint64 devpos,
+    GstClockTime time)
+{
+  guint idx;
+
+  if (!GST_CLOCK_TIME_IS_VALID (time))
+    return;
+
+  if (self->n_points > 0) {
+    guint last = (self->head + self->n_points - 1) % WINDOW_SIZE;
+
+    /* The position or the clock went back, start over */
+    if (devpos < self->devpos[last] || time < self->time[last]) {
+      gst_wasapi_drift_reset (self);
+    } else if (devpos == self->devpos[last] ||
+        time - self->time[last] < POINT_INTERVAL) {
+      return;
+    }
+  }
+
+  if (self->n_points == WINDOW_SIZE) {
+    self->head = (self->head + 1) % WINDOW_SIZE;
+    self->n_points--;
+  }
+
+  idx = (self->head + self->n_points) % WINDOW_SIZE;
+  self->devpos[idx] = devpos;
+  self->time[idx] = time;
+  self->n_points++;
+
+  gst_wasapi_drift_update (self);
+}
+
+gboolean
+gst_wasapi_drift_get_ppm (GstWasapiDrift * self, gdouble * ppm)
+{
+  if (!g_atomic_int_get (&self->valid))
+    return FALSE;
+
+  *ppm = g_atomic_int_get (&self->ppb) / 1000.0;
+  return TRUE;
+}
+
+void
+gst_wasapi_drift_seed (GstWasapiDrift * self, gdouble ppm)
+{
+  ppm = CLAMP (ppm, -MAX_PPM, MAX_PPM);
+
+  g_atomic_int_set (&self->seed_ppb, (gint) (ppm * 1000));
+  g_atomic_int_set (&self->seeded, TRUE);
+  /* Until the window has an estimate of its own */
+  if (!g_atomic_int_get (&self->valid)) {
+    g_atomic_int_set (&self->ppb, (gint) (ppm * 1000));
+    g_atomic_int_set (&self->valid, TRUE);
+  }
+}
+
+gboolean
+gst_wasapi_drift_get_measured_ppm (GstWasapiDrift * self, gdouble * ppm)
+{
+  if (!g_atomic_int_get (&self->measured))
+    return FALSE;
+
+  *ppm = g_atomic_int_get (&self->measured_ppb) / 1000.0;
+  return TRUE;
+}
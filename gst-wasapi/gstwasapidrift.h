@@ -0,0 +1,58 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_DRIFT_H__
+#define __GST_WASAPI_DRIFT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Estimates the rate of the device against a clock.
+ *
+ * Keeps a sliding window of (device position, clock time) pairs and fits a
+ * line through them, so single late or early timestamps barely move the
+ * estimate while a steady drift shows up after a few seconds. Points are
+ * pushed from the capture thread, the estimate can be read from any. */
+typedef struct _GstWasapiDrift GstWasapiDrift;
+
+GstWasapiDrift *gst_wasapi_drift_new (gint rate);
+
+void gst_wasapi_drift_free (GstWasapiDrift * drift);
+
+/* Forget all points, e.g. after the device position started over */
+void gst_wasapi_drift_reset (GstWasapiDrift * drift);
+
+/* Frame @devpos was captured at @time */
+void gst_wasapi_drift_push (GstWasapiDrift * drift, guint64 devpos,
+    GstClockTime time);
+
+/* How much faster the device runs than the clock, in ppm. Returns FALSE
+ * while there are not enough points for an estimate. */
+gboolean gst_wasapi_drift_get_ppm (GstWasapiDrift * drift, gdouble * ppm);
+
+/* The estimate to give until there are enough points for one, and again
+ * after a reset, e.g. what was measured for the device before */
+void gst_wasapi_drift_seed (GstWasapiDrift * drift, gdouble ppm);
+
+/* The last estimate fitted over enough time to be worth remembering for
+ * the device, never the seed. FALSE if there is none yet. */
+gboolean gst_wasapi_drift_get_measured_ppm (GstWasapiDrift * drift,
+    gdouble * ppm);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_DRIFT_H__ */
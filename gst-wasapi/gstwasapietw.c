@@ -0,0 +1,395 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapietw.h"
+
+#include <evntrace.h>
+#include <evntcons.h>
+#include <tdh.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Microsoft-Windows-Audio {ae4bd3be-f36f-45b6-8d21-bdd6fb832853} */
+static const GUID gst_wasapi_etw_audio_provider = { 0xae4bd3be, 0xf36f,
+  0x45b6, {0x8d, 0x21, 0xbd, 0xd6, 0xfb, 0x83, 0x28, 0x53}
+};
+
+/* Glitches of the audio engine that are matched against, across all
+ * endpoints of the process */
+#define N_EVENTS 256
+/* Glitches of an element waiting for ETW to catch up */
+#define N_PENDING 64
+/* The session flushes its buffers every second, in 100 ns */
+#define SETTLE_TIME (3 * 10000000)
+
+typedef struct
+{
+  guint64 qpcpos;
+  GstWasapiGlitchSource source;
+} GstWasapiEtwEvent;
+
+typedef struct
+{
+  guint64 qpcpos;
+  guint64 window;
+  gboolean client_late;
+} GstWasapiEtwGlitch;
+
+struct _GstWasapiEtwTracker
+{
+  /* Protects everything below */
+  GMutex lock;
+  GstWasapiEtwGlitch pending[N_PENDING];
+  guint n_pending;
+  guint counts[GST_WASAPI_N_GLITCH_SOURCES];
+};
+
+/* With an EVENT_TRACE_PROPERTIES the name of the session goes after it */
+typedef struct
+{
+  EVENT_TRACE_PROPERTIES props;
+  WCHAR name[64];
+} GstWasapiEtwProperties;
+
+/* Protects the session, held while it starts and stops */
+static GMutex session_lock;
+static guint session_users;
+static TRACEHANDLE session;
+static TRACEHANDLE trace;
+static GThread *consumer;
+
+/* Only touched by the consumer thread: the source of each event id, as
+ * found from its names */
+static GHashTable *event_sources;
+static gint64 qpc_freq;
+
+/* Protects the engine glitches, oldest overwritten first */
+static GMutex events_lock;
+static GstWasapiEtwEvent events[N_EVENTS];
+static guint n_events;
+static guint next_event;
+
+static void
+gst_wasapi_etw_init_properties (GstWasapiEtwProperties * p)
+{
+  memset (p, 0, sizeof (GstWasapiEtwProperties));
+  p->props.Wnode.BufferSize = sizeof (GstWasapiEtwProperties);
+  p->props.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+  /* Timestamps from QPC, like the packets of WASAPI */
+  p->props.Wnode.ClientContext = 1;
+  p->props.LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+  p->props.FlushTimer = 1;
+  p->props.LoggerNameOffset = G_STRUCT_OFFSET (GstWasapiEtwProperties, name);
+}
+
+static gchar *
+gst_wasapi_etw_info_string (PTRACE_EVENT_INFO info, ULONG offset)
+{
+  gchar *str = NULL;
+
+  if (offset != 0)
+    str = g_utf16_to_utf8 ((const gunichar2 *) ((guint8 *) info + offset), -1,
+        NULL, NULL, NULL);
+
+  return str ? str : g_strdup ("");
+}
+
+/* What an event of the provider is about, from its task and opcode names */
+static GstWasapiGlitchSource
+gst_wasapi_etw_classify (PEVENT_RECORD record)
+{
+  GstWasapiGlitchSource source = GST_WASAPI_GLITCH_SOURCE_UNKNOWN;
+  PTRACE_EVENT_INFO info;
+  ULONG size = 0;
+  gchar *task, *opcode, *str, *name;
+
+  if (TdhGetEventInformation (record, 0, NULL, NULL, &size) !=
+      ERROR_INSUFFICIENT_BUFFER)
+    return source;
+
+  info = g_malloc (size);
+  if (TdhGetEventInformation (record, 0, NULL, info, &size) != ERROR_SUCCESS) {
+    g_free (info);
+    return source;
+  }
+
+  task = gst_wasapi_etw_info_string (info, info->TaskNameOffset);
+  opcode = gst_wasapi_etw_info_string (info, info->OpcodeNameOffset);
+  str = g_strconcat (task, " ", opcode, NULL);
+  name = g_utf8_strdown (str, -1);
+  g_free (str);
+  g_free (opcode);
+  g_free (task);
+
+  if (strstr (name, "glitch") != NULL) {
+    if (strstr (name, "driver") != NULL || strstr (name, "device") != NULL)
+      source = GST_WASAPI_GLITCH_SOURCE_DRIVER;
+    else
+      source = GST_WASAPI_GLITCH_SOURCE_ENGINE;
+  }
+
+  GST_DEBUG ("audio engine event %u is \"%s\"%s",
+      record->EventHeader.EventDescriptor.Id, name,
+      source == GST_WASAPI_GLITCH_SOURCE_UNKNOWN ? ", ignored" : "");
+
+  g_free (name);
+  g_free (info);
+
+  return source;
+}
+
+static void WINAPI
+gst_wasapi_etw_event_record (PEVENT_RECORD record)
+{
+  GstWasapiGlitchSource source;
+  gpointer key, value;
+
+  if (!IsEqualGUID (&record->EventHeader.ProviderId,
+          &gst_wasapi_etw_audio_provider))
+    return;
+
+  /* Ids start at 0, NULL is no key */
+  key = GUINT_TO_POINTER (record->EventHeader.EventDescriptor.Id + 1);
+  if (!g_hash_table_lookup_extended (event_sources, key, NULL, &value)) {
+    value = GINT_TO_POINTER (gst_wasapi_etw_classify (record));
+    g_hash_table_insert (event_sources, key, value);
+  }
+  source = GPOINTER_TO_INT (value);
+  if (source == GST_WASAPI_GLITCH_SOURCE_UNKNOWN)
+    return;
+
+  g_mutex_lock (&events_lock);
+  events[next_event].qpcpos =
+      gst_util_uint64_scale (record->EventHeader.TimeStamp.QuadPart,
+      10000000, qpc_freq);
+  events[next_event].source = source;
+  next_event = (next_event + 1) % N_EVENTS;
+  n_events = MIN (n_events + 1, N_EVENTS);
+  g_mutex_unlock (&events_lock);
+}
+
+static gpointer
+gst_wasapi_etw_consumer_func (gpointer user_data)
+{
+  /* Returns once the session is stopped */
+  ProcessTrace (&trace, 1, NULL, NULL);
+
+  return NULL;
+}
+
+/* Called with the session lock */
+static gboolean
+gst_wasapi_etw_start (GstElement * element)
+{
+  GstWasapiEtwProperties props;
+  EVENT_TRACE_LOGFILEW logfile;
+  LARGE_INTEGER freq;
+  gunichar2 *name;
+  gchar *str;
+  ULONG status;
+
+  str = g_strdup_printf ("GStreamer-WASAPI-Audio-%lu", GetCurrentProcessId ());
+  name = g_utf8_to_utf16 (str, -1, NULL, NULL, NULL);
+  g_free (str);
+
+  gst_wasapi_etw_init_properties (&props);
+  status = StartTraceW (&session, name, &props.props);
+  if (status == ERROR_ALREADY_EXISTS) {
+    /* Left behind by a process that had our id and crashed */
+    gst_wasapi_etw_init_properties (&props);
+    ControlTraceW (0, name, &props.props, EVENT_TRACE_CONTROL_STOP);
+    gst_wasapi_etw_init_properties (&props);
+    status = StartTraceW (&session, name, &props.props);
+  }
+  if (status != ERROR_SUCCESS) {
+    GST_WARNING_OBJECT (element, "can't start an ETW session (%lu), that "
+        "needs an administrator or a member of Performance Log Users",
+        status);
+    goto failed;
+  }
+
+  status = EnableTraceEx2 (session, &gst_wasapi_etw_audio_provider,
+      EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_VERBOSE, 0, 0, 0, NULL);
+  if (status != ERROR_SUCCESS) {
+    GST_WARNING_OBJECT (element, "can't enable Microsoft-Windows-Audio (%lu)",
+        status);
+    goto stop;
+  }
+
+  memset (&logfile, 0, sizeof (logfile));
+  logfile.LoggerName = (LPWSTR) name;
+  logfile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME |
+      PROCESS_TRACE_MODE_EVENT_RECORD | PROCESS_TRACE_MODE_RAW_TIMESTAMP;
+  logfile.EventRecordCallback = gst_wasapi_etw_event_record;
+  trace = OpenTraceW (&logfile);
+  if (trace == INVALID_PROCESSTRACE_HANDLE) {
+    GST_WARNING_OBJECT (element, "can't consume the ETW session (%lu)",
+        GetLastError ());
+    goto stop;
+  }
+
+  QueryPerformanceFrequency (&freq);
+  qpc_freq = freq.QuadPart;
+  event_sources = g_hash_table_new (NULL, NULL);
+  g_mutex_lock (&events_lock);
+  n_events = next_event = 0;
+  g_mutex_unlock (&events_lock);
+  consumer = g_thread_new ("wasapi-etw", gst_wasapi_etw_consumer_func, NULL);
+  g_free (name);
+
+  GST_INFO_OBJECT (element, "consuming Microsoft-Windows-Audio events");
+
+  return TRUE;
+
+stop:
+  gst_wasapi_etw_init_properties (&props);
+  ControlTraceW (session, NULL, &props.props, EVENT_TRACE_CONTROL_STOP);
+failed:
+  session = 0;
+  g_free (name);
+  return FALSE;
+}
+
+/* Called with the session lock */
+static void
+gst_wasapi_etw_stop (void)
+{
+  GstWasapiEtwProperties props;
+
+  gst_wasapi_etw_init_properties (&props);
+  ControlTraceW (session, NULL, &props.props, EVENT_TRACE_CONTROL_STOP);
+  g_thread_join (consumer);
+  CloseTrace (trace);
+  consumer = NULL;
+  session = 0;
+  g_clear_pointer (&event_sources, g_hash_table_unref);
+}
+
+GstWasapiEtwTracker *
+gst_wasapi_etw_tracker_new (GstElement * element)
+{
+  GstWasapiEtwTracker *tracker;
+
+  g_mutex_lock (&session_lock);
+  if (session_users == 0 && !gst_wasapi_etw_start (element)) {
+    g_mutex_unlock (&session_lock);
+    return NULL;
+  }
+  session_users++;
+  g_mutex_unlock (&session_lock);
+
+  tracker = g_slice_new0 (GstWasapiEtwTracker);
+  g_mutex_init (&tracker->lock);
+
+  return tracker;
+}
+
+void
+gst_wasapi_etw_tracker_free (GstWasapiEtwTracker * tracker)
+{
+  g_mutex_lock (&session_lock);
+  if (--session_users == 0)
+    gst_wasapi_etw_stop ();
+  g_mutex_unlock (&session_lock);
+
+  g_mutex_clear (&tracker->lock);
+  g_slice_free (GstWasapiEtwTracker, tracker);
+}
+
+void
+gst_wasapi_etw_tracker_glitch (GstWasapiEtwTracker * tracker, guint64 qpcpos,
+    guint64 window, gboolean client_late)
+{
+  GstWasapiEtwGlitch *glitch;
+
+  g_mutex_lock (&tracker->lock);
+  if (tracker->n_pending == N_PENDING) {
+    /* Faster than ETW can tell us about them */
+    tracker->counts[GST_WASAPI_GLITCH_SOURCE_UNKNOWN]++;
+  } else {
+    glitch = &tracker->pending[tracker->n_pending++];
+    glitch->qpcpos = qpcpos;
+    glitch->window = window;
+    glitch->client_late = client_late;
+  }
+  g_mutex_unlock (&tracker->lock);
+}
+
+/* The source of the engine glitch closest to @qpcpos within @window */
+static GstWasapiGlitchSource
+gst_wasapi_etw_find (guint64 qpcpos, guint64 window)
+{
+  GstWasapiGlitchSource source = GST_WASAPI_GLITCH_SOURCE_UNKNOWN;
+  guint64 best = G_MAXUINT64;
+  guint i;
+
+  g_mutex_lock (&events_lock);
+  for (i = 0; i < n_events; i++) {
+    guint64 distance = events[i].qpcpos > qpcpos ?
+        events[i].qpcpos - qpcpos : qpcpos - events[i].qpcpos;
+
+    if (distance <= window && distance < best) {
+      best = distance;
+      source = events[i].source;
+    }
+  }
+  g_mutex_unlock (&events_lock);
+
+  return source;
+}
+
+void
+gst_wasapi_etw_tracker_to_structure (GstWasapiEtwTracker * tracker,
+    GstStructure * s)
+{
+  guint64 now = gst_wasapi_util_get_qpc_position ();
+  guint i, n = 0;
+
+  g_mutex_lock (&tracker->lock);
+  for (i = 0; i < tracker->n_pending; i++) {
+    GstWasapiEtwGlitch *glitch = &tracker->pending[i];
+
+    if (glitch->client_late) {
+      tracker->counts[GST_WASAPI_GLITCH_SOURCE_CLIENT]++;
+    } else if (glitch->qpcpos + SETTLE_TIME <= now) {
+      tracker->counts[gst_wasapi_etw_find (glitch->qpcpos,
+              glitch->window)]++;
+    } else {
+      /* Still pending, in order */
+      tracker->pending[n++] = *glitch;
+    }
+  }
+  tracker->n_pending = n;
+
+  gst_structure_set (s,
+      "glitches-client", G_TYPE_UINT,
+      tracker->counts[GST_WASAPI_GLITCH_SOURCE_CLIENT],
+      "glitches-engine", G_TYPE_UINT,
+      tracker->counts[GST_WASAPI_GLITCH_SOURCE_ENGINE],
+      "glitches-driver", G_TYPE_UINT,
+      tracker->counts[GST_WASAPI_GLITCH_SOURCE_DRIVER],
+      "glitches-unknown", G_TYPE_UINT,
+      tracker->counts[GST_WASAPI_GLITCH_SOURCE_UNKNOWN],
+      "glitches-pending", G_TYPE_UINT, n, NULL);
+  g_mutex_unlock (&tracker->lock);
+}
@@ -0,0 +1,69 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_ETW_H__
+#define __GST_WASAPI_ETW_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Who a glitch of the device is blamed on */
+typedef enum
+{
+  /* Nothing explains it, or ETW had no time to report yet */
+  GST_WASAPI_GLITCH_SOURCE_UNKNOWN,
+  /* Our thread slept longer than the device buffer lasts */
+  GST_WASAPI_GLITCH_SOURCE_CLIENT,
+  /* The audio engine reported a glitch around it */
+  GST_WASAPI_GLITCH_SOURCE_ENGINE,
+  /* The audio engine reported a glitch of the driver around it */
+  GST_WASAPI_GLITCH_SOURCE_DRIVER,
+  GST_WASAPI_N_GLITCH_SOURCES
+} GstWasapiGlitchSource;
+
+/* Attributes the device glitches of an element with the glitch events of
+ * the Microsoft-Windows-Audio ETW provider, for etw-attribution=true.
+ *
+ * The provider is consumed by one real-time session per process, started
+ * with the first tracker and stopped with the last. That needs an
+ * administrator or a member of Performance Log Users. ETW hands events over
+ * about a second late, so a glitch is only attributed a few seconds after
+ * it happened, until then it is pending. The audio engine events are told apart by their
+ * names in the manifest, those that mention a glitch and the driver or
+ * device are blamed on the driver, other glitches on the engine. */
+typedef struct _GstWasapiEtwTracker GstWasapiEtwTracker;
+
+/* NULL if the session can't be started */
+GstWasapiEtwTracker *gst_wasapi_etw_tracker_new (GstElement * element);
+
+void gst_wasapi_etw_tracker_free (GstWasapiEtwTracker * tracker);
+
+/* The device glitched at @qpcpos, in 100 ns. Matched with the audio engine
+ * within @window around it, unless @client_late. */
+void gst_wasapi_etw_tracker_glitch (GstWasapiEtwTracker * tracker,
+    guint64 qpcpos, guint64 window, gboolean client_late);
+
+/* Attributes the pending glitches ETW had time to report, then sets
+ * glitches-client, -engine, -driver and -unknown in @s to the counts since
+ * the tracker was created, and glitches-pending to those still waiting */
+void gst_wasapi_etw_tracker_to_structure (GstWasapiEtwTracker * tracker,
+    GstStructure * s);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_ETW_H__ */
@@ -0,0 +1,1187 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapifake.h"
+#include "gstwasapipacketlog.h"
+
+#include <math.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Capture packets an endpoint buffer holds at most */
+#define MAX_PACKETS 64
+
+/* Captured tone, 1 kHz at -20 dBFS */
+#define TONE_FREQ 1000
+#define TONE_AMPLITUDE 0.1
+
+#define FAKE_FROM(ptr,member) \
+  ((GstWasapiFakeClient *) ((guint8 *) (ptr) - \
+      G_STRUCT_OFFSET (GstWasapiFakeClient, member)))
+
+static const WCHAR fake_capture_id[] = L"{gst-wasapi-fake}.capture";
+static const WCHAR fake_render_id[] = L"{gst-wasapi-fake}.render";
+
+static struct
+{
+  gint rate;
+  gint channels;
+  gint period_us;
+  gint buffer_periods;
+  gint jitter_us;
+  gdouble burst_probability;
+  gdouble discont_probability;
+  gint invalidate_after_ms;
+
+  /* A packet log to replay, with its qpcpos made monotonic. One pass
+   * takes @replay_loop_qpc and @replay_loop_frames. */
+  GstWasapiPacketRecord *replay;
+  guint n_replay;
+  guint replay_max_frames;
+  guint64 replay_loop_qpc;
+  guint64 replay_loop_frames;
+} script = {
+48000, 2, 10000, 2, 0, 0.0, 0.0, 0};
+
+typedef struct
+{
+  UINT64 devpos;
+  UINT64 qpcpos;
+  UINT32 frames;
+  DWORD flags;
+} GstWasapiFakePacket;
+
+typedef struct
+{
+  IAudioClient client;
+  IAudioCaptureClient capture_client;
+  IAudioRenderClient render_client;
+  IAudioClock clock;
+  gint refcount;
+  gint data_flow;
+
+  /* Protects everything below, the engine thread holds it for a tick */
+  GMutex lock;
+  gboolean initialized;
+  gboolean started;
+  gboolean capture;
+  HANDLE event;
+  guint rate;
+  guint bpf;
+  guint period_frames;
+  guint buffer_frames;
+  /* One period of the tone for capture, the endpoint buffer for render */
+  guint8 *data;
+  /* Between GetBuffer() and ReleaseBuffer() */
+  gboolean in_use;
+  UINT32 requested;
+
+  /* Engine thread, stopped with @quit */
+  GThread *thread;
+  HANDLE quit;
+  HANDLE timer;
+  GRand *rand;
+
+  /* Capture: what the engine produced and nobody read yet */
+  GstWasapiFakePacket packets[MAX_PACKETS];
+  guint max_packets;
+  guint first_packet;
+  guint n_packets;
+  guint queued_frames;
+  gboolean discont;
+  gboolean held;
+  /* Render: frames written, and those the engine played */
+  guint64 written;
+  guint64 played;
+  /* Device position in frames */
+  guint64 position;
+
+  gint64 invalidate_at;
+  gboolean invalidated;
+
+  /* Capture from script.replay, the next packet and where the engine
+   * thread started in it, in monotonic time, QPC and replay offset */
+  gboolean replaying;
+  guint64 replay_index;
+  gint64 replay_base_time;
+  guint64 replay_base_qpc;
+  guint64 replay_base_offset;
+} GstWasapiFakeClient;
+
+typedef struct
+{
+  IMMDevice device;
+  gint refcount;
+  gint data_flow;
+} GstWasapiFakeDevice;
+
+static void
+gst_wasapi_fake_load_replay (const gchar * path)
+{
+  GstWasapiPacketLogHeader header;
+  GstWasapiPacketRecord *records, *last;
+  guint i, n;
+
+  if (path == NULL ||
+      (records = gst_wasapi_packet_log_load (path, &header, &n)) == NULL)
+    return;
+
+  /* Packets flagged with a timestamp error may carry anything */
+  for (i = 1; i < n; i++)
+    records[i].qpcpos = MAX (records[i].qpcpos, records[i - 1].qpcpos);
+  for (i = 0; i < n; i++)
+    script.replay_max_frames = MAX (script.replay_max_frames,
+        records[i].frames);
+
+  last = &records[n - 1];
+  script.replay = records;
+  script.n_replay = n;
+  script.rate = header.rate;
+  script.channels = header.channels;
+  script.replay_loop_frames = last->devpos + last->frames - records[0].devpos;
+  script.replay_loop_qpc = last->qpcpos - records[0].qpcpos +
+      gst_util_uint64_scale_int (last->frames, 10000000, header.rate);
+
+  GST_INFO ("replaying %u packets of %s, %" G_GUINT64_FORMAT " frames per "
+      "pass", n, path, script.replay_loop_frames);
+}
+
+/* Of replayed packet @index from the first, in 100 ns and frames, going
+ * on with the next pass at the end */
+static guint64
+gst_wasapi_fake_replay_qpc (guint64 index)
+{
+  const GstWasapiPacketRecord *r = &script.replay[index % script.n_replay];
+
+  return index / script.n_replay * script.replay_loop_qpc + r->qpcpos -
+      script.replay[0].qpcpos;
+}
+
+static guint64
+gst_wasapi_fake_replay_devpos (guint64 index)
+{
+  const GstWasapiPacketRecord *r = &script.replay[index % script.n_replay];
+
+  return index / script.n_replay * script.replay_loop_frames + r->devpos -
+      script.replay[0].devpos;
+}
+
+static gpointer
+gst_wasapi_fake_parse_script (gpointer user_data)
+{
+  const gchar *env = g_getenv ("GST_WASAPI_FAKE");
+  GstStructure *s;
+  gchar *str;
+
+  if (env == NULL)
+    return GINT_TO_POINTER (FALSE);
+
+  /* Like GST_WASAPI_FAKE=1, the defaults */
+  if (strchr (env, '=') == NULL)
+    goto done;
+
+  str = g_strdup_printf ("fake, %s", env);
+  s = gst_structure_from_string (str, NULL);
+  g_free (str);
+  if (s == NULL) {
+    GST_WARNING ("can't parse GST_WASAPI_FAKE \"%s\", using the defaults",
+        env);
+    goto done;
+  }
+
+  gst_structure_get_int (s, "rate", &script.rate);
+  gst_structure_get_int (s, "channels", &script.channels);
+  gst_structure_get_int (s, "period-us", &script.period_us);
+  gst_structure_get_int (s, "buffer-periods", &script.buffer_periods);
+  gst_structure_get_int (s, "jitter-us", &script.jitter_us);
+  gst_structure_get_double (s, "burst-probability",
+      &script.burst_probability);
+  gst_structure_get_double (s, "discont-probability",
+      &script.discont_probability);
+  gst_structure_get_int (s, "invalidate-after-ms",
+      &script.invalidate_after_ms);
+  if (gst_structure_has_field (s, "replay"))
+    gst_wasapi_fake_load_replay (gst_structure_get_string (s, "replay"));
+  gst_structure_free (s);
+
+  script.rate = CLAMP (script.rate, 8000, 384000);
+  script.channels = CLAMP (script.channels, 1, 8);
+  script.period_us = MAX (script.period_us, 1000);
+  script.buffer_periods = CLAMP (script.buffer_periods, 1, MAX_PACKETS);
+  script.jitter_us = MAX (script.jitter_us, 0);
+
+done:
+  GST_INFO ("fake endpoints: %d Hz, %d channels, period %d us, %d periods, "
+      "jitter %d us, bursts %.3f, disconts %.3f, invalidated after %d ms",
+      script.rate, script.channels, script.period_us, script.buffer_periods,
+      script.jitter_us, script.burst_probability, script.discont_probability,
+      script.invalidate_after_ms);
+
+  return GINT_TO_POINTER (TRUE);
+}
+
+gboolean
+gst_wasapi_fake_enabled (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, gst_wasapi_fake_parse_script, NULL);
+
+  return GPOINTER_TO_INT (once.retval);
+}
+
+static WAVEFORMATEX *
+gst_wasapi_fake_get_mix_format (void)
+{
+  WAVEFORMATEXTENSIBLE *format;
+
+  format = CoTaskMemAlloc (sizeof (WAVEFORMATEXTENSIBLE));
+  memset (format, 0, sizeof (WAVEFORMATEXTENSIBLE));
+
+  format->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format->Format.nChannels = script.channels;
+  format->Format.nSamplesPerSec = script.rate;
+  format->Format.wBitsPerSample = 32;
+  format->Format.nBlockAlign = script.channels * 4;
+  format->Format.nAvgBytesPerSec = script.rate * script.channels * 4;
+  format->Format.cbSize =
+      sizeof (WAVEFORMATEXTENSIBLE) - sizeof (WAVEFORMATEX);
+  format->Samples.wValidBitsPerSample = 32;
+  if (script.channels == 1)
+    format->dwChannelMask = SPEAKER_FRONT_CENTER;
+  else
+    format->dwChannelMask = (1 << script.channels) - 1;
+  format->SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+
+  return (WAVEFORMATEX *) format;
+}
+
+static gboolean
+gst_wasapi_fake_format_is_float (const WAVEFORMATEX * format)
+{
+  if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    return TRUE;
+  if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    return IsEqualGUID (&((WAVEFORMATEXTENSIBLE *) format)->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+
+  return FALSE;
+}
+
+/* One period of the tone, in @format, or silence for formats other than
+ * 32 bit float and 16 bit integer */
+static void
+gst_wasapi_fake_fill_tone (guint8 * data, const WAVEFORMATEX * format,
+    guint n_frames)
+{
+  guint i, c, channels = format->nChannels;
+  gboolean is_float = gst_wasapi_fake_format_is_float (format);
+
+  memset (data, 0, n_frames * format->nBlockAlign);
+
+  for (i = 0; i < n_frames; i++) {
+    gdouble v = TONE_AMPLITUDE * sin (2 * G_PI * TONE_FREQ * i /
+        format->nSamplesPerSec);
+
+    for (c = 0; c < channels; c++) {
+      if (is_float && format->wBitsPerSample == 32)
+        ((gfloat *) data)[i * channels + c] = (gfloat) v;
+      else if (!is_float && format->wBitsPerSample == 16)
+        ((gint16 *) data)[i * channels + c] = (gint16) (v * G_MAXINT16);
+    }
+  }
+}
+
+/* Called with the lock, the oldest capture packet is gone */
+static void
+gst_wasapi_fake_client_drop_packet (GstWasapiFakeClient * self)
+{
+  self->queued_frames -= self->packets[self->first_packet].frames;
+  self->first_packet = (self->first_packet + 1) % MAX_PACKETS;
+  self->n_packets--;
+}
+
+/* Called with the lock, whether to signal the event */
+static gboolean
+gst_wasapi_fake_client_tick (GstWasapiFakeClient * self)
+{
+  GstWasapiFakePacket *packet;
+  DWORD flags = 0;
+
+  if (self->invalidate_at != 0 &&
+      g_get_monotonic_time () >= self->invalidate_at) {
+    if (!self->invalidated)
+      GST_INFO ("invalidating fake client %p", self);
+    self->invalidated = TRUE;
+    /* So it notices */
+    return TRUE;
+  }
+
+  if (!self->capture) {
+    /* Underruns just play less */
+    self->played += MIN (self->written - self->played, self->period_frames);
+    self->position = self->played;
+    return TRUE;
+  }
+
+  if (self->replaying) {
+    const GstWasapiPacketRecord *r =
+        &script.replay[self->replay_index % script.n_replay];
+
+    /* Overruns were recorded as what they did to the packets */
+    if (self->n_packets == self->max_packets)
+      gst_wasapi_fake_client_drop_packet (self);
+
+    packet = &self->packets[(self->first_packet + self->n_packets) %
+        MAX_PACKETS];
+    packet->devpos = gst_wasapi_fake_replay_devpos (self->replay_index);
+    packet->qpcpos = self->replay_base_qpc +
+        gst_wasapi_fake_replay_qpc (self->replay_index) -
+        self->replay_base_offset;
+    packet->frames = r->frames;
+    packet->flags = r->flags;
+    self->n_packets++;
+    self->queued_frames += r->frames;
+    self->replay_index++;
+    return TRUE;
+  }
+
+  if (self->discont)
+    flags |= AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY;
+
+  /* Lost, the next packet will tell */
+  if (g_rand_double (self->rand) < script.discont_probability) {
+    self->position += self->period_frames;
+    self->discont = TRUE;
+    return FALSE;
+  }
+
+  /* Overrun, the oldest packet goes unless it is being read */
+  if (self->n_packets == self->max_packets) {
+    if (self->in_use) {
+      self->position += self->period_frames;
+      self->discont = TRUE;
+      return TRUE;
+    }
+    gst_wasapi_fake_client_drop_packet (self);
+    flags |= AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY;
+  }
+
+  packet = &self->packets[(self->first_packet + self->n_packets) %
+      MAX_PACKETS];
+  packet->devpos = self->position;
+  packet->qpcpos = gst_wasapi_util_get_qpc_position ();
+  packet->frames = self->period_frames;
+  packet->flags = flags;
+  self->n_packets++;
+  self->queued_frames += self->period_frames;
+  self->position += self->period_frames;
+  self->discont = FALSE;
+
+  /* A burst, this one comes with the next */
+  if (self->held) {
+    self->held = FALSE;
+    return TRUE;
+  }
+  if (g_rand_double (self->rand) < script.burst_probability) {
+    self->held = TRUE;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Plays the audio engine, one tick per device period */
+static gpointer
+gst_wasapi_fake_client_thread_func (gpointer user_data)
+{
+  GstWasapiFakeClient *self = user_data;
+  HANDLE handles[2] = { self->quit, self->timer };
+  gint64 next = g_get_monotonic_time ();
+  gboolean signal;
+
+  if (self->replaying) {
+    g_mutex_lock (&self->lock);
+    self->replay_base_time = next;
+    self->replay_base_qpc = gst_wasapi_util_get_qpc_position ();
+    self->replay_base_offset = gst_wasapi_fake_replay_qpc (self->replay_index);
+    g_mutex_unlock (&self->lock);
+  }
+
+  for (;;) {
+    LARGE_INTEGER due;
+    gint64 at;
+
+    if (self->replaying) {
+      /* When the packet was captured, relative to where we started */
+      at = self->replay_base_time +
+          (gint64) (gst_wasapi_fake_replay_qpc (self->replay_index) -
+          self->replay_base_offset) / 10;
+    } else {
+      /* Late events don't shift the next ones */
+      next += script.period_us;
+      at = next;
+      if (script.jitter_us > 0)
+        at += g_rand_int_range (self->rand, 0, script.jitter_us + 1);
+    }
+
+    /* Relative, in 100 ns */
+    due.QuadPart = -MAX (at - g_get_monotonic_time (), 1) * 10;
+    SetWaitableTimer (self->timer, &due, 0, NULL, NULL, FALSE);
+    if (WaitForMultipleObjects (2, handles, FALSE, INFINITE) !=
+        WAIT_OBJECT_0 + 1)
+      break;
+
+    g_mutex_lock (&self->lock);
+    signal = gst_wasapi_fake_client_tick (self) && self->event != NULL;
+    g_mutex_unlock (&self->lock);
+
+    if (signal)
+      SetEvent (self->event);
+  }
+
+  return NULL;
+}
+
+static void
+gst_wasapi_fake_client_stop (GstWasapiFakeClient * self)
+{
+  GThread *thread;
+
+  g_mutex_lock (&self->lock);
+  thread = self->thread;
+  self->thread = NULL;
+  self->started = FALSE;
+  g_mutex_unlock (&self->lock);
+
+  if (thread != NULL) {
+    SetEvent (self->quit);
+    g_thread_join (thread);
+  }
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_QueryInterface (IAudioClient * This, REFIID riid,
+    void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IAudioClient, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_client_AddRef (IAudioClient * This)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+
+  return g_atomic_int_add (&self->refcount, 1) + 1;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_client_Release (IAudioClient * This)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+  gint refcount = g_atomic_int_add (&self->refcount, -1) - 1;
+
+  if (refcount > 0)
+    return refcount;
+
+  gst_wasapi_fake_client_stop (self);
+  CloseHandle (self->quit);
+  CloseHandle (self->timer);
+  g_rand_free (self->rand);
+  g_free (self->data);
+  g_mutex_clear (&self->lock);
+  g_slice_free (GstWasapiFakeClient, self);
+
+  return 0;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_Initialize (IAudioClient * This,
+    AUDCLNT_SHAREMODE ShareMode, DWORD StreamFlags,
+    REFERENCE_TIME hnsBufferDuration, REFERENCE_TIME hnsPeriodicity,
+    const WAVEFORMATEX * pFormat, LPCGUID AudioSessionGuid)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+  gboolean loopback = (StreamFlags & AUDCLNT_STREAMFLAGS_LOOPBACK) != 0;
+  guint64 frames;
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (self->initialized) {
+    hr = AUDCLNT_E_ALREADY_INITIALIZED;
+    goto beach;
+  }
+  if (ShareMode != AUDCLNT_SHAREMODE_SHARED) {
+    hr = AUDCLNT_E_EXCLUSIVE_MODE_NOT_ALLOWED;
+    goto beach;
+  }
+  if (loopback && self->data_flow != eRender) {
+    hr = AUDCLNT_E_WRONG_ENDPOINT_TYPE;
+    goto beach;
+  }
+  if ((pFormat->nSamplesPerSec != script.rate ||
+          pFormat->nChannels != script.channels) &&
+      !(StreamFlags & AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM)) {
+    hr = AUDCLNT_E_UNSUPPORTED_FORMAT;
+    goto beach;
+  }
+
+  self->capture = self->data_flow == eCapture || loopback;
+  self->rate = pFormat->nSamplesPerSec;
+  self->bpf = pFormat->nBlockAlign;
+  self->period_frames = MAX (gst_util_uint64_scale_int (self->rate,
+          script.period_us, G_USEC_PER_SEC), 1);
+
+  /* Whole periods, at least as many as the script says */
+  frames = gst_util_uint64_scale_int (hnsBufferDuration, self->rate,
+      10000000);
+  frames = MAX (frames, (guint64) self->period_frames * script.buffer_periods);
+  frames = MIN (frames, (guint64) self->period_frames * MAX_PACKETS);
+  self->max_packets = (frames + self->period_frames - 1) / self->period_frames;
+  self->buffer_frames = self->max_packets * self->period_frames;
+
+  self->replaying = self->capture && script.replay != NULL;
+  if (self->capture) {
+    guint data_frames = self->period_frames;
+
+    /* Every replayed packet fits */
+    if (self->replaying)
+      data_frames = MAX (data_frames, script.replay_max_frames);
+    self->data = g_malloc (data_frames * self->bpf);
+    gst_wasapi_fake_fill_tone (self->data, pFormat, data_frames);
+  } else {
+    self->data = g_malloc0 (self->buffer_frames * self->bpf);
+  }
+  self->initialized = TRUE;
+
+  GST_DEBUG ("fake %s client %p: %u Hz, bpf %u, period %u frames, buffer "
+      "%u frames", self->capture ? "capture" : "render", self, self->rate,
+      self->bpf, self->period_frames, self->buffer_frames);
+
+beach:
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_GetBufferSize (IAudioClient * This,
+    UINT32 * pNumBufferFrames)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+
+  if (!self->initialized)
+    return AUDCLNT_E_NOT_INITIALIZED;
+
+  *pNumBufferFrames = self->buffer_frames;
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_GetStreamLatency (IAudioClient * This,
+    REFERENCE_TIME * phnsLatency)
+{
+  *phnsLatency = (REFERENCE_TIME) script.period_us * 10;
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_GetCurrentPadding (IAudioClient * This,
+    UINT32 * pNumPaddingFrames)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (!self->initialized)
+    hr = AUDCLNT_E_NOT_INITIALIZED;
+  else if (self->invalidated)
+    hr = AUDCLNT_E_DEVICE_INVALIDATED;
+  else if (self->capture)
+    *pNumPaddingFrames = self->queued_frames;
+  else
+    *pNumPaddingFrames = (UINT32) (self->written - self->played);
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_IsFormatSupported (IAudioClient * This,
+    AUDCLNT_SHAREMODE ShareMode, const WAVEFORMATEX * pFormat,
+    WAVEFORMATEX ** ppClosestMatch)
+{
+  if (ppClosestMatch != NULL)
+    *ppClosestMatch = NULL;
+
+  if (ShareMode != AUDCLNT_SHAREMODE_SHARED)
+    return AUDCLNT_E_UNSUPPORTED_FORMAT;
+
+  if (pFormat->nSamplesPerSec == script.rate &&
+      pFormat->nChannels == script.channels)
+    return S_OK;
+
+  if (ppClosestMatch != NULL)
+    *ppClosestMatch = gst_wasapi_fake_get_mix_format ();
+  return S_FALSE;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_GetMixFormat (IAudioClient * This,
+    WAVEFORMATEX ** ppDeviceFormat)
+{
+  *ppDeviceFormat = gst_wasapi_fake_get_mix_format ();
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_GetDevicePeriod (IAudioClient * This,
+    REFERENCE_TIME * phnsDefaultDevicePeriod,
+    REFERENCE_TIME * phnsMinimumDevicePeriod)
+{
+  if (phnsDefaultDevicePeriod != NULL)
+    *phnsDefaultDevicePeriod = (REFERENCE_TIME) script.period_us * 10;
+  if (phnsMinimumDevicePeriod != NULL)
+    *phnsMinimumDevicePeriod = (REFERENCE_TIME) script.period_us * 10;
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_Start (IAudioClient * This)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (!self->initialized) {
+    hr = AUDCLNT_E_NOT_INITIALIZED;
+  } else if (self->started) {
+    hr = AUDCLNT_E_NOT_STOPPED;
+  } else if (self->invalidated) {
+    hr = AUDCLNT_E_DEVICE_INVALIDATED;
+  } else {
+    if (self->invalidate_at == 0 && script.invalidate_after_ms > 0)
+      self->invalidate_at = g_get_monotonic_time () +
+          (gint64) script.invalidate_after_ms * 1000;
+    self->started = TRUE;
+    self->thread = g_thread_new ("wasapi-fake",
+        gst_wasapi_fake_client_thread_func, self);
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_Stop (IAudioClient * This)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+
+  if (!self->initialized)
+    return AUDCLNT_E_NOT_INITIALIZED;
+  if (!self->started)
+    return S_FALSE;
+
+  gst_wasapi_fake_client_stop (self);
+
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_Reset (IAudioClient * This)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (!self->initialized) {
+    hr = AUDCLNT_E_NOT_INITIALIZED;
+  } else if (self->started) {
+    hr = AUDCLNT_E_NOT_STOPPED;
+  } else if (self->in_use) {
+    hr = AUDCLNT_E_BUFFER_OPERATION_PENDING;
+  } else {
+    self->first_packet = self->n_packets = 0;
+    self->queued_frames = 0;
+    self->replay_index = 0;
+    self->discont = self->held = FALSE;
+    self->written = self->played = 0;
+    self->position = 0;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_SetEventHandle (IAudioClient * This,
+    HANDLE eventHandle)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+
+  g_mutex_lock (&self->lock);
+  self->event = eventHandle;
+  g_mutex_unlock (&self->lock);
+
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_client_GetService (IAudioClient * This, REFIID riid,
+    void **ppv)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, client);
+
+  *ppv = NULL;
+  if (!self->initialized)
+    return AUDCLNT_E_NOT_INITIALIZED;
+
+  if (IsEqualGUID (&IID_IAudioCaptureClient, riid) && self->capture)
+    *ppv = &self->capture_client;
+  else if (IsEqualGUID (&IID_IAudioRenderClient, riid) && !self->capture)
+    *ppv = &self->render_client;
+  else if (IsEqualGUID (&IID_IAudioClock, riid))
+    *ppv = &self->clock;
+  else
+    return E_NOINTERFACE;
+
+  IUnknown_AddRef (This);
+  return S_OK;
+}
+
+static CONST_VTBL IAudioClientVtbl fake_client_vtbl = {
+  .QueryInterface = gst_wasapi_fake_client_QueryInterface,
+  .AddRef = gst_wasapi_fake_client_AddRef,
+  .Release = gst_wasapi_fake_client_Release,
+  .Initialize = gst_wasapi_fake_client_Initialize,
+  .GetBufferSize = gst_wasapi_fake_client_GetBufferSize,
+  .GetStreamLatency = gst_wasapi_fake_client_GetStreamLatency,
+  .GetCurrentPadding = gst_wasapi_fake_client_GetCurrentPadding,
+  .IsFormatSupported = gst_wasapi_fake_client_IsFormatSupported,
+  .GetMixFormat = gst_wasapi_fake_client_GetMixFormat,
+  .GetDevicePeriod = gst_wasapi_fake_client_GetDevicePeriod,
+  .Start = gst_wasapi_fake_client_Start,
+  .Stop = gst_wasapi_fake_client_Stop,
+  .Reset = gst_wasapi_fake_client_Reset,
+  .SetEventHandle = gst_wasapi_fake_client_SetEventHandle,
+  .GetService = gst_wasapi_fake_client_GetService,
+};
+
+/* The services share the lifetime of the client */
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_capture_QueryInterface (IAudioCaptureClient * This,
+    REFIID riid, void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IAudioCaptureClient, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_capture_AddRef (IAudioCaptureClient * This)
+{
+  return IUnknown_AddRef (&FAKE_FROM (This, capture_client)->client);
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_capture_Release (IAudioCaptureClient * This)
+{
+  return IUnknown_Release (&FAKE_FROM (This, capture_client)->client);
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_capture_GetBuffer (IAudioCaptureClient * This,
+    BYTE ** ppData, UINT32 * pNumFramesToRead, DWORD * pdwFlags,
+    UINT64 * pu64DevicePosition, UINT64 * pu64QPCPosition)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, capture_client);
+  GstWasapiFakePacket *packet;
+  HRESULT hr = S_OK;
+
+  *ppData = NULL;
+  *pNumFramesToRead = 0;
+  *pdwFlags = 0;
+
+  g_mutex_lock (&self->lock);
+  if (self->invalidated) {
+    hr = AUDCLNT_E_DEVICE_INVALIDATED;
+  } else if (self->in_use) {
+    hr = AUDCLNT_E_OUT_OF_ORDER;
+  } else if (self->n_packets == 0) {
+    hr = AUDCLNT_S_BUFFER_EMPTY;
+  } else {
+    packet = &self->packets[self->first_packet];
+    *ppData = self->data;
+    *pNumFramesToRead = packet->frames;
+    *pdwFlags = packet->flags;
+    if (pu64DevicePosition != NULL)
+      *pu64DevicePosition = packet->devpos;
+    if (pu64QPCPosition != NULL)
+      *pu64QPCPosition = packet->qpcpos;
+    self->in_use = TRUE;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_capture_ReleaseBuffer (IAudioCaptureClient * This,
+    UINT32 NumFramesRead)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, capture_client);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (!self->in_use) {
+    hr = AUDCLNT_E_OUT_OF_ORDER;
+  } else if (NumFramesRead != 0 &&
+      NumFramesRead != self->packets[self->first_packet].frames) {
+    hr = AUDCLNT_E_INVALID_SIZE;
+  } else {
+    self->in_use = FALSE;
+    /* 0 keeps the packet for the next GetBuffer() */
+    if (NumFramesRead != 0)
+      gst_wasapi_fake_client_drop_packet (self);
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_capture_GetNextPacketSize (IAudioCaptureClient * This,
+    UINT32 * pNumFramesInNextPacket)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, capture_client);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (self->invalidated)
+    hr = AUDCLNT_E_DEVICE_INVALIDATED;
+  else
+    *pNumFramesInNextPacket = self->n_packets > 0 ?
+        self->packets[self->first_packet].frames : 0;
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static CONST_VTBL IAudioCaptureClientVtbl fake_capture_vtbl = {
+  .QueryInterface = gst_wasapi_fake_capture_QueryInterface,
+  .AddRef = gst_wasapi_fake_capture_AddRef,
+  .Release = gst_wasapi_fake_capture_Release,
+  .GetBuffer = gst_wasapi_fake_capture_GetBuffer,
+  .ReleaseBuffer = gst_wasapi_fake_capture_ReleaseBuffer,
+  .GetNextPacketSize = gst_wasapi_fake_capture_GetNextPacketSize,
+};
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_render_QueryInterface (IAudioRenderClient * This,
+    REFIID riid, void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IAudioRenderClient, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_render_AddRef (IAudioRenderClient * This)
+{
+  return IUnknown_AddRef (&FAKE_FROM (This, render_client)->client);
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_render_Release (IAudioRenderClient * This)
+{
+  return IUnknown_Release (&FAKE_FROM (This, render_client)->client);
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_render_GetBuffer (IAudioRenderClient * This,
+    UINT32 NumFramesRequested, BYTE ** ppData)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, render_client);
+  HRESULT hr = S_OK;
+
+  *ppData = NULL;
+
+  g_mutex_lock (&self->lock);
+  if (self->invalidated) {
+    hr = AUDCLNT_E_DEVICE_INVALIDATED;
+  } else if (self->in_use) {
+    hr = AUDCLNT_E_OUT_OF_ORDER;
+  } else if (NumFramesRequested > self->buffer_frames -
+      (self->written - self->played)) {
+    hr = AUDCLNT_E_BUFFER_TOO_LARGE;
+  } else {
+    *ppData = self->data;
+    self->requested = NumFramesRequested;
+    self->in_use = TRUE;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_render_ReleaseBuffer (IAudioRenderClient * This,
+    UINT32 NumFramesWritten, DWORD dwFlags)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, render_client);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (!self->in_use) {
+    hr = AUDCLNT_E_OUT_OF_ORDER;
+  } else if (NumFramesWritten > self->requested) {
+    hr = AUDCLNT_E_INVALID_SIZE;
+  } else {
+    self->written += NumFramesWritten;
+    self->in_use = FALSE;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static CONST_VTBL IAudioRenderClientVtbl fake_render_vtbl = {
+  .QueryInterface = gst_wasapi_fake_render_QueryInterface,
+  .AddRef = gst_wasapi_fake_render_AddRef,
+  .Release = gst_wasapi_fake_render_Release,
+  .GetBuffer = gst_wasapi_fake_render_GetBuffer,
+  .ReleaseBuffer = gst_wasapi_fake_render_ReleaseBuffer,
+};
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_clock_QueryInterface (IAudioClock * This, REFIID riid,
+    void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IAudioClock, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_clock_AddRef (IAudioClock * This)
+{
+  return IUnknown_AddRef (&FAKE_FROM (This, clock)->client);
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_clock_Release (IAudioClock * This)
+{
+  return IUnknown_Release (&FAKE_FROM (This, clock)->client);
+}
+
+/* Positions are in frames */
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_clock_GetFrequency (IAudioClock * This, UINT64 * pu64Frequency)
+{
+  *pu64Frequency = FAKE_FROM (This, clock)->rate;
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_clock_GetPosition (IAudioClock * This, UINT64 * pu64Position,
+    UINT64 * pu64QPCPosition)
+{
+  GstWasapiFakeClient *self = FAKE_FROM (This, clock);
+  HRESULT hr = S_OK;
+
+  g_mutex_lock (&self->lock);
+  if (self->invalidated) {
+    hr = AUDCLNT_E_DEVICE_INVALIDATED;
+  } else {
+    *pu64Position = self->position;
+    if (pu64QPCPosition != NULL)
+      *pu64QPCPosition = gst_wasapi_util_get_qpc_position ();
+  }
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_clock_GetCharacteristics (IAudioClock * This,
+    DWORD * pdwCharacteristics)
+{
+  *pdwCharacteristics = 0;
+  return S_OK;
+}
+
+static CONST_VTBL IAudioClockVtbl fake_clock_vtbl = {
+  .QueryInterface = gst_wasapi_fake_clock_QueryInterface,
+  .AddRef = gst_wasapi_fake_clock_AddRef,
+  .Release = gst_wasapi_fake_clock_Release,
+  .GetFrequency = gst_wasapi_fake_clock_GetFrequency,
+  .GetPosition = gst_wasapi_fake_clock_GetPosition,
+  .GetCharacteristics = gst_wasapi_fake_clock_GetCharacteristics,
+};
+
+static IAudioClient *
+gst_wasapi_fake_client_new (gint data_flow)
+{
+  GstWasapiFakeClient *self;
+
+  self = g_slice_new0 (GstWasapiFakeClient);
+  self->client.lpVtbl = &fake_client_vtbl;
+  self->capture_client.lpVtbl = &fake_capture_vtbl;
+  self->render_client.lpVtbl = &fake_render_vtbl;
+  self->clock.lpVtbl = &fake_clock_vtbl;
+  self->refcount = 1;
+  self->data_flow = data_flow;
+  g_mutex_init (&self->lock);
+  self->quit = CreateEvent (NULL, FALSE, FALSE, NULL);
+  /* Periods below the 15.6 ms default timer resolution need this */
+  self->timer = CreateWaitableTimerExW (NULL, NULL,
+      CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+  if (self->timer == NULL)
+    self->timer = CreateWaitableTimer (NULL, TRUE, NULL);
+  self->rand = g_rand_new ();
+
+  return &self->client;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_device_QueryInterface (IMMDevice * This, REFIID riid,
+    void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_device_AddRef (IMMDevice * This)
+{
+  GstWasapiFakeDevice *self = (GstWasapiFakeDevice *) This;
+
+  return g_atomic_int_add (&self->refcount, 1) + 1;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_fake_device_Release (IMMDevice * This)
+{
+  GstWasapiFakeDevice *self = (GstWasapiFakeDevice *) This;
+  gint refcount = g_atomic_int_add (&self->refcount, -1) - 1;
+
+  if (refcount == 0)
+    g_slice_free (GstWasapiFakeDevice, self);
+
+  return refcount;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_device_Activate (IMMDevice * This, REFIID iid,
+    DWORD dwClsCtx, PROPVARIANT * pActivationParams, void **ppInterface)
+{
+  GstWasapiFakeDevice *self = (GstWasapiFakeDevice *) This;
+
+  if (!IsEqualGUID (&IID_IAudioClient, iid)) {
+    *ppInterface = NULL;
+    return E_NOINTERFACE;
+  }
+
+  *ppInterface = gst_wasapi_fake_client_new (self->data_flow);
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_device_OpenPropertyStore (IMMDevice * This,
+    DWORD stgmAccess, IPropertyStore ** ppProperties)
+{
+  *ppProperties = NULL;
+  return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_device_GetId (IMMDevice * This, LPWSTR * ppstrId)
+{
+  GstWasapiFakeDevice *self = (GstWasapiFakeDevice *) This;
+  const WCHAR *id = self->data_flow == eCapture ? fake_capture_id :
+      fake_render_id;
+  gsize size = (wcslen (id) + 1) * sizeof (WCHAR);
+
+  *ppstrId = CoTaskMemAlloc (size);
+  memcpy (*ppstrId, id, size);
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_fake_device_GetState (IMMDevice * This, DWORD * pdwState)
+{
+  *pdwState = DEVICE_STATE_ACTIVE;
+  return S_OK;
+}
+
+static CONST_VTBL IMMDeviceVtbl fake_device_vtbl = {
+  .QueryInterface = gst_wasapi_fake_device_QueryInterface,
+  .AddRef = gst_wasapi_fake_device_AddRef,
+  .Release = gst_wasapi_fake_device_Release,
+  .Activate = gst_wasapi_fake_device_Activate,
+  .OpenPropertyStore = gst_wasapi_fake_device_OpenPropertyStore,
+  .GetId = gst_wasapi_fake_device_GetId,
+  .GetState = gst_wasapi_fake_device_GetState,
+};
+
+IMMDevice *
+gst_wasapi_fake_device_new (gint data_flow)
+{
+  GstWasapiFakeDevice *self;
+
+  self = g_slice_new0 (GstWasapiFakeDevice);
+  self->device.lpVtbl = &fake_device_vtbl;
+  self->refcount = 1;
+  self->data_flow = data_flow;
+
+  return &self->device;
+}
@@ -0,0 +1,61 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_FAKE_H__
+#define __GST_WASAPI_FAKE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Scripted stand-in for the WASAPI endpoints, to run and benchmark the
+ * elements without audio hardware.
+ *
+ * With GST_WASAPI_FAKE set, gst_wasapi_util_get_device_client() hands out
+ * a fake IMMDevice of the requested data flow, whose IAudioClient,
+ * IAudioCaptureClient, IAudioRenderClient and IAudioClock are implemented
+ * here on a thread that plays the audio engine. The variable holds the
+ * fields of a GstStructure, all optional:
+ *
+ *   rate=48000,channels=2          mix format, 32 bit float
+ *   period-us=10000                device period
+ *   buffer-periods=2               smallest endpoint buffer
+ *   jitter-us=0                    random lateness of each period event
+ *   burst-probability=0.0          a capture packet is held back and comes
+ *                                  with the next one
+ *   discont-probability=0.0        a capture packet is lost, the next one
+ *                                  is flagged discontinuous
+ *   invalidate-after-ms=0          every client returns
+ *                                  AUDCLNT_E_DEVICE_INVALIDATED this long
+ *                                  after its first Start(), 0 for never
+ *   replay=path                    capture packets come with the timing,
+ *                                  sizes, positions and flags of a
+ *                                  wasapisrc packet-log, over and over.
+ *                                  Its rate and channels override the
+ *                                  above, the other fields don't apply.
+ *
+ * Exclusive mode isn't supported. The existing stats property then gives
+ * the wakeup intervals, and the CPU per second of audio is what the process
+ * uses running the pipeline for a given time. */
+gboolean gst_wasapi_fake_enabled (void);
+
+/* A new fake endpoint for @data_flow, eRender or eCapture */
+IMMDevice *gst_wasapi_fake_device_new (gint data_flow);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_FAKE_H__ */
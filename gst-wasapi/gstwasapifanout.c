@@ -0,0 +1,676 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapifanout.h"
+#include "gstwasapiutil.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+typedef struct
+{
+  GstPad parent;
+
+  /* Under the object lock */
+  gchar *channel_select;
+} GstWasapiFanoutPad;
+
+typedef struct
+{
+  GstPadClass parent_class;
+} GstWasapiFanoutPadClass;
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_CHANNEL_SELECT
+};
+
+G_DEFINE_TYPE (GstWasapiFanoutPad, gst_wasapi_fanout_pad, GST_TYPE_PAD);
+
+typedef struct
+{
+  GstPad *pad;
+  /* Fixed caps the pad was requested with, or NULL to negotiate */
+  GstCaps *caps;
+  /* What the pad was negotiated for, nothing is pushed until it is */
+  gboolean negotiated;
+  GstAudioInfo in_info;
+  GstAudioInfo out_info;
+  /* NULL if the selected channels already are in @out_info */
+  GstAudioConverter *convert;
+  /* The channels of channel-select, all if @n_selected is 0, picked into
+   * frames of @select_info for the converter */
+  gint selected[64];
+  gint n_selected;
+  GstAudioInfo select_info;
+  guint8 *select_data;
+  gsize select_size;
+  gboolean need_stream_start;
+  gboolean need_caps;
+  gboolean need_segment;
+  gboolean warned;
+  guint64 offset;
+} GstWasapiFanoutOutput;
+
+/* Something to push on a pad once the lock is released */
+typedef struct
+{
+  GstPad *pad;
+  GstEvent *events[3];
+  guint n_events;
+  GstBuffer *buf;
+} GstWasapiFanoutItem;
+
+struct _GstWasapiFanout
+{
+  GstElement *element;
+  GstPad *srcpad;
+  gulong probe_id;
+
+  /* Protects everything below */
+  GMutex lock;
+  GList *outputs;
+  guint next_id;
+  /* The last segment of the source pad, for pads that start later */
+  GstEvent *segment;
+};
+
+static void
+gst_wasapi_fanout_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstWasapiFanoutPad *self = (GstWasapiFanoutPad *) object;
+
+  switch (prop_id) {
+    case PROP_PAD_CHANNEL_SELECT:
+      GST_OBJECT_LOCK (self);
+      g_free (self->channel_select);
+      self->channel_select = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      /* Picked up with the next buffer */
+      gst_pad_mark_reconfigure (GST_PAD (self));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_fanout_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstWasapiFanoutPad *self = (GstWasapiFanoutPad *) object;
+
+  switch (prop_id) {
+    case PROP_PAD_CHANNEL_SELECT:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->channel_select);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_fanout_pad_finalize (GObject * object)
+{
+  GstWasapiFanoutPad *self = (GstWasapiFanoutPad *) object;
+
+  g_free (self->channel_select);
+
+  G_OBJECT_CLASS (gst_wasapi_fanout_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_wasapi_fanout_pad_class_init (GstWasapiFanoutPadClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gst_wasapi_fanout_pad_set_property;
+  gobject_class->get_property = gst_wasapi_fanout_pad_get_property;
+  gobject_class->finalize = gst_wasapi_fanout_pad_finalize;
+
+  g_object_class_install_property (gobject_class,
+      PROP_PAD_CHANNEL_SELECT,
+      g_param_spec_string ("channel-select", "Channel select",
+          "Only push these channels of the source, numbered from 1 and comma "
+          "separated, e.g. \"3,4\". NULL or a list that doesn't fit the "
+          "source pushes all of them. Can be changed while playing", NULL,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_wasapi_fanout_pad_init (GstWasapiFanoutPad * self)
+{
+}
+
+static void
+gst_wasapi_fanout_output_free (GstWasapiFanoutOutput * output)
+{
+  if (output->convert != NULL)
+    gst_audio_converter_free (output->convert);
+  g_free (output->select_data);
+  if (output->caps != NULL)
+    gst_caps_unref (output->caps);
+  gst_object_unref (output->pad);
+  g_slice_free (GstWasapiFanoutOutput, output);
+}
+
+/* Called with the lock */
+static GstWasapiFanoutOutput *
+gst_wasapi_fanout_find (GstWasapiFanout * fanout, GstPad * pad)
+{
+  GList *l;
+
+  for (l = fanout->outputs; l != NULL; l = l->next) {
+    GstWasapiFanoutOutput *output = l->data;
+
+    if (output->pad == pad)
+      return output;
+  }
+
+  return NULL;
+}
+
+static void
+gst_wasapi_fanout_push_items (GArray * items)
+{
+  guint i, j;
+
+  for (i = 0; i < items->len; i++) {
+    GstWasapiFanoutItem *item = &g_array_index (items, GstWasapiFanoutItem, i);
+    GstFlowReturn ret;
+
+    for (j = 0; j < item->n_events; j++)
+      gst_pad_push_event (item->pad, item->events[j]);
+    if (item->buf != NULL) {
+      ret = gst_pad_push (item->pad, item->buf);
+      if (ret != GST_FLOW_OK && ret != GST_FLOW_NOT_LINKED &&
+          ret != GST_FLOW_FLUSHING)
+        GST_DEBUG_OBJECT (item->pad, "push failed: %s",
+            gst_flow_get_name (ret));
+    }
+    gst_object_unref (item->pad);
+  }
+}
+
+/* Serialized events of the source pad go to every pad, except for the
+ * stream start and the caps, the pads have their own */
+static GstPadProbeReturn
+gst_wasapi_fanout_event_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstWasapiFanout *fanout = user_data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GArray *items;
+  GList *l;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:
+    case GST_EVENT_FLUSH_START:
+    case GST_EVENT_FLUSH_STOP:
+    case GST_EVENT_GAP:
+    case GST_EVENT_SEGMENT:
+    case GST_EVENT_STREAM_START:
+      break;
+    default:
+      return GST_PAD_PROBE_OK;
+  }
+
+  items = g_array_new (FALSE, TRUE, sizeof (GstWasapiFanoutItem));
+  g_mutex_lock (&fanout->lock);
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+    gst_event_replace (&fanout->segment, event);
+
+  for (l = fanout->outputs; l != NULL; l = l->next) {
+    GstWasapiFanoutOutput *output = l->data;
+    GstWasapiFanoutItem item = { NULL, };
+
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_STREAM_START:
+        output->need_stream_start = TRUE;
+        continue;
+      case GST_EVENT_SEGMENT:
+        /* Comes before the next buffer of the pad, after its caps */
+        output->need_segment = TRUE;
+        continue;
+      case GST_EVENT_FLUSH_STOP:
+        if (output->negotiated && output->convert != NULL)
+          gst_audio_converter_reset (output->convert);
+        output->need_segment = TRUE;
+        break;
+      default:
+        break;
+    }
+
+    item.pad = gst_object_ref (output->pad);
+    item.events[item.n_events++] = gst_event_ref (event);
+    g_array_append_val (items, item);
+  }
+  g_mutex_unlock (&fanout->lock);
+
+  gst_wasapi_fanout_push_items (items);
+  g_array_free (items, TRUE);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Latency is that of the source, caps queries are answered from ours */
+static gboolean
+gst_wasapi_fanout_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GstWasapiFanout *fanout = gst_pad_get_element_private (pad);
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY)
+    return gst_pad_query (fanout->srcpad, query);
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+GstWasapiFanout *
+gst_wasapi_fanout_new (GstElement * element, GstPad * srcpad)
+{
+  GstWasapiFanout *fanout = g_slice_new0 (GstWasapiFanout);
+
+  fanout->element = element;
+  fanout->srcpad = srcpad;
+  g_mutex_init (&fanout->lock);
+  fanout->probe_id = gst_pad_add_probe (srcpad,
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      gst_wasapi_fanout_event_probe, fanout, NULL);
+
+  return fanout;
+}
+
+void
+gst_wasapi_fanout_free (GstWasapiFanout * fanout)
+{
+  gst_pad_remove_probe (fanout->srcpad, fanout->probe_id);
+  g_list_free_full (fanout->outputs,
+      (GDestroyNotify) gst_wasapi_fanout_output_free);
+  gst_event_replace (&fanout->segment, NULL);
+  g_mutex_clear (&fanout->lock);
+  g_slice_free (GstWasapiFanout, fanout);
+}
+
+GstPad *
+gst_wasapi_fanout_request_pad (GstWasapiFanout * fanout,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  GstWasapiFanoutOutput *output;
+  gchar *pad_name = NULL;
+  GstPad *pad;
+
+  g_mutex_lock (&fanout->lock);
+  while (name == NULL) {
+    GstPad *existing;
+
+    pad_name = g_strdup_printf ("src_%u", fanout->next_id++);
+    existing = gst_element_get_static_pad (fanout->element, pad_name);
+    if (existing == NULL) {
+      name = pad_name;
+      break;
+    }
+    gst_object_unref (existing);
+    g_free (pad_name);
+    pad_name = NULL;
+  }
+
+  pad = gst_pad_new_from_template (templ, name);
+  g_free (pad_name);
+  gst_pad_set_element_private (pad, fanout);
+  gst_pad_set_query_function (pad, gst_wasapi_fanout_query);
+  gst_pad_use_fixed_caps (pad);
+
+  output = g_slice_new0 (GstWasapiFanoutOutput);
+  output->pad = gst_object_ref (pad);
+  if (caps != NULL && gst_caps_is_fixed (caps))
+    output->caps = gst_caps_copy (caps);
+  output->need_stream_start = TRUE;
+  output->need_segment = TRUE;
+  fanout->outputs = g_list_append (fanout->outputs, output);
+  g_mutex_unlock (&fanout->lock);
+
+  if (!gst_element_add_pad (fanout->element, pad)) {
+    g_mutex_lock (&fanout->lock);
+    fanout->outputs = g_list_remove (fanout->outputs, output);
+    g_mutex_unlock (&fanout->lock);
+    gst_wasapi_fanout_output_free (output);
+    return NULL;
+  }
+
+  return pad;
+}
+
+void
+gst_wasapi_fanout_release_pad (GstWasapiFanout * fanout, GstPad * pad)
+{
+  GstWasapiFanoutOutput *output;
+
+  g_mutex_lock (&fanout->lock);
+  output = gst_wasapi_fanout_find (fanout, pad);
+  if (output != NULL)
+    fanout->outputs = g_list_remove (fanout->outputs, output);
+  g_mutex_unlock (&fanout->lock);
+
+  if (output == NULL)
+    return;
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (fanout->element, pad);
+  gst_wasapi_fanout_output_free (output);
+}
+
+/* Called with the lock. The caps the peer takes that are closest to
+ * @info, NULL if it takes nothing. */
+static GstCaps *
+gst_wasapi_fanout_fixate (GstWasapiFanoutOutput * output,
+    const GstAudioInfo * info)
+{
+  GstCaps *templ, *caps;
+  GstStructure *s;
+  gint channels;
+
+  if (output->caps != NULL)
+    return gst_caps_ref (output->caps);
+
+  templ = gst_pad_get_pad_template_caps (output->pad);
+  caps = gst_pad_peer_query_caps (output->pad, templ);
+  gst_caps_unref (templ);
+  if (gst_caps_is_empty (caps)) {
+    gst_caps_unref (caps);
+    return NULL;
+  }
+
+  caps = gst_caps_truncate (caps);
+  caps = gst_caps_make_writable (caps);
+  s = gst_caps_get_structure (caps, 0);
+  gst_structure_fixate_field_nearest_int (s, "rate",
+      GST_AUDIO_INFO_RATE (info));
+  gst_structure_fixate_field_nearest_int (s, "channels",
+      GST_AUDIO_INFO_CHANNELS (info));
+  gst_structure_fixate_field_string (s, "format",
+      GST_AUDIO_INFO_NAME (info));
+
+  /* Same channels, same positions */
+  if (gst_structure_get_int (s, "channels", &channels) &&
+      channels == GST_AUDIO_INFO_CHANNELS (info) && channels > 2 &&
+      !gst_structure_has_field (s, "channel-mask")) {
+    guint64 mask = 0;
+
+    if (GST_AUDIO_INFO_IS_UNPOSITIONED (info) ||
+        gst_audio_channel_positions_to_mask (info->position, channels,
+            FALSE, &mask))
+      gst_structure_set (s, "channel-mask", GST_TYPE_BITMASK, mask, NULL);
+  }
+
+  return gst_caps_fixate (caps);
+}
+
+/* Called with the lock. The channels of channel-select of @output in
+ * @info into @output->select_info, FALSE to take all of them. */
+static gboolean
+gst_wasapi_fanout_select (GstWasapiFanoutOutput * output,
+    const GstAudioInfo * info)
+{
+  GstWasapiFanoutPad *pad = (GstWasapiFanoutPad *) output->pad;
+  gint channels = GST_AUDIO_INFO_CHANNELS (info);
+
+  GST_OBJECT_LOCK (pad);
+  output->n_selected = gst_wasapi_util_parse_channel_select
+      (pad->channel_select, channels, output->selected);
+  if (pad->channel_select != NULL && output->n_selected == 0)
+    GST_WARNING_OBJECT (pad, "channel-select \"%s\" doesn't fit the %d "
+        "channels of the source, pushing all of them", pad->channel_select,
+        channels);
+  GST_OBJECT_UNLOCK (pad);
+
+  if (output->n_selected == 0)
+    return FALSE;
+
+  /* Mono or stereo for one or two channels, else unpositioned */
+  gst_audio_info_set_format (&output->select_info,
+      GST_AUDIO_INFO_FORMAT (info), GST_AUDIO_INFO_RATE (info),
+      output->n_selected, NULL);
+  output->select_info.layout = GST_AUDIO_INFO_LAYOUT (info);
+
+  return TRUE;
+}
+
+/* Called with the lock. (Re)creates the converter of @output for @info. */
+static gboolean
+gst_wasapi_fanout_negotiate (GstWasapiFanoutOutput * output,
+    const GstAudioInfo * info)
+{
+  const GstAudioInfo *conv_info =
+      gst_wasapi_fanout_select (output, info) ? &output->select_info : info;
+  GstCaps *caps = gst_wasapi_fanout_fixate (output, conv_info);
+  GstAudioInfo out_info;
+  GstStructure *config;
+
+  output->negotiated = FALSE;
+  if (output->convert != NULL) {
+    gst_audio_converter_free (output->convert);
+    output->convert = NULL;
+  }
+
+  if (caps == NULL || !gst_audio_info_from_caps (&out_info, caps)) {
+    if (!output->warned)
+      GST_WARNING_OBJECT (output->pad, "not negotiated, dropping buffers");
+    output->warned = TRUE;
+    if (caps != NULL)
+      gst_caps_unref (caps);
+    return FALSE;
+  }
+  gst_caps_unref (caps);
+
+  /* The selected channels are already what the pad pushes, pick them
+   * straight into its buffers */
+  if (output->n_selected > 0 && GST_AUDIO_INFO_IS_INTERLEAVED (info) &&
+      GST_AUDIO_INFO_IS_INTERLEAVED (&out_info) &&
+      GST_AUDIO_INFO_FORMAT (&out_info) == GST_AUDIO_INFO_FORMAT (info) &&
+      GST_AUDIO_INFO_RATE (&out_info) == GST_AUDIO_INFO_RATE (info) &&
+      GST_AUDIO_INFO_CHANNELS (&out_info) == output->n_selected) {
+    GST_INFO_OBJECT (output->pad, "selecting %d of %d channels",
+        output->n_selected, GST_AUDIO_INFO_CHANNELS (info));
+    goto done;
+  }
+
+  config = gst_structure_new ("GstAudioConverterConfig",
+      GST_AUDIO_CONVERTER_OPT_RESAMPLER_METHOD,
+      GST_TYPE_AUDIO_RESAMPLER_METHOD, GST_AUDIO_RESAMPLER_METHOD_KAISER,
+      NULL);
+  output->convert = gst_audio_converter_new (GST_AUDIO_CONVERTER_FLAG_NONE,
+      (GstAudioInfo *) conv_info, &out_info, config);
+  if (output->convert == NULL) {
+    if (!output->warned)
+      GST_WARNING_OBJECT (output->pad, "can't convert to %d Hz %s, %d "
+          "channels", GST_AUDIO_INFO_RATE (&out_info),
+          GST_AUDIO_INFO_NAME (&out_info), GST_AUDIO_INFO_CHANNELS (&out_info));
+    output->warned = TRUE;
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (output->pad, "converting %d Hz to %d Hz %s, %d channels",
+      GST_AUDIO_INFO_RATE (info), GST_AUDIO_INFO_RATE (&out_info),
+      GST_AUDIO_INFO_NAME (&out_info), GST_AUDIO_INFO_CHANNELS (&out_info));
+
+done:
+  output->negotiated = TRUE;
+  output->in_info = *info;
+  output->out_info = out_info;
+  output->need_caps = TRUE;
+  output->warned = FALSE;
+
+  return TRUE;
+}
+
+/* Called with the lock */
+static GstBuffer *
+gst_wasapi_fanout_convert (GstWasapiFanoutOutput * output,
+    GstAudioBuffer * in, GstBuffer * buf)
+{
+  GstAudioInfo *out_info = &output->out_info;
+  gsize in_frames = in->n_samples;
+  gsize out_frames;
+  GstBuffer *outbuf;
+  GstMapInfo map;
+  gpointer *in_planes = in->planes;
+  gpointer out[1], planes[64];
+  gint bps = GST_AUDIO_INFO_BPS (&output->in_info);
+
+  out_frames = output->convert != NULL ?
+      gst_audio_converter_get_out_frames (output->convert, in_frames) :
+      in_frames;
+  outbuf = gst_buffer_new_allocate (NULL,
+      out_frames * GST_AUDIO_INFO_BPF (out_info), NULL);
+  gst_buffer_map (outbuf, &map, GST_MAP_WRITE);
+  out[0] = map.data;
+
+  if (output->n_selected > 0 && output->convert == NULL) {
+    gst_wasapi_util_select_channels (map.data, in->planes[0], in_frames,
+        GST_AUDIO_INFO_CHANNELS (&output->in_info), bps, output->n_selected,
+        output->selected);
+    goto out;
+  }
+
+  if (output->n_selected > 0 &&
+      GST_AUDIO_INFO_IS_INTERLEAVED (&output->in_info)) {
+    gsize size = in_frames * GST_AUDIO_INFO_BPF (&output->select_info);
+
+    if (output->select_size < size) {
+      g_free (output->select_data);
+      output->select_data = g_malloc (size);
+      output->select_size = size;
+    }
+    gst_wasapi_util_select_channels (output->select_data, in->planes[0],
+        in_frames, GST_AUDIO_INFO_CHANNELS (&output->in_info), bps,
+        output->n_selected, output->selected);
+    planes[0] = output->select_data;
+    in_planes = planes;
+  } else if (output->n_selected > 0) {
+    /* Planar, the selected planes are the input */
+    for (gint ii = 0; ii < output->n_selected; ii++)
+      planes[ii] = in->planes[output->selected[ii]];
+    in_planes = planes;
+  }
+
+  if (!gst_audio_converter_samples (output->convert,
+          GST_AUDIO_CONVERTER_FLAG_NONE, in_planes, in_frames, out,
+          out_frames))
+    gst_audio_format_fill_silence (out_info->finfo, map.data, map.size);
+
+out:
+  gst_buffer_unmap (outbuf, &map);
+
+  gst_buffer_copy_into (outbuf, buf, GST_BUFFER_COPY_FLAGS, 0, 0);
+  GST_BUFFER_PTS (outbuf) = GST_BUFFER_PTS (buf);
+  GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale_int (out_frames,
+      GST_SECOND, GST_AUDIO_INFO_RATE (out_info));
+  GST_BUFFER_OFFSET (outbuf) = output->offset;
+  output->offset += out_frames;
+  GST_BUFFER_OFFSET_END (outbuf) = output->offset;
+
+  return outbuf;
+}
+
+void
+gst_wasapi_fanout_push (GstWasapiFanout * fanout, GstBuffer * buf,
+    const GstAudioInfo * info)
+{
+  GstAudioBuffer in;
+  GArray *items;
+  GList *l;
+
+  g_mutex_lock (&fanout->lock);
+  if (fanout->outputs == NULL) {
+    g_mutex_unlock (&fanout->lock);
+    return;
+  }
+
+  if (!gst_audio_buffer_map (&in, info, buf, GST_MAP_READ)) {
+    g_mutex_unlock (&fanout->lock);
+    return;
+  }
+
+  items = g_array_new (FALSE, TRUE, sizeof (GstWasapiFanoutItem));
+  for (l = fanout->outputs; l != NULL; l = l->next) {
+    GstWasapiFanoutOutput *output = l->data;
+    GstWasapiFanoutItem item = { NULL, };
+
+    if ((!output->negotiated || gst_pad_check_reconfigure (output->pad) ||
+            !gst_audio_info_is_equal (&output->in_info, info)) &&
+        !gst_wasapi_fanout_negotiate (output, info))
+      continue;
+
+    item.pad = gst_object_ref (output->pad);
+    if (output->need_stream_start) {
+      gchar *stream_id = gst_pad_create_stream_id (output->pad,
+          fanout->element, GST_PAD_NAME (output->pad));
+
+      item.events[item.n_events++] = gst_event_new_stream_start (stream_id);
+      g_free (stream_id);
+      output->need_stream_start = FALSE;
+    }
+    if (output->need_caps) {
+      item.events[item.n_events++] =
+          gst_event_new_caps (gst_audio_info_to_caps (&output->out_info));
+      output->need_caps = FALSE;
+    }
+    if (output->need_segment) {
+      if (fanout->segment != NULL) {
+        item.events[item.n_events++] = gst_event_ref (fanout->segment);
+      } else {
+        GstSegment segment;
+
+        gst_segment_init (&segment, GST_FORMAT_TIME);
+        item.events[item.n_events++] = gst_event_new_segment (&segment);
+      }
+      output->need_segment = FALSE;
+    }
+    item.buf = gst_wasapi_fanout_convert (output, &in, buf);
+    g_array_append_val (items, item);
+  }
+  gst_audio_buffer_unmap (&in);
+  g_mutex_unlock (&fanout->lock);
+
+  gst_wasapi_fanout_push_items (items);
+  g_array_free (items, TRUE);
+}
+
+gboolean
+gst_wasapi_fanout_is_linked (GstWasapiFanout * fanout)
+{
+  gboolean linked = FALSE;
+  GList *l;
+
+  g_mutex_lock (&fanout->lock);
+  for (l = fanout->outputs; l != NULL && !linked; l = l->next)
+    linked = gst_pad_is_linked (((GstWasapiFanoutOutput *) l->data)->pad);
+  g_mutex_unlock (&fanout->lock);
+
+  return linked;
+}
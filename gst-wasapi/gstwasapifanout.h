@@ -0,0 +1,66 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_FANOUT_H__
+#define __GST_WASAPI_FANOUT_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* Request src pads of wasapisrc, each with its own rate, format and
+ * channels, e.g. 16 kHz for speech recognition next to the 48 kHz stream.
+ * With channel-select a pad only takes some channels of the source, e.g.
+ * the host microphone on 1 and the music on 3,4 of a broadcast interface,
+ * each to its own branch with the same timestamps. 1 goes mono, 2 stereo,
+ * more unpositioned.
+ *
+ * Every buffer create() pushes is converted for each pad straight from
+ * its memory, with a Kaiser windowed polyphase resampler per pad, instead
+ * of a tee copying it into one audioresample each. The pads push from the
+ * streaming thread of the source, so a branch that blocks needs a queue.
+ * Serialized downstream events of the source pad go to all pads as well.
+ *
+ * The caps of a pad are those it was requested with, or negotiated with
+ * its peer, as close to the capture format as it allows. */
+typedef struct _GstWasapiFanout GstWasapiFanout;
+
+/* The pads the template of the request pads has to make */
+#define GST_TYPE_WASAPI_FANOUT_PAD (gst_wasapi_fanout_pad_get_type ())
+GType gst_wasapi_fanout_pad_get_type (void);
+
+/* For the request pads of @element, following its always src pad @srcpad */
+GstWasapiFanout *gst_wasapi_fanout_new (GstElement * element, GstPad * srcpad);
+
+void gst_wasapi_fanout_free (GstWasapiFanout * fanout);
+
+/* Adds a pad of @templ to the element, with @caps if fixed */
+GstPad *gst_wasapi_fanout_request_pad (GstWasapiFanout * fanout,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+
+void gst_wasapi_fanout_release_pad (GstWasapiFanout * fanout, GstPad * pad);
+
+/* Converts @buf of @info for every pad and pushes it there */
+void gst_wasapi_fanout_push (GstWasapiFanout * fanout, GstBuffer * buf,
+    const GstAudioInfo * info);
+
+/* Whether any of the pads is linked */
+gboolean gst_wasapi_fanout_is_linked (GstWasapiFanout * fanout);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_FANOUT_H__ */
@@ -0,0 +1,393 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapijitter.h"
+#include "gstwasapiutil.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Rates are passed to the resampler multiplied by this, like in
+ * gstwasapiresampler.c */
+#define RATE_SCALE 100
+
+/* Each arrival moves the jitter estimate 1/16 of the way, like RFC 3550 */
+#define JITTER_SMOOTHING 16
+/* Jitter estimates of margin in the target */
+#define JITTER_FACTOR 3
+
+/* The controller looks at the fill averaged over this many seconds, so
+ * the saw tooth of the arrivals doesn't steer it */
+#define FILL_SMOOTHING 0.5
+/* And consumes a difference with the target in about this many seconds */
+#define CORRECTION_TIME 2.0
+/* Never faster or slower than 1%, about a sixth of a semitone */
+#define MAX_CORRECTION 0.01
+
+/* A smaller excess is left to the rate correction, in seconds */
+#define MIN_EXCESS 0.1
+
+struct _GstWasapiJitter
+{
+  /* Protects everything below */
+  GMutex lock;
+  /* Signalled when frames were pulled or flushing was set */
+  GCond cond;
+  gint rate;
+  gint bpf;
+  gboolean flushing;
+
+  /* @fill frames are queued from @read on. With @mirrored the ring is
+   * mapped twice in a row and they are contiguous, wherever @read is. It
+   * may be larger than @capacity then, the most that is queued. */
+  guint8 *ring;
+  guint ring_frames;
+  guint capacity;
+  gboolean mirrored;
+  guint read;
+  guint fill;
+  /* Contiguous input for the resampler, when not mirrored */
+  guint8 *scratch;
+  guint scratch_frames;
+
+  /* Only silence is pulled until the fill reached the target */
+  gboolean buffering;
+  guint min_frames;
+  guint target;
+  gdouble avg_fill;
+
+  /* In microseconds, last_arrival is 0 after a reset */
+  gint64 last_arrival;
+  gint64 last_duration;
+  gdouble jitter;
+
+  /* NULL if the format can't be resampled */
+  GstAudioResampler *resampler;
+  gint in_rate;
+  gdouble correction;
+};
+
+GstWasapiJitter *
+gst_wasapi_jitter_new (const GstAudioInfo * info, guint max_frames,
+    guint min_frames)
+{
+  GstWasapiJitter *self;
+  GstStructure *options;
+  gsize size;
+
+  self = g_slice_new0 (GstWasapiJitter);
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  self->rate = GST_AUDIO_INFO_RATE (info);
+  self->bpf = GST_AUDIO_INFO_BPF (info);
+  /* The target may take half of it, the rest is for bursts */
+  self->capacity = MAX (max_frames, 2 * MAX (min_frames, 1));
+  self->ring_frames = self->capacity;
+  size = (gsize) self->ring_frames * self->bpf;
+  self->ring = gst_wasapi_util_alloc_mirrored (&size, self->bpf);
+  if (self->ring != NULL) {
+    self->mirrored = TRUE;
+    self->ring_frames = (guint) (size / self->bpf);
+  } else {
+    self->ring = g_malloc ((gsize) self->ring_frames * self->bpf);
+  }
+  self->min_frames = min_frames;
+  self->target = min_frames;
+  self->buffering = TRUE;
+  self->in_rate = self->rate * RATE_SCALE;
+
+  switch (GST_AUDIO_INFO_FORMAT (info)) {
+    case GST_AUDIO_FORMAT_S16:
+    case GST_AUDIO_FORMAT_S32:
+    case GST_AUDIO_FORMAT_F32:
+    case GST_AUDIO_FORMAT_F64:
+      options = gst_structure_new_empty ("GstAudioResampler.options");
+      gst_audio_resampler_options_set_quality
+          (GST_AUDIO_RESAMPLER_METHOD_KAISER,
+          GST_AUDIO_RESAMPLER_QUALITY_DEFAULT, self->in_rate, self->in_rate,
+          options);
+      self->resampler =
+          gst_audio_resampler_new (GST_AUDIO_RESAMPLER_METHOD_KAISER,
+          GST_AUDIO_RESAMPLER_FLAG_VARIABLE_RATE, GST_AUDIO_INFO_FORMAT (info),
+          GST_AUDIO_INFO_CHANNELS (info), self->in_rate, self->in_rate,
+          options);
+      gst_structure_free (options);
+      break;
+    default:
+      break;
+  }
+
+  if (self->resampler == NULL)
+    GST_INFO ("can't resample %s, no rate correction",
+        GST_AUDIO_INFO_NAME (info));
+
+  return self;
+}
+
+void
+gst_wasapi_jitter_free (GstWasapiJitter * self)
+{
+  if (self->resampler != NULL)
+    gst_audio_resampler_free (self->resampler);
+  g_free (self->scratch);
+  if (self->mirrored)
+    gst_wasapi_util_free_mirrored (self->ring,
+        (gsize) self->ring_frames * self->bpf);
+  else
+    g_free (self->ring);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->lock);
+  g_slice_free (GstWasapiJitter, self);
+}
+
+void
+gst_wasapi_jitter_reset (GstWasapiJitter * self)
+{
+  g_mutex_lock (&self->lock);
+  self->read = 0;
+  self->fill = 0;
+  self->avg_fill = 0;
+  self->buffering = TRUE;
+  /* The time since the last buffer is no arrival jitter */
+  self->last_arrival = 0;
+  if (self->resampler != NULL)
+    gst_audio_resampler_reset (self->resampler);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+void
+gst_wasapi_jitter_set_flushing (GstWasapiJitter * self, gboolean flushing)
+{
+  g_mutex_lock (&self->lock);
+  self->flushing = flushing;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Called with the lock. Half of a buffer is queued on average while we
+ * wait for the next one, on top of that the jitter and the minimum. */
+static void
+gst_wasapi_jitter_update_target (GstWasapiJitter * self, gint64 now,
+    guint n_frames)
+{
+  gdouble frames;
+  guint target;
+
+  if (self->last_arrival != 0) {
+    gint64 d = (now - self->last_arrival) - self->last_duration;
+
+    self->jitter += (ABS (d) - self->jitter) / JITTER_SMOOTHING;
+  }
+  self->last_arrival = now;
+  self->last_duration = gst_util_uint64_scale_int (n_frames, G_USEC_PER_SEC,
+      self->rate);
+
+  frames = (self->last_duration / 2.0 + JITTER_FACTOR * self->jitter) *
+      self->rate / G_USEC_PER_SEC;
+  target = self->min_frames + (guint) MIN (frames, (gdouble) G_MAXUINT / 2);
+  target = MIN (target, self->capacity / 2);
+
+  if (target != self->target)
+    GST_LOG ("jitter %.0f us, target %u frames", self->jitter, target);
+  self->target = target;
+}
+
+guint
+gst_wasapi_jitter_push (GstWasapiJitter * self, const guint8 * data,
+    guint n_frames)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint done = 0;
+
+  g_mutex_lock (&self->lock);
+  gst_wasapi_jitter_update_target (self, now, n_frames);
+
+  while (done < n_frames) {
+    guint pos, n, chunk;
+
+    while (self->fill == self->capacity && !self->flushing)
+      g_cond_wait (&self->cond, &self->lock);
+    if (self->flushing)
+      break;
+
+    n = MIN (n_frames - done, self->capacity - self->fill);
+    pos = (self->read + self->fill) % self->ring_frames;
+    chunk = self->mirrored ? n : MIN (n, self->ring_frames - pos);
+    memcpy (self->ring + (gsize) pos * self->bpf,
+        data + (gsize) done * self->bpf, (gsize) chunk * self->bpf);
+    memcpy (self->ring, data + (gsize) (done + chunk) * self->bpf,
+        (gsize) (n - chunk) * self->bpf);
+    self->fill += n;
+    done += n;
+  }
+  g_mutex_unlock (&self->lock);
+
+  return done;
+}
+
+/* Called with the lock. Moves @n_frames from the queue to @dst. */
+static void
+gst_wasapi_jitter_copy_out (GstWasapiJitter * self, guint8 * dst,
+    guint n_frames)
+{
+  guint chunk = self->mirrored ? n_frames :
+      MIN (n_frames, self->ring_frames - self->read);
+
+  memcpy (dst, self->ring + (gsize) self->read * self->bpf,
+      (gsize) chunk * self->bpf);
+  memcpy (dst + (gsize) chunk * self->bpf, self->ring,
+      (gsize) (n_frames - chunk) * self->bpf);
+  self->read = (self->read + n_frames) % self->ring_frames;
+  self->fill -= n_frames;
+}
+
+/* Called with the lock. A burst the rate correction would need too long
+ * for, skip to the target instead. */
+static void
+gst_wasapi_jitter_trim (GstWasapiJitter * self)
+{
+  guint excess;
+
+  if (self->fill <= self->target)
+    return;
+
+  excess = self->fill - self->target;
+  if (excess <= self->target || excess < self->rate * MIN_EXCESS)
+    return;
+
+  GST_DEBUG ("dropping %u frames of a burst", excess);
+  self->read = (self->read + excess) % self->ring_frames;
+  self->fill -= excess;
+  self->avg_fill = self->fill;
+}
+
+/* Called with the lock */
+static void
+gst_wasapi_jitter_update_ratio (GstWasapiJitter * self, guint n_frames)
+{
+  gdouble alpha = MIN ((gdouble) n_frames / (self->rate * FILL_SMOOTHING),
+      1.0);
+  gint in_rate;
+
+  self->avg_fill += (self->fill - self->avg_fill) * alpha;
+
+  if (self->resampler == NULL)
+    return;
+
+  /* Consume more input per output sample while above the target */
+  self->correction = (self->avg_fill - self->target) /
+      (self->rate * CORRECTION_TIME);
+  self->correction = CLAMP (self->correction, -MAX_CORRECTION, MAX_CORRECTION);
+
+  in_rate = (gint) (self->rate * RATE_SCALE * (1.0 + self->correction) + 0.5);
+  if (in_rate != self->in_rate) {
+    self->in_rate = in_rate;
+    gst_audio_resampler_update (self->resampler, in_rate,
+        self->rate * RATE_SCALE, NULL);
+  }
+
+  GST_LOG ("fill %.0f frames, target %u, correction %.0f ppm",
+      self->avg_fill, self->target, self->correction * 1e6);
+}
+
+/* Called with the lock. Produces up to @n_frames in @dst, fewer if not
+ * enough are queued. */
+static guint
+gst_wasapi_jitter_take (GstWasapiJitter * self, guint8 * dst,
+    guint n_frames)
+{
+  gsize in_frames, out_frames = n_frames;
+  gpointer in[1], out[1];
+
+  if (self->resampler == NULL) {
+    out_frames = MIN (n_frames, self->fill);
+    gst_wasapi_jitter_copy_out (self, dst, (guint) out_frames);
+    return (guint) out_frames;
+  }
+
+  in_frames = gst_audio_resampler_get_in_frames (self->resampler, out_frames);
+  if (in_frames > self->fill) {
+    out_frames = gst_audio_resampler_get_out_frames (self->resampler,
+        self->fill);
+    out_frames = MIN (out_frames, n_frames);
+    in_frames = gst_audio_resampler_get_in_frames (self->resampler,
+        out_frames);
+    while (out_frames > 0 && in_frames > self->fill)
+      in_frames = gst_audio_resampler_get_in_frames (self->resampler,
+          --out_frames);
+    if (in_frames > self->fill)
+      return 0;
+  }
+
+  if (self->mirrored) {
+    /* Straight from the ring */
+    in[0] = self->ring + (gsize) self->read * self->bpf;
+  } else {
+    if (in_frames > self->scratch_frames) {
+      self->scratch = g_realloc (self->scratch, in_frames * self->bpf);
+      self->scratch_frames = (guint) in_frames;
+    }
+    gst_wasapi_jitter_copy_out (self, self->scratch, (guint) in_frames);
+    in[0] = self->scratch;
+  }
+  out[0] = dst;
+  gst_audio_resampler_resample (self->resampler, in, in_frames, out,
+      out_frames);
+
+  if (self->mirrored) {
+    self->read = (self->read + (guint) in_frames) % self->ring_frames;
+    self->fill -= (guint) in_frames;
+  }
+
+  return (guint) out_frames;
+}
+
+guint
+gst_wasapi_jitter_pull (GstWasapiJitter * self, guint8 * dst,
+    guint n_frames)
+{
+  guint out_frames = 0;
+
+  g_mutex_lock (&self->lock);
+  if (self->buffering && self->fill >= self->target) {
+    GST_DEBUG ("buffered %u frames, playing", self->fill);
+    self->buffering = FALSE;
+    self->avg_fill = self->fill;
+  }
+
+  if (!self->buffering) {
+    gst_wasapi_jitter_trim (self);
+    gst_wasapi_jitter_update_ratio (self, n_frames);
+    out_frames = gst_wasapi_jitter_take (self, dst, n_frames);
+    if (out_frames < n_frames) {
+      GST_DEBUG ("ran empty %u frames short, buffering",
+          n_frames - out_frames);
+      self->buffering = TRUE;
+    }
+    g_cond_broadcast (&self->cond);
+  }
+  g_mutex_unlock (&self->lock);
+
+  return out_frames;
+}
@@ -0,0 +1,67 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_JITTER_H__
+#define __GST_WASAPI_JITTER_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* Adaptive jitter buffer of wasapisink with jitter-buffer=true.
+ *
+ * The streaming thread pushes the samples of upstream whenever they
+ * arrive, the render thread pulls a device period worth each time the
+ * endpoint wants one. The arrival jitter is tracked like RFC 3550 does,
+ * the target fill follows it, and a variable rate resampler consumes
+ * slightly faster or slower until the fill is back at the target, so
+ * bursts and a sender clock that drifts are absorbed without gaps or
+ * skips. When it runs empty the device gets silence until it filled up to
+ * the target again.
+ *
+ * Formats the resampler can't handle get no rate correction. For all of
+ * them an excess of more than the target, and at least 100 ms, is dropped
+ * at once instead. */
+typedef struct _GstWasapiJitter GstWasapiJitter;
+
+/* Holds at most @max_frames, and never aims for less than @min_frames */
+GstWasapiJitter *gst_wasapi_jitter_new (const GstAudioInfo * info,
+    guint max_frames, guint min_frames);
+
+void gst_wasapi_jitter_free (GstWasapiJitter * jitter);
+
+/* Drops what is queued and buffers up to the target again. The jitter
+ * estimate and the rate correction are kept. */
+void gst_wasapi_jitter_reset (GstWasapiJitter * jitter);
+
+/* While flushing push() doesn't wait for room */
+void gst_wasapi_jitter_set_flushing (GstWasapiJitter * jitter,
+    gboolean flushing);
+
+/* Queues the @n_frames of @data that arrived just now, waiting for room if
+ * needed. Returns how many were queued, less only when flushing. */
+guint gst_wasapi_jitter_push (GstWasapiJitter * jitter, const guint8 * data,
+    guint n_frames);
+
+/* Writes up to @n_frames to @dst, returns how many. Fewer when it ran
+ * empty or is buffering, nothing was there to play for the rest. */
+guint gst_wasapi_jitter_pull (GstWasapiJitter * jitter, guint8 * dst,
+    guint n_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_JITTER_H__ */
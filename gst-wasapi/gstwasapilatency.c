@@ -0,0 +1,248 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapilatency.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* One pulse a second, each a 1 kHz square cycle */
+#define PULSE_INTERVAL_MS 1000
+#define PULSE_MS 1
+#define PULSE_AMPLITUDE 0.9
+
+/* What counts as the pulse arriving */
+#define DETECT_THRESHOLD 0.5
+
+/* Pulses older than this when captured are lost, in 100 ns */
+#define MAX_LATENCY (900 * 10000)
+
+/* Pulses that were sent and not captured yet */
+#define MAX_PENDING 8
+
+/* Measurements the percentiles are taken from */
+#define HISTORY_SIZE 256
+
+struct _GstWasapiLatencyProbe
+{
+  gboolean is_float;
+  guint channels;
+  guint bpf;
+  guint rate;
+  guint pulse_frames;
+  guint interval_frames;
+
+  /* Sink: frames until the next pulse. Source: frames to ignore after one,
+   * its tail and echoes. */
+  guint countdown;
+
+  GstClockTime history[HISTORY_SIZE];
+  guint n_measurements;
+};
+
+/* Written by the sink, taken by the source */
+static GMutex pending_lock;
+static guint64 pending[MAX_PENDING];
+static guint n_pending;
+
+GstWasapiLatencyProbe *
+gst_wasapi_latency_probe_new (const WAVEFORMATEX * format)
+{
+  GstWasapiLatencyProbe *probe;
+  gboolean is_float;
+
+  if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    is_float = TRUE;
+  else if (format->wFormatTag == WAVE_FORMAT_PCM)
+    is_float = FALSE;
+  else if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    is_float = IsEqualGUID (&((WAVEFORMATEXTENSIBLE *) format)->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+  else
+    return NULL;
+
+  if ((is_float && format->wBitsPerSample != 32) ||
+      (!is_float && format->wBitsPerSample != 16))
+    return NULL;
+
+  probe = g_slice_new0 (GstWasapiLatencyProbe);
+  probe->is_float = is_float;
+  probe->channels = format->nChannels;
+  probe->bpf = format->nBlockAlign;
+  probe->rate = format->nSamplesPerSec;
+  probe->pulse_frames = MAX (probe->rate * PULSE_MS / 1000, 2);
+  probe->interval_frames = probe->rate * PULSE_INTERVAL_MS / 1000;
+
+  return probe;
+}
+
+void
+gst_wasapi_latency_probe_free (GstWasapiLatencyProbe * probe)
+{
+  g_slice_free (GstWasapiLatencyProbe, probe);
+}
+
+gboolean
+gst_wasapi_latency_probe_insert (GstWasapiLatencyProbe * probe,
+    guint8 * data, guint n_frames)
+{
+  guint i, c, offset = probe->countdown;
+
+  if (offset >= n_frames) {
+    probe->countdown -= n_frames;
+    return FALSE;
+  }
+
+  /* Cut short at the end of @data, the start is what counts */
+  for (i = offset; i < MIN (offset + probe->pulse_frames, n_frames); i++) {
+    gdouble v = i - offset < probe->pulse_frames / 2 ? PULSE_AMPLITUDE :
+        -PULSE_AMPLITUDE;
+    guint8 *frame = data + i * probe->bpf;
+
+    for (c = 0; c < probe->channels; c++) {
+      if (probe->is_float)
+        ((gfloat *) frame)[c] = (gfloat) v;
+      else
+        ((gint16 *) frame)[c] = (gint16) (v * G_MAXINT16);
+    }
+  }
+
+  probe->countdown = probe->interval_frames - MIN (n_frames - offset,
+      probe->interval_frames);
+
+  return TRUE;
+}
+
+void
+gst_wasapi_latency_probe_sent (GstWasapiLatencyProbe * probe, guint64 qpc)
+{
+  g_mutex_lock (&pending_lock);
+  if (n_pending == MAX_PENDING) {
+    memmove (pending, pending + 1, (MAX_PENDING - 1) * sizeof (guint64));
+    n_pending--;
+  }
+  pending[n_pending++] = qpc;
+  g_mutex_unlock (&pending_lock);
+}
+
+/* The pulse captured at @qpc was sent when? 0 if we don't know */
+static guint64
+gst_wasapi_latency_take_pending (guint64 qpc)
+{
+  guint64 sent = 0;
+  guint i;
+
+  g_mutex_lock (&pending_lock);
+  /* The oldest one that is recent enough, what is older got lost */
+  for (i = 0; i < n_pending; i++) {
+    if (pending[i] <= qpc && qpc - pending[i] <= MAX_LATENCY) {
+      sent = pending[i++];
+      break;
+    }
+    if (pending[i] > qpc)
+      break;
+  }
+  memmove (pending, pending + i, (n_pending - i) * sizeof (guint64));
+  n_pending -= i;
+  g_mutex_unlock (&pending_lock);
+
+  return sent;
+}
+
+static gint
+compare_clock_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+GstStructure *
+gst_wasapi_latency_probe_add (GstWasapiLatencyProbe * probe,
+    GstClockTime latency)
+{
+  GstClockTime sorted[HISTORY_SIZE];
+  guint n;
+
+  probe->history[probe->n_measurements % HISTORY_SIZE] = latency;
+  probe->n_measurements++;
+
+  n = MIN (probe->n_measurements, HISTORY_SIZE);
+  memcpy (sorted, probe->history, n * sizeof (GstClockTime));
+  qsort (sorted, n, sizeof (GstClockTime), compare_clock_time);
+
+  return gst_structure_new ("wasapi-latency",
+      "latency", G_TYPE_UINT64, latency,
+      "count", G_TYPE_UINT, probe->n_measurements,
+      "min", G_TYPE_UINT64, sorted[0],
+      "p50", G_TYPE_UINT64, sorted[n * 50 / 100],
+      "p90", G_TYPE_UINT64, sorted[n * 90 / 100],
+      "p99", G_TYPE_UINT64, sorted[n * 99 / 100],
+      "max", G_TYPE_UINT64, sorted[n - 1], NULL);
+}
+
+GstClockTime
+gst_wasapi_latency_probe_detect (GstWasapiLatencyProbe * probe,
+    const guint8 * data, guint n_frames, guint64 qpc)
+{
+  guint i, c, start = 0;
+  guint64 sent, captured;
+
+  if (probe->countdown >= n_frames) {
+    probe->countdown -= n_frames;
+    return GST_CLOCK_TIME_NONE;
+  }
+  start = probe->countdown;
+  probe->countdown = 0;
+
+  for (i = start; i < n_frames; i++) {
+    const guint8 *frame = data + i * probe->bpf;
+
+    for (c = 0; c < probe->channels; c++) {
+      gdouble v = probe->is_float ? ((const gfloat *) frame)[c] :
+          ((const gint16 *) frame)[c] / (gdouble) G_MAXINT16;
+
+      if (ABS (v) >= DETECT_THRESHOLD)
+        goto found;
+    }
+  }
+
+  return GST_CLOCK_TIME_NONE;
+
+found:
+  /* Half an interval, so the next pulse is caught again */
+  probe->countdown = probe->interval_frames / 2 - MIN (n_frames - i,
+      probe->interval_frames / 2);
+
+  captured = qpc + gst_util_uint64_scale_int (i, 10000000, probe->rate);
+  sent = gst_wasapi_latency_take_pending (captured);
+  if (sent == 0) {
+    GST_DEBUG ("captured a pulse nobody sent");
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  return (captured - sent) * 100;
+}
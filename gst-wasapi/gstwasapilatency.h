@@ -0,0 +1,70 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_LATENCY_H__
+#define __GST_WASAPI_LATENCY_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Round-trip latency measurement, for latency-probe=true on wasapisink and
+ * on a wasapisrc capturing what it plays, in loopback or through a
+ * microphone.
+ *
+ * The sink overwrites 1 ms of its output with a full scale pulse once a
+ * second and notes when the pulse went into the endpoint buffer. The source
+ * looks for it in the packets it captures. The latency is the capture time
+ * of the pulse minus the time the sink wrote it, so it includes what was
+ * queued in the endpoint buffer ahead of it. The source posts a
+ * "wasapi-latency" element message for each pulse it finds, with the
+ * measurement and percentiles over the last ones.
+ *
+ * The sink should play silence meanwhile, loud audio looks like pulses.
+ * Only one sink in the process should probe at a time. */
+typedef struct _GstWasapiLatencyProbe GstWasapiLatencyProbe;
+
+/* NULL unless @format is 32 bit float or 16 bit integer PCM */
+GstWasapiLatencyProbe *gst_wasapi_latency_probe_new (const WAVEFORMATEX *
+    format);
+
+void gst_wasapi_latency_probe_free (GstWasapiLatencyProbe * probe);
+
+/* Sink, writes the pulse into the @n_frames at @data when one is due. TRUE
+ * if it did, then call gst_wasapi_latency_probe_sent() once they are
+ * committed to the endpoint buffer. */
+gboolean gst_wasapi_latency_probe_insert (GstWasapiLatencyProbe * probe,
+    guint8 * data, guint n_frames);
+
+/* @qpc in 100 ns units, see gst_wasapi_util_get_qpc_position() */
+void gst_wasapi_latency_probe_sent (GstWasapiLatencyProbe * probe,
+    guint64 qpc);
+
+/* Source, looks for the pulse in the @n_frames at @data, captured at @qpc.
+ * The round trip when it measured one, else GST_CLOCK_TIME_NONE. */
+GstClockTime gst_wasapi_latency_probe_detect (GstWasapiLatencyProbe * probe,
+    const guint8 * data, guint n_frames, guint64 qpc);
+
+/* Source, adds a @latency from detect() to the history. The structure for
+ * the message, which sorts the history, so it's left to another thread
+ * than detect(). */
+GstStructure *gst_wasapi_latency_probe_add (GstWasapiLatencyProbe * probe,
+    GstClockTime latency);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_LATENCY_H__ */
@@ -0,0 +1,314 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapilevel.h"
+
+#include <math.h>
+#include <endpointvolume.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Not in every SDK, and ABI anyway */
+static const IID gst_wasapi_iid_audio_meter_information = { 0xc02216f6,
+  0x8c67, 0x4b5b, {0x9d, 0x00, 0xd0, 0x08, 0xe7, 0x3e, 0x00, 0x64}
+};
+
+typedef void (*GstWasapiLevelMeasureFunc) (gdouble * sum, gdouble * peak,
+    gconstpointer data, guint n_frames, gint channels);
+
+struct _GstWasapiLevel
+{
+  GstWasapiLevelMeasureFunc measure;
+  /* Instead of the samples, if set */
+  IAudioMeterInformation *meter;
+
+  gint rate;
+  gint channels;
+  guint64 interval_frames;
+
+  GstClockTime timestamp;
+  guint64 frames;
+  /* Sum of the squares and peak per channel, normalized to [-1, 1] */
+  gdouble *sum;
+  gdouble *peak;
+  gfloat *meter_peak;
+
+  /* The last complete interval, until take_structure() had it. Intervals
+   * that end while it is still pending are dropped. */
+  gint pending;
+  GstClockTime result_timestamp;
+  guint64 result_frames;
+  gdouble *result_sum;
+  gdouble *result_peak;
+};
+
+/* Frame at a time, channels of a frame next to each other. The common
+ * channel counts get their own copy with the count fixed at compile time,
+ * so the inner loop is unrolled and the compiler can vectorize it. */
+#define DEFINE_MEASURE_CHANNELS(name, type, scale, suffix, CHANNELS) \
+static void \
+gst_wasapi_level_measure_##name##_##suffix (gdouble * sum, gdouble * peak, \
+    gconstpointer data, guint n_frames, gint channels) \
+{ \
+  const type *in = data; \
+  \
+  for (guint ii = 0; ii < n_frames; ii++) { \
+    for (gint cc = 0; cc < (CHANNELS); cc++) { \
+      gdouble s = *in++ * (scale); \
+      \
+      sum[cc] += s * s; \
+      if (fabs (s) > peak[cc]) \
+        peak[cc] = fabs (s); \
+    } \
+  } \
+}
+
+#define DEFINE_MEASURE(name, type, scale) \
+  DEFINE_MEASURE_CHANNELS (name, type, scale, 1, 1) \
+  DEFINE_MEASURE_CHANNELS (name, type, scale, 2, 2) \
+  DEFINE_MEASURE_CHANNELS (name, type, scale, 6, 6) \
+  DEFINE_MEASURE_CHANNELS (name, type, scale, 8, 8) \
+  DEFINE_MEASURE_CHANNELS (name, type, scale, any, channels)
+
+DEFINE_MEASURE (s16, gint16, 1.0 / 32768.0);
+DEFINE_MEASURE (s32, gint32, 1.0 / 2147483648.0);
+DEFINE_MEASURE (f32, gfloat, 1.0);
+
+#define PICK_MEASURE(name, channels) \
+  ((channels) == 1 ? gst_wasapi_level_measure_##name##_1 : \
+   (channels) == 2 ? gst_wasapi_level_measure_##name##_2 : \
+   (channels) == 6 ? gst_wasapi_level_measure_##name##_6 : \
+   (channels) == 8 ? gst_wasapi_level_measure_##name##_8 : \
+   gst_wasapi_level_measure_##name##_any)
+
+static GstWasapiLevel *
+gst_wasapi_level_alloc (const GstAudioInfo * info, GstClockTime interval)
+{
+  GstWasapiLevel *self = g_slice_new0 (GstWasapiLevel);
+
+  self->rate = GST_AUDIO_INFO_RATE (info);
+  self->channels = GST_AUDIO_INFO_CHANNELS (info);
+  self->interval_frames = MAX (gst_util_uint64_scale_int (interval,
+          self->rate, GST_SECOND), 1);
+  self->timestamp = GST_CLOCK_TIME_NONE;
+  self->sum = g_new0 (gdouble, self->channels);
+  self->peak = g_new0 (gdouble, self->channels);
+  self->result_sum = g_new0 (gdouble, self->channels);
+  self->result_peak = g_new0 (gdouble, self->channels);
+
+  return self;
+}
+
+GstWasapiLevel *
+gst_wasapi_level_new (const GstAudioInfo * info, GstClockTime interval)
+{
+  GstWasapiLevelMeasureFunc measure;
+  GstWasapiLevel *self;
+  gint channels = GST_AUDIO_INFO_CHANNELS (info);
+
+  switch (GST_AUDIO_INFO_FORMAT (info)) {
+    case GST_AUDIO_FORMAT_S16LE:
+      measure = PICK_MEASURE (s16, channels);
+      break;
+    case GST_AUDIO_FORMAT_S32LE:
+      measure = PICK_MEASURE (s32, channels);
+      break;
+    case GST_AUDIO_FORMAT_F32LE:
+      measure = PICK_MEASURE (f32, channels);
+      break;
+    default:
+      GST_INFO ("can't measure %s", GST_AUDIO_INFO_NAME (info));
+      return NULL;
+  }
+
+  self = gst_wasapi_level_alloc (info, interval);
+  self->measure = measure;
+
+  return self;
+}
+
+GstWasapiLevel *
+gst_wasapi_level_new_endpoint (GstElement * self, IMMDevice * device,
+    const GstAudioInfo * info, GstClockTime interval)
+{
+  IAudioMeterInformation *meter = NULL;
+  GstWasapiLevel *level;
+  UINT meter_channels = 0;
+  HRESULT hr;
+
+  hr = IMMDevice_Activate (device, &gst_wasapi_iid_audio_meter_information,
+      CLSCTX_ALL, NULL, (void **) &meter);
+  HR_FAILED_RET (hr, IMMDevice::Activate (IID_IAudioMeterInformation), NULL);
+
+  hr = IAudioMeterInformation_GetMeteringChannelCount (meter,
+      &meter_channels);
+  if (FAILED (hr) || meter_channels == 0) {
+    GST_WARNING_OBJECT (self, "endpoint has no meter channels");
+    IUnknown_Release (meter);
+    return NULL;
+  }
+
+  /* The meter has the channels of the endpoint, not of our caps */
+  level = gst_wasapi_level_alloc (info, interval);
+  level->meter = meter;
+  level->channels = meter_channels;
+  g_free (level->peak);
+  g_free (level->sum);
+  g_free (level->result_peak);
+  g_free (level->result_sum);
+  level->sum = level->result_sum = NULL;
+  level->peak = g_new0 (gdouble, meter_channels);
+  level->result_peak = g_new0 (gdouble, meter_channels);
+  level->meter_peak = g_new0 (gfloat, meter_channels);
+
+  return level;
+}
+
+void
+gst_wasapi_level_free (GstWasapiLevel * self)
+{
+  if (self->meter)
+    IUnknown_Release (self->meter);
+  g_free (self->sum);
+  g_free (self->peak);
+  g_free (self->meter_peak);
+  g_free (self->result_sum);
+  g_free (self->result_peak);
+  g_slice_free (GstWasapiLevel, self);
+}
+
+/* The level element still posts GValueArrays, so do we for compatibility */
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+static void
+gst_wasapi_level_append_db (GValueArray * array, gdouble db)
+{
+  GValue v = G_VALUE_INIT;
+
+  g_value_init (&v, G_TYPE_DOUBLE);
+  g_value_set_double (&v, db);
+  g_value_array_append (array, &v);
+  g_value_unset (&v);
+}
+
+static void
+gst_wasapi_level_take_array (GstStructure * s, const gchar * name,
+    GValueArray * array)
+{
+  GValue v = G_VALUE_INIT;
+
+  g_value_init (&v, G_TYPE_VALUE_ARRAY);
+  g_value_take_boxed (&v, array);
+  gst_structure_take_value (s, name, &v);
+}
+
+GstStructure *
+gst_wasapi_level_take_structure (GstWasapiLevel * self)
+{
+  GstStructure *s;
+  GstClockTime duration;
+  GValueArray *peak, *rms = NULL;
+
+  if (!g_atomic_int_get (&self->pending))
+    return NULL;
+
+  duration = gst_util_uint64_scale_int (self->result_frames, GST_SECOND,
+      self->rate);
+
+  peak = g_value_array_new (self->channels);
+  if (self->result_sum)
+    rms = g_value_array_new (self->channels);
+
+  for (gint cc = 0; cc < self->channels; cc++) {
+    gst_wasapi_level_append_db (peak, 20 * log10 (self->result_peak[cc]));
+    if (rms)
+      gst_wasapi_level_append_db (rms, 10 * log10 (self->result_sum[cc] /
+              self->result_frames));
+  }
+
+  s = gst_structure_new ("level",
+      "timestamp", G_TYPE_UINT64, self->result_timestamp,
+      "duration", G_TYPE_UINT64, duration,
+      "endtime", G_TYPE_UINT64,
+      GST_CLOCK_TIME_IS_VALID (self->result_timestamp) ?
+      self->result_timestamp + duration : GST_CLOCK_TIME_NONE, NULL);
+  gst_wasapi_level_take_array (s, "peak", peak);
+  if (rms)
+    gst_wasapi_level_take_array (s, "rms", rms);
+
+  g_atomic_int_set (&self->pending, FALSE);
+
+  return s;
+}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+gboolean
+gst_wasapi_level_process (GstWasapiLevel * self, gconstpointer data,
+    guint n_frames, GstClockTime timestamp)
+{
+  gboolean published = FALSE;
+
+  if (n_frames == 0)
+    return FALSE;
+
+  if (self->frames == 0)
+    self->timestamp = timestamp;
+
+  if (self->measure)
+    self->measure (self->sum, self->peak, data, n_frames, self->channels);
+  self->frames += n_frames;
+
+  if (self->frames < self->interval_frames)
+    return FALSE;
+
+  if (self->meter) {
+    HRESULT hr = IAudioMeterInformation_GetChannelsPeakValues (self->meter,
+        self->channels, self->meter_peak);
+
+    if (FAILED (hr)) {
+      GST_WARNING ("IAudioMeterInformation::GetChannelsPeakValues failed: %s",
+          gst_wasapi_util_hresult_to_static_string (hr));
+      memset (self->meter_peak, 0, self->channels * sizeof (gfloat));
+    }
+    for (gint cc = 0; cc < self->channels; cc++)
+      self->peak[cc] = self->meter_peak[cc];
+  }
+
+  if (!g_atomic_int_get (&self->pending)) {
+    self->result_timestamp = self->timestamp;
+    self->result_frames = self->frames;
+    if (self->sum)
+      memcpy (self->result_sum, self->sum, self->channels * sizeof (gdouble));
+    memcpy (self->result_peak, self->peak, self->channels * sizeof (gdouble));
+    g_atomic_int_set (&self->pending, TRUE);
+    published = TRUE;
+  }
+
+  self->timestamp = GST_CLOCK_TIME_NONE;
+  self->frames = 0;
+  for (gint cc = 0; cc < self->channels; cc++) {
+    if (self->sum)
+      self->sum[cc] = 0;
+    self->peak[cc] = 0;
+  }
+
+  return published;
+}
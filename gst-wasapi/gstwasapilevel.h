@@ -0,0 +1,55 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_LEVEL_H__
+#define __GST_WASAPI_LEVEL_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Metering of wasapisrc, so no level element is needed after it.
+ *
+ * Peak and RMS per channel are accumulated over each interval while the
+ * samples are read, or only the peaks are taken from the
+ * IAudioMeterInformation of the endpoint at the end of the interval. The
+ * result is a structure like the messages of the level element, with
+ * "timestamp", "duration", "endtime" and "peak" and "rms" arrays in dB. */
+typedef struct _GstWasapiLevel GstWasapiLevel;
+
+/* NULL if the samples of @info can't be measured */
+GstWasapiLevel *gst_wasapi_level_new (const GstAudioInfo * info,
+    GstClockTime interval);
+
+/* NULL if @device has no meter */
+GstWasapiLevel *gst_wasapi_level_new_endpoint (GstElement * element,
+    IMMDevice * device, const GstAudioInfo * info, GstClockTime interval);
+
+void gst_wasapi_level_free (GstWasapiLevel * level);
+
+/* Measures @n_frames frames of @data, the first captured at @timestamp.
+ * Neither allocates nor locks. TRUE once an interval is complete and kept
+ * for gst_wasapi_level_take_structure(). */
+gboolean gst_wasapi_level_process (GstWasapiLevel * level,
+    gconstpointer data, guint n_frames, GstClockTime timestamp);
+
+/* The message structure of the interval process() kept, NULL if there is
+ * none. May be called from another thread than process(). */
+GstStructure *gst_wasapi_level_take_structure (GstWasapiLevel * level);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_LEVEL_H__ */
@@ -0,0 +1,518 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapimixer.h"
+#include "gstwasapideviceclock.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+#define MIXER_WARNING(hr,func) \
+  GST_WARNING (#func " failed (%x): %s", (guint) hr, \
+      gst_wasapi_util_hresult_to_static_string (hr))
+
+struct _GstWasapiMixer
+{
+  gchar *id;
+  /* Attached inputs, protected by mixers_lock */
+  gint refcount;
+
+  IAudioClient *client;
+  IAudioRenderClient *render_client;
+  IAudioClock *client_clock;
+  GstClock *shared_clock;
+  WAVEFORMATEX *format;
+  HANDLE event_handle;
+  HANDLE stop_handle;
+  GThread *thread;
+
+  guint bpf;
+  guint channels;
+  guint buffer_frames;
+  guint period_frames;
+  /* Frames in the device buffer after the last write. ATOMIC */
+  gint padding;
+
+  /* Protects inputs and their queues, cond is signalled when the mixer
+   * took something out of them */
+  GMutex lock;
+  GCond cond;
+  GList *inputs;
+};
+
+struct _GstWasapiMixerInput
+{
+  GstWasapiMixer *mixer;
+  /* Ring of queue_frames frames, fill of them from read on */
+  guint8 *queue;
+  guint queue_frames;
+  guint read;
+  guint fill;
+  /* Incremented by reset, so a waiting write knows it was flushed */
+  guint resets;
+  gfloat gain;
+  /* Of the queued frames, which are of the mixer unless @n_selected
+   * channels go to channels @selected of it */
+  guint bpf;
+  gint selected[64];
+  gint n_selected;
+};
+
+static GMutex mixers_lock;
+static GHashTable *mixers;
+
+/* Plain enough for the compiler to vectorize */
+static inline void
+gst_wasapi_mixer_sum (gfloat * dst, const gfloat * src, guint n, gfloat gain)
+{
+  guint ii;
+
+  if (gain == 1.0f) {
+    for (ii = 0; ii < n; ii++)
+      dst[ii] += src[ii];
+  } else {
+    for (ii = 0; ii < n; ii++)
+      dst[ii] += src[ii] * gain;
+  }
+}
+
+static inline void
+gst_wasapi_mixer_scatter (gfloat * dst, guint dst_channels,
+    const gfloat * src, guint n_frames, const gint * selected,
+    gint n_selected, gfloat gain)
+{
+  guint ii;
+  gint jj;
+
+  for (ii = 0; ii < n_frames; ii++) {
+    for (jj = 0; jj < n_selected; jj++)
+      dst[selected[jj]] += src[jj] * gain;
+    dst += dst_channels;
+    src += n_selected;
+  }
+}
+
+/* Called with the mixer lock */
+static gboolean
+gst_wasapi_mixer_input_mix (GstWasapiMixerInput * input, gfloat * dst,
+    guint n_frames)
+{
+  GstWasapiMixer *mixer = input->mixer;
+  guint n = MIN (n_frames, input->fill);
+
+  if (n == 0)
+    return FALSE;
+
+  while (n > 0) {
+    guint chunk = MIN (n, input->queue_frames - input->read);
+
+    const gfloat *src =
+        (const gfloat *) (input->queue + input->read * input->bpf);
+
+    if (input->gain != 0.0f && input->n_selected > 0)
+      gst_wasapi_mixer_scatter (dst, mixer->channels, src, chunk,
+          input->selected, input->n_selected, input->gain);
+    else if (input->gain != 0.0f)
+      gst_wasapi_mixer_sum (dst, src, chunk * mixer->channels, input->gain);
+
+    dst += chunk * mixer->channels;
+    input->read = (input->read + chunk) % input->queue_frames;
+    input->fill -= chunk;
+    n -= chunk;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_wasapi_mixer_render (GstWasapiMixer * mixer)
+{
+  guint32 padding, n_frames;
+  gboolean mixed = FALSE;
+  BYTE *dst;
+  GList *l;
+  HRESULT hr;
+
+  hr = IAudioClient_GetCurrentPadding (mixer->client, &padding);
+  if (FAILED (hr)) {
+    MIXER_WARNING (hr, IAudioClient::GetCurrentPadding);
+    return;
+  }
+
+  n_frames = mixer->buffer_frames - padding;
+  g_atomic_int_set (&mixer->padding, padding);
+  if (n_frames == 0)
+    return;
+
+  hr = IAudioRenderClient_GetBuffer (mixer->render_client, n_frames, &dst);
+  if (FAILED (hr)) {
+    MIXER_WARNING (hr, IAudioRenderClient::GetBuffer);
+    return;
+  }
+
+  memset (dst, 0, n_frames * mixer->bpf);
+
+  g_mutex_lock (&mixer->lock);
+  for (l = mixer->inputs; l; l = l->next)
+    mixed |= gst_wasapi_mixer_input_mix (l->data, (gfloat *) dst, n_frames);
+  g_cond_broadcast (&mixer->cond);
+  g_mutex_unlock (&mixer->lock);
+
+  hr = IAudioRenderClient_ReleaseBuffer (mixer->render_client, n_frames,
+      mixed ? 0 : AUDCLNT_BUFFERFLAGS_SILENT);
+  if (FAILED (hr)) {
+    MIXER_WARNING (hr, IAudioRenderClient::ReleaseBuffer);
+    return;
+  }
+
+  g_atomic_int_set (&mixer->padding, padding + n_frames);
+}
+
+static gpointer
+gst_wasapi_mixer_thread_func (gpointer user_data)
+{
+  GstWasapiMixer *mixer = user_data;
+  HANDLE handles[2] = { mixer->stop_handle, mixer->event_handle };
+  HANDLE priority_handle;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  priority_handle =
+      gst_wasapi_util_set_thread_characteristics (GST_WASAPI_DEFAULT_MMCSS_TASK,
+      GST_WASAPI_MMCSS_PRIORITY_NORMAL);
+
+  while (WaitForMultipleObjects (2, handles, FALSE, INFINITE) ==
+      WAIT_OBJECT_0 + 1)
+    gst_wasapi_mixer_render (mixer);
+
+  if (priority_handle != NULL)
+    gst_wasapi_util_revert_thread_characteristics (priority_handle);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static void
+gst_wasapi_mixer_free (GstWasapiMixer * mixer)
+{
+  if (mixer->thread != NULL) {
+    SetEvent (mixer->stop_handle);
+    g_thread_join (mixer->thread);
+  }
+
+  if (mixer->client != NULL)
+    IAudioClient_Stop (mixer->client);
+
+  if (mixer->client_clock != NULL) {
+    if (mixer->shared_clock != NULL)
+      gst_wasapi_device_clock_remove_client (mixer->shared_clock,
+          mixer->client_clock);
+    IUnknown_Release (mixer->client_clock);
+  }
+  if (mixer->shared_clock != NULL)
+    gst_object_unref (mixer->shared_clock);
+  if (mixer->render_client != NULL)
+    IUnknown_Release (mixer->render_client);
+  if (mixer->client != NULL)
+    IUnknown_Release (mixer->client);
+  if (mixer->event_handle != NULL)
+    CloseHandle (mixer->event_handle);
+  if (mixer->stop_handle != NULL)
+    CloseHandle (mixer->stop_handle);
+  CoTaskMemFree (mixer->format);
+
+  g_mutex_clear (&mixer->lock);
+  g_cond_clear (&mixer->cond);
+  g_free (mixer->id);
+  g_slice_free (GstWasapiMixer, mixer);
+}
+
+/* Whether @spec goes on the float @format as it is, or on its @selected
+ * channels */
+static gboolean
+gst_wasapi_mixer_accepts (WAVEFORMATEX * format,
+    GstAudioRingBufferSpec * spec, gint n_selected, const gint * selected)
+{
+  const gchar *afmt =
+      gst_waveformatex_to_audio_format ((WAVEFORMATEXTENSIBLE *) format);
+
+  if (GST_AUDIO_INFO_FORMAT (&spec->info) != GST_AUDIO_FORMAT_F32LE ||
+      afmt == NULL || !g_str_equal (afmt, "F32LE") ||
+      format->nSamplesPerSec != GST_AUDIO_INFO_RATE (&spec->info))
+    return FALSE;
+
+  if (n_selected == 0)
+    return format->nChannels == GST_AUDIO_INFO_CHANNELS (&spec->info);
+
+  if (n_selected != GST_AUDIO_INFO_CHANNELS (&spec->info))
+    return FALSE;
+  for (gint ii = 0; ii < n_selected; ii++)
+    if (selected[ii] < 0 || selected[ii] >= format->nChannels)
+      return FALSE;
+
+  return TRUE;
+}
+
+static GstWasapiMixer *
+gst_wasapi_mixer_new (GstElement * self, IMMDevice * device,
+    GstAudioRingBufferSpec * spec, gint n_selected, const gint * selected)
+{
+  GstWasapiMixer *mixer;
+  GstAudioRingBufferSpec mixer_spec = *spec;
+  guint devicep_frames;
+  BYTE *dst;
+  HRESULT hr;
+
+  mixer = g_slice_new0 (GstWasapiMixer);
+  g_mutex_init (&mixer->lock);
+  g_cond_init (&mixer->cond);
+
+  hr = IMMDevice_Activate (device, &IID_IAudioClient, CLSCTX_ALL, NULL,
+      (void **) &mixer->client);
+  HR_FAILED_AND (hr, IMMDevice::Activate (IID_IAudioClient), goto failed);
+
+  hr = IAudioClient_GetMixFormat (mixer->client, &mixer->format);
+  HR_FAILED_AND (hr, IAudioClient::GetMixFormat, goto failed);
+
+  if (!gst_wasapi_mixer_accepts (mixer->format, spec, n_selected,
+          selected)) {
+    GST_INFO_OBJECT (self, "can only share a client with float samples in "
+        "the mix format");
+    goto failed;
+  }
+
+  if (!gst_wasapi_util_initialize_audioclient (self, &mixer_spec, device,
+          &mixer->client, mixer->format, AUDCLNT_SHAREMODE_SHARED, FALSE,
+          FALSE, FALSE, FALSE, &devicep_frames))
+    goto failed;
+
+  hr = IAudioClient_GetBufferSize (mixer->client, &mixer->buffer_frames);
+  HR_FAILED_AND (hr, IAudioClient::GetBufferSize, goto failed);
+
+  mixer->bpf = mixer->format->nBlockAlign;
+  mixer->channels = mixer->format->nChannels;
+  mixer->period_frames = MAX (MIN (devicep_frames, mixer->buffer_frames), 1);
+
+  if (!gst_wasapi_util_get_render_client (self, mixer->client,
+          &mixer->render_client))
+    goto failed;
+
+  mixer->event_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  mixer->stop_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  hr = IAudioClient_SetEventHandle (mixer->client, mixer->event_handle);
+  HR_FAILED_AND (hr, IAudioClient::SetEventHandle, goto failed);
+
+  /* Sinks on the shared client provide the clock of the endpoint through
+   * this one, they have no client of their own */
+  if (gst_wasapi_util_get_clock (self, mixer->client, &mixer->client_clock) &&
+      (mixer->shared_clock = gst_wasapi_device_clock_get_shared (device)))
+    gst_wasapi_device_clock_add_client (mixer->shared_clock,
+        mixer->client_clock, gst_util_uint64_scale_int (mixer->period_frames,
+            GST_SECOND, mixer->format->nSamplesPerSec));
+
+  /* Start on a buffer of silence, like the sink does */
+  hr = IAudioRenderClient_GetBuffer (mixer->render_client,
+      mixer->buffer_frames, &dst);
+  HR_FAILED_AND (hr, IAudioRenderClient::GetBuffer, goto failed);
+  hr = IAudioRenderClient_ReleaseBuffer (mixer->render_client,
+      mixer->buffer_frames, AUDCLNT_BUFFERFLAGS_SILENT);
+  HR_FAILED_AND (hr, IAudioRenderClient::ReleaseBuffer, goto failed);
+
+  hr = IAudioClient_Start (mixer->client);
+  HR_FAILED_AND (hr, IAudioClient::Start, goto failed);
+
+  mixer->thread = g_thread_new ("wasapi-mixer", gst_wasapi_mixer_thread_func,
+      mixer);
+
+  GST_INFO_OBJECT (self, "new shared client, buffer %u frames, period %u "
+      "frames", mixer->buffer_frames, mixer->period_frames);
+
+  return mixer;
+
+failed:
+  gst_wasapi_mixer_free (mixer);
+  return NULL;
+}
+
+GstWasapiMixerInput *
+gst_wasapi_mixer_attach (GstElement * self, IMMDevice * device,
+    GstAudioRingBufferSpec * spec, gint n_selected, const gint * selected)
+{
+  GstWasapiMixer *mixer;
+  GstWasapiMixerInput *input;
+  LPWSTR wid = NULL;
+  gchar *id;
+  HRESULT hr;
+
+  hr = IMMDevice_GetId (device, &wid);
+  HR_FAILED_RET (hr, IMMDevice::GetId, NULL);
+  id = g_utf16_to_utf8 (wid, -1, NULL, NULL, NULL);
+  CoTaskMemFree (wid);
+
+  g_mutex_lock (&mixers_lock);
+  if (mixers == NULL)
+    mixers = g_hash_table_new (g_str_hash, g_str_equal);
+
+  mixer = g_hash_table_lookup (mixers, id);
+  if (mixer == NULL) {
+    if (!(mixer = gst_wasapi_mixer_new (self, device, spec, n_selected,
+                selected))) {
+      g_mutex_unlock (&mixers_lock);
+      g_free (id);
+      return NULL;
+    }
+    mixer->id = id;
+    id = NULL;
+    g_hash_table_insert (mixers, mixer->id, mixer);
+  } else if (!gst_wasapi_mixer_accepts (mixer->format, spec, n_selected,
+          selected)) {
+    GST_INFO_OBJECT (self, "caps are not the format of the shared client");
+    g_mutex_unlock (&mixers_lock);
+    g_free (id);
+    return NULL;
+  }
+  mixer->refcount++;
+  g_mutex_unlock (&mixers_lock);
+
+  g_free (id);
+
+  input = g_slice_new0 (GstWasapiMixerInput);
+  input->mixer = mixer;
+  input->queue_frames = mixer->buffer_frames;
+  input->bpf = GST_AUDIO_INFO_BPF (&spec->info);
+  input->queue = g_malloc (input->queue_frames * input->bpf);
+  input->gain = 1.0f;
+  input->n_selected = n_selected;
+  if (n_selected > 0)
+    memcpy (input->selected, selected, n_selected * sizeof (gint));
+
+  g_mutex_lock (&mixer->lock);
+  mixer->inputs = g_list_append (mixer->inputs, input);
+  g_mutex_unlock (&mixer->lock);
+
+  GST_INFO_OBJECT (self, "attached to the shared client of %s, %d inputs",
+      mixer->id, mixer->refcount);
+
+  return input;
+}
+
+void
+gst_wasapi_mixer_detach (GstWasapiMixerInput * input)
+{
+  GstWasapiMixer *mixer = input->mixer;
+  gboolean last;
+
+  g_mutex_lock (&mixer->lock);
+  mixer->inputs = g_list_remove (mixer->inputs, input);
+  g_mutex_unlock (&mixer->lock);
+
+  g_free (input->queue);
+  g_slice_free (GstWasapiMixerInput, input);
+
+  g_mutex_lock (&mixers_lock);
+  last = --mixer->refcount == 0;
+  if (last)
+    g_hash_table_remove (mixers, mixer->id);
+  g_mutex_unlock (&mixers_lock);
+
+  if (last) {
+    GST_INFO ("last input of the shared client of %s is gone", mixer->id);
+    gst_wasapi_mixer_free (mixer);
+  }
+}
+
+guint
+gst_wasapi_mixer_input_write (GstWasapiMixerInput * input,
+    const guint8 * data, guint length)
+{
+  GstWasapiMixer *mixer = input->mixer;
+  guint n_frames = length / input->bpf;
+  guint resets, pos, chunk;
+
+  g_mutex_lock (&mixer->lock);
+  resets = input->resets;
+  while (input->fill == input->queue_frames && input->resets == resets)
+    g_cond_wait (&mixer->cond, &mixer->lock);
+
+  /* Flushed while waiting, what we had is gone as well */
+  if (input->resets != resets) {
+    g_mutex_unlock (&mixer->lock);
+    return length;
+  }
+
+  n_frames = MIN (n_frames, input->queue_frames - input->fill);
+  pos = (input->read + input->fill) % input->queue_frames;
+  chunk = MIN (n_frames, input->queue_frames - pos);
+
+  memcpy (input->queue + pos * input->bpf, data, chunk * input->bpf);
+  memcpy (input->queue, data + chunk * input->bpf,
+      (n_frames - chunk) * input->bpf);
+  input->fill += n_frames;
+  g_mutex_unlock (&mixer->lock);
+
+  return n_frames * input->bpf;
+}
+
+void
+gst_wasapi_mixer_input_reset (GstWasapiMixerInput * input)
+{
+  GstWasapiMixer *mixer = input->mixer;
+
+  g_mutex_lock (&mixer->lock);
+  input->read = 0;
+  input->fill = 0;
+  input->resets++;
+  g_cond_broadcast (&mixer->cond);
+  g_mutex_unlock (&mixer->lock);
+}
+
+guint
+gst_wasapi_mixer_input_delay (GstWasapiMixerInput * input)
+{
+  GstWasapiMixer *mixer = input->mixer;
+  guint delay;
+
+  g_mutex_lock (&mixer->lock);
+  delay = input->fill;
+  g_mutex_unlock (&mixer->lock);
+
+  return delay + g_atomic_int_get (&mixer->padding);
+}
+
+void
+gst_wasapi_mixer_input_set_volume (GstWasapiMixerInput * input,
+    gdouble volume, gboolean mute)
+{
+  GstWasapiMixer *mixer = input->mixer;
+
+  g_mutex_lock (&mixer->lock);
+  input->gain = mute ? 0.0f : (gfloat) volume;
+  g_mutex_unlock (&mixer->lock);
+}
+
+void
+gst_wasapi_mixer_input_get_sizes (GstWasapiMixerInput * input,
+    guint * period_frames, guint * buffer_frames)
+{
+  *period_frames = input->mixer->period_frames;
+  *buffer_frames = input->mixer->buffer_frames;
+}
@@ -0,0 +1,70 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_MIXER_H__
+#define __GST_WASAPI_MIXER_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Process-wide shared mode render stream of an endpoint, for wasapisink
+ * with shared-client=true.
+ *
+ * Sinks attach as inputs with their own queue instead of initializing a
+ * client each, so there is one engine stream and one MMCSS thread per
+ * endpoint. That thread waits for the device events and sums what the
+ * inputs queued into the device buffer. Inputs have to use the mix format,
+ * which has to be 32 bit float.
+ *
+ * An input can also take only some channels of the endpoint, then its
+ * frames are scattered into those while mixing, e.g. four stereo sinks on
+ * an 8 channel interface without interleaving them upstream. */
+typedef struct _GstWasapiMixer GstWasapiMixer;
+typedef struct _GstWasapiMixerInput GstWasapiMixerInput;
+
+/* Attaches to the stream of the endpoint of @device, setting it up with the
+ * buffer and latency time of @spec when it's the first input. Channel i of
+ * @spec goes to channel @selected[i] of the endpoint, from 0, unless
+ * @n_selected is 0. NULL if @spec isn't the mix format or that many of its
+ * channels, or the stream can't be set up. */
+GstWasapiMixerInput *gst_wasapi_mixer_attach (GstElement * element,
+    IMMDevice * device, GstAudioRingBufferSpec * spec, gint n_selected,
+    const gint * selected);
+
+void gst_wasapi_mixer_detach (GstWasapiMixerInput * input);
+
+/* Queues up to @length bytes, waits while the queue is full. Returns how
+ * many were taken, all of them when reset meanwhile. */
+guint gst_wasapi_mixer_input_write (GstWasapiMixerInput * input,
+    const guint8 * data, guint length);
+
+/* Drops what is queued and wakes up a waiting write */
+void gst_wasapi_mixer_input_reset (GstWasapiMixerInput * input);
+
+/* Frames queued plus what the device still has to play */
+guint gst_wasapi_mixer_input_delay (GstWasapiMixerInput * input);
+
+void gst_wasapi_mixer_input_set_volume (GstWasapiMixerInput * input,
+    gdouble volume, gboolean mute);
+
+/* The device period and buffer size of the shared stream, in frames */
+void gst_wasapi_mixer_input_get_sizes (GstWasapiMixerInput * input,
+    guint * period_frames, guint * buffer_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_MIXER_H__ */
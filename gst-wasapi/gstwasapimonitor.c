@@ -0,0 +1,791 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/**
+ * SECTION:element-wasapimonitor
+ * @title: wasapimonitor
+ *
+ * Plays what a capture endpoint records on a render endpoint with as
+ * little latency as the engine allows, for monitoring a microphone, and
+ * outputs the same capture on its src pad for recording.
+ *
+ * Instead of going through a wasapisrc and a wasapisink, with two ring
+ * buffers and the streaming thread in between, the capture and the render
+ * client are serviced by one MMCSS thread: every capture packet is written
+ * to the render client right when the capture event fires. To keep the
+ * latency from growing when the two devices drift apart, frames above a
+ * few packets in the render client are dropped. The src pad gets the
+ * packets untouched, gain only applies to what is monitored.
+ *
+ * Both clients run in shared mode on the format of the caps, the audio
+ * engine converts to and from what the devices have.
+ *
+ * ## Example pipelines
+ * |[
+ * gst-launch-1.0 -v wasapimonitor gain=0.5 ! audioconvert ! lamemp3enc ! filesink location=take.mp3
+ * ]| Hear the default microphone on the default speakers while recording it.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "gstwasapimonitor.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_wasapi_monitor_debug);
+#define GST_CAT_DEFAULT gst_wasapi_monitor_debug
+
+#define DEFAULT_CAPTURE_DEVICE NULL
+#define DEFAULT_RENDER_DEVICE  NULL
+#define DEFAULT_RATE           48000
+#define DEFAULT_CHANNELS       2
+#define DEFAULT_GAIN           1.0
+#define DEFAULT_MONITOR        TRUE
+#define DEFAULT_LATENCY_TIME   3000
+#define DEFAULT_BUFFER_TIME    200000
+
+/* Packets that may wait in the render client on top of the prefill */
+#define MAX_FILL_PACKETS 2
+
+enum
+{
+  PROP_0,
+  PROP_CAPTURE_DEVICE,
+  PROP_RENDER_DEVICE,
+  PROP_RATE,
+  PROP_CHANNELS,
+  PROP_GAIN,
+  PROP_MONITOR,
+  PROP_LATENCY_TIME,
+  PROP_BUFFER_TIME
+};
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) " GST_AUDIO_NE (F32) ", "
+        "layout = (string) interleaved, "
+        "rate = " GST_AUDIO_RATE_RANGE ", "
+        "channels = " GST_AUDIO_CHANNELS_RANGE));
+
+static void gst_wasapi_monitor_finalize (GObject * object);
+static void gst_wasapi_monitor_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_wasapi_monitor_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstCaps *gst_wasapi_monitor_get_caps (GstBaseSrc * bsrc,
+    GstCaps * filter);
+static gboolean gst_wasapi_monitor_start (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_monitor_stop (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_monitor_query (GstBaseSrc * bsrc,
+    GstQuery * query);
+static gboolean gst_wasapi_monitor_unlock (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_monitor_unlock_stop (GstBaseSrc * bsrc);
+static GstFlowReturn gst_wasapi_monitor_create (GstPushSrc * psrc,
+    GstBuffer ** outbuf);
+
+#define gst_wasapi_monitor_parent_class parent_class
+G_DEFINE_TYPE (GstWasapiMonitor, gst_wasapi_monitor, GST_TYPE_PUSH_SRC);
+
+static void
+gst_wasapi_monitor_class_init (GstWasapiMonitorClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *gstbasesrc_class = GST_BASE_SRC_CLASS (klass);
+  GstPushSrcClass *gstpushsrc_class = GST_PUSH_SRC_CLASS (klass);
+
+  gobject_class->finalize = gst_wasapi_monitor_finalize;
+  gobject_class->set_property = gst_wasapi_monitor_set_property;
+  gobject_class->get_property = gst_wasapi_monitor_get_property;
+
+  g_object_class_install_property (gobject_class,
+      PROP_CAPTURE_DEVICE,
+      g_param_spec_string ("capture-device", "Capture device",
+          "WASAPI capture device as a GUID string, the default one if unset",
+          DEFAULT_CAPTURE_DEVICE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RENDER_DEVICE,
+      g_param_spec_string ("render-device", "Render device",
+          "WASAPI playback device as a GUID string, the default one if unset",
+          DEFAULT_RENDER_DEVICE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RATE,
+      g_param_spec_int ("rate", "Rate",
+          "Sample rate of both clients and the output", 1, G_MAXINT,
+          DEFAULT_RATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNELS,
+      g_param_spec_int ("channels", "Channels",
+          "Channels of both clients and the output", 1, 8, DEFAULT_CHANNELS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_GAIN,
+      g_param_spec_double ("gain", "Gain",
+          "Linear gain of what is monitored, the output is not affected",
+          0.0, 10.0, DEFAULT_GAIN, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MONITOR,
+      g_param_spec_boolean ("monitor", "Monitor",
+          "Play the capture on the render device, otherwise it only goes to "
+          "the src pad", DEFAULT_MONITOR, G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LATENCY_TIME,
+      g_param_spec_uint64 ("latency-time", "Latency time",
+          "Device period to ask both clients for, in microseconds",
+          1000, G_MAXUINT64, DEFAULT_LATENCY_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_BUFFER_TIME,
+      g_param_spec_uint64 ("buffer-time", "Buffer time",
+          "How much of the capture is kept for the src pad at most, in "
+          "microseconds", 1000, G_MAXUINT64, DEFAULT_BUFFER_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (gstelement_class,
+      &src_template);
+  gst_element_class_set_static_metadata (gstelement_class,
+      "WasapiMonitor", "Source/Audio",
+      "Monitor a capture endpoint on a render endpoint with low latency "
+      "through WASAPI, and output the capture", "Bebo");
+
+  gstbasesrc_class->get_caps = GST_DEBUG_FUNCPTR (gst_wasapi_monitor_get_caps);
+  gstbasesrc_class->start = GST_DEBUG_FUNCPTR (gst_wasapi_monitor_start);
+  gstbasesrc_class->stop = GST_DEBUG_FUNCPTR (gst_wasapi_monitor_stop);
+  gstbasesrc_class->query = GST_DEBUG_FUNCPTR (gst_wasapi_monitor_query);
+  gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_wasapi_monitor_unlock);
+  gstbasesrc_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_wasapi_monitor_unlock_stop);
+
+  gstpushsrc_class->create = GST_DEBUG_FUNCPTR (gst_wasapi_monitor_create);
+
+  GST_DEBUG_CATEGORY_INIT (gst_wasapi_monitor_debug, "wasapimonitor", 0,
+      "Windows audio session API monitor");
+}
+
+static void
+gst_wasapi_monitor_init (GstWasapiMonitor * self)
+{
+  self->capture_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->render_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->stop_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  self->ready_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->cancel_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  g_mutex_init (&self->lock);
+  g_queue_init (&self->packets);
+
+  self->capture_device_id = g_strdup (DEFAULT_CAPTURE_DEVICE);
+  self->render_device_id = g_strdup (DEFAULT_RENDER_DEVICE);
+  self->rate = DEFAULT_RATE;
+  self->channels = DEFAULT_CHANNELS;
+  self->gain = DEFAULT_GAIN;
+  self->monitor = DEFAULT_MONITOR;
+  self->latency_time = DEFAULT_LATENCY_TIME;
+  self->buffer_time = DEFAULT_BUFFER_TIME;
+
+  gst_base_src_set_live (GST_BASE_SRC (self), TRUE);
+  gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
+}
+
+static void
+gst_wasapi_monitor_finalize (GObject * object)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (object);
+
+  CloseHandle (self->capture_event);
+  CloseHandle (self->render_event);
+  CloseHandle (self->stop_handle);
+  CloseHandle (self->ready_event);
+  CloseHandle (self->cancel_handle);
+  g_mutex_clear (&self->lock);
+  g_free (self->capture_device_id);
+  g_free (self->render_device_id);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_wasapi_monitor_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_CAPTURE_DEVICE:
+      g_free (self->capture_device_id);
+      self->capture_device_id = g_value_dup_string (value);
+      break;
+    case PROP_RENDER_DEVICE:
+      g_free (self->render_device_id);
+      self->render_device_id = g_value_dup_string (value);
+      break;
+    case PROP_RATE:
+      self->rate = g_value_get_int (value);
+      break;
+    case PROP_CHANNELS:
+      self->channels = g_value_get_int (value);
+      break;
+    case PROP_GAIN:
+      self->gain = g_value_get_double (value);
+      break;
+    case PROP_MONITOR:
+      self->monitor = g_value_get_boolean (value);
+      break;
+    case PROP_LATENCY_TIME:
+      self->latency_time = g_value_get_uint64 (value);
+      break;
+    case PROP_BUFFER_TIME:
+      self->buffer_time = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_wasapi_monitor_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_CAPTURE_DEVICE:
+      g_value_set_string (value, self->capture_device_id);
+      break;
+    case PROP_RENDER_DEVICE:
+      g_value_set_string (value, self->render_device_id);
+      break;
+    case PROP_RATE:
+      g_value_set_int (value, self->rate);
+      break;
+    case PROP_CHANNELS:
+      g_value_set_int (value, self->channels);
+      break;
+    case PROP_GAIN:
+      g_value_set_double (value, self->gain);
+      break;
+    case PROP_MONITOR:
+      g_value_set_boolean (value, self->monitor);
+      break;
+    case PROP_LATENCY_TIME:
+      g_value_set_uint64 (value, self->latency_time);
+      break;
+    case PROP_BUFFER_TIME:
+      g_value_set_uint64 (value, self->buffer_time);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static GstCaps *
+gst_wasapi_monitor_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (bsrc);
+  GstCaps *caps;
+
+  if (self->capture_client == NULL) {
+    caps = gst_pad_get_pad_template_caps (bsrc->srcpad);
+  } else {
+    caps = gst_audio_info_to_caps (&self->info);
+  }
+
+  if (filter) {
+    GstCaps *filtered =
+        gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = filtered;
+  }
+
+  return caps;
+}
+
+/* Opens the default endpoint of @flow or @id and initializes its client on
+ * the format of the caps */
+static gboolean
+gst_wasapi_monitor_open_client (GstWasapiMonitor * self, EDataFlow flow,
+    const gchar * id, IMMDevice ** device, IAudioClient ** client,
+    guint * devicep_frames)
+{
+  GstAudioRingBufferSpec spec;
+  WAVEFORMATEX *mix_format = NULL, *format;
+  wchar_t *strid = NULL;
+  gboolean ok;
+  HRESULT hr;
+
+  if (id != NULL)
+    strid = g_utf8_to_utf16 (id, -1, NULL, NULL, NULL);
+  ok = gst_wasapi_util_get_device_client (GST_ELEMENT (self), flow, eConsole,
+      strid, device, client);
+  g_free (strid);
+  if (!ok)
+    return FALSE;
+
+  /* Only for the channel mask, which the engine maps to ours */
+  hr = IAudioClient_GetMixFormat (*client, &mix_format);
+  HR_FAILED_RET (hr, IAudioClient::GetMixFormat, FALSE);
+  format = gst_wasapi_util_audio_info_to_waveformatex (&self->info,
+      mix_format);
+  CoTaskMemFree (mix_format);
+
+  memset (&spec, 0, sizeof (spec));
+  spec.info = self->info;
+  spec.latency_time = self->latency_time;
+  spec.buffer_time = self->latency_time * 4;
+  ok = gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), &spec,
+      *device, client, format, AUDCLNT_SHAREMODE_SHARED, TRUE, FALSE, TRUE,
+      FALSE, devicep_frames);
+  CoTaskMemFree (format);
+
+  return ok;
+}
+
+static void
+gst_wasapi_monitor_close (GstWasapiMonitor * self)
+{
+  if (self->capture_client != NULL)
+    IAudioClient_Stop (self->capture_client);
+  if (self->render_client != NULL)
+    IAudioClient_Stop (self->render_client);
+
+  if (self->capture != NULL) {
+    IUnknown_Release (self->capture);
+    self->capture = NULL;
+  }
+  if (self->capture_client != NULL) {
+    IUnknown_Release (self->capture_client);
+    self->capture_client = NULL;
+  }
+  if (self->capture_device != NULL) {
+    IUnknown_Release (self->capture_device);
+    self->capture_device = NULL;
+  }
+  if (self->render != NULL) {
+    IUnknown_Release (self->render);
+    self->render = NULL;
+  }
+  if (self->render_client != NULL) {
+    IUnknown_Release (self->render_client);
+    self->render_client = NULL;
+  }
+  if (self->render_device != NULL) {
+    IUnknown_Release (self->render_device);
+    self->render_device = NULL;
+  }
+
+  g_queue_clear_full (&self->packets, (GDestroyNotify) gst_buffer_unref);
+  self->queued_frames = 0;
+  self->render_started = FALSE;
+  self->failed = FALSE;
+}
+
+/* From the monitor thread. Writes @n_frames of the capture to the render
+ * client, with the gain, and starts it on the first ones. */
+static HRESULT
+gst_wasapi_monitor_render (GstWasapiMonitor * self, const BYTE * data,
+    guint n_frames, gboolean silent)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->info);
+  guint32 padding, excess;
+  gboolean monitor;
+  gfloat gain;
+  BYTE *dst;
+  HRESULT hr;
+
+  GST_OBJECT_LOCK (self);
+  monitor = self->monitor;
+  gain = (gfloat) self->gain;
+  GST_OBJECT_UNLOCK (self);
+
+  /* A cushion against the jitter of the capture events */
+  if (!self->render_started) {
+    hr = IAudioRenderClient_GetBuffer (self->render, self->prefill_frames,
+        &dst);
+    if (FAILED (hr))
+      return hr;
+    hr = IAudioRenderClient_ReleaseBuffer (self->render, self->prefill_frames,
+        AUDCLNT_BUFFERFLAGS_SILENT);
+    if (FAILED (hr))
+      return hr;
+  }
+
+  hr = IAudioClient_GetCurrentPadding (self->render_client, &padding);
+  if (FAILED (hr))
+    return hr;
+
+  /* The capture device runs faster than the render one, or the render
+   * client fell behind: drop instead of letting the latency grow */
+  if (padding + n_frames > self->max_fill_frames) {
+    excess = MIN (padding + n_frames - self->max_fill_frames, n_frames);
+    if (self->dropped_frames == 0)
+      GST_INFO_OBJECT (self, "render client is full, dropping frames");
+    self->dropped_frames += excess;
+    data += excess * bpf;
+    n_frames -= excess;
+  }
+  n_frames = MIN (n_frames, self->render_buffer_frames - padding);
+
+  if (n_frames > 0) {
+    hr = IAudioRenderClient_GetBuffer (self->render, n_frames, &dst);
+    if (FAILED (hr))
+      return hr;
+
+    if (silent || !monitor || gain == 0) {
+      hr = IAudioRenderClient_ReleaseBuffer (self->render, n_frames,
+          AUDCLNT_BUFFERFLAGS_SILENT);
+    } else {
+      if (gain == 1) {
+        memcpy (dst, data, n_frames * bpf);
+      } else {
+        const gfloat *in = (const gfloat *) data;
+        gfloat *out = (gfloat *) dst;
+        guint i, n = n_frames * GST_AUDIO_INFO_CHANNELS (&self->info);
+
+        for (i = 0; i < n; i++)
+          out[i] = in[i] * gain;
+      }
+      hr = IAudioRenderClient_ReleaseBuffer (self->render, n_frames, 0);
+    }
+    if (FAILED (hr))
+      return hr;
+  }
+
+  if (!self->render_started) {
+    hr = IAudioClient_Start (self->render_client);
+    if (FAILED (hr))
+      return hr;
+    self->render_started = TRUE;
+  }
+
+  return S_OK;
+}
+
+/* From the monitor thread. Queues a copy of the packet for the src pad,
+ * dropping the oldest when downstream doesn't keep up. */
+static void
+gst_wasapi_monitor_queue (GstWasapiMonitor * self, const BYTE * data,
+    guint n_frames, gboolean silent, gboolean discont, guint64 qpcpos)
+{
+  guint bpf = GST_AUDIO_INFO_BPF (&self->info);
+  GstBuffer *buf;
+
+  buf = gst_buffer_new_allocate (NULL, n_frames * bpf, NULL);
+  if (silent)
+    gst_buffer_memset (buf, 0, 0, n_frames * bpf);
+  else
+    gst_buffer_fill (buf, 0, data, n_frames * bpf);
+  GST_BUFFER_OFFSET (buf) = qpcpos;
+
+  g_mutex_lock (&self->lock);
+  if (discont)
+    self->discont = TRUE;
+  g_queue_push_tail (&self->packets, buf);
+  self->queued_frames += n_frames;
+  while (self->queued_frames > self->max_frames) {
+    buf = g_queue_pop_head (&self->packets);
+    self->queued_frames -= gst_buffer_get_size (buf) / bpf;
+    gst_buffer_unref (buf);
+    self->discont = TRUE;
+  }
+  g_mutex_unlock (&self->lock);
+
+  SetEvent (self->ready_event);
+}
+
+static gpointer
+gst_wasapi_monitor_thread_func (gpointer user_data)
+{
+  GstWasapiMonitor *self = user_data;
+  HANDLE handles[2] = { self->stop_handle, self->capture_event };
+  HANDLE priority_handle;
+  HRESULT hr = S_OK;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  priority_handle =
+      gst_wasapi_util_set_thread_characteristics (GST_WASAPI_DEFAULT_MMCSS_TASK,
+      GST_WASAPI_MMCSS_PRIORITY_HIGH);
+
+  while (WaitForMultipleObjects (2, handles, FALSE, INFINITE) ==
+      WAIT_OBJECT_0 + 1) {
+    for (;;) {
+      BYTE *data;
+      UINT32 n_frames;
+      DWORD flags;
+      UINT64 devpos, qpcpos;
+      gboolean silent;
+
+      hr = IAudioCaptureClient_GetBuffer (self->capture, &data, &n_frames,
+          &flags, &devpos, &qpcpos);
+      if (hr == AUDCLNT_S_BUFFER_EMPTY) {
+        hr = S_OK;
+        break;
+      }
+      if (FAILED (hr))
+        break;
+
+      silent = (flags & AUDCLNT_BUFFERFLAGS_SILENT) != 0;
+      if (flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)
+        qpcpos = gst_wasapi_util_get_qpc_position ();
+
+      /* Monitoring first, it is what can be heard */
+      hr = gst_wasapi_monitor_render (self, data, n_frames, silent);
+      if (SUCCEEDED (hr))
+        gst_wasapi_monitor_queue (self, data, n_frames, silent,
+            (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) != 0, qpcpos);
+      IAudioCaptureClient_ReleaseBuffer (self->capture, n_frames);
+      if (FAILED (hr))
+        break;
+    }
+
+    if (FAILED (hr)) {
+      gchar *msg = gst_wasapi_util_hresult_to_string (hr);
+      GST_ERROR_OBJECT (self, "Failed to monitor: %s", msg);
+      g_free (msg);
+      g_mutex_lock (&self->lock);
+      self->failed = TRUE;
+      g_mutex_unlock (&self->lock);
+      SetEvent (self->ready_event);
+      break;
+    }
+  }
+
+  if (priority_handle != NULL)
+    gst_wasapi_util_revert_thread_characteristics (priority_handle);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static gboolean
+gst_wasapi_monitor_start (GstBaseSrc * bsrc)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (bsrc);
+  guint capture_period = 0, render_period = 0;
+  gchar *capture_id, *render_id;
+  gboolean ok;
+  HRESULT hr;
+
+  GST_OBJECT_LOCK (self);
+  capture_id = g_strdup (self->capture_device_id);
+  render_id = g_strdup (self->render_device_id);
+  gst_audio_info_set_format (&self->info, GST_AUDIO_FORMAT_F32, self->rate,
+      self->channels, NULL);
+  self->max_frames = MAX (gst_util_uint64_scale_int (self->buffer_time,
+          self->rate, G_USEC_PER_SEC), 1);
+  GST_OBJECT_UNLOCK (self);
+
+  ok = gst_wasapi_monitor_open_client (self, eCapture, capture_id,
+      &self->capture_device, &self->capture_client, &capture_period);
+  if (!ok) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+        ("Failed to open capture device %s", capture_id ? capture_id :
+            "default"));
+    goto failed;
+  }
+
+  ok = gst_wasapi_monitor_open_client (self, eRender, render_id,
+      &self->render_device, &self->render_client, &render_period);
+  if (!ok) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+        ("Failed to open render device %s", render_id ? render_id :
+            "default"));
+    goto failed;
+  }
+
+  hr = IAudioClient_SetEventHandle (self->capture_client, self->capture_event);
+  HR_FAILED_AND (hr, IAudioClient::SetEventHandle, goto open_failed);
+  hr = IAudioClient_SetEventHandle (self->render_client, self->render_event);
+  HR_FAILED_AND (hr, IAudioClient::SetEventHandle, goto open_failed);
+  hr = IAudioClient_GetBufferSize (self->render_client,
+      &self->render_buffer_frames);
+  HR_FAILED_AND (hr, IAudioClient::GetBufferSize, goto open_failed);
+  if (!gst_wasapi_util_get_capture_client (GST_ELEMENT (self),
+          self->capture_client, &self->capture) ||
+      !gst_wasapi_util_get_render_client (GST_ELEMENT (self),
+          self->render_client, &self->render))
+    goto open_failed;
+
+  self->packet_frames = MAX (capture_period, 1);
+  self->prefill_frames = MIN (MAX (render_period, 1),
+      self->render_buffer_frames / 2);
+  self->max_fill_frames = MIN (self->prefill_frames +
+      MAX_FILL_PACKETS * self->packet_frames, self->render_buffer_frames);
+  self->dropped_frames = 0;
+  self->discont = TRUE;
+
+  hr = IAudioClient_Start (self->capture_client);
+  HR_FAILED_AND (hr, IAudioClient::Start, goto open_failed);
+
+  GST_INFO_OBJECT (self, "monitoring %s on %s, capture period %u frames, "
+      "render period %u frames", capture_id ? capture_id : "default",
+      render_id ? render_id : "default", capture_period, render_period);
+
+  self->thread = g_thread_new ("wasapi-monitor",
+      gst_wasapi_monitor_thread_func, self);
+
+  g_free (capture_id);
+  g_free (render_id);
+
+  return TRUE;
+
+open_failed:
+  GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+      ("Failed to set up the clients"));
+failed:
+  gst_wasapi_monitor_close (self);
+  g_free (capture_id);
+  g_free (render_id);
+  return FALSE;
+}
+
+static gboolean
+gst_wasapi_monitor_stop (GstBaseSrc * bsrc)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (bsrc);
+
+  if (self->thread != NULL) {
+    SetEvent (self->stop_handle);
+    g_thread_join (self->thread);
+    self->thread = NULL;
+    ResetEvent (self->stop_handle);
+  }
+
+  if (self->dropped_frames > 0)
+    GST_INFO_OBJECT (self, "dropped %" G_GUINT64_FORMAT " frames to keep the "
+        "monitoring latency", self->dropped_frames);
+  gst_wasapi_monitor_close (self);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_monitor_query (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (bsrc);
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY) {
+    GstClockTime packet;
+
+    if (self->capture_client == NULL)
+      return FALSE;
+
+    /* A packet goes out once it is complete */
+    packet = gst_util_uint64_scale_int (self->packet_frames, GST_SECOND,
+        GST_AUDIO_INFO_RATE (&self->info));
+    gst_query_set_latency (query, TRUE, packet,
+        self->buffer_time * GST_USECOND);
+    return TRUE;
+  }
+
+  return GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+}
+
+static gboolean
+gst_wasapi_monitor_unlock (GstBaseSrc * bsrc)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (bsrc);
+
+  SetEvent (self->cancel_handle);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_monitor_unlock_stop (GstBaseSrc * bsrc)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (bsrc);
+
+  ResetEvent (self->cancel_handle);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_wasapi_monitor_create (GstPushSrc * psrc, GstBuffer ** outbuf)
+{
+  GstWasapiMonitor *self = GST_WASAPI_MONITOR (psrc);
+  HANDLE handles[2] = { self->ready_event, self->cancel_handle };
+  GstClock *clock;
+  GstClockTime base_time, pts;
+  GstBuffer *buf = NULL;
+  gboolean discont = FALSE, failed = FALSE;
+  guint rate = GST_AUDIO_INFO_RATE (&self->info);
+  guint n_frames;
+
+  while (buf == NULL) {
+    g_mutex_lock (&self->lock);
+    buf = g_queue_pop_head (&self->packets);
+    if (buf != NULL) {
+      self->queued_frames -= gst_buffer_get_size (buf) /
+          GST_AUDIO_INFO_BPF (&self->info);
+      discont = self->discont;
+      self->discont = FALSE;
+    }
+    failed = self->failed;
+    g_mutex_unlock (&self->lock);
+
+    if (buf == NULL && failed) {
+      GST_ELEMENT_ERROR (self, RESOURCE, READ, (NULL),
+          ("Failed to monitor the capture device"));
+      return GST_FLOW_ERROR;
+    }
+    if (buf == NULL && WaitForMultipleObjects (2, handles, FALSE,
+            INFINITE) == WAIT_OBJECT_0 + 1)
+      return GST_FLOW_FLUSHING;
+  }
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (clock == NULL)
+    clock = gst_system_clock_obtain ();
+  base_time = gst_element_get_base_time (GST_ELEMENT (self));
+  pts = gst_wasapi_util_qpc_to_clock_time (clock, GST_BUFFER_OFFSET (buf));
+  gst_object_unref (clock);
+
+  n_frames = gst_buffer_get_size (buf) / GST_AUDIO_INFO_BPF (&self->info);
+  GST_BUFFER_PTS (buf) = pts > base_time ? pts - base_time : 0;
+  GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (n_frames,
+      GST_SECOND, rate);
+  GST_BUFFER_OFFSET (buf) = GST_BUFFER_OFFSET_NONE;
+  if (discont)
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+
+  *outbuf = buf;
+  return GST_FLOW_OK;
+}
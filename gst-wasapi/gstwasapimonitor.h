@@ -0,0 +1,100 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_MONITOR_H__
+#define __GST_WASAPI_MONITOR_H__
+
+#include <gst/base/gstpushsrc.h>
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+#define GST_TYPE_WASAPI_MONITOR \
+  (gst_wasapi_monitor_get_type ())
+#define GST_WASAPI_MONITOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_WASAPI_MONITOR, GstWasapiMonitor))
+#define GST_WASAPI_MONITOR_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_WASAPI_MONITOR, GstWasapiMonitorClass))
+#define GST_IS_WASAPI_MONITOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_WASAPI_MONITOR))
+#define GST_IS_WASAPI_MONITOR_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_WASAPI_MONITOR))
+typedef struct _GstWasapiMonitor GstWasapiMonitor;
+typedef struct _GstWasapiMonitorClass GstWasapiMonitorClass;
+
+struct _GstWasapiMonitor
+{
+  GstPushSrc parent;
+
+  IMMDevice *capture_device;
+  IAudioClient *capture_client;
+  IAudioCaptureClient *capture;
+  HANDLE capture_event;
+  IMMDevice *render_device;
+  IAudioClient *render_client;
+  IAudioRenderClient *render;
+  /* Only because the client is event driven, the capture event paces both */
+  HANDLE render_event;
+  guint render_buffer_frames;
+  /* Silence written ahead of the first packet, and the most that may wait
+   * in the render client before frames get dropped */
+  guint prefill_frames;
+  guint max_fill_frames;
+  gboolean render_started;
+  guint64 dropped_frames;
+
+  GThread *thread;
+  /* Manual-reset, stops the monitor thread */
+  HANDLE stop_handle;
+  /* Signalled by the monitor thread for every packet, and by unlock() */
+  HANDLE ready_event;
+  HANDLE cancel_handle;
+
+  GstAudioInfo info;
+  guint packet_frames;
+  guint max_frames;
+
+  /* Protects the packets and the flags after them */
+  GMutex lock;
+  /* Captured packets for the src pad, OFFSET is the QPC position of the
+   * first frame */
+  GQueue packets;
+  guint queued_frames;
+  gboolean discont;
+  gboolean failed;
+
+  /* properties, under the object lock */
+  gchar *capture_device_id;
+  gchar *render_device_id;
+  gint rate;
+  gint channels;
+  gdouble gain;
+  gboolean monitor;
+  guint64 latency_time;
+  guint64 buffer_time;
+};
+
+struct _GstWasapiMonitorClass
+{
+  GstPushSrcClass parent_class;
+};
+
+GType gst_wasapi_monitor_get_type (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_MONITOR_H__ */
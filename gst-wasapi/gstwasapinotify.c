@@ -0,0 +1,238 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapinotify.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+typedef struct
+{
+  guint id;
+  const GstWasapiNotifyFuncs *funcs;
+  gpointer user_data;
+} GstWasapiNotifySubscriber;
+
+/* Protects everything below. Held while dispatching, so unsubscribing waits
+ * for the callbacks in flight. */
+static GMutex notify_lock;
+static IMMDeviceEnumerator *enumerator;
+/* Registered for the lifetime of the process once anyone subscribed, since
+ * unregistering from under a running callback can deadlock */
+static IMMNotificationClient notify_client;
+static gboolean registered;
+static GList *subscribers;
+static guint next_id = 1;
+
+#define DISPATCH(func, ...) \
+  G_STMT_START { \
+    g_mutex_lock (&notify_lock); \
+    for (GList * l = subscribers; l; l = l->next) { \
+      GstWasapiNotifySubscriber *sub = l->data; \
+      \
+      if (sub->funcs->func) \
+        sub->funcs->func (__VA_ARGS__, sub->user_data); \
+    } \
+    g_mutex_unlock (&notify_lock); \
+  } G_STMT_END
+
+static gchar *
+gst_wasapi_notify_id_to_utf8 (LPCWSTR wid)
+{
+  return wid ? g_utf16_to_utf8 (wid, -1, NULL, NULL, NULL) : NULL;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_notify_QueryInterface (IMMNotificationClient * This,
+    REFIID riid, void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IMMNotificationClient, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+/* Static, so no reference counting */
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_notify_AddRef (IMMNotificationClient * This)
+{
+  return 1;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_notify_Release (IMMNotificationClient * This)
+{
+  return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_notify_OnDeviceStateChanged (IMMNotificationClient * This,
+    LPCWSTR pwstrDeviceId, DWORD dwNewState)
+{
+  gchar *id = gst_wasapi_notify_id_to_utf8 (pwstrDeviceId);
+
+  DISPATCH (device_state_changed, id, dwNewState);
+  g_free (id);
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_notify_OnDeviceAdded (IMMNotificationClient * This,
+    LPCWSTR pwstrDeviceId)
+{
+  gchar *id = gst_wasapi_notify_id_to_utf8 (pwstrDeviceId);
+
+  DISPATCH (device_added, id);
+  g_free (id);
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_notify_OnDeviceRemoved (IMMNotificationClient * This,
+    LPCWSTR pwstrDeviceId)
+{
+  gchar *id = gst_wasapi_notify_id_to_utf8 (pwstrDeviceId);
+
+  DISPATCH (device_removed, id);
+  g_free (id);
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_notify_OnDefaultDeviceChanged (IMMNotificationClient * This,
+    EDataFlow flow, ERole role, LPCWSTR pwstrDeviceId)
+{
+  gchar *id = gst_wasapi_notify_id_to_utf8 (pwstrDeviceId);
+
+  GST_INFO ("default device changed to %s", GST_STR_NULL (id));
+  DISPATCH (default_device_changed, flow, role, id);
+  g_free (id);
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_notify_OnPropertyValueChanged (IMMNotificationClient * This,
+    LPCWSTR pwstrDeviceId, const PROPERTYKEY key)
+{
+  gchar *id = gst_wasapi_notify_id_to_utf8 (pwstrDeviceId);
+
+  DISPATCH (property_value_changed, id, &key);
+  g_free (id);
+  return S_OK;
+}
+
+#undef DISPATCH
+
+static CONST_VTBL IMMNotificationClientVtbl notify_client_vtbl = {
+  .QueryInterface = gst_wasapi_notify_QueryInterface,
+  .AddRef = gst_wasapi_notify_AddRef,
+  .Release = gst_wasapi_notify_Release,
+  .OnDeviceStateChanged = gst_wasapi_notify_OnDeviceStateChanged,
+  .OnDeviceAdded = gst_wasapi_notify_OnDeviceAdded,
+  .OnDeviceRemoved = gst_wasapi_notify_OnDeviceRemoved,
+  .OnDefaultDeviceChanged = gst_wasapi_notify_OnDefaultDeviceChanged,
+  .OnPropertyValueChanged = gst_wasapi_notify_OnPropertyValueChanged,
+};
+
+/* With notify_lock */
+static gboolean
+gst_wasapi_notify_ensure_enumerator (GstElement * self)
+{
+  HRESULT hr;
+
+  if (enumerator != NULL)
+    return TRUE;
+
+  hr = CoCreateInstance (&CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
+      &IID_IMMDeviceEnumerator, (void **) &enumerator);
+  HR_FAILED_RET (hr, CoCreateInstance (MMDeviceEnumerator), FALSE);
+
+  return TRUE;
+}
+
+IMMDeviceEnumerator *
+gst_wasapi_notify_get_enumerator (GstElement * self)
+{
+  IMMDeviceEnumerator *ret = NULL;
+
+  g_mutex_lock (&notify_lock);
+  if (gst_wasapi_notify_ensure_enumerator (self)) {
+    ret = enumerator;
+    IUnknown_AddRef (ret);
+  }
+  g_mutex_unlock (&notify_lock);
+
+  return ret;
+}
+
+guint
+gst_wasapi_notify_subscribe (GstElement * self,
+    const GstWasapiNotifyFuncs * funcs, gpointer user_data)
+{
+  GstWasapiNotifySubscriber *sub;
+  guint id = 0;
+  HRESULT hr;
+
+  g_mutex_lock (&notify_lock);
+
+  if (!gst_wasapi_notify_ensure_enumerator (self))
+    goto out;
+
+  if (!registered) {
+    notify_client.lpVtbl = &notify_client_vtbl;
+    hr = IMMDeviceEnumerator_RegisterEndpointNotificationCallback (enumerator,
+        &notify_client);
+    HR_FAILED_AND (hr,
+        IMMDeviceEnumerator::RegisterEndpointNotificationCallback, goto out);
+    registered = TRUE;
+  }
+
+  sub = g_slice_new (GstWasapiNotifySubscriber);
+  sub->id = id = next_id++;
+  sub->funcs = funcs;
+  sub->user_data = user_data;
+  subscribers = g_list_prepend (subscribers, sub);
+
+out:
+  g_mutex_unlock (&notify_lock);
+  return id;
+}
+
+void
+gst_wasapi_notify_unsubscribe (guint id)
+{
+  GList *l;
+
+  g_mutex_lock (&notify_lock);
+  for (l = subscribers; l; l = l->next) {
+    GstWasapiNotifySubscriber *sub = l->data;
+
+    if (sub->id == id) {
+      subscribers = g_list_delete_link (subscribers, l);
+      g_slice_free (GstWasapiNotifySubscriber, sub);
+      break;
+    }
+  }
+  g_mutex_unlock (&notify_lock);
+}
@@ -0,0 +1,56 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_NOTIFY_H__
+#define __GST_WASAPI_NOTIFY_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Process-wide IMMDeviceEnumerator and endpoint notifications.
+ *
+ * The enumerator is only activated once. A single IMMNotificationClient is
+ * registered with it on the first subscription, and every event is handed
+ * to all subscribers, with the endpoint id in UTF-8 (maybe NULL). The
+ * callbacks are called from the notification thread of COM: they must not
+ * block, and must not subscribe or unsubscribe. Unset ones are skipped. */
+typedef struct
+{
+  void (*device_state_changed) (const gchar * id, DWORD state,
+      gpointer user_data);
+  void (*device_added) (const gchar * id, gpointer user_data);
+  void (*device_removed) (const gchar * id, gpointer user_data);
+  void (*default_device_changed) (EDataFlow flow, ERole role,
+      const gchar * id, gpointer user_data);
+  void (*property_value_changed) (const gchar * id, const PROPERTYKEY * key,
+      gpointer user_data);
+} GstWasapiNotifyFuncs;
+
+/* A new reference to the enumerator, NULL on errors */
+IMMDeviceEnumerator *gst_wasapi_notify_get_enumerator (GstElement * element);
+
+/* 0 if notifications are not available. @funcs must stay valid until
+ * unsubscribed. */
+guint gst_wasapi_notify_subscribe (GstElement * element,
+    const GstWasapiNotifyFuncs * funcs, gpointer user_data);
+
+/* No callback of @id runs anymore once this returns */
+void gst_wasapi_notify_unsubscribe (guint id);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_NOTIFY_H__ */
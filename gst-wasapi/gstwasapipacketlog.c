@@ -0,0 +1,209 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapipacketlog.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Records handed to the writer thread at once, about 10 s of packets */
+#define CHUNK_RECORDS 1024
+
+G_STATIC_ASSERT (sizeof (GstWasapiPacketLogHeader) == 24);
+G_STATIC_ASSERT (sizeof (GstWasapiPacketRecord) == 32);
+
+typedef struct
+{
+  guint n_records;
+  GstWasapiPacketRecord records[CHUNK_RECORDS];
+} GstWasapiPacketChunk;
+
+struct _GstWasapiPacketLog
+{
+  FILE *file;
+  gchar *path;
+  GThread *thread;
+  /* Full chunks to the writer, written ones back */
+  GAsyncQueue *full;
+  GAsyncQueue *empty;
+  /* Being filled by add() */
+  GstWasapiPacketChunk *chunk;
+  guint64 n_records;
+  guint64 n_lost;
+};
+
+/* Pushed to tell the writer thread to stop */
+static GstWasapiPacketChunk quit_chunk;
+
+static gpointer
+gst_wasapi_packet_log_thread_func (gpointer user_data)
+{
+  GstWasapiPacketLog *self = user_data;
+  GstWasapiPacketChunk *chunk;
+
+  while ((chunk = g_async_queue_pop (self->full)) != &quit_chunk) {
+    if (fwrite (chunk->records, sizeof (GstWasapiPacketRecord),
+            chunk->n_records, self->file) != chunk->n_records)
+      GST_WARNING ("can't write packet log %s", self->path);
+    chunk->n_records = 0;
+    g_async_queue_push (self->empty, chunk);
+  }
+
+  return NULL;
+}
+
+GstWasapiPacketLog *
+gst_wasapi_packet_log_new (const gchar * path, const WAVEFORMATEX * format)
+{
+  GstWasapiPacketLog *self;
+  GstWasapiPacketLogHeader header;
+  FILE *file;
+
+  file = g_fopen (path, "wb");
+  if (file == NULL) {
+    GST_WARNING ("can't create packet log %s", path);
+    return NULL;
+  }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, GST_WASAPI_PACKET_LOG_MAGIC, 4);
+  header.version = GST_WASAPI_PACKET_LOG_VERSION;
+  header.rate = format->nSamplesPerSec;
+  header.channels = format->nChannels;
+  header.bpf = format->nBlockAlign;
+  if (fwrite (&header, sizeof (header), 1, file) != 1) {
+    GST_WARNING ("can't write packet log %s", path);
+    fclose (file);
+    return NULL;
+  }
+
+  self = g_slice_new0 (GstWasapiPacketLog);
+  self->file = file;
+  self->path = g_strdup (path);
+  self->full = g_async_queue_new ();
+  self->empty = g_async_queue_new_full (g_free);
+  /* Two spare, the writer never holds up add() for long */
+  g_async_queue_push (self->empty, g_new0 (GstWasapiPacketChunk, 1));
+  g_async_queue_push (self->empty, g_new0 (GstWasapiPacketChunk, 1));
+  self->chunk = g_new0 (GstWasapiPacketChunk, 1);
+  self->thread = g_thread_new ("wasapi-packet-log",
+      gst_wasapi_packet_log_thread_func, self);
+
+  GST_INFO ("logging packets to %s", path);
+
+  return self;
+}
+
+void
+gst_wasapi_packet_log_free (GstWasapiPacketLog * self)
+{
+  if (self->chunk->n_records > 0)
+    g_async_queue_push (self->full, self->chunk);
+  else
+    g_free (self->chunk);
+  g_async_queue_push (self->full, &quit_chunk);
+  g_thread_join (self->thread);
+
+  fclose (self->file);
+  GST_INFO ("logged %" G_GUINT64_FORMAT " packets to %s, lost %"
+      G_GUINT64_FORMAT, self->n_records, self->path, self->n_lost);
+
+  g_async_queue_unref (self->full);
+  g_async_queue_unref (self->empty);
+  g_free (self->path);
+  g_slice_free (GstWasapiPacketLog, self);
+}
+
+void
+gst_wasapi_packet_log_add (GstWasapiPacketLog * self, guint64 qpcpos,
+    guint64 devpos, guint32 frames, guint32 flags, guint32 wait_us)
+{
+  GstWasapiPacketRecord *record;
+
+  if (self->chunk == NULL) {
+    /* The disk can't keep up, don't wait for it */
+    self->chunk = g_async_queue_try_pop (self->empty);
+    if (self->chunk == NULL) {
+      self->n_lost++;
+      return;
+    }
+  }
+
+  record = &self->chunk->records[self->chunk->n_records++];
+  record->qpcpos = qpcpos;
+  record->devpos = devpos;
+  record->frames = frames;
+  record->flags = flags;
+  record->wait_us = wait_us;
+  record->reserved = 0;
+  self->n_records++;
+
+  if (self->chunk->n_records == CHUNK_RECORDS) {
+    g_async_queue_push (self->full, self->chunk);
+    self->chunk = g_async_queue_try_pop (self->empty);
+  }
+}
+
+GstWasapiPacketRecord *
+gst_wasapi_packet_log_load (const gchar * path,
+    GstWasapiPacketLogHeader * header, guint * n_records)
+{
+  gchar *contents;
+  gsize length, n;
+  GstWasapiPacketRecord *records;
+  GError *err = NULL;
+
+  if (!g_file_get_contents (path, &contents, &length, &err)) {
+    GST_WARNING ("can't read packet log: %s", err->message);
+    g_clear_error (&err);
+    return NULL;
+  }
+
+  if (length < sizeof (GstWasapiPacketLogHeader) ||
+      memcmp (contents, GST_WASAPI_PACKET_LOG_MAGIC, 4) != 0 ||
+      ((GstWasapiPacketLogHeader *) contents)->version !=
+      GST_WASAPI_PACKET_LOG_VERSION) {
+    GST_WARNING ("%s is not a packet log", path);
+    g_free (contents);
+    return NULL;
+  }
+
+  memcpy (header, contents, sizeof (GstWasapiPacketLogHeader));
+  n = (length - sizeof (GstWasapiPacketLogHeader)) /
+      sizeof (GstWasapiPacketRecord);
+  if (n == 0 || header->rate == 0 || header->channels == 0) {
+    GST_WARNING ("packet log %s is empty", path);
+    g_free (contents);
+    return NULL;
+  }
+
+  records = g_memdup (contents + sizeof (GstWasapiPacketLogHeader),
+      n * sizeof (GstWasapiPacketRecord));
+  g_free (contents);
+  *n_records = n;
+
+  return records;
+}
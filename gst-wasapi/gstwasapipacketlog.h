@@ -0,0 +1,77 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_PACKET_LOG_H__
+#define __GST_WASAPI_PACKET_LOG_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Compact binary log of the packets wasapisrc got from the device, to
+ * reproduce a capture's timing with the replay of the fake endpoints (see
+ * gstwasapifake.h).
+ *
+ * The file is a GstWasapiPacketLogHeader followed by one
+ * GstWasapiPacketRecord per packet, both in the byte order of the machine
+ * that wrote them, i.e. little endian on Windows. */
+#define GST_WASAPI_PACKET_LOG_MAGIC "GWPL"
+#define GST_WASAPI_PACKET_LOG_VERSION 1
+
+typedef struct
+{
+  gchar magic[4];
+  guint32 version;
+  guint32 rate;
+  guint32 channels;
+  guint32 bpf;
+  guint32 reserved;
+} GstWasapiPacketLogHeader;
+
+typedef struct
+{
+  /* QPC position of the first frame, in 100 ns, and device position */
+  guint64 qpcpos;
+  guint64 devpos;
+  guint32 frames;
+  guint32 flags;
+  /* How long the read thread waited for the wakeup this packet came with,
+   * 0 for those drained after the first */
+  guint32 wait_us;
+  guint32 reserved;
+} GstWasapiPacketRecord;
+
+typedef struct _GstWasapiPacketLog GstWasapiPacketLog;
+
+/* Starts writing to @path, NULL if it can't be created. The file is written
+ * by a thread of its own, add() only copies the record. */
+GstWasapiPacketLog *gst_wasapi_packet_log_new (const gchar * path,
+    const WAVEFORMATEX * format);
+
+/* Writes what is left and closes the file */
+void gst_wasapi_packet_log_free (GstWasapiPacketLog * log);
+
+void gst_wasapi_packet_log_add (GstWasapiPacketLog * log, guint64 qpcpos,
+    guint64 devpos, guint32 frames, guint32 flags, guint32 wait_us);
+
+/* Reads the log at @path, NULL if it isn't one. Free with g_free(). */
+GstWasapiPacketRecord *gst_wasapi_packet_log_load (const gchar * path,
+    GstWasapiPacketLogHeader * header, guint * n_records);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_PACKET_LOG_H__ */
@@ -0,0 +1,105 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiprocessloopback.h"
+#include "gstaudioclientactivationparams.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+GType
+gst_wasapi_target_mode_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_TARGET_MODE_INCLUDE, "Only the process and its children",
+        "include"},
+    {GST_WASAPI_TARGET_MODE_EXCLUDE,
+        "Everything but the process and its children", "exclude"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiTargetMode", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+gboolean
+gst_wasapi_process_loopback_activate (GstElement * self, guint pid,
+    GstWasapiTargetMode mode, IAudioClient ** ret_client)
+{
+  AUDIOCLIENT_ACTIVATION_PARAMS params = { 0, };
+  PROPVARIANT var;
+
+  params.ActivationType = AUDIOCLIENT_ACTIVATION_TYPE_PROCESS_LOOPBACK;
+  params.ProcessLoopbackParams.TargetProcessId = pid;
+  params.ProcessLoopbackParams.ProcessLoopbackMode =
+      mode == GST_WASAPI_TARGET_MODE_EXCLUDE ?
+      PROCESS_LOOPBACK_MODE_EXCLUDE_TARGET_PROCESS_TREE :
+      PROCESS_LOOPBACK_MODE_INCLUDE_TARGET_PROCESS_TREE;
+
+  /* Points to our params, so no PropVariantClear() */
+  PropVariantInit (&var);
+  var.vt = VT_BLOB;
+  var.blob.cbSize = sizeof (params);
+  var.blob.pBlobData = (BYTE *) & params;
+
+  if (!gst_wasapi_util_activate_async (self,
+          VIRTUAL_AUDIO_DEVICE_PROCESS_LOOPBACK, &IID_IAudioClient, &var,
+          ret_client))
+    return FALSE;
+
+  GST_INFO_OBJECT (self, "capturing %s process %u and its children",
+      mode == GST_WASAPI_TARGET_MODE_EXCLUDE ? "everything but" : "only", pid);
+
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_process_loopback_initialize (GstElement * self,
+    GstAudioRingBufferSpec * spec, IAudioClient * client,
+    WAVEFORMATEX * format, guint * ret_devicep_frames)
+{
+  guint rate = GST_AUDIO_INFO_RATE (&spec->info);
+  HRESULT hr;
+
+  /* Always shared, through the engine, which converts the mix of the
+   * processes to whatever we ask for */
+  hr = IAudioClient_Initialize (client, AUDCLNT_SHAREMODE_SHARED,
+      AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK |
+      AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+      AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY, spec->buffer_time * 10, 0,
+      format, NULL);
+  HR_FAILED_RET (hr, IAudioClient::Initialize, FALSE);
+
+  /* There is no GetDevicePeriod() to ask */
+  *ret_devicep_frames = (guint) gst_util_uint64_scale_int (spec->latency_time,
+      rate, G_USEC_PER_SEC);
+
+  return TRUE;
+}
@@ -0,0 +1,57 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_PROCESS_LOOPBACK_H__
+#define __GST_WASAPI_PROCESS_LOOPBACK_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Loopback capture of a process tree instead of a whole endpoint, with
+ * target-pid on wasapisrc. Windows 10 2004 and newer.
+ *
+ * These clients come from ActivateAudioInterfaceAsync() on the process
+ * loopback virtual device. They only run in shared mode and know neither
+ * the mix format nor the device period, so the caller brings the format of
+ * the endpoint and the engine converts to it. */
+
+/* Mirrors PROCESS_LOOPBACK_MODE */
+typedef enum
+{
+  GST_WASAPI_TARGET_MODE_INCLUDE,
+  GST_WASAPI_TARGET_MODE_EXCLUDE
+} GstWasapiTargetMode;
+
+#define GST_WASAPI_TYPE_TARGET_MODE (gst_wasapi_target_mode_get_type ())
+GType gst_wasapi_target_mode_get_type (void);
+
+/* Activates a client capturing process @pid and its children, or all
+ * processes but those with the exclude mode. Waits for the activation to
+ * complete. */
+gboolean gst_wasapi_process_loopback_activate (GstElement * element,
+    guint pid, GstWasapiTargetMode mode, IAudioClient ** ret_client);
+
+/* Initializes a client of activate() for capturing @format, events come
+ * once per engine period, segments are latency-time long */
+gboolean gst_wasapi_process_loopback_initialize (GstElement * element,
+    GstAudioRingBufferSpec * spec, IAudioClient * client,
+    WAVEFORMATEX * format, guint * ret_devicep_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_PROCESS_LOOPBACK_H__ */
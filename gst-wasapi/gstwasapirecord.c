@@ -0,0 +1,493 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapirecord.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+G_STATIC_ASSERT (G_STRUCT_OFFSET (GstWasapiRecordHeader, n_frames) == 48);
+G_STATIC_ASSERT (sizeof (GstWasapiRecordIndex) == 32);
+
+/* Mapped at once, so keep it well within a 32 bit address space */
+#define MAX_FILE_SIZE (G_GUINT64_CONSTANT (1) << 30)
+
+/* Index entries beyond one a second, for discontinuities */
+#define EXTRA_INDEX 4096
+
+/* How long to wait before trying to create a file again */
+#define RETRY_INTERVAL G_TIME_SPAN_SECOND
+
+typedef struct
+{
+  gchar *path;
+  HANDLE file;
+  HANDLE mapping;
+  GstWasapiRecordHeader *header;
+  GstWasapiRecordIndex *index;
+  guint8 *data;
+} GstWasapiRecordFile;
+
+struct _GstWasapiRecord
+{
+  gchar *location;
+  GstWasapiRecordHeader templ;
+  guint64 file_frames;
+  guint64 file_size;
+
+  GThread *thread;
+  GMutex lock;
+  GCond cond;
+  /* PROTECTED by lock. Created ahead by the thread, and those it has to
+   * finish. */
+  GstWasapiRecordFile *next;
+  GQueue done;
+  gboolean quit;
+
+  /* Number of the newest file. Thread only, once it runs. */
+  guint sequence;
+
+  /* Write only */
+  GstWasapiRecordFile *current;
+  guint64 expected_devpos;
+  guint64 last_index_frame;
+  guint64 lost_frames;
+};
+
+/* Copies @location into @path, if not NULL, with @sequence for its
+ * directive. FALSE for anything is_valid() rejects. */
+static gboolean
+gst_wasapi_record_expand (const gchar * location, guint sequence,
+    GString * path, gboolean * has_directive)
+{
+  const gchar *p;
+
+  *has_directive = FALSE;
+
+  for (p = location; *p != '\0'; p++) {
+    gboolean zero = FALSE;
+    guint width = 0;
+
+    if (*p != '%') {
+      if (path != NULL)
+        g_string_append_c (path, *p);
+      continue;
+    }
+
+    p++;
+    if (*p == '%') {
+      if (path != NULL)
+        g_string_append_c (path, '%');
+      continue;
+    }
+
+    if (*p == '0') {
+      zero = TRUE;
+      p++;
+    }
+    for (; g_ascii_isdigit (*p); p++) {
+      width = width * 10 + (*p - '0');
+      /* Nothing sensible needs more */
+      if (width > 20)
+        return FALSE;
+    }
+
+    if ((*p != 'd' && *p != 'u') || *has_directive)
+      return FALSE;
+    *has_directive = TRUE;
+
+    if (path != NULL)
+      g_string_append_printf (path, zero ? "%0*u" : "%*u", width, sequence);
+  }
+
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_record_location_is_valid (const gchar * location)
+{
+  gboolean has_directive;
+
+  return location == NULL ||
+      gst_wasapi_record_expand (location, 0, NULL, &has_directive);
+}
+
+static gchar *
+gst_wasapi_record_get_path (const gchar * location, guint sequence)
+{
+  GString *path = g_string_new (NULL);
+  gboolean has_directive;
+
+  /* Checked when it was set */
+  if (!gst_wasapi_record_expand (location, sequence, path, &has_directive))
+    g_return_val_if_reached (g_string_free (path, TRUE));
+
+  if (!has_directive && sequence > 0)
+    g_string_append_printf (path, ".%u", sequence);
+
+  return g_string_free (path, FALSE);
+}
+
+static GstWasapiRecordFile *
+gst_wasapi_record_open_file (GstWasapiRecord * self, guint sequence)
+{
+  GstWasapiRecordFile *file;
+  gunichar2 *wpath;
+  HANDLE handle, mapping;
+  gpointer view;
+  gchar *path;
+
+  path = gst_wasapi_record_get_path (self->location, sequence);
+  wpath = g_utf8_to_utf16 (path, -1, NULL, NULL, NULL);
+  if (wpath == NULL) {
+    GST_WARNING ("invalid record location %s", path);
+    g_free (path);
+    return NULL;
+  }
+
+  /* Others may read while we record */
+  handle = CreateFileW ((LPCWSTR) wpath, GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  g_free (wpath);
+  if (handle == INVALID_HANDLE_VALUE) {
+    GST_WARNING ("can't create %s: %lu", path, GetLastError ());
+    g_free (path);
+    return NULL;
+  }
+
+  /* Also extends the file to its full size */
+  mapping = CreateFileMappingW (handle, NULL, PAGE_READWRITE,
+      (DWORD) (self->file_size >> 32), (DWORD) self->file_size, NULL);
+  view = mapping ? MapViewOfFile (mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+      (SIZE_T) self->file_size) : NULL;
+  if (view == NULL) {
+    GST_WARNING ("can't map %s: %lu", path, GetLastError ());
+    if (mapping != NULL)
+      CloseHandle (mapping);
+    CloseHandle (handle);
+    g_free (path);
+    return NULL;
+  }
+
+  file = g_slice_new0 (GstWasapiRecordFile);
+  file->path = path;
+  file->file = handle;
+  file->mapping = mapping;
+  file->header = view;
+  file->index = (GstWasapiRecordIndex *) ((guint8 *) view +
+      self->templ.index_offset);
+  file->data = (guint8 *) view + self->templ.data_offset;
+
+  *file->header = self->templ;
+  file->header->sequence = sequence;
+
+  GST_INFO ("recording to %s", path);
+
+  return file;
+}
+
+/* Flushes @file and cuts it to what was written */
+static void
+gst_wasapi_record_close_file (GstWasapiRecord * self,
+    GstWasapiRecordFile * file)
+{
+  LARGE_INTEGER size;
+
+  size.QuadPart = self->templ.data_offset +
+      file->header->n_frames * self->templ.bpf;
+
+  FlushViewOfFile (file->header, 0);
+  UnmapViewOfFile (file->header);
+  CloseHandle (file->mapping);
+
+  if (!SetFilePointerEx (file->file, size, NULL, FILE_BEGIN) ||
+      !SetEndOfFile (file->file))
+    GST_WARNING ("can't truncate %s: %lu", file->path, GetLastError ());
+  FlushFileBuffers (file->file);
+  CloseHandle (file->file);
+
+  GST_INFO ("finished %s, %" G_GINT64_FORMAT " bytes", file->path,
+      (gint64) size.QuadPart);
+
+  g_free (file->path);
+  g_slice_free (GstWasapiRecordFile, file);
+}
+
+/* For the file created ahead that was never written to */
+static void
+gst_wasapi_record_discard_file (GstWasapiRecordFile * file)
+{
+  gunichar2 *wpath;
+
+  UnmapViewOfFile (file->header);
+  CloseHandle (file->mapping);
+  CloseHandle (file->file);
+
+  wpath = g_utf8_to_utf16 (file->path, -1, NULL, NULL, NULL);
+  if (!DeleteFileW ((LPCWSTR) wpath))
+    GST_WARNING ("can't delete %s: %lu", file->path, GetLastError ());
+  g_free (wpath);
+
+  g_free (file->path);
+  g_slice_free (GstWasapiRecordFile, file);
+}
+
+static gpointer
+gst_wasapi_record_thread_func (gpointer user_data)
+{
+  GstWasapiRecord *self = user_data;
+  GstWasapiRecordFile *file;
+  gint64 retry = 0;
+
+  g_mutex_lock (&self->lock);
+  while (TRUE) {
+    if ((file = g_queue_pop_head (&self->done)) != NULL) {
+      g_mutex_unlock (&self->lock);
+      gst_wasapi_record_close_file (self, file);
+      g_mutex_lock (&self->lock);
+      continue;
+    }
+
+    if (self->quit)
+      break;
+
+    if (self->next == NULL && g_get_monotonic_time () >= retry) {
+      g_mutex_unlock (&self->lock);
+      file = gst_wasapi_record_open_file (self, self->sequence + 1);
+      g_mutex_lock (&self->lock);
+      if (file != NULL) {
+        self->sequence++;
+        self->next = file;
+      } else {
+        retry = g_get_monotonic_time () + RETRY_INTERVAL;
+      }
+      continue;
+    }
+
+    if (self->next == NULL)
+      g_cond_wait_until (&self->cond, &self->lock, retry);
+    else
+      g_cond_wait (&self->cond, &self->lock);
+  }
+
+  file = self->next;
+  self->next = NULL;
+  g_mutex_unlock (&self->lock);
+
+  /* Its number is free again */
+  if (file != NULL) {
+    gst_wasapi_record_discard_file (file);
+    self->sequence--;
+  }
+
+  return NULL;
+}
+
+GstWasapiRecord *
+gst_wasapi_record_new (const gchar * location, const WAVEFORMATEX * format,
+    guint64 max_size, GstClockTime max_time, guint sequence)
+{
+  GstWasapiRecord *self;
+  GstWasapiRecordHeader *templ;
+  guint64 frames, data_offset;
+  guint index_capacity;
+
+  if (max_size == 0 || max_size > MAX_FILE_SIZE)
+    max_size = MAX_FILE_SIZE;
+
+  /* The index is sized for the most frames a file could hold */
+  frames = max_size / format->nBlockAlign;
+  if (max_time != 0)
+    frames = MIN (frames, gst_util_uint64_scale_int_ceil (max_time,
+            format->nSamplesPerSec, GST_SECOND));
+  index_capacity = frames / format->nSamplesPerSec + 1 + EXTRA_INDEX;
+  data_offset = GST_ROUND_UP_N (sizeof (GstWasapiRecordHeader) +
+      (guint64) index_capacity * sizeof (GstWasapiRecordIndex), 4096);
+  if (data_offset + format->nBlockAlign > max_size) {
+    GST_WARNING ("record-max-size of %" G_GUINT64_FORMAT " bytes is too "
+        "small", max_size);
+    return NULL;
+  }
+  frames = MIN (frames, (max_size - data_offset) / format->nBlockAlign);
+
+  self = g_slice_new0 (GstWasapiRecord);
+  self->location = g_strdup (location);
+  self->file_frames = frames;
+  self->file_size = data_offset + frames * format->nBlockAlign;
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->done);
+
+  templ = &self->templ;
+  memcpy (templ->magic, GST_WASAPI_RECORD_MAGIC, sizeof (templ->magic));
+  templ->version = GST_WASAPI_RECORD_VERSION;
+  templ->rate = format->nSamplesPerSec;
+  templ->channels = format->nChannels;
+  templ->bpf = format->nBlockAlign;
+  templ->bits = format->wBitsPerSample;
+  templ->format_tag = format->wFormatTag;
+  if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+    WAVEFORMATEXTENSIBLE *ext = (WAVEFORMATEXTENSIBLE *) format;
+
+    templ->format_tag = IsEqualGUID (&ext->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) ? WAVE_FORMAT_IEEE_FLOAT :
+        WAVE_FORMAT_PCM;
+    templ->channel_mask = ext->dwChannelMask;
+  }
+  templ->index_offset = sizeof (GstWasapiRecordHeader);
+  templ->index_capacity = index_capacity;
+  templ->data_offset = data_offset;
+
+  /* The first one right away, so a bad location shows */
+  self->sequence = sequence;
+  self->current = gst_wasapi_record_open_file (self, sequence);
+  if (self->current == NULL) {
+    gst_wasapi_record_free (self);
+    return NULL;
+  }
+  self->expected_devpos = G_MAXUINT64;
+
+  self->thread = g_thread_new ("wasapi-record",
+      gst_wasapi_record_thread_func, self);
+
+  return self;
+}
+
+guint
+gst_wasapi_record_free (GstWasapiRecord * self)
+{
+  guint sequence;
+
+  if (self->thread != NULL) {
+    g_mutex_lock (&self->lock);
+    if (self->current != NULL)
+      g_queue_push_tail (&self->done, self->current);
+    self->current = NULL;
+    self->quit = TRUE;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->lock);
+    g_thread_join (self->thread);
+  }
+
+  if (self->current != NULL)
+    gst_wasapi_record_close_file (self, self->current);
+  if (self->lost_frames > 0)
+    GST_WARNING ("%" G_GUINT64_FORMAT " frames were not recorded",
+        self->lost_frames);
+
+  sequence = self->sequence + 1;
+
+  g_queue_clear (&self->done);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->lock);
+  g_free (self->location);
+  g_slice_free (GstWasapiRecord, self);
+
+  return sequence;
+}
+
+/* Hands the full file to the thread and takes the next one, if it's
+ * ready */
+static gboolean
+gst_wasapi_record_rotate (GstWasapiRecord * self)
+{
+  g_mutex_lock (&self->lock);
+  if (self->current != NULL)
+    g_queue_push_tail (&self->done, self->current);
+  self->current = self->next;
+  self->next = NULL;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  /* The first packet in a file always gets an entry */
+  self->expected_devpos = G_MAXUINT64;
+  self->last_index_frame = 0;
+
+  return self->current != NULL;
+}
+
+void
+gst_wasapi_record_write (GstWasapiRecord * self, const guint8 * data,
+    guint n_frames, guint64 qpcpos, guint64 devpos, guint32 flags)
+{
+  GstWasapiRecordFile *file;
+  GstWasapiRecordHeader *header;
+  guint bpf = self->templ.bpf, rate = self->templ.rate;
+  guint64 written;
+  guint n;
+
+  if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
+    data = NULL;
+
+  while (n_frames > 0) {
+    file = self->current;
+    if (file == NULL || file->header->n_frames == self->file_frames ||
+        file->header->n_index == self->templ.index_capacity) {
+      if (!gst_wasapi_record_rotate (self)) {
+        if (self->lost_frames == 0)
+          GST_WARNING ("next recording file isn't ready, dropping frames");
+        self->lost_frames += n_frames;
+        return;
+      }
+      file = self->current;
+    }
+    header = file->header;
+    written = header->n_frames;
+
+    if (devpos != self->expected_devpos ||
+        (flags & (AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY |
+                AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) ||
+        written - self->last_index_frame >= rate) {
+      GstWasapiRecordIndex *entry = &file->index[header->n_index];
+
+      entry->frame = written;
+      entry->qpcpos = qpcpos;
+      entry->devpos = devpos;
+      entry->flags = flags;
+      entry->reserved = 0;
+      MemoryBarrier ();
+      header->n_index++;
+      self->last_index_frame = written;
+    }
+
+    n = (guint) MIN (n_frames, self->file_frames - written);
+    if (data != NULL) {
+      memcpy (file->data + written * bpf, data, (gsize) n * bpf);
+      data += (gsize) n * bpf;
+    } else {
+      memset (file->data + written * bpf, 0, (gsize) n * bpf);
+    }
+
+    /* After the data, also atomic for 32 bit builds */
+    InterlockedExchange64 ((volatile LONG64 *) & header->n_frames,
+        written + n);
+
+    n_frames -= n;
+    devpos += n;
+    qpcpos += gst_util_uint64_scale_int (n, 10000000, rate);
+    self->expected_devpos = devpos;
+    /* Only the first part of a packet carries its flags */
+    flags &= AUDCLNT_BUFFERFLAGS_SILENT;
+  }
+}
@@ -0,0 +1,106 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_RECORD_H__
+#define __GST_WASAPI_RECORD_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Raw recording of wasapisrc with record-location, written straight from
+ * the packets in the read path.
+ *
+ * Each file is created at its full size and mapped, so writing a packet
+ * is a copy into the mapping. It holds a GstWasapiRecordHeader, an index
+ * of index_capacity GstWasapiRecordIndex entries at index_offset and the
+ * frames in the mix format and device channel order at data_offset. An
+ * index entry is added for the first packet, once a second, and for every
+ * packet that doesn't simply continue the last one: after a discontinuity
+ * or a timestamp error, or when the device position jumped because frames
+ * were lost. Those frames are not in the file.
+ *
+ * n_frames and n_index are only advanced once the data they cover is in
+ * the mapping. The header is therefore valid after a crash of the
+ * process. A file is full after max-size bytes or max-time of audio.
+ * Recording then goes on in the next file, which a thread of its own
+ * created ahead of time. That thread also flushes finished files and cuts
+ * them to what was written. Little endian, like the machine. */
+#define GST_WASAPI_RECORD_MAGIC "GWRC"
+#define GST_WASAPI_RECORD_VERSION 1
+
+typedef struct
+{
+  gchar magic[4];
+  guint32 version;
+  guint32 rate;
+  guint32 channels;
+  guint32 bpf;
+  /* WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT */
+  guint32 format_tag;
+  guint32 bits;
+  guint32 channel_mask;
+  guint32 index_offset;
+  guint32 index_capacity;
+  guint64 data_offset;
+  volatile guint64 n_frames;
+  volatile guint32 n_index;
+  /* Number of this file in the recording, from 0 */
+  guint32 sequence;
+} GstWasapiRecordHeader;
+
+typedef struct
+{
+  /* Frame in this file, and the QPC position (100 ns) and device position
+   * it was captured at */
+  guint64 frame;
+  guint64 qpcpos;
+  guint64 devpos;
+  /* AUDCLNT_BUFFERFLAGS_* of the packet */
+  guint32 flags;
+  guint32 reserved;
+} GstWasapiRecordIndex;
+
+typedef struct _GstWasapiRecord GstWasapiRecord;
+
+/* Whether @location is a valid record location: at most one %d or %u
+ * directive, with an optional zero padded width like %05d, and %% for a
+ * percent sign. No other directives, the location is never used as a
+ * printf format. */
+gboolean gst_wasapi_record_location_is_valid (const gchar * location);
+
+/* Starts recording @format into @location, with file number @sequence.
+ * The file number replaces the directive in @location, like %05d, else
+ * files after the first get it appended as ".N". 0 for @max_size or
+ * @max_time means no limit, but one file is never larger than 1 GB. NULL
+ * if the first file can't be created. */
+GstWasapiRecord *gst_wasapi_record_new (const gchar * location,
+    const WAVEFORMATEX * format, guint64 max_size, GstClockTime max_time,
+    guint sequence);
+
+/* Finishes all files. Returns the number for the next one, to continue
+ * the same recording without overwriting any. */
+guint gst_wasapi_record_free (GstWasapiRecord * record);
+
+/* Appends a packet, @data may be NULL for silence. Never waits, frames
+ * that come before the next file is ready are dropped. */
+void gst_wasapi_record_write (GstWasapiRecord * record, const guint8 * data,
+    guint n_frames, guint64 qpcpos, guint64 devpos, guint32 flags);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_RECORD_H__ */
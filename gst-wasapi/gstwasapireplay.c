@@ -0,0 +1,321 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapireplay.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* A pushed timestamp this close to where the timeline already is doesn't
+ * need a mark of its own */
+#define MARK_TOLERANCE GST_MSECOND
+
+typedef struct
+{
+  guint64 position;
+  GstClockTime pts;
+} GstWasapiReplayMark;
+
+struct _GstWasapiReplay
+{
+  GMutex lock;
+  GstAudioInfo info;
+  gint bpf;
+  gint rate;
+
+  guint8 *data;
+  /* In frames, frame n is at n modulo capacity */
+  guint64 capacity;
+  guint64 total;
+  /* Sorted by position, the first may be older than what is kept */
+  GArray *marks;
+};
+
+GstWasapiReplay *
+gst_wasapi_replay_new (const GstAudioInfo * info, GstClockTime duration)
+{
+  GstWasapiReplay *self;
+  guint64 capacity;
+
+  if (GST_AUDIO_INFO_LAYOUT (info) != GST_AUDIO_LAYOUT_INTERLEAVED) {
+    GST_WARNING ("can't keep a replay of non-interleaved audio");
+    return NULL;
+  }
+
+  capacity = gst_util_uint64_scale_int_ceil (duration,
+      GST_AUDIO_INFO_RATE (info), GST_SECOND);
+  if (capacity == 0)
+    return NULL;
+
+  self = g_slice_new0 (GstWasapiReplay);
+  g_mutex_init (&self->lock);
+  self->info = *info;
+  self->bpf = GST_AUDIO_INFO_BPF (info);
+  self->rate = GST_AUDIO_INFO_RATE (info);
+  self->capacity = capacity;
+  self->data = g_malloc (capacity * self->bpf);
+  self->marks = g_array_new (FALSE, FALSE, sizeof (GstWasapiReplayMark));
+
+  GST_INFO ("keeping %" GST_TIME_FORMAT " of replay, %" G_GUINT64_FORMAT
+      " bytes", GST_TIME_ARGS (duration), capacity * self->bpf);
+
+  return self;
+}
+
+void
+gst_wasapi_replay_free (GstWasapiReplay * self)
+{
+  g_array_free (self->marks, TRUE);
+  g_free (self->data);
+  g_mutex_clear (&self->lock);
+  g_slice_free (GstWasapiReplay, self);
+}
+
+static inline guint64
+gst_wasapi_replay_oldest (GstWasapiReplay * self)
+{
+  return self->total > self->capacity ? self->total - self->capacity : 0;
+}
+
+/* With the lock held, the mark @position belongs to */
+static GstWasapiReplayMark *
+gst_wasapi_replay_find_mark (GstWasapiReplay * self, guint64 position)
+{
+  guint i = self->marks->len;
+
+  while (i > 1 && g_array_index (self->marks, GstWasapiReplayMark,
+          i - 1).position > position)
+    i--;
+
+  return &g_array_index (self->marks, GstWasapiReplayMark, i - 1);
+}
+
+static GstClockTime
+gst_wasapi_replay_position_to_time (GstWasapiReplay * self, guint64 position)
+{
+  GstWasapiReplayMark *mark = gst_wasapi_replay_find_mark (self, position);
+
+  return mark->pts + gst_util_uint64_scale_int (position - mark->position,
+      GST_SECOND, self->rate);
+}
+
+static guint64
+gst_wasapi_replay_time_to_position (GstWasapiReplay * self, GstClockTime time)
+{
+  GstWasapiReplayMark *mark;
+  guint64 position, limit;
+  guint i = self->marks->len;
+
+  /* The last mark at or before @time, the timeline resumes there */
+  while (i > 1 && g_array_index (self->marks, GstWasapiReplayMark,
+          i - 1).pts > time)
+    i--;
+  mark = &g_array_index (self->marks, GstWasapiReplayMark, i - 1);
+
+  position = mark->position;
+  if (time > mark->pts)
+    position += gst_util_uint64_scale_int (time - mark->pts, self->rate,
+        GST_SECOND);
+  limit = i < self->marks->len ? g_array_index (self->marks,
+      GstWasapiReplayMark, i).position : self->total;
+
+  return CLAMP (MIN (position, limit), gst_wasapi_replay_oldest (self),
+      self->total);
+}
+
+void
+gst_wasapi_replay_push (GstWasapiReplay * self, GstBuffer * buf)
+{
+  GstClockTime pts = GST_BUFFER_PTS (buf);
+  GstMapInfo info;
+  const guint8 *data;
+  guint64 n_frames, offset, n;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ))
+    return;
+  data = info.data;
+  n_frames = info.size / self->bpf;
+
+  g_mutex_lock (&self->lock);
+
+  if (GST_CLOCK_TIME_IS_VALID (pts)) {
+    GstClockTimeDiff diff = G_MAXINT64;
+
+    if (self->marks->len > 0)
+      diff = GST_CLOCK_DIFF (gst_wasapi_replay_position_to_time (self,
+              self->total), pts);
+    if (ABS (diff) > MARK_TOLERANCE ||
+        GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DISCONT)) {
+      GstWasapiReplayMark mark = { self->total, pts };
+
+      g_array_append_val (self->marks, mark);
+    }
+  } else if (self->marks->len == 0) {
+    GstWasapiReplayMark mark = { self->total, 0 };
+
+    g_array_append_val (self->marks, mark);
+  }
+
+  /* Only the newest capacity frames stay */
+  if (n_frames > self->capacity) {
+    data += (n_frames - self->capacity) * self->bpf;
+    self->total += n_frames - self->capacity;
+    n_frames = self->capacity;
+  }
+
+  while (n_frames > 0) {
+    offset = self->total % self->capacity;
+    n = MIN (n_frames, self->capacity - offset);
+    memcpy (self->data + offset * self->bpf, data, n * self->bpf);
+    data += n * self->bpf;
+    self->total += n;
+    n_frames -= n;
+  }
+
+  /* Drop marks that only cover frames we no longer have */
+  while (self->marks->len > 1 && g_array_index (self->marks,
+          GstWasapiReplayMark, 1).position <= gst_wasapi_replay_oldest (self))
+    g_array_remove_index (self->marks, 0);
+
+  g_mutex_unlock (&self->lock);
+
+  gst_buffer_unmap (buf, &info);
+}
+
+GstBuffer *
+gst_wasapi_replay_export (GstWasapiReplay * self, GstClockTime start,
+    GstClockTime stop)
+{
+  GstBuffer *buf = NULL;
+  GstMapInfo info;
+  guint64 first, last, position, offset, n;
+  guint8 *data;
+
+  g_mutex_lock (&self->lock);
+  if (self->marks->len == 0)
+    goto done;
+
+  first = GST_CLOCK_TIME_IS_VALID (start) ?
+      gst_wasapi_replay_time_to_position (self, start) :
+      gst_wasapi_replay_oldest (self);
+  last = GST_CLOCK_TIME_IS_VALID (stop) ?
+      gst_wasapi_replay_time_to_position (self, stop) : self->total;
+  if (last <= first)
+    goto done;
+
+  buf = gst_buffer_new_allocate (NULL, (last - first) * self->bpf, NULL);
+  gst_buffer_map (buf, &info, GST_MAP_WRITE);
+  data = info.data;
+  for (position = first; position < last; position += n) {
+    offset = position % self->capacity;
+    n = MIN (last - position, self->capacity - offset);
+    memcpy (data, self->data + offset * self->bpf, n * self->bpf);
+    data += n * self->bpf;
+  }
+  gst_buffer_unmap (buf, &info);
+
+  GST_BUFFER_PTS (buf) = gst_wasapi_replay_position_to_time (self, first);
+  GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (last - first,
+      GST_SECOND, self->rate);
+  GST_BUFFER_OFFSET (buf) = first;
+  GST_BUFFER_OFFSET_END (buf) = last;
+
+done:
+  g_mutex_unlock (&self->lock);
+
+  return buf;
+}
+
+static void
+gst_wasapi_replay_write_le (guint8 * p, guint32 value, guint size)
+{
+  guint i;
+
+  for (i = 0; i < size; i++)
+    p[i] = (value >> (8 * i)) & 0xff;
+}
+
+const GstAudioInfo *
+gst_wasapi_replay_get_info (GstWasapiReplay * self)
+{
+  return &self->info;
+}
+
+gboolean
+gst_wasapi_replay_write_wav (const GstAudioInfo * info, GstBuffer * buf,
+    const gchar * path, GError ** error)
+{
+  guint8 header[44];
+  GstMapInfo map;
+  gboolean res;
+  FILE *file;
+
+  if (GST_AUDIO_INFO_WIDTH (info) > 8 &&
+      GST_AUDIO_INFO_ENDIANNESS (info) != G_LITTLE_ENDIAN) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "WAV needs little endian samples, not %s", GST_AUDIO_INFO_NAME (info));
+    return FALSE;
+  }
+
+  file = g_fopen (path, "wb");
+  if (file == NULL) {
+    gint err = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (err),
+        "Can't create %s: %s", path, g_strerror (err));
+    return FALSE;
+  }
+
+  gst_buffer_map (buf, &map, GST_MAP_READ);
+
+  /* The canonical 44 byte header, PCM or IEEE float */
+  memcpy (header, "RIFF", 4);
+  gst_wasapi_replay_write_le (header + 4, 36 + map.size, 4);
+  memcpy (header + 8, "WAVEfmt ", 8);
+  gst_wasapi_replay_write_le (header + 16, 16, 4);
+  gst_wasapi_replay_write_le (header + 20, GST_AUDIO_INFO_IS_FLOAT (info) ?
+      3 : 1, 2);
+  gst_wasapi_replay_write_le (header + 22, GST_AUDIO_INFO_CHANNELS (info), 2);
+  gst_wasapi_replay_write_le (header + 24, GST_AUDIO_INFO_RATE (info), 4);
+  gst_wasapi_replay_write_le (header + 28, GST_AUDIO_INFO_RATE (info) *
+      GST_AUDIO_INFO_BPF (info), 4);
+  gst_wasapi_replay_write_le (header + 32, GST_AUDIO_INFO_BPF (info), 2);
+  gst_wasapi_replay_write_le (header + 34, GST_AUDIO_INFO_WIDTH (info), 2);
+  memcpy (header + 36, "data", 4);
+  gst_wasapi_replay_write_le (header + 40, map.size, 4);
+
+  res = fwrite (header, sizeof (header), 1, file) == 1 &&
+      fwrite (map.data, map.size, 1, file) == 1;
+  res = fclose (file) == 0 && res;
+  if (!res)
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_IO, "Can't write %s",
+        path);
+
+  gst_buffer_unmap (buf, &map);
+
+  return res;
+}
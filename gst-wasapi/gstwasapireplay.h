@@ -0,0 +1,58 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_REPLAY_H__
+#define __GST_WASAPI_REPLAY_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* History of the last frames wasapisrc pushed, for replay-duration.
+ *
+ * The frames are copied into one circular block of memory, so keeping
+ * them costs nothing per buffer. Timestamps are only stored where the
+ * timeline doesn't simply continue, e.g. after a gap or a resync, so
+ * exporting finds the frames of a time range exactly. Thread safe, pushing
+ * and exporting happen from different threads. */
+typedef struct _GstWasapiReplay GstWasapiReplay;
+
+/* NULL unless @info is interleaved */
+GstWasapiReplay *gst_wasapi_replay_new (const GstAudioInfo * info,
+    GstClockTime duration);
+
+void gst_wasapi_replay_free (GstWasapiReplay * replay);
+
+/* Appends the frames of @buf, stamped with its PTS */
+void gst_wasapi_replay_push (GstWasapiReplay * replay, GstBuffer * buf);
+
+/* Copies what is kept from @start to @stop, in the time of the pushed
+ * buffers, into a single buffer. GST_CLOCK_TIME_NONE for the oldest or
+ * the newest frame. NULL if nothing is kept in that range. */
+GstBuffer *gst_wasapi_replay_export (GstWasapiReplay * replay,
+    GstClockTime start, GstClockTime stop);
+
+const GstAudioInfo *gst_wasapi_replay_get_info (GstWasapiReplay * replay);
+
+/* Writes @buf from gst_wasapi_replay_export() to the WAV file at @path */
+gboolean gst_wasapi_replay_write_wav (const GstAudioInfo * info,
+    GstBuffer * buf, const gchar * path, GError ** error);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_REPLAY_H__ */
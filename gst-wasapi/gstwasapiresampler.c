@@ -0,0 +1,251 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiresampler.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Rates are passed to the resampler multiplied by this, so that the ratio
+ * can be adjusted in steps well below 1 ppm */
+#define RATE_SCALE 100
+
+/* PI controller gains, in 1/s and 1/s^2. Critically damped with a time
+ * constant of 20 seconds, so capture timestamp jitter is averaged out. */
+#define CONTROLLER_KP 0.05
+#define CONTROLLER_KI (CONTROLLER_KP * CONTROLLER_KP / 4)
+
+/* Clock rates never differ by more than this, 0.5% */
+#define MAX_CORRECTION 0.005
+
+/* With an error larger than this we start a new timeline instead */
+#define MAX_ERROR (200 * GST_MSECOND)
+
+struct _GstWasapiResampler
+{
+  GstAudioResampler *resampler;
+  gint rate;
+  gint bpf;
+  gsize latency;
+
+  gint in_rate;
+  gdouble hint;
+  gdouble integral;
+  gdouble correction;
+
+  /* Output timeline, in running time. Invalid until the first buffer. */
+  GstClockTime first_capture_time;
+  GstClockTimeDiff out_base;
+  guint64 out_total;
+};
+
+GstWasapiResampler *
+gst_wasapi_resampler_new (const GstAudioInfo * info)
+{
+  GstWasapiResampler *self;
+  GstStructure *options;
+  gint rate = GST_AUDIO_INFO_RATE (info);
+
+  switch (GST_AUDIO_INFO_FORMAT (info)) {
+    case GST_AUDIO_FORMAT_S16:
+    case GST_AUDIO_FORMAT_S32:
+    case GST_AUDIO_FORMAT_F32:
+    case GST_AUDIO_FORMAT_F64:
+      break;
+    default:
+      GST_INFO ("can't resample %s", GST_AUDIO_INFO_NAME (info));
+      return NULL;
+  }
+
+  self = g_slice_new0 (GstWasapiResampler);
+  self->rate = rate;
+  self->bpf = GST_AUDIO_INFO_BPF (info);
+  self->in_rate = rate * RATE_SCALE;
+
+  options = gst_structure_new_empty ("GstAudioResampler.options");
+  gst_audio_resampler_options_set_quality (GST_AUDIO_RESAMPLER_METHOD_KAISER,
+      GST_AUDIO_RESAMPLER_QUALITY_DEFAULT, self->in_rate, self->in_rate,
+      options);
+  self->resampler =
+      gst_audio_resampler_new (GST_AUDIO_RESAMPLER_METHOD_KAISER,
+      GST_AUDIO_RESAMPLER_FLAG_VARIABLE_RATE, GST_AUDIO_INFO_FORMAT (info),
+      GST_AUDIO_INFO_CHANNELS (info), self->in_rate, self->in_rate, options);
+  gst_structure_free (options);
+
+  if (self->resampler == NULL) {
+    g_slice_free (GstWasapiResampler, self);
+    return NULL;
+  }
+
+  self->latency = gst_audio_resampler_get_max_latency (self->resampler);
+  gst_wasapi_resampler_reset (self);
+
+  return self;
+}
+
+void
+gst_wasapi_resampler_free (GstWasapiResampler * self)
+{
+  gst_audio_resampler_free (self->resampler);
+  g_slice_free (GstWasapiResampler, self);
+}
+
+void
+gst_wasapi_resampler_reset (GstWasapiResampler * self)
+{
+  gst_audio_resampler_reset (self->resampler);
+  self->integral = 0;
+  self->correction = 0;
+  self->first_capture_time = GST_CLOCK_TIME_NONE;
+  self->out_base = 0;
+  self->out_total = 0;
+}
+
+/* Starts a new output timeline at @capture_time. The clock rate difference
+ * we learned so far stays valid, so keep the controller state. */
+static void
+gst_wasapi_resampler_restart (GstWasapiResampler * self,
+    GstClockTime capture_time)
+{
+  gst_audio_resampler_reset (self->resampler);
+  self->first_capture_time = capture_time;
+  /* The first output sample belongs to @latency frames before the input */
+  self->out_base = (GstClockTimeDiff) capture_time -
+      (GstClockTimeDiff) gst_util_uint64_scale_int (self->latency, GST_SECOND,
+      self->rate);
+  self->out_total = 0;
+}
+
+static void
+gst_wasapi_resampler_update_ratio (GstWasapiResampler * self,
+    GstClockTime capture_time, gsize in_frames)
+{
+  GstClockTimeDiff error;
+  gdouble e, dt, max_integral;
+  gint in_rate;
+
+  /* Positive if we produced more samples than were captured in that time */
+  error = GST_CLOCK_DIFF (capture_time, self->first_capture_time +
+      gst_util_uint64_scale_int (self->out_total, GST_SECOND, self->rate));
+  e = (gdouble) error / GST_SECOND;
+  dt = (gdouble) in_frames / self->rate;
+
+  self->integral += e * dt;
+  max_integral = MAX_CORRECTION / CONTROLLER_KI;
+  self->integral = CLAMP (self->integral, -max_integral, max_integral);
+
+  /* The controller only has to take care of what the hint doesn't cover */
+  self->correction = self->hint + CONTROLLER_KP * e +
+      CONTROLLER_KI * self->integral;
+  self->correction = CLAMP (self->correction, -MAX_CORRECTION, MAX_CORRECTION);
+
+  /* Consume more input per output sample when we're ahead */
+  in_rate = (gint) (self->rate * RATE_SCALE * (1.0 + self->correction) + 0.5);
+  if (in_rate != self->in_rate) {
+    self->in_rate = in_rate;
+    gst_audio_resampler_update (self->resampler, in_rate,
+        self->rate * RATE_SCALE, NULL);
+  }
+
+  GST_LOG ("error %" G_GINT64_FORMAT " ns, correction %.1f ppm", error,
+      self->correction * 1e6);
+}
+
+GstBuffer *
+gst_wasapi_resampler_process (GstWasapiResampler * self, GstBuffer * inbuf,
+    GstClockTime capture_time)
+{
+  GstBuffer *outbuf;
+  GstMapInfo in_map, out_map;
+  gpointer in[1], out[1];
+  gsize in_frames, out_frames;
+  GstClockTimeDiff pts;
+  gboolean discont = GST_BUFFER_FLAG_IS_SET (inbuf, GST_BUFFER_FLAG_DISCONT);
+
+  in_frames = gst_buffer_get_size (inbuf) / self->bpf;
+
+  if (!GST_CLOCK_TIME_IS_VALID (capture_time)) {
+    /* Nothing to compare against, just continue the timeline */
+    if (!GST_CLOCK_TIME_IS_VALID (self->first_capture_time))
+      gst_wasapi_resampler_restart (self, 0);
+  } else if (!GST_CLOCK_TIME_IS_VALID (self->first_capture_time) || discont) {
+    gst_wasapi_resampler_restart (self, capture_time);
+  } else {
+    GstClockTimeDiff error = GST_CLOCK_DIFF (capture_time,
+        self->first_capture_time + gst_util_uint64_scale_int (self->out_total,
+            GST_SECOND, self->rate));
+
+    if (ABS (error) > MAX_ERROR) {
+      GST_WARNING ("capture time is off by %" G_GINT64_FORMAT " ns, starting "
+          "over", error);
+      gst_wasapi_resampler_restart (self, capture_time);
+      discont = TRUE;
+    } else {
+      gst_wasapi_resampler_update_ratio (self, capture_time, in_frames);
+    }
+  }
+
+  out_frames = gst_audio_resampler_get_out_frames (self->resampler, in_frames);
+  outbuf = gst_buffer_new_allocate (NULL, out_frames * self->bpf, NULL);
+
+  gst_buffer_map (inbuf, &in_map, GST_MAP_READ);
+  gst_buffer_map (outbuf, &out_map, GST_MAP_WRITE);
+  in[0] = in_map.data;
+  out[0] = out_map.data;
+  gst_audio_resampler_resample (self->resampler, in, in_frames, out,
+      out_frames);
+  gst_buffer_unmap (outbuf, &out_map);
+  gst_buffer_unmap (inbuf, &in_map);
+
+  gst_buffer_copy_into (outbuf, inbuf, GST_BUFFER_COPY_FLAGS, 0, -1);
+  if (discont)
+    GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DISCONT);
+  gst_buffer_unref (inbuf);
+
+  pts = self->out_base + gst_util_uint64_scale_int (self->out_total,
+      GST_SECOND, self->rate);
+  GST_BUFFER_PTS (outbuf) = MAX (pts, 0);
+  GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale_int (out_frames,
+      GST_SECOND, self->rate);
+  GST_BUFFER_OFFSET (outbuf) = self->out_total;
+  self->out_total += out_frames;
+  GST_BUFFER_OFFSET_END (outbuf) = self->out_total;
+
+  return outbuf;
+}
+
+void
+gst_wasapi_resampler_set_rate_hint (GstWasapiResampler * self, gdouble ppm)
+{
+  self->hint = CLAMP (ppm / 1e6, -MAX_CORRECTION, MAX_CORRECTION);
+}
+
+gdouble
+gst_wasapi_resampler_get_ratio (GstWasapiResampler * self)
+{
+  return (gdouble) self->rate * RATE_SCALE / self->in_rate;
+}
+
+guint
+gst_wasapi_resampler_get_latency (GstWasapiResampler * self)
+{
+  return (guint) self->latency;
+}
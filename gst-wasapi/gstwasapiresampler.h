@@ -0,0 +1,58 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_RESAMPLER_H__
+#define __GST_WASAPI_RESAMPLER_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* Adaptive resampler used to slave the capture rate to the pipeline clock.
+ *
+ * A PI controller compares the capture time of the incoming samples with
+ * the time implied by the number of samples we produced so far, and nudges
+ * the conversion ratio of a variable rate sinc resampler, so drift is
+ * absorbed continuously instead of by skipping segments. */
+typedef struct _GstWasapiResampler GstWasapiResampler;
+
+GstWasapiResampler *gst_wasapi_resampler_new (const GstAudioInfo * info);
+
+void gst_wasapi_resampler_free (GstWasapiResampler * resampler);
+
+/* Forget all history, the next buffer starts a new timeline */
+void gst_wasapi_resampler_reset (GstWasapiResampler * resampler);
+
+/* Resamples @inbuf, which was captured at @capture_time (running time), into
+ * a new buffer stamped on the output timeline. Takes ownership of @inbuf. */
+GstBuffer *gst_wasapi_resampler_process (GstWasapiResampler * resampler,
+    GstBuffer * inbuf, GstClockTime capture_time);
+
+/* How much faster the input runs than the clock, in ppm, as estimated
+ * elsewhere. Applied directly, the controller then only corrects the rest. */
+void gst_wasapi_resampler_set_rate_hint (GstWasapiResampler * resampler,
+    gdouble ppm);
+
+/* Current output/input ratio */
+gdouble gst_wasapi_resampler_get_ratio (GstWasapiResampler * resampler);
+
+/* Frames an input sample takes until it comes out */
+guint gst_wasapi_resampler_get_latency (GstWasapiResampler * resampler);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_RESAMPLER_H__ */
@@ -0,0 +1,506 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapiringbuffer.h"
+#include "gstwasapisink.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+#define GET_SINK(buf) GST_AUDIO_SINK (GST_OBJECT_PARENT (buf))
+
+static void gst_wasapi_ring_buffer_dispose (GObject * object);
+static void gst_wasapi_ring_buffer_finalize (GObject * object);
+
+static gboolean gst_wasapi_ring_buffer_open_device (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_ring_buffer_close_device (GstAudioRingBuffer *
+    buf);
+static gboolean gst_wasapi_ring_buffer_acquire (GstAudioRingBuffer * buf,
+    GstAudioRingBufferSpec * spec);
+static gboolean gst_wasapi_ring_buffer_release (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_ring_buffer_start (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_ring_buffer_pause (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_ring_buffer_stop (GstAudioRingBuffer * buf);
+static guint gst_wasapi_ring_buffer_delay (GstAudioRingBuffer * buf);
+static void gst_wasapi_ring_buffer_clear_all (GstAudioRingBuffer * buf);
+static guint gst_wasapi_ring_buffer_commit (GstAudioRingBuffer * buf,
+    guint64 * sample, guint8 * data, gint in_samples, gint out_samples,
+    gint * accum);
+
+static void gst_wasapi_ring_buffer_advance (GstWasapiRingBuffer * self,
+    guint frames);
+
+#define gst_wasapi_ring_buffer_parent_class parent_class
+G_DEFINE_TYPE (GstWasapiRingBuffer, gst_wasapi_ring_buffer,
+    GST_TYPE_AUDIO_RING_BUFFER);
+
+static void
+gst_wasapi_ring_buffer_class_init (GstWasapiRingBufferClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstAudioRingBufferClass *ringbuffer_class =
+      GST_AUDIO_RING_BUFFER_CLASS (klass);
+
+  gobject_class->dispose = gst_wasapi_ring_buffer_dispose;
+  gobject_class->finalize = gst_wasapi_ring_buffer_finalize;
+
+  ringbuffer_class->open_device =
+      GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_open_device);
+  ringbuffer_class->close_device =
+      GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_close_device);
+  ringbuffer_class->acquire = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_acquire);
+  ringbuffer_class->release = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_release);
+  ringbuffer_class->start = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_start);
+  ringbuffer_class->resume = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_start);
+  ringbuffer_class->pause = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_pause);
+  ringbuffer_class->stop = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_stop);
+  ringbuffer_class->delay = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_delay);
+  ringbuffer_class->clear_all =
+      GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_clear_all);
+  ringbuffer_class->commit = GST_DEBUG_FUNCPTR (gst_wasapi_ring_buffer_commit);
+}
+
+static void
+gst_wasapi_ring_buffer_init (GstWasapiRingBuffer * self)
+{
+  self->cancel_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  self->start_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  g_mutex_init (&self->render_lock);
+  self->partial = 0;
+}
+
+static void
+gst_wasapi_ring_buffer_dispose (GObject * object)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (object);
+
+  if (self->cancel_handle != NULL) {
+    CloseHandle (self->cancel_handle);
+    self->cancel_handle = NULL;
+  }
+  if (self->start_handle != NULL) {
+    CloseHandle (self->start_handle);
+    self->start_handle = NULL;
+  }
+
+  G_OBJECT_CLASS (parent_class)->dispose (object);
+}
+
+static void
+gst_wasapi_ring_buffer_finalize (GObject * object)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (object);
+
+  g_mutex_clear (&self->render_lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static gboolean
+gst_wasapi_ring_buffer_open_device (GstAudioRingBuffer * buf)
+{
+  GstAudioSink *sink = GET_SINK (buf);
+
+  return GST_AUDIO_SINK_GET_CLASS (sink)->open (sink);
+}
+
+static gboolean
+gst_wasapi_ring_buffer_close_device (GstAudioRingBuffer * buf)
+{
+  GstAudioSink *sink = GET_SINK (buf);
+
+  return GST_AUDIO_SINK_GET_CLASS (sink)->close (sink);
+}
+
+/* Straight from the mapping into the device buffer, in two pieces where
+ * the ring wraps, the rest as a gap */
+static gboolean
+gst_wasapi_ring_buffer_render_shm (GstWasapiRingBuffer * self,
+    GstWasapiSink * sink, guint can_frames)
+{
+  const guint8 *data;
+  guint n, done = 0;
+
+  while (done < can_frames &&
+      (n = gst_wasapi_shm_reader_peek (self->shm, &data,
+              can_frames - done)) > 0) {
+    if (!gst_wasapi_sink_render (sink, data, n))
+      return FALSE;
+    gst_wasapi_shm_reader_consume (self->shm, n);
+    done += n;
+  }
+
+  return done == can_frames ||
+      gst_wasapi_sink_render (sink, NULL, can_frames - done);
+}
+
+/* Renders what the jitter buffer or the shared memory has each time the
+ * device wants more, the rest as a gap */
+static gpointer
+gst_wasapi_ring_buffer_thread_func (gpointer user_data)
+{
+  GstWasapiRingBuffer *self = user_data;
+  GstAudioRingBuffer *buf = GST_AUDIO_RING_BUFFER (self);
+  GstWasapiSink *sink = GST_WASAPI_SINK (GST_OBJECT_PARENT (buf));
+  gint bpf = GST_AUDIO_INFO_BPF (&buf->spec.info);
+  gint rate = GST_AUDIO_INFO_RATE (&buf->spec.info);
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+
+  while (WaitForSingleObject (self->start_handle, INFINITE) == WAIT_OBJECT_0 &&
+      g_atomic_int_get (&self->running)) {
+    GstWasapiStats *stats;
+    guint64 cycles;
+    gint can_frames;
+    guint n;
+    gboolean ok = FALSE;
+
+    /* Like the ringbuffer thread of GstAudioSink */
+    if (sink->thread_task != NULL)
+      gst_wasapi_util_ensure_thread_characteristics (sink->thread_task,
+          sink->thread_priority);
+    gst_wasapi_util_ensure_thread_affinity (sink->thread_group,
+        sink->thread_mask);
+    gst_wasapi_util_ensure_thread_flags (sink->thread_flags);
+
+    can_frames = gst_wasapi_sink_wait_for_room (sink, self->cancel_handle);
+    if (can_frames == 0)
+      continue;
+
+    if (can_frames < 0) {
+      /* Don't spin on a broken device */
+      WaitForSingleObject (self->cancel_handle,
+          (DWORD) gst_util_uint64_scale_int (MAX (sink->period_frames, 1),
+              1000, rate) + 1);
+      continue;
+    }
+
+    cycles = gst_wasapi_util_get_thread_cycles ();
+
+    if (self->jitter != NULL && (guint) can_frames > self->render_frames) {
+      self->render_data = g_realloc (self->render_data,
+          (gsize) can_frames * bpf);
+      self->render_frames = can_frames;
+    }
+
+    /* Paused or stopped while we waited, the client is reset already */
+    g_mutex_lock (&self->render_lock);
+    if (WaitForSingleObject (self->cancel_handle, 0) == WAIT_OBJECT_0) {
+      /* Nothing rendered */
+    } else if (self->shm != NULL) {
+      ok = gst_wasapi_ring_buffer_render_shm (self, sink, can_frames);
+    } else {
+      n = gst_wasapi_jitter_pull (self->jitter, self->render_data,
+          can_frames);
+      ok = (n == 0 || gst_wasapi_sink_render (sink, self->render_data, n)) &&
+          (n == (guint) can_frames ||
+          gst_wasapi_sink_render (sink, NULL, can_frames - n));
+    }
+    g_mutex_unlock (&self->render_lock);
+
+    if (ok)
+      gst_wasapi_ring_buffer_advance (self, can_frames);
+
+    stats = gst_wasapi_stats_block_begin (sink->device_stats);
+    stats->device_cycles += gst_wasapi_util_get_thread_cycles () - cycles;
+    if (ok)
+      stats->device_audio += gst_util_uint64_scale_int (can_frames,
+          GST_SECOND, rate);
+    gst_wasapi_stats_block_end (sink->device_stats);
+  }
+
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static gboolean
+gst_wasapi_ring_buffer_acquire (GstAudioRingBuffer * buf,
+    GstAudioRingBufferSpec * spec)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+  GstAudioSink *sink = GET_SINK (buf);
+
+  if (!GST_AUDIO_SINK_GET_CLASS (sink)->prepare (sink, spec))
+    return FALSE;
+
+  /* No memory, the segments only exist in the device buffer */
+  buf->size = spec->segtotal * spec->segsize;
+  buf->memory = NULL;
+  g_atomic_int_set (&self->partial, 0);
+
+  /* Aims for a device period at least, on top of what the device has */
+  if (self->jitter_latency > 0 && self->shm == NULL) {
+    gint rate = GST_AUDIO_INFO_RATE (&spec->info);
+
+    self->jitter = gst_wasapi_jitter_new (&spec->info,
+        (guint) gst_util_uint64_scale_int (self->jitter_latency, rate,
+            GST_SECOND), spec->segsize / GST_AUDIO_INFO_BPF (&spec->info));
+  }
+
+  if (self->jitter != NULL || self->shm != NULL) {
+    g_atomic_int_set (&self->running, TRUE);
+    self->thread = g_thread_new (self->shm != NULL ? "wasapi-shm-input" :
+        "wasapi-jitter", gst_wasapi_ring_buffer_thread_func, self);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_ring_buffer_release (GstAudioRingBuffer * buf)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+  GstAudioSink *sink = GET_SINK (buf);
+
+  if (self->thread != NULL) {
+    g_atomic_int_set (&self->running, FALSE);
+    SetEvent (self->start_handle);
+    SetEvent (self->cancel_handle);
+    g_thread_join (self->thread);
+    self->thread = NULL;
+  }
+  g_clear_pointer (&self->jitter, gst_wasapi_jitter_free);
+  g_clear_pointer (&self->render_data, g_free);
+  self->render_frames = 0;
+  g_clear_pointer (&self->scaled_data, g_free);
+  self->scaled_size = 0;
+
+  return GST_AUDIO_SINK_GET_CLASS (sink)->unprepare (sink);
+}
+
+static gboolean
+gst_wasapi_ring_buffer_start (GstAudioRingBuffer * buf)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+
+  gst_wasapi_sink_stop_keepalive (GST_WASAPI_SINK (GET_SINK (buf)));
+
+  /* The client is started by the first commit, or the first packet of
+   * the thread */
+  ResetEvent (self->cancel_handle);
+  if (self->jitter != NULL)
+    gst_wasapi_jitter_set_flushing (self->jitter, FALSE);
+  if (self->thread != NULL)
+    SetEvent (self->start_handle);
+
+  return TRUE;
+}
+
+/* Called with the object lock of the ringbuffer */
+static gboolean
+gst_wasapi_ring_buffer_pause (GstAudioRingBuffer * buf)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+  GstAudioSink *sink = GET_SINK (buf);
+
+  /* The thread waits for the next start, commit() doesn't wait for room */
+  ResetEvent (self->start_handle);
+  SetEvent (self->cancel_handle);
+  if (self->jitter != NULL)
+    gst_wasapi_jitter_set_flushing (self->jitter, TRUE);
+
+  /* Like GstAudioSink, stop the device and drop what it still has */
+  g_mutex_lock (&self->render_lock);
+  GST_AUDIO_SINK_GET_CLASS (sink)->reset (sink);
+  g_mutex_unlock (&self->render_lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_ring_buffer_stop (GstAudioRingBuffer * buf)
+{
+  return gst_wasapi_ring_buffer_pause (buf);
+}
+
+/* The device delay minus what didn't make a full segment yet, so that
+ * samples_done() - delay() is what was actually played */
+static guint
+gst_wasapi_ring_buffer_delay (GstAudioRingBuffer * buf)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+  GstAudioSink *sink = GET_SINK (buf);
+  guint delay, partial;
+
+  delay = GST_AUDIO_SINK_GET_CLASS (sink)->delay (sink);
+  partial = g_atomic_int_get (&self->partial);
+
+  return delay > partial ? delay - partial : 0;
+}
+
+/* Flushing, what the jitter buffer has is gone as well */
+static void
+gst_wasapi_ring_buffer_clear_all (GstAudioRingBuffer * buf)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+
+  if (self->jitter != NULL)
+    gst_wasapi_jitter_reset (self->jitter);
+}
+
+/* Ringbuffer position of the next frame we hand to the device */
+static guint64
+gst_wasapi_ring_buffer_position (GstWasapiRingBuffer * self)
+{
+  GstAudioRingBuffer *buf = GST_AUDIO_RING_BUFFER (self);
+  gint segdone = g_atomic_int_get (&buf->segdone) - buf->segbase;
+
+  return (guint64) MAX (segdone, 0) * buf->samples_per_seg +
+      g_atomic_int_get (&self->partial);
+}
+
+static void
+gst_wasapi_ring_buffer_advance (GstWasapiRingBuffer * self, guint frames)
+{
+  GstAudioRingBuffer *buf = GST_AUDIO_RING_BUFFER (self);
+  guint partial = g_atomic_int_get (&self->partial) + frames;
+
+  if (partial >= (guint) buf->samples_per_seg)
+    gst_audio_ring_buffer_advance (buf, partial / buf->samples_per_seg);
+  g_atomic_int_set (&self->partial, partial % buf->samples_per_seg);
+}
+
+/* Like the default ringbuffer, start if we may, never wait for that */
+static gboolean
+gst_wasapi_ring_buffer_is_started (GstAudioRingBuffer * buf)
+{
+  gboolean res;
+
+  if (g_atomic_int_get (&buf->state) != GST_AUDIO_RING_BUFFER_STATE_STARTED) {
+    if (!g_atomic_int_get (&buf->may_start))
+      return FALSE;
+    gst_audio_ring_buffer_start (buf);
+  }
+
+  GST_OBJECT_LOCK (buf);
+  res = !buf->flushing &&
+      g_atomic_int_get (&buf->state) == GST_AUDIO_RING_BUFFER_STATE_STARTED;
+  GST_OBJECT_UNLOCK (buf);
+
+  return res;
+}
+
+static guint
+gst_wasapi_ring_buffer_commit (GstAudioRingBuffer * buf, guint64 * sample,
+    guint8 * data, gint in_samples, gint out_samples, gint * accum)
+{
+  GstWasapiRingBuffer *self = GST_WASAPI_RING_BUFFER (buf);
+  GstWasapiSink *sink = GST_WASAPI_SINK (GST_OBJECT_PARENT (buf));
+  gint bpf = GST_AUDIO_INFO_BPF (&buf->spec.info);
+  GstWasapiStats *stats;
+  guint done = 0;
+  guint64 cycles;
+
+  /* With shm-input upstream isn't played, we don't hold it up either */
+  if (in_samples <= 0 || out_samples == 0 || self->shm != NULL)
+    return MAX (in_samples, 0);
+
+  /* Trick modes, pick the nearest frame like the default ringbuffer */
+  if (out_samples != in_samples) {
+    gboolean reverse = out_samples < 0;
+    gint i, j;
+
+    out_samples = ABS (out_samples);
+    /* Only grows, so a steady rate allocates once */
+    if ((gsize) out_samples * bpf > self->scaled_size) {
+      self->scaled_size = (gsize) out_samples * bpf;
+      g_free (self->scaled_data);
+      self->scaled_data = g_malloc (self->scaled_size);
+    }
+    for (i = 0; i < out_samples; i++) {
+      j = (gint) ((gint64) i * in_samples / out_samples);
+      if (reverse)
+        j = in_samples - 1 - j;
+      memcpy (self->scaled_data + (gsize) i * bpf, data + (gsize) j * bpf,
+          bpf);
+    }
+    data = self->scaled_data;
+  }
+
+  cycles = gst_wasapi_util_get_thread_cycles ();
+
+  /* Where the samples belong doesn't matter, they are played in order */
+  if (self->jitter != NULL && gst_wasapi_ring_buffer_is_started (buf))
+    done = gst_wasapi_jitter_push (self->jitter, data, out_samples);
+
+  while (self->jitter == NULL && done < (guint) out_samples) {
+    guint64 pos, want = *sample + done;
+    gint can_frames;
+    guint n;
+    gboolean ok;
+
+    if (!gst_wasapi_ring_buffer_is_started (buf))
+      break;
+
+    pos = gst_wasapi_ring_buffer_position (self);
+    if (want < pos) {
+      /* The device is past these already */
+      n = (guint) MIN (pos - want, (guint64) (out_samples - done));
+      GST_DEBUG_OBJECT (sink, "dropping %u late frames", n);
+      done += n;
+      continue;
+    }
+
+    can_frames = gst_wasapi_sink_wait_for_room (sink, self->cancel_handle);
+    if (can_frames == 0)
+      break;
+
+    if (can_frames < 0) {
+      /* The GstAudioSink thread would go on, so do we */
+      GST_WARNING_OBJECT (sink, "dropping %u frames after a device error",
+          out_samples - done);
+      done = out_samples;
+      break;
+    }
+
+    g_mutex_lock (&self->render_lock);
+    if (want > pos) {
+      /* Fill the gap up to where this data belongs */
+      n = (guint) MIN (want - pos, (guint64) can_frames);
+      ok = gst_wasapi_sink_render (sink, NULL, n);
+    } else {
+      n = MIN (out_samples - done, (guint) can_frames);
+      ok = gst_wasapi_sink_render (sink, data + (gsize) done * bpf, n);
+      done += n;
+    }
+    g_mutex_unlock (&self->render_lock);
+
+    /* Frames the device didn't take are rendered as a gap next time */
+    if (ok)
+      gst_wasapi_ring_buffer_advance (self, n);
+  }
+
+  stats = gst_wasapi_stats_block_begin (sink->streaming_stats);
+  stats->streaming_cycles += gst_wasapi_util_get_thread_cycles () - cycles;
+  stats->streaming_audio += gst_util_uint64_scale_int (done, GST_SECOND,
+      GST_AUDIO_INFO_RATE (&buf->spec.info));
+  gst_wasapi_stats_block_end (sink->streaming_stats);
+
+  *sample += done;
+
+  if (out_samples != in_samples)
+    return (guint) ((guint64) done * in_samples / out_samples);
+
+  return done;
+}
@@ -0,0 +1,94 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_RING_BUFFER_H__
+#define __GST_WASAPI_RING_BUFFER_H__
+
+#include "gstwasapiutil.h"
+#include "gstwasapijitter.h"
+#include "gstwasapishm.h"
+
+G_BEGIN_DECLS
+
+/* Ringbuffer of wasapisink with zero-copy=true, in shared mode.
+ *
+ * There is no ringbuffer memory and no writer thread: commit() waits for
+ * room in the endpoint buffer and copies the samples of upstream straight
+ * into it from the streaming thread. Gaps are rendered with the silent
+ * buffer flag. segdone still advances per device period worth of frames,
+ * so samples_done() and the clocks work like with the default ringbuffer.
+ *
+ * With jitter-buffer=true commit() only queues the samples in a
+ * GstWasapiJitter, in the order they come and regardless of where they
+ * belong, and a thread of ours pulls them whenever the device has room.
+ *
+ * With shm-input that thread copies from the shared memory of another
+ * process straight into the device buffer instead, and commit() drops what
+ * upstream has. */
+#define GST_TYPE_WASAPI_RING_BUFFER \
+  (gst_wasapi_ring_buffer_get_type())
+#define GST_WASAPI_RING_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_WASAPI_RING_BUFFER,GstWasapiRingBuffer))
+#define GST_WASAPI_RING_BUFFER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_WASAPI_RING_BUFFER,GstWasapiRingBufferClass))
+#define GST_IS_WASAPI_RING_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_WASAPI_RING_BUFFER))
+typedef struct _GstWasapiRingBuffer GstWasapiRingBuffer;
+typedef struct _GstWasapiRingBufferClass GstWasapiRingBufferClass;
+
+struct _GstWasapiRingBuffer
+{
+  GstAudioRingBuffer parent;
+
+  /* Set while paused or stopped, so commit() stops waiting for room */
+  HANDLE cancel_handle;
+  /* Held around each packet, pause and stop only reset the client once
+   * the packet is released */
+  GMutex render_lock;
+  /* Frames committed beyond the last full segment. ATOMIC */
+  gint partial;
+
+  /* Most the jitter buffer may hold, 0 without one. Set by the sink when
+   * it creates us. */
+  GstClockTime jitter_latency;
+  /* Set and owned by the sink before acquire() with shm-input */
+  GstWasapiShmReader *shm;
+  /* Between acquire() and release() with a jitter buffer or @shm. The
+   * thread waits for @start_handle, set while started, and then renders a
+   * packet each time the device has room. @running is cleared to stop it. */
+  GstWasapiJitter *jitter;
+  GThread *thread;
+  HANDLE start_handle;
+  gint running;
+  /* Only used by the thread */
+  guint8 *render_data;
+  guint render_frames;
+  /* The samples of commit() picked for a trick mode rate, until release().
+   * Only used by commit(). */
+  guint8 *scaled_data;
+  gsize scaled_size;
+};
+
+struct _GstWasapiRingBufferClass
+{
+  GstAudioRingBufferClass parent_class;
+};
+
+GType gst_wasapi_ring_buffer_get_type (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_RING_BUFFER_H__ */
@@ -0,0 +1,218 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapisession.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+struct _GstWasapiSession
+{
+  /* First, so the interface pointer is the session */
+  IAudioSessionEvents events;
+  volatile LONG refcount;
+
+  GstElement *element;
+  IAudioSessionControl *control;
+
+  /* Protects the callback, held while it runs so unwatch() waits for it */
+  GMutex lock;
+  GstWasapiSessionDisconnectedFunc disconnected;
+  gpointer user_data;
+};
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_QueryInterface (IAudioSessionEvents * This, REFIID riid,
+    void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IAudioSessionEvents, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_session_AddRef (IAudioSessionEvents * This)
+{
+  return InterlockedIncrement (&((GstWasapiSession *) This)->refcount);
+}
+
+/* The audio service may hold on to us for a while after unwatch() */
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_session_Release (IAudioSessionEvents * This)
+{
+  GstWasapiSession *session = (GstWasapiSession *) This;
+  ULONG refcount = InterlockedDecrement (&session->refcount);
+
+  if (refcount == 0) {
+    g_mutex_clear (&session->lock);
+    g_slice_free (GstWasapiSession, session);
+  }
+
+  return refcount;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnDisplayNameChanged (IAudioSessionEvents * This,
+    LPCWSTR NewDisplayName, LPCGUID EventContext)
+{
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnIconPathChanged (IAudioSessionEvents * This,
+    LPCWSTR NewIconPath, LPCGUID EventContext)
+{
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnSimpleVolumeChanged (IAudioSessionEvents * This,
+    float NewVolume, BOOL NewMute, LPCGUID EventContext)
+{
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnChannelVolumeChanged (IAudioSessionEvents * This,
+    DWORD ChannelCount, float NewChannelVolumeArray[], DWORD ChangedChannel,
+    LPCGUID EventContext)
+{
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnGroupingParamChanged (IAudioSessionEvents * This,
+    LPCGUID NewGroupingParam, LPCGUID EventContext)
+{
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnStateChanged (IAudioSessionEvents * This,
+    AudioSessionState NewState)
+{
+  return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_session_OnSessionDisconnected (IAudioSessionEvents * This,
+    AudioSessionDisconnectReason DisconnectReason)
+{
+  GstWasapiSession *session = (GstWasapiSession *) This;
+
+  g_mutex_lock (&session->lock);
+  if (session->disconnected != NULL) {
+    GST_WARNING_OBJECT (session->element, "session disconnected: %s",
+        gst_wasapi_session_disconnect_reason_to_string (DisconnectReason));
+    session->disconnected (DisconnectReason, session->user_data);
+  }
+  g_mutex_unlock (&session->lock);
+
+  return S_OK;
+}
+
+static CONST_VTBL IAudioSessionEventsVtbl session_events_vtbl = {
+  .QueryInterface = gst_wasapi_session_QueryInterface,
+  .AddRef = gst_wasapi_session_AddRef,
+  .Release = gst_wasapi_session_Release,
+  .OnDisplayNameChanged = gst_wasapi_session_OnDisplayNameChanged,
+  .OnIconPathChanged = gst_wasapi_session_OnIconPathChanged,
+  .OnSimpleVolumeChanged = gst_wasapi_session_OnSimpleVolumeChanged,
+  .OnChannelVolumeChanged = gst_wasapi_session_OnChannelVolumeChanged,
+  .OnGroupingParamChanged = gst_wasapi_session_OnGroupingParamChanged,
+  .OnStateChanged = gst_wasapi_session_OnStateChanged,
+  .OnSessionDisconnected = gst_wasapi_session_OnSessionDisconnected,
+};
+
+GstWasapiSession *
+gst_wasapi_session_watch (GstElement * self, IAudioClient * client,
+    GstWasapiSessionDisconnectedFunc disconnected, gpointer user_data)
+{
+  GstWasapiSession *session;
+  IAudioSessionControl *control = NULL;
+  HRESULT hr;
+
+  hr = IAudioClient_GetService (client, &IID_IAudioSessionControl,
+      (void **) &control);
+  HR_FAILED_RET (hr, IAudioClient::GetService (IID_IAudioSessionControl),
+      NULL);
+
+  session = g_slice_new0 (GstWasapiSession);
+  session->events.lpVtbl = &session_events_vtbl;
+  session->refcount = 1;
+  session->element = self;
+  session->control = control;
+  g_mutex_init (&session->lock);
+  session->disconnected = disconnected;
+  session->user_data = user_data;
+
+  hr = IAudioSessionControl_RegisterAudioSessionNotification (control,
+      &session->events);
+  HR_FAILED_AND (hr, IAudioSessionControl::RegisterAudioSessionNotification,
+      goto failed);
+
+  return session;
+
+failed:
+  IUnknown_Release (control);
+  IUnknown_Release (&session->events);
+  return NULL;
+}
+
+void
+gst_wasapi_session_unwatch (GstWasapiSession * session)
+{
+  g_mutex_lock (&session->lock);
+  session->disconnected = NULL;
+  g_mutex_unlock (&session->lock);
+
+  IAudioSessionControl_UnregisterAudioSessionNotification (session->control,
+      &session->events);
+  IUnknown_Release (session->control);
+  IUnknown_Release (&session->events);
+}
+
+const gchar *
+gst_wasapi_session_disconnect_reason_to_string (AudioSessionDisconnectReason
+    reason)
+{
+  switch (reason) {
+    case DisconnectReasonDeviceRemoval:
+      return "device removed";
+    case DisconnectReasonServerShutdown:
+      return "audio service stopped";
+    case DisconnectReasonFormatChanged:
+      return "format of the endpoint changed";
+    case DisconnectReasonSessionLogoff:
+      return "user logged off";
+    case DisconnectReasonSessionDisconnected:
+      return "remote desktop session disconnected";
+    case DisconnectReasonExclusiveModeOverride:
+      return "taken over in exclusive mode";
+    default:
+      return "unknown reason";
+  }
+}
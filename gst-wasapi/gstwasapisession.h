@@ -0,0 +1,54 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_SESSION_H__
+#define __GST_WASAPI_SESSION_H__
+
+#include "gstwasapiutil.h"
+
+#include <audiopolicy.h>
+
+G_BEGIN_DECLS
+
+/* IAudioSessionEvents on the session of a client, for wasapisink and
+ * wasapisrc.
+ *
+ * Only the disconnect matters: the client is dead from then on, when the
+ * format of the endpoint changed, another application took it in
+ * exclusive mode or the remote desktop session went away. Otherwise that
+ * only shows when GetBuffer fails, sometimes after a long stall. The
+ * callback runs on a thread of the audio service, it must not block and
+ * must not unwatch. */
+typedef struct _GstWasapiSession GstWasapiSession;
+
+typedef void (*GstWasapiSessionDisconnectedFunc) (AudioSessionDisconnectReason
+    reason, gpointer user_data);
+
+/* NULL if the session can't be watched, the client works as before then */
+GstWasapiSession *gst_wasapi_session_watch (GstElement * element,
+    IAudioClient * client, GstWasapiSessionDisconnectedFunc disconnected,
+    gpointer user_data);
+
+/* The callback doesn't run anymore once this returns */
+void gst_wasapi_session_unwatch (GstWasapiSession * session);
+
+const gchar *gst_wasapi_session_disconnect_reason_to_string
+    (AudioSessionDisconnectReason reason);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SESSION_H__ */
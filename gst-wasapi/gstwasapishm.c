@@ -0,0 +1,336 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapishm.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+G_STATIC_ASSERT (G_STRUCT_OFFSET (GstWasapiShmHeader, write_frames) == 40);
+G_STATIC_ASSERT (sizeof (GstWasapiShmPacket) == 24);
+G_STATIC_ASSERT (G_STRUCT_OFFSET (GstWasapiShmHeader, read_frames) == 6200);
+
+struct _GstWasapiShm
+{
+  HANDLE mapping;
+  HANDLE event;
+  GstWasapiShmHeader *header;
+  guint8 *data;
+  guint bpf;
+  guint mask;
+  /* Our copies of the counters in the header */
+  guint64 write_frames;
+  guint64 write_packets;
+};
+
+struct _GstWasapiShmReader
+{
+  HANDLE mapping;
+  HANDLE event;
+  GstWasapiShmHeader *header;
+  guint8 *data;
+  guint bpf;
+  guint mask;
+  /* Our copy of read_frames in the header */
+  guint64 read_frames;
+  WAVEFORMATEXTENSIBLE format;
+};
+
+/* Also atomic for 32 bit builds */
+static guint64
+gst_wasapi_shm_load (volatile guint64 * counter)
+{
+  return (guint64) InterlockedCompareExchange64 ((volatile LONG64 *) counter,
+      0, 0);
+}
+
+GstWasapiShm *
+gst_wasapi_shm_new (const gchar * name, const WAVEFORMATEX * format,
+    guint min_frames)
+{
+  GstWasapiShm *self;
+  GstWasapiShmHeader *header;
+  guint data_offset, data_frames;
+  guint64 size;
+  gchar *event_name;
+  HANDLE mapping;
+
+  data_offset = GST_ROUND_UP_64 (sizeof (GstWasapiShmHeader));
+  data_frames = 1 << g_bit_storage (MAX (min_frames, 2) - 1);
+  size = data_offset + (guint64) data_frames * format->nBlockAlign;
+
+  mapping = CreateFileMappingA (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      (DWORD) (size >> 32), (DWORD) size, name);
+  if (mapping == NULL) {
+    GST_WARNING ("can't create shared memory %s: %lu", name, GetLastError ());
+    return NULL;
+  }
+
+  header = MapViewOfFile (mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T) size);
+  if (header == NULL) {
+    /* Also when it exists already, but smaller */
+    GST_WARNING ("can't map shared memory %s: %lu", name, GetLastError ());
+    CloseHandle (mapping);
+    return NULL;
+  }
+
+  self = g_slice_new0 (GstWasapiShm);
+  self->mapping = mapping;
+  self->header = header;
+  self->data = (guint8 *) header + data_offset;
+  self->bpf = format->nBlockAlign;
+  self->mask = data_frames - 1;
+
+  event_name = g_strdup_printf ("%s-event", name);
+  self->event = CreateEventA (NULL, FALSE, FALSE, event_name);
+  g_free (event_name);
+
+  /* A reader that sees a new magic and version starts over */
+  memset (header->magic, 0, sizeof (header->magic));
+  MemoryBarrier ();
+  header->version = GST_WASAPI_SHM_VERSION;
+  header->data_offset = data_offset;
+  header->data_frames = data_frames;
+  header->rate = format->nSamplesPerSec;
+  header->channels = format->nChannels;
+  header->bpf = format->nBlockAlign;
+  header->bits = format->wBitsPerSample;
+  header->format_tag = format->wFormatTag;
+  header->channel_mask = 0;
+  if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+    WAVEFORMATEXTENSIBLE *ext = (WAVEFORMATEXTENSIBLE *) format;
+
+    header->format_tag = IsEqualGUID (&ext->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) ? WAVE_FORMAT_IEEE_FLOAT :
+        WAVE_FORMAT_PCM;
+    header->channel_mask = ext->dwChannelMask;
+  }
+  header->write_frames = 0;
+  header->write_packets = 0;
+  header->read_frames = 0;
+  MemoryBarrier ();
+  memcpy (header->magic, GST_WASAPI_SHM_MAGIC, sizeof (header->magic));
+
+  GST_INFO ("writing to shared memory %s, %u frames of %u bytes", name,
+      data_frames, self->bpf);
+
+  return self;
+}
+
+void
+gst_wasapi_shm_free (GstWasapiShm * self)
+{
+  UnmapViewOfFile (self->header);
+  CloseHandle (self->mapping);
+  if (self->event != NULL)
+    CloseHandle (self->event);
+  g_slice_free (GstWasapiShm, self);
+}
+
+void
+gst_wasapi_shm_write (GstWasapiShm * self, const guint8 * data,
+    guint n_frames, guint64 qpcpos, guint32 flags)
+{
+  GstWasapiShmPacket *packet;
+  guint offset, n, done = 0;
+
+  if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
+    data = NULL;
+
+  /* Only the newest data_frames frames fit */
+  if (n_frames > self->mask + 1)
+    done = n_frames - (self->mask + 1);
+
+  while (done < n_frames) {
+    offset = (guint) ((self->write_frames + done) & self->mask);
+    n = MIN (n_frames - done, self->mask + 1 - offset);
+    if (data != NULL)
+      memcpy (self->data + (gsize) offset * self->bpf,
+          data + (gsize) done * self->bpf, (gsize) n * self->bpf);
+    else
+      memset (self->data + (gsize) offset * self->bpf, 0,
+          (gsize) n * self->bpf);
+    done += n;
+  }
+
+  packet = &self->header->packets[self->write_packets %
+      GST_WASAPI_SHM_N_PACKETS];
+  packet->position = self->write_frames;
+  packet->qpcpos = qpcpos;
+  packet->frames = n_frames;
+  packet->flags = flags;
+
+  self->write_frames += n_frames;
+  self->write_packets++;
+
+  /* Full barriers, readers must see the data before the counters. Also
+   * atomic for 32 bit builds. */
+  InterlockedExchange64 ((volatile LONG64 *) & self->header->write_frames,
+      self->write_frames);
+  InterlockedExchange64 ((volatile LONG64 *) & self->header->write_packets,
+      self->write_packets);
+
+  if (self->event != NULL)
+    SetEvent (self->event);
+}
+
+GstWasapiShmReader *
+gst_wasapi_shm_reader_new (const gchar * name)
+{
+  GstWasapiShmReader *self;
+  GstWasapiShmHeader *header;
+  MEMORY_BASIC_INFORMATION info;
+  WAVEFORMATEX *format;
+  guint64 size;
+  gchar *event_name;
+  HANDLE mapping;
+
+  mapping = OpenFileMappingA (FILE_MAP_ALL_ACCESS, FALSE, name);
+  if (mapping == NULL) {
+    GST_WARNING ("can't open shared memory %s: %lu", name, GetLastError ());
+    return NULL;
+  }
+
+  /* All of it, however large the writer made it */
+  header = MapViewOfFile (mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (header == NULL) {
+    GST_WARNING ("can't map shared memory %s: %lu", name, GetLastError ());
+    CloseHandle (mapping);
+    return NULL;
+  }
+
+  if (VirtualQuery (header, &info, sizeof (info)) == 0 ||
+      info.RegionSize < sizeof (GstWasapiShmHeader))
+    goto invalid;
+
+  size = (guint64) header->data_offset +
+      (guint64) header->data_frames * header->bpf;
+  if (memcmp (header->magic, GST_WASAPI_SHM_MAGIC,
+          sizeof (header->magic)) != 0 ||
+      header->version != GST_WASAPI_SHM_VERSION ||
+      header->data_offset < sizeof (GstWasapiShmHeader) ||
+      header->data_frames == 0 ||
+      (header->data_frames & (header->data_frames - 1)) != 0 ||
+      header->channels == 0 || header->bits == 0 || header->bits % 8 != 0 ||
+      header->bpf != header->channels * header->bits / 8 ||
+      (header->format_tag != WAVE_FORMAT_PCM &&
+          header->format_tag != WAVE_FORMAT_IEEE_FLOAT) ||
+      size > info.RegionSize)
+    goto invalid;
+
+  self = g_slice_new0 (GstWasapiShmReader);
+  self->mapping = mapping;
+  self->header = header;
+  self->data = (guint8 *) header + header->data_offset;
+  self->bpf = header->bpf;
+  self->mask = header->data_frames - 1;
+  self->read_frames = gst_wasapi_shm_load (&header->read_frames);
+
+  format = &self->format.Format;
+  format->wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format->nChannels = header->channels;
+  format->nSamplesPerSec = header->rate;
+  format->nAvgBytesPerSec = header->rate * header->bpf;
+  format->nBlockAlign = header->bpf;
+  format->wBitsPerSample = header->bits;
+  format->cbSize = sizeof (WAVEFORMATEXTENSIBLE) - sizeof (WAVEFORMATEX);
+  self->format.Samples.wValidBitsPerSample = header->bits;
+  self->format.SubFormat = header->format_tag == WAVE_FORMAT_IEEE_FLOAT ?
+      KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+  self->format.dwChannelMask = header->channel_mask;
+  /* What the writer had was a plain WAVEFORMATEX then */
+  if (header->channel_mask == 0 && header->channels <= 2)
+    self->format.dwChannelMask = header->channels == 1 ?
+        KSAUDIO_SPEAKER_MONO : KSAUDIO_SPEAKER_STEREO;
+
+  event_name = g_strdup_printf ("%s-read-event", name);
+  self->event = CreateEventA (NULL, FALSE, FALSE, event_name);
+  g_free (event_name);
+
+  GST_INFO ("reading from shared memory %s, %u frames of %u bytes at %u Hz",
+      name, self->mask + 1, self->bpf, header->rate);
+
+  return self;
+
+invalid:
+  GST_WARNING ("shared memory %s doesn't hold a ring of version %u", name,
+      GST_WASAPI_SHM_VERSION);
+  UnmapViewOfFile (header);
+  CloseHandle (mapping);
+  return NULL;
+}
+
+void
+gst_wasapi_shm_reader_free (GstWasapiShmReader * self)
+{
+  UnmapViewOfFile (self->header);
+  CloseHandle (self->mapping);
+  if (self->event != NULL)
+    CloseHandle (self->event);
+  g_slice_free (GstWasapiShmReader, self);
+}
+
+const WAVEFORMATEX *
+gst_wasapi_shm_reader_get_format (GstWasapiShmReader * self)
+{
+  return &self->format.Format;
+}
+
+guint
+gst_wasapi_shm_reader_peek (GstWasapiShmReader * self, const guint8 ** data,
+    guint max_frames)
+{
+  guint64 written = gst_wasapi_shm_load (&self->header->write_frames);
+  guint offset, n;
+
+  /* Only a writer that doesn't look at read_frames laps us */
+  if (written < self->read_frames ||
+      written - self->read_frames > (guint64) self->mask + 1) {
+    GST_DEBUG ("writer %s, skipping to %" G_GUINT64_FORMAT,
+        written < self->read_frames ? "started over" : "lapped us", written);
+    self->read_frames = written;
+    InterlockedExchange64 ((volatile LONG64 *) & self->header->read_frames,
+        self->read_frames);
+  }
+
+  offset = (guint) (self->read_frames & self->mask);
+  n = (guint) MIN (written - self->read_frames, (guint64) max_frames);
+  n = MIN (n, self->mask + 1 - offset);
+  *data = self->data + (gsize) offset * self->bpf;
+
+  return n;
+}
+
+void
+gst_wasapi_shm_reader_consume (GstWasapiShmReader * self, guint n_frames)
+{
+  self->read_frames += n_frames;
+
+  /* Full barrier, we are done with the data before the writer sees it */
+  InterlockedExchange64 ((volatile LONG64 *) & self->header->read_frames,
+      self->read_frames);
+
+  if (self->event != NULL)
+    SetEvent (self->event);
+}
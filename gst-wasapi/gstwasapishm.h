@@ -0,0 +1,127 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_SHM_H__
+#define __GST_WASAPI_SHM_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Shared memory output of wasapisrc with shm-name, for a capture process
+ * that reads the audio without a pipeline of its own.
+ *
+ * The named file mapping holds a GstWasapiShmHeader followed by a ring of
+ * data_frames frames in the mix format, in device channel order. Each
+ * packet is copied there straight from the endpoint buffer, silent packets
+ * as zeroes. There is a single writer and it never waits:
+ * it stores the data and the packet record first, then advances
+ * write_frames and write_packets. Readers load those first and have lost
+ * data when they fell more than data_frames or GST_WASAPI_SHM_N_PACKETS
+ * behind. Both are 64 bit, aligned, and only ever grow.
+ *
+ * The auto-reset event "<name>-event" is set after each packet. All fields
+ * are in the byte order of the machine, i.e. little endian.
+ *
+ * The same layout goes the other way for wasapisink with shm-input: another
+ * process creates the mapping and writes into it like above, and the sink
+ * renders from it. The sink stores how far it read in read_frames and sets
+ * the auto-reset event "<name>-read-event" after each packet it took, so
+ * the writer can stay ahead of it by as much latency as it wants and never
+ * overwrite what wasn't played yet. The packet records are not needed for
+ * that. */
+#define GST_WASAPI_SHM_MAGIC "GWSM"
+#define GST_WASAPI_SHM_VERSION 1
+#define GST_WASAPI_SHM_N_PACKETS 256
+
+typedef struct
+{
+  /* Position of the first frame in the stream, the ring offset is this
+   * modulo data_frames */
+  guint64 position;
+  /* QPC position of the first frame, in 100 ns */
+  guint64 qpcpos;
+  guint32 frames;
+  /* AUDCLNT_BUFFERFLAGS_* of the packet */
+  guint32 flags;
+} GstWasapiShmPacket;
+
+typedef struct
+{
+  gchar magic[4];
+  guint32 version;
+  /* The ring starts this many bytes into the mapping */
+  guint32 data_offset;
+  /* Power of two */
+  guint32 data_frames;
+  guint32 rate;
+  guint32 channels;
+  guint32 bpf;
+  /* WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT */
+  guint32 format_tag;
+  guint32 bits;
+  guint32 channel_mask;
+  /* Frames and packets written so far */
+  volatile guint64 write_frames;
+  volatile guint64 write_packets;
+  /* Packet n is at n modulo GST_WASAPI_SHM_N_PACKETS */
+  GstWasapiShmPacket packets[GST_WASAPI_SHM_N_PACKETS];
+  /* Frames a reader that paces the writer took so far, see above. Within
+   * the padding before data_offset of earlier writers. */
+  volatile guint64 read_frames;
+} GstWasapiShmHeader;
+
+typedef struct _GstWasapiShm GstWasapiShm;
+
+/* Creates the mapping @name with room for at least @min_frames frames of
+ * @format, NULL if it can't. Readers that opened it before keep working. */
+GstWasapiShm *gst_wasapi_shm_new (const gchar * name,
+    const WAVEFORMATEX * format, guint min_frames);
+
+void gst_wasapi_shm_free (GstWasapiShm * shm);
+
+/* Appends @n_frames captured at @qpcpos. @data may be NULL for silence,
+ * like for packets with AUDCLNT_BUFFERFLAGS_SILENT. */
+void gst_wasapi_shm_write (GstWasapiShm * shm, const guint8 * data,
+    guint n_frames, guint64 qpcpos, guint32 flags);
+
+typedef struct _GstWasapiShmReader GstWasapiShmReader;
+
+/* Opens the mapping @name that another process writes, NULL if there is
+ * none or it doesn't hold the layout above. Reading goes on from the
+ * read_frames of the last reader. */
+GstWasapiShmReader *gst_wasapi_shm_reader_new (const gchar * name);
+
+void gst_wasapi_shm_reader_free (GstWasapiShmReader * reader);
+
+/* The format in the header, as it was when opened */
+const WAVEFORMATEX *gst_wasapi_shm_reader_get_format (GstWasapiShmReader *
+    reader);
+
+/* Points @data at up to @max_frames frames that were written and not read
+ * yet, in one piece, and returns how many. After the writer started over
+ * or lapped us, reading continues at what it writes next. */
+guint gst_wasapi_shm_reader_peek (GstWasapiShmReader * reader,
+    const guint8 ** data, guint max_frames);
+
+/* Done with @n_frames of what peek() gave, the writer may reuse them */
+void gst_wasapi_shm_reader_consume (GstWasapiShmReader * reader,
+    guint n_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SHM_H__ */
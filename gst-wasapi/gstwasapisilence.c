@@ -0,0 +1,356 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapisilence.h"
+#include "gstwasapicpu.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef GST_WASAPI_CPU_X86
+#include <immintrin.h>
+#elif defined(GST_WASAPI_CPU_ARM64)
+#include <arm_neon.h>
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* How long packets have to be quiet before they count as silence, so a
+ * pause between two words isn't cut into GAP buffers */
+#define HOLD_MS 50
+
+/* Samples looked at before checking for a loud one, small enough to stop
+ * early and large enough for the compiler to vectorize the block */
+#define BLOCK 64
+
+/* Whether none of the @n samples at @data is above @threshold */
+typedef gboolean (*GstWasapiSilenceFunc) (gconstpointer data, gsize n,
+    guint32 threshold);
+
+struct _GstWasapiSilence
+{
+  /* Picked once in new(), for the format */
+  GstWasapiSilenceFunc func;
+  /* Magnitude in the sample format, the bits of the float for F32 */
+  guint32 threshold;
+  gint channels;
+
+  guint hold_frames;
+  guint quiet_frames;
+};
+
+/* The magnitude of one sample @v, unsigned so that the most negative one
+ * isn't negative. Clearing the sign bit of a float leaves bits that
+ * compare like the magnitude, NaNs are above everything. */
+#define ABS_S16(v) \
+  ((guint32) ((v) < 0 ? -(gint32) (v) : (v)))
+#define ABS_S32(v) \
+  ((guint32) ((v) < 0 ? (guint32) 0 - (guint32) (v) : (guint32) (v)))
+#define ABS_F32(v) \
+  ((v) & 0x7fffffff)
+
+#define DEFINE_QUIET(name, type, ABS) \
+static gboolean \
+quiet_##name (gconstpointer data, gsize n, guint32 threshold) \
+{ \
+  const type *in = data; \
+  gsize ii = 0; \
+  \
+  for (; ii + BLOCK <= n; ii += BLOCK) { \
+    guint32 loud = 0; \
+    \
+    for (gsize jj = 0; jj < BLOCK; jj++) \
+      loud |= ABS (in[ii + jj]) > threshold; \
+    if (loud) \
+      return FALSE; \
+  } \
+  \
+  for (; ii < n; ii++) \
+    if (ABS (in[ii]) > threshold) \
+      return FALSE; \
+  \
+  return TRUE; \
+}
+
+DEFINE_QUIET (s16, gint16, ABS_S16);
+DEFINE_QUIET (s32, gint32, ABS_S32);
+DEFINE_QUIET (f32, guint32, ABS_F32);
+
+#ifdef GST_WASAPI_CPU_X86
+/* AVX2 versions of the above, a block of 64 samples per check. The
+ * magnitudes are compared as unsigned: max(x, threshold + 1) is x only
+ * where x is above the threshold. */
+static GST_WASAPI_TARGET ("avx2") gboolean
+quiet_s16_avx2 (gconstpointer data, gsize n, guint32 threshold)
+{
+  const gint16 *in = data;
+  gsize ii = 0;
+  const __m256i above = _mm256_set1_epi16 ((gint16) MIN (threshold + 1,
+          G_MAXUINT16));
+
+  /* Nothing is above a threshold that doesn't fit */
+  if (threshold >= G_MAXUINT16)
+    return TRUE;
+
+  for (; ii + BLOCK <= n; ii += BLOCK) {
+    __m256i loud = _mm256_setzero_si256 ();
+    gsize jj;
+
+    for (jj = 0; jj < BLOCK; jj += 16) {
+      __m256i v = _mm256_abs_epi16 (_mm256_loadu_si256 ((const __m256i *)
+              (in + ii + jj)));
+
+      loud = _mm256_or_si256 (loud, _mm256_cmpeq_epi16 (_mm256_max_epu16 (v,
+                  above), v));
+    }
+    if (!_mm256_testz_si256 (loud, loud))
+      return FALSE;
+  }
+
+  for (; ii < n; ii++)
+    if (ABS_S16 (in[ii]) > threshold)
+      return FALSE;
+
+  return TRUE;
+}
+
+static GST_WASAPI_TARGET ("avx2") gboolean
+quiet_32_avx2 (gconstpointer data, gsize n, guint32 threshold,
+    gboolean is_float)
+{
+  const gint32 *in = data;
+  gsize ii = 0;
+  const __m256i above = _mm256_set1_epi32 ((gint32) (threshold + 1));
+  const __m256i mask = _mm256_set1_epi32 (0x7fffffff);
+
+  if (threshold == G_MAXUINT32)
+    return TRUE;
+
+  for (; ii + BLOCK <= n; ii += BLOCK) {
+    __m256i loud = _mm256_setzero_si256 ();
+    gsize jj;
+
+    for (jj = 0; jj < BLOCK; jj += 8) {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (in + ii + jj));
+
+      v = is_float ? _mm256_and_si256 (v, mask) : _mm256_abs_epi32 (v);
+      loud = _mm256_or_si256 (loud, _mm256_cmpeq_epi32 (_mm256_max_epu32 (v,
+                  above), v));
+    }
+    if (!_mm256_testz_si256 (loud, loud))
+      return FALSE;
+  }
+
+  for (; ii < n; ii++)
+    if ((is_float ? ABS_F32 ((guint32) in[ii]) : ABS_S32 (in[ii])) >
+        threshold)
+      return FALSE;
+
+  return TRUE;
+}
+
+static GST_WASAPI_TARGET ("avx2") gboolean
+quiet_s32_avx2 (gconstpointer data, gsize n, guint32 threshold)
+{
+  return quiet_32_avx2 (data, n, threshold, FALSE);
+}
+
+static GST_WASAPI_TARGET ("avx2") gboolean
+quiet_f32_avx2 (gconstpointer data, gsize n, guint32 threshold)
+{
+  return quiet_32_avx2 (data, n, threshold, TRUE);
+}
+#elif defined(GST_WASAPI_CPU_ARM64)
+/* NEON versions, also a block of 64 samples per check. NEON compares
+ * unsigned directly, and the absolute of the most negative sample wraps
+ * to itself, which is its magnitude as unsigned. */
+static gboolean
+quiet_s16_neon (gconstpointer data, gsize n, guint32 threshold)
+{
+  const gint16 *in = data;
+  gsize ii = 0;
+  uint16x8_t limit;
+
+  if (threshold >= G_MAXUINT16)
+    return TRUE;
+  limit = vdupq_n_u16 ((guint16) threshold);
+
+  for (; ii + BLOCK <= n; ii += BLOCK) {
+    uint16x8_t loud = vdupq_n_u16 (0);
+    gsize jj;
+
+    for (jj = 0; jj < BLOCK; jj += 8) {
+      uint16x8_t v = vreinterpretq_u16_s16 (vabsq_s16 (vld1q_s16 (in + ii +
+                  jj)));
+
+      loud = vorrq_u16 (loud, vcgtq_u16 (v, limit));
+    }
+    if (vmaxvq_u16 (loud) != 0)
+      return FALSE;
+  }
+
+  for (; ii < n; ii++)
+    if (ABS_S16 (in[ii]) > threshold)
+      return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+quiet_32_neon (gconstpointer data, gsize n, guint32 threshold,
+    gboolean is_float)
+{
+  const gint32 *in = data;
+  gsize ii = 0;
+  const uint32x4_t limit = vdupq_n_u32 (threshold);
+  const uint32x4_t mask = vdupq_n_u32 (0x7fffffff);
+
+  for (; ii + BLOCK <= n; ii += BLOCK) {
+    uint32x4_t loud = vdupq_n_u32 (0);
+    gsize jj;
+
+    for (jj = 0; jj < BLOCK; jj += 4) {
+      int32x4_t s = vld1q_s32 (in + ii + jj);
+      uint32x4_t v = is_float ? vandq_u32 (vreinterpretq_u32_s32 (s), mask) :
+          vreinterpretq_u32_s32 (vabsq_s32 (s));
+
+      loud = vorrq_u32 (loud, vcgtq_u32 (v, limit));
+    }
+    if (vmaxvq_u32 (loud) != 0)
+      return FALSE;
+  }
+
+  for (; ii < n; ii++)
+    if ((is_float ? ABS_F32 ((guint32) in[ii]) : ABS_S32 (in[ii])) >
+        threshold)
+      return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+quiet_s32_neon (gconstpointer data, gsize n, guint32 threshold)
+{
+  return quiet_32_neon (data, n, threshold, FALSE);
+}
+
+static gboolean
+quiet_f32_neon (gconstpointer data, gsize n, guint32 threshold)
+{
+  return quiet_32_neon (data, n, threshold, TRUE);
+}
+#endif
+
+GstWasapiSilence *
+gst_wasapi_silence_new (const WAVEFORMATEX * format, gdouble threshold_db)
+{
+  GstWasapiSilence *self;
+  GstWasapiSilenceFunc func;
+  gdouble level = pow (10.0, threshold_db / 20.0);
+  guint32 threshold;
+  gboolean is_float;
+
+  if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    is_float = TRUE;
+  else if (format->wFormatTag == WAVE_FORMAT_PCM)
+    is_float = FALSE;
+  else if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    is_float = IsEqualGUID (&((WAVEFORMATEXTENSIBLE *) format)->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+  else
+    return NULL;
+
+  if (is_float && format->wBitsPerSample == 32) {
+    gfloat f = (gfloat) level;
+
+    memcpy (&threshold, &f, sizeof (threshold));
+    func = quiet_f32;
+  } else if (!is_float && format->wBitsPerSample == 16) {
+    threshold = (guint32) MIN (floor (level * 32768.0), G_MAXUINT16);
+    func = quiet_s16;
+  } else if (!is_float && format->wBitsPerSample == 32) {
+    /* 24 bit samples in 32 bits are in the upper bits */
+    threshold = (guint32) MIN (floor (level * 2147483648.0), G_MAXUINT32);
+    func = quiet_s32;
+  } else {
+    return NULL;
+  }
+
+#ifdef GST_WASAPI_CPU_X86
+  if (gst_wasapi_cpu_get_flags () & GST_WASAPI_CPU_AVX2) {
+    if (func == quiet_s16)
+      func = quiet_s16_avx2;
+    else if (func == quiet_s32)
+      func = quiet_s32_avx2;
+    else
+      func = quiet_f32_avx2;
+  }
+#elif defined(GST_WASAPI_CPU_ARM64)
+  if (gst_wasapi_cpu_get_flags () & GST_WASAPI_CPU_NEON) {
+    if (func == quiet_s16)
+      func = quiet_s16_neon;
+    else if (func == quiet_s32)
+      func = quiet_s32_neon;
+    else
+      func = quiet_f32_neon;
+  }
+#endif
+
+  self = g_slice_new0 (GstWasapiSilence);
+  self->func = func;
+  self->threshold = threshold;
+  self->channels = format->nChannels;
+  self->hold_frames = format->nSamplesPerSec * HOLD_MS / 1000;
+
+  GST_DEBUG ("silence below %.1f dBFS, threshold %#x", threshold_db,
+      threshold);
+
+  return self;
+}
+
+void
+gst_wasapi_silence_free (GstWasapiSilence * self)
+{
+  g_slice_free (GstWasapiSilence, self);
+}
+
+void
+gst_wasapi_silence_reset (GstWasapiSilence * self)
+{
+  self->quiet_frames = 0;
+}
+
+gboolean
+gst_wasapi_silence_process (GstWasapiSilence * self, gconstpointer data,
+    guint n_frames)
+{
+  if (data != NULL && !self->func (data, (gsize) n_frames * self->channels,
+          self->threshold)) {
+    self->quiet_frames = 0;
+    return FALSE;
+  }
+
+  self->quiet_frames = MIN ((guint64) self->quiet_frames + n_frames,
+      G_MAXUINT);
+
+  return self->quiet_frames >= self->hold_frames;
+}
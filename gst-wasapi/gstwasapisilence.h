@@ -0,0 +1,52 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_SILENCE_H__
+#define __GST_WASAPI_SILENCE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Digital silence detection of wasapisrc with detect-silence=true.
+ *
+ * Many drivers never set AUDCLNT_BUFFERFLAGS_SILENT, and deliver zeros or
+ * dither of a bit or two instead. A packet with no sample above the
+ * threshold is quiet, and once the packets were quiet for a while they are
+ * treated like silent ones, pushed as GAP. The first loud packet ends that
+ * right away, so only the start of a silence is ever passed on as it is.
+ * The scan stops at the first loud block, live signal costs next to
+ * nothing. */
+typedef struct _GstWasapiSilence GstWasapiSilence;
+
+/* Silence below @threshold_db dBFS. NULL unless @format is 32 bit float or
+ * 16 or 32 bit integer PCM. */
+GstWasapiSilence *gst_wasapi_silence_new (const WAVEFORMATEX * format,
+    gdouble threshold_db);
+
+void gst_wasapi_silence_free (GstWasapiSilence * silence);
+
+/* Forgets how long it has been quiet, after a discontinuity */
+void gst_wasapi_silence_reset (GstWasapiSilence * silence);
+
+/* Whether the @n_frames of @data should be treated as silence. @data is
+ * NULL for packets that had the silent flag. */
+gboolean gst_wasapi_silence_process (GstWasapiSilence * silence,
+    gconstpointer data, guint n_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SILENCE_H__ */
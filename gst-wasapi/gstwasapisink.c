@@ -37,14 +37,25 @@
  * gst-launch-1.0 -v audiotestsrc samplesperbuffer=160 ! wasapisink low-latency=true
  * ]| Same as above, but with the minimum possible latency
  *
+ * With slave-method=custom the sink follows a pipeline clock that isn't its
+ * own, like a PTP or NTP clock, by resampling instead of skipping: the
+ * drift of the IAudioClock position against that clock is absorbed
+ * continuously, so playback stays glitch-free over hours.
+ *
  */
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
 
 #include "gstwasapisink.h"
+#include "gstwasapiringbuffer.h"
+#include "gstwasapidevicecache.h"
+#include "gstwasapitrace.h"
+#include "gstwasapinotify.h"
+#include "gstwasapiautotune.h"
 
 #include <avrt.h>
+#include <math.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_wasapi_sink_debug);
 #define GST_CAT_DEFAULT gst_wasapi_sink_debug
@@ -52,25 +63,122 @@ GST_DEBUG_CATEGORY_STATIC (gst_wasapi_sink_debug);
 static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS));
+    GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS "; "
+        GST_WASAPI_PASSTHROUGH_CAPS));
 
 #define DEFAULT_ROLE          GST_WASAPI_DEVICE_ROLE_CONSOLE
 #define DEFAULT_MUTE          FALSE
 #define DEFAULT_EXCLUSIVE     FALSE
 #define DEFAULT_LOW_LATENCY   FALSE
 #define DEFAULT_AUDIOCLIENT3  TRUE
+/* Below this latency-time, in us, only the IAudioClient3 engine periods
+ * get close to it, the default shared period is about 10 ms */
+#define AUDIOCLIENT3_LATENCY_TIME 10000
+#define DEFAULT_DEVICE_CLOCK  TRUE
+#define DEFAULT_ZERO_COPY     FALSE
+#define DEFAULT_PREFILL_SILENCE TRUE
+#define DEFAULT_PREWARM       FALSE
+#define DEFAULT_AUTOCONVERT   FALSE
+#define DEFAULT_MATCH_FORMAT  FALSE
+#define DEFAULT_OFFLOAD       FALSE
+#define DEFAULT_RAW           FALSE
+#define DEFAULT_CATEGORY      GST_WASAPI_STREAM_CATEGORY_OTHER
+#define DEFAULT_ADAPTIVE_BUFFER FALSE
+#define DEFAULT_AUTO_TUNE     FALSE
+#define DEFAULT_SHARED_CLIENT FALSE
+#define DEFAULT_DEVICE_CHANNELS NULL
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_FOLLOW_DEFAULT FALSE
+#define DEFAULT_STREAM_ROUTING FALSE
+#define DEFAULT_MMCSS_TASK    GST_WASAPI_DEFAULT_MMCSS_TASK
+#define DEFAULT_MMCSS_PRIORITY GST_WASAPI_MMCSS_PRIORITY_NORMAL
+#define DEFAULT_THREAD_AFFINITY 0
+#define DEFAULT_PROCESSOR_GROUP 0
+#define DEFAULT_POWER_THROTTLING TRUE
+#define DEFAULT_PERFORMANCE_CORES FALSE
+#define DEFAULT_LATENCY_PROBE FALSE
+#define DEFAULT_AEC_REFERENCE FALSE
+#define DEFAULT_JITTER_BUFFER FALSE
+#define DEFAULT_JITTER_MAX_LATENCY (200 * GST_MSECOND)
+#define DEFAULT_CONCEAL       FALSE
+#define DEFAULT_KEEP_RUNNING  FALSE
+#define DEFAULT_SPIN_WAIT     FALSE
+#define DEFAULT_START_QPC     0
+#define DEFAULT_ASYNC_OPEN    FALSE
+#define DEFAULT_EMIT_NEED_FRAMES FALSE
+#define DEFAULT_SHM_INPUT     NULL
+#define DEFAULT_VOLUME        1.0
+
+/* The device position moves against the pipeline clock by less than this
+ * between two packets unless it stopped or started over, clocks never
+ * drift that fast */
+#define SLAVE_MAX_STEP (GST_MSECOND)
+/* Pipeline clock readings that took longer than this, in 100 ns, can't be
+ * matched with the device position */
+#define SLAVE_MAX_READ 1000
+/* Of channel-delays, in milliseconds, and channel-gains, in dB */
+#define MAX_CHANNEL_DELAY 1000.0
+#define MIN_CHANNEL_GAIN (-96.0)
+#define MAX_CHANNEL_GAIN 24.0
 
 enum
 {
   PROP_0,
   PROP_ROLE,
   PROP_MUTE,
+  PROP_VOLUME,
   PROP_DEVICE,
+  PROP_DEVICE_NAME,
   PROP_EXCLUSIVE,
   PROP_LOW_LATENCY,
-  PROP_AUDIOCLIENT3
+  PROP_AUDIOCLIENT3,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_DEVICE_CLOCK,
+  PROP_ZERO_COPY,
+  PROP_PREFILL_SILENCE,
+  PROP_PREWARM,
+  PROP_AUTOCONVERT,
+  PROP_MATCH_FORMAT,
+  PROP_OFFLOAD,
+  PROP_RAW,
+  PROP_CATEGORY,
+  PROP_ADAPTIVE_BUFFER,
+  PROP_AUTO_TUNE,
+  PROP_SHARED_CLIENT,
+  PROP_DEVICE_CHANNELS,
+  PROP_FOLLOW_DEFAULT,
+  PROP_STREAM_ROUTING,
+  PROP_MMCSS_TASK,
+  PROP_MMCSS_PRIORITY,
+  PROP_THREAD_AFFINITY,
+  PROP_PROCESSOR_GROUP,
+  PROP_POWER_THROTTLING,
+  PROP_PERFORMANCE_CORES,
+  PROP_LATENCY_PROBE,
+  PROP_AEC_REFERENCE,
+  PROP_JITTER_BUFFER,
+  PROP_JITTER_MAX_LATENCY,
+  PROP_CONCEAL,
+  PROP_KEEP_RUNNING,
+  PROP_START_QPC,
+  PROP_STARTUP_TIMES,
+  PROP_ASYNC_OPEN,
+  PROP_EMIT_NEED_FRAMES,
+  PROP_CHANNEL_DELAYS,
+  PROP_CHANNEL_GAINS,
+  PROP_SPIN_WAIT,
+  PROP_SHM_INPUT
+};
+
+enum
+{
+  SIGNAL_NEED_FRAMES,
+  LAST_SIGNAL
 };
 
+static guint gst_wasapi_sink_signals[LAST_SIGNAL] = { 0 };
+
 static void gst_wasapi_sink_dispose (GObject * object);
 static void gst_wasapi_sink_finalize (GObject * object);
 static void gst_wasapi_sink_set_property (GObject * object, guint prop_id,
@@ -78,21 +186,46 @@ static void gst_wasapi_sink_set_property (GObject * object, guint prop_id,
 static void gst_wasapi_sink_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
 
+static GstStateChangeReturn gst_wasapi_sink_change_state (GstElement *
+    element, GstStateChange transition);
+
+static gboolean gst_wasapi_sink_query (GstBaseSink * bsink, GstQuery * query);
+static GstFlowReturn gst_wasapi_sink_wait_event (GstBaseSink * bsink,
+    GstEvent * event);
+static gboolean gst_wasapi_sink_unlock (GstBaseSink * bsink);
+static gboolean gst_wasapi_sink_unlock_stop (GstBaseSink * bsink);
 static GstCaps *gst_wasapi_sink_get_caps (GstBaseSink * bsink,
     GstCaps * filter);
+static GstAudioRingBuffer *gst_wasapi_sink_create_ringbuffer (GstAudioBaseSink
+    * sink);
+static void gst_wasapi_sink_custom_slaving (GstAudioBaseSink * sink,
+    GstClockTime etime, GstClockTime itime, GstClockTimeDiff * requested_skew,
+    GstAudioBaseSinkDiscontReason discont_reason, gpointer user_data);
+static GstBuffer *gst_wasapi_sink_payload (GstAudioBaseSink * sink,
+    GstBuffer * buf);
 
 static gboolean gst_wasapi_sink_prepare (GstAudioSink * asink,
     GstAudioRingBufferSpec * spec);
 static gboolean gst_wasapi_sink_unprepare (GstAudioSink * asink);
 static gboolean gst_wasapi_sink_open (GstAudioSink * asink);
 static gboolean gst_wasapi_sink_close (GstAudioSink * asink);
+static gboolean gst_wasapi_sink_finish_open (GstWasapiSink * self);
+static void gst_wasapi_sink_release_warm_client (GstWasapiSink * self);
 static gint gst_wasapi_sink_write (GstAudioSink * asink,
     gpointer data, guint length);
 static guint gst_wasapi_sink_delay (GstAudioSink * asink);
 static void gst_wasapi_sink_reset (GstAudioSink * asink);
 
+static GstClockTime gst_wasapi_sink_get_time (GstClock * clock,
+    gpointer user_data);
+static gboolean gst_wasapi_sink_get_played (GstWasapiSink * self,
+    guint64 * ret_played);
+static gboolean gst_wasapi_sink_get_position_delay (GstWasapiSink * self,
+    guint * ret_delay);
+
 #define gst_wasapi_sink_parent_class parent_class
-G_DEFINE_TYPE (GstWasapiSink, gst_wasapi_sink, GST_TYPE_AUDIO_SINK);
+G_DEFINE_TYPE_WITH_CODE (GstWasapiSink, gst_wasapi_sink, GST_TYPE_AUDIO_SINK,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_STREAM_VOLUME, NULL));
 
 static void
 gst_wasapi_sink_class_init (GstWasapiSinkClass * klass)
@@ -100,6 +233,8 @@ gst_wasapi_sink_class_init (GstWasapiSinkClass * klass)
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
   GstBaseSinkClass *gstbasesink_class = GST_BASE_SINK_CLASS (klass);
+  GstAudioBaseSinkClass *gstaudiobasesink_class =
+      GST_AUDIO_BASE_SINK_CLASS (klass);
   GstAudioSinkClass *gstaudiosink_class = GST_AUDIO_SINK_CLASS (klass);
 
   gobject_class->dispose = gst_wasapi_sink_dispose;
@@ -120,12 +255,28 @@ gst_wasapi_sink_class_init (GstWasapiSinkClass * klass)
           DEFAULT_MUTE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_PLAYING));
 
+  g_object_class_install_property (gobject_class,
+      PROP_VOLUME,
+      g_param_spec_double ("volume", "Volume",
+          "Volume of this stream, applied by the audio engine when it mixes. "
+          "Only in shared mode", 0.0, 1.0, DEFAULT_VOLUME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
   g_object_class_install_property (gobject_class,
       PROP_DEVICE,
       g_param_spec_string ("device", "Device",
-          "WASAPI playback device as a GUID string",
+          "WASAPI playback device as a GUID string. Shared mode streams move "
+          "to a new one while running",
           NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE_NAME,
+      g_param_spec_string ("device-name", "Device name",
+          "Friendly name of the playback device, or a glob pattern like "
+          "\"*USB*\" for it, when device is unset", NULL, G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+
   g_object_class_install_property (gobject_class,
       PROP_EXCLUSIVE,
       g_param_spec_boolean ("exclusive", "Exclusive mode",
@@ -142,9 +293,388 @@ gst_wasapi_sink_class_init (GstWasapiSinkClass * klass)
       PROP_AUDIOCLIENT3,
       g_param_spec_boolean ("use-audioclient3", "Use the AudioClient3 API",
           "Use the Windows 10 AudioClient3 API when available and if the "
-          "low-latency property is set to TRUE",
+          "low-latency property is set to TRUE or latency-time is below 10 "
+          "ms. Without low-latency the engine period then follows "
+          "latency-time and the ringbuffer buffer-time",
           DEFAULT_AUDIOCLIENT3, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+      PROP_STARTUP_TIMES,
+      g_param_spec_boxed ("startup-times", "Startup times",
+          "How long each phase of opening and starting the stream took, in "
+          "ns: enumerator, endpoint, activate, mix-format, initialize, "
+          "get-service, start, first-event and their total. Also posted as "
+          "wasapi-startup element message on the first device event",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Render statistics: glitches, wakeup-interval-min/avg/max (ns), "
+          "padding-high-water (frames), underruns, underrun-time (ns) and "
+          "drift-ppm against the "
+          "system clock, and log2 histograms (buckets in us) with p99/p999 "
+          "(ns) of wakeup-interval and buffer-hold, and the CPU cycles per "
+          "second of audio of the device and streaming threads. The overflow "
+          "and drain fields are always 0",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "Stats interval",
+          "Post a wasapi-stats element message this often, in ns, with what "
+          "changed since the last one: frames, glitches, overflow-saved and "
+          "overflow-dropped (bytes), underruns, drift-ppm, wakeups, "
+          "wakeup-interval-avg/p99/p999 (ns), and device-cycles and "
+          "streaming-cycles. Also streams, the elements reporting in this "
+          "process, and process-cpu, the CPU time of the process in percent "
+          "of one core, so N concurrent streams can be compared. Built on a "
+          "thread of its own. 0 posts none, takes effect when prepared", 0,
+          G_MAXUINT64,
+          DEFAULT_STATS_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE_CLOCK,
+      g_param_spec_boolean ("device-clock", "Device clock",
+          "Provide the clock of the endpoint, driven by the position the "
+          "device played and interpolated with the performance counter, "
+          "instead of one following the amount of samples written. All "
+          "elements on the same endpoint, or on endpoints of one device like "
+          "the microphone of a USB headset, share this clock",
+          DEFAULT_DEVICE_CLOCK, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ZERO_COPY,
+      g_param_spec_boolean ("zero-copy", "Zero-copy rendering",
+          "Write the samples of upstream straight into the device buffer from "
+          "the streaming thread, instead of going through a ringbuffer and a "
+          "writer thread. Only in shared mode, takes effect when going to "
+          "READY", DEFAULT_ZERO_COPY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PREFILL_SILENCE,
+      g_param_spec_boolean ("prefill-silence", "Prefill silence",
+          "Fill the device buffer with silence before starting it, as "
+          "recommended by the WASAPI documentation. When disabled, the device "
+          "is started once a period of samples was written, so they are heard "
+          "one period after starting or seeking instead of one buffer. "
+          "Exclusive mode always prefills", DEFAULT_PREFILL_SILENCE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PREWARM,
+      g_param_spec_boolean ("prewarm", "Prewarm",
+          "Keep the initialized client when going to READY, and start it "
+          "again with the next samples if the caps and buffer sizes didn't "
+          "change, without a new Initialize() or silent prefill, so back to "
+          "back tracks play gapless. Whatever was still queued plays first. "
+          "Only in shared mode, not offloaded or with shared-client",
+          DEFAULT_PREWARM, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_AUTOCONVERT,
+      g_param_spec_boolean ("autoconvert", "Autoconvert",
+          "Accept any PCM rate and sample format and let the audio engine "
+          "convert it to the mix format. Only in shared mode, has to be set "
+          "before the device is opened", DEFAULT_AUTOCONVERT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MATCH_FORMAT,
+      g_param_spec_boolean ("match-format", "Match format",
+          "With autoconvert, have the audio engine switch the endpoint to the "
+          "rate and sample format of the stream when no other stream holds "
+          "it, instead of converting. Windows 10 and newer",
+          DEFAULT_MATCH_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_OFFLOAD,
+      g_param_spec_boolean ("offload", "Offload",
+          "Request a hardware offloaded stream if the endpoint supports it, "
+          "with large buffers to save CPU and power. Overrides low-latency. "
+          "Only in shared mode, Windows 10 and newer", DEFAULT_OFFLOAD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RAW,
+      g_param_spec_boolean ("raw", "Raw",
+          "Render without the effects of the endpoint, like loudness "
+          "equalization and virtual surround, for lower latency and "
+          "bit-transparent output. Only in shared mode, Windows 10 and newer",
+          DEFAULT_RAW, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CATEGORY,
+      g_param_spec_enum ("category", "Category",
+          "Category of the stream, which decides about ducking and the "
+          "processing of the endpoint. Only in shared mode, Windows 10 and "
+          "newer", GST_WASAPI_TYPE_STREAM_CATEGORY, DEFAULT_CATEGORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ADAPTIVE_BUFFER,
+      g_param_spec_boolean ("adaptive-buffer", "Adaptive buffer",
+          "Start with the smallest ringbuffer and grow it when wakeup "
+          "jitter or underruns come close to the limit, shrinking it again "
+          "after a stable minute. Learned per endpoint, a new size takes "
+          "effect with the next prepare. Not with shared-client",
+          DEFAULT_ADAPTIVE_BUFFER, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_AUTO_TUNE,
+      g_param_spec_boolean ("auto-tune", "Auto tune",
+          "Pick exclusive, low-latency and audioclient3 by streaming each "
+          "combination the endpoint accepts for a moment the first time it's "
+          "opened, and keeping the one with the lowest latency that didn't "
+          "glitch. Remembered per endpoint in the user cache directory, "
+          "overrides these properties",
+          DEFAULT_AUTO_TUNE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SHARED_CLIENT,
+      g_param_spec_boolean ("shared-client", "Shared client",
+          "Mix into one stream per endpoint shared by all sinks of the "
+          "process that set this, instead of opening a stream of our own. "
+          "Needs the mix format in float, falls back to an own stream "
+          "otherwise. Only in shared mode, takes effect when going to READY",
+          DEFAULT_SHARED_CLIENT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE_CHANNELS,
+      g_param_spec_string ("device-channels", "Device channels",
+          "With shared-client, only render into these channels of the "
+          "endpoint, numbered from 1 and comma separated, e.g. \"3,4\". "
+          "Sinks on other channels of the same endpoint are interleaved "
+          "with ours straight into the device buffer. Takes float samples "
+          "at the mix rate with that many channels, in that order. Has to "
+          "be set before the device is opened", DEFAULT_DEVICE_CHANNELS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_FOLLOW_DEFAULT,
+      g_param_spec_boolean ("follow-default-device", "Follow default device",
+          "Switch to the new default device when it changes, instead of "
+          "posting a wasapi_restart message. Only in shared mode without "
+          "device-clock or shared-client, and when no device is set",
+          DEFAULT_FOLLOW_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STREAM_ROUTING,
+      g_param_spec_boolean ("stream-routing", "Stream routing",
+          "Open the default device through the virtual default device, so "
+          "the audio engine moves the stream to a new default device by "
+          "itself, without reopening it or a wasapi_restart message. Only "
+          "in shared mode without auto-tune, device-clock or shared-client, "
+          "and when no device is set. Windows 10 and newer, otherwise the "
+          "current default device is opened. Has to be set before the "
+          "device is opened",
+          DEFAULT_STREAM_ROUTING, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MMCSS_TASK,
+      g_param_spec_string ("mmcss-task", "MMCSS task",
+          "Multimedia Class Scheduler task of the realtime thread, "
+          "e.g. \"Pro Audio\", \"Audio\" or \"Games\". Takes effect when "
+          "prepared", DEFAULT_MMCSS_TASK,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MMCSS_PRIORITY,
+      g_param_spec_enum ("mmcss-priority", "MMCSS priority",
+          "Priority of the realtime thread within its MMCSS task. Takes "
+          "effect when prepared", GST_WASAPI_TYPE_MMCSS_PRIORITY,
+          DEFAULT_MMCSS_PRIORITY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_THREAD_AFFINITY,
+      g_param_spec_uint64 ("thread-affinity", "Thread affinity",
+          "Mask of the processors within processor-group the realtime thread "
+          "may run on, 0 to not pin it. Takes effect when prepared",
+          0, G_MAXUINT64, DEFAULT_THREAD_AFFINITY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PROCESSOR_GROUP,
+      g_param_spec_uint ("processor-group", "Processor group",
+          "Processor group thread-affinity refers to", 0, G_MAXUINT16,
+          DEFAULT_PROCESSOR_GROUP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_POWER_THROTTLING,
+      g_param_spec_boolean ("power-throttling", "Power throttling",
+          "Let Windows throttle the realtime thread to save power (EcoQoS), "
+          "e.g. while the application is in the background. FALSE opts it "
+          "out. Takes effect when prepared", DEFAULT_POWER_THROTTLING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PERFORMANCE_CORES,
+      g_param_spec_boolean ("performance-cores", "Performance cores",
+          "Keep the realtime thread on the performance cores of a hybrid "
+          "CPU, through CPU sets. Nothing on CPUs with one kind of core. "
+          "Takes effect when prepared", DEFAULT_PERFORMANCE_CORES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LATENCY_PROBE,
+      g_param_spec_boolean ("latency-probe", "Latency probe",
+          "Overwrite the output with a pulse once a second, for a wasapisrc "
+          "with latency-probe that captures it to measure the round trip. Not "
+          "with shared-client. Takes effect when prepared",
+          DEFAULT_LATENCY_PROBE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_AEC_REFERENCE,
+      g_param_spec_boolean ("aec-reference", "AEC reference",
+          "Publish what is rendered with the time it is played, for a "
+          "loopback wasapisrc with aec-reference on the same endpoint in this "
+          "process. Not with shared-client. Takes effect when prepared",
+          DEFAULT_AEC_REFERENCE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_JITTER_BUFFER,
+      g_param_spec_boolean ("jitter-buffer", "Jitter buffer",
+          "Queue the samples of upstream in an adaptive jitter buffer and "
+          "render them from a thread of ours, for bursty streams from the "
+          "network. The fill follows the arrival jitter and is held with "
+          "small rate corrections, so a small device buffer gets no gaps "
+          "and the latency doesn't grow. Samples are then played in order, "
+          "regardless of their timestamps. Only in shared mode, not with "
+          "shared-client, takes effect when going to READY",
+          DEFAULT_JITTER_BUFFER, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_JITTER_MAX_LATENCY,
+      g_param_spec_uint64 ("jitter-max-latency", "Jitter max latency",
+          "Most the jitter buffer holds (in nanoseconds), upstream waits "
+          "when it is full. It aims for half of it at most. Takes effect "
+          "when going to READY", 0, 10 * GST_SECOND, DEFAULT_JITTER_MAX_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CONCEAL,
+      g_param_spec_boolean ("conceal", "Conceal underruns",
+          "Where there is nothing to render, because the jitter buffer ran "
+          "empty or upstream left a gap with zero-copy, play a fading repeat "
+          "of the last period instead of silence and crossfade back to the "
+          "real samples. After the device ran dry, its samples fade in. "
+          "Only for 32 bit float and 16 bit samples, takes effect when "
+          "prepared", DEFAULT_CONCEAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_KEEP_RUNNING,
+      g_param_spec_boolean ("keep-running", "Keep running",
+          "Keep the device stream running while paused or flushing and "
+          "write silence to it, instead of stopping and resetting it, so "
+          "playback resumes without restarting the stream. What the device "
+          "buffer still holds is played out", DEFAULT_KEEP_RUNNING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_START_QPC,
+      g_param_spec_uint64 ("start-qpc", "Start QPC time",
+          "QPC time (in 100 ns) at which the first sample after prepare is "
+          "played, silence is written before it as the device position "
+          "requires. With the system clock as pipeline clock this is its "
+          "time / 100, so sinks on several endpoints can start in phase. "
+          "0 starts right away. Not with zero-copy or jitter-buffer, takes "
+          "effect when prepared", 0, G_MAXUINT64, DEFAULT_START_QPC,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ASYNC_OPEN,
+      g_param_spec_boolean ("async-open", "Async open",
+          "Look up and activate the device on a thread of its own, so going "
+          "to READY returns right away. Caps queries and prepare wait for "
+          "it, and a device that fails to open is an error message instead "
+          "of a failed state change. Has to be set before the device is "
+          "opened", DEFAULT_ASYNC_OPEN,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_EMIT_NEED_FRAMES,
+      g_param_spec_boolean ("emit-need-frames", "Emit need-frames",
+          "Have the application fill the device buffer from need-frames "
+          "instead of playing the samples of upstream, which only pace the "
+          "stream then. Also while paused with keep-running",
+          DEFAULT_EMIT_NEED_FRAMES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNEL_DELAYS,
+      gst_param_spec_array ("channel-delays", "Channel delays",
+          "Delay of each channel of the endpoint in milliseconds, in the "
+          "order of the endpoint, e.g. <0.0, 0.0, 2.5, 2.5> to line up "
+          "speakers at different distances. Channels without one aren't "
+          "delayed. Applied while copying into the device buffer, for 32 bit "
+          "float and 16 or 32 bit samples and not with shared-client. Takes "
+          "effect when prepared",
+          g_param_spec_double ("delay", "Delay",
+              "Delay of one channel in milliseconds", 0, MAX_CHANNEL_DELAY,
+              0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNEL_GAINS,
+      gst_param_spec_array ("channel-gains", "Channel gains",
+          "Gain of each channel of the endpoint in dB, in the order of the "
+          "endpoint, like channel-delays. Channels without one are left as "
+          "they are. Changes apply right away once there was a gain or a "
+          "delay when prepared",
+          g_param_spec_double ("gain", "Gain", "Gain of one channel in dB",
+              MIN_CHANNEL_GAIN, MAX_CHANNEL_GAIN, 0,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SPIN_WAIT,
+      g_param_spec_boolean ("spin-wait", "Spin wait",
+          "In exclusive mode, sleep until shortly before the next device "
+          "period is due and then poll the client for it, instead of "
+          "waiting for the event. Wakes up within microseconds at periods "
+          "where the scheduling latency is a good part of the period, at the "
+          "cost of a busy core. Needs Windows 10 1803, takes effect when "
+          "prepared", DEFAULT_SPIN_WAIT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SHM_INPUT,
+      g_param_spec_string ("shm-input", "Shared memory input",
+          "Name of a file mapping another process writes audio into, in the "
+          "layout of wasapisrc shm-name, to render from instead of "
+          "upstream. A thread of ours copies it straight into the device "
+          "buffer whenever the device has room, and the sink plays without "
+          "a pad linked or any preroll. The mapping has to exist when going "
+          "to PAUSED. Only in shared mode, not with shared-client, takes "
+          "effect when going to READY", DEFAULT_SHM_INPUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstWasapiSink::need-frames:
+   * @sink: the wasapisink
+   * @data: the device buffer to fill, in the mix format of the stream
+   * @frames: the number of frames to fill
+   *
+   * With emit-need-frames, emitted on the thread that renders each time
+   * there is room in the device buffer, between GetBuffer and
+   * ReleaseBuffer. The mix format is the device format, which differs from
+   * the caps when the sink converts. The handler must not block, the device
+   * runs dry meanwhile.
+   *
+   * Returns: TRUE if @data was filled, FALSE to play silence
+   */
+  gst_wasapi_sink_signals[SIGNAL_NEED_FRAMES] =
+      g_signal_new ("need-frames", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, g_signal_accumulator_true_handled, NULL,
+      g_cclosure_marshal_generic, G_TYPE_BOOLEAN, 2, G_TYPE_POINTER,
+      G_TYPE_UINT);
+
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_wasapi_sink_change_state);
+
   gst_element_class_add_static_pad_template (gstelement_class, &sink_template);
   gst_element_class_set_static_metadata (gstelement_class, "WasapiSrc",
       "Sink/Audio",
@@ -153,6 +683,16 @@ gst_wasapi_sink_class_init (GstWasapiSinkClass * klass)
       "Ole André Vadla Ravnås <ole.andre.ravnas@tandberg.com>");
 
   gstbasesink_class->get_caps = GST_DEBUG_FUNCPTR (gst_wasapi_sink_get_caps);
+  gstbasesink_class->query = GST_DEBUG_FUNCPTR (gst_wasapi_sink_query);
+  gstbasesink_class->wait_event =
+      GST_DEBUG_FUNCPTR (gst_wasapi_sink_wait_event);
+  gstbasesink_class->unlock = GST_DEBUG_FUNCPTR (gst_wasapi_sink_unlock);
+  gstbasesink_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_wasapi_sink_unlock_stop);
+
+  gstaudiobasesink_class->create_ringbuffer =
+      GST_DEBUG_FUNCPTR (gst_wasapi_sink_create_ringbuffer);
+  gstaudiobasesink_class->payload = GST_DEBUG_FUNCPTR (gst_wasapi_sink_payload);
 
   gstaudiosink_class->prepare = GST_DEBUG_FUNCPTR (gst_wasapi_sink_prepare);
   gstaudiosink_class->unprepare = GST_DEBUG_FUNCPTR (gst_wasapi_sink_unprepare);
@@ -169,15 +709,74 @@ gst_wasapi_sink_class_init (GstWasapiSinkClass * klass)
 static void
 gst_wasapi_sink_init (GstWasapiSink * self)
 {
+  /* override with a custom clock, that can follow the device position */
+  if (GST_AUDIO_BASE_SINK (self)->provided_clock)
+    gst_object_unref (GST_AUDIO_BASE_SINK (self)->provided_clock);
+
+  GST_AUDIO_BASE_SINK (self)->provided_clock =
+      gst_audio_clock_new ("GstWasapiSinkClock", gst_wasapi_sink_get_time,
+      gst_object_ref (self), (GDestroyNotify) gst_object_unref);
+
+  /* slave-method=custom resamples in payload() */
+  gst_audio_base_sink_set_custom_slaving_callback (GST_AUDIO_BASE_SINK (self),
+      gst_wasapi_sink_custom_slaving, NULL, NULL);
+
   self->role = DEFAULT_ROLE;
   self->mute = DEFAULT_MUTE;
+  self->volume = DEFAULT_VOLUME;
   self->sharemode = AUDCLNT_SHAREMODE_SHARED;
   self->low_latency = DEFAULT_LOW_LATENCY;
   self->try_audioclient3 = DEFAULT_AUDIOCLIENT3;
-  self->event_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->zero_copy = DEFAULT_ZERO_COPY;
+  self->prefill_silence = DEFAULT_PREFILL_SILENCE;
+  self->prewarm = DEFAULT_PREWARM;
+  self->autoconvert = DEFAULT_AUTOCONVERT;
+  self->match_format = DEFAULT_MATCH_FORMAT;
+  self->offload = DEFAULT_OFFLOAD;
+  self->raw = DEFAULT_RAW;
+  self->category = DEFAULT_CATEGORY;
+  self->adaptive_buffer = DEFAULT_ADAPTIVE_BUFFER;
+  self->auto_tune = DEFAULT_AUTO_TUNE;
+  self->shared_client = DEFAULT_SHARED_CLIENT;
+  self->device_channels = g_strdup (DEFAULT_DEVICE_CHANNELS);
+  self->follow_default = DEFAULT_FOLLOW_DEFAULT;
+  self->stream_routing = DEFAULT_STREAM_ROUTING;
+  self->mmcss_task = g_strdup (DEFAULT_MMCSS_TASK);
+  self->mmcss_priority = DEFAULT_MMCSS_PRIORITY;
+  self->thread_affinity = DEFAULT_THREAD_AFFINITY;
+  self->processor_group = DEFAULT_PROCESSOR_GROUP;
+  self->power_throttling = DEFAULT_POWER_THROTTLING;
+  self->performance_cores = DEFAULT_PERFORMANCE_CORES;
+  self->probe_latency = DEFAULT_LATENCY_PROBE;
+  self->aec_reference = DEFAULT_AEC_REFERENCE;
+  self->jitter_buffer = DEFAULT_JITTER_BUFFER;
+  self->stats_interval = DEFAULT_STATS_INTERVAL;
+  self->jitter_max_latency = DEFAULT_JITTER_MAX_LATENCY;
+  self->conceal = DEFAULT_CONCEAL;
+  self->keep_running = DEFAULT_KEEP_RUNNING;
+  self->spin_wait = DEFAULT_SPIN_WAIT;
+  self->start_qpc = DEFAULT_START_QPC;
+  self->async_open = DEFAULT_ASYNC_OPEN;
+  self->emit_need_frames = DEFAULT_EMIT_NEED_FRAMES;
+  self->shm_input = g_strdup (DEFAULT_SHM_INPUT);
+  g_value_init (&self->channel_delays, GST_TYPE_ARRAY);
+  g_value_init (&self->channel_gains, GST_TYPE_ARRAY);
+  g_mutex_init (&self->open_lock);
+  self->use_device_clock = DEFAULT_DEVICE_CLOCK;
+  self->shared_clock = NULL;
+  self->own_clock = NULL;
+  self->stream_latency = GST_CLOCK_TIME_NONE;
+  g_mutex_init (&self->position_lock);
+  self->frames_written = 0;
   self->client_needs_restart = FALSE;
-
-  CoInitialize (NULL);
+  self->primed = FALSE;
+  self->free_frames = 0;
+  self->dry_time = 0;
+  gst_wasapi_startup_times_init (&self->startup_times, GST_ELEMENT (self));
+  self->device_stats = gst_wasapi_stats_block_new ();
+  self->streaming_stats = gst_wasapi_stats_block_new ();
+  gst_wasapi_histogram_reset (&self->wakeup_histogram);
+  gst_wasapi_histogram_reset (&self->hold_histogram);
 }
 
 static void
@@ -189,6 +788,15 @@ gst_wasapi_sink_dispose (GObject * object)
     CloseHandle (self->event_handle);
     self->event_handle = NULL;
   }
+  if (self->keepalive_stop != NULL) {
+    CloseHandle (self->keepalive_stop);
+    self->keepalive_stop = NULL;
+  }
+  if (self->drain_cancel != NULL) {
+    CloseHandle (self->drain_cancel);
+    self->drain_cancel = NULL;
+  }
+  gst_wasapi_cancel_clear (&self->cancel);
 
   if (self->client != NULL) {
     IUnknown_Release (self->client);
@@ -199,32 +807,77 @@ gst_wasapi_sink_dispose (GObject * object)
     IUnknown_Release (self->render_client);
     self->render_client = NULL;
   }
+  gst_caps_replace (&self->warm_caps, NULL);
 
   G_OBJECT_CLASS (gst_wasapi_sink_parent_class)->dispose (object);
 }
 
+/* What get_caps() learned about the device, from then until close */
 static void
-gst_wasapi_sink_finalize (GObject * object)
+gst_wasapi_sink_clear_format (GstWasapiSink * self)
 {
-  GstWasapiSink *self = GST_WASAPI_SINK (object);
-
-  CoTaskMemFree (self->mix_format);
-  self->mix_format = NULL;
+  if (self->mix_format != self->device_format)
+    CoTaskMemFree (self->mix_format);
+  CoTaskMemFree (self->device_format);
+  self->mix_format = self->device_format = NULL;
 
-  CoUninitialize ();
+  g_clear_pointer (&self->cached_caps, gst_caps_unref);
+  g_clear_pointer (&self->positions, g_free);
+}
 
-  if (self->cached_caps != NULL) {
-    gst_caps_unref (self->cached_caps);
-    self->cached_caps = NULL;
-  }
+static void
+gst_wasapi_sink_finalize (GObject * object)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (object);
 
-  g_clear_pointer (&self->positions, g_free);
+  gst_wasapi_sink_clear_format (self);
   g_clear_pointer (&self->device_strid, g_free);
+  g_clear_pointer (&self->device_name, g_free);
+  g_clear_pointer (&self->mmcss_task, g_free);
+  g_clear_pointer (&self->thread_task, g_free);
+  g_clear_pointer (&self->device_channels, g_free);
+  g_clear_pointer (&self->shm_input, g_free);
+  g_value_unset (&self->channel_delays);
+  g_value_unset (&self->channel_gains);
   self->mute = FALSE;
 
+  gst_wasapi_startup_times_clear (&self->startup_times);
+  g_clear_pointer (&self->device_stats, gst_wasapi_stats_block_free);
+  g_clear_pointer (&self->streaming_stats, gst_wasapi_stats_block_free);
+  g_mutex_clear (&self->position_lock);
+  g_mutex_clear (&self->open_lock);
+
   G_OBJECT_CLASS (gst_wasapi_sink_parent_class)->finalize (object);
 }
 
+/* Lets the audio engine apply volume and mute in its mix, instead of an
+ * extra pass over every sample. Called with the object lock. */
+static void
+gst_wasapi_sink_apply_volume (GstWasapiSink * self)
+{
+  HRESULT hr;
+  UINT32 i, n_channels;
+  gfloat *levels;
+
+  if (self->mixer_input != NULL)
+    gst_wasapi_mixer_input_set_volume (self->mixer_input, self->volume,
+        self->mute);
+
+  if (self->stream_volume == NULL)
+    return;
+
+  hr = IAudioStreamVolume_GetChannelCount (self->stream_volume, &n_channels);
+  HR_FAILED_RET (hr, IAudioStreamVolume::GetChannelCount,);
+
+  levels = g_newa (gfloat, n_channels);
+  for (i = 0; i < n_channels; i++)
+    levels[i] = self->mute ? 0.0f : (gfloat) self->volume;
+
+  hr = IAudioStreamVolume_SetAllVolumes (self->stream_volume, n_channels,
+      levels);
+  HR_FAILED_AND (hr, IAudioStreamVolume::SetAllVolumes,);
+}
+
 static void
 gst_wasapi_sink_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -236,7 +889,16 @@ gst_wasapi_sink_set_property (GObject * object, guint prop_id,
       self->role = gst_wasapi_device_role_to_erole (g_value_get_enum (value));
       break;
     case PROP_MUTE:
+      GST_OBJECT_LOCK (self);
       self->mute = g_value_get_boolean (value);
+      gst_wasapi_sink_apply_volume (self);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VOLUME:
+      GST_OBJECT_LOCK (self);
+      self->volume = g_value_get_double (value);
+      gst_wasapi_sink_apply_volume (self);
+      GST_OBJECT_UNLOCK (self);
       break;
     case PROP_DEVICE:
     {
@@ -244,8 +906,14 @@ gst_wasapi_sink_set_property (GObject * object, guint prop_id,
       g_free (self->device_strid);
       self->device_strid =
           device ? g_utf8_to_utf16 (device, -1, NULL, NULL, NULL) : NULL;
+      self->device_name_resolved = FALSE;
+      g_atomic_int_set (&self->device_changed, TRUE);
       break;
     }
+    case PROP_DEVICE_NAME:
+      g_free (self->device_name);
+      self->device_name = g_value_dup_string (value);
+      break;
     case PROP_EXCLUSIVE:
       self->sharemode = g_value_get_boolean (value)
           ? AUDCLNT_SHAREMODE_EXCLUSIVE : AUDCLNT_SHAREMODE_SHARED;
@@ -256,12 +924,136 @@ gst_wasapi_sink_set_property (GObject * object, guint prop_id,
     case PROP_AUDIOCLIENT3:
       self->try_audioclient3 = g_value_get_boolean (value);
       break;
+    case PROP_DEVICE_CLOCK:
+      self->use_device_clock = g_value_get_boolean (value);
+      break;
+    case PROP_ZERO_COPY:
+      self->zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_PREFILL_SILENCE:
+      self->prefill_silence = g_value_get_boolean (value);
+      break;
+    case PROP_PREWARM:
+      self->prewarm = g_value_get_boolean (value);
+      break;
+    case PROP_AUTOCONVERT:
+      self->autoconvert = g_value_get_boolean (value);
+      break;
+    case PROP_MATCH_FORMAT:
+      self->match_format = g_value_get_boolean (value);
+      break;
+    case PROP_OFFLOAD:
+      self->offload = g_value_get_boolean (value);
+      break;
+    case PROP_RAW:
+      self->raw = g_value_get_boolean (value);
+      break;
+    case PROP_CATEGORY:
+      self->category = g_value_get_enum (value);
+      break;
+    case PROP_ADAPTIVE_BUFFER:
+      self->adaptive_buffer = g_value_get_boolean (value);
+      break;
+    case PROP_AUTO_TUNE:
+      self->auto_tune = g_value_get_boolean (value);
+      break;
+    case PROP_SHARED_CLIENT:
+      self->shared_client = g_value_get_boolean (value);
+      break;
+    case PROP_DEVICE_CHANNELS:
+      g_free (self->device_channels);
+      self->device_channels = g_value_dup_string (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_FOLLOW_DEFAULT:
+      self->follow_default = g_value_get_boolean (value);
+      break;
+    case PROP_STREAM_ROUTING:
+      self->stream_routing = g_value_get_boolean (value);
+      break;
+    case PROP_MMCSS_TASK:
+      g_free (self->mmcss_task);
+      self->mmcss_task = g_value_dup_string (value);
+      break;
+    case PROP_MMCSS_PRIORITY:
+      self->mmcss_priority = g_value_get_enum (value);
+      break;
+    case PROP_THREAD_AFFINITY:
+      self->thread_affinity = g_value_get_uint64 (value);
+      break;
+    case PROP_PROCESSOR_GROUP:
+      self->processor_group = g_value_get_uint (value);
+      break;
+    case PROP_POWER_THROTTLING:
+      self->power_throttling = g_value_get_boolean (value);
+      break;
+    case PROP_PERFORMANCE_CORES:
+      self->performance_cores = g_value_get_boolean (value);
+      break;
+    case PROP_LATENCY_PROBE:
+      self->probe_latency = g_value_get_boolean (value);
+      break;
+    case PROP_AEC_REFERENCE:
+      self->aec_reference = g_value_get_boolean (value);
+      break;
+    case PROP_JITTER_BUFFER:
+      self->jitter_buffer = g_value_get_boolean (value);
+      break;
+    case PROP_JITTER_MAX_LATENCY:
+      self->jitter_max_latency = g_value_get_uint64 (value);
+      break;
+    case PROP_CONCEAL:
+      self->conceal = g_value_get_boolean (value);
+      break;
+    case PROP_KEEP_RUNNING:
+      self->keep_running = g_value_get_boolean (value);
+      break;
+    case PROP_SPIN_WAIT:
+      self->spin_wait = g_value_get_boolean (value);
+      break;
+    case PROP_SHM_INPUT:
+      g_free (self->shm_input);
+      self->shm_input = g_value_dup_string (value);
+      break;
+    case PROP_START_QPC:
+      GST_OBJECT_LOCK (self);
+      self->start_qpc = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ASYNC_OPEN:
+      self->async_open = g_value_get_boolean (value);
+      break;
+    case PROP_EMIT_NEED_FRAMES:
+      g_atomic_int_set (&self->emit_need_frames, g_value_get_boolean (value));
+      break;
+    case PROP_CHANNEL_DELAYS:
+      GST_OBJECT_LOCK (self);
+      g_value_copy (value, &self->channel_delays);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHANNEL_GAINS:
+      GST_OBJECT_LOCK (self);
+      g_value_copy (value, &self->channel_gains);
+      GST_OBJECT_UNLOCK (self);
+      g_atomic_int_set (&self->trim_gains_changed, TRUE);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+/* What both threads counted, without a lock */
+static void
+gst_wasapi_sink_get_stats (GstWasapiSink * self, GstWasapiStats * stats)
+{
+  gst_wasapi_stats_reset (stats);
+  gst_wasapi_stats_block_add_to (self->device_stats, stats);
+  gst_wasapi_stats_block_add_to (self->streaming_stats, stats);
+}
+
 static void
 gst_wasapi_sink_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
@@ -275,10 +1067,16 @@ gst_wasapi_sink_get_property (GObject * object, guint prop_id,
     case PROP_MUTE:
       g_value_set_boolean (value, self->mute);
       break;
+    case PROP_VOLUME:
+      g_value_set_double (value, self->volume);
+      break;
     case PROP_DEVICE:
       g_value_take_string (value, self->device_strid ?
           g_utf16_to_utf8 (self->device_strid, -1, NULL, NULL, NULL) : NULL);
       break;
+    case PROP_DEVICE_NAME:
+      g_value_set_string (value, self->device_name);
+      break;
     case PROP_EXCLUSIVE:
       g_value_set_boolean (value,
           self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE);
@@ -289,14 +1087,166 @@ gst_wasapi_sink_get_property (GObject * object, guint prop_id,
     case PROP_AUDIOCLIENT3:
       g_value_set_boolean (value, self->try_audioclient3);
       break;
+    case PROP_DEVICE_CLOCK:
+      g_value_set_boolean (value, self->use_device_clock);
+      break;
+    case PROP_ZERO_COPY:
+      g_value_set_boolean (value, self->zero_copy);
+      break;
+    case PROP_PREFILL_SILENCE:
+      g_value_set_boolean (value, self->prefill_silence);
+      break;
+    case PROP_PREWARM:
+      g_value_set_boolean (value, self->prewarm);
+      break;
+    case PROP_AUTOCONVERT:
+      g_value_set_boolean (value, self->autoconvert);
+      break;
+    case PROP_MATCH_FORMAT:
+      g_value_set_boolean (value, self->match_format);
+      break;
+    case PROP_OFFLOAD:
+      g_value_set_boolean (value, self->offload);
+      break;
+    case PROP_RAW:
+      g_value_set_boolean (value, self->raw);
+      break;
+    case PROP_CATEGORY:
+      g_value_set_enum (value, self->category);
+      break;
+    case PROP_ADAPTIVE_BUFFER:
+      g_value_set_boolean (value, self->adaptive_buffer);
+      break;
+    case PROP_AUTO_TUNE:
+      g_value_set_boolean (value, self->auto_tune);
+      break;
+    case PROP_SHARED_CLIENT:
+      g_value_set_boolean (value, self->shared_client);
+      break;
+    case PROP_DEVICE_CHANNELS:
+      g_value_set_string (value, self->device_channels);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint64 (value, self->stats_interval);
+      break;
+    case PROP_FOLLOW_DEFAULT:
+      g_value_set_boolean (value, self->follow_default);
+      break;
+    case PROP_STREAM_ROUTING:
+      g_value_set_boolean (value, self->stream_routing);
+      break;
+    case PROP_MMCSS_TASK:
+      g_value_set_string (value, self->mmcss_task);
+      break;
+    case PROP_MMCSS_PRIORITY:
+      g_value_set_enum (value, self->mmcss_priority);
+      break;
+    case PROP_THREAD_AFFINITY:
+      g_value_set_uint64 (value, self->thread_affinity);
+      break;
+    case PROP_PROCESSOR_GROUP:
+      g_value_set_uint (value, self->processor_group);
+      break;
+    case PROP_POWER_THROTTLING:
+      g_value_set_boolean (value, self->power_throttling);
+      break;
+    case PROP_PERFORMANCE_CORES:
+      g_value_set_boolean (value, self->performance_cores);
+      break;
+    case PROP_LATENCY_PROBE:
+      g_value_set_boolean (value, self->probe_latency);
+      break;
+    case PROP_AEC_REFERENCE:
+      g_value_set_boolean (value, self->aec_reference);
+      break;
+    case PROP_JITTER_BUFFER:
+      g_value_set_boolean (value, self->jitter_buffer);
+      break;
+    case PROP_JITTER_MAX_LATENCY:
+      g_value_set_uint64 (value, self->jitter_max_latency);
+      break;
+    case PROP_CONCEAL:
+      g_value_set_boolean (value, self->conceal);
+      break;
+    case PROP_KEEP_RUNNING:
+      g_value_set_boolean (value, self->keep_running);
+      break;
+    case PROP_SPIN_WAIT:
+      g_value_set_boolean (value, self->spin_wait);
+      break;
+    case PROP_SHM_INPUT:
+      g_value_set_string (value, self->shm_input);
+      break;
+    case PROP_START_QPC:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->start_qpc);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ASYNC_OPEN:
+      g_value_set_boolean (value, self->async_open);
+      break;
+    case PROP_EMIT_NEED_FRAMES:
+      g_value_set_boolean (value, g_atomic_int_get (&self->emit_need_frames));
+      break;
+    case PROP_CHANNEL_DELAYS:
+      GST_OBJECT_LOCK (self);
+      g_value_copy (&self->channel_delays, value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHANNEL_GAINS:
+      GST_OBJECT_LOCK (self);
+      g_value_copy (&self->channel_gains, value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STARTUP_TIMES:
+      g_value_take_boxed (value,
+          gst_wasapi_startup_times_to_structure (&self->startup_times,
+              "GstWasapiSinkStartupTimes"));
+      break;
+    case PROP_STATS:
+    {
+      GstWasapiStats stats;
+      GstStructure *s;
+      gdouble ppm = 0;
+
+      gst_wasapi_sink_get_stats (self, &stats);
+
+      GST_OBJECT_LOCK (self);
+      if (self->drift)
+        gst_wasapi_drift_get_ppm (self->drift, &ppm);
+      GST_OBJECT_UNLOCK (self);
+
+      s = gst_wasapi_stats_to_structure (&stats, "GstWasapiSinkStats", ppm);
+      gst_wasapi_histogram_to_structure (&self->wakeup_histogram, s,
+          "wakeup-interval-histogram");
+      gst_wasapi_histogram_to_structure (&self->hold_histogram, s,
+          "buffer-hold-histogram");
+      g_value_take_boxed (value, s);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+/* Before each Initialize() of a new shared mode client */
+static void
+gst_wasapi_sink_set_client_properties (GstWasapiSink * self,
+    IAudioClient * client)
+{
+  /* Without autoconvert the stream is in the mix format already */
+  gboolean match_format = self->match_format && self->autoconvert;
+
+  if (self->sharemode == AUDCLNT_SHAREMODE_SHARED &&
+      (self->raw || self->category != DEFAULT_CATEGORY || match_format))
+    gst_wasapi_util_set_client_properties (GST_ELEMENT (self), client,
+        self->category, self->raw, match_format);
+}
+
 static gboolean
-gst_wasapi_sink_can_audioclient3 (GstWasapiSink * self)
+gst_wasapi_sink_can_audioclient3 (GstWasapiSink * self,
+    GstAudioRingBufferSpec * spec)
 {
   /* AudioClient3 API only makes sense in shared mode */
   if (self->sharemode != AUDCLNT_SHAREMODE_SHARED)
@@ -315,15 +1265,40 @@ gst_wasapi_sink_can_audioclient3 (GstWasapiSink * self)
   /* Only use audioclient3 when low-latency is requested because otherwise
    * very slow machines and VMs with 1 CPU allocated will get glitches:
    * https://bugzilla.gnome.org/show_bug.cgi?id=794497 */
-  if (!self->low_latency) {
-    GST_INFO_OBJECT (self, "AudioClient3 disabled because low-latency mode "
-        "was not requested");
+  if (!self->low_latency && spec->latency_time >= AUDIOCLIENT3_LATENCY_TIME) {
+    GST_INFO_OBJECT (self, "AudioClient3 disabled because neither low-latency "
+        "mode nor a latency-time below %u us was requested",
+        AUDIOCLIENT3_LATENCY_TIME);
     return FALSE;
   }
 
   return TRUE;
 }
 
+/* The base class only knows about the ringbuffer, add what the audio
+ * engine and driver hold on top of it, and the device buffer */
+static gboolean
+gst_wasapi_sink_query (GstBaseSink * bsink, GstQuery * query)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (bsink);
+  gboolean res;
+
+  res = GST_BASE_SINK_CLASS (parent_class)->query (bsink, query);
+
+  if (res && GST_QUERY_TYPE (query) == GST_QUERY_LATENCY && self->mix_format) {
+    gint rate = self->mix_format->nSamplesPerSec;
+    GstClockTime period, buffer;
+
+    period = gst_util_uint64_scale_int (self->period_frames, GST_SECOND, rate);
+    buffer = gst_util_uint64_scale_int (self->buffer_frame_count, GST_SECOND,
+        rate);
+    gst_wasapi_util_add_device_latency (GST_ELEMENT (self), query,
+        self->stream_latency, period, buffer, 0);
+  }
+
+  return res;
+}
+
 static GstCaps *
 gst_wasapi_sink_get_caps (GstBaseSink * bsink, GstCaps * filter)
 {
@@ -333,33 +1308,25 @@ gst_wasapi_sink_get_caps (GstBaseSink * bsink, GstCaps * filter)
 
   GST_DEBUG_OBJECT (self, "entering get caps");
 
+  gst_wasapi_sink_finish_open (self);
+
   if (self->cached_caps) {
     caps = gst_caps_ref (self->cached_caps);
   } else {
-    GstCaps *template_caps;
     gboolean ret;
 
-    template_caps = gst_pad_get_pad_template_caps (bsink->sinkpad);
-
     if (!self->client) {
-      caps = template_caps;
+      caps = gst_pad_get_pad_template_caps (bsink->sinkpad);
       goto out;
     }
 
-    ret = gst_wasapi_util_get_device_format (GST_ELEMENT (self),
-        self->sharemode, self->device, self->client, &format);
+    g_clear_pointer (&self->positions, g_free);
+    ret = gst_wasapi_device_cache_get_format (GST_ELEMENT (self),
+        self->device, self->client, self->sharemode, &format, &caps,
+        &self->positions);
     if (!ret) {
       GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
           ("failed to detect format"));
-      gst_caps_unref (template_caps);
-      return NULL;
-    }
-
-    gst_wasapi_util_parse_waveformatex ((WAVEFORMATEXTENSIBLE *) format,
-        template_caps, &caps, &self->positions);
-    if (caps == NULL) {
-      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL), ("unknown format"));
-      gst_caps_unref (template_caps);
       return NULL;
     }
 
@@ -370,9 +1337,48 @@ gst_wasapi_sink_get_caps (GstBaseSink * bsink, GstCaps * filter)
       g_free (pos_str);
     }
 
-    self->mix_format = format;
+    /* device-channels numbers the channels in device order */
+    self->n_selected = 0;
+    if (self->shared_client && self->sharemode == AUDCLNT_SHAREMODE_SHARED) {
+      self->n_selected =
+          gst_wasapi_util_parse_channel_select (self->device_channels,
+          format->nChannels, self->selected);
+      if (self->device_channels != NULL && self->n_selected == 0)
+        GST_ELEMENT_WARNING (self, RESOURCE, SETTINGS, (NULL),
+            ("device-channels \"%s\" doesn't fit the %d channels of the "
+                "device, rendering into all of them", self->device_channels,
+                format->nChannels));
+    }
+
+    if (self->n_selected > 0) {
+      gst_caps_unref (caps);
+      caps = gst_caps_new_simple ("audio/x-raw",
+          "format", G_TYPE_STRING, "F32LE",
+          "layout", G_TYPE_STRING, "interleaved",
+          "rate", G_TYPE_INT, (gint) format->nSamplesPerSec,
+          "channels", G_TYPE_INT, self->n_selected, NULL);
+    } else if (self->autoconvert &&
+        self->sharemode == AUDCLNT_SHAREMODE_SHARED) {
+      caps = gst_wasapi_util_add_autoconvert_caps (caps);
+    } else if (self->sharemode == AUDCLNT_SHAREMODE_SHARED &&
+        !self->zero_copy && !self->jitter_buffer) {
+      /* Those two hand the ringbuffer memory to the device as it is */
+      caps = gst_wasapi_sink_add_convert_caps (caps);
+    }
+
+    if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE) {
+      /* The device format stays first, so it's preferred */
+      caps = gst_caps_merge (caps,
+          gst_wasapi_device_cache_get_exclusive_caps (GST_ELEMENT (self),
+              self->device, self->client));
+      /* Bitstreams can only bypass the audio engine */
+      caps = gst_caps_merge (caps,
+          gst_wasapi_util_get_passthrough_caps (GST_ELEMENT (self),
+              self->client));
+    }
+
+    self->device_format = self->mix_format = format;
     gst_caps_replace (&self->cached_caps, caps);
-    gst_caps_unref (template_caps);
   }
 
   if (filter) {
@@ -387,299 +1393,2363 @@ out:
   return caps;
 }
 
-static gboolean
-gst_wasapi_sink_open (GstAudioSink * asink)
+/* Also offers a float mix format as the integer formats and the other
+ * channel counts render() converts from while copying into the device
+ * buffer, which spares an audioconvert upstream */
+static GstCaps *
+gst_wasapi_sink_add_convert_caps (GstCaps * caps)
 {
-  GstWasapiSink *self = GST_WASAPI_SINK (asink);
-  gboolean res = FALSE;
-  IMMDevice *device = NULL;
-  IAudioClient *client = NULL;
+  GstCaps *int_caps, *mix_caps;
+  GValue formats = G_VALUE_INIT, val = G_VALUE_INIT;
+
+  if (g_strcmp0 (gst_structure_get_string (gst_caps_get_structure (caps, 0),
+              "format"), "F32LE") != 0)
+    return caps;
+
+  g_value_init (&formats, GST_TYPE_LIST);
+  g_value_init (&val, G_TYPE_STRING);
+  g_value_set_static_string (&val, "S16LE");
+  gst_value_list_append_value (&formats, &val);
+  g_value_set_static_string (&val, "S24_32LE");
+  gst_value_list_append_value (&formats, &val);
+  g_value_set_static_string (&val, "S32LE");
+  gst_value_list_append_value (&formats, &val);
+  g_value_unset (&val);
+
+  int_caps = gst_caps_copy (caps);
+  for (guint ii = 0; ii < gst_caps_get_size (int_caps); ii++)
+    gst_structure_set_value (gst_caps_get_structure (int_caps, ii), "format",
+        &formats);
+  g_value_unset (&formats);
+
+  /* The mix format stays first, so it's preferred */
+  caps = gst_caps_merge (caps, int_caps);
+
+  /* Then the same formats up to 7.1, upmixed or downmixed to the positions
+   * of the endpoint */
+  mix_caps = gst_caps_copy (caps);
+  for (guint ii = 0; ii < gst_caps_get_size (mix_caps); ii++) {
+    GstStructure *s = gst_caps_get_structure (mix_caps, ii);
+
+    gst_structure_set (s, "channels", GST_TYPE_INT_RANGE, 1, 8, NULL);
+    gst_structure_remove_field (s, "channel-mask");
+  }
 
-  GST_DEBUG_OBJECT (self, "opening device");
+  return gst_caps_merge (caps, mix_caps);
+}
 
-  if (self->client)
-    return TRUE;
+/* With slave-method=custom payload() follows the pipeline clock by
+ * resampling, so the base class must not skew on top of that */
+static void
+gst_wasapi_sink_custom_slaving (GstAudioBaseSink * sink, GstClockTime etime,
+    GstClockTime itime, GstClockTimeDiff * requested_skew,
+    GstAudioBaseSinkDiscontReason discont_reason, gpointer user_data)
+{
+  *requested_skew = 0;
+}
 
-  /* FIXME: Switching the default device does not switch the stream to it,
-   * even if the old device was unplugged. We need to handle this somehow.
-   * For example, perhaps we should automatically switch to the new device if
-   * the default device is changed and a device isn't explicitly selected. */
-  if (!gst_wasapi_util_get_device_client (GST_ELEMENT (self), eRender,
-          self->role, self->device_strid, &device, &client)) {
-    if (!self->device_strid)
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
-          ("Failed to get default device"));
-    else
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
-          ("Failed to open device %S", self->device_strid));
-    goto beach;
-  }
+/* Resamples @buf so that the device plays it at its timestamp on the
+ * pipeline clock. The output is stamped on a continuous timeline that
+ * runs by the device, so the base class never has to resync. */
+static GstBuffer *
+gst_wasapi_sink_resample (GstWasapiSink * self, GstBuffer * buf)
+{
+  GstAudioBaseSink *sink = GST_AUDIO_BASE_SINK (self);
+  GstClockTime pts = GST_BUFFER_PTS (buf);
+  GstClockTime time = GST_CLOCK_TIME_NONE;
+  GstClockTimeDiff offset = 0;
+  gboolean slaved, valid;
+  gdouble ppm;
+  GstClock *clock;
 
-  self->client = client;
-  self->device = device;
+  GST_OBJECT_LOCK (self);
+  clock = GST_ELEMENT_CLOCK (self);
+  slaved = clock != NULL && clock != sink->provided_clock;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!slaved)
+    return gst_buffer_ref (buf);
+
+  if (g_atomic_int_compare_and_exchange (&self->resampler_needs_reset, TRUE,
+          FALSE)) {
+    gst_wasapi_resampler_reset (self->resampler);
+    self->slave_base_valid = FALSE;
+  }
+
+  g_mutex_lock (&self->position_lock);
+  valid = self->slave_valid;
+  if (valid)
+    offset = self->slave_offset;
+  g_mutex_unlock (&self->position_lock);
+
+  /* What the device ran ahead of the pipeline clock since the timeline
+   * started, these samples need to be that much later on it */
+  if (valid && !self->slave_base_valid) {
+    self->slave_base = offset;
+    self->slave_base_valid = TRUE;
+  }
+  if (self->slave_base_valid)
+    offset -= self->slave_base;
+  else
+    offset = 0;
+
+  if (GST_CLOCK_TIME_IS_VALID (pts) && (offset >= 0 || pts >= -offset))
+    time = pts + offset;
+
+  if (gst_wasapi_drift_get_ppm (self->clock_drift, &ppm))
+    gst_wasapi_resampler_set_rate_hint (self->resampler, -ppm);
+
+  buf = gst_wasapi_resampler_process (self->resampler, gst_buffer_ref (buf),
+      time);
+  GST_LOG_OBJECT (self, "device offset %" G_GINT64_FORMAT " ns, ratio %.6f",
+      offset, gst_wasapi_resampler_get_ratio (self->resampler));
+
+  return buf;
+}
+
+/* Wraps compressed frames into IEC 61937 bursts for passthrough */
+static GstBuffer *
+gst_wasapi_sink_payload (GstAudioBaseSink * sink, GstBuffer * buf)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (sink);
+  GstAudioRingBufferSpec *spec = &sink->ringbuffer->spec;
+  GstBuffer *out;
+  GstMapInfo inmap, outmap;
+  gint framesize;
+  gboolean res;
+
+  if (spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW) {
+    if (self->resampler != NULL)
+      return gst_wasapi_sink_resample (self, buf);
+    return gst_buffer_ref (buf);
+  }
+
+  framesize = gst_audio_iec61937_frame_size (spec);
+  if (framesize <= 0)
+    return NULL;
+
+  out = gst_buffer_new_and_alloc (framesize);
+
+  gst_buffer_map (buf, &inmap, GST_MAP_READ);
+  gst_buffer_map (out, &outmap, GST_MAP_WRITE);
+
+  /* WASAPI takes the bursts as little endian 16 bit samples */
+  res = gst_audio_iec61937_payload (inmap.data, inmap.size, outmap.data,
+      outmap.size, spec, G_LITTLE_ENDIAN);
+
+  gst_buffer_unmap (buf, &inmap);
+  gst_buffer_unmap (out, &outmap);
+
+  if (!res) {
+    GST_WARNING_OBJECT (sink, "failed to payload %" G_GSIZE_FORMAT " bytes",
+        inmap.size);
+    gst_buffer_unref (out);
+    return NULL;
+  }
+
+  gst_buffer_copy_into (out, buf, GST_BUFFER_COPY_METADATA, 0, -1);
+
+  return out;
+}
+
+static GstAudioRingBuffer *
+gst_wasapi_sink_create_ringbuffer (GstAudioBaseSink * sink)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (sink);
+  GstAudioRingBuffer *buffer;
+
+  /* Exclusive mode wants whole device periods at once, which upstream
+   * doesn't give us, so that needs the ringbuffer of GstAudioSink. So does
+   * the queue of the shared client. */
+  if ((!self->zero_copy && !self->jitter_buffer && self->shm_input == NULL) ||
+      self->shared_client || self->sharemode != AUDCLNT_SHAREMODE_SHARED)
+    return GST_AUDIO_BASE_SINK_CLASS (parent_class)->create_ringbuffer (sink);
+
+  GST_DEBUG_OBJECT (self, "creating %s ringbuffer",
+      self->shm_input != NULL ? "shared memory input" :
+      self->jitter_buffer ? "jitter-buffered" : "zero-copy");
+  buffer = g_object_new (GST_TYPE_WASAPI_RING_BUFFER, NULL);
+  GST_OBJECT_PARENT (buffer) = GST_OBJECT_CAST (sink);
+  if (self->jitter_buffer)
+    GST_WASAPI_RING_BUFFER (buffer)->jitter_latency =
+        MAX (self->jitter_max_latency, 1);
+
+  return buffer;
+}
+
+/* With shm-input the caps come from the mapping, the ringbuffer is
+ * acquired like setcaps() would and no buffer ever prerolls */
+static gboolean
+gst_wasapi_sink_open_shm_input (GstWasapiSink * self)
+{
+  GstBaseSink *bsink = GST_BASE_SINK (self);
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SINK (self)->ringbuffer;
+  GstAudioRingBufferSpec *spec = &ringbuffer->spec;
+  GstCaps *template_caps, *caps, *allowed;
+  gchar *name;
+  gboolean res = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  name = g_strdup (self->shm_input);
+  GST_OBJECT_UNLOCK (self);
+
+  if (name == NULL)
+    return TRUE;
+
+  /* Set after going to READY */
+  if (!GST_IS_WASAPI_RING_BUFFER (ringbuffer)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS, (NULL),
+        ("shm-input is only possible in shared mode, without shared-client, "
+            "and has to be set before going to READY"));
+    g_free (name);
+    return FALSE;
+  }
+
+  self->shm_reader = gst_wasapi_shm_reader_new (name);
+  if (self->shm_reader == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+        ("Failed to open shared memory %s", name));
+    g_free (name);
+    return FALSE;
+  }
+  g_free (name);
+
+  template_caps = gst_caps_from_string (GST_WASAPI_STATIC_CAPS);
+  if (!gst_wasapi_util_parse_waveformatex ((WAVEFORMATEXTENSIBLE *)
+          gst_wasapi_shm_reader_get_format (self->shm_reader), template_caps,
+          &caps, NULL))
+    caps = gst_caps_new_empty ();
+  gst_caps_unref (template_caps);
+
+  /* Anything render() takes, without autoconvert the rate has to match */
+  allowed = gst_pad_query_caps (GST_BASE_SINK_PAD (bsink), caps);
+  if (gst_caps_is_empty (allowed)) {
+    GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+        ("Can't render %" GST_PTR_FORMAT " from shared memory, try "
+            "autoconvert", caps));
+    goto done;
+  }
+  allowed = gst_caps_fixate (allowed);
+  GST_INFO_OBJECT (self, "rendering %" GST_PTR_FORMAT " from shared memory",
+      allowed);
+
+  GST_WASAPI_RING_BUFFER (ringbuffer)->shm = self->shm_reader;
+  spec->buffer_time = GST_AUDIO_BASE_SINK (self)->buffer_time;
+  spec->latency_time = GST_AUDIO_BASE_SINK (self)->latency_time;
+  if (!gst_audio_ring_buffer_parse_caps (spec, allowed) ||
+      !gst_audio_ring_buffer_acquire (ringbuffer, spec))
+    goto done;
+
+  self->shm_async = gst_base_sink_is_async_enabled (bsink);
+  gst_base_sink_set_async_enabled (bsink, FALSE);
+  res = TRUE;
+
+done:
+  gst_caps_unref (allowed);
+  gst_caps_unref (caps);
+  if (!res) {
+    GST_WASAPI_RING_BUFFER (ringbuffer)->shm = NULL;
+    g_clear_pointer (&self->shm_reader, gst_wasapi_shm_reader_free);
+  }
+
+  return res;
+}
+
+/* After the ringbuffer was released */
+static void
+gst_wasapi_sink_close_shm_input (GstWasapiSink * self)
+{
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SINK (self)->ringbuffer;
+
+  if (self->shm_reader == NULL)
+    return;
+
+  GST_WASAPI_RING_BUFFER (ringbuffer)->shm = NULL;
+  g_clear_pointer (&self->shm_reader, gst_wasapi_shm_reader_free);
+  gst_base_sink_set_async_enabled (GST_BASE_SINK (self), self->shm_async);
+}
+
+static GstStateChangeReturn
+gst_wasapi_sink_change_state (GstElement * element, GstStateChange transition)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (element);
+  GstStateChangeReturn ret;
+
+  /* Before the base class, so it doesn't wait for a preroll */
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED &&
+      !gst_wasapi_sink_open_shm_input (self))
+    return GST_STATE_CHANGE_FAILURE;
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      if (ret == GST_STATE_CHANGE_FAILURE && self->shm_reader != NULL) {
+        gst_audio_ring_buffer_release (GST_AUDIO_BASE_SINK (self)->ringbuffer);
+        gst_wasapi_sink_close_shm_input (self);
+      }
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+      /* Nothing is committed that would start it */
+      if (ret != GST_STATE_CHANGE_FAILURE && self->shm_reader != NULL)
+        gst_audio_ring_buffer_start (GST_AUDIO_BASE_SINK (self)->ringbuffer);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* The base class released the ringbuffer */
+      gst_wasapi_sink_close_shm_input (self);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static void
+gst_wasapi_sink_default_device_changed (EDataFlow flow, ERole role,
+    const gchar * id, gpointer user_data)
+{
+  GstWasapiSink *self = user_data;
+
+  if (flow != eRender || role != gst_wasapi_device_role_to_erole (self->role))
+    return;
+
+  /* Our stream is on the new device already */
+  if (self->routed) {
+    GST_INFO_OBJECT (self, "default device changed to %s", GST_STR_NULL (id));
+    GST_OBJECT_LOCK (self);
+    g_free (self->device_id);
+    self->device_id = g_strdup (id);
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  GST_WARNING_OBJECT (self, "default device changed");
+  g_atomic_int_set (&self->default_changed, TRUE);
+}
+
+/* Wakes up write() when our device is gone, instead of it waiting for an
+ * event that never comes */
+static void
+gst_wasapi_sink_device_changed (GstWasapiSink * self, const gchar * id,
+    gboolean available)
+{
+  gboolean ours;
+
+  /* The engine moves a routed stream to whatever device is left */
+  if (available || id == NULL || self->routed)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  ours = self->device_id && g_ascii_strcasecmp (self->device_id, id) == 0;
+  GST_OBJECT_UNLOCK (self);
+
+  if (ours) {
+    GST_WARNING_OBJECT (self, "device %s went away", id);
+    g_atomic_int_set (&self->device_lost, TRUE);
+    SetEvent (self->event_handle);
+  }
+}
+
+static void
+gst_wasapi_sink_device_state_changed (const gchar * id, DWORD state,
+    gpointer user_data)
+{
+  gst_wasapi_sink_device_changed (user_data, id, state == DEVICE_STATE_ACTIVE);
+}
+
+static void
+gst_wasapi_sink_device_removed (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_sink_device_changed (user_data, id, FALSE);
+}
+
+static const GstWasapiNotifyFuncs notify_funcs = {
+  .device_state_changed = gst_wasapi_sink_device_state_changed,
+  .device_removed = gst_wasapi_sink_device_removed,
+  .default_device_changed = gst_wasapi_sink_default_device_changed,
+};
+
+/* The client is dead, but unless the device is gone it can be opened again
+ * right away. Wakes up write() to do that. */
+static void
+gst_wasapi_sink_session_disconnected (AudioSessionDisconnectReason reason,
+    gpointer user_data)
+{
+  GstWasapiSink *self = user_data;
+
+  if (reason == DisconnectReasonDeviceRemoval)
+    g_atomic_int_set (&self->device_lost, TRUE);
+  else
+    g_atomic_int_set (&self->session_lost, TRUE);
+  SetEvent (self->event_handle);
+}
+
+/* Before anything depends on the share mode, the caps do */
+static void
+gst_wasapi_sink_auto_tune (GstWasapiSink * self, IMMDevice * device)
+{
+  GstWasapiAutoTuneConfig config;
+
+  if (!gst_wasapi_autotune_get_config (GST_ELEMENT (self), device,
+          "render", &config))
+    return;
+
+  self->sharemode = config.exclusive ? AUDCLNT_SHAREMODE_EXCLUSIVE :
+      AUDCLNT_SHAREMODE_SHARED;
+  self->low_latency = config.low_latency;
+  self->try_audioclient3 = config.audioclient3;
+}
+
+/* With device-name and no device, looks up the endpoint, which is then the
+ * device until the next open() */
+static gboolean
+gst_wasapi_sink_resolve_device_name (GstWasapiSink * self)
+{
+  gchar *id;
+
+  if (self->device_name_resolved) {
+    g_clear_pointer (&self->device_strid, g_free);
+    self->device_name_resolved = FALSE;
+  }
+  if (self->device_strid != NULL || self->device_name == NULL)
+    return TRUE;
+
+  id = gst_wasapi_device_cache_find_by_name (GST_ELEMENT (self),
+      eRender, self->device_name);
+  if (id == NULL)
+    return FALSE;
+
+  self->device_strid = g_utf8_to_utf16 (id, -1, NULL, NULL, NULL);
+  self->device_name_resolved = TRUE;
+  g_free (id);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_sink_open_device (GstWasapiSink * self)
+{
+  gboolean res = FALSE;
+  IMMDevice *device = NULL;
+  IAudioClient *client = NULL;
+
+  if (!gst_wasapi_sink_resolve_device_name (self)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND, (NULL),
+        ("No playback device named %s", self->device_name));
+    goto beach;
+  }
+
+  /* When the default device changes, write() switches to the new one with
+   * follow-default-device, see gst_wasapi_sink_switch_device(), unless the
+   * engine does that with stream-routing */
+  self->routed = self->stream_routing && !self->device_strid &&
+      self->sharemode == AUDCLNT_SHAREMODE_SHARED && !self->auto_tune &&
+      !self->use_device_clock && !self->shared_client &&
+      gst_wasapi_util_get_routed_client (GST_ELEMENT (self), eRender,
+      self->role, &device, &client);
+  if (!self->routed && !gst_wasapi_util_get_device_client (GST_ELEMENT (self),
+          eRender, self->role, self->device_strid, &device, &client)) {
+    if (!self->device_strid)
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+          ("Failed to get default device"));
+    else
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+          ("Failed to open device %S", self->device_strid));
+    goto beach;
+  }
+  if (self->auto_tune)
+    gst_wasapi_sink_auto_tune (self, device);
+
+  /* Also for a selected device, to notice right away when it's gone */
+  g_atomic_int_set (&self->default_changed, FALSE);
+  g_atomic_int_set (&self->device_lost, FALSE);
+  g_atomic_int_set (&self->device_changed, FALSE);
+  self->restart_posted = FALSE;
+  GST_OBJECT_LOCK (self);
+  self->device_id = gst_wasapi_util_get_device_id (device);
+  GST_OBJECT_UNLOCK (self);
+  self->notify_id = gst_wasapi_notify_subscribe (GST_ELEMENT (self),
+      &notify_funcs, self);
+
+  self->client = client;
+  self->device = device;
   res = TRUE;
 
+  /* Provide the clock of the endpoint instead of ours, it is the same for
+   * all elements on this device */
+  if (self->use_device_clock &&
+      (self->shared_clock = gst_wasapi_device_clock_get_shared (device))) {
+    GST_OBJECT_LOCK (self);
+    self->own_clock = GST_AUDIO_BASE_SINK (self)->provided_clock;
+    GST_AUDIO_BASE_SINK (self)->provided_clock =
+        gst_object_ref (self->shared_clock);
+    GST_OBJECT_UNLOCK (self);
+  }
+
 beach:
 
   return res;
 }
 
+static gpointer
+gst_wasapi_sink_open_thread_func (gpointer user_data)
+{
+  GstWasapiSink *self = user_data;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  gst_wasapi_sink_open_device (self);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+/* Waits for an async-open to be done, FALSE if it failed and posted the
+ * error. Everything it set up is ours once joined. */
+static gboolean
+gst_wasapi_sink_finish_open (GstWasapiSink * self)
+{
+  g_mutex_lock (&self->open_lock);
+  if (self->open_thread != NULL) {
+    GST_DEBUG_OBJECT (self, "waiting for the device to open");
+    g_thread_join (self->open_thread);
+    self->open_thread = NULL;
+  }
+  g_mutex_unlock (&self->open_lock);
+
+  return self->client != NULL;
+}
+
+/* Not in init(), elements that autoplugging only probes and discards never
+ * get here. They stay until dispose. */
+static void
+gst_wasapi_sink_create_events (GstWasapiSink * self)
+{
+  if (self->event_handle != NULL)
+    return;
+
+  self->event_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  /* Manual-reset, set while the keepalive thread is to stop */
+  self->keepalive_stop = CreateEvent (NULL, TRUE, FALSE, NULL);
+  /* Manual-reset, set while unlocked, so the EOS drain stops waiting */
+  self->drain_cancel = CreateEvent (NULL, TRUE, FALSE, NULL);
+  gst_wasapi_cancel_init (&self->cancel);
+}
+
+static gboolean
+gst_wasapi_sink_open (GstAudioSink * asink)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (asink);
+
+  GST_DEBUG_OBJECT (self, "opening device");
+
+  gst_wasapi_sink_create_events (self);
+
+  if (self->client)
+    return TRUE;
+
+  gst_wasapi_startup_times_reset (&self->startup_times,
+      GST_WASAPI_STARTUP_ENUMERATOR);
+
+  if (!self->async_open)
+    return gst_wasapi_sink_open_device (self);
+
+  GST_DEBUG_OBJECT (self, "opening the device in the background");
+  g_mutex_lock (&self->open_lock);
+  self->open_thread = g_thread_new ("wasapi-open",
+      gst_wasapi_sink_open_thread_func, self);
+  g_mutex_unlock (&self->open_lock);
+
+  return TRUE;
+}
+
 static gboolean
 gst_wasapi_sink_close (GstAudioSink * asink)
 {
   GstWasapiSink *self = GST_WASAPI_SINK (asink);
 
+  gst_wasapi_sink_finish_open (self);
+  /* After a failed prepare */
+  g_clear_pointer (&self->bus_queue, gst_wasapi_bus_queue_free);
+
+  if (self->notify_id != 0) {
+    gst_wasapi_notify_unsubscribe (self->notify_id);
+    self->notify_id = 0;
+  }
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->device_id, g_free);
+  GST_OBJECT_UNLOCK (self);
+
+  /* The base class invalidates its clock when disposed, so never leave the
+   * shared one there */
+  if (self->shared_clock != NULL) {
+    GST_OBJECT_LOCK (self);
+    gst_object_unref (GST_AUDIO_BASE_SINK (self)->provided_clock);
+    GST_AUDIO_BASE_SINK (self)->provided_clock = self->own_clock;
+    self->own_clock = NULL;
+    GST_OBJECT_UNLOCK (self);
+    gst_object_unref (self->shared_clock);
+    self->shared_clock = NULL;
+  }
+
   if (self->device != NULL) {
     IUnknown_Release (self->device);
     self->device = NULL;
   }
 
+  gst_wasapi_sink_release_warm_client (self);
+  self->client_initialized = FALSE;
   if (self->client != NULL) {
     IUnknown_Release (self->client);
     self->client = NULL;
   }
 
+  /* The next device may well be a different one */
+  gst_wasapi_sink_clear_format (self);
+
+  return TRUE;
+}
+
+/* Releases what belongs to the client kept by unprepare() */
+static void
+gst_wasapi_sink_release_warm_client (GstWasapiSink * self)
+{
+  if (self->render_client != NULL) {
+    IUnknown_Release (self->render_client);
+    self->render_client = NULL;
+  }
+
+  if (self->client_clock != NULL) {
+    IUnknown_Release (self->client_clock);
+    self->client_clock = NULL;
+  }
+
+  gst_caps_replace (&self->warm_caps, NULL);
+}
+
+/* A client can only be initialized once, so we need a new one when we are
+ * prepared again, or if the one kept by unprepare() was initialized for
+ * other caps */
+static gboolean
+gst_wasapi_sink_renew_client (GstWasapiSink * self)
+{
+  IMMDevice *device = NULL;
+  HRESULT hr;
+
+  gst_wasapi_sink_release_warm_client (self);
+  self->client_initialized = FALSE;
+  IUnknown_Release (self->client);
+  self->client = NULL;
+
+  /* Again on the virtual default device */
+  if (self->routed && gst_wasapi_util_get_routed_client (GST_ELEMENT (self),
+          eRender, self->role, &device, &self->client)) {
+    IUnknown_Release (self->device);
+    self->device = device;
+    return TRUE;
+  }
+
+  if (gst_wasapi_util_have_audioclient3 ())
+    hr = IMMDevice_Activate (self->device, &IID_IAudioClient3, CLSCTX_ALL,
+        NULL, (void **) &self->client);
+  else
+    hr = IMMDevice_Activate (self->device, &IID_IAudioClient, CLSCTX_ALL,
+        NULL, (void **) &self->client);
+  HR_FAILED_RET (hr, IMMDevice::Activate (IID_IAudioClient), FALSE);
+
+  return TRUE;
+}
+
+/* Get the empty space in the buffer that we have to write to */
+static gint
+gst_wasapi_sink_get_can_frames (GstWasapiSink * self)
+{
+  HRESULT hr;
+  guint n_frames_padding;
+
+  /* There is no padding in exclusive mode since there is no ringbuffer */
+  if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE) {
+    GST_DEBUG_OBJECT (self, "exclusive mode, can write: %i",
+        self->buffer_frame_count);
+    return self->buffer_frame_count;
+  }
+
+  /* Frames the card hasn't rendered yet */
+  hr = IAudioClient_GetCurrentPadding (self->client, &n_frames_padding);
+  HR_FAILED_RET (hr, IAudioClient::GetCurrentPadding, -1);
+
+  GST_DEBUG_OBJECT (self, "%i unread frames (padding)", n_frames_padding);
+
+  /* We can write out these many frames */
+  return self->buffer_frame_count - n_frames_padding;
+}
+
+/* With spin-wait, whether the device took the whole exclusive mode buffer,
+ * which it signals the event for */
+static gboolean
+gst_wasapi_sink_period_ready (GstWasapiSink * self)
+{
+  UINT32 padding = 0;
+  HRESULT hr;
+
+  hr = IAudioClient_GetCurrentPadding (self->client, &padding);
+
+  /* GetBuffer() reports the errors */
+  return FAILED (hr) || padding == 0;
+}
+
+/* Attaches to the shared client of the endpoint instead of initializing
+ * ours, FALSE if we need our own for these caps */
+static gboolean
+gst_wasapi_sink_prepare_mixer_input (GstWasapiSink * self,
+    GstAudioRingBufferSpec * spec)
+{
+  GstWasapiMixerInput *input;
+  guint period_frames, buffer_frames;
+
+  input = gst_wasapi_mixer_attach (GST_ELEMENT (self), self->device, spec,
+      self->n_selected, self->selected);
+  if (input == NULL)
+    return FALSE;
+
+  gst_wasapi_mixer_input_get_sizes (input, &period_frames, &buffer_frames);
+  spec->segsize = period_frames * GST_AUDIO_INFO_BPF (&spec->info);
+  spec->segtotal = MAX (buffer_frames / period_frames, 2);
+
+  GST_INFO_OBJECT (self, "using the shared client, segsize is %i, segtotal "
+      "is %i", spec->segsize, spec->segtotal);
+
+  GST_OBJECT_LOCK (self);
+  self->mixer_input = input;
+  gst_wasapi_sink_apply_volume (self);
+  GST_OBJECT_UNLOCK (self);
+
+  /* Our channels are in the order of device-channels already */
+  if (self->n_selected == 0)
+    gst_audio_ring_buffer_set_channel_positions (GST_AUDIO_BASE_SINK
+        (self)->ringbuffer, self->positions);
+
+  return TRUE;
+}
+
+static void
+gst_wasapi_sink_clear_aec_ref (GstWasapiSink * self)
+{
+  if (self->aec_ref == NULL)
+    return;
+
+  gst_wasapi_aec_ref_stop (self->aec_ref, GST_ELEMENT (self));
+  g_clear_pointer (&self->aec_ref, gst_wasapi_aec_ref_unref);
+}
+
+static void
+gst_wasapi_sink_clear_resampler (GstWasapiSink * self)
+{
+  g_clear_pointer (&self->resampler, gst_wasapi_resampler_free);
+  g_clear_pointer (&self->clock_drift, gst_wasapi_drift_free);
+  self->slave_valid = FALSE;
+  self->slave_base_valid = FALSE;
+  g_atomic_int_set (&self->resampler_needs_reset, FALSE);
+}
+
+/* For the wasapi-stats messages, on their thread */
+static void
+gst_wasapi_sink_stats_snapshot (GstElement * element, GstWasapiStats * stats,
+    gdouble * drift_ppm)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (element);
+
+  gst_wasapi_sink_get_stats (self, stats);
+
+  *drift_ppm = 0;
+  GST_OBJECT_LOCK (self);
+  if (self->drift)
+    gst_wasapi_drift_get_ppm (self->drift, drift_ppm);
+  GST_OBJECT_UNLOCK (self);
+}
+
+/* The channel-delays in frames at @rate, unless @delays is NULL, and the
+ * channel-gains as factors for the @channels of the endpoint. Whether
+ * there is any of either. */
+static gboolean
+gst_wasapi_sink_get_trim (GstWasapiSink * self, guint * delays,
+    gfloat * gains, gint channels, gint rate)
+{
+  guint n_delays, n_gains;
+  gint i;
+
+  GST_OBJECT_LOCK (self);
+  n_delays = gst_value_array_get_size (&self->channel_delays);
+  n_gains = gst_value_array_get_size (&self->channel_gains);
+  for (i = 0; i < channels; i++) {
+    if (delays != NULL)
+      delays[i] = i < n_delays ? (guint) (g_value_get_double
+          (gst_value_array_get_value (&self->channel_delays, i)) * rate /
+          1000.0 + 0.5) : 0;
+    gains[i] = i < n_gains ? (gfloat) pow (10.0, g_value_get_double
+        (gst_value_array_get_value (&self->channel_gains, i)) / 20.0) : 1.0f;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return n_delays > 0 || n_gains > 0;
+}
+
+/* Tells upstream and the application that the device ran dry for
+ * @duration, if QoS is enabled */
+static void
+gst_wasapi_sink_post_underrun (GstWasapiSink * self, GstClockTime duration,
+    guint64 total_time)
+{
+  GstClockTime running_time = GST_CLOCK_TIME_NONE, base_time, now;
+  GstClock *clock;
+  GstMessage *msg;
+  guint64 written;
+
+  GST_INFO_OBJECT (self, "device ran dry for %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (duration));
+
+  if (!gst_base_sink_is_qos_enabled (GST_BASE_SINK (self)))
+    return;
+
+  GST_OBJECT_LOCK (self);
+  if ((clock = GST_ELEMENT_CLOCK (self)) != NULL)
+    gst_object_ref (clock);
+  base_time = GST_ELEMENT_CAST (self)->base_time;
+  GST_OBJECT_UNLOCK (self);
+
+  if (clock != NULL) {
+    now = gst_clock_get_time (clock);
+    if (GST_CLOCK_TIME_IS_VALID (now) && now > base_time)
+      running_time = now - base_time;
+    gst_object_unref (clock);
+  }
+
+  g_mutex_lock (&self->position_lock);
+  written = self->frames_written;
+  g_mutex_unlock (&self->position_lock);
+
+  if (GST_CLOCK_TIME_IS_VALID (running_time))
+    gst_pad_push_event (GST_BASE_SINK_PAD (self),
+        gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW, 1.0,
+            (GstClockTimeDiff) duration, running_time));
+
+  msg = gst_message_new_qos (GST_OBJECT (self), TRUE, running_time,
+      GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, duration);
+  gst_message_set_qos_values (msg, (gint64) duration, 1.0, 1000000);
+  gst_message_set_qos_stats (msg, GST_FORMAT_DEFAULT, written,
+      gst_util_uint64_scale_int (total_time, self->mix_format->nSamplesPerSec,
+          GST_SECOND));
+  gst_element_post_message (GST_ELEMENT (self), msg);
+}
+
+/* What the thread that writes the device leaves to the bus queue to post */
+enum
+{
+  SINK_NOTIFY_RESTART = 1,
+  SINK_NOTIFY_UNDERRUN,
+  SINK_NOTIFY_STARTUP,
+};
+
+static void
+gst_wasapi_sink_notified (GstElement * element,
+    const GstWasapiNotification * notification)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (element);
+
+  switch (notification->kind) {
+    case SINK_NOTIFY_RESTART:
+      if (!gst_element_post_message (element,
+              gst_message_new_element (GST_OBJECT (self),
+                  gst_structure_new_empty ("wasapi_restart"))))
+        GST_WARNING_OBJECT (self, "Unable to send message");
+      break;
+    case SINK_NOTIFY_UNDERRUN:
+      gst_wasapi_sink_post_underrun (self, notification->args[0],
+          notification->args[1]);
+      break;
+    case SINK_NOTIFY_STARTUP:
+      gst_element_post_message (element,
+          gst_message_new_element (GST_OBJECT (self),
+              gst_wasapi_startup_times_to_structure (&self->startup_times,
+                  "wasapi-startup")));
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+/* Through the bus queue while prepared, so the thread that writes the
+ * device neither formats nor takes the bus lock. Directly otherwise. */
+static void
+gst_wasapi_sink_notify (GstWasapiSink * self, guint kind, guint64 arg0,
+    guint64 arg1)
+{
+  GstWasapiNotification notification = { kind, {arg0, arg1, 0} };
+
+  if (self->bus_queue != NULL)
+    gst_wasapi_bus_queue_push (self->bus_queue, kind, arg0, arg1, 0);
+  else
+    gst_wasapi_sink_notified (GST_ELEMENT (self), &notification);
+}
+
+static gboolean
+gst_wasapi_sink_prepare (GstAudioSink * asink, GstAudioRingBufferSpec * spec)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (asink);
+  gboolean res = FALSE;
+  REFERENCE_TIME latency_rt;
+  guint bpf, rate, devicep_frames, queued = 0;
+  gboolean offloaded = FALSE, audioclient3, warm = FALSE;
+  guint64 latency_time = spec->latency_time, buffer_time = spec->buffer_time;
+  guint64 start, written = 0;
+  HRESULT hr;
+
+  /* Normally get_caps() waited already */
+  if (!gst_wasapi_sink_finish_open (self))
+    return FALSE;
+
+  gst_wasapi_startup_times_reset (&self->startup_times,
+      GST_WASAPI_STARTUP_INITIALIZE);
+
+  if (self->bus_queue == NULL)
+    self->bus_queue = gst_wasapi_bus_queue_new (GST_ELEMENT (self),
+        gst_wasapi_sink_notified);
+
+  /* What write() registers its thread with, so it never looks at the
+   * properties */
+  g_free (self->thread_task);
+  GST_OBJECT_LOCK (self);
+  self->thread_task = g_strdup (self->mmcss_task);
+  self->thread_priority = self->mmcss_priority;
+  self->thread_group = self->processor_group;
+  self->thread_mask = self->thread_affinity;
+  self->thread_flags =
+      (self->power_throttling ? 0 : GST_WASAPI_THREAD_NO_THROTTLING) |
+      (self->performance_cores ? GST_WASAPI_THREAD_PERFORMANCE_CORES : 0);
+  self->thread_start_qpc = self->start_qpc;
+  GST_OBJECT_UNLOCK (self);
+
+  if (self->shared_client && self->sharemode == AUDCLNT_SHAREMODE_SHARED &&
+      spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      gst_wasapi_sink_prepare_mixer_input (self, spec)) {
+    res = TRUE;
+    goto beach;
+  }
+
+  /* Only the shared client takes part of the channels */
+  if (self->n_selected > 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+        ("can't render into device-channels without the shared client"));
+    goto beach;
+  }
+
+  /* From here on we work in the format of upstream, the engine converts it
+   * or the endpoint decodes it */
+  if (self->mix_format != self->device_format)
+    CoTaskMemFree (self->mix_format);
+  self->mix_format = self->device_format;
+
+  if (spec->type != GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW) {
+    self->mix_format = gst_wasapi_util_get_passthrough_format (spec->type,
+        GST_AUDIO_INFO_RATE (&spec->info));
+    if (self->mix_format == NULL ||
+        self->sharemode != AUDCLNT_SHAREMODE_EXCLUSIVE) {
+      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+          ("passthrough is only possible in exclusive mode"));
+      if (self->mix_format != NULL)
+        CoTaskMemFree (self->mix_format);
+      self->mix_format = self->device_format;
+      goto beach;
+    }
+  } else if ((self->autoconvert &&
+          self->sharemode == AUDCLNT_SHAREMODE_SHARED) ||
+      (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE &&
+          !gst_wasapi_util_waveformatex_matches_info (self->device_format,
+              &spec->info))) {
+    /* One of the probed exclusive formats otherwise */
+    self->mix_format =
+        gst_wasapi_util_audio_info_to_waveformatex (&spec->info,
+        self->device_format);
+  }
+
+  if (self->warm_caps != NULL) {
+    if (gst_caps_is_equal (self->warm_caps, spec->caps) &&
+        self->warm_latency_time == latency_time &&
+        self->warm_buffer_time == buffer_time) {
+      GST_INFO_OBJECT (self, "reusing the prewarmed client");
+      devicep_frames = self->warm_devicep_frames;
+      warm = TRUE;
+    } else {
+      GST_INFO_OBJECT (self, "caps changed, not reusing the prewarmed client");
+      if (!gst_wasapi_sink_renew_client (self))
+        goto beach;
+    }
+  } else if (self->client_initialized && !gst_wasapi_sink_renew_client (self)) {
+    goto beach;
+  }
+
+  if (!warm && self->offload && self->sharemode == AUDCLNT_SHAREMODE_SHARED)
+    offloaded = gst_wasapi_util_request_offload (GST_ELEMENT (self),
+        self->client, self->mix_format, spec, self->category, self->raw);
+  if (!warm && !offloaded)
+    gst_wasapi_sink_set_client_properties (self, self->client);
+
+  /* The engine periods of IAudioClient3 are only valid for the mix format,
+   * and offloaded streams don't run on engine periods at all */
+  audioclient3 = !self->autoconvert && !offloaded &&
+      gst_wasapi_sink_can_audioclient3 (self, spec);
+  start = gst_wasapi_util_get_qpc_position ();
+  if (warm) {
+    /* Initialized, with its event handle, clock and render client */
+  } else if (audioclient3) {
+    if (!gst_wasapi_util_initialize_audioclient3 (GST_ELEMENT (self), spec,
+            (IAudioClient3 *) self->client, self->mix_format, self->low_latency,
+            FALSE, &devicep_frames))
+      goto beach;
+  } else {
+    if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
+            self->device, &self->client, self->mix_format, self->sharemode,
+            self->low_latency && !offloaded, FALSE, self->autoconvert,
+            FALSE, &devicep_frames))
+      goto beach;
+  }
+  gst_wasapi_startup_times_add (GST_ELEMENT (self),
+      GST_WASAPI_STARTUP_INITIALIZE, start);
+  self->client_initialized = TRUE;
+
+  bpf = GST_AUDIO_INFO_BPF (&spec->info);
+  rate = GST_AUDIO_INFO_RATE (&spec->info);
+
+  /* Integer caps or other channels on the float mix format, see
+   * add_convert_caps(). The mixing goes straight to the device positions. */
+  g_clear_pointer (&self->render_convert, gst_wasapi_convert_free);
+  self->write_bpf = self->mix_format->nBlockAlign;
+  if (spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      self->sharemode == AUDCLNT_SHAREMODE_SHARED && !self->autoconvert &&
+      (GST_AUDIO_INFO_FORMAT (&spec->info) != GST_AUDIO_FORMAT_F32LE ||
+          GST_AUDIO_INFO_CHANNELS (&spec->info) !=
+          self->mix_format->nChannels)) {
+    GstAudioInfo mix_info;
+
+    gst_audio_info_set_format (&mix_info, GST_AUDIO_FORMAT_F32LE, rate,
+        self->mix_format->nChannels, self->positions);
+    self->render_convert = gst_wasapi_convert_new (&spec->info, &mix_info,
+        FALSE);
+    if (self->render_convert == NULL ||
+        !gst_wasapi_util_waveformatex_matches_info (self->mix_format,
+            &mix_info)) {
+      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+          ("can't convert %s with %d channels to the mix format",
+              GST_AUDIO_INFO_NAME (&spec->info),
+              GST_AUDIO_INFO_CHANNELS (&spec->info)));
+      goto beach;
+    }
+    self->write_bpf = bpf;
+    GST_INFO_OBJECT (self, "converting %s with %d channels to the float mix "
+        "format with %d", GST_AUDIO_INFO_NAME (&spec->info),
+        GST_AUDIO_INFO_CHANNELS (&spec->info), self->mix_format->nChannels);
+  }
+
+  /* Total size of the allocated buffer that we will write to */
+  hr = IAudioClient_GetBufferSize (self->client, &self->buffer_frame_count);
+  HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
+
+  GST_INFO_OBJECT (self, "buffer size is %i frames, device period is %i "
+      "frames, bpf is %i bytes, rate is %i Hz", self->buffer_frame_count,
+      devicep_frames, bpf, rate);
+
+  /* Actual latency-time/buffer-time will be different now */
+  spec->segsize = devicep_frames * bpf;
+
+  if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE) {
+    g_free (self->period_data);
+    self->period_data = g_malloc (self->buffer_frame_count * bpf);
+    self->period_fill = 0;
+  }
+
+  gst_wasapi_spin_clear (&self->spin);
+  if (self->spin_wait) {
+    if (self->sharemode != AUDCLNT_SHAREMODE_EXCLUSIVE)
+      GST_WARNING_OBJECT (self, "can only spin in exclusive mode, waiting "
+          "for events");
+    else if (gst_wasapi_spin_init (&self->spin,
+            gst_util_uint64_scale_int (self->buffer_frame_count, GST_SECOND,
+                rate)))
+      GST_INFO_OBJECT (self, "spinning for the device periods");
+  }
+
+  /* We need a minimum of 2 segments to ensure glitch-free playback */
+  spec->segtotal = MAX (self->buffer_frame_count * self->write_bpf /
+      spec->segsize, 2);
+  /* The engine period followed latency-time, the shared buffer is just a
+   * few of them, so buffer-time is up to the ringbuffer */
+  if (audioclient3 && !self->low_latency)
+    spec->segtotal = MAX (gst_util_uint64_scale_int_ceil (spec->buffer_time,
+            rate, G_USEC_PER_SEC) / devicep_frames, spec->segtotal);
+  if (self->adaptive_buffer) {
+    guint extra = gst_wasapi_device_cache_get_ring_extra (GST_ELEMENT (self),
+        self->device);
+
+    gst_wasapi_ring_sizer_reset (&self->ring_sizer, extra,
+        gst_util_uint64_scale_int (devicep_frames, G_USEC_PER_SEC, rate));
+    spec->segtotal = 2 + extra;
+  }
+
+  GST_INFO_OBJECT (self, "segsize is %i, segtotal is %i", spec->segsize,
+      spec->segtotal);
+
+  /* Get latency for logging */
+  hr = IAudioClient_GetStreamLatency (self->client, &latency_rt);
+  HR_FAILED_GOTO (hr, IAudioClient::GetStreamLatency, beach);
+  self->stream_latency = latency_rt * 100;
+
+  GST_INFO_OBJECT (self, "wasapi stream latency: %" G_GINT64_FORMAT " (%"
+      G_GINT64_FORMAT "ms)", latency_rt, latency_rt / 10000);
+
+  /* Set the event handler which will trigger writes */
+  if (!warm) {
+    hr = IAudioClient_SetEventHandle (self->client, self->event_handle);
+    HR_FAILED_GOTO (hr, IAudioClient::SetEventHandle, beach);
+  }
+
+  g_atomic_int_set (&self->session_lost, FALSE);
+  self->session = gst_wasapi_session_watch (GST_ELEMENT (self), self->client,
+      gst_wasapi_sink_session_disconnected, self);
+
+  /* The device clock drives our clock, and is used to estimate the drift */
+  if (!warm && !gst_wasapi_util_get_clock (GST_ELEMENT (self), self->client,
+          &self->client_clock))
+    goto beach;
+
+  hr = IAudioClock_GetFrequency (self->client_clock, &self->client_clock_freq);
+  HR_FAILED_GOTO (hr, IAudioClock::GetFrequency, beach);
+
+  /* The kept client still holds the end of what was played before, its
+   * position went on from there */
+  if (warm) {
+    UINT64 devpos, qpcpos;
+
+    hr = IAudioClock_GetPosition (self->client_clock, &devpos, &qpcpos);
+    HR_FAILED_GOTO (hr, IAudioClock::GetPosition, beach);
+    hr = IAudioClient_GetCurrentPadding (self->client, &queued);
+    HR_FAILED_GOTO (hr, IAudioClient::GetCurrentPadding, beach);
+
+    written = gst_util_uint64_scale (devpos, rate,
+        self->client_clock_freq) + queued;
+    GST_DEBUG_OBJECT (self, "%u frames still queued", queued);
+  }
+
+  if (self->shared_clock != NULL &&
+      !gst_wasapi_device_clock_add_client (self->shared_clock,
+          self->client_clock, gst_util_uint64_scale_int (devicep_frames,
+              GST_SECOND, rate)))
+    goto beach;
+
+  GST_OBJECT_LOCK (self);
+  self->drift = gst_wasapi_drift_new ((gint) self->client_clock_freq);
+  GST_OBJECT_UNLOCK (self);
+
+  g_mutex_lock (&self->position_lock);
+  self->frames_written = written;
+  g_mutex_unlock (&self->position_lock);
+
+  /* Nothing writes the device yet */
+  gst_wasapi_stats_block_reset (self->device_stats);
+  gst_wasapi_stats_block_reset (self->streaming_stats);
+  gst_wasapi_histogram_reset (&self->wakeup_histogram);
+  gst_wasapi_histogram_reset (&self->hold_histogram);
+  g_atomic_int_set (&self->primed, queued > 0);
+  g_atomic_int_set (&self->free_frames, 0);
+  self->dry_time = 0;
+
+  /* Get render sink client and start it up */
+  if (!warm && !gst_wasapi_util_get_render_client (GST_ELEMENT (self),
+          self->client, &self->render_client)) {
+    goto beach;
+  }
+
+  GST_INFO_OBJECT (self, "got render client");
+
+  /* Not available in exclusive mode, then mute falls back to the silent
+   * buffer flag and volume does nothing */
+  if (self->sharemode == AUDCLNT_SHAREMODE_SHARED) {
+    GST_OBJECT_LOCK (self);
+    if (gst_wasapi_util_get_stream_volume (GST_ELEMENT (self), self->client,
+            &self->stream_volume))
+      gst_wasapi_sink_apply_volume (self);
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  self->period_frames = devicep_frames;
+
+  if (warm || (!self->prefill_silence &&
+          self->sharemode == AUDCLNT_SHAREMODE_SHARED)) {
+    /* Started once the first period of real samples is in, by render(). A
+     * kept client only needs silence for the time until then. */
+    GST_DEBUG_OBJECT (self, "waiting for samples to start");
+    g_atomic_int_set (&self->client_needs_restart, TRUE);
+  } else {
+    /* To avoid start-up glitches, before starting the streaming, we fill the
+     * buffer with silence as recommended by the documentation:
+     * https://msdn.microsoft.com/en-us/library/windows/desktop/dd370879%28v=vs.85%29.aspx */
+    gint n_frames, len;
+    gint16 *dst = NULL;
+
+    n_frames = gst_wasapi_sink_get_can_frames (self);
+    if (n_frames < 1) {
+      GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
+          ("should have more than %i frames to write", n_frames));
+      goto beach;
+    }
+
+    len = n_frames * self->mix_format->nBlockAlign;
+
+    hr = IAudioRenderClient_GetBuffer (self->render_client, n_frames,
+        (BYTE **) & dst);
+    HR_FAILED_GOTO (hr, IAudioRenderClient::GetBuffer, beach);
+
+    GST_DEBUG_OBJECT (self, "pre-wrote %i bytes of silence", len);
+
+    hr = IAudioRenderClient_ReleaseBuffer (self->render_client, n_frames,
+        AUDCLNT_BUFFERFLAGS_SILENT);
+    HR_FAILED_GOTO (hr, IAudioRenderClient::ReleaseBuffer, beach);
+
+    start = gst_wasapi_util_get_qpc_position ();
+    hr = IAudioClient_Start (self->client);
+    gst_wasapi_startup_times_add (GST_ELEMENT (self),
+        GST_WASAPI_STARTUP_START, start);
+    HR_FAILED_GOTO (hr, IAudioClient::Start, beach);
+  }
+
+  /* Bitstreams have no channel positions. The ringbuffer keeps the samples
+   * in the GStreamer order, render() puts them in device order. */
+  self->reorder = FALSE;
+  if (spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      self->positions != NULL &&
+      GST_AUDIO_INFO_CHANNELS (&spec->info) == self->mix_format->nChannels &&
+      self->mix_format->nChannels == self->device_format->nChannels)
+    self->reorder =
+        gst_wasapi_util_get_reorder_map (self->mix_format->nChannels,
+        spec->info.position, self->positions, self->reorder_map);
+
+  g_clear_pointer (&self->latency_probe, gst_wasapi_latency_probe_free);
+  if (self->probe_latency &&
+      spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW) {
+    self->latency_probe = gst_wasapi_latency_probe_new (self->mix_format);
+    if (self->latency_probe == NULL)
+      GST_WARNING_OBJECT (self, "can't insert latency pulses in this format");
+  }
+
+  g_clear_pointer (&self->concealment, gst_wasapi_conceal_free);
+  g_atomic_int_set (&self->conceal_flushed, FALSE);
+  if (self->conceal && spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW) {
+    self->concealment = gst_wasapi_conceal_new (self->mix_format,
+        devicep_frames);
+    if (self->concealment == NULL)
+      GST_WARNING_OBJECT (self, "can't conceal underruns in this format");
+  }
+
+  g_clear_pointer (&self->trim, gst_wasapi_trim_free);
+  g_atomic_int_set (&self->trim_flushed, FALSE);
+  g_atomic_int_set (&self->trim_gains_changed, FALSE);
+  if (spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      self->mixer_input == NULL) {
+    gint channels = self->mix_format->nChannels;
+    guint *delays = g_newa (guint, channels);
+    gfloat *gains = g_newa (gfloat, channels);
+
+    if (gst_wasapi_sink_get_trim (self, delays, gains, channels,
+            self->mix_format->nSamplesPerSec)) {
+      self->trim = gst_wasapi_trim_new (self->mix_format, delays, gains);
+      if (self->trim == NULL)
+        GST_WARNING_OBJECT (self, "can't delay or scale channels in this "
+            "format");
+    }
+  }
+
+  gst_wasapi_sink_clear_resampler (self);
+  if (spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      self->mixer_input == NULL) {
+    GstAudioBaseSinkSlaveMethod slave_method;
+
+    g_object_get (self, "slave-method", &slave_method, NULL);
+    if (slave_method == GST_AUDIO_BASE_SINK_SLAVE_CUSTOM) {
+      self->resampler = gst_wasapi_resampler_new (&spec->info);
+      if (self->resampler == NULL)
+        GST_WARNING_OBJECT (self, "can't resample this format, not following "
+            "the pipeline clock");
+      else
+        self->clock_drift = gst_wasapi_drift_new ((gint)
+            self->client_clock_freq);
+    }
+  }
+
+  /* Raw samples written by write() only, what the ringbuffer renders itself
+   * starts right away */
+  self->start_pending = self->thread_start_qpc != 0 &&
+      spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      self->mixer_input == NULL && !self->zero_copy && !self->jitter_buffer;
+
+  gst_wasapi_sink_clear_aec_ref (self);
+  if (self->aec_reference &&
+      spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW &&
+      self->device_id != NULL) {
+    self->aec_ref = gst_wasapi_aec_ref_get (self->device_id);
+    if (!gst_wasapi_aec_ref_start (self->aec_ref, GST_ELEMENT (self),
+            self->mix_format))
+      g_clear_pointer (&self->aec_ref, gst_wasapi_aec_ref_unref);
+  }
+
+  if (!warm && !offloaded && self->sharemode == AUDCLNT_SHAREMODE_SHARED) {
+    gst_caps_replace (&self->warm_caps, spec->caps);
+    self->warm_latency_time = latency_time;
+    self->warm_buffer_time = buffer_time;
+    self->warm_devicep_frames = devicep_frames;
+  }
+
+  res = TRUE;
+
+beach:
+  /* unprepare() is not called if prepare() fails, but we want it to be, so call
+   * it manually when needed. Nothing is kept of a failed client. */
+  if (!res) {
+    gst_caps_replace (&self->warm_caps, NULL);
+    gst_wasapi_sink_unprepare (asink);
+  } else if (self->stats_interval > 0) {
+    self->stats_reporter = gst_wasapi_stats_reporter_new (GST_ELEMENT (self),
+        self->stats_interval, GST_AUDIO_INFO_RATE (&spec->info),
+        &self->wakeup_histogram, gst_wasapi_sink_stats_snapshot);
+  }
+
+  return res;
+}
+
+static gboolean
+gst_wasapi_sink_unprepare (GstAudioSink * asink)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (asink);
+  gboolean keep = self->prewarm && self->warm_caps != NULL &&
+      self->render_client != NULL && self->mixer_input == NULL;
+
+  self->stream_latency = GST_CLOCK_TIME_NONE;
+
+  g_clear_pointer (&self->stats_reporter, gst_wasapi_stats_reporter_free);
+
+  g_clear_pointer (&self->session, gst_wasapi_session_unwatch);
+
+  if (self->mixer_input != NULL) {
+    GstWasapiMixerInput *input = self->mixer_input;
+
+    GST_OBJECT_LOCK (self);
+    self->mixer_input = NULL;
+    GST_OBJECT_UNLOCK (self);
+    gst_wasapi_mixer_detach (input);
+  } else if (self->client != NULL) {
+    gst_wasapi_sink_stop_keepalive (self);
+    /* Without a reset what is queued plays once it's started again */
+    IAudioClient_Stop (self->client);
+  }
+
+  GST_OBJECT_LOCK (self);
+  if (self->stream_volume != NULL) {
+    IUnknown_Release (self->stream_volume);
+    self->stream_volume = NULL;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (self->client_clock != NULL && self->shared_clock != NULL)
+    gst_wasapi_device_clock_remove_client (self->shared_clock,
+        self->client_clock);
+
+  if (!keep)
+    gst_wasapi_sink_release_warm_client (self);
+
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->drift, gst_wasapi_drift_free);
+  GST_OBJECT_UNLOCK (self);
+
+  g_clear_pointer (&self->period_data, g_free);
+  self->period_fill = 0;
+  g_clear_pointer (&self->latency_probe, gst_wasapi_latency_probe_free);
+  g_clear_pointer (&self->concealment, gst_wasapi_conceal_free);
+  g_clear_pointer (&self->trim, gst_wasapi_trim_free);
+  g_clear_pointer (&self->render_convert, gst_wasapi_convert_free);
+  gst_wasapi_spin_clear (&self->spin);
+  gst_wasapi_sink_clear_resampler (self);
+  gst_wasapi_sink_clear_aec_ref (self);
+  g_clear_pointer (&self->bus_queue, gst_wasapi_bus_queue_free);
+
+  return TRUE;
+}
+
+/* The running ringbuffer can't change size, keep what adaptive-buffer
+ * learned for the next prepare */
+static void
+gst_wasapi_sink_store_ring_extra (GstWasapiSink * self, guint extra)
+{
+  GST_INFO_OBJECT (self, "ringbuffer wants %u extra segments, from the next "
+      "prepare on", extra);
+  gst_wasapi_device_cache_set_ring_extra (GST_ELEMENT (self), self->device,
+      extra);
+}
+
+/* Accounts a wakeup of the render thread at @wakeup (0 if we didn't have to
+ * wait) with @can_frames of room in the device buffer */
+static void
+gst_wasapi_sink_update_stats (GstWasapiSink * self, gint64 wakeup,
+    guint can_frames)
+{
+  guint padding = self->buffer_frame_count - can_frames;
+  gboolean underrun = FALSE;
+  gboolean resized = FALSE;
+  GstWasapiStats *stats;
+  GstClockTime duration = 0;
+  guint64 total_time;
+  gint64 interval = -1;
+
+  if (g_atomic_int_get (&self->primed)) {
+    guint delay;
+
+    /* The device played everything we gave it. There is no padding in
+     * exclusive mode, ask the position there. */
+    if (self->sharemode == AUDCLNT_SHAREMODE_SHARED)
+      underrun = padding == 0;
+    else
+      underrun = gst_wasapi_sink_get_position_delay (self, &delay) &&
+          delay == 0;
+  }
+
+  if (underrun && self->dry_time != 0) {
+    gint64 now = wakeup != 0 ? wakeup : g_get_monotonic_time ();
+
+    if (now > self->dry_time)
+      duration = (now - self->dry_time) * GST_USECOND;
+  }
+
+  stats = gst_wasapi_stats_block_begin (self->device_stats);
+  if (wakeup != 0)
+    interval = gst_wasapi_stats_wakeup (stats, wakeup);
+  if (self->sharemode == AUDCLNT_SHAREMODE_SHARED)
+    stats->max_padding = MAX (stats->max_padding, padding);
+  if (underrun) {
+    stats->underruns++;
+    stats->underrun_time += duration / GST_USECOND;
+  }
+  total_time = stats->underrun_time * GST_USECOND;
+  gst_wasapi_stats_block_end (self->device_stats);
+
+  if (self->adaptive_buffer) {
+    if (interval >= 0)
+      resized = gst_wasapi_ring_sizer_wakeup (&self->ring_sizer, wakeup,
+          interval);
+    if (underrun)
+      resized |= gst_wasapi_ring_sizer_glitch (&self->ring_sizer,
+          wakeup != 0 ? wakeup : g_get_monotonic_time ());
+  }
+
+  if (resized)
+    gst_wasapi_sink_store_ring_extra (self, self->ring_sizer.extra);
+
+  if (interval >= 0)
+    gst_wasapi_histogram_add (&self->wakeup_histogram, interval);
+
+  if (underrun && self->concealment != NULL)
+    gst_wasapi_conceal_dropout (self->concealment);
+
+  if (underrun)
+    gst_wasapi_sink_notify (self, SINK_NOTIFY_UNDERRUN, duration, total_time);
+
+  if (wakeup != 0 && gst_wasapi_startup_times_event (&self->startup_times))
+    gst_wasapi_sink_notify (self, SINK_NOTIFY_STARTUP, 0, 0);
+}
+
+gint
+gst_wasapi_sink_wait_for_room (GstWasapiSink * self, HANDLE cancel)
+{
+  HANDLE handles[2] = { self->event_handle, cancel };
+  DWORD dwWaitResult;
+  gint64 wakeup = 0;
+  gint can_frames;
+
+  /* Stopped after a reset or before the first samples, nothing to wait for.
+   * Without the silent prefill only give it a period, so the first samples
+   * are heard right away. It is started once they are in. */
+  if (g_atomic_int_get (&self->client_needs_restart)) {
+    can_frames = gst_wasapi_sink_get_can_frames (self);
+    if (can_frames > 0 && !self->prefill_silence)
+      can_frames = MIN (can_frames, (gint) self->period_frames);
+    if (can_frames != 0)
+      return can_frames;
+
+    /* Full already, start it and wait for room as usual */
+    if (!gst_wasapi_util_start_if_needed (GST_ELEMENT (self), self->client,
+            &self->client_needs_restart))
+      return -1;
+  }
+
+  /* The device only frees space once per period, so until it signals us
+   * the room left over from its last padding is all there is */
+  can_frames = g_atomic_int_get (&self->free_frames);
+  if (can_frames > 0)
+    return can_frames;
+
+  /* Unless we were reset, then the buffer may well be empty already */
+  can_frames = g_atomic_int_get (&self->primed) ? 0 :
+      gst_wasapi_sink_get_can_frames (self);
+  while (can_frames == 0) {
+    dwWaitResult = WaitForMultipleObjects (cancel ? 2 : 1, handles, FALSE,
+        INFINITE);
+    gst_wasapi_trace_wakeup (GST_ELEMENT (self), dwWaitResult);
+    if (dwWaitResult == WAIT_OBJECT_0 + 1)
+      return 0;
+    if (dwWaitResult != WAIT_OBJECT_0) {
+      GST_ERROR_OBJECT (self, "Error waiting for event handle: %x",
+          (guint) dwWaitResult);
+      return -1;
+    }
+    wakeup = g_get_monotonic_time ();
+    can_frames = gst_wasapi_sink_get_can_frames (self);
+  }
+
+  if (can_frames > 0) {
+    gst_wasapi_sink_update_stats (self, wakeup, can_frames);
+    g_atomic_int_set (&self->free_frames, can_frames);
+  }
+
+  return can_frames;
+}
+
+/* The frames before these were played by the IAudioClock position, so
+ * these start playing once the rest of those did */
+static void
+gst_wasapi_sink_publish_aec_ref (GstWasapiSink * self, const guint8 * data,
+    guint n_frames)
+{
+  UINT64 devpos, qpcpos;
+  guint64 played, written;
+  guint rate = self->mix_format->nSamplesPerSec;
+  HRESULT hr;
+
+  if (self->client_clock_freq == 0)
+    return;
+
+  hr = IAudioClock_GetPosition (self->client_clock, &devpos, &qpcpos);
+  if (FAILED (hr))
+    return;
+
+  played = gst_util_uint64_scale (devpos, rate, self->client_clock_freq);
+  /* Not started yet, the device position stands still until then */
+  if (g_atomic_int_get (&self->client_needs_restart))
+    qpcpos = gst_wasapi_util_get_qpc_position ();
+
+  g_mutex_lock (&self->position_lock);
+  written = self->frames_written;
+  g_mutex_unlock (&self->position_lock);
+
+  if (written > played)
+    qpcpos += gst_util_uint64_scale_int (written - played, 10000000, rate);
+
+  gst_wasapi_aec_ref_write (self->aec_ref, data, n_frames, qpcpos);
+}
+
+/* Compares the device position @devpos at @qpcpos with the pipeline clock
+ * for the resample slaving. The device stands still while stopped and
+ * starts over on resets, those steps are left out of the offset. */
+static void
+gst_wasapi_sink_measure_slave_offset (GstWasapiSink * self, guint64 devpos,
+    guint64 qpcpos)
+{
+  GstClock *clock;
+  GstClockTime now, time;
+  GstClockTimeDiff offset;
+  guint64 qpc_before, qpc_now;
+
+  GST_OBJECT_LOCK (self);
+  if ((clock = GST_ELEMENT_CLOCK (self)) != NULL)
+    gst_object_ref (clock);
+  GST_OBJECT_UNLOCK (self);
+
+  if (clock == NULL)
+    return;
+
+  qpc_before = gst_wasapi_util_get_qpc_position ();
+  now = gst_clock_get_time (clock);
+  qpc_now = gst_wasapi_util_get_qpc_position ();
+  gst_object_unref (clock);
+
+  /* Preempted meanwhile, a step that isn't there would be left out */
+  if (!GST_CLOCK_TIME_IS_VALID (now) || qpc_now - qpc_before > SLAVE_MAX_READ)
+    return;
+
+  /* The pipeline clock at the time of the position, QPC is in 100 ns */
+  if (qpc_now > qpcpos)
+    now -= MIN (now, (qpc_now - qpcpos) * 100);
+  time = gst_util_uint64_scale (devpos, GST_SECOND, self->client_clock_freq);
+  offset = GST_CLOCK_DIFF (now, time);
+
+  g_mutex_lock (&self->position_lock);
+  if (!self->slave_valid) {
+    self->slave_offset = 0;
+  } else if (ABS (offset - self->slave_last) > SLAVE_MAX_STEP) {
+    GST_DEBUG_OBJECT (self, "device position stepped by %" G_GINT64_FORMAT
+        " ns against the pipeline clock", offset - self->slave_last);
+    gst_wasapi_drift_reset (self->clock_drift);
+  } else {
+    self->slave_offset += offset - self->slave_last;
+  }
+  self->slave_last = offset;
+  self->slave_valid = TRUE;
+  g_mutex_unlock (&self->position_lock);
+
+  gst_wasapi_drift_push (self->clock_drift, devpos, now);
+}
+
+gboolean
+gst_wasapi_sink_render (GstWasapiSink * self, const guint8 * data,
+    guint n_frames)
+{
+  HRESULT hr;
+  BYTE *dst = NULL;
+  DWORD flags = 0;
+  guint len = n_frames * self->mix_format->nBlockAlign;
+  gboolean pulse = FALSE;
+  guint64 hold_start, now;
+
+  hr = IAudioRenderClient_GetBuffer (self->render_client, n_frames, &dst);
+  HR_FAILED_AND (hr, IAudioRenderClient::GetBuffer, goto glitch);
+  hold_start = gst_wasapi_util_get_qpc_position ();
+  gst_wasapi_trace_get_buffer (GST_ELEMENT (self), n_frames, 0, 0, 0);
+
+  if (self->concealment != NULL &&
+      g_atomic_int_compare_and_exchange (&self->conceal_flushed, TRUE, FALSE))
+    gst_wasapi_conceal_reset (self->concealment);
+
+  /* Silence is only a flag, nothing needs to be written for it */
+  if (self->mute && self->stream_volume == NULL) {
+    flags = AUDCLNT_BUFFERFLAGS_SILENT;
+  } else if (g_atomic_int_get (&self->emit_need_frames)) {
+    gboolean filled = FALSE;
+
+    /* Straight into the device buffer, what upstream gave us is dropped */
+    g_signal_emit (self, gst_wasapi_sink_signals[SIGNAL_NEED_FRAMES], 0, dst,
+        n_frames, &filled);
+    if (!filled)
+      flags = AUDCLNT_BUFFERFLAGS_SILENT;
+    data = NULL;
+  } else if (data == NULL) {
+    /* Nothing to play here, conceal that if we may */
+    if (self->concealment == NULL ||
+        !gst_wasapi_conceal_fill (self->concealment, dst, n_frames))
+      flags = AUDCLNT_BUFFERFLAGS_SILENT;
+  } else if (self->render_convert != NULL) {
+    gint channels = self->mix_format->nChannels;
+
+    gst_wasapi_convert_process (self->render_convert, data, dst, n_frames);
+    if (self->reorder)
+      gst_wasapi_util_reorder (dst, dst, n_frames, channels,
+          self->mix_format->nBlockAlign / channels, self->reorder_map);
+  } else if (self->reorder) {
+    gint channels = self->mix_format->nChannels;
+
+    gst_wasapi_util_reorder (dst, data, n_frames, channels,
+        self->mix_format->nBlockAlign / channels, self->reorder_map);
+  } else {
+    memcpy (dst, data, len);
+  }
+
+  if (data != NULL && flags == 0 && self->concealment != NULL)
+    gst_wasapi_conceal_real (self->concealment, dst, n_frames);
+
+  /* Delayed channels go on into silence, only muting stops them */
+  if (self->trim != NULL && !(self->mute && self->stream_volume == NULL)) {
+    if (g_atomic_int_compare_and_exchange (&self->trim_flushed, TRUE, FALSE))
+      gst_wasapi_trim_reset (self->trim);
+    if (g_atomic_int_compare_and_exchange (&self->trim_gains_changed, TRUE,
+            FALSE)) {
+      gfloat *gains = g_newa (gfloat, self->mix_format->nChannels);
+
+      gst_wasapi_sink_get_trim (self, NULL, gains,
+          self->mix_format->nChannels, 0);
+      gst_wasapi_trim_set_gains (self->trim, gains);
+    }
+    if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+      memset (dst, 0, len);
+      flags = 0;
+    }
+    gst_wasapi_trim_process (self->trim, dst, n_frames);
+  }
+
+  if (self->latency_probe != NULL) {
+    if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+      memset (dst, 0, len);
+      flags = 0;
+    }
+    pulse = gst_wasapi_latency_probe_insert (self->latency_probe, dst,
+        n_frames);
+  }
+
+  if (self->aec_ref != NULL)
+    gst_wasapi_sink_publish_aec_ref (self,
+        (flags & AUDCLNT_BUFFERFLAGS_SILENT) ? NULL : dst, n_frames);
+
+  hr = IAudioRenderClient_ReleaseBuffer (self->render_client, n_frames, flags);
+  HR_FAILED_AND (hr, IAudioRenderClient::ReleaseBuffer, goto glitch);
+  gst_wasapi_trace_release_buffer (GST_ELEMENT (self), n_frames);
+  now = gst_wasapi_util_get_qpc_position ();
+  /* QPC positions are in 100 ns */
+  gst_wasapi_histogram_add (&self->hold_histogram, (now - hold_start) / 10);
+
+  if (pulse)
+    gst_wasapi_latency_probe_sent (self->latency_probe, now);
+
+  g_atomic_int_set (&self->primed, TRUE);
+  {
+    guint queued = self->buffer_frame_count;
+
+    if (self->sharemode == AUDCLNT_SHAREMODE_SHARED) {
+      g_atomic_int_add (&self->free_frames, -(gint) n_frames);
+      queued -= MAX (g_atomic_int_get (&self->free_frames), 0);
+    }
+    self->dry_time = g_get_monotonic_time () +
+        gst_util_uint64_scale_int (queued, G_USEC_PER_SEC,
+        self->mix_format->nSamplesPerSec);
+  }
+
+  /* The samples are in, now it can play them */
+  if (!gst_wasapi_util_start_if_needed (GST_ELEMENT (self), self->client,
+          &self->client_needs_restart))
+    goto glitch;
+
+  g_mutex_lock (&self->position_lock);
+  self->frames_written += n_frames;
+  g_mutex_unlock (&self->position_lock);
+
+  if (self->drift != NULL) {
+    UINT64 devpos, qpcpos;
+
+    hr = IAudioClock_GetPosition (self->client_clock, &devpos, &qpcpos);
+    if (SUCCEEDED (hr)) {
+      gst_wasapi_drift_push (self->drift, devpos, qpcpos * 100);
+      if (self->clock_drift != NULL)
+        gst_wasapi_sink_measure_slave_offset (self, devpos, qpcpos);
+    }
+  }
+
   return TRUE;
-}
 
-/* Get the empty space in the buffer that we have to write to */
-static gint
-gst_wasapi_sink_get_can_frames (GstWasapiSink * self)
-{
-  HRESULT hr;
-  guint n_frames_padding;
+glitch:
+  gst_wasapi_stats_block_begin (self->device_stats)->glitches++;
+  gst_wasapi_stats_block_end (self->device_stats);
 
-  /* There is no padding in exclusive mode since there is no ringbuffer */
-  if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE) {
-    GST_DEBUG_OBJECT (self, "exclusive mode, can write: %i",
-        self->buffer_frame_count);
-    return self->buffer_frame_count;
-  }
+  return FALSE;
+}
 
-  /* Frames the card hasn't rendered yet */
-  hr = IAudioClient_GetCurrentPadding (self->client, &n_frames_padding);
-  HR_FAILED_RET (hr, IAudioClient::GetCurrentPadding, -1);
+/* Asks the application to rebuild the pipeline on the new default device,
+ * or after the session was disconnected, once, when we can't recover from
+ * that ourselves */
+static void
+gst_wasapi_sink_post_restart (GstWasapiSink * self)
+{
+  g_atomic_int_set (&self->default_changed, FALSE);
 
-  GST_DEBUG_OBJECT (self, "%i unread frames (padding)", n_frames_padding);
+  if (self->restart_posted)
+    return;
 
-  /* We can write out these many frames */
-  return self->buffer_frame_count - n_frames_padding;
+  GST_INFO_OBJECT (self, "can't recover the stream, asking for a restart");
+  gst_wasapi_sink_notify (self, SINK_NOTIFY_RESTART, 0, 0);
+  self->restart_posted = TRUE;
 }
 
+/* Reopens the stream on the new default device from the ringbuffer thread,
+ * in the format we are already running in, or with @reopen on the device we
+ * have, after its session was disconnected or device was set. Shared mode streams go through
+ * the engine, which converts if the new device has another mix format, so
+ * the caps never change. What the old device still had queued is lost, the
+ * new one plays that much silence first so the clock stays continuous.
+ *
+ * Returns FALSE if the stream can't be reopened like that. */
 static gboolean
-gst_wasapi_sink_prepare (GstAudioSink * asink, GstAudioRingBufferSpec * spec)
+gst_wasapi_sink_switch_device (GstWasapiSink * self, gboolean reopen)
 {
-  GstWasapiSink *self = GST_WASAPI_SINK (asink);
+  GstAudioRingBufferSpec *spec =
+      &GST_AUDIO_BASE_SINK (self)->ringbuffer->spec;
+  IMMDevice *device = NULL;
+  IAudioClient *client = NULL;
+  IAudioClock *client_clock = NULL;
+  IAudioRenderClient *render_client = NULL;
+  IAudioStreamVolume *stream_volume = NULL;
+  guint devicep_frames, buffer_frames, queued, silence_frames;
+  guint64 freq;
+  BYTE *dst = NULL;
+  gint64 start = g_get_monotonic_time ();
+  gchar *device_id = NULL;
   gboolean res = FALSE;
-  REFERENCE_TIME latency_rt;
-  guint bpf, rate, devicep_frames;
   HRESULT hr;
 
-  CoInitialize (NULL);
+  if ((!reopen && (!self->follow_default || self->device_strid != NULL)) ||
+      self->sharemode != AUDCLNT_SHAREMODE_SHARED ||
+      self->shared_clock != NULL || self->mixer_input != NULL ||
+      spec->type != GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW)
+    return FALSE;
 
-  if (gst_wasapi_sink_can_audioclient3 (self)) {
-    if (!gst_wasapi_util_initialize_audioclient3 (GST_ELEMENT (self), spec,
-            (IAudioClient3 *) self->client, self->mix_format, self->low_latency,
-            FALSE, &devicep_frames))
-      goto beach;
+  if (reopen) {
+    GST_INFO_OBJECT (self, "reopening the stream on %s",
+        self->device_strid ? "the selected device" : "the default device");
   } else {
-    if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
-            self->client, self->mix_format, self->sharemode, self->low_latency,
-            FALSE, &devicep_frames))
-      goto beach;
+    g_atomic_int_set (&self->default_changed, FALSE);
+    GST_INFO_OBJECT (self, "switching to the new default device");
   }
 
-  bpf = GST_AUDIO_INFO_BPF (&spec->info);
-  rate = GST_AUDIO_INFO_RATE (&spec->info);
-
-  /* Total size of the allocated buffer that we will write to */
-  hr = IAudioClient_GetBufferSize (self->client, &self->buffer_frame_count);
-  HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
-
-  GST_INFO_OBJECT (self, "buffer size is %i frames, device period is %i "
-      "frames, bpf is %i bytes, rate is %i Hz", self->buffer_frame_count,
-      devicep_frames, bpf, rate);
-
-  /* Actual latency-time/buffer-time will be different now */
-  spec->segsize = devicep_frames * bpf;
+  if (!gst_wasapi_sink_get_position_delay (self, &queued))
+    queued = 0;
+  IAudioClient_Stop (self->client);
 
-  /* We need a minimum of 2 segments to ensure glitch-free playback */
-  spec->segtotal = MAX (self->buffer_frame_count * bpf / spec->segsize, 2);
+  if (!(self->routed && gst_wasapi_util_get_routed_client (GST_ELEMENT (self),
+              eRender, self->role, &device, &client)) &&
+      !gst_wasapi_util_get_device_client (GST_ELEMENT (self), eRender,
+          self->role, reopen ? self->device_strid : NULL, &device, &client))
+    goto beach;
+  device_id = gst_wasapi_util_get_device_id (device);
 
-  GST_INFO_OBJECT (self, "segsize is %i, segtotal is %i", spec->segsize,
-      spec->segtotal);
+  gst_wasapi_sink_set_client_properties (self, client);
 
-  /* Get latency for logging */
-  hr = IAudioClient_GetStreamLatency (self->client, &latency_rt);
-  HR_FAILED_GOTO (hr, IAudioClient::GetStreamLatency, beach);
+  if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
+          device, &client, self->mix_format, self->sharemode, self->low_latency,
+          FALSE, TRUE, FALSE, &devicep_frames))
+    goto beach;
 
-  GST_INFO_OBJECT (self, "wasapi stream latency: %" G_GINT64_FORMAT " (%"
-      G_GINT64_FORMAT "ms)", latency_rt, latency_rt / 10000);
+  hr = IAudioClient_GetBufferSize (client, &buffer_frames);
+  HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
 
-  /* Set the event handler which will trigger writes */
-  hr = IAudioClient_SetEventHandle (self->client, self->event_handle);
+  hr = IAudioClient_SetEventHandle (client, self->event_handle);
   HR_FAILED_GOTO (hr, IAudioClient::SetEventHandle, beach);
 
-  /* Get render sink client and start it up */
-  if (!gst_wasapi_util_get_render_client (GST_ELEMENT (self), self->client,
-          &self->render_client)) {
+  if (!gst_wasapi_util_get_clock (GST_ELEMENT (self), client, &client_clock))
     goto beach;
-  }
-
-  GST_INFO_OBJECT (self, "got render client");
-
-  /* To avoid start-up glitches, before starting the streaming, we fill the
-   * buffer with silence as recommended by the documentation:
-   * https://msdn.microsoft.com/en-us/library/windows/desktop/dd370879%28v=vs.85%29.aspx */
-  {
-    gint n_frames, len;
-    gint16 *dst = NULL;
 
-    n_frames = gst_wasapi_sink_get_can_frames (self);
-    if (n_frames < 1) {
-      GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
-          ("should have more than %i frames to write", n_frames));
-      goto beach;
-    }
+  hr = IAudioClock_GetFrequency (client_clock, &freq);
+  HR_FAILED_GOTO (hr, IAudioClock::GetFrequency, beach);
 
-    len = n_frames * self->mix_format->nBlockAlign;
+  if (!gst_wasapi_util_get_render_client (GST_ELEMENT (self), client,
+          &render_client))
+    goto beach;
 
-    hr = IAudioRenderClient_GetBuffer (self->render_client, n_frames,
-        (BYTE **) & dst);
+  /* Started by render() with the next samples */
+  silence_frames = MIN (queued, buffer_frames);
+  if (silence_frames > 0) {
+    hr = IAudioRenderClient_GetBuffer (render_client, silence_frames, &dst);
     HR_FAILED_GOTO (hr, IAudioRenderClient::GetBuffer, beach);
 
-    GST_DEBUG_OBJECT (self, "pre-wrote %i bytes of silence", len);
-
-    hr = IAudioRenderClient_ReleaseBuffer (self->render_client, n_frames,
+    hr = IAudioRenderClient_ReleaseBuffer (render_client, silence_frames,
         AUDCLNT_BUFFERFLAGS_SILENT);
     HR_FAILED_GOTO (hr, IAudioRenderClient::ReleaseBuffer, beach);
   }
 
-  hr = IAudioClient_Start (self->client);
-  HR_FAILED_GOTO (hr, IAudioClient::Start, beach);
+  gst_wasapi_util_get_stream_volume (GST_ELEMENT (self), client,
+      &stream_volume);
+
+  /* The old ones are released below */
+  GST_OBJECT_LOCK (self);
+  {
+    IMMDevice *old_device = self->device;
+    IAudioClient *old_client = self->client;
+    IAudioClock *old_clock = self->client_clock;
+    IAudioRenderClient *old_render_client = self->render_client;
+    IAudioStreamVolume *old_stream_volume = self->stream_volume;
+    gchar *old_id = self->device_id;
+
+    self->device_id = device_id;
+    device_id = old_id;
+    self->device = device;
+    self->client = client;
+    self->client_clock = client_clock;
+    self->render_client = render_client;
+    self->stream_volume = stream_volume;
+    device = old_device;
+    client = old_client;
+    client_clock = old_clock;
+    render_client = old_render_client;
+    stream_volume = old_stream_volume;
+  }
+  gst_wasapi_sink_apply_volume (self);
+
+  self->client_clock_freq = freq;
+  g_clear_pointer (&self->drift, gst_wasapi_drift_free);
+  self->drift = gst_wasapi_drift_new ((gint) freq);
+  if (self->clock_drift != NULL) {
+    gst_wasapi_drift_free (self->clock_drift);
+    self->clock_drift = gst_wasapi_drift_new ((gint) freq);
+  }
+  GST_OBJECT_UNLOCK (self);
 
-  gst_audio_ring_buffer_set_channel_positions (GST_AUDIO_BASE_SINK
-      (self)->ringbuffer, self->positions);
+  self->buffer_frame_count = buffer_frames;
+  self->period_frames = devicep_frames;
+  self->warm_devicep_frames = devicep_frames;
+  g_atomic_int_set (&self->primed, silence_frames > 0);
+  g_atomic_int_set (&self->free_frames, 0);
+  self->dry_time = 0;
+  g_atomic_int_set (&self->client_needs_restart, TRUE);
+  g_atomic_int_set (&self->device_lost, FALSE);
+  g_atomic_int_set (&self->session_lost, FALSE);
+  g_clear_pointer (&self->session, gst_wasapi_session_unwatch);
+  self->session = gst_wasapi_session_watch (GST_ELEMENT (self), self->client,
+      gst_wasapi_sink_session_disconnected, self);
+
+  g_mutex_lock (&self->position_lock);
+  self->frames_written = silence_frames;
+  g_mutex_unlock (&self->position_lock);
+
+  /* The reference follows to the endpoint that plays it now */
+  if (self->aec_ref != NULL) {
+    gst_wasapi_sink_clear_aec_ref (self);
+    self->aec_ref = gst_wasapi_aec_ref_get (self->device_id);
+    if (!gst_wasapi_aec_ref_start (self->aec_ref, GST_ELEMENT (self),
+            self->mix_format))
+      g_clear_pointer (&self->aec_ref, gst_wasapi_aec_ref_unref);
+  }
 
-  /* Increase the thread priority to reduce glitches */
-  self->thread_priority_handle = gst_wasapi_util_set_thread_characteristics ();
+  GST_INFO_OBJECT (self, "switched device in %" G_GINT64_FORMAT " us, "
+      "replacing %u queued frames with silence",
+      g_get_monotonic_time () - start, silence_frames);
 
   res = TRUE;
 
 beach:
-  /* unprepare() is not called if prepare() fails, but we want it to be, so call
-   * it manually when needed */
   if (!res)
-    gst_wasapi_sink_unprepare (asink);
+    GST_WARNING_OBJECT (self, "can't switch to the new default device");
+
+  g_free (device_id);
+  if (stream_volume != NULL)
+    IUnknown_Release (stream_volume);
+  if (render_client != NULL)
+    IUnknown_Release (render_client);
+  if (client_clock != NULL)
+    IUnknown_Release (client_clock);
+  if (client != NULL)
+    IUnknown_Release (client);
+  if (device != NULL)
+    IUnknown_Release (device);
 
   return res;
 }
 
-static gboolean
-gst_wasapi_sink_unprepare (GstAudioSink * asink)
+/* Frames of silence that still have to go before the first samples so
+ * they play at thread_start_qpc, from the IAudioClock position like
+ * publish_aec_ref(). Zero or less once that time is reached. */
+static gint64
+gst_wasapi_sink_frames_before_start (GstWasapiSink * self)
 {
-  GstWasapiSink *self = GST_WASAPI_SINK (asink);
+  UINT64 devpos, qpcpos;
+  guint64 played, written;
+  guint rate = self->mix_format->nSamplesPerSec;
+  gint64 frames;
+  HRESULT hr;
 
-  CoUninitialize ();
+  if (self->client_clock_freq == 0)
+    return 0;
 
-  if (self->thread_priority_handle != NULL) {
-    gst_wasapi_util_revert_thread_characteristics
-        (self->thread_priority_handle);
-    self->thread_priority_handle = NULL;
-  }
+  hr = IAudioClock_GetPosition (self->client_clock, &devpos, &qpcpos);
+  HR_FAILED_RET (hr, IAudioClock::GetPosition, 0);
 
-  if (self->client != NULL) {
-    IAudioClient_Stop (self->client);
-  }
+  played = gst_util_uint64_scale (devpos, rate, self->client_clock_freq);
+  /* Not started yet, it starts playing once we wrote something */
+  if (g_atomic_int_get (&self->client_needs_restart))
+    qpcpos = gst_wasapi_util_get_qpc_position ();
 
-  if (self->render_client != NULL) {
-    IUnknown_Release (self->render_client);
-    self->render_client = NULL;
-  }
+  g_mutex_lock (&self->position_lock);
+  written = self->frames_written;
+  g_mutex_unlock (&self->position_lock);
 
-  CoUninitialize ();
+  /* What we write next plays after everything still queued */
+  if (self->thread_start_qpc > qpcpos)
+    frames = (gint64) gst_util_uint64_scale (self->thread_start_qpc - qpcpos,
+        rate, 10000000);
+  else
+    frames = -(gint64) gst_util_uint64_scale (qpcpos - self->thread_start_qpc,
+        rate, 10000000);
 
-  return TRUE;
+  return frames - (gint64) (written > played ? written - played : 0);
+}
+
+/* Done with the scheduled start, @late frames after the target */
+static void
+gst_wasapi_sink_started (GstWasapiSink * self, gint64 late)
+{
+  self->start_pending = FALSE;
+
+  if (late > 0)
+    GST_WARNING_OBJECT (self, "start-qpc was %" G_GINT64_FORMAT " frames ago, "
+        "starting late", late);
+  else
+    GST_INFO_OBJECT (self, "first samples play at start-qpc %"
+        G_GUINT64_FORMAT, self->thread_start_qpc);
 }
 
 static gint
-gst_wasapi_sink_write (GstAudioSink * asink, gpointer data, guint length)
+gst_wasapi_sink_write_segment (GstAudioSink * asink, gpointer data,
+    guint length)
 {
   GstWasapiSink *self = GST_WASAPI_SINK (asink);
-  HRESULT hr;
-  gint16 *dst = NULL;
   DWORD dwWaitResult;
   guint can_frames, have_frames, n_frames, write_len, written_len = 0;
+  gint64 wakeup = 0;
+
+  /* Increase the priority of the ringbuffer thread to reduce glitches */
+  if (self->thread_task != NULL)
+    gst_wasapi_util_ensure_thread_characteristics (self->thread_task,
+        self->thread_priority);
+  /* And keep it on the same cores */
+  gst_wasapi_util_ensure_thread_affinity (self->thread_group,
+      self->thread_mask);
+  gst_wasapi_util_ensure_thread_flags (self->thread_flags);
+
+  if (self->mixer_input != NULL)
+    return gst_wasapi_mixer_input_write (self->mixer_input, data, length);
+
+  /* Playing again after keep-running kept the device busy */
+  gst_wasapi_sink_stop_keepalive (self);
+
+  /* Reset since the last write, the rest of the segment is flushed. Returning
+   * less would have the ringbuffer thread write it to the stopped client. */
+  if (!gst_wasapi_cancel_prepare (&self->cancel))
+    return length;
+
+  /* Before GetBuffer runs into the dead client */
+  if (g_atomic_int_get (&self->session_lost) &&
+      !g_atomic_int_get (&self->device_lost) &&
+      !gst_wasapi_sink_switch_device (self, TRUE)) {
+    gst_wasapi_sink_post_restart (self);
+    if (WaitForSingleObject (self->cancel.handle,
+            (DWORD) gst_util_uint64_scale_int (self->period_frames, 1000,
+                self->mix_format->nSamplesPerSec)) == WAIT_OBJECT_0)
+      return length;
+    return 0;
+  }
 
-  GST_OBJECT_LOCK (self);
-  if (self->client_needs_restart) {
-    hr = IAudioClient_Start (self->client);
-    HR_FAILED_AND (hr, IAudioClient::Start, GST_OBJECT_UNLOCK (self); goto beach);
-    self->client_needs_restart = FALSE;
+  /* Moved there at the start of a segment, without a restart */
+  if (g_atomic_int_compare_and_exchange (&self->device_changed, TRUE, FALSE)
+      && !gst_wasapi_sink_switch_device (self, TRUE)) {
+    GST_WARNING_OBJECT (self, "can't switch devices while running, the new "
+        "device is used from the next prepare");
+    /* It may have stopped the one we keep */
+    g_atomic_int_set (&self->client_needs_restart, TRUE);
   }
-  GST_OBJECT_UNLOCK (self);
+
+  if ((!self->device_strid && g_atomic_int_get (&self->default_changed)) ||
+      g_atomic_int_get (&self->device_lost)) {
+    if (!gst_wasapi_sink_switch_device (self, FALSE) &&
+        (!self->follow_default || self->device_strid))
+      gst_wasapi_sink_post_restart (self);
+
+    /* Nothing to write to, don't spin until we're restarted or the default
+     * device changes */
+    if (g_atomic_int_get (&self->device_lost)) {
+      if (WaitForSingleObject (self->cancel.handle,
+              (DWORD) gst_util_uint64_scale_int (self->period_frames, 1000,
+                  self->mix_format->nSamplesPerSec)) == WAIT_OBJECT_0)
+        return length;
+      return 0;
+    }
+  }
+
   /* We have N frames to be written out */
-  have_frames = length / (self->mix_format->nBlockAlign);
+  have_frames = length / self->write_bpf;
 
   if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE) {
+    guint period_len = self->buffer_frame_count * self->mix_format->nBlockAlign;
+    HANDLE handles[2] = { self->event_handle, self->cancel.handle };
+    const guint8 *period = NULL;
+    gint64 silence = 0;
+
+    if (G_UNLIKELY (self->start_pending) && self->period_fill == 0)
+      silence = gst_wasapi_sink_frames_before_start (self);
+
+    if (silence >= (gint64) self->buffer_frame_count) {
+      /* A silent period, the samples wait for the next one */
+      write_len = 0;
+    } else {
+      /* The rest of the silence goes in front of them in this period */
+      if (silence > 0) {
+        self->period_fill = (guint) silence * self->mix_format->nBlockAlign;
+        memset (self->period_data, 0, self->period_fill);
+      }
+      if (G_UNLIKELY (self->start_pending))
+        gst_wasapi_sink_started (self, -silence);
+
+      /* In exclusive mode we need to fill the whole buffer in one go or
+       * GetBuffer will error out, so collect a full period first. Segments
+       * that line up with it are rendered without the copy. */
+      if (self->period_fill == 0 && length >= period_len) {
+        period = data;
+        write_len = period_len;
+      } else {
+        write_len = MIN (length, period_len - self->period_fill);
+        memcpy (self->period_data + self->period_fill, data, write_len);
+        self->period_fill += write_len;
+        if (self->period_fill < period_len)
+          return write_len;
+        period = self->period_data;
+      }
+    }
+
+    if (!gst_wasapi_util_start_if_needed (GST_ELEMENT (self), self->client,
+            &self->client_needs_restart))
+      goto beach;
+
     /* In exlusive mode we have to wait always */
 
-    dwWaitResult = WaitForSingleObject (self->event_handle, INFINITE);
+    if (self->spin.timer != NULL)
+      dwWaitResult = gst_wasapi_spin_wait (&self->spin, handles, 2,
+          (GstWasapiSpinReadyFunc) gst_wasapi_sink_period_ready, self,
+          INFINITE);
+    else
+      dwWaitResult = WaitForMultipleObjects (2, handles, FALSE, INFINITE);
+    gst_wasapi_trace_wakeup (GST_ELEMENT (self), dwWaitResult);
+    if (dwWaitResult == WAIT_OBJECT_0 + 1) {
+      /* Reset, drop the period, reset() already forgot what we collected */
+      GST_DEBUG_OBJECT (self, "cancelled, dropping %u bytes", length);
+      return length;
+    }
     if (dwWaitResult != WAIT_OBJECT_0) {
       GST_ERROR_OBJECT (self, "Error waiting for event handle: %x",
           (guint) dwWaitResult);
+      /* Try again with the same period next time */
+      if (period == self->period_data)
+        self->period_fill -= write_len;
       goto beach;
     }
+    wakeup = g_get_monotonic_time ();
 
-    can_frames = gst_wasapi_sink_get_can_frames (self);
-    /* In exclusive mode we need to fill the whole buffer in one go or
-     * GetBuffer will error out */
-    if (can_frames != have_frames) {
-      GST_ERROR_OBJECT (self,
-        "Need at %i frames to write for exclusive mode, but got %i",
-        can_frames, have_frames);
-      written_len = -1;
-      goto beach;
-    }
+    gst_wasapi_sink_update_stats (self, wakeup, self->buffer_frame_count);
+
+    GST_LOG_OBJECT (self, "rendering a period of %i frames, %i bytes of it "
+        "from this write", self->buffer_frame_count, write_len);
+
+    self->period_fill = 0;
+    if (gst_wasapi_sink_render (self, period, self->buffer_frame_count))
+      written_len = write_len;
+
+    goto beach;
   } else {
     /* In shared mode we can write parts of the buffer, so only wait
      * in case we can't write anything */
-    can_frames = gst_wasapi_sink_get_can_frames (self);
+    gint ret = gst_wasapi_sink_wait_for_room (self, self->cancel.handle);
 
-    if (can_frames == 0) {
-      dwWaitResult = WaitForSingleObject (self->event_handle, INFINITE);
-      if (dwWaitResult != WAIT_OBJECT_0) {
-        GST_ERROR_OBJECT (self, "Error waiting for event handle: %x",
-            (guint) dwWaitResult);
-        goto beach;
+    /* Reset while waiting */
+    if (ret == 0) {
+      GST_DEBUG_OBJECT (self, "cancelled, dropping %u bytes", length);
+      return length;
+    }
+    /* The default device may be gone before we heard that it changed */
+    if (ret < 0 && !self->device_strid && self->follow_default)
+      g_atomic_int_set (&self->default_changed, TRUE);
+    if (ret < 0)
+      goto beach;
+    can_frames = ret;
+
+    /* Silence until the scheduled start, the samples are written once
+     * it's that close */
+    if (G_UNLIKELY (self->start_pending)) {
+      gint64 silence = gst_wasapi_sink_frames_before_start (self);
+
+      if (silence > 0) {
+        gst_wasapi_sink_render (self, NULL, (guint) MIN (silence,
+                (gint64) can_frames));
+        return 0;
       }
-      can_frames = gst_wasapi_sink_get_can_frames (self);
+      gst_wasapi_sink_started (self, -silence);
     }
   }
 
   /* We will write out these many frames, and this much length */
   n_frames = MIN (can_frames, have_frames);
-  write_len = n_frames * self->mix_format->nBlockAlign;
+  write_len = n_frames * self->write_bpf;
 
   GST_DEBUG_OBJECT (self, "total: %i, have_frames: %i (%i bytes), "
       "can_frames: %i, will write: %i (%i bytes)", self->buffer_frame_count,
       have_frames, length, can_frames, n_frames, write_len);
 
-  hr = IAudioRenderClient_GetBuffer (self->render_client, n_frames,
-      (BYTE **) & dst);
-  HR_FAILED_AND (hr, IAudioRenderClient::GetBuffer, goto beach);
+  if (gst_wasapi_sink_render (self, data, n_frames))
+    written_len = write_len;
 
-  memcpy (dst, data, write_len);
+beach:
 
-  hr = IAudioRenderClient_ReleaseBuffer (self->render_client, n_frames,
-      self->mute ? AUDCLNT_BUFFERFLAGS_SILENT : 0);
-  HR_FAILED_AND (hr, IAudioRenderClient::ReleaseBuffer, goto beach);
+  return written_len;
+}
 
-  written_len = write_len;
+static gint
+gst_wasapi_sink_write (GstAudioSink * asink, gpointer data, guint length)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (asink);
+  guint64 cycles = gst_wasapi_util_get_thread_cycles ();
+  GstAudioInfo *info = &GST_AUDIO_BASE_SINK (self)->ringbuffer->spec.info;
+  GstWasapiStats *stats;
+  gint ret;
 
-beach:
+  ret = gst_wasapi_sink_write_segment (asink, data, length);
 
-  return written_len;
+  stats = gst_wasapi_stats_block_begin (self->device_stats);
+  stats->device_cycles += gst_wasapi_util_get_thread_cycles () - cycles;
+  if (ret > 0)
+    stats->device_audio += gst_util_uint64_scale_int (ret /
+        GST_AUDIO_INFO_BPF (info), GST_SECOND, GST_AUDIO_INFO_RATE (info));
+  gst_wasapi_stats_block_end (self->device_stats);
+
+  return ret;
+}
+
+/* The padding only covers the endpoint buffer, and is always 0 in exclusive
+ * mode. The IAudioClock position is what actually left the speakers, so the
+ * difference with what we wrote also includes the hardware latency. */
+static gboolean
+gst_wasapi_sink_get_position_delay (GstWasapiSink * self, guint * ret_delay)
+{
+  guint64 played, written;
+
+  if (!gst_wasapi_sink_get_played (self, &played))
+    return FALSE;
+
+  g_mutex_lock (&self->position_lock);
+  written = self->frames_written;
+  g_mutex_unlock (&self->position_lock);
+
+  *ret_delay = written > played ? (guint) MIN (written - played, G_MAXUINT) : 0;
+
+  return TRUE;
+}
+
+/* The frames that left the speakers since the last reset, from the
+ * IAudioClock position. Called with the object lock, like delay(). */
+static gboolean
+gst_wasapi_sink_get_played (GstWasapiSink * self, guint64 * ret_played)
+{
+  UINT64 devpos, qpcpos, now;
+  HRESULT hr;
+
+  if (self->client_clock == NULL || self->client_clock_freq == 0)
+    return FALSE;
+
+  hr = IAudioClock_GetPosition (self->client_clock, &devpos, &qpcpos);
+  if (FAILED (hr))
+    return FALSE;
+
+  /* Account for the time that passed since the position was sampled, but
+   * only while the device is actually running */
+  now = gst_wasapi_util_get_qpc_position ();
+  if (g_atomic_int_get (&self->primed) &&
+      !g_atomic_int_get (&self->client_needs_restart) && now > qpcpos)
+    devpos += gst_util_uint64_scale (now - qpcpos, self->client_clock_freq,
+        10000000);
+
+  *ret_played = gst_util_uint64_scale (devpos,
+      self->mix_format->nSamplesPerSec, self->client_clock_freq);
+
+  return TRUE;
+}
+
+/* The base class drains by the clock at EOS, which only knows roughly when
+ * the ringbuffer is played out. Waits on until the IAudioClock position
+ * reaches the last frame of upstream, sleeping for exactly what is left
+ * each time, so EOS is posted once that left the speakers. */
+static void
+gst_wasapi_sink_drain (GstWasapiSink * self)
+{
+  GstAudioBaseSink *base = GST_AUDIO_BASE_SINK (self);
+  guint64 target, played;
+  gint64 pending = 0, deadline = 0;
+  guint rate;
+
+  if (self->mixer_input != NULL || self->mix_format == NULL ||
+      base->ringbuffer == NULL ||
+      !gst_audio_ring_buffer_is_acquired (base->ringbuffer) ||
+      base->ringbuffer->spec.type != GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW)
+    return;
+
+  rate = self->mix_format->nSamplesPerSec;
+
+  /* The ringbuffer may still hold the last samples, or have written the
+   * silence after them already, a segment at most either way */
+  if (base->next_sample != (guint64) - 1)
+    pending = (gint64) base->next_sample -
+        (gint64) gst_audio_ring_buffer_samples_done (base->ringbuffer);
+
+  g_mutex_lock (&self->position_lock);
+  target = self->frames_written;
+  g_mutex_unlock (&self->position_lock);
+  if (pending >= 0)
+    target += pending;
+  else
+    target -= MIN (target, (guint64) - pending);
+
+  for (;;) {
+    gboolean known;
+    gint64 now = g_get_monotonic_time ();
+
+    GST_OBJECT_LOCK (self);
+    known = gst_wasapi_sink_get_played (self, &played);
+    GST_OBJECT_UNLOCK (self);
+    if (!known || played >= target)
+      break;
+
+    /* A reset or a device switch starts the position over, and a paused
+     * device doesn't play at all. Plus a period for the position updates. */
+    if (deadline == 0)
+      deadline = now + gst_util_uint64_scale_int (target - played +
+          self->period_frames, G_USEC_PER_SEC, rate);
+    else if (now > deadline)
+      break;
+
+    if (WaitForSingleObject (self->drain_cancel,
+            (DWORD) gst_util_uint64_scale_int_ceil (target - played, 1000,
+                rate)) == WAIT_OBJECT_0) {
+      GST_DEBUG_OBJECT (self, "drain interrupted");
+      return;
+    }
+  }
+
+  GST_DEBUG_OBJECT (self, "drained to frame %" G_GUINT64_FORMAT " of the "
+      "device", target);
+}
+
+static GstFlowReturn
+gst_wasapi_sink_wait_event (GstBaseSink * bsink, GstEvent * event)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (bsink);
+  GstFlowReturn ret;
+
+  ret = GST_BASE_SINK_CLASS (parent_class)->wait_event (bsink, event);
+
+  if (ret == GST_FLOW_OK && GST_EVENT_TYPE (event) == GST_EVENT_EOS &&
+      gst_base_sink_get_sync (bsink))
+    gst_wasapi_sink_drain (self);
+
+  return ret;
+}
+
+static gboolean
+gst_wasapi_sink_unlock (GstBaseSink * bsink)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (bsink);
+
+  SetEvent (self->drain_cancel);
+
+  if (GST_BASE_SINK_CLASS (parent_class)->unlock)
+    return GST_BASE_SINK_CLASS (parent_class)->unlock (bsink);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_sink_unlock_stop (GstBaseSink * bsink)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (bsink);
+
+  ResetEvent (self->drain_cancel);
+
+  if (GST_BASE_SINK_CLASS (parent_class)->unlock_stop)
+    return GST_BASE_SINK_CLASS (parent_class)->unlock_stop (bsink);
+
+  return TRUE;
 }
 
 static guint
@@ -689,12 +3759,78 @@ gst_wasapi_sink_delay (GstAudioSink * asink)
   guint delay = 0;
   HRESULT hr;
 
-  hr = IAudioClient_GetCurrentPadding (self->client, &delay);
-  HR_FAILED_RET (hr, IAudioClient::GetCurrentPadding, 0);
+  if (self->mixer_input != NULL)
+    return gst_wasapi_mixer_input_delay (self->mixer_input);
+
+  /* write() swaps the client when it follows the default device */
+  GST_OBJECT_LOCK (self);
+  if (!gst_wasapi_sink_get_position_delay (self, &delay) &&
+      self->client != NULL) {
+    hr = IAudioClient_GetCurrentPadding (self->client, &delay);
+    HR_FAILED_AND (hr, IAudioClient::GetCurrentPadding, delay = 0);
+  }
+  GST_OBJECT_UNLOCK (self);
 
   return delay;
 }
 
+/* Renders silence while we're paused or flushing with keep-running, until
+ * write() or the ringbuffer take over again */
+static gpointer
+gst_wasapi_sink_keepalive_thread_func (gpointer user_data)
+{
+  GstWasapiSink *self = user_data;
+  HANDLE handles[2] = { self->event_handle, self->keepalive_stop };
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+
+  while (TRUE) {
+    gint can_frames;
+
+    if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE) {
+      /* Whole periods, like write() */
+      if (WaitForMultipleObjects (2, handles, FALSE, INFINITE) !=
+          WAIT_OBJECT_0)
+        break;
+      can_frames = self->buffer_frame_count;
+    } else {
+      can_frames = gst_wasapi_sink_wait_for_room (self, self->keepalive_stop);
+      if (can_frames <= 0)
+        break;
+    }
+
+    if (!gst_wasapi_sink_render (self, NULL, can_frames))
+      break;
+  }
+
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static void
+gst_wasapi_sink_start_keepalive (GstWasapiSink * self)
+{
+  if (self->keepalive_thread != NULL)
+    return;
+
+  GST_DEBUG_OBJECT (self, "keeping the stream running");
+  ResetEvent (self->keepalive_stop);
+  self->keepalive_thread = g_thread_new ("wasapi-keepalive",
+      gst_wasapi_sink_keepalive_thread_func, self);
+}
+
+void
+gst_wasapi_sink_stop_keepalive (GstWasapiSink * self)
+{
+  if (G_LIKELY (self->keepalive_thread == NULL))
+    return;
+
+  SetEvent (self->keepalive_stop);
+  g_thread_join (self->keepalive_thread);
+  self->keepalive_thread = NULL;
+}
+
 static void
 gst_wasapi_sink_reset (GstAudioSink * asink)
 {
@@ -703,16 +3839,79 @@ gst_wasapi_sink_reset (GstAudioSink * asink)
 
   GST_INFO_OBJECT (self, "reset called");
 
+  if (self->mixer_input != NULL) {
+    gst_wasapi_mixer_input_reset (self->mixer_input);
+    return;
+  }
+
+  /* Before stopping, so a blocked write() doesn't wait for the client */
+  gst_wasapi_cancel_trigger (&self->cancel);
+
   if (!self->client)
     return;
 
-  GST_OBJECT_LOCK (self);
+  /* With keep-running the stream goes on with silence from the keepalive
+   * thread. The device position continues, only what we collected is
+   * flushed. */
+  if (self->keep_running && !g_atomic_int_get (&self->client_needs_restart)) {
+    self->period_fill = 0;
+    g_atomic_int_set (&self->resampler_needs_reset, TRUE);
+    g_atomic_int_set (&self->conceal_flushed, TRUE);
+    g_atomic_int_set (&self->trim_flushed, TRUE);
+    gst_wasapi_sink_start_keepalive (self);
+    return;
+  }
+
+  /* What is still queued in the device is dropped, it won't be played */
+  if (self->aec_ref != NULL)
+    gst_wasapi_aec_ref_flush (self->aec_ref,
+        gst_wasapi_util_get_qpc_position ());
+
   hr = IAudioClient_Stop (self->client);
   HR_FAILED_AND (hr, IAudioClient::Stop,);
 
   hr = IAudioClient_Reset (self->client);
   HR_FAILED_AND (hr, IAudioClient::Reset,);
 
-  self->client_needs_restart = TRUE;
-  GST_OBJECT_UNLOCK (self);
+  if (self->shared_clock != NULL && self->client_clock != NULL)
+    gst_wasapi_device_clock_client_reset (self->shared_clock,
+        self->client_clock);
+  gst_wasapi_spin_reset (&self->spin);
+  g_atomic_int_set (&self->primed, FALSE);
+  g_atomic_int_set (&self->client_needs_restart, TRUE);
+
+  /* A partial period belongs to what was flushed */
+  self->period_fill = 0;
+  g_atomic_int_set (&self->resampler_needs_reset, TRUE);
+  g_atomic_int_set (&self->conceal_flushed, TRUE);
+  g_atomic_int_set (&self->trim_flushed, TRUE);
+  g_atomic_int_set (&self->free_frames, 0);
+  self->dry_time = 0;
+
+  /* IAudioClient::Reset() also rewinds the device position */
+  g_mutex_lock (&self->position_lock);
+  self->frames_written = 0;
+  g_mutex_unlock (&self->position_lock);
+}
+
+/* Like the GstAudioBaseSink clock, from the samples written so far minus
+ * what is still queued in the device. Replaced by the shared clock of the
+ * endpoint while the device is open, with the device-clock property. */
+static GstClockTime
+gst_wasapi_sink_get_time (GstClock * clock, gpointer user_data)
+{
+  GstWasapiSink *self = GST_WASAPI_SINK (user_data);
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SINK (self)->ringbuffer;
+  guint64 samples;
+  guint delay;
+  gint rate;
+
+  if (ringbuffer == NULL || (rate = ringbuffer->spec.info.rate) == 0)
+    return GST_CLOCK_TIME_NONE;
+
+  samples = gst_audio_ring_buffer_samples_done (ringbuffer);
+  delay = gst_audio_ring_buffer_delay (ringbuffer);
+  samples = samples > delay ? samples - delay : 0;
+
+  return gst_util_uint64_scale_int (samples, GST_SECOND, rate);
 }
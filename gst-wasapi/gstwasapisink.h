@@ -21,6 +21,20 @@
 #define __GST_WASAPI_SINK_H__
 
 #include "gstwasapiutil.h"
+#include "gstwasapibusqueue.h"
+#include "gstwasapimixer.h"
+#include "gstwasapidrift.h"
+#include "gstwasapiresampler.h"
+#include "gstwasapistats.h"
+#include "gstwasapideviceclock.h"
+#include "gstwasapilatency.h"
+#include "gstwasapiaecref.h"
+#include "gstwasapiconceal.h"
+#include "gstwasapitrim.h"
+#include "gstwasapispin.h"
+#include "gstwasapiconvert.h"
+#include "gstwasapisession.h"
+#include "gstwasapishm.h"
 
 G_BEGIN_DECLS
 #define GST_TYPE_WASAPI_SINK \
@@ -42,30 +56,240 @@ struct _GstWasapiSink
 
   IMMDevice *device;
   IAudioClient *client;
+  /* With async_open, open() leaves the device to @open_thread, which owns
+   * everything open() sets up until joined under @open_lock */
+  gboolean async_open;
+  /* render() asks need-frames instead, read there atomically */
+  gint emit_need_frames;
+  GThread *open_thread;
+  GMutex open_lock;
   IAudioRenderClient *render_client;
+  /* Applies volume and mute in shared mode, protected by the object lock */
+  IAudioStreamVolume *stream_volume;
+  /* With shared_client, our input on the stream of the endpoint instead of
+   * client and render_client. Set and cleared with the object lock. */
+  GstWasapiMixerInput *mixer_input;
   HANDLE event_handle;
-  HANDLE thread_priority_handle;
+  /* Triggered by reset(), so write() returns instead of waiting for the
+   * stopped client */
+  GstWasapiCancel cancel;
   /* Client was reset, so it needs to be started again */
-  gboolean client_needs_restart;
+  gint client_needs_restart;
+  /* Set once we wrote something after a reset, an empty device buffer only
+   * counts as an underrun after that. Only accessed atomically. */
+  gint primed;
+  /* Room left in the shared mode device buffer since we last asked for the
+   * padding, after an event. Only accessed atomically. */
+  gint free_frames;
+  /* Monotonic time at which the device will have played all we gave it,
+   * 0 if unknown. Only used by the render thread. */
+  gint64 dry_time;
+
+  /* Rate of the device against the system clock, from IAudioClock */
+  IAudioClock *client_clock;
+  guint64 client_clock_freq;
+  GstWasapiDrift *drift;
+  /* Frames handed to the device since the last reset, delay() compares them
+   * with the IAudioClock position. Protected by position_lock. */
+  GMutex position_lock;
+  guint64 frames_written;
+
+  /* With slave-method=custom, payload() resamples to follow the pipeline
+   * clock while slaved, see gstwasapiresampler.h. render() measures how far
+   * the IAudioClock position moved away from the pipeline clock in
+   * @slave_offset, with steps like resets and pauses taken out, and feeds
+   * @clock_drift for the rate hint. Protected by position_lock. */
+  GstWasapiResampler *resampler;
+  GstWasapiDrift *clock_drift;
+  gboolean slave_valid;
+  GstClockTimeDiff slave_last;
+  GstClockTimeDiff slave_offset;
+  /* Offset at the start of the timeline of @resampler. Only used by the
+   * streaming thread, reset() sets @resampler_needs_reset. */
+  gboolean slave_base_valid;
+  GstClockTimeDiff slave_base;
+  gint resampler_needs_reset;
+
+  /* With use_device_clock we provide the clock shared by all elements on
+   * the endpoint while open, see gstwasapideviceclock.h */
+  gboolean use_device_clock;
+  GstClock *shared_clock;
+  GstClock *own_clock;
+
+  /* Engine and driver latency reported by GetStreamLatency, added to the
+   * LATENCY query answer. NONE while not prepared. */
+  GstClockTime stream_latency;
+
+  /* Back the stats property, see gstwasapistats.h. @device_stats is
+   * updated by whichever thread writes the device: write(), or the thread
+   * or commit() of a GstWasapiRingBuffer. @streaming_stats by the commit()
+   * of a GstWasapiRingBuffer. */
+  GstWasapiStatsBlock *device_stats;
+  GstWasapiStatsBlock *streaming_stats;
+  /* Time between wakeups and how long each packet was held between
+   * GetBuffer() and ReleaseBuffer(), lock-free for the stats property */
+  GstWasapiHistogram wakeup_histogram;
+  GstWasapiHistogram hold_histogram;
+  /* Posts wasapi-stats messages with stats-interval while prepared */
+  GstClockTime stats_interval;
+  GstWasapiStatsReporter *stats_reporter;
+  /* Extra ringbuffer segments with adaptive-buffer, only used by the
+   * thread that writes the device */
+  GstWasapiRingSizer ring_sizer;
+  /* Behind the startup-times property */
+  GstWasapiStartupTimes startup_times;
 
   /* Actual size of the allocated buffer */
   guint buffer_frame_count;
+  /* Device period, how much we write before starting without prefill */
+  guint period_frames;
+  /* Exclusive mode takes exactly buffer_frame_count frames per event, the
+   * writes of the ringbuffer are collected here until there are that many.
+   * Only used by the ringbuffer thread and reset(). */
+  guint8 *period_data;
+  guint period_fill;
   /* The mix format that wasapi prefers in shared mode */
+  WAVEFORMATEX *device_format;
+  /* The format the client is initialized with, the device format unless
+   * prepared with autoconvert or passthrough caps */
   WAVEFORMATEX *mix_format;
   /* The probed caps that we can accept */
   GstCaps *cached_caps;
-  /* The channel positions in the data to be written to the device we
-   * will pass this to GstAudioRingbuffer so it can to it translate
-   * from the native GStreamer channel layout. */
+  /* The channel positions in the data to be written to the device */
   GstAudioChannelPosition *positions;
+  /* Set if those are not in the GStreamer channel order. render() then
+   * reorders the samples while it copies them to the device, instead of
+   * GstAudioRingbuffer doing it in a separate pass. */
+  gboolean reorder;
+  gint reorder_map[64];
+  /* Converts integer caps to the float mix format in render(), before the
+   * reorder. write() then takes frames of @write_bpf bytes. */
+  GstWasapiConvert *render_convert;
+  guint write_bpf;
+
+  /* Subscribed to the endpoint notifications while open. They set
+   * @device_lost when the open device, @device_id, goes away and
+   * @default_changed when the default device changes. ATOMIC. With
+   * @follow_default write() then switches to the new default device,
+   * otherwise a wasapi_restart message is posted once. @device_id is
+   * protected by the object lock. */
+  guint notify_id;
+  gchar *device_id;
+  gint device_lost;
+  gint default_changed;
+  gboolean restart_posted;
+  /* Posts the messages of the thread that writes the device while
+   * prepared */
+  GstWasapiBusQueue *bus_queue;
+  /* Watches the session of @client while prepared. A disconnect sets
+   * @session_lost, ATOMIC, and write() then reopens the stream on the same
+   * device right away. */
+  GstWasapiSession *session;
+  gint session_lost;
+  /* Set with device while open, write() then moves the stream there the
+   * same way. ATOMIC. */
+  gint device_changed;
 
   /* properties */
   gint role;
   gint sharemode;
   gboolean mute;
+  gdouble volume;
   gboolean low_latency;
   gboolean try_audioclient3;
+  gboolean zero_copy;
+  gboolean prefill_silence;
+  /* With prewarm, unprepare() keeps the initialized client with its render
+   * client and clock, for the next prepare() if the caps and buffer sizes
+   * are still @warm_caps, @warm_latency_time and @warm_buffer_time.
+   * @warm_caps is NULL while nothing is kept. */
+  gboolean prewarm;
+  gboolean client_initialized;
+  GstCaps *warm_caps;
+  guint64 warm_latency_time;
+  guint64 warm_buffer_time;
+  guint warm_devicep_frames;
+  gboolean autoconvert;
+  gboolean match_format;
+  gboolean offload;
+  gboolean raw;
+  GstWasapiStreamCategory category;
+  gboolean adaptive_buffer;
+  gboolean auto_tune;
+  gboolean shared_client;
+  /* device-channels, and the endpoint channels it picked with the caps,
+   * from 0, all of them if n_selected is 0 */
+  gchar *device_channels;
+  gint selected[64];
+  gint n_selected;
+  gboolean follow_default;
+  /* With stream_routing, @client may be one of the virtual default device,
+   * @routed then, which the engine moves on its own */
+  gboolean stream_routing;
+  gboolean routed;
+  /* MMCSS task, priority, processors and power settings of the ringbuffer
+   * thread. The thread_* fields are the copies taken in prepare(). */
+  gchar *mmcss_task;
+  GstWasapiMmcssPriority mmcss_priority;
+  guint64 thread_affinity;
+  guint processor_group;
+  gboolean power_throttling;
+  gboolean performance_cores;
+  gchar *thread_task;
+  GstWasapiMmcssPriority thread_priority;
+  guint64 thread_mask;
+  guint thread_group;
+  GstWasapiThreadFlags thread_flags;
+  /* With start_qpc, write() puts silence before the first samples until
+   * @start_pending is cleared. Copied in prepare(), like the above. */
+  guint64 start_qpc;
+  guint64 thread_start_qpc;
+  gboolean start_pending;
+  /* render() inserts the pulses while prepared */
+  gboolean probe_latency;
+  GstWasapiLatencyProbe *latency_probe;
+  /* With aec_reference, render() publishes to it on @device_id while
+   * prepared, see gstwasapiaecref.h */
+  gboolean aec_reference;
+  GstWasapiAecRef *aec_ref;
+  /* With conceal, render() fills gaps from it while prepared. reset() sets
+   * @conceal_flushed so render() makes it forget, lock-free. */
+  gboolean conceal;
+  GstWasapiConceal *concealment;
+  gint conceal_flushed;
+  /* channel-delays and channel-gains, under the object lock. render()
+   * applies them through @trim while prepared, resets it when reset()
+   * set @trim_flushed and takes the gains again when set_property() set
+   * @trim_gains_changed. */
+  GValue channel_delays;
+  GValue channel_gains;
+  GstWasapiTrim *trim;
+  gint trim_flushed;
+  gint trim_gains_changed;
+  /* With spin_wait, how write() waits in exclusive mode. Has a timer
+   * while prepared that way. */
+  gboolean spin_wait;
+  GstWasapiSpin spin;
+  /* With keep_running, reset() leaves the client running and this thread
+   * writes silence until write() or the ringbuffer stop it */
+  gboolean keep_running;
+  GThread *keepalive_thread;
+  HANDLE keepalive_stop;
+  /* Wakes the drain at EOS from unlock() */
+  HANDLE drain_cancel;
+  /* Handed to GstWasapiRingBuffer when it is created */
+  gboolean jitter_buffer;
+  GstClockTime jitter_max_latency;
+  /* With shm-input the ringbuffer renders from @shm_reader, which is open
+   * from going to PAUSED until back in READY. Preroll is off meanwhile,
+   * @shm_async is what async was before. */
+  gchar *shm_input;
+  GstWasapiShmReader *shm_reader;
+  gboolean shm_async;
   wchar_t *device_strid;
+  gchar *device_name;
+  /* device_strid was looked up from device_name */
+  gboolean device_name_resolved;
 };
 
 struct _GstWasapiSinkClass
@@ -75,5 +299,21 @@ struct _GstWasapiSinkClass
 
 GType gst_wasapi_sink_get_type (void);
 
+/* For GstWasapiRingBuffer, which renders from the streaming thread */
+
+/* Waits until the device buffer has room or @cancel is set. Returns the
+ * frames that can be written, 0 when cancelled and -1 on errors. */
+gint gst_wasapi_sink_wait_for_room (GstWasapiSink * self, HANDLE cancel);
+
+/* Hands @n_frames of @data to the device, silence when muted. NULL @data
+ * is a gap, concealed with conceal and silence otherwise. The channels are
+ * put in device order on the way. */
+gboolean gst_wasapi_sink_render (GstWasapiSink * self, const guint8 * data,
+    guint n_frames);
+
+/* Takes the device back from the keep-running silence, before rendering
+ * again after a pause or flush */
+void gst_wasapi_sink_stop_keepalive (GstWasapiSink * self);
+
 G_END_DECLS
 #endif /* __GST_WASAPI_SINK_H__ */
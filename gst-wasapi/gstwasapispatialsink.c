@@ -0,0 +1,1072 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/**
+ * SECTION:element-wasapispatialsink
+ * @title: wasapispatialsink
+ *
+ * Renders every input channel as a dynamic audio object of the spatial
+ * audio engine of Windows, through ISpatialAudioObjectRenderStream. The
+ * spatial sound format chosen for the endpoint, like Windows Sonic for
+ * Headphones or Dolby Atmos, then places the objects in the engine or the
+ * hardware, instead of binauralizing each one in software before
+ * wasapisink.
+ *
+ * The positions are in meters from the listener, x to the right, y up and
+ * z to the back, so the front is at negative z. They are set with
+ * #GstWasapiSpatialSink:positions, or per object with a serialized custom
+ * downstream event:
+ * |[
+ * GstWasapiSpatialPosition, object=(uint)0, x=(float)1.0, y=(float)0.0,
+ *     z=(float)-2.0, volume=(float)0.5;
+ * ]|
+ * which takes effect once what was queued before it plays.
+ *
+ * An object is activated when its channel has something to play and
+ * released after a second of silence, so silent channels leave their slot
+ * to other applications. Channels that don't get a slot because the
+ * engine has none left are dropped.
+ *
+ * The device is opened in the READY to PAUSED transition. When it goes
+ * away, or the default device changes when none is selected, the stream is
+ * opened again on the new one.
+ *
+ * ## Example pipelines
+ * |[
+ * gst-launch-1.0 -v audiotestsrc ! audioconvert ! audioresample ! "audio/x-raw,channels=2,channel-mask=(bitmask)0" ! wasapispatialsink positions="<-2.0,0.0,0.0,2.0,1.0,-1.0>"
+ * ]| Play one object on the left and one up front right.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "gstwasapispatialsink.h"
+#include "gstwasapinotify.h"
+
+#include <math.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_wasapi_spatial_sink_debug);
+#define GST_CAT_DEFAULT gst_wasapi_spatial_sink_debug
+
+/* Not in every SDK */
+#ifndef SPTLAUDCLNT_E_DESTROYED
+#define SPTLAUDCLNT_E_DESTROYED AUDCLNT_ERR (0x100)
+#endif
+#ifndef SPTLAUDCLNT_E_RESOURCES_INVALIDATED
+#define SPTLAUDCLNT_E_RESOURCES_INVALIDATED AUDCLNT_ERR (0x102)
+#endif
+#ifndef SPTLAUDCLNT_E_NO_MORE_OBJECTS
+#define SPTLAUDCLNT_E_NO_MORE_OBJECTS AUDCLNT_ERR (0x103)
+#endif
+#ifndef SPTLAUDCLNT_E_STREAM_NOT_AVAILABLE
+#define SPTLAUDCLNT_E_STREAM_NOT_AVAILABLE AUDCLNT_ERR (0x107)
+#endif
+
+/* The stream is dead and has to be activated again */
+#define GST_WASAPI_SPATIAL_LOST(hr) (GST_WASAPI_CLIENT_LOST (hr) || \
+    (hr) == SPTLAUDCLNT_E_RESOURCES_INVALIDATED || \
+    (hr) == SPTLAUDCLNT_E_DESTROYED)
+
+#define DEFAULT_ROLE          GST_WASAPI_DEVICE_ROLE_CONSOLE
+#define DEFAULT_LATENCY_TIME  10000
+#define DEFAULT_BUFFER_TIME   200000
+
+/* Where objects without a position are, spread over the front half circle
+ * at this distance */
+#define DEFAULT_DISTANCE 1.0f
+
+/* Silent passes, of 10 ms usually, after which an object is released */
+#define IDLE_PASSES 100
+
+#define POSITION_EVENT "GstWasapiSpatialPosition"
+
+/* Not in every SDK, and ABI anyway */
+static const IID gst_wasapi_iid_spatial_audio_client = { 0xbbf8e066,
+  0xaaaa, 0x49be, {0x9a, 0x4d, 0xfd, 0x2a, 0x85, 0x8e, 0xa2, 0x7f}
+};
+
+static const IID gst_wasapi_iid_spatial_audio_object_render_stream = {
+  0xbab5f473, 0xb423, 0x477b, {0x85, 0xf5, 0xb5, 0xa3, 0x32, 0xa0, 0x41,
+      0x53}
+};
+
+enum
+{
+  PROP_0,
+  PROP_DEVICE,
+  PROP_ROLE,
+  PROP_POSITIONS,
+  PROP_LATENCY_TIME,
+  PROP_BUFFER_TIME
+};
+
+/* Every channel is an object of its own, none has a speaker position */
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) " GST_AUDIO_NE (F32) ", "
+        "layout = (string) interleaved, "
+        "rate = " GST_AUDIO_RATE_RANGE ", "
+        "channels = " GST_AUDIO_CHANNELS_RANGE ", "
+        "channel-mask = (bitmask) 0"));
+
+static void gst_wasapi_spatial_sink_finalize (GObject * object);
+static void gst_wasapi_spatial_sink_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_wasapi_spatial_sink_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstCaps *gst_wasapi_spatial_sink_get_caps (GstBaseSink * bsink,
+    GstCaps * filter);
+static gboolean gst_wasapi_spatial_sink_set_caps (GstBaseSink * bsink,
+    GstCaps * caps);
+static gboolean gst_wasapi_spatial_sink_start (GstBaseSink * bsink);
+static gboolean gst_wasapi_spatial_sink_stop (GstBaseSink * bsink);
+static gboolean gst_wasapi_spatial_sink_unlock (GstBaseSink * bsink);
+static gboolean gst_wasapi_spatial_sink_unlock_stop (GstBaseSink * bsink);
+static gboolean gst_wasapi_spatial_sink_event (GstBaseSink * bsink,
+    GstEvent * event);
+static GstFlowReturn gst_wasapi_spatial_sink_render (GstBaseSink * bsink,
+    GstBuffer * buffer);
+
+#define gst_wasapi_spatial_sink_parent_class parent_class
+G_DEFINE_TYPE (GstWasapiSpatialSink, gst_wasapi_spatial_sink,
+    GST_TYPE_BASE_SINK);
+
+static void
+gst_wasapi_spatial_sink_class_init (GstWasapiSpatialSinkClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSinkClass *gstbasesink_class = GST_BASE_SINK_CLASS (klass);
+
+  gobject_class->finalize = gst_wasapi_spatial_sink_finalize;
+  gobject_class->set_property = gst_wasapi_spatial_sink_set_property;
+  gobject_class->get_property = gst_wasapi_spatial_sink_get_property;
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE,
+      g_param_spec_string ("device", "Device",
+          "WASAPI playback device as a GUID string, the default one of role "
+          "if unset", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ROLE,
+      g_param_spec_enum ("role", "Role",
+          "Role of the device: communications, multimedia, etc",
+          GST_WASAPI_DEVICE_TYPE_ROLE, DEFAULT_ROLE, G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_POSITIONS,
+      gst_param_spec_array ("positions", "Positions",
+          "x, y and z of each object in meters: right, up and back from the "
+          "listener. Objects without one are spread over the front",
+          g_param_spec_float ("coordinate", "Coordinate",
+              "One coordinate in meters", -G_MAXFLOAT, G_MAXFLOAT, 0,
+              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LATENCY_TIME,
+      g_param_spec_uint64 ("latency-time", "Latency time",
+          "How much is queued before the objects start, in microseconds",
+          1000, G_MAXUINT64, DEFAULT_LATENCY_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_BUFFER_TIME,
+      g_param_spec_uint64 ("buffer-time", "Buffer time",
+          "How much may be queued at most, in microseconds",
+          1000, G_MAXUINT64, DEFAULT_BUFFER_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (gstelement_class,
+      &sink_template);
+  gst_element_class_set_static_metadata (gstelement_class,
+      "WasapiSpatialSink", "Sink/Audio",
+      "Render channels as spatial audio objects through WASAPI", "Bebo");
+
+  gstbasesink_class->get_caps =
+      GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_get_caps);
+  gstbasesink_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_set_caps);
+  gstbasesink_class->start = GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_start);
+  gstbasesink_class->stop = GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_stop);
+  gstbasesink_class->unlock =
+      GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_unlock);
+  gstbasesink_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_unlock_stop);
+  gstbasesink_class->event = GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_event);
+  gstbasesink_class->render =
+      GST_DEBUG_FUNCPTR (gst_wasapi_spatial_sink_render);
+
+  GST_DEBUG_CATEGORY_INIT (gst_wasapi_spatial_sink_debug,
+      "wasapispatialsink", 0, "Windows audio session API spatial sink");
+}
+
+static void
+gst_wasapi_spatial_sink_init (GstWasapiSpatialSink * self)
+{
+  self->stream_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->stop_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  self->wake_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+
+  self->role = DEFAULT_ROLE;
+  g_value_init (&self->positions, GST_TYPE_ARRAY);
+  self->latency_time = DEFAULT_LATENCY_TIME;
+  self->buffer_time = DEFAULT_BUFFER_TIME;
+}
+
+static void
+gst_wasapi_spatial_sink_finalize (GObject * object)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (object);
+
+  g_free (self->ring);
+  CloseHandle (self->stream_event);
+  CloseHandle (self->stop_handle);
+  CloseHandle (self->wake_handle);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_value_unset (&self->positions);
+  g_free (self->device_strid);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* Called with the lock and the object lock. Places every object where
+ * positions has it, or on the front half circle. */
+static void
+gst_wasapi_spatial_sink_apply_positions (GstWasapiSpatialSink * self)
+{
+  guint i, n_values = gst_value_array_get_size (&self->positions);
+
+  for (i = 0; i < self->n_objects; i++) {
+    GstWasapiSpatialObject *obj = &self->objects[i];
+
+    if (3 * i + 2 < n_values) {
+      obj->x = g_value_get_float (gst_value_array_get_value (&self->positions,
+              3 * i));
+      obj->y = g_value_get_float (gst_value_array_get_value (&self->positions,
+              3 * i + 1));
+      obj->z = g_value_get_float (gst_value_array_get_value (&self->positions,
+              3 * i + 2));
+    } else {
+      gdouble angle = self->n_objects > 1 ?
+          G_PI * ((gdouble) i / (self->n_objects - 1) - 0.5) : 0;
+
+      obj->x = DEFAULT_DISTANCE * (gfloat) sin (angle);
+      obj->y = 0;
+      obj->z = -DEFAULT_DISTANCE * (gfloat) cos (angle);
+    }
+  }
+}
+
+static void
+gst_wasapi_spatial_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (object);
+
+  switch (prop_id) {
+    case PROP_DEVICE:
+    {
+      const gchar *device = g_value_get_string (value);
+      g_free (self->device_strid);
+      self->device_strid =
+          device ? g_utf8_to_utf16 (device, -1, NULL, NULL, NULL) : NULL;
+      break;
+    }
+    case PROP_ROLE:
+      self->role = g_value_get_enum (value);
+      break;
+    case PROP_POSITIONS:
+      g_mutex_lock (&self->lock);
+      GST_OBJECT_LOCK (self);
+      g_value_copy (value, &self->positions);
+      gst_wasapi_spatial_sink_apply_positions (self);
+      GST_OBJECT_UNLOCK (self);
+      g_mutex_unlock (&self->lock);
+      break;
+    case PROP_LATENCY_TIME:
+      self->latency_time = g_value_get_uint64 (value);
+      break;
+    case PROP_BUFFER_TIME:
+      self->buffer_time = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_spatial_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (object);
+
+  switch (prop_id) {
+    case PROP_DEVICE:
+      g_value_take_string (value, self->device_strid ?
+          g_utf16_to_utf8 (self->device_strid, -1, NULL, NULL, NULL) : NULL);
+      break;
+    case PROP_ROLE:
+      g_value_set_enum (value, self->role);
+      break;
+    case PROP_POSITIONS:
+      GST_OBJECT_LOCK (self);
+      g_value_copy (&self->positions, value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LATENCY_TIME:
+      g_value_set_uint64 (value, self->latency_time);
+      break;
+    case PROP_BUFFER_TIME:
+      g_value_set_uint64 (value, self->buffer_time);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_wasapi_spatial_sink_default_device_changed (EDataFlow flow, ERole role,
+    const gchar * id, gpointer user_data)
+{
+  GstWasapiSpatialSink *self = user_data;
+
+  if (flow != eRender || role != gst_wasapi_device_role_to_erole (self->role) ||
+      self->device_strid != NULL)
+    return;
+
+  GST_INFO_OBJECT (self, "default device changed");
+  g_atomic_int_set (&self->default_changed, TRUE);
+  SetEvent (self->wake_handle);
+}
+
+static void
+gst_wasapi_spatial_sink_device_changed (GstWasapiSpatialSink * self,
+    const gchar * id, gboolean available)
+{
+  gboolean ours;
+
+  if (available || id == NULL)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  ours = self->device_id && g_ascii_strcasecmp (self->device_id, id) == 0;
+  GST_OBJECT_UNLOCK (self);
+
+  if (ours) {
+    GST_WARNING_OBJECT (self, "device %s went away", id);
+    g_atomic_int_set (&self->device_lost, TRUE);
+    SetEvent (self->wake_handle);
+  }
+}
+
+static void
+gst_wasapi_spatial_sink_device_state_changed (const gchar * id, DWORD state,
+    gpointer user_data)
+{
+  gst_wasapi_spatial_sink_device_changed (user_data, id,
+      state == DEVICE_STATE_ACTIVE);
+}
+
+static void
+gst_wasapi_spatial_sink_device_removed (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_spatial_sink_device_changed (user_data, id, FALSE);
+}
+
+static const GstWasapiNotifyFuncs notify_funcs = {
+  .device_state_changed = gst_wasapi_spatial_sink_device_state_changed,
+  .device_removed = gst_wasapi_spatial_sink_device_removed,
+  .default_device_changed = gst_wasapi_spatial_sink_default_device_changed,
+};
+
+/* Activates the spatial audio client of the device and gets the object
+ * format, which has to stay the same when it is opened again */
+static gboolean
+gst_wasapi_spatial_sink_open_client (GstWasapiSpatialSink * self)
+{
+  IMMDeviceEnumerator *enumerator;
+  IAudioFormatEnumerator *formats = NULL;
+  WAVEFORMATEX *format = NULL;
+  UINT32 max_objects = 0;
+  gboolean res = FALSE;
+  HRESULT hr;
+
+  if (!(enumerator = gst_wasapi_notify_get_enumerator (GST_ELEMENT (self))))
+    return FALSE;
+
+  if (self->device_strid == NULL) {
+    hr = IMMDeviceEnumerator_GetDefaultAudioEndpoint (enumerator, eRender,
+        gst_wasapi_device_role_to_erole (self->role), &self->device);
+    HR_FAILED_GOTO (hr, IMMDeviceEnumerator::GetDefaultAudioEndpoint, beach);
+  } else {
+    hr = IMMDeviceEnumerator_GetDevice (enumerator, self->device_strid,
+        &self->device);
+    HR_FAILED_GOTO (hr, IMMDeviceEnumerator::GetDevice, beach);
+  }
+
+  hr = IMMDevice_Activate (self->device, &gst_wasapi_iid_spatial_audio_client,
+      CLSCTX_INPROC_SERVER, NULL, (void **) &self->client);
+  HR_FAILED_GOTO (hr, IMMDevice::Activate (IID_ISpatialAudioClient), beach);
+
+  hr = ISpatialAudioClient_GetMaxDynamicObjectCount (self->client,
+      &max_objects);
+  HR_FAILED_GOTO (hr, ISpatialAudioClient::GetMaxDynamicObjectCount, beach);
+  if (max_objects == 0) {
+    GST_ERROR_OBJECT (self, "spatial sound is off for this device");
+    goto beach;
+  }
+
+  hr = ISpatialAudioClient_GetSupportedAudioObjectFormatEnumerator
+      (self->client, &formats);
+  HR_FAILED_GOTO (hr,
+      ISpatialAudioClient::GetSupportedAudioObjectFormatEnumerator, beach);
+  /* Owned by the enumerator */
+  hr = IAudioFormatEnumerator_GetFormat (formats, 0, &format);
+  HR_FAILED_GOTO (hr, IAudioFormatEnumerator::GetFormat, beach);
+
+  if (format->nChannels != 1 || format->wBitsPerSample != 32) {
+    GST_ERROR_OBJECT (self, "unexpected object format, %u channels of %u "
+        "bits", format->nChannels, format->wBitsPerSample);
+    goto beach;
+  }
+  if (self->format != NULL &&
+      self->format->nSamplesPerSec != format->nSamplesPerSec) {
+    GST_ERROR_OBJECT (self, "object rate changed from %u to %u Hz",
+        (guint) self->format->nSamplesPerSec, (guint) format->nSamplesPerSec);
+    goto beach;
+  }
+  if (self->format == NULL)
+    self->format = g_memdup (format, sizeof (WAVEFORMATEX) + format->cbSize);
+
+  self->max_objects = max_objects;
+  GST_OBJECT_LOCK (self);
+  g_free (self->device_id);
+  self->device_id = gst_wasapi_util_get_device_id (self->device);
+  GST_OBJECT_UNLOCK (self);
+
+  GST_INFO_OBJECT (self, "opened %s, up to %u objects of %u Hz",
+      self->device_id, max_objects, (guint) format->nSamplesPerSec);
+  res = TRUE;
+
+beach:
+  if (formats != NULL)
+    IUnknown_Release (formats);
+  IUnknown_Release (enumerator);
+
+  return res;
+}
+
+/* Called without a stream */
+static void
+gst_wasapi_spatial_sink_close_client (GstWasapiSpatialSink * self)
+{
+  if (self->client != NULL) {
+    IUnknown_Release (self->client);
+    self->client = NULL;
+  }
+  if (self->device != NULL) {
+    IUnknown_Release (self->device);
+    self->device = NULL;
+  }
+}
+
+/* Activates and starts a stream for the objects of the caps */
+static gboolean
+gst_wasapi_spatial_sink_open_stream (GstWasapiSpatialSink * self)
+{
+  SpatialAudioObjectRenderStreamActivationParams params;
+  PROPVARIANT var;
+  HRESULT hr;
+
+  memset (&params, 0, sizeof (params));
+  params.ObjectFormat = self->format;
+  params.StaticObjectTypeMask = AudioObjectType_None;
+  params.MinDynamicObjectCount = 0;
+  params.MaxDynamicObjectCount = self->n_objects;
+  params.Category = AudioCategory_Other;
+  params.EventHandle = self->stream_event;
+
+  PropVariantInit (&var);
+  var.vt = VT_BLOB;
+  var.blob.cbSize = sizeof (params);
+  var.blob.pBlobData = (BYTE *) & params;
+
+  hr = ISpatialAudioClient_ActivateSpatialAudioStream (self->client, &var,
+      &gst_wasapi_iid_spatial_audio_object_render_stream,
+      (void **) &self->stream);
+  if (hr == SPTLAUDCLNT_E_STREAM_NOT_AVAILABLE) {
+    GST_ERROR_OBJECT (self, "another application has the spatial stream");
+    return FALSE;
+  }
+  HR_FAILED_RET (hr, ISpatialAudioClient::ActivateSpatialAudioStream, FALSE);
+
+  hr = ISpatialAudioObjectRenderStream_Start (self->stream);
+  HR_FAILED_RET (hr, ISpatialAudioObjectRenderStream::Start, FALSE);
+
+  return TRUE;
+}
+
+/* From the render thread, or while there is none */
+static void
+gst_wasapi_spatial_sink_release_objects (GstWasapiSpatialSink * self)
+{
+  guint i;
+
+  for (i = 0; i < self->n_objects; i++) {
+    if (self->objects[i].object != NULL) {
+      IUnknown_Release (self->objects[i].object);
+      self->objects[i].object = NULL;
+    }
+    self->objects[i].idle = 0;
+  }
+}
+
+static void
+gst_wasapi_spatial_sink_close_stream (GstWasapiSpatialSink * self)
+{
+  gst_wasapi_spatial_sink_release_objects (self);
+
+  if (self->stream != NULL) {
+    ISpatialAudioObjectRenderStream_Stop (self->stream);
+    IUnknown_Release (self->stream);
+    self->stream = NULL;
+  }
+}
+
+/* From the render thread, after the device went away or changed. What is
+ * queued plays on the new one. */
+static gboolean
+gst_wasapi_spatial_sink_reopen (GstWasapiSpatialSink * self)
+{
+  GST_INFO_OBJECT (self, "opening the spatial stream again");
+
+  g_atomic_int_set (&self->device_lost, FALSE);
+  g_atomic_int_set (&self->default_changed, FALSE);
+  gst_wasapi_spatial_sink_close_stream (self);
+  gst_wasapi_spatial_sink_close_client (self);
+
+  if (!gst_wasapi_spatial_sink_open_client (self))
+    return FALSE;
+  if (self->n_objects > self->max_objects) {
+    GST_ERROR_OBJECT (self, "%u objects, the new device only takes %u",
+        self->n_objects, self->max_objects);
+    return FALSE;
+  }
+
+  return gst_wasapi_spatial_sink_open_stream (self);
+}
+
+static inline guint
+gst_wasapi_spatial_sink_queued (GstWasapiSpatialSink * self)
+{
+  return (guint) g_atomic_int_get (&self->ring_write) -
+      (guint) g_atomic_int_get (&self->ring_read);
+}
+
+/* From the render thread. Hands one pass worth of the ring to the
+ * objects. */
+static HRESULT
+gst_wasapi_spatial_sink_pass (GstWasapiSpatialSink * self)
+{
+  guint channels = self->n_objects;
+  guint mask = self->ring_frames - 1;
+  UINT32 available = 0, frame_count = 0;
+  guint i, read, queued, n_frames = 0;
+  HRESULT hr;
+
+  hr = ISpatialAudioObjectRenderStream_BeginUpdatingAudioObjects
+      (self->stream, &available, &frame_count);
+  if (FAILED (hr))
+    return hr;
+
+  g_mutex_lock (&self->lock);
+  if (self->flush_pending) {
+    g_atomic_int_set (&self->ring_read, self->flush_to);
+    self->flush_pending = FALSE;
+  }
+  queued = gst_wasapi_spatial_sink_queued (self);
+  if (!self->started && (self->draining || queued >= self->start_frames))
+    self->started = TRUE;
+  if (self->started)
+    n_frames = MIN (frame_count, queued);
+  for (i = 0; i < channels; i++) {
+    GstWasapiSpatialObject *obj = &self->objects[i];
+
+    obj->pass_x = obj->x;
+    obj->pass_y = obj->y;
+    obj->pass_z = obj->z;
+    obj->pass_volume = obj->volume;
+  }
+  g_mutex_unlock (&self->lock);
+
+  read = (guint) g_atomic_int_get (&self->ring_read);
+
+  for (i = 0; i < channels && SUCCEEDED (hr); i++) {
+    GstWasapiSpatialObject *obj = &self->objects[i];
+    gboolean silent = TRUE;
+    UINT32 length;
+    gfloat *dst;
+    guint f;
+
+    for (f = 0; f < n_frames && silent; f++)
+      silent = self->ring[((read + f) & mask) * channels + i] == 0;
+    obj->idle = silent ? obj->idle + 1 : 0;
+
+    if (obj->object == NULL) {
+      if (silent)
+        continue;
+      hr = available == 0 ? SPTLAUDCLNT_E_NO_MORE_OBJECTS :
+          ISpatialAudioObjectRenderStream_ActivateSpatialAudioObject
+          (self->stream, AudioObjectType_Dynamic, &obj->object);
+      if (hr == SPTLAUDCLNT_E_NO_MORE_OBJECTS) {
+        if (self->rejected == 0)
+          GST_WARNING_OBJECT (self, "no spatial object left for channel %u, "
+              "dropping it", i);
+        self->rejected += n_frames;
+        hr = S_OK;
+        continue;
+      }
+      if (FAILED (hr))
+        break;
+      available--;
+      GST_DEBUG_OBJECT (self, "activated object %u", i);
+    }
+
+    hr = ISpatialAudioObject_GetBuffer (obj->object, (BYTE **) & dst, &length);
+    if (FAILED (hr))
+      break;
+    length /= sizeof (gfloat);
+    for (f = 0; f < MIN (n_frames, length); f++)
+      dst[f] = self->ring[((read + f) & mask) * channels + i];
+    for (; f < length; f++)
+      dst[f] = 0;
+
+    ISpatialAudioObject_SetPosition (obj->object, obj->pass_x, obj->pass_y,
+        obj->pass_z);
+    ISpatialAudioObject_SetVolume (obj->object, obj->pass_volume);
+
+    if (obj->idle >= IDLE_PASSES) {
+      GST_DEBUG_OBJECT (self, "releasing idle object %u", i);
+      ISpatialAudioObject_SetEndOfStream (obj->object, 0);
+      IUnknown_Release (obj->object);
+      obj->object = NULL;
+    }
+  }
+
+  if (n_frames > 0)
+    g_atomic_int_set (&self->ring_read, (gint) (read + n_frames));
+
+  if (FAILED (hr))
+    ISpatialAudioObjectRenderStream_EndUpdatingAudioObjects (self->stream);
+  else
+    hr = ISpatialAudioObjectRenderStream_EndUpdatingAudioObjects
+        (self->stream);
+
+  /* render() and EOS wait for room or for the ring to run empty */
+  g_mutex_lock (&self->lock);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  return hr;
+}
+
+static gpointer
+gst_wasapi_spatial_sink_thread_func (gpointer user_data)
+{
+  GstWasapiSpatialSink *self = user_data;
+  HANDLE handles[3];
+  HANDLE priority_handle;
+  DWORD res;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  priority_handle =
+      gst_wasapi_util_set_thread_characteristics (GST_WASAPI_DEFAULT_MMCSS_TASK,
+      GST_WASAPI_MMCSS_PRIORITY_NORMAL);
+
+  handles[0] = self->stop_handle;
+  handles[1] = self->wake_handle;
+  handles[2] = self->stream_event;
+
+  for (;;) {
+    gboolean ok = TRUE;
+    HRESULT hr = S_OK;
+
+    res = WaitForMultipleObjects (G_N_ELEMENTS (handles), handles, FALSE,
+        INFINITE);
+    if (res == WAIT_OBJECT_0)
+      break;
+
+    if (res >= WAIT_OBJECT_0 + G_N_ELEMENTS (handles)) {
+      GST_ERROR_OBJECT (self, "Error waiting for the stream event: %x",
+          (guint) res);
+      ok = FALSE;
+    } else if (g_atomic_int_get (&self->device_lost) ||
+        g_atomic_int_get (&self->default_changed)) {
+      ok = gst_wasapi_spatial_sink_reopen (self);
+    } else if (res == WAIT_OBJECT_0 + 2) {
+      hr = gst_wasapi_spatial_sink_pass (self);
+      if (GST_WASAPI_SPATIAL_LOST (hr)) {
+        GST_WARNING_OBJECT (self, "spatial stream lost");
+        ok = gst_wasapi_spatial_sink_reopen (self);
+      } else if (FAILED (hr)) {
+        gchar *msg = gst_wasapi_util_hresult_to_string (hr);
+        GST_ERROR_OBJECT (self, "Failed to update the objects: %s", msg);
+        g_free (msg);
+        ok = FALSE;
+      }
+    }
+
+    if (!ok) {
+      g_mutex_lock (&self->lock);
+      self->failed = TRUE;
+      g_cond_broadcast (&self->cond);
+      g_mutex_unlock (&self->lock);
+      break;
+    }
+  }
+
+  if (priority_handle != NULL)
+    gst_wasapi_util_revert_thread_characteristics (priority_handle);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static void
+gst_wasapi_spatial_sink_stop_thread (GstWasapiSpatialSink * self)
+{
+  if (self->thread != NULL) {
+    SetEvent (self->stop_handle);
+    g_thread_join (self->thread);
+    self->thread = NULL;
+    ResetEvent (self->stop_handle);
+  }
+
+  if (self->rejected > 0)
+    GST_INFO_OBJECT (self, "dropped %" G_GUINT64_FORMAT " frames for lack of "
+        "objects", self->rejected);
+  g_atomic_int_set (&self->ring_read, 0);
+  g_atomic_int_set (&self->ring_write, 0);
+  self->flush_pending = FALSE;
+  self->rejected = 0;
+  self->started = FALSE;
+  self->failed = FALSE;
+  self->draining = FALSE;
+}
+
+static gboolean
+gst_wasapi_spatial_sink_start (GstBaseSink * bsink)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+
+  if (!gst_wasapi_spatial_sink_open_client (self)) {
+    gst_wasapi_spatial_sink_close_client (self);
+    if (!self->device_strid)
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+          ("Failed to open spatial audio on the default device"));
+    else
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+          ("Failed to open spatial audio on device %S", self->device_strid));
+    return FALSE;
+  }
+
+  g_atomic_int_set (&self->device_lost, FALSE);
+  g_atomic_int_set (&self->default_changed, FALSE);
+  self->notify_id = gst_wasapi_notify_subscribe (GST_ELEMENT (self),
+      &notify_funcs, self);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_spatial_sink_stop (GstBaseSink * bsink)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+
+  gst_wasapi_spatial_sink_stop_thread (self);
+  gst_wasapi_spatial_sink_close_stream (self);
+  gst_wasapi_spatial_sink_close_client (self);
+
+  if (self->notify_id != 0) {
+    gst_wasapi_notify_unsubscribe (self->notify_id);
+    self->notify_id = 0;
+  }
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->device_id, g_free);
+  GST_OBJECT_UNLOCK (self);
+
+  g_clear_pointer (&self->format, g_free);
+  g_clear_pointer (&self->objects, g_free);
+  self->n_objects = 0;
+  g_clear_pointer (&self->ring, g_free);
+  self->ring_frames = 0;
+  gst_audio_info_init (&self->info);
+
+  return TRUE;
+}
+
+static GstCaps *
+gst_wasapi_spatial_sink_get_caps (GstBaseSink * bsink, GstCaps * filter)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+  GstCaps *caps;
+
+  caps = gst_pad_get_pad_template_caps (bsink->sinkpad);
+
+  /* Only known once the device is open */
+  if (self->format != NULL) {
+    caps = gst_caps_make_writable (caps);
+    gst_caps_set_simple (caps, "rate", G_TYPE_INT,
+        (gint) self->format->nSamplesPerSec, NULL);
+    if (self->max_objects > 1)
+      gst_caps_set_simple (caps, "channels", GST_TYPE_INT_RANGE, 1,
+          (gint) MIN (self->max_objects, 64), NULL);
+    else
+      gst_caps_set_simple (caps, "channels", G_TYPE_INT, 1, NULL);
+  }
+
+  if (filter) {
+    GstCaps *filtered =
+        gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = filtered;
+  }
+
+  return caps;
+}
+
+static gboolean
+gst_wasapi_spatial_sink_set_caps (GstBaseSink * bsink, GstCaps * caps)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+  GstAudioInfo info;
+  guint i, channels;
+  gint rate;
+
+  if (!gst_audio_info_from_caps (&info, caps))
+    return FALSE;
+
+  if (self->stream != NULL && gst_audio_info_is_equal (&info, &self->info))
+    return TRUE;
+
+  if (self->client == NULL)
+    return FALSE;
+
+  gst_wasapi_spatial_sink_stop_thread (self);
+  gst_wasapi_spatial_sink_close_stream (self);
+
+  channels = GST_AUDIO_INFO_CHANNELS (&info);
+  rate = GST_AUDIO_INFO_RATE (&info);
+  if (channels > self->max_objects) {
+    GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+        ("%u channels, the device only takes %u spatial objects", channels,
+            self->max_objects));
+    return FALSE;
+  }
+
+  g_mutex_lock (&self->lock);
+  GST_OBJECT_LOCK (self);
+  g_free (self->objects);
+  self->objects = g_new0 (GstWasapiSpatialObject, channels);
+  self->n_objects = channels;
+  for (i = 0; i < channels; i++)
+    self->objects[i].volume = 1.0f;
+  gst_wasapi_spatial_sink_apply_positions (self);
+  GST_OBJECT_UNLOCK (self);
+  self->info = info;
+  self->start_frames = MAX (gst_util_uint64_scale_int (self->latency_time,
+          rate, G_USEC_PER_SEC), 1);
+  self->max_frames = MAX (gst_util_uint64_scale_int (self->buffer_time,
+          rate, G_USEC_PER_SEC), self->start_frames);
+  g_mutex_unlock (&self->lock);
+
+  /* Allocated once here, render() and the render thread only copy */
+  g_free (self->ring);
+  self->ring_frames = 1 << g_bit_storage (self->max_frames - 1);
+  self->ring = g_new0 (gfloat, (gsize) self->ring_frames * channels);
+
+  if (!gst_wasapi_spatial_sink_open_stream (self)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+        ("Failed to open a spatial stream of %u objects", channels));
+    gst_wasapi_spatial_sink_close_stream (self);
+    return FALSE;
+  }
+
+  /* What waits in the queue before it plays */
+  gst_base_sink_set_render_delay (bsink,
+      gst_util_uint64_scale_int (self->start_frames, GST_SECOND, rate));
+
+  self->thread = g_thread_new ("wasapi-spatial",
+      gst_wasapi_spatial_sink_thread_func, self);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_spatial_sink_unlock (GstBaseSink * bsink)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+
+  g_mutex_lock (&self->lock);
+  self->flushing = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_spatial_sink_unlock_stop (GstBaseSink * bsink)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+
+  /* Whatever comes next starts over, idle objects get released */
+  g_mutex_lock (&self->lock);
+  self->flushing = FALSE;
+  self->draining = FALSE;
+  self->started = FALSE;
+  /* Only the render thread moves the read position, and render() doesn't
+   * write again before this returns */
+  self->flush_pending = TRUE;
+  self->flush_to = g_atomic_int_get (&self->ring_write);
+  g_mutex_unlock (&self->lock);
+
+  return TRUE;
+}
+
+/* Moves one object, with the position event */
+static void
+gst_wasapi_spatial_sink_position_event (GstWasapiSpatialSink * self,
+    const GstStructure * s)
+{
+  GstWasapiSpatialObject *obj;
+  guint index;
+
+  if (!gst_structure_get_uint (s, "object", &index)) {
+    GST_WARNING_OBJECT (self, "position event without an object");
+    return;
+  }
+
+  g_mutex_lock (&self->lock);
+  if (index < self->n_objects) {
+    obj = &self->objects[index];
+    gst_structure_get (s, "x", G_TYPE_FLOAT, &obj->x, NULL);
+    gst_structure_get (s, "y", G_TYPE_FLOAT, &obj->y, NULL);
+    gst_structure_get (s, "z", G_TYPE_FLOAT, &obj->z, NULL);
+    gst_structure_get (s, "volume", G_TYPE_FLOAT, &obj->volume, NULL);
+    obj->volume = CLAMP (obj->volume, 0.0f, 1.0f);
+  } else {
+    GST_WARNING_OBJECT (self, "position event for object %u of %u", index,
+        self->n_objects);
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static gboolean
+gst_wasapi_spatial_sink_event (GstBaseSink * bsink, GstEvent * event)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM &&
+      gst_event_has_name (event, POSITION_EVENT)) {
+    gst_wasapi_spatial_sink_position_event (self,
+        gst_event_get_structure (event));
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && self->thread) {
+    /* Play out what is queued, also when it was too short to start */
+    g_mutex_lock (&self->lock);
+    self->draining = TRUE;
+    while (!self->flushing && !self->failed &&
+        gst_wasapi_spatial_sink_queued (self) > 0)
+      g_cond_wait (&self->cond, &self->lock);
+    g_mutex_unlock (&self->lock);
+  }
+
+  return GST_BASE_SINK_CLASS (parent_class)->event (bsink, event);
+}
+
+static GstFlowReturn
+gst_wasapi_spatial_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
+{
+  GstWasapiSpatialSink *self = GST_WASAPI_SPATIAL_SINK (bsink);
+  guint channels = self->n_objects;
+  guint mask = self->ring_frames - 1;
+  const gfloat *src;
+  GstMapInfo map;
+  guint n_frames;
+
+  if (self->thread == NULL)
+    return GST_FLOW_NOT_NEGOTIATED;
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  src = (const gfloat *) map.data;
+  n_frames = map.size / GST_AUDIO_INFO_BPF (&self->info);
+
+  while (n_frames > 0) {
+    guint write, queued, n, first;
+
+    g_mutex_lock (&self->lock);
+    while (!self->flushing && !self->failed &&
+        gst_wasapi_spatial_sink_queued (self) >= self->max_frames)
+      g_cond_wait (&self->cond, &self->lock);
+    if (self->flushing) {
+      g_mutex_unlock (&self->lock);
+      gst_buffer_unmap (buffer, &map);
+      return GST_FLOW_FLUSHING;
+    }
+    if (self->failed) {
+      g_mutex_unlock (&self->lock);
+      gst_buffer_unmap (buffer, &map);
+      GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
+          ("Failed to render the spatial objects"));
+      return GST_FLOW_ERROR;
+    }
+    g_mutex_unlock (&self->lock);
+
+    /* Only this thread writes, so the room can only grow meanwhile */
+    queued = gst_wasapi_spatial_sink_queued (self);
+    write = (guint) g_atomic_int_get (&self->ring_write);
+    n = MIN (n_frames, self->max_frames - queued);
+    first = MIN (n, self->ring_frames - (write & mask));
+    memcpy (self->ring + (gsize) (write & mask) * channels, src,
+        (gsize) first * channels * sizeof (gfloat));
+    memcpy (self->ring, src + (gsize) first * channels,
+        (gsize) (n - first) * channels * sizeof (gfloat));
+    g_atomic_int_set (&self->ring_write, (gint) (write + n));
+
+    src += (gsize) n * channels;
+    n_frames -= n;
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  return GST_FLOW_OK;
+}
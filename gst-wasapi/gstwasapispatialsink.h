@@ -0,0 +1,125 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_SPATIAL_SINK_H__
+#define __GST_WASAPI_SPATIAL_SINK_H__
+
+#include <gst/base/gstbasesink.h>
+
+#include <spatialaudioclient.h>
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+#define GST_TYPE_WASAPI_SPATIAL_SINK \
+  (gst_wasapi_spatial_sink_get_type ())
+#define GST_WASAPI_SPATIAL_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_WASAPI_SPATIAL_SINK, GstWasapiSpatialSink))
+#define GST_WASAPI_SPATIAL_SINK_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_WASAPI_SPATIAL_SINK, GstWasapiSpatialSinkClass))
+#define GST_IS_WASAPI_SPATIAL_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_WASAPI_SPATIAL_SINK))
+#define GST_IS_WASAPI_SPATIAL_SINK_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_WASAPI_SPATIAL_SINK))
+typedef struct _GstWasapiSpatialSink GstWasapiSpatialSink;
+typedef struct _GstWasapiSpatialSinkClass GstWasapiSpatialSinkClass;
+
+/* The dynamic audio object of one input channel. It is only activated
+ * while the channel has something to play, so silent ones leave their
+ * slot in the spatial engine to others. */
+typedef struct
+{
+  /* Only used by the render thread */
+  ISpatialAudioObject *object;
+  /* Passes in a row that were silent */
+  guint idle;
+  /* Right, up, back from the listener in meters, under the lock */
+  gfloat x, y, z;
+  gfloat volume;
+  /* What the render thread took of those for the current pass */
+  gfloat pass_x, pass_y, pass_z, pass_volume;
+} GstWasapiSpatialObject;
+
+struct _GstWasapiSpatialSink
+{
+  GstBaseSink parent;
+
+  IMMDevice *device;
+  ISpatialAudioClient *client;
+  ISpatialAudioObjectRenderStream *stream;
+  /* The spatial engine signals it for every pass */
+  HANDLE stream_event;
+  /* The format of every object, F32 mono */
+  WAVEFORMATEX *format;
+  guint max_objects;
+  gchar *device_id;
+  guint notify_id;
+
+  GThread *thread;
+  /* Manual-reset, stops the render thread */
+  HANDLE stop_handle;
+  /* Wakes the render thread when the stream has to be opened again */
+  HANDLE wake_handle;
+  gint device_lost;
+  gint default_changed;
+
+  /* The frames between render() and the render thread, which doesn't take
+   * the lock for them. @ring_write is only moved by render() and
+   * @ring_read by the render thread, both are ATOMIC frame counts that
+   * wrap, @ring_frames is a power of two. */
+  gfloat *ring;
+  guint ring_frames;
+  gint ring_read;
+  gint ring_write;
+
+  /* Protects the control state below. Never held over a call into the
+   * spatial engine. */
+  GMutex lock;
+  GCond cond;
+  gboolean flushing;
+  gboolean failed;
+  gboolean draining;
+  /* A flush asks the render thread to skip to @flush_to */
+  gboolean flush_pending;
+  gint flush_to;
+
+  GstAudioInfo info;
+  GstWasapiSpatialObject *objects;
+  guint n_objects;
+  guint start_frames;
+  guint max_frames;
+  gboolean started;
+  guint64 rejected;
+
+  /* properties */
+  wchar_t *device_strid;
+  gint role;
+  GValue positions;
+  guint64 latency_time;
+  guint64 buffer_time;
+};
+
+struct _GstWasapiSpatialSinkClass
+{
+  GstBaseSinkClass parent_class;
+};
+
+GType gst_wasapi_spatial_sink_get_type (void);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SPATIAL_SINK_H__ */
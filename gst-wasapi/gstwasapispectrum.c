@@ -0,0 +1,229 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapispectrum.h"
+
+#include <math.h>
+#include <string.h>
+#include <gst/fft/gstfftf32.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Below this bands are posted as this, instead of -inf for silence */
+#define SPECTRUM_FLOOR -120.0
+
+typedef void (*GstWasapiSpectrumMixFunc) (gfloat * out, gconstpointer data,
+    guint n_frames, gint channels);
+
+struct _GstWasapiSpectrum
+{
+  GstWasapiSpectrumMixFunc mix;
+
+  gint rate;
+  gint channels;
+  gint bpf;
+  guint64 interval_frames;
+
+  guint bands;
+  guint n_fft;
+  GstFFTF32 *fft;
+  /* The last @n_fft frames mixed down, oldest at @pos */
+  gfloat *history;
+  guint pos;
+  /* The window of the last complete interval in order, what the FFT works
+   * on. Owned by take_structure() while pending, intervals that end
+   * meanwhile are dropped. */
+  gint pending;
+  gfloat *input;
+  GstFFTF32Complex *freq;
+  GstClockTime result_timestamp;
+  guint64 result_frames;
+
+  GstClockTime timestamp;
+  guint64 frames;
+};
+
+/* Mean of the channels of each frame, normalized to [-1, 1] */
+#define DEFINE_MIX(name, type, scale) \
+static void \
+gst_wasapi_spectrum_mix_##name (gfloat * out, gconstpointer data, \
+    guint n_frames, gint channels) \
+{ \
+  const type *in = data; \
+  const gfloat factor = (gfloat) (scale) / channels; \
+  \
+  for (guint ii = 0; ii < n_frames; ii++) { \
+    gfloat sum = 0; \
+    \
+    for (gint cc = 0; cc < channels; cc++) \
+      sum += (gfloat) *in++; \
+    out[ii] = sum * factor; \
+  } \
+}
+
+DEFINE_MIX (s16, gint16, 1.0 / 32768.0);
+DEFINE_MIX (s32, gint32, 1.0 / 2147483648.0);
+DEFINE_MIX (f32, gfloat, 1.0);
+
+GstWasapiSpectrum *
+gst_wasapi_spectrum_new (const GstAudioInfo * info, guint bands,
+    GstClockTime interval)
+{
+  GstWasapiSpectrumMixFunc mix;
+  GstWasapiSpectrum *self;
+
+  g_return_val_if_fail (bands > 0, NULL);
+
+  switch (GST_AUDIO_INFO_FORMAT (info)) {
+    case GST_AUDIO_FORMAT_S16LE:
+      mix = gst_wasapi_spectrum_mix_s16;
+      break;
+    case GST_AUDIO_FORMAT_S32LE:
+      mix = gst_wasapi_spectrum_mix_s32;
+      break;
+    case GST_AUDIO_FORMAT_F32LE:
+      mix = gst_wasapi_spectrum_mix_f32;
+      break;
+    default:
+      GST_INFO ("can't analyze %s", GST_AUDIO_INFO_NAME (info));
+      return NULL;
+  }
+
+  self = g_slice_new0 (GstWasapiSpectrum);
+  self->mix = mix;
+  self->rate = GST_AUDIO_INFO_RATE (info);
+  self->channels = GST_AUDIO_INFO_CHANNELS (info);
+  self->bpf = GST_AUDIO_INFO_BPF (info);
+  self->interval_frames = MAX (gst_util_uint64_scale_int (interval,
+          self->rate, GST_SECOND), 1);
+
+  /* Bins up to n_fft / 2, a length kissfft is fast at */
+  self->bands = bands;
+  self->n_fft = gst_fft_next_fast_length (2 * bands);
+  self->fft = gst_fft_f32_new (self->n_fft, FALSE);
+  self->history = g_new0 (gfloat, self->n_fft);
+  self->input = g_new (gfloat, self->n_fft);
+  self->freq = g_new (GstFFTF32Complex, self->n_fft / 2 + 1);
+  self->timestamp = GST_CLOCK_TIME_NONE;
+
+  GST_DEBUG ("%u bands of %.1f Hz with a window of %u frames", bands,
+      (gdouble) self->rate / self->n_fft, self->n_fft);
+
+  return self;
+}
+
+void
+gst_wasapi_spectrum_free (GstWasapiSpectrum * self)
+{
+  gst_fft_f32_free (self->fft);
+  g_free (self->history);
+  g_free (self->input);
+  g_free (self->freq);
+  g_slice_free (GstWasapiSpectrum, self);
+}
+
+GstStructure *
+gst_wasapi_spectrum_take_structure (GstWasapiSpectrum * self)
+{
+  GstStructure *s;
+  GstClockTime duration;
+  GBytes *bytes;
+  gfloat *magnitude;
+  guint n_fft = self->n_fft;
+
+  if (!g_atomic_int_get (&self->pending))
+    return NULL;
+
+  gst_fft_f32_window (self->fft, self->input, GST_FFT_WINDOW_HANN);
+  gst_fft_f32_fft (self->fft, self->input, self->freq);
+
+  magnitude = g_new (gfloat, self->bands);
+  for (guint ii = 0; ii < self->bands; ii++) {
+    gdouble re = self->freq[ii].r, im = self->freq[ii].i;
+    gdouble val = (re * re + im * im) / ((gdouble) n_fft * n_fft);
+
+    magnitude[ii] = (gfloat) MAX (10 * log10 (val), SPECTRUM_FLOOR);
+  }
+  bytes = g_bytes_new_take (magnitude, self->bands * sizeof (gfloat));
+
+  duration = gst_util_uint64_scale_int (self->result_frames, GST_SECOND,
+      self->rate);
+  s = gst_structure_new ("wasapi-spectrum",
+      "timestamp", G_TYPE_UINT64, self->result_timestamp,
+      "duration", G_TYPE_UINT64, duration,
+      "endtime", G_TYPE_UINT64,
+      GST_CLOCK_TIME_IS_VALID (self->result_timestamp) ?
+      self->result_timestamp + duration : GST_CLOCK_TIME_NONE,
+      "band-width", G_TYPE_DOUBLE, (gdouble) self->rate / n_fft,
+      "magnitude", G_TYPE_BYTES, bytes, NULL);
+  g_bytes_unref (bytes);
+
+  g_atomic_int_set (&self->pending, FALSE);
+
+  return s;
+}
+
+gboolean
+gst_wasapi_spectrum_process (GstWasapiSpectrum * self, gconstpointer data,
+    guint n_frames, GstClockTime timestamp)
+{
+  const guint8 *in = data;
+  gboolean published = FALSE;
+  guint n, first;
+
+  if (n_frames == 0)
+    return FALSE;
+
+  if (self->frames == 0)
+    self->timestamp = timestamp;
+  self->frames += n_frames;
+
+  /* Earlier frames would be pushed out of the window by these anyway */
+  n = MIN (n_frames, self->n_fft);
+  in += (gsize) (n_frames - n) * self->bpf;
+
+  first = MIN (n, self->n_fft - self->pos);
+  self->mix (self->history + self->pos, in, first, self->channels);
+  self->mix (self->history, in + (gsize) first * self->bpf, n - first,
+      self->channels);
+  self->pos = (self->pos + n) % self->n_fft;
+
+  if (self->frames < self->interval_frames)
+    return FALSE;
+
+  if (!g_atomic_int_get (&self->pending)) {
+    memcpy (self->input, self->history + self->pos,
+        (self->n_fft - self->pos) * sizeof (gfloat));
+    memcpy (self->input + self->n_fft - self->pos, self->history,
+        self->pos * sizeof (gfloat));
+    self->result_timestamp = self->timestamp;
+    self->result_frames = self->frames;
+    g_atomic_int_set (&self->pending, TRUE);
+    published = TRUE;
+  }
+
+  self->timestamp = GST_CLOCK_TIME_NONE;
+  self->frames = 0;
+
+  return published;
+}
@@ -0,0 +1,56 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_SPECTRUM_H__
+#define __GST_WASAPI_SPECTRUM_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Spectrum of wasapisrc, so visualizers need no spectrum element after it.
+ *
+ * The channels are mixed down as the samples are read, but only the last
+ * frames of each segment that can still end up in the window, and one FFT
+ * of the most recent window is done per interval, off the capture thread, instead of one for every
+ * window of the stream. That is what a visualizer shows at its frame rate
+ * anyway. The result is a "wasapi-spectrum" structure with "timestamp",
+ * "duration" and "endtime" like the level messages, the width of a band in
+ * Hz as "band-width" and the magnitudes in dB as "magnitude", GBytes of one
+ * float per band from 0 Hz up, scaled like the spectrum element's. */
+typedef struct _GstWasapiSpectrum GstWasapiSpectrum;
+
+/* NULL if the samples of @info can't be analyzed */
+GstWasapiSpectrum *gst_wasapi_spectrum_new (const GstAudioInfo * info,
+    guint bands, GstClockTime interval);
+
+void gst_wasapi_spectrum_free (GstWasapiSpectrum * spectrum);
+
+/* Takes @n_frames frames of @data, the first captured at @timestamp. Only
+ * mixes down, neither allocates nor locks. TRUE once an interval is
+ * complete and its window kept for gst_wasapi_spectrum_take_structure(). */
+gboolean gst_wasapi_spectrum_process (GstWasapiSpectrum * spectrum,
+    gconstpointer data, guint n_frames, GstClockTime timestamp);
+
+/* Does the FFT of the window process() kept, the message structure or NULL
+ * if there is none. May be called from another thread than process(). */
+GstStructure *gst_wasapi_spectrum_take_structure (GstWasapiSpectrum *
+    spectrum);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SPECTRUM_H__ */
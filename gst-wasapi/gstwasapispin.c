@@ -0,0 +1,167 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapispin.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* How long before the predicted time the polling starts, in 100 ns. Above
+ * what the timer is late by on a quiet machine, and at most a quarter of
+ * the period. */
+#define SPIN_MARGIN 2000
+
+/* Polls of the client between looks at the other handles, each of those
+ * is a system call */
+#define SPIN_CHECK_INTERVAL 16
+
+gboolean
+gst_wasapi_spin_init (GstWasapiSpin * spin, GstClockTime period)
+{
+  /* Regular timers are only as precise as the timer resolution */
+  spin->timer = CreateWaitableTimerExW (NULL, NULL,
+      CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+  if (spin->timer == NULL) {
+    GST_WARNING ("no high resolution timers before Windows 10 1803");
+    return FALSE;
+  }
+
+  spin->period = MAX (period / 100, 1);
+  spin->margin = MIN (SPIN_MARGIN, spin->period / 4);
+  spin->last = 0;
+
+  return TRUE;
+}
+
+void
+gst_wasapi_spin_clear (GstWasapiSpin * spin)
+{
+  if (spin->timer != NULL) {
+    CloseHandle (spin->timer);
+    spin->timer = NULL;
+  }
+}
+
+void
+gst_wasapi_spin_reset (GstWasapiSpin * spin)
+{
+  spin->last = 0;
+}
+
+/* Milliseconds until @deadline from @now, rounded up */
+static DWORD
+gst_wasapi_spin_timeout (guint64 now, guint64 deadline)
+{
+  if (deadline == G_MAXUINT64)
+    return INFINITE;
+  if (now >= deadline)
+    return 0;
+  return (DWORD) MIN ((deadline - now + 9999) / 10000, INFINITE - 1);
+}
+
+DWORD
+gst_wasapi_spin_wait (GstWasapiSpin * spin, const HANDLE * handles,
+    DWORD n_handles, GstWasapiSpinReadyFunc ready, gpointer user_data,
+    DWORD timeout_ms)
+{
+  HANDLE all[MAXIMUM_WAIT_OBJECTS];
+  guint64 now = gst_wasapi_util_get_qpc_position ();
+  guint64 deadline, due;
+  DWORD ret;
+  guint polls;
+
+  g_return_val_if_fail (n_handles > 0 && n_handles < MAXIMUM_WAIT_OBJECTS,
+      WAIT_FAILED);
+
+  deadline = timeout_ms == INFINITE ? G_MAXUINT64 :
+      now + (guint64) timeout_ms * 10000;
+  memcpy (all, handles, n_handles * sizeof (HANDLE));
+  all[n_handles] = spin->timer;
+
+  for (;;) {
+    now = gst_wasapi_util_get_qpc_position ();
+
+    /* Nothing to predict from, the event it is */
+    if (spin->last == 0 || now > spin->last + 2 * spin->period) {
+      ret = WaitForMultipleObjects (n_handles, handles, FALSE,
+          gst_wasapi_spin_timeout (now, deadline));
+      if (ret == WAIT_OBJECT_0)
+        spin->last = gst_wasapi_util_get_qpc_position ();
+      return ret;
+    }
+
+    due = spin->last + spin->period;
+    if (now + spin->margin < due) {
+      LARGE_INTEGER when;
+
+      /* Relative, in 100 ns */
+      when.QuadPart = -(LONGLONG) (due - spin->margin - now);
+      SetWaitableTimer (spin->timer, &when, 0, NULL, NULL, FALSE);
+      ret = WaitForMultipleObjects (n_handles + 1, all, FALSE,
+          gst_wasapi_spin_timeout (now, deadline));
+
+      if (ret == WAIT_OBJECT_0) {
+        CancelWaitableTimer (spin->timer);
+        /* Left over from the last period, which we took by polling */
+        if (!ready (user_data))
+          continue;
+        /* We woke up late for it, the period started at the latest when
+         * it was due */
+        spin->last = MIN (gst_wasapi_util_get_qpc_position (), due);
+        return ret;
+      }
+      if (ret != WAIT_OBJECT_0 + n_handles) {
+        CancelWaitableTimer (spin->timer);
+        return ret;
+      }
+    }
+
+    /* Shortly before it is due, poll until it is there. Not for longer
+     * than another period, the device stalled then. */
+    for (polls = 0; !ready (user_data); polls++) {
+      if (polls % SPIN_CHECK_INTERVAL == SPIN_CHECK_INTERVAL - 1) {
+        if (n_handles > 1) {
+          ret = WaitForMultipleObjects (n_handles - 1, handles + 1, FALSE, 0);
+          if (ret != WAIT_TIMEOUT)
+            return ret == WAIT_FAILED ? ret : ret + 1;
+        }
+
+        now = gst_wasapi_util_get_qpc_position ();
+        if (now >= deadline)
+          return WAIT_TIMEOUT;
+        if (now > due + spin->period) {
+          GST_DEBUG ("not ready a period after it was due, waiting for the "
+              "event");
+          spin->last = 0;
+          break;
+        }
+      }
+      YieldProcessor ();
+    }
+
+    if (spin->last != 0) {
+      spin->last = gst_wasapi_util_get_qpc_position ();
+      return WAIT_OBJECT_0;
+    }
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_SPIN_H__
+#define __GST_WASAPI_SPIN_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Spin-then-wait wakeups in exclusive mode, for wasapisrc scheduling=spin
+ * and wasapisink spin-wait=true.
+ *
+ * At device periods of a millisecond or two, how late the scheduler wakes
+ * a thread from WaitForMultipleObjects() is a good part of the period. The
+ * device is ready one period after it was ready the last time, so we sleep
+ * on a high resolution timer until shortly before that and then poll the
+ * client until it is, on a core of our own. The event of the device still
+ * ends the sleep when it comes first. An event left over from a period the
+ * polling already took is recognized by the client not being ready, and
+ * waited past.
+ *
+ * Without a period to predict from, the first time and after a stall, it
+ * waits for the event as usual. Only for the thread that reads or writes
+ * the client. */
+typedef gboolean (*GstWasapiSpinReadyFunc) (gpointer user_data);
+
+typedef struct
+{
+  HANDLE timer;
+  /* In QPC units of 100 ns */
+  guint64 period;
+  guint64 margin;
+  /* When the client was last ready, 0 before that */
+  guint64 last;
+} GstWasapiSpin;
+
+/* For a client with a device period of @period. FALSE if there is no
+ * timer for it. */
+gboolean gst_wasapi_spin_init (GstWasapiSpin * spin, GstClockTime period);
+
+void gst_wasapi_spin_clear (GstWasapiSpin * spin);
+
+/* The client stopped, the next wait is for its event */
+void gst_wasapi_spin_reset (GstWasapiSpin * spin);
+
+/* Like WaitForMultipleObjects() on the @n_handles @handles, the first of
+ * them the event of the client. WAIT_OBJECT_0 once @ready says the client
+ * is ready, the index of another handle that was signalled, WAIT_TIMEOUT
+ * after @timeout_ms or WAIT_FAILED. */
+DWORD gst_wasapi_spin_wait (GstWasapiSpin * spin, const HANDLE * handles,
+    DWORD n_handles, GstWasapiSpinReadyFunc ready, gpointer user_data,
+    DWORD timeout_ms);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SPIN_H__ */
@@ -0,0 +1,303 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapisplice.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Crossfade length, 1ms */
+#define CROSSFADE_RATE_DIVISOR 1000
+/* Fade in length, 5ms */
+#define FADE_IN_RATE_DIVISOR 200
+/* Fade out and back in around a seam, 2ms each */
+#define SEAM_FADE_RATE_DIVISOR 500
+
+#define DEFINE_CROSSFADE(type,name,round) \
+static void \
+crossfade_##name (gpointer out, gconstpointer from, gconstpointer to, \
+    gint frames, gint channels) \
+{ \
+  type *o = out; \
+  const type *a = from, *b = to; \
+  gint i, c; \
+  \
+  for (i = 0; i < frames; i++) { \
+    gdouble w = (gdouble) (i + 1) / (frames + 1); \
+    \
+    for (c = 0; c < channels; c++, o++, a++, b++) \
+      *o = (type) (*a + (*b - (gdouble) *a) * w round); \
+  } \
+}
+
+DEFINE_CROSSFADE (gint16, s16, +0.5)
+DEFINE_CROSSFADE (gint32, s32, +0.5)
+DEFINE_CROSSFADE (gfloat, f32,)
+DEFINE_CROSSFADE (gdouble, f64,)
+
+/* Sum of the squared samples of each frame */
+#define DEFINE_ENERGY(type,name) \
+static void \
+energy_##name (gdouble * out, gconstpointer in, gint frames, gint channels) \
+{ \
+  const type *a = in; \
+  gint i, c; \
+  \
+  for (i = 0; i < frames; i++) { \
+    gdouble e = 0; \
+    \
+    for (c = 0; c < channels; c++, a++) \
+      e += (gdouble) *a * *a; \
+    out[i] = e; \
+  } \
+}
+
+DEFINE_ENERGY (gint16, s16)
+DEFINE_ENERGY (gint32, s32)
+DEFINE_ENERGY (gfloat, f32)
+DEFINE_ENERGY (gdouble, f64)
+
+typedef void (*CrossfadeFunc) (gpointer out, gconstpointer from,
+    gconstpointer to, gint frames, gint channels);
+
+typedef void (*EnergyFunc) (gdouble * out, gconstpointer in, gint frames,
+    gint channels);
+
+static CrossfadeFunc
+get_crossfade_func (GstAudioFormat format)
+{
+  switch (format) {
+    case GST_AUDIO_FORMAT_S16:
+      return crossfade_s16;
+    case GST_AUDIO_FORMAT_S32:
+      return crossfade_s32;
+    case GST_AUDIO_FORMAT_F32:
+      return crossfade_f32;
+    case GST_AUDIO_FORMAT_F64:
+      return crossfade_f64;
+    default:
+      return NULL;
+  }
+}
+
+static EnergyFunc
+get_energy_func (GstAudioFormat format)
+{
+  switch (format) {
+    case GST_AUDIO_FORMAT_S16:
+      return energy_s16;
+    case GST_AUDIO_FORMAT_S32:
+      return energy_s32;
+    case GST_AUDIO_FORMAT_F32:
+      return energy_f32;
+    case GST_AUDIO_FORMAT_F64:
+      return energy_f64;
+    default:
+      return NULL;
+  }
+}
+
+/* Start of the quietest @window frames of @in, at least @margin frames
+ * away from both ends so the seam stays inside the buffer. @e is the
+ * caller's scratch for @e_frames energies, the middle is used if @in
+ * doesn't fit. */
+static gint
+find_quiet_point (const guint8 * in, const GstAudioInfo * info,
+    gint in_frames, gint window, gint margin, gdouble * e, gint e_frames)
+{
+  EnergyFunc energy = get_energy_func (GST_AUDIO_INFO_FORMAT (info));
+  gint first = margin, last = in_frames - window - margin;
+  gint i, best;
+  gdouble sum, best_sum;
+
+  if (energy == NULL || last <= first || e == NULL || in_frames > e_frames)
+    return (in_frames - window) / 2;
+
+  energy (e, in, in_frames, GST_AUDIO_INFO_CHANNELS (info));
+
+  sum = 0;
+  for (i = first; i < first + window; i++)
+    sum += e[i];
+
+  best = first;
+  best_sum = sum;
+  for (i = first + 1; i <= last; i++) {
+    sum += e[i + window - 1] - e[i - 1];
+    if (sum < best_sum) {
+      best_sum = sum;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
+static gint
+splice_frames (GstBuffer * buf, const GstAudioInfo * info, gint frames,
+    gdouble * energy, gint energy_frames, GstBuffer ** outbuf)
+{
+  CrossfadeFunc crossfade = get_crossfade_func (GST_AUDIO_INFO_FORMAT (info));
+  gint bpf = GST_AUDIO_INFO_BPF (info);
+  gint channels = GST_AUDIO_INFO_CHANNELS (info);
+  gint fade, in_frames, n, pos;
+  GstBuffer *out;
+  GstMapInfo in_map, out_map;
+  const guint8 *in;
+  guint8 *o;
+
+  in_frames = gst_buffer_get_size (buf) / bpf;
+  fade = crossfade ? MAX (GST_AUDIO_INFO_RATE (info) /
+      CROSSFADE_RATE_DIVISOR, 1) : 0;
+  fade = MIN (fade, in_frames / 2);
+
+  /* The seam and its crossfade have to fit in the buffer */
+  n = MIN (ABS (frames), in_frames - fade);
+  if (n <= 0) {
+    *outbuf = buf;
+    return 0;
+  }
+
+  gst_buffer_map (buf, &in_map, GST_MAP_READ);
+  in = in_map.data;
+
+  /* Splice in the middle, away from the neighbouring buffers, or where it
+   * is least audible. Keep a crossfade length to the buffer edges. */
+  if (energy != NULL)
+    pos = find_quiet_point (in, info, in_frames, n + fade, fade, energy,
+        energy_frames);
+  else
+    pos = (in_frames - n - fade) / 2;
+
+  out = gst_buffer_new_allocate (NULL,
+      (gsize) (frames > 0 ? in_frames + n : in_frames - n) * bpf, NULL);
+  gst_buffer_copy_into (out, buf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META, 0, -1);
+
+  gst_buffer_map (out, &out_map, GST_MAP_WRITE);
+  o = out_map.data;
+
+  if (frames > 0) {
+    /* Play @n frames before the seam twice */
+    memcpy (o, in, (gsize) (pos + n) * bpf);
+    o += (gsize) (pos + n) * bpf;
+    if (fade > 0)
+      crossfade (o, in + (gsize) (pos + n) * bpf, in + (gsize) pos * bpf,
+          fade, channels);
+    o += (gsize) fade *bpf;
+    memcpy (o, in + (gsize) (pos + fade) * bpf,
+        (gsize) (in_frames - pos - fade) * bpf);
+  } else {
+    /* Skip @n frames after the seam */
+    memcpy (o, in, (gsize) pos * bpf);
+    o += (gsize) pos *bpf;
+    if (fade > 0)
+      crossfade (o, in + (gsize) pos * bpf, in + (gsize) (pos + n) * bpf,
+          fade, channels);
+    o += (gsize) fade *bpf;
+    memcpy (o, in + (gsize) (pos + n + fade) * bpf,
+        (gsize) (in_frames - pos - n - fade) * bpf);
+  }
+
+  gst_buffer_unmap (out, &out_map);
+  gst_buffer_unmap (buf, &in_map);
+  gst_buffer_unref (buf);
+
+  GST_LOG ("%s %d frames at frame %d", frames > 0 ? "inserted" : "dropped",
+      n, pos);
+
+  *outbuf = out;
+  return frames > 0 ? n : -n;
+}
+
+gint
+gst_wasapi_splice_frames (GstBuffer * buf, const GstAudioInfo * info,
+    gint frames, GstBuffer ** outbuf)
+{
+  return splice_frames (buf, info, frames, NULL, 0, outbuf);
+}
+
+gint
+gst_wasapi_splice_frames_quiet (GstBuffer * buf, const GstAudioInfo * info,
+    gint frames, gdouble * energy, gint energy_frames, GstBuffer ** outbuf)
+{
+  return splice_frames (buf, info, frames, energy, energy_frames, outbuf);
+}
+
+gboolean
+gst_wasapi_fade_in (GstBuffer * buf, const GstAudioInfo * info)
+{
+  CrossfadeFunc crossfade = get_crossfade_func (GST_AUDIO_INFO_FORMAT (info));
+  gint bpf = GST_AUDIO_INFO_BPF (info);
+  gint fade;
+  GstMapInfo map;
+  guint8 *zeroes;
+
+  if (crossfade == NULL || !gst_buffer_is_writable (buf) ||
+      !gst_buffer_map (buf, &map, GST_MAP_READWRITE))
+    return FALSE;
+
+  fade = MAX (GST_AUDIO_INFO_RATE (info) / FADE_IN_RATE_DIVISOR, 1);
+  fade = MIN (fade, (gint) (map.size / bpf));
+
+  /* All formats we fade are signed, so zeroes are silence */
+  zeroes = g_malloc0 ((gsize) fade * bpf);
+  crossfade (map.data, zeroes, map.data, fade,
+      GST_AUDIO_INFO_CHANNELS (info));
+  g_free (zeroes);
+
+  gst_buffer_unmap (buf, &map);
+
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_fade_seam (GstBuffer * buf, const GstAudioInfo * info, gint frame)
+{
+  CrossfadeFunc crossfade = get_crossfade_func (GST_AUDIO_INFO_FORMAT (info));
+  gint bpf = GST_AUDIO_INFO_BPF (info);
+  gint channels = GST_AUDIO_INFO_CHANNELS (info);
+  gint fade, frames, out, in;
+  GstMapInfo map;
+  guint8 *zeroes;
+
+  if (crossfade == NULL || !gst_buffer_is_writable (buf) ||
+      !gst_buffer_map (buf, &map, GST_MAP_READWRITE))
+    return FALSE;
+
+  frames = map.size / bpf;
+  frame = CLAMP (frame, 0, frames);
+  fade = MAX (GST_AUDIO_INFO_RATE (info) / SEAM_FADE_RATE_DIVISOR, 1);
+  out = MIN (fade, frame);
+  in = MIN (fade, frames - frame);
+
+  zeroes = g_malloc0 ((gsize) fade * bpf);
+  crossfade (map.data + (gsize) (frame - out) * bpf,
+      map.data + (gsize) (frame - out) * bpf, zeroes, out, channels);
+  crossfade (map.data + (gsize) frame * bpf, zeroes,
+      map.data + (gsize) frame * bpf, in, channels);
+  g_free (zeroes);
+
+  gst_buffer_unmap (buf, &map);
+
+  return TRUE;
+}
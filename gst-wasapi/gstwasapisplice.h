@@ -0,0 +1,50 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_SPLICE_H__
+#define __GST_WASAPI_SPLICE_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* Inserts (@frames > 0) or drops (@frames < 0) frames in the middle of
+ * @buf, crossfading over the seam so it can't be heard. At most as many as
+ * fit next to the crossfade are spliced, returns how many that were.
+ * Takes ownership of @buf and returns the new buffer in @outbuf. */
+gint gst_wasapi_splice_frames (GstBuffer * buf, const GstAudioInfo * info,
+    gint frames, GstBuffer ** outbuf);
+
+/* Same, but splices at the quietest point of @buf instead of the middle.
+ * @energy is scratch for @energy_frames values that the caller allocates
+ * once, buffers longer than that are spliced in the middle. */
+gint gst_wasapi_splice_frames_quiet (GstBuffer * buf,
+    const GstAudioInfo * info, gint frames, gdouble * energy,
+    gint energy_frames, GstBuffer ** outbuf);
+
+/* Fades @buf in from silence over its first few ms, in place. FALSE if
+ * the format can't be faded or @buf isn't writable. */
+gboolean gst_wasapi_fade_in (GstBuffer * buf, const GstAudioInfo * info);
+
+/* Fades @buf out to silence over the few ms before @frame and back in
+ * over those after it, in place, to hide the seam between two streams */
+gboolean gst_wasapi_fade_seam (GstBuffer * buf, const GstAudioInfo * info,
+    gint frame);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SPLICE_H__ */
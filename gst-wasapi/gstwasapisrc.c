@@ -41,6 +41,13 @@
 #endif
 
 #include "gstwasapisrc.h"
+#include "gstwasapitrace.h"
+#include "gstwasapitracer.h"
+#include "gstwasapisplice.h"
+#include "gstwasapidevicecache.h"
+#include "gstwasapinotify.h"
+#include "gstwasapiautotune.h"
+#include "gstwasapisrcringbuffer.h"
 
 #include <gst/gst.h>
 #include <avrt.h>
@@ -73,37 +80,245 @@ GST_DEBUG_CATEGORY_STATIC (gst_wasapi_src_debug);
 static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS));
+    GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS "; "
+        "audio/x-raw, "
+        "format = (string) " GST_AUDIO_FORMATS_ALL ", "
+        "layout = (string) non-interleaved, "
+        "rate = " GST_AUDIO_RATE_RANGE ", "
+        "channels = " GST_AUDIO_CHANNELS_RANGE));
+
+static GstStaticPadTemplate fanout_template = GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) " GST_AUDIO_FORMATS_ALL ", "
+        "layout = (string) interleaved, "
+        "rate = " GST_AUDIO_RATE_RANGE ", "
+        "channels = " GST_AUDIO_CHANNELS_RANGE));
 
 #define DEFAULT_ROLE          GST_WASAPI_DEVICE_ROLE_CONSOLE
 #define DEFAULT_LOOPBACK      FALSE
 #define DEFAULT_EXCLUSIVE     FALSE
 #define DEFAULT_LOW_LATENCY   FALSE
 #define DEFAULT_AUDIOCLIENT3  FALSE
-/* The clock provided by WASAPI is always off and causes buffers to be late
- * very quickly on the sink. Disable pending further investigation. */
-#define DEFAULT_PROVIDE_CLOCK FALSE
+#define DEFAULT_RAW           FALSE
+#define DEFAULT_CATEGORY      GST_WASAPI_STREAM_CATEGORY_OTHER
+#define DEFAULT_COMMUNICATIONS_EFFECTS FALSE
+#define DEFAULT_ADAPTIVE_BUFFER FALSE
+#define DEFAULT_AUTO_TUNE     FALSE
+#define DEFAULT_LOCK_MEMORY   FALSE
+#define DEFAULT_SHM_NAME      NULL
+#define DEFAULT_EMIT_PACKETS  FALSE
+#define DEFAULT_REPLAY_DURATION 0
+#define DEFAULT_RECORD_LOCATION NULL
+#define DEFAULT_RECORD_MAX_SIZE 0
+#define DEFAULT_RECORD_MAX_TIME 0
+#define DEFAULT_PREROLL_TIME  0
+#define DEFAULT_OUTPUT_FRAMES 0
+#define DEFAULT_TARGET_PID    0
+#define DEFAULT_TARGET_MODE   GST_WASAPI_TARGET_MODE_INCLUDE
+#define DEFAULT_ZERO_COPY     FALSE
+#define DEFAULT_DIRECT        FALSE
+#define DEFAULT_AUTOCONVERT   FALSE
+#define DEFAULT_MATCH_FORMAT  FALSE
+#define DEFAULT_DITHER        FALSE
+#define DEFAULT_CHANNELS      0
+#define DEFAULT_CHANNEL_SELECT NULL
+#define DEFAULT_LEVEL         GST_WASAPI_LEVEL_MODE_NONE
+#define DEFAULT_LEVEL_INTERVAL (100 * GST_MSECOND)
+#define DEFAULT_SPECTRUM      FALSE
+#define DEFAULT_SPECTRUM_BANDS 32
+#define DEFAULT_SPECTRUM_INTERVAL (50 * GST_MSECOND)
+#define DEFAULT_VAD           FALSE
+#define DEFAULT_VAD_THRESHOLD -50.0
+#define DEFAULT_VAD_HANGOVER  (300 * GST_MSECOND)
+#define DEFAULT_DETECT_SILENCE FALSE
+#define DEFAULT_SILENCE_THRESHOLD -144.0
+#define DEFAULT_PREWARM       FALSE
+#define DEFAULT_FOLLOW_DEFAULT FALSE
+#define DEFAULT_STREAM_ROUTING FALSE
+#define DEFAULT_MMCSS_TASK    GST_WASAPI_DEFAULT_MMCSS_TASK
+#define DEFAULT_MMCSS_PRIORITY GST_WASAPI_MMCSS_PRIORITY_NORMAL
+#define DEFAULT_THREAD_AFFINITY 0
+#define DEFAULT_PROCESSOR_GROUP 0
+#define DEFAULT_POWER_THROTTLING TRUE
+#define DEFAULT_PERFORMANCE_CORES FALSE
+#define DEFAULT_SHARED_ENGINE FALSE
+#define DEFAULT_SHARE_CLIENT  FALSE
+#define DEFAULT_RTWQ          FALSE
+#define DEFAULT_SCHEDULING    GST_WASAPI_SCHEDULING_EVENT
+#define DEFAULT_LATENCY_PROBE FALSE
+#define DEFAULT_AEC_REFERENCE FALSE
+#define DEFAULT_REFERENCE_TIMESTAMP_META FALSE
+#define DEFAULT_GLITCH_INTERVAL GST_SECOND
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_ETW_ATTRIBUTION FALSE
+#define DEFAULT_PACKET_LOG    NULL
+#define DEFAULT_HEALTH_INTERVAL 0
+#define DEFAULT_HIGH_WATERMARK 0
+#define DEFAULT_LOW_WATERMARK 25
+#define DEFAULT_KEEP_RUNNING  FALSE
+#define DEFAULT_ON_DEMAND     FALSE
+#define DEFAULT_ASYNC_OPEN    FALSE
+#define DEFAULT_LIST_THRESHOLD 0
+#define DEFAULT_LOCKLESS_HANDOFF FALSE
+#define DEFAULT_FAST_START    FALSE
+
+/* Don't fill device position gaps larger than this many seconds with
+ * silence, something else went wrong then (e.g. the device was reset) */
+#define MAX_GAP_FILL_SECONDS  1
+/* How often a lost device is looked for again, in microseconds */
+#define OUTAGE_RETRY_INTERVAL (100 * 1000)
+/* The clock provided by WASAPI used to be off and make buffers late very
+ * quickly on the sink. It is interpolated now, but stays opt-in. */
+#define DEFAULT_DEVICE_CLOCK  FALSE
 #define DEFAULT_DRIFT_CORRECTION_THRESHOLD  50 * 1000000 // 50ms
+#define DEFAULT_DRIFT_CORRECTION_METHOD GST_WASAPI_DRIFT_CORRECTION_RESAMPLE
+#define DEFAULT_CALIBRATION_FILE NULL
+#define DEFAULT_CATCHUP_POLICY GST_WASAPI_CATCHUP_DISCONT
+#define DEFAULT_TIMESTAMP_MODE GST_WASAPI_TIMESTAMP_MODE_DEVICE
+/* Of the timestamp DLL, in Hz: follows a rate change within seconds while
+ * averaging the jitter over many packets */
+#define DLL_BANDWIDTH 0.2
+/* Don't bother the engine with rate changes smaller than this */
+#define ENGINE_RATE_STEP_PPM 0.2
+/* How often create() reads the pipeline clock when slaved with the skew
+ * algorithm, extrapolating in between */
+#define CLOCK_CALIBRATION_INTERVAL (100 * GST_MSECOND)
+
+/* Indices into stream_counters and capture_counters */
+enum
+{
+  STREAM_COUNTER_TIMESHIFTED,
+  STREAM_COUNTER_DRIFT_CORRECTIONS
+};
+
+enum
+{
+  CAPTURE_COUNTER_GAPS,
+  CAPTURE_COUNTER_GAP_FRAMES
+};
+
+/* Into create_counters, the time in QPC units */
+enum
+{
+  CREATE_COUNTER_BUFFERS,
+  CREATE_COUNTER_TICKS,
+  CREATE_COUNTER_TICKS_MAX
+};
+
+enum
+{
+  SIGNAL_EXPORT_REPLAY,
+  SIGNAL_SAVE_REPLAY,
+  SIGNAL_NEW_PACKET,
+  LAST_SIGNAL
+};
+
+static guint gst_wasapi_src_signals[LAST_SIGNAL] = { 0 };
 
 enum
 {
   PROP_0,
   PROP_ROLE,
   PROP_DEVICE,
+  PROP_DEVICE_NAME,
   PROP_LOOPBACK,
   PROP_EXCLUSIVE,
   PROP_LOW_LATENCY,
   PROP_AUDIOCLIENT3,
+  PROP_RAW,
+  PROP_CATEGORY,
+  PROP_COMMUNICATIONS_EFFECTS,
+  PROP_ADAPTIVE_BUFFER,
+  PROP_AUTO_TUNE,
+  PROP_LOCK_MEMORY,
+  PROP_SHM_NAME,
+  PROP_EMIT_PACKETS,
+  PROP_REPLAY_DURATION,
+  PROP_RECORD_LOCATION,
+  PROP_RECORD_MAX_SIZE,
+  PROP_RECORD_MAX_TIME,
+  PROP_PREROLL_TIME,
+  PROP_OUTPUT_FRAMES,
+  PROP_TARGET_PID,
+  PROP_TARGET_MODE,
   PROP_RESTART_REQUIRED,
   PROP_SAMPLE_RATE,
   PROP_DEVICE_DESCRIPTION,
   PROP_TIMESHIFTED_COUNT,
   PROP_DRIFT_CORRECTION_COUNT,
   PROP_DRIFT_CORRECTION_THRESHOLD,
+  PROP_DRIFT_CORRECTION_METHOD,
+  PROP_CALIBRATION_FILE,
+  PROP_CATCHUP_POLICY,
+  PROP_TIMESTAMP_MODE,
+  PROP_ZERO_COPY,
+  PROP_DIRECT,
+  PROP_GAP_COUNT,
+  PROP_GAP_FRAMES,
+  PROP_DEVICE_CLOCK,
+  PROP_DRIFT_PPM,
+  PROP_STATS,
+  PROP_STARTUP_TIMES,
+  PROP_OS_EFFECTS,
+  PROP_AUTOCONVERT,
+  PROP_MATCH_FORMAT,
+  PROP_DITHER,
+  PROP_CHANNELS,
+  PROP_CHANNEL_SELECT,
+  PROP_LEVEL,
+  PROP_LEVEL_INTERVAL,
+  PROP_SPECTRUM,
+  PROP_SPECTRUM_BANDS,
+  PROP_SPECTRUM_INTERVAL,
+  PROP_VAD,
+  PROP_VAD_THRESHOLD,
+  PROP_VAD_HANGOVER,
+  PROP_DETECT_SILENCE,
+  PROP_SILENCE_THRESHOLD,
+  PROP_PREWARM,
+  PROP_FOLLOW_DEFAULT,
+  PROP_STREAM_ROUTING,
+  PROP_DEVICE_LIST,
+  PROP_MMCSS_TASK,
+  PROP_MMCSS_PRIORITY,
+  PROP_THREAD_AFFINITY,
+  PROP_PROCESSOR_GROUP,
+  PROP_POWER_THROTTLING,
+  PROP_PERFORMANCE_CORES,
+  PROP_SHARED_ENGINE,
+  PROP_SHARE_CLIENT,
+  PROP_RTWQ,
+  PROP_SCHEDULING,
+  PROP_LATENCY_PROBE,
+  PROP_AEC_REFERENCE,
+  PROP_REFERENCE_TIMESTAMP_META,
+  PROP_GLITCH_INTERVAL,
+  PROP_STATS_INTERVAL,
+  PROP_ETW_ATTRIBUTION,
+  PROP_PACKET_LOG,
+  PROP_HEALTH_INTERVAL,
+  PROP_RING_FILL,
+  PROP_OVERFLOW_FILL,
+  PROP_HIGH_WATERMARK,
+  PROP_LOW_WATERMARK,
+  PROP_KEEP_RUNNING,
+  PROP_ON_DEMAND,
+  PROP_ASYNC_OPEN,
+  PROP_LIST_THRESHOLD,
+  PROP_LOCKLESS_HANDOFF,
+  PROP_FAST_START,
 };
 
+static gboolean gst_wasapi_src_decide_allocation (GstBaseSrc * bsrc,
+    GstQuery * query);
 static GstFlowReturn gst_audio_base_src_create (GstBaseSrc * bsrc,
     guint64 offset, guint length, GstBuffer ** buf);
+static GstFlowReturn gst_wasapi_src_create (GstBaseSrc * bsrc,
+    guint64 offset, guint length, GstBuffer ** buf);
+static GstAudioRingBuffer *gst_wasapi_src_create_ringbuffer (GstAudioBaseSrc *
+    src);
 
 static void gst_wasapi_src_dispose (GObject * object);
 static void gst_wasapi_src_finalize (GObject * object);
@@ -112,7 +327,18 @@ static void gst_wasapi_src_set_property (GObject * object, guint prop_id,
 static void gst_wasapi_src_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
 
+static gboolean gst_wasapi_src_query (GstBaseSrc * bsrc, GstQuery * query);
+static gboolean gst_wasapi_src_event (GstBaseSrc * bsrc, GstEvent * event);
 static GstCaps *gst_wasapi_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter);
+static gboolean gst_wasapi_src_unlock (GstBaseSrc * bsrc);
+static gboolean gst_wasapi_src_set_clock (GstElement * element,
+    GstClock * clock);
+static GstStateChangeReturn gst_wasapi_src_change_state (GstElement * element,
+    GstStateChange transition);
+static gboolean gst_wasapi_src_unlock_stop (GstBaseSrc * bsrc);
+static GstPad *gst_wasapi_src_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_wasapi_src_release_pad (GstElement * element, GstPad * pad);
 
 static gboolean gst_wasapi_src_open (GstAudioSrc * asrc);
 static gboolean gst_wasapi_src_close (GstAudioSrc * asrc);
@@ -122,14 +348,28 @@ static gboolean gst_wasapi_src_unprepare (GstAudioSrc * asrc);
 static guint gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data,
     guint length, GstClockTime * timestamp);
 static guint gst_wasapi_src_delay (GstAudioSrc * asrc);
+static guint gst_wasapi_src_overflow_pop (GstWasapiSrc * self, guint8 * data,
+    guint length, gboolean reorder);
 static void gst_wasapi_src_reset (GstAudioSrc * asrc);
+static void gst_wasapi_src_reset_client (GstWasapiSrc * self, gboolean stop);
+static void gst_wasapi_src_release_warm_client (GstWasapiSrc * self);
+static void gst_wasapi_src_request_period_change (GstWasapiSrc * self);
+static void gst_wasapi_src_request_device_change (GstWasapiSrc * self,
+    const gchar * id);
+static void gst_wasapi_src_stop_drain (GstWasapiSrc * self);
+static gboolean gst_wasapi_src_finish_open (GstWasapiSrc * self);
+static void gst_wasapi_src_update_fill (GstWasapiSrc * self);
+static void gst_wasapi_src_clear_clock_adjust (GstWasapiSrc * self);
 
-#ifdef DEFAULT_PROVIDE_CLOCK
 static GstClockTime gst_wasapi_src_get_time (GstClock * clock,
     gpointer user_data);
-#endif
 
 #define gst_wasapi_src_parent_class parent_class
+static GstBuffer *gst_wasapi_src_export_replay (GstWasapiSrc * self,
+    guint64 start, guint64 stop);
+static gboolean gst_wasapi_src_save_replay (GstWasapiSrc * self,
+    guint64 start, guint64 stop, const gchar * path);
+
 G_DEFINE_TYPE (GstWasapiSrc, gst_wasapi_src, GST_TYPE_AUDIO_SRC);
 
 static void
@@ -138,6 +378,8 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
   GstBaseSrcClass *gstbasesrc_class = GST_BASE_SRC_CLASS (klass);
+  GstAudioBaseSrcClass *gstaudiobasesrc_class =
+      GST_AUDIO_BASE_SRC_CLASS (klass);
   GstAudioSrcClass *gstaudiosrc_class = GST_AUDIO_SRC_CLASS (klass);
 
   gobject_class->dispose = gst_wasapi_src_dispose;
@@ -145,7 +387,9 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
   gobject_class->set_property = gst_wasapi_src_set_property;
   gobject_class->get_property = gst_wasapi_src_get_property;
 
-  gstbasesrc_class->create = GST_DEBUG_FUNCPTR (gst_audio_base_src_create);
+  gstbasesrc_class->create = GST_DEBUG_FUNCPTR (gst_wasapi_src_create);
+  gstaudiobasesrc_class->create_ringbuffer =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_create_ringbuffer);
 
   g_object_class_install_property (gobject_class,
       PROP_ROLE,
@@ -157,9 +401,17 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
   g_object_class_install_property (gobject_class,
       PROP_DEVICE,
       g_param_spec_string ("device", "Device",
-          "WASAPI playback device as a GUID string",
+          "WASAPI playback device as a GUID string. Shared mode streams move "
+          "to a new one while running",
           NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE_NAME,
+      g_param_spec_string ("device-name", "Device name",
+          "Friendly name of the capture device, or a glob pattern like "
+          "\"*USB*\" for it, when device is unset", NULL, G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+
   g_object_class_install_property (gobject_class,
       PROP_LOOPBACK,
       g_param_spec_boolean ("loopback", "Loopback recording",
@@ -175,15 +427,216 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
   g_object_class_install_property (gobject_class,
       PROP_LOW_LATENCY,
       g_param_spec_boolean ("low-latency", "Low latency",
-          "Optimize all settings for lowest latency. Always safe to enable.",
+          "Optimize all settings for lowest latency. Always safe to enable. "
+          "Changes the period while running with AudioClient3 in shared mode",
           DEFAULT_LOW_LATENCY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   g_object_class_install_property (gobject_class,
       PROP_AUDIOCLIENT3,
       g_param_spec_boolean ("use-audioclient3", "Use the AudioClient3 API",
-          "Whether to use the Windows 10 AudioClient3 API when available",
+          "Whether to use the Windows 10 AudioClient3 API when available. "
+          "Always tried for low-latency loopback capture",
           DEFAULT_AUDIOCLIENT3, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+      PROP_RAW,
+      g_param_spec_boolean ("raw", "Raw",
+          "Capture without the effects of the endpoint, like noise "
+          "suppression and gain control, for lower latency and unprocessed "
+          "input. Only in shared mode, Windows 10 and newer", DEFAULT_RAW,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CATEGORY,
+      g_param_spec_enum ("category", "Category",
+          "Category of the stream, which decides about ducking and the "
+          "processing of the endpoint. Only in shared mode, Windows 10 and "
+          "newer", GST_WASAPI_TYPE_STREAM_CATEGORY, DEFAULT_CATEGORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_COMMUNICATIONS_EFFECTS,
+      g_param_spec_boolean ("communications-effects", "Communications effects",
+          "Ask for the communications processing of the endpoint: the stream "
+          "gets the communications category unless category is set, and the "
+          "echo cancellation, noise suppression and gain control of the OS "
+          "are turned on where it lets us (Windows 11). See os-effects for "
+          "what it runs. Only in shared mode without loopback or raw, takes "
+          "effect when prepared", DEFAULT_COMMUNICATIONS_EFFECTS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ADAPTIVE_BUFFER,
+      g_param_spec_boolean ("adaptive-buffer", "Adaptive buffer",
+          "Start with the smallest ringbuffer and grow it when wakeup "
+          "jitter or overruns come close to the limit, shrinking it again "
+          "after a stable minute. Learned per endpoint, a new size takes "
+          "effect with the next prepare",
+          DEFAULT_ADAPTIVE_BUFFER, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_AUTO_TUNE,
+      g_param_spec_boolean ("auto-tune", "Auto tune",
+          "Pick exclusive, low-latency and audioclient3 by streaming each "
+          "combination the endpoint accepts for a moment the first time it's "
+          "opened, and keeping the one with the lowest latency that didn't "
+          "glitch. Remembered per endpoint in the user cache directory, "
+          "overrides these properties",
+          DEFAULT_AUTO_TUNE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LOCK_MEMORY,
+      g_param_spec_boolean ("lock-memory", "Lock memory",
+          "Lock the ringbuffer and overflow buffer in RAM and fault them in "
+          "when preparing, so capturing never waits for a page fault after "
+          "the working set was trimmed. Grows the minimum working set of the "
+          "process by their size",
+          DEFAULT_LOCK_MEMORY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SHM_NAME,
+      g_param_spec_string ("shm-name", "Shared memory name",
+          "Also copy every packet from the endpoint buffer into a shared "
+          "memory ring of this name, for another process to read without a "
+          "pipeline. See gstwasapishm.h for the layout",
+          DEFAULT_SHM_NAME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_EMIT_PACKETS,
+      g_param_spec_boolean ("emit-packets", "Emit packets",
+          "Emit new-packet for every packet from the endpoint buffer, on the "
+          "I/O thread and without copying it. Off by default since that is "
+          "a signal emission per packet", DEFAULT_EMIT_PACKETS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_REPLAY_DURATION,
+      g_param_spec_uint64 ("replay-duration", "Replay duration",
+          "Keep this much of the pushed audio in memory (in nanoseconds, 0 "
+          "= off), for the export-replay and save-replay actions. Takes "
+          "effect with the next prepare",
+          0, G_MAXUINT64, DEFAULT_REPLAY_DURATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RECORD_LOCATION,
+      g_param_spec_string ("record-location", "Record location",
+          "Also record every packet, raw and with a timestamp index, into "
+          "memory mapped files at this location. A directive like %05d or "
+          "%u is replaced by the file number and %% is a percent sign, no "
+          "other directives are allowed. See gstwasapirecord.h",
+          DEFAULT_RECORD_LOCATION, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RECORD_MAX_SIZE,
+      g_param_spec_uint64 ("record-max-size", "Record max size",
+          "Start a new recording file after this many bytes (0 = 1 GB)",
+          0, G_MAXUINT64, DEFAULT_RECORD_MAX_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RECORD_MAX_TIME,
+      g_param_spec_uint64 ("record-max-time", "Record max time",
+          "Start a new recording file after this much audio (in nanoseconds, "
+          "0 = only by size)",
+          0, G_MAXUINT64, DEFAULT_RECORD_MAX_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PREROLL_TIME,
+      g_param_spec_uint64 ("preroll-time", "Preroll time",
+          "Keep capturing in PAUSED and start PLAYING with this much of the "
+          "audio from before (in nanoseconds, 0 = disabled). Adds as much "
+          "latency. Not with direct or zero-copy, takes effect with the next "
+          "prepare",
+          0, 10 * GST_SECOND, DEFAULT_PREROLL_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_OUTPUT_FRAMES,
+      g_param_spec_uint ("output-frames", "Output frames",
+          "Frames in each buffer, to match the frame size of an encoder "
+          "downstream, like 960 for 20 ms Opus at 48 kHz or 1024 for AAC "
+          "(0 = one device period). Not with direct, zero-copy or the "
+          "resample slave method",
+          0, G_MAXINT / 64, DEFAULT_OUTPUT_FRAMES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstWasapiSrc::export-replay:
+   * @src: the wasapisrc
+   * @start: running time of the first frame, GST_CLOCK_TIME_NONE for the
+   *     oldest one kept
+   * @stop: running time to stop at, GST_CLOCK_TIME_NONE for the newest
+   *
+   * Copies what replay-duration kept of that range into one buffer, or
+   * returns NULL when nothing is.
+   */
+  gst_wasapi_src_signals[SIGNAL_EXPORT_REPLAY] =
+      g_signal_new ("export-replay", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstWasapiSrcClass, export_replay), NULL, NULL,
+      g_cclosure_marshal_generic, GST_TYPE_BUFFER, 2, G_TYPE_UINT64,
+      G_TYPE_UINT64);
+
+  /**
+   * GstWasapiSrc::save-replay:
+   * @src: the wasapisrc
+   * @start: like for export-replay
+   * @stop: like for export-replay
+   * @path: the WAV file to write
+   *
+   * Writes that range to a WAV file. FALSE if nothing is kept in it or the
+   * file can't be written.
+   */
+  gst_wasapi_src_signals[SIGNAL_SAVE_REPLAY] =
+      g_signal_new ("save-replay", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstWasapiSrcClass, save_replay), NULL, NULL,
+      g_cclosure_marshal_generic, G_TYPE_BOOLEAN, 3, G_TYPE_UINT64,
+      G_TYPE_UINT64, G_TYPE_STRING);
+
+  /**
+   * GstWasapiSrc::new-packet:
+   * @src: the wasapisrc
+   * @data: the packet in the endpoint buffer, read-only
+   * @frames: the number of frames in it
+   * @flags: the AUDCLNT_BUFFERFLAGS of it, @data is to be taken as silence
+   *     with AUDCLNT_BUFFERFLAGS_SILENT
+   * @qpcpos: the QPC position of the first frame, in 100 ns
+   *
+   * With emit-packets, emitted on the I/O thread for every packet that
+   * GetBuffer returns, before it is released. @data is only valid during
+   * the emission. The handler must neither block nor keep the pointer: the
+   * device keeps capturing into the endpoint buffer meanwhile and glitches
+   * once that is full, so copy out what is needed or do the little there is
+   * to do right there.
+   */
+  gst_wasapi_src_signals[SIGNAL_NEW_PACKET] =
+      g_signal_new ("new-packet", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_generic,
+      G_TYPE_NONE, 4, G_TYPE_POINTER, G_TYPE_UINT, G_TYPE_UINT,
+      G_TYPE_UINT64);
+
+  klass->export_replay = gst_wasapi_src_export_replay;
+  klass->save_replay = gst_wasapi_src_save_replay;
+
+  g_object_class_install_property (gobject_class,
+      PROP_TARGET_PID,
+      g_param_spec_uint ("target-pid", "Target PID",
+          "With loopback, capture the audio of this process and its "
+          "children instead of the whole endpoint, or everything else, see "
+          "target-mode. 0 for the endpoint. Only in shared mode, Windows 10 "
+          "2004 and newer, takes effect when going to READY", 0, G_MAXUINT,
+          DEFAULT_TARGET_PID, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_TARGET_MODE,
+      g_param_spec_enum ("target-mode", "Target mode",
+          "Whether target-pid selects the processes to capture or those to "
+          "leave out", GST_WASAPI_TYPE_TARGET_MODE, DEFAULT_TARGET_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property(gobject_class,
     PROP_RESTART_REQUIRED,
     g_param_spec_boolean("restart-required", "Should we restart plugin",
@@ -221,7 +674,549 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
           0, G_MAXUINT64, DEFAULT_DRIFT_CORRECTION_THRESHOLD,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+      PROP_DRIFT_CORRECTION_METHOD,
+      g_param_spec_enum ("drift-correction-method", "Drift correction method",
+          "How to follow the pipeline clock with slave-method=resample. "
+          "With splice the timeline stays continuous and no DISCONT is set "
+          "for drift below the drift correction threshold. With engine the "
+          "audio engine resamples shared mode streams at no cost to us. Takes "
+          "effect when the device is opened",
+          GST_WASAPI_TYPE_DRIFT_CORRECTION_METHOD,
+          DEFAULT_DRIFT_CORRECTION_METHOD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CALIBRATION_FILE,
+      g_param_spec_string ("calibration-file", "Calibration file",
+          "The rate measured for an endpoint is remembered for the process "
+          "and seeds the drift estimate of its next stream, so correction "
+          "starts out locked. Also keep it in this key file, read when "
+          "prepared and updated when unprepared, for the next processes. "
+          "Takes effect when prepared", DEFAULT_CALIBRATION_FILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CATCHUP_POLICY,
+      g_param_spec_enum ("catchup-policy", "Catch-up policy",
+          "What to do when downstream falls behind the ringbuffer. With fade "
+          "and compress the skipped audio is faded over instead of marked "
+          "DISCONT, compress also drops frames at quiet points of the "
+          "buffers while more than half the ringbuffer is behind",
+          GST_WASAPI_TYPE_CATCHUP_POLICY, DEFAULT_CATCHUP_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_TIMESTAMP_MODE,
+      g_param_spec_enum ("timestamp-mode", "Timestamp mode",
+          "What buffers are timestamped with. qpc and system run the QPC "
+          "capture time of the packets or the pipeline clock when a buffer "
+          "is taken through a delay locked loop over the frame position, so "
+          "the timestamps are smooth and monotonic without the scheduling "
+          "jitter. Not for what the resampler of slave-method=resample "
+          "timestamps itself. Takes effect when prepared",
+          GST_WASAPI_TYPE_TIMESTAMP_MODE, DEFAULT_TIMESTAMP_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ZERO_COPY,
+      g_param_spec_boolean ("zero-copy", "Zero-copy capture",
+          "Push WASAPI packets downstream without copying them. Buffers have "
+          "the size of the device packets and must be released promptly, "
+          "since the device can't deliver more data until they are",
+          DEFAULT_ZERO_COPY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DIRECT,
+      g_param_spec_boolean ("direct", "Direct capture",
+          "Push one buffer per WASAPI packet from the streaming thread instead "
+          "of going through the ringbuffer thread. Lowers latency by about a "
+          "segment, buffer sizes follow the device packets. Implied by "
+          "zero-copy", DEFAULT_DIRECT, G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_GAP_COUNT,
+      g_param_spec_uint64 ("gap-count", "Gap count",
+          "Number of times the device position jumped, i.e. frames were lost",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_GAP_FRAMES,
+      g_param_spec_uint64 ("gap-frames", "Gap frames",
+          "Total number of lost frames that were replaced by silence",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE_CLOCK,
+      g_param_spec_boolean ("device-clock", "Device clock",
+          "Provide the clock of the endpoint, driven by the device position "
+          "and interpolated with the performance counter, instead of one "
+          "following the amount of samples read. Lets the device master the "
+          "pipeline without drift. All elements on the same endpoint, or on "
+          "endpoints of one device like the speakers of a USB headset, share "
+          "this clock", DEFAULT_DEVICE_CLOCK,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DRIFT_PPM,
+      g_param_spec_double ("drift-ppm", "Drift (ppm)",
+          "Estimated rate of the device against the pipeline clock, in parts "
+          "per million. Positive when the device runs fast, 0 until known",
+          -G_MAXDOUBLE, G_MAXDOUBLE, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STARTUP_TIMES,
+      g_param_spec_boxed ("startup-times", "Startup times",
+          "How long each phase of opening and starting the stream took, in "
+          "ns: enumerator, endpoint, activate, mix-format, initialize, "
+          "get-service, start, first-event and their total. Also posted as "
+          "wasapi-startup element message on the first device event",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_OS_EFFECTS,
+      g_param_spec_boxed ("os-effects", "OS effects",
+          "The effects the OS runs on the captured stream: echo-cancellation, "
+          "noise-suppression, automatic-gain-control and beamforming, TRUE "
+          "when on, and n-effects, the number of all. Also posted as "
+          "wasapi-effects element message when prepared. NULL when not "
+          "prepared, in exclusive mode, with loopback or before Windows 11, "
+          "where the OS doesn't tell",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Capture statistics: glitches, overflow-saved, overflow-dropped "
+          "(bytes), max-drain-iterations, wakeup-interval-min/avg/max (ns), "
+          "padding-high-water (frames), underruns, drift-ppm, and log2 "
+          "histograms (buckets in us) with p99/p999 (ns) of wakeup-interval "
+          "and buffer-hold, create-buffers and create-time-avg/max (ns) "
+          "spent on offsets and timestamps per buffer, and the CPU cycles "
+          "per second of audio of the device and streaming threads",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_AUTOCONVERT,
+      g_param_spec_boolean ("autoconvert", "Autoconvert",
+          "Offer any PCM rate and sample format and let the audio engine "
+          "convert the mix format to it. Only in shared mode, has to be set "
+          "before the device is opened", DEFAULT_AUTOCONVERT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MATCH_FORMAT,
+      g_param_spec_boolean ("match-format", "Match format",
+          "With autoconvert, have the audio engine switch the endpoint to the "
+          "rate and sample format of the stream when no other stream holds "
+          "it, instead of converting. Not for loopback. Windows 10 and newer",
+          DEFAULT_MATCH_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DITHER,
+      g_param_spec_boolean ("dither", "Dither",
+          "Apply TPDF dither when converting the float mix format to S16LE "
+          "ourselves", DEFAULT_DITHER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNELS,
+      g_param_spec_int ("channels", "Channels",
+          "Downmix a float mix format with more channels to this many while "
+          "reading, e.g. 2 for loopback of a 5.1 endpoint. 0 keeps the "
+          "channels of the mix format. Not with autoconvert, direct or "
+          "zero-copy, has to be set before the device is opened",
+          0, 64, DEFAULT_CHANNELS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_CHANNEL_SELECT,
+      g_param_spec_string ("channel-select", "Channel select",
+          "Only capture these device channels, numbered from 1 and comma "
+          "separated, e.g. \"3,4\". They go downstream unpositioned in that "
+          "order and are picked from each packet while reading, so the rest "
+          "never reaches the ringbuffer. Overrides channels. Not with "
+          "autoconvert, direct or zero-copy, has to be set before the device "
+          "is opened", DEFAULT_CHANNEL_SELECT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LEVEL,
+      g_param_spec_enum ("level", "Level",
+          "Post \"level\" element messages like the level element does, "
+          "measured from the samples while reading or taken from the meter "
+          "of the endpoint. Samples can't be measured with zero-copy. Has "
+          "to be set before the device is opened", GST_WASAPI_TYPE_LEVEL_MODE,
+          DEFAULT_LEVEL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LEVEL_INTERVAL,
+      g_param_spec_uint64 ("level-interval", "Level interval",
+          "Interval of the level messages, in nanoseconds", 1, G_MAXUINT64,
+          DEFAULT_LEVEL_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SPECTRUM,
+      g_param_spec_boolean ("spectrum", "Spectrum",
+          "Post \"wasapi-spectrum\" element messages with the magnitudes "
+          "of the channels mixed down, from one FFT of the latest samples "
+          "per interval. Not with zero-copy, has to be set before the "
+          "device is opened", DEFAULT_SPECTRUM,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SPECTRUM_BANDS,
+      g_param_spec_uint ("spectrum-bands", "Spectrum bands",
+          "Number of frequency bands of the spectrum messages, from 0 Hz up "
+          "to about half the rate", 2, 1024, DEFAULT_SPECTRUM_BANDS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SPECTRUM_INTERVAL,
+      g_param_spec_uint64 ("spectrum-interval", "Spectrum interval",
+          "Interval of the spectrum messages, in nanoseconds", 1,
+          G_MAXUINT64, DEFAULT_SPECTRUM_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_VAD,
+      g_param_spec_boolean ("vad", "Voice activity detection",
+          "Push segments without voice as GAP buffers of silence, so "
+          "downstream can skip encoding and sending them. Not with direct "
+          "or zero-copy, has to be set before the device is opened",
+          DEFAULT_VAD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_VAD_THRESHOLD,
+      g_param_spec_double ("vad-threshold", "VAD threshold",
+          "RMS level in dBFS above which a segment counts as voice",
+          -120.0, 0.0, DEFAULT_VAD_THRESHOLD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_VAD_HANGOVER,
+      g_param_spec_uint64 ("vad-hangover", "VAD hangover",
+          "How long voice is held after the level dropped below the "
+          "threshold, in nanoseconds", 0, G_MAXUINT64, DEFAULT_VAD_HANGOVER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DETECT_SILENCE,
+      g_param_spec_boolean ("detect-silence", "Detect silence",
+          "Treat packets with no sample above silence-threshold like the "
+          "ones the driver flags as silent, once they were for 50 ms, and "
+          "push them as GAP buffers. Has to be set before the device is "
+          "opened", DEFAULT_DETECT_SILENCE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SILENCE_THRESHOLD,
+      g_param_spec_double ("silence-threshold", "Silence threshold",
+          "Level in dBFS no sample of a silent packet is above. The default "
+          "only catches zeros and what is below the last bit of 24 bit "
+          "samples, -90 also catches the dither of 16 bit ones", -200.0, 0.0,
+          DEFAULT_SILENCE_THRESHOLD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PREWARM,
+      g_param_spec_boolean ("prewarm", "Prewarm",
+          "Keep the initialized client when going to READY, and start it "
+          "again right away if the caps and buffer sizes didn't change",
+          DEFAULT_PREWARM, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_FOLLOW_DEFAULT,
+      g_param_spec_boolean ("follow-default-device", "Follow default device",
+          "Switch to the new default device when it changes, instead of "
+          "posting a wasapi_restart message. Only in shared mode without "
+          "device-clock, and when no device is set",
+          DEFAULT_FOLLOW_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STREAM_ROUTING,
+      g_param_spec_boolean ("stream-routing", "Stream routing",
+          "Open the default device through the virtual default device, so "
+          "the audio engine moves the stream to a new default device by "
+          "itself, without reopening it or a wasapi_restart message. Only "
+          "in shared mode without loopback, auto-tune, device-clock or "
+          "share-client, and when neither device nor device-list is set. "
+          "Windows 10 and newer, otherwise the current default device is "
+          "opened. Has to be set before the device is opened",
+          DEFAULT_STREAM_ROUTING, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_DEVICE_LIST,
+      g_param_spec_string ("device-list", "Device list",
+          "Comma separated device IDs in order of preference. The first "
+          "available one is opened, read() fails over to the next one when "
+          "it disappears and moves back when a preferred one returns. "
+          "Overrides device, failing over needs shared mode without "
+          "device-clock", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MMCSS_TASK,
+      g_param_spec_string ("mmcss-task", "MMCSS task",
+          "Multimedia Class Scheduler task of the realtime thread, "
+          "e.g. \"Pro Audio\", \"Audio\" or \"Games\". Takes effect when "
+          "prepared", DEFAULT_MMCSS_TASK,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MMCSS_PRIORITY,
+      g_param_spec_enum ("mmcss-priority", "MMCSS priority",
+          "Priority of the realtime thread within its MMCSS task. Takes "
+          "effect when prepared", GST_WASAPI_TYPE_MMCSS_PRIORITY,
+          DEFAULT_MMCSS_PRIORITY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_THREAD_AFFINITY,
+      g_param_spec_uint64 ("thread-affinity", "Thread affinity",
+          "Mask of the processors within processor-group the realtime thread "
+          "may run on, 0 to not pin it. Takes effect when prepared",
+          0, G_MAXUINT64, DEFAULT_THREAD_AFFINITY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PROCESSOR_GROUP,
+      g_param_spec_uint ("processor-group", "Processor group",
+          "Processor group thread-affinity refers to", 0, G_MAXUINT16,
+          DEFAULT_PROCESSOR_GROUP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_POWER_THROTTLING,
+      g_param_spec_boolean ("power-throttling", "Power throttling",
+          "Let Windows throttle the realtime thread to save power (EcoQoS), "
+          "e.g. while the application is in the background. FALSE opts it "
+          "out. Takes effect when prepared", DEFAULT_POWER_THROTTLING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PERFORMANCE_CORES,
+      g_param_spec_boolean ("performance-cores", "Performance cores",
+          "Keep the realtime thread on the performance cores of a hybrid "
+          "CPU, through CPU sets. Nothing on CPUs with one kind of core. "
+          "Takes effect when prepared", DEFAULT_PERFORMANCE_CORES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SHARED_ENGINE,
+      g_param_spec_boolean ("shared-engine", "Shared engine",
+          "Let one process-wide realtime thread service the devices of all "
+          "sources with this set, instead of one thread each. Not with direct "
+          "or zero-copy, the MMCSS and affinity properties don't apply then. "
+          "Takes effect when prepared", DEFAULT_SHARED_ENGINE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SHARE_CLIENT,
+      g_param_spec_boolean ("share-client", "Share client",
+          "With shared-engine, capture from the stream of another source "
+          "with this set on the same endpoint, in the same format and with "
+          "the same buffer sizes, instead of opening one more. Only in shared "
+          "mode, not with device-clock, process loopback or prewarm. Takes "
+          "effect when prepared", DEFAULT_SHARE_CLIENT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RTWQ,
+      g_param_spec_boolean ("rtwq", "RTWQ",
+          "With shared-engine, service the device from a work item on the "
+          "MMCSS queue of the Real-Time Work Queue API instead of our capture "
+          "thread, where available (Windows 10). Takes effect when prepared",
+          DEFAULT_RTWQ, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_SCHEDULING,
+      g_param_spec_enum ("scheduling", "Scheduling",
+          "What wakes up the ringbuffer thread. timer wakes it every device "
+          "period and polls for packets, for idle loopback devices and "
+          "drivers that signal irregularly. power-saving wakes it once per "
+          "latency-time in shared mode, with segments that long and a shared "
+          "buffer of three, ignoring low-latency and use-audioclient3. Not "
+          "with shared-engine, direct or zero-copy. spin sleeps until "
+          "shortly before the next device period is due and then polls for "
+          "it, for wakeups within microseconds at the cost of a busy core. "
+          "Only in exclusive mode when a period is read as it is. Takes "
+          "effect when prepared", GST_WASAPI_TYPE_SCHEDULING,
+          DEFAULT_SCHEDULING, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LATENCY_PROBE,
+      g_param_spec_boolean ("latency-probe", "Latency probe",
+          "Look for the pulses of a wasapisink with latency-probe in what is "
+          "captured, and post a wasapi-latency element message with the round "
+          "trip for each. Not with direct or zero-copy. Takes effect when "
+          "prepared", DEFAULT_LATENCY_PROBE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_AEC_REFERENCE,
+      g_param_spec_boolean ("aec-reference", "AEC reference",
+          "In loopback, output what a wasapisink with aec-reference in this "
+          "process played on the endpoint at the capture time of each "
+          "packet instead, an echo cancellation reference aligned with the "
+          "microphone. Silence where it played nothing, the loopback data "
+          "while no such sink is prepared in the same format. Not with "
+          "direct or zero-copy. Takes effect when prepared",
+          DEFAULT_AEC_REFERENCE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+#if GST_CHECK_VERSION (1, 14, 0)
+  g_object_class_install_property (gobject_class,
+      PROP_REFERENCE_TIMESTAMP_META,
+      g_param_spec_boolean ("add-reference-timestamp-meta",
+          "Add reference timestamp meta",
+          "Attach a GstReferenceTimestampMeta with caps timestamp/x-qpc to "
+          "each buffer, the QPC position (in ns) the device captured its "
+          "first frame at, to line up with other QPC stamped captures like "
+          "DXGI desktop duplication. Takes effect when prepared",
+          DEFAULT_REFERENCE_TIMESTAMP_META,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+
+  g_object_class_install_property (gobject_class,
+      PROP_GLITCH_INTERVAL,
+      g_param_spec_uint64 ("glitch-interval", "Glitch interval",
+          "Post device glitches and overruns as wasapi-glitch element "
+          "messages, coalesced to at most one per this many ns, and only "
+          "warn about overruns that often. 0 posts no messages and warns "
+          "about every overrun. Takes effect when prepared", 0, G_MAXUINT64,
+          DEFAULT_GLITCH_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "Stats interval",
+          "Post a wasapi-stats element message this often, in ns, with what "
+          "changed since the last one: frames, glitches, overflow-saved and "
+          "overflow-dropped (bytes), underruns, drift-ppm, wakeups, "
+          "wakeup-interval-avg/p99/p999 (ns), and device-cycles and "
+          "streaming-cycles. Also streams, the elements reporting in this "
+          "process, and process-cpu, the CPU time of the process in percent "
+          "of one core, so N concurrent streams can be compared. Built on a "
+          "thread of its own. 0 posts none, takes effect when prepared", 0,
+          G_MAXUINT64,
+          DEFAULT_STATS_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ETW_ATTRIBUTION,
+      g_param_spec_boolean ("etw-attribution", "ETW attribution",
+          "Match device glitches with the glitch events of the audio engine "
+          "from the Microsoft-Windows-Audio ETW provider, and count those "
+          "we were late for, the engine's and the driver's in the stats and "
+          "wasapi-glitch messages, a few seconds after they happened. Needs "
+          "an administrator or a member of Performance Log Users. Takes "
+          "effect when prepared", DEFAULT_ETW_ATTRIBUTION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_PACKET_LOG,
+      g_param_spec_string ("packet-log", "Packet log",
+          "Log QPC and device position, size, flags and wait time of every "
+          "packet to this file, for replay with GST_WASAPI_FAKE=replay=file. "
+          "Not with direct or zero-copy. Takes effect when prepared",
+          DEFAULT_PACKET_LOG, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_HEALTH_INTERVAL,
+      g_param_spec_uint64 ("health-interval", "Health interval",
+          "Post a wasapi-health element message this often (in ns) with the "
+          "uptime, timeshift, drift and glitch counters and the resident and "
+          "private bytes and handle count of the process, for soak testing. "
+          "0 disables", 0, G_MAXUINT64, DEFAULT_HEALTH_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_RING_FILL,
+      g_param_spec_uint ("ring-fill", "Ring fill",
+          "How much of the ringbuffer holds captured samples downstream "
+          "didn't take yet, in percent, as of the last segment captured. At "
+          "100 the oldest ones are about to be dropped", 0, 100, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_OVERFLOW_FILL,
+      g_param_spec_uint ("overflow-fill", "Overflow fill",
+          "Frames captured beyond the last segment, waiting in the overflow "
+          "buffer for the next one", 0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_HIGH_WATERMARK,
+      g_param_spec_uint ("high-watermark", "High watermark",
+          "Post a wasapi-ring-watermark element message with high=TRUE once "
+          "ring-fill reaches this, and one with high=FALSE once it is back "
+          "at low-watermark, so downstream can shed load before samples are "
+          "dropped. 0 disables", 0, 100, DEFAULT_HIGH_WATERMARK,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LOW_WATERMARK,
+      g_param_spec_uint ("low-watermark", "Low watermark",
+          "See high-watermark", 0, 100, DEFAULT_LOW_WATERMARK,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_KEEP_RUNNING,
+      g_param_spec_boolean ("keep-running", "Keep running",
+          "Keep capturing while paused or flushing and drop what comes in, "
+          "instead of stopping and resetting the device stream, so capture "
+          "resumes without restarting it", DEFAULT_KEEP_RUNNING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ON_DEMAND,
+      g_param_spec_boolean ("on-demand", "On demand",
+          "Stop the device stream and push silence while nothing downstream "
+          "consumes the buffers, e.g. a tee without branches, and capture "
+          "again within a period once something is linked. Not with "
+          "shared-engine", DEFAULT_ON_DEMAND,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ASYNC_OPEN,
+      g_param_spec_boolean ("async-open", "Async open",
+          "Look up and activate the device on a thread of its own, so going "
+          "to READY returns right away. Caps queries and prepare wait for "
+          "it, and a device that fails to open is an error message instead "
+          "of a failed state change. Has to be set before the device is "
+          "opened", DEFAULT_ASYNC_OPEN,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LIST_THRESHOLD,
+      g_param_spec_uint ("list-threshold", "List threshold",
+          "Once at least this many segments are captured but not pushed yet, "
+          "e.g. after downstream stalled, push all of them in one buffer "
+          "list instead of one buffer at a time. 0 disables", 0, G_MAXINT,
+          DEFAULT_LIST_THRESHOLD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LOCKLESS_HANDOFF,
+      g_param_spec_boolean ("lockless-handoff", "Lockless handoff",
+          "Hand each captured segment to the streaming thread through an "
+          "atomic counter it spins on briefly and then waits on with "
+          "WaitOnAddress(), instead of a mutex and condition, which saves "
+          "kernel transitions at periods of a few milliseconds. Needs "
+          "Windows 8, has to be set before the element goes to READY",
+          DEFAULT_LOCKLESS_HANDOFF,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_FAST_START,
+      g_param_spec_boolean ("fast-start", "Fast start",
+          "Push the first buffer after starting as soon as the device "
+          "delivered a period, with just the frames so far, and the rest of "
+          "that segment next, instead of waiting for the whole segment. Not "
+          "with direct, zero-copy or output-frames", DEFAULT_FAST_START,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_add_static_pad_template (gstelement_class, &src_template);
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_pad_template_new_from_static_pad_template_with_gtype
+      (&fanout_template, GST_TYPE_WASAPI_FANOUT_PAD));
   gst_element_class_set_static_metadata (gstelement_class, "WasapiSrc",
       "Source/Audio",
       "Stream audio from an audio capture device through WASAPI",
@@ -229,6 +1224,20 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
       "Ole André Vadla Ravnås <ole.andre.ravnas@tandberg.com>");
 
   gstbasesrc_class->get_caps = GST_DEBUG_FUNCPTR (gst_wasapi_src_get_caps);
+  gstbasesrc_class->query = GST_DEBUG_FUNCPTR (gst_wasapi_src_query);
+  gstbasesrc_class->event = GST_DEBUG_FUNCPTR (gst_wasapi_src_event);
+  gstbasesrc_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_decide_allocation);
+  gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_wasapi_src_unlock);
+  gstelement_class->set_clock = GST_DEBUG_FUNCPTR (gst_wasapi_src_set_clock);
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_release_pad);
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_change_state);
+  gstbasesrc_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_unlock_stop);
 
   gstaudiosrc_class->open = GST_DEBUG_FUNCPTR (gst_wasapi_src_open);
   gstaudiosrc_class->close = GST_DEBUG_FUNCPTR (gst_wasapi_src_close);
@@ -245,16 +1254,13 @@ gst_wasapi_src_class_init (GstWasapiSrcClass * klass)
 static void
 gst_wasapi_src_init (GstWasapiSrc * self)
 {
-
-#ifdef DEFAULT_PROVIDE_CLOCK
-  /* override with a custom clock */
+  /* override with a custom clock, that can follow the device position */
   if (GST_AUDIO_BASE_SRC (self)->clock)
     gst_object_unref (GST_AUDIO_BASE_SRC (self)->clock);
 
   GST_AUDIO_BASE_SRC (self)->clock = gst_audio_clock_new ("GstWasapiSrcClock",
       gst_wasapi_src_get_time, gst_object_ref (self),
       (GDestroyNotify) gst_object_unref);
-#endif
 
   self->sample_rate = 0;
   self->device_description = NULL;
@@ -263,18 +1269,172 @@ gst_wasapi_src_init (GstWasapiSrc * self)
   self->loopback = DEFAULT_LOOPBACK;
   self->low_latency = DEFAULT_LOW_LATENCY;
   self->try_audioclient3 = DEFAULT_AUDIOCLIENT3;
-  self->event_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
-  self->stop_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->raw = DEFAULT_RAW;
+  self->category = DEFAULT_CATEGORY;
+  self->communications_effects = DEFAULT_COMMUNICATIONS_EFFECTS;
+  self->adaptive_buffer = DEFAULT_ADAPTIVE_BUFFER;
+  self->auto_tune = DEFAULT_AUTO_TUNE;
+  self->lock_memory = DEFAULT_LOCK_MEMORY;
+  self->shm_name = g_strdup (DEFAULT_SHM_NAME);
+  self->emit_packets = DEFAULT_EMIT_PACKETS;
+  self->replay_duration = DEFAULT_REPLAY_DURATION;
+  self->record_location = g_strdup (DEFAULT_RECORD_LOCATION);
+  self->record_max_size = DEFAULT_RECORD_MAX_SIZE;
+  self->record_max_time = DEFAULT_RECORD_MAX_TIME;
+  self->preroll_time = DEFAULT_PREROLL_TIME;
+  self->output_frames = DEFAULT_OUTPUT_FRAMES;
+  self->target_pid = DEFAULT_TARGET_PID;
+  self->target_mode = DEFAULT_TARGET_MODE;
+  self->zero_copy = DEFAULT_ZERO_COPY;
+  self->direct = DEFAULT_DIRECT;
+  self->autoconvert = DEFAULT_AUTOCONVERT;
+  self->match_format = DEFAULT_MATCH_FORMAT;
+  self->dither = DEFAULT_DITHER;
+  self->channels = DEFAULT_CHANNELS;
+  self->channel_select = g_strdup (DEFAULT_CHANNEL_SELECT);
+  self->level_mode = DEFAULT_LEVEL;
+  self->level_interval = DEFAULT_LEVEL_INTERVAL;
+  self->spectrum_enabled = DEFAULT_SPECTRUM;
+  self->spectrum_bands = DEFAULT_SPECTRUM_BANDS;
+  self->spectrum_interval = DEFAULT_SPECTRUM_INTERVAL;
+  self->vad = DEFAULT_VAD;
+  self->vad_threshold = DEFAULT_VAD_THRESHOLD;
+  self->vad_hangover = DEFAULT_VAD_HANGOVER;
+  self->detect_silence = DEFAULT_DETECT_SILENCE;
+  self->silence_threshold = DEFAULT_SILENCE_THRESHOLD;
+  self->prewarm = DEFAULT_PREWARM;
+  self->follow_default = DEFAULT_FOLLOW_DEFAULT;
+  self->stream_routing = DEFAULT_STREAM_ROUTING;
+  self->mmcss_task = g_strdup (DEFAULT_MMCSS_TASK);
+  self->mmcss_priority = DEFAULT_MMCSS_PRIORITY;
+  self->thread_affinity = DEFAULT_THREAD_AFFINITY;
+  self->processor_group = DEFAULT_PROCESSOR_GROUP;
+  self->power_throttling = DEFAULT_POWER_THROTTLING;
+  self->performance_cores = DEFAULT_PERFORMANCE_CORES;
+  self->shared_engine = DEFAULT_SHARED_ENGINE;
+  self->share_client = DEFAULT_SHARE_CLIENT;
+  self->rtwq = DEFAULT_RTWQ;
+  self->scheduling = DEFAULT_SCHEDULING;
+  self->probe_latency = DEFAULT_LATENCY_PROBE;
+  self->aec_reference = DEFAULT_AEC_REFERENCE;
+  self->reference_timestamp_meta = DEFAULT_REFERENCE_TIMESTAMP_META;
+  self->glitch_interval = DEFAULT_GLITCH_INTERVAL;
+  self->stats_interval = DEFAULT_STATS_INTERVAL;
+  self->etw_attribution = DEFAULT_ETW_ATTRIBUTION;
+  self->packet_log_path = g_strdup (DEFAULT_PACKET_LOG);
+  self->health_interval = DEFAULT_HEALTH_INTERVAL;
+  self->high_watermark = DEFAULT_HIGH_WATERMARK;
+  self->low_watermark = DEFAULT_LOW_WATERMARK;
+  self->keep_running = DEFAULT_KEEP_RUNNING;
+  self->on_demand = DEFAULT_ON_DEMAND;
+  self->async_open = DEFAULT_ASYNC_OPEN;
+  self->list_threshold = DEFAULT_LIST_THRESHOLD;
+  self->lockless_handoff = DEFAULT_LOCKLESS_HANDOFF;
+  self->fast_start = DEFAULT_FAST_START;
+  self->first_seg = -1;
+  g_mutex_init (&self->open_lock);
+  self->fanout = gst_wasapi_fanout_new (GST_ELEMENT (self),
+      GST_BASE_SRC_PAD (self));
+  gst_wasapi_glitch_log_init (&self->glitch_log);
+  self->device_index = -1;
+  g_mutex_init (&self->packet_lock);
+  g_cond_init (&self->packet_cond);
+  self->packet_outstanding = FALSE;
+  self->flushing = FALSE;
   self->client_needs_restart = FALSE;
   self->capture_too_many_frames_log_count = 0;
-  self->client_needs_restart = FALSE;
-  self->change_initialized = 0;
+  g_mutex_init (&self->clock_lock);
+  self->use_device_clock = DEFAULT_DEVICE_CLOCK;
+  self->shared_clock = NULL;
+  self->own_clock = NULL;
+  self->stream_latency = GST_CLOCK_TIME_NONE;
+  gst_wasapi_startup_times_init (&self->startup_times, GST_ELEMENT (self));
+  self->device_stats = gst_wasapi_stats_block_new ();
+  self->streaming_stats = gst_wasapi_stats_block_new ();
+  gst_wasapi_histogram_reset (&self->wakeup_histogram);
+  gst_wasapi_histogram_reset (&self->hold_histogram);
+  self->create_counters = gst_wasapi_counters_new ();
+  self->clock = NULL;
+  self->base_time = 0;
+  /* The copies start out stale */
+  self->clock_cookie = 1;
   self->eos_sent = FALSE;
   self->initial_timestamp_diff = 0;
-  self->timeshifted_count = 0;
-  self->drift_correction_count = 0;
+  self->stream_counters = gst_wasapi_counters_new ();
+  self->capture_counters = gst_wasapi_counters_new ();
   self->drift_correction_threshold = DEFAULT_DRIFT_CORRECTION_THRESHOLD;
-  CoInitialize (NULL);
+  self->drift_correction_method = DEFAULT_DRIFT_CORRECTION_METHOD;
+  self->calibration_file = g_strdup (DEFAULT_CALIBRATION_FILE);
+  self->catchup_policy = DEFAULT_CATCHUP_POLICY;
+  self->timestamp_mode = DEFAULT_TIMESTAMP_MODE;
+}
+
+/* Mirrored if possible. A power of two in *@size stays one, rounded up to
+ * the allocation granularity then. */
+static guint8 *
+gst_wasapi_src_overflow_alloc (GstWasapiSrc * self, gsize * size,
+    gboolean * mirrored)
+{
+  guint8 *mem = gst_wasapi_util_alloc_mirrored (size, 1);
+
+  *mirrored = mem != NULL;
+  if (mem != NULL) {
+    /* Both views, or the second one would still fault */
+    if (self->memory_locked)
+      gst_wasapi_util_lock_memory (mem, 2 * *size);
+    return mem;
+  }
+
+  if (self->memory_locked)
+    return gst_wasapi_util_alloc_locked (*size);
+
+  return g_malloc (*size);
+}
+
+static void
+gst_wasapi_src_overflow_free (GstWasapiSrc * self, guint8 * mem, gsize size,
+    gboolean mirrored)
+{
+  if (mirrored) {
+    if (self->memory_locked)
+      gst_wasapi_util_unlock_memory (mem, 2 * size);
+    gst_wasapi_util_free_mirrored (mem, size);
+  } else if (self->memory_locked) {
+    gst_wasapi_util_free_locked (mem, size);
+  } else {
+    g_free (mem);
+  }
+}
+
+/* The base class allocates the ringbuffer memory after prepare(), and frees
+ * it after unprepare() */
+static void
+gst_wasapi_src_lock_ring (GstWasapiSrc * self, GstAudioRingBuffer * ringbuffer)
+{
+  if (!self->memory_locked || ringbuffer->memory == self->locked_ring)
+    return;
+
+  gst_wasapi_util_unlock_memory (self->locked_ring, self->locked_ring_size);
+  self->locked_ring = NULL;
+  self->locked_ring_size = 0;
+
+  if (gst_wasapi_util_lock_memory (ringbuffer->memory, ringbuffer->size)) {
+    self->locked_ring = ringbuffer->memory;
+    self->locked_ring_size = ringbuffer->size;
+  }
+}
+
+static void
+gst_wasapi_src_clear_pool (GstWasapiSrc * self)
+{
+  if (self->pool == NULL)
+    return;
+
+  /* Buffers still downstream are freed when they come back */
+  gst_buffer_pool_set_active (self->pool, FALSE);
+  gst_object_unref (self->pool);
+  self->pool = NULL;
+  self->pool_size = 0;
 }
 
 static void
@@ -287,15 +1447,47 @@ gst_wasapi_src_dispose (GObject * object)
     self->event_handle = NULL;
   }
 
-  if (self->stop_handle != NULL) {
-    CloseHandle (self->stop_handle);
-    self->stop_handle = NULL;
+  gst_wasapi_cancel_clear (&self->stop);
+
+  if (self->capture_event != NULL) {
+    CloseHandle (self->capture_event);
+    self->capture_event = NULL;
   }
 
-  if (self->client_clock != NULL) {
+  if (self->drain_stop != NULL) {
+    CloseHandle (self->drain_stop);
+    self->drain_stop = NULL;
+  }
+
+  if (self->demand_event != NULL) {
+    CloseHandle (self->demand_event);
+    self->demand_event = NULL;
+  }
+
+  if (self->first_event != NULL) {
+    CloseHandle (self->first_event);
+    self->first_event = NULL;
+  }
+
+  if (self->cancel_handle != NULL) {
+    CloseHandle (self->cancel_handle);
+    self->cancel_handle = NULL;
+  }
+
+  if (self->clock != NULL) {
+    gst_object_unref (self->clock);
+    self->clock = NULL;
+  }
+  gst_object_replace ((GstObject **) & self->device_clock.clock, NULL);
+  gst_object_replace ((GstObject **) & self->streaming_clock.clock, NULL);
+
+  if (self->client_clock != NULL) {
     IUnknown_Release (self->client_clock);
     self->client_clock = NULL;
   }
+  gst_caps_replace (&self->warm_caps, NULL);
+  gst_wasapi_src_clear_pool (self);
+  g_clear_pointer (&self->fanout, gst_wasapi_fanout_free);
 
   if (self->client != NULL) {
     IUnknown_Release (self->client);
@@ -307,33 +1499,63 @@ gst_wasapi_src_dispose (GObject * object)
     self->capture_client = NULL;
   }
 
-  if (self->change_initialized && self->change.client.lpVtbl) {
-    change_notify * change = &self->change;
-    self->change_initialized = 0;
-    IMMDeviceEnumerator_UnregisterEndpointNotificationCallback(
-      change->pEnumerator, (IMMNotificationClient *)change);
-    IUnknown_Release(change->pEnumerator);
-  }
-
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
 
+/* What get_caps() learned about the device, from then until close */
+static void
+gst_wasapi_src_clear_format (GstWasapiSrc * self)
+{
+  if (self->mix_format != self->device_format)
+    CoTaskMemFree (self->mix_format);
+  CoTaskMemFree (self->device_format);
+  self->mix_format = self->device_format = NULL;
+
+  g_clear_pointer (&self->cached_caps, gst_caps_unref);
+  g_clear_pointer (&self->positions, g_free);
+}
+
 static void
 gst_wasapi_src_finalize (GObject * object)
 {
   GstWasapiSrc *self = GST_WASAPI_SRC (object);
 
-  CoTaskMemFree (self->mix_format);
-  self->mix_format = NULL;
+  gst_wasapi_src_clear_format (self);
 
-  CoUninitialize ();
+  if (self->overflow_buffer != NULL) {
+    gst_wasapi_src_overflow_free (self, self->overflow_buffer,
+        self->overflow_buffer_size, self->overflow_mirrored);
+    self->overflow_buffer = NULL;
+    self->overflow_buffer_size = 0;
+  }
+  g_clear_pointer (&self->convert_data, g_free);
+  self->convert_size = 0;
 
-  g_clear_pointer (&self->cached_caps, gst_caps_unref);
-  g_clear_pointer (&self->positions, g_free);
   g_clear_pointer (&self->device_strid, g_free);
-  g_clear_pointer (&self->device_description, g_free);
+  g_clear_pointer (&self->device_name, g_free);
+  g_clear_pointer (&self->device_list, g_strfreev);
+  g_clear_pointer (&self->mmcss_task, g_free);
+  g_clear_pointer (&self->packet_log_path, g_free);
+  g_clear_pointer (&self->channel_select, g_free);
+  g_clear_pointer (&self->shm_name, g_free);
+  g_clear_pointer (&self->record_location, g_free);
+  g_clear_pointer (&self->calibration_file, g_free);
+  g_clear_pointer (&self->thread_task, g_free);
   self->sample_rate = 0;
 
+  g_mutex_clear (&self->open_lock);
+  g_mutex_clear (&self->packet_lock);
+  g_mutex_clear (&self->clock_lock);
+  gst_wasapi_startup_times_clear (&self->startup_times);
+  g_clear_pointer (&self->os_effects, gst_structure_free);
+  gst_wasapi_glitch_log_clear (&self->glitch_log);
+  g_cond_clear (&self->packet_cond);
+  g_clear_pointer (&self->stream_counters, gst_wasapi_counters_free);
+  g_clear_pointer (&self->capture_counters, gst_wasapi_counters_free);
+  g_clear_pointer (&self->create_counters, gst_wasapi_counters_free);
+  g_clear_pointer (&self->device_stats, gst_wasapi_stats_block_free);
+  g_clear_pointer (&self->streaming_stats, gst_wasapi_stats_block_free);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -353,8 +1575,14 @@ gst_wasapi_src_set_property (GObject * object, guint prop_id,
       g_free (self->device_strid);
       self->device_strid =
           device ? g_utf8_to_utf16 (device, -1, NULL, NULL, NULL) : NULL;
+      self->device_name_resolved = FALSE;
+      gst_wasapi_src_request_device_change (self, device);
       break;
     }
+    case PROP_DEVICE_NAME:
+      g_free (self->device_name);
+      self->device_name = g_value_dup_string (value);
+      break;
     case PROP_LOOPBACK:
       self->loopback = g_value_get_boolean (value);
       break;
@@ -364,19 +1592,292 @@ gst_wasapi_src_set_property (GObject * object, guint prop_id,
       break;
     case PROP_LOW_LATENCY:
       self->low_latency = g_value_get_boolean (value);
+      gst_wasapi_src_request_period_change (self);
       break;
     case PROP_AUDIOCLIENT3:
       self->try_audioclient3 = g_value_get_boolean (value);
       break;
+    case PROP_RAW:
+      self->raw = g_value_get_boolean (value);
+      break;
+    case PROP_CATEGORY:
+      self->category = g_value_get_enum (value);
+      break;
+    case PROP_COMMUNICATIONS_EFFECTS:
+      self->communications_effects = g_value_get_boolean (value);
+      break;
+    case PROP_ADAPTIVE_BUFFER:
+      self->adaptive_buffer = g_value_get_boolean (value);
+      break;
+    case PROP_AUTO_TUNE:
+      self->auto_tune = g_value_get_boolean (value);
+      break;
+    case PROP_LOCK_MEMORY:
+      self->lock_memory = g_value_get_boolean (value);
+      break;
+    case PROP_SHM_NAME:
+      g_free (self->shm_name);
+      self->shm_name = g_value_dup_string (value);
+      break;
+    case PROP_EMIT_PACKETS:
+      g_atomic_int_set (&self->emit_packets, g_value_get_boolean (value));
+      break;
+    case PROP_REPLAY_DURATION:
+      self->replay_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_RECORD_LOCATION:
+      if (!gst_wasapi_record_location_is_valid (g_value_get_string (value))) {
+        GST_WARNING_OBJECT (self, "ignoring invalid record-location %s, only "
+            "one %%d or %%u and %%%% are allowed", g_value_get_string (value));
+        break;
+      }
+      g_free (self->record_location);
+      self->record_location = g_value_dup_string (value);
+      self->record_sequence = 0;
+      break;
+    case PROP_RECORD_MAX_SIZE:
+      self->record_max_size = g_value_get_uint64 (value);
+      break;
+    case PROP_RECORD_MAX_TIME:
+      self->record_max_time = g_value_get_uint64 (value);
+      break;
+    case PROP_PREROLL_TIME:
+      self->preroll_time = g_value_get_uint64 (value);
+      break;
+    case PROP_OUTPUT_FRAMES:
+      self->output_frames = g_value_get_uint (value);
+      break;
+    case PROP_TARGET_PID:
+      self->target_pid = g_value_get_uint (value);
+      break;
+    case PROP_TARGET_MODE:
+      self->target_mode = g_value_get_enum (value);
+      break;
     case PROP_DRIFT_CORRECTION_THRESHOLD:
       self->drift_correction_threshold = g_value_get_uint64 (value);
       break;
+    case PROP_DRIFT_CORRECTION_METHOD:
+      self->drift_correction_method = g_value_get_enum (value);
+      break;
+    case PROP_CALIBRATION_FILE:
+      g_free (self->calibration_file);
+      self->calibration_file = g_value_dup_string (value);
+      break;
+    case PROP_CATCHUP_POLICY:
+      self->catchup_policy = g_value_get_enum (value);
+      break;
+    case PROP_TIMESTAMP_MODE:
+      self->timestamp_mode = g_value_get_enum (value);
+      break;
+    case PROP_ZERO_COPY:
+      self->zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_DIRECT:
+      self->direct = g_value_get_boolean (value);
+      break;
+    case PROP_DEVICE_CLOCK:
+      self->use_device_clock = g_value_get_boolean (value);
+      break;
+    case PROP_AUTOCONVERT:
+      self->autoconvert = g_value_get_boolean (value);
+      break;
+    case PROP_MATCH_FORMAT:
+      self->match_format = g_value_get_boolean (value);
+      break;
+    case PROP_DITHER:
+      self->dither = g_value_get_boolean (value);
+      break;
+    case PROP_CHANNELS:
+      self->channels = g_value_get_int (value);
+      break;
+    case PROP_CHANNEL_SELECT:
+      g_free (self->channel_select);
+      self->channel_select = g_value_dup_string (value);
+      break;
+    case PROP_LEVEL:
+      self->level_mode = g_value_get_enum (value);
+      break;
+    case PROP_LEVEL_INTERVAL:
+      self->level_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_SPECTRUM:
+      self->spectrum_enabled = g_value_get_boolean (value);
+      break;
+    case PROP_SPECTRUM_BANDS:
+      self->spectrum_bands = g_value_get_uint (value);
+      break;
+    case PROP_SPECTRUM_INTERVAL:
+      self->spectrum_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_VAD:
+      self->vad = g_value_get_boolean (value);
+      break;
+    case PROP_VAD_THRESHOLD:
+      self->vad_threshold = g_value_get_double (value);
+      break;
+    case PROP_VAD_HANGOVER:
+      self->vad_hangover = g_value_get_uint64 (value);
+      break;
+    case PROP_DETECT_SILENCE:
+      self->detect_silence = g_value_get_boolean (value);
+      break;
+    case PROP_SILENCE_THRESHOLD:
+      self->silence_threshold = g_value_get_double (value);
+      break;
+    case PROP_PREWARM:
+      self->prewarm = g_value_get_boolean (value);
+      break;
+    case PROP_FOLLOW_DEFAULT:
+      self->follow_default = g_value_get_boolean (value);
+      break;
+    case PROP_STREAM_ROUTING:
+      self->stream_routing = g_value_get_boolean (value);
+      break;
+    case PROP_MMCSS_TASK:
+      g_free (self->mmcss_task);
+      self->mmcss_task = g_value_dup_string (value);
+      break;
+    case PROP_MMCSS_PRIORITY:
+      self->mmcss_priority = g_value_get_enum (value);
+      break;
+    case PROP_THREAD_AFFINITY:
+      self->thread_affinity = g_value_get_uint64 (value);
+      break;
+    case PROP_PROCESSOR_GROUP:
+      self->processor_group = g_value_get_uint (value);
+      break;
+    case PROP_POWER_THROTTLING:
+      self->power_throttling = g_value_get_boolean (value);
+      break;
+    case PROP_PERFORMANCE_CORES:
+      self->performance_cores = g_value_get_boolean (value);
+      break;
+    case PROP_SHARED_ENGINE:
+      self->shared_engine = g_value_get_boolean (value);
+      break;
+    case PROP_SHARE_CLIENT:
+      self->share_client = g_value_get_boolean (value);
+      break;
+    case PROP_RTWQ:
+      self->rtwq = g_value_get_boolean (value);
+      break;
+    case PROP_SCHEDULING:
+      self->scheduling = g_value_get_enum (value);
+      break;
+    case PROP_LATENCY_PROBE:
+      self->probe_latency = g_value_get_boolean (value);
+      break;
+    case PROP_AEC_REFERENCE:
+      self->aec_reference = g_value_get_boolean (value);
+      break;
+    case PROP_REFERENCE_TIMESTAMP_META:
+      self->reference_timestamp_meta = g_value_get_boolean (value);
+      break;
+    case PROP_GLITCH_INTERVAL:
+      self->glitch_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_ETW_ATTRIBUTION:
+      self->etw_attribution = g_value_get_boolean (value);
+      break;
+    case PROP_PACKET_LOG:
+      g_free (self->packet_log_path);
+      self->packet_log_path = g_value_dup_string (value);
+      break;
+    case PROP_HEALTH_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      self->health_interval = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_HIGH_WATERMARK:
+      g_atomic_int_set (&self->high_watermark, g_value_get_uint (value));
+      break;
+    case PROP_LOW_WATERMARK:
+      g_atomic_int_set (&self->low_watermark, g_value_get_uint (value));
+      break;
+    case PROP_KEEP_RUNNING:
+      self->keep_running = g_value_get_boolean (value);
+      break;
+    case PROP_ON_DEMAND:
+      self->on_demand = g_value_get_boolean (value);
+      /* Only waited for once opened */
+      if (self->demand_event != NULL)
+        SetEvent (self->demand_event);
+      break;
+    case PROP_ASYNC_OPEN:
+      self->async_open = g_value_get_boolean (value);
+      break;
+    case PROP_LIST_THRESHOLD:
+      g_atomic_int_set (&self->list_threshold, g_value_get_uint (value));
+      break;
+    case PROP_LOCKLESS_HANDOFF:
+      self->lockless_handoff = g_value_get_boolean (value);
+      break;
+    case PROP_FAST_START:
+      g_atomic_int_set (&self->fast_start, g_value_get_boolean (value));
+      break;
+    case PROP_DEVICE_LIST:
+    {
+      const gchar *list = g_value_get_string (value);
+      gchar **ids = NULL;
+
+      if (list != NULL) {
+        GPtrArray *array = g_ptr_array_new ();
+        gchar **split = g_strsplit (list, ",", -1);
+        gint i;
+
+        for (i = 0; split[i] != NULL; i++) {
+          g_strstrip (split[i]);
+          if (*split[i] != '\0')
+            g_ptr_array_add (array, g_strdup (split[i]));
+        }
+        g_strfreev (split);
+
+        if (array->len > 0) {
+          g_ptr_array_add (array, NULL);
+          ids = (gchar **) g_ptr_array_free (array, FALSE);
+        } else {
+          g_ptr_array_free (array, TRUE);
+        }
+      }
+
+      /* Also read by the notification callbacks */
+      GST_OBJECT_LOCK (self);
+      g_strfreev (self->device_list);
+      self->device_list = ids;
+      GST_OBJECT_UNLOCK (self);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+/* What both threads counted, without a lock */
+static void
+gst_wasapi_src_get_stats (GstWasapiSrc * self, GstWasapiStats * stats)
+{
+  gst_wasapi_stats_reset (stats);
+  gst_wasapi_stats_block_add_to (self->device_stats, stats);
+  gst_wasapi_stats_block_add_to (self->streaming_stats, stats);
+}
+
+static gdouble
+gst_wasapi_src_get_drift_ppm (GstWasapiSrc * self)
+{
+  gdouble ppm = 0;
+
+  GST_OBJECT_LOCK (self);
+  if (self->drift)
+    gst_wasapi_drift_get_ppm (self->drift, &ppm);
+  GST_OBJECT_UNLOCK (self);
+
+  return ppm;
+}
+
 static void
 gst_wasapi_src_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
@@ -391,6 +1892,9 @@ gst_wasapi_src_get_property (GObject * object, guint prop_id,
       g_value_take_string (value, self->device_strid ?
           g_utf16_to_utf8 (self->device_strid, -1, NULL, NULL, NULL) : NULL);
       break;
+    case PROP_DEVICE_NAME:
+      g_value_set_string (value, self->device_name);
+      break;
     case PROP_LOOPBACK:
       g_value_set_boolean (value, self->loopback);
       break;
@@ -404,6 +1908,54 @@ gst_wasapi_src_get_property (GObject * object, guint prop_id,
     case PROP_AUDIOCLIENT3:
       g_value_set_boolean (value, self->try_audioclient3);
       break;
+    case PROP_RAW:
+      g_value_set_boolean (value, self->raw);
+      break;
+    case PROP_CATEGORY:
+      g_value_set_enum (value, self->category);
+      break;
+    case PROP_COMMUNICATIONS_EFFECTS:
+      g_value_set_boolean (value, self->communications_effects);
+      break;
+    case PROP_ADAPTIVE_BUFFER:
+      g_value_set_boolean (value, self->adaptive_buffer);
+      break;
+    case PROP_AUTO_TUNE:
+      g_value_set_boolean (value, self->auto_tune);
+      break;
+    case PROP_LOCK_MEMORY:
+      g_value_set_boolean (value, self->lock_memory);
+      break;
+    case PROP_SHM_NAME:
+      g_value_set_string (value, self->shm_name);
+      break;
+    case PROP_EMIT_PACKETS:
+      g_value_set_boolean (value, g_atomic_int_get (&self->emit_packets));
+      break;
+    case PROP_REPLAY_DURATION:
+      g_value_set_uint64 (value, self->replay_duration);
+      break;
+    case PROP_RECORD_LOCATION:
+      g_value_set_string (value, self->record_location);
+      break;
+    case PROP_RECORD_MAX_SIZE:
+      g_value_set_uint64 (value, self->record_max_size);
+      break;
+    case PROP_RECORD_MAX_TIME:
+      g_value_set_uint64 (value, self->record_max_time);
+      break;
+    case PROP_PREROLL_TIME:
+      g_value_set_uint64 (value, self->preroll_time);
+      break;
+    case PROP_OUTPUT_FRAMES:
+      g_value_set_uint (value, self->output_frames);
+      break;
+    case PROP_TARGET_PID:
+      g_value_set_uint (value, self->target_pid);
+      break;
+    case PROP_TARGET_MODE:
+      g_value_set_enum (value, self->target_mode);
+      break;
     case PROP_RESTART_REQUIRED:
       g_value_set_boolean(value, self->eos_sent);
       break;
@@ -414,314 +1966,3655 @@ gst_wasapi_src_get_property (GObject * object, guint prop_id,
       g_value_set_string (value, self->device_description);
       break;
     case PROP_TIMESHIFTED_COUNT:
-      g_value_set_uint64 (value, self->timeshifted_count);
+      g_value_set_uint64 (value, gst_wasapi_counters_get
+          (self->stream_counters, STREAM_COUNTER_TIMESHIFTED));
       break;
     case PROP_DRIFT_CORRECTION_COUNT:
-      g_value_set_uint64 (value, self->drift_correction_count);
+      g_value_set_uint64 (value, gst_wasapi_counters_get
+          (self->stream_counters, STREAM_COUNTER_DRIFT_CORRECTIONS));
       break;
     case PROP_DRIFT_CORRECTION_THRESHOLD:
       g_value_set_uint64 (value, self->drift_correction_threshold);
       break;
+    case PROP_DRIFT_CORRECTION_METHOD:
+      g_value_set_enum (value, self->drift_correction_method);
+      break;
+    case PROP_CALIBRATION_FILE:
+      g_value_set_string (value, self->calibration_file);
+      break;
+    case PROP_CATCHUP_POLICY:
+      g_value_set_enum (value, self->catchup_policy);
+      break;
+    case PROP_TIMESTAMP_MODE:
+      g_value_set_enum (value, self->timestamp_mode);
+      break;
+    case PROP_ZERO_COPY:
+      g_value_set_boolean (value, self->zero_copy);
+      break;
+    case PROP_DIRECT:
+      g_value_set_boolean (value, self->direct);
+      break;
+    case PROP_GAP_COUNT:
+      g_value_set_uint64 (value, gst_wasapi_counters_get
+          (self->capture_counters, CAPTURE_COUNTER_GAPS));
+      break;
+    case PROP_GAP_FRAMES:
+      g_value_set_uint64 (value, gst_wasapi_counters_get
+          (self->capture_counters, CAPTURE_COUNTER_GAP_FRAMES));
+      break;
+    case PROP_DEVICE_CLOCK:
+      g_value_set_boolean (value, self->use_device_clock);
+      break;
+    case PROP_AUTOCONVERT:
+      g_value_set_boolean (value, self->autoconvert);
+      break;
+    case PROP_MATCH_FORMAT:
+      g_value_set_boolean (value, self->match_format);
+      break;
+    case PROP_DITHER:
+      g_value_set_boolean (value, self->dither);
+      break;
+    case PROP_CHANNELS:
+      g_value_set_int (value, self->channels);
+      break;
+    case PROP_CHANNEL_SELECT:
+      g_value_set_string (value, self->channel_select);
+      break;
+    case PROP_LEVEL:
+      g_value_set_enum (value, self->level_mode);
+      break;
+    case PROP_LEVEL_INTERVAL:
+      g_value_set_uint64 (value, self->level_interval);
+      break;
+    case PROP_SPECTRUM:
+      g_value_set_boolean (value, self->spectrum_enabled);
+      break;
+    case PROP_SPECTRUM_BANDS:
+      g_value_set_uint (value, self->spectrum_bands);
+      break;
+    case PROP_SPECTRUM_INTERVAL:
+      g_value_set_uint64 (value, self->spectrum_interval);
+      break;
+    case PROP_VAD:
+      g_value_set_boolean (value, self->vad);
+      break;
+    case PROP_VAD_THRESHOLD:
+      g_value_set_double (value, self->vad_threshold);
+      break;
+    case PROP_VAD_HANGOVER:
+      g_value_set_uint64 (value, self->vad_hangover);
+      break;
+    case PROP_DETECT_SILENCE:
+      g_value_set_boolean (value, self->detect_silence);
+      break;
+    case PROP_SILENCE_THRESHOLD:
+      g_value_set_double (value, self->silence_threshold);
+      break;
+    case PROP_PREWARM:
+      g_value_set_boolean (value, self->prewarm);
+      break;
+    case PROP_FOLLOW_DEFAULT:
+      g_value_set_boolean (value, self->follow_default);
+      break;
+    case PROP_STREAM_ROUTING:
+      g_value_set_boolean (value, self->stream_routing);
+      break;
+    case PROP_MMCSS_TASK:
+      g_value_set_string (value, self->mmcss_task);
+      break;
+    case PROP_MMCSS_PRIORITY:
+      g_value_set_enum (value, self->mmcss_priority);
+      break;
+    case PROP_THREAD_AFFINITY:
+      g_value_set_uint64 (value, self->thread_affinity);
+      break;
+    case PROP_PROCESSOR_GROUP:
+      g_value_set_uint (value, self->processor_group);
+      break;
+    case PROP_POWER_THROTTLING:
+      g_value_set_boolean (value, self->power_throttling);
+      break;
+    case PROP_PERFORMANCE_CORES:
+      g_value_set_boolean (value, self->performance_cores);
+      break;
+    case PROP_SHARED_ENGINE:
+      g_value_set_boolean (value, self->shared_engine);
+      break;
+    case PROP_SHARE_CLIENT:
+      g_value_set_boolean (value, self->share_client);
+      break;
+    case PROP_RTWQ:
+      g_value_set_boolean (value, self->rtwq);
+      break;
+    case PROP_SCHEDULING:
+      g_value_set_enum (value, self->scheduling);
+      break;
+    case PROP_LATENCY_PROBE:
+      g_value_set_boolean (value, self->probe_latency);
+      break;
+    case PROP_AEC_REFERENCE:
+      g_value_set_boolean (value, self->aec_reference);
+      break;
+    case PROP_REFERENCE_TIMESTAMP_META:
+      g_value_set_boolean (value, self->reference_timestamp_meta);
+      break;
+    case PROP_GLITCH_INTERVAL:
+      g_value_set_uint64 (value, self->glitch_interval);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint64 (value, self->stats_interval);
+      break;
+    case PROP_ETW_ATTRIBUTION:
+      g_value_set_boolean (value, self->etw_attribution);
+      break;
+    case PROP_PACKET_LOG:
+      g_value_set_string (value, self->packet_log_path);
+      break;
+    case PROP_HEALTH_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint64 (value, self->health_interval);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_RING_FILL:
+      g_value_set_uint (value, g_atomic_int_get (&self->ring_fill));
+      break;
+    case PROP_OVERFLOW_FILL:
+      g_value_set_uint (value, g_atomic_int_get (&self->overflow_fill));
+      break;
+    case PROP_HIGH_WATERMARK:
+      g_value_set_uint (value, g_atomic_int_get (&self->high_watermark));
+      break;
+    case PROP_LOW_WATERMARK:
+      g_value_set_uint (value, g_atomic_int_get (&self->low_watermark));
+      break;
+    case PROP_KEEP_RUNNING:
+      g_value_set_boolean (value, self->keep_running);
+      break;
+    case PROP_ON_DEMAND:
+      g_value_set_boolean (value, self->on_demand);
+      break;
+    case PROP_ASYNC_OPEN:
+      g_value_set_boolean (value, self->async_open);
+      break;
+    case PROP_LIST_THRESHOLD:
+      g_value_set_uint (value, g_atomic_int_get (&self->list_threshold));
+      break;
+    case PROP_LOCKLESS_HANDOFF:
+      g_value_set_boolean (value, self->lockless_handoff);
+      break;
+    case PROP_FAST_START:
+      g_value_set_boolean (value, g_atomic_int_get (&self->fast_start));
+      break;
+    case PROP_DEVICE_LIST:
+      GST_OBJECT_LOCK (self);
+      g_value_take_string (value, self->device_list ?
+          g_strjoinv (",", self->device_list) : NULL);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DRIFT_PPM:
+      g_value_set_double (value, gst_wasapi_src_get_drift_ppm (self));
+      break;
+    case PROP_STARTUP_TIMES:
+      g_value_take_boxed (value,
+          gst_wasapi_startup_times_to_structure (&self->startup_times,
+              "GstWasapiSrcStartupTimes"));
+      break;
+    case PROP_OS_EFFECTS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boxed (value, self->os_effects);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STATS:
+    {
+      GstWasapiStats stats;
+      GstStructure *s;
+      guint64 create[GST_WASAPI_N_COUNTERS];
+
+      gst_wasapi_src_get_stats (self, &stats);
+      gst_wasapi_counters_snapshot (self->create_counters, create);
+
+      s = gst_wasapi_stats_to_structure (&stats, "GstWasapiSrcStats",
+          gst_wasapi_src_get_drift_ppm (self));
+      gst_structure_set (s,
+          "create-buffers", G_TYPE_UINT64, create[CREATE_COUNTER_BUFFERS],
+          "create-time-avg", G_TYPE_UINT64,
+          create[CREATE_COUNTER_BUFFERS] > 0 ?
+          create[CREATE_COUNTER_TICKS] * 100 /
+          create[CREATE_COUNTER_BUFFERS] : 0,
+          "create-time-max", G_TYPE_UINT64,
+          create[CREATE_COUNTER_TICKS_MAX] * 100, NULL);
+      gst_wasapi_histogram_to_structure (&self->wakeup_histogram, s,
+          "wakeup-interval-histogram");
+      gst_wasapi_histogram_to_structure (&self->hold_histogram, s,
+          "buffer-hold-histogram");
+      GST_OBJECT_LOCK (self);
+      if (self->etw_tracker != NULL)
+        gst_wasapi_etw_tracker_to_structure (self->etw_tracker, s);
+      GST_OBJECT_UNLOCK (self);
+      g_value_take_boxed (value, s);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+/* The capture thread needs the clock and base time for every packet, keep
+ * our own copies so it doesn't have to take the object lock for those */
 static gboolean
-gst_wasapi_src_can_audioclient3 (GstWasapiSrc * self)
+gst_wasapi_src_set_clock (GstElement * element, GstClock * clock)
 {
-  if (self->sharemode == AUDCLNT_SHAREMODE_SHARED &&
-      self->try_audioclient3 && gst_wasapi_util_have_audioclient3 ())
-    return TRUE;
-  return FALSE;
+  GstWasapiSrc *self = GST_WASAPI_SRC (element);
+
+  g_mutex_lock (&self->clock_lock);
+  gst_object_replace ((GstObject **) & self->clock, (GstObject *) clock);
+  g_atomic_int_inc (&self->clock_cookie);
+  g_mutex_unlock (&self->clock_lock);
+  g_atomic_int_set (&self->drift_needs_reset, TRUE);
+
+  return GST_ELEMENT_CLASS (parent_class)->set_clock (element, clock);
 }
 
-static GstCaps *
-gst_wasapi_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+/* The clock of @copy, refreshed if set_clock() or a new base time came
+ * since. Only the thread that owns @copy calls this, and the lock is only
+ * taken for the refresh. */
+static inline GstClock *
+gst_wasapi_src_clock_copy (GstWasapiSrc * self, GstWasapiClockCopy * copy)
 {
-  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
-  WAVEFORMATEX *format = NULL;
-  GstCaps *caps = NULL;
-
-  GST_DEBUG_OBJECT (self, "entering get caps");
+  if (G_UNLIKELY (g_atomic_int_get (&self->clock_cookie) != copy->cookie)) {
+    g_mutex_lock (&self->clock_lock);
+    gst_object_replace ((GstObject **) & copy->clock,
+        (GstObject *) self->clock);
+    copy->base_time = self->base_time;
+    copy->cookie = g_atomic_int_get (&self->clock_cookie);
+    g_mutex_unlock (&self->clock_lock);
+  }
 
-  if (self->cached_caps) {
-    caps = gst_caps_ref (self->cached_caps);
-  } else {
-    GstCaps *template_caps;
-    gboolean ret;
+  return copy->clock;
+}
 
-    template_caps = gst_pad_get_pad_template_caps (bsrc->srcpad);
+/* With preroll-time the ringbuffer also runs in PAUSED, so the history is
+ * there when we go to PLAYING */
+static void
+gst_wasapi_src_start_preroll (GstWasapiSrc * self)
+{
+  GstAudioBaseSrc *src = GST_AUDIO_BASE_SRC (self);
 
-    if (!self->client) {
-      caps = template_caps;
-      goto out;
-    }
+  if (self->preroll_segments == 0 || src->ringbuffer == NULL ||
+      !gst_audio_ring_buffer_is_acquired (src->ringbuffer))
+    return;
 
-    ret = gst_wasapi_util_get_device_format (GST_ELEMENT (self),
-        self->sharemode, self->device, self->client, &format);
-    if (!ret) {
-      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
-          ("failed to detect format"));
-      gst_caps_unref (template_caps);
-      return NULL;
-    }
+  GST_DEBUG_OBJECT (self, "capturing %d segments ahead of PLAYING",
+      self->preroll_segments);
+  gst_audio_ring_buffer_may_start (src->ringbuffer, TRUE);
+  gst_audio_ring_buffer_start (src->ringbuffer);
+  /* Start over at the history once we're PLAYING again */
+  GST_OBJECT_LOCK (self);
+  src->next_sample = -1;
+  GST_OBJECT_UNLOCK (self);
+}
 
-    gst_wasapi_util_parse_waveformatex ((WAVEFORMATEXTENSIBLE *) format,
-        template_caps, &caps, &self->positions);
-    if (caps == NULL) {
-      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL), ("unknown format"));
-      gst_caps_unref (template_caps);
-      return NULL;
-    }
+static GstStateChangeReturn
+gst_wasapi_src_change_state (GstElement * element, GstStateChange transition)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (element);
+  GstStateChangeReturn ret;
 
-    {
-      gchar *pos_str = gst_audio_channel_positions_to_string (self->positions,
-          format->nChannels);
-      GST_INFO_OBJECT (self, "positions are: %s", pos_str);
-      g_free (pos_str);
-    }
+  /* The base time is only ever changed before going to PLAYING */
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_PLAYING) {
+    GstClockTime base_time = gst_element_get_base_time (element);
 
-    self->mix_format = format;
-    gst_caps_replace (&self->cached_caps, caps);
-    gst_caps_unref (template_caps);
+    g_mutex_lock (&self->clock_lock);
+    self->base_time = base_time;
+    g_atomic_int_inc (&self->clock_cookie);
+    g_mutex_unlock (&self->clock_lock);
   }
 
-  if (filter) {
-    GstCaps *filtered =
-        gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
-    gst_caps_unref (caps);
-    caps = filtered;
-  }
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
 
-out:
-  GST_DEBUG_OBJECT (self, "returning caps %" GST_PTR_FORMAT, caps);
-  return caps;
-}
+  /* The base class just paused the ringbuffer */
+  if (transition == GST_STATE_CHANGE_PLAYING_TO_PAUSED &&
+      ret != GST_STATE_CHANGE_FAILURE)
+    gst_wasapi_src_start_preroll (self);
 
+  return ret;
+}
 
-static gboolean
+/* Before each Initialize() of a new shared mode client */
+static void
+gst_wasapi_src_set_client_properties (GstWasapiSrc * self,
+    IAudioClient * client)
+{
+  GstWasapiStreamCategory category = self->category;
+  /* Without autoconvert the stream is in the mix format already, and
+   * loopback takes whatever the render streams make of the endpoint */
+  gboolean match_format = self->match_format && self->autoconvert &&
+      !self->loopback;
+
+  if (self->communications_effects && !self->loopback && !self->raw &&
+      category == DEFAULT_CATEGORY)
+    category = GST_WASAPI_STREAM_CATEGORY_COMMUNICATIONS;
+
+  if (self->sharemode == AUDCLNT_SHAREMODE_SHARED && !self->process_loopback &&
+      (self->raw || category != DEFAULT_CATEGORY || match_format))
+    gst_wasapi_util_set_client_properties (GST_ELEMENT (self), client,
+        category, self->raw, match_format);
+}
+
+/* Once the client is initialized, for os-effects */
+static void
+gst_wasapi_src_update_os_effects (GstWasapiSrc * self)
+{
+  GstStructure *effects = NULL;
+
+  if (self->sharemode == AUDCLNT_SHAREMODE_SHARED && !self->loopback &&
+      !self->process_loopback)
+    effects = gst_wasapi_util_get_audio_effects (GST_ELEMENT (self),
+        self->client, self->communications_effects && !self->raw);
+
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->os_effects, gst_structure_free);
+  self->os_effects = effects;
+  GST_OBJECT_UNLOCK (self);
+
+  if (effects != NULL)
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self),
+            gst_structure_copy (effects)));
+}
+
+/* Its periods end at the default one, power saving wants a large shared
+ * buffer instead */
+/* Only shared mode streams go through the audio engine */
+static gboolean
+gst_wasapi_src_rate_adjust (GstWasapiSrc * self)
+{
+  return self->drift_correction_method == GST_WASAPI_DRIFT_CORRECTION_ENGINE
+      && self->sharemode == AUDCLNT_SHAREMODE_SHARED && !self->process_loopback;
+}
+
+static gboolean
+gst_wasapi_src_can_audioclient3 (GstWasapiSrc * self)
+{
+  /* InitializeSharedAudioStream() has no rate adjustment */
+  if (self->sharemode != AUDCLNT_SHAREMODE_SHARED ||
+      !gst_wasapi_util_have_audioclient3 () || self->process_loopback ||
+      self->power_saving || gst_wasapi_src_rate_adjust (self))
+    return FALSE;
+
+  /* Low latency loopback needs it for anything below the default period,
+   * unless the endpoint is known not to go along */
+  if (self->loopback)
+    return (self->try_audioclient3 || self->low_latency) &&
+        gst_wasapi_device_cache_get_loopback_engine_period (GST_ELEMENT (self),
+        self->device);
+
+  return self->try_audioclient3;
+}
+
+/* A shared low latency client gets the smallest buffer the engine allows */
+static gboolean
+gst_wasapi_src_low_latency (GstWasapiSrc * self)
+{
+  return self->low_latency && !self->power_saving;
+}
+
+/* The base class only knows about the ringbuffer, add what the audio
+ * engine and driver hold on top of it, and the frames in the device buffer */
+static GstBuffer *
+gst_wasapi_src_export_replay (GstWasapiSrc * self, guint64 start,
+    guint64 stop)
+{
+  GstBuffer *buf = NULL;
+
+  GST_OBJECT_LOCK (self);
+  if (self->replay != NULL)
+    buf = gst_wasapi_replay_export (self->replay, start, stop);
+  GST_OBJECT_UNLOCK (self);
+
+  return buf;
+}
+
+static gboolean
+gst_wasapi_src_save_replay (GstWasapiSrc * self, guint64 start, guint64 stop,
+    const gchar * path)
+{
+  GstAudioInfo info;
+  GstBuffer *buf = NULL;
+  GError *err = NULL;
+  gboolean res;
+
+  /* Only the copy with the lock held, not the writing */
+  GST_OBJECT_LOCK (self);
+  if (self->replay != NULL) {
+    info = *gst_wasapi_replay_get_info (self->replay);
+    buf = gst_wasapi_replay_export (self->replay, start, stop);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (buf == NULL) {
+    GST_WARNING_OBJECT (self, "Nothing to save in that range");
+    return FALSE;
+  }
+
+  res = gst_wasapi_replay_write_wav (&info, buf, path, &err);
+  gst_buffer_unref (buf);
+  if (!res) {
+    GST_WARNING_OBJECT (self, "Failed to save replay: %s", err->message);
+    g_clear_error (&err);
+  }
+
+  return res;
+}
+
+static GstAudioRingBuffer *
+gst_wasapi_src_create_ringbuffer (GstAudioBaseSrc * src)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (src);
+  GstAudioRingBuffer *buffer;
+
+  if (!self->lockless_handoff)
+    return GST_AUDIO_BASE_SRC_CLASS (parent_class)->create_ringbuffer (src);
+
+  if (!gst_wasapi_src_ring_buffer_is_supported ()) {
+    GST_WARNING_OBJECT (self, "no WaitOnAddress(), ignoring lockless-handoff");
+    return GST_AUDIO_BASE_SRC_CLASS (parent_class)->create_ringbuffer (src);
+  }
+
+  GST_DEBUG_OBJECT (self, "creating lockless ringbuffer");
+  buffer = g_object_new (GST_TYPE_WASAPI_SRC_RING_BUFFER, NULL);
+  GST_OBJECT_PARENT (buffer) = GST_OBJECT_CAST (src);
+
+  return buffer;
+}
+
+/* Without a pool from downstream basesrc allocates every buffer on the
+ * heap, one per period. Keep our own of segsize buffers, aligned for SIMD. */
+static gboolean
+gst_wasapi_src_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  GstAllocationParams params;
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstCaps *caps;
+  guint size;
+
+  if (!GST_BASE_SRC_CLASS (parent_class)->decide_allocation (bsrc, query))
+    return FALSE;
+
+  gst_wasapi_src_clear_pool (self);
+
+  /* The first call after acquiring, so also where the memory gets locked */
+  if (ringbuffer != NULL && gst_audio_ring_buffer_is_acquired (ringbuffer)) {
+    gst_wasapi_src_lock_ring (self, ringbuffer);
+    if (GST_STATE (self) != GST_STATE_PLAYING)
+      gst_wasapi_src_start_preroll (self);
+  }
+
+  if ((pool = gst_base_src_get_buffer_pool (bsrc)) != NULL) {
+    gst_object_unref (pool);
+    return TRUE;
+  }
+
+  if (ringbuffer == NULL || !gst_audio_ring_buffer_is_acquired (ringbuffer))
+    return TRUE;
+  size = ringbuffer->spec.segsize;
+  if (self->output_frames > 0)
+    size = self->output_frames * GST_AUDIO_INFO_BPF (&ringbuffer->spec.info);
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  gst_allocation_params_init (&params);
+  if (gst_query_get_n_allocation_params (query) > 0)
+    gst_query_parse_nth_allocation_param (query, 0, NULL, &params);
+  params.align = MAX (params.align, 63);
+
+  pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  /* Unlimited, so create() never waits for downstream to return one */
+  gst_buffer_pool_config_set_params (config, caps, size,
+      ringbuffer->spec.segtotal, 0);
+  gst_buffer_pool_config_set_allocator (config, NULL, &params);
+  if (!gst_buffer_pool_set_config (pool, config) ||
+      !gst_buffer_pool_set_active (pool, TRUE)) {
+    GST_WARNING_OBJECT (self, "failed to set up buffer pool");
+    gst_object_unref (pool);
+    return TRUE;
+  }
+
+  GST_DEBUG_OBJECT (self, "recycling buffers of %u bytes", size);
+  self->pool = pool;
+  self->pool_size = size;
+
+  return TRUE;
+}
+
+/* From our pool when it has the right size, basesrc's allocation else */
+static GstFlowReturn
+gst_wasapi_src_alloc (GstWasapiSrc * self, guint64 offset, guint size,
+    GstBuffer ** buf)
+{
+  if (self->pool != NULL && size == self->pool_size)
+    return gst_buffer_pool_acquire_buffer (self->pool, buf, NULL);
+
+  return GST_BASE_SRC_CLASS (parent_class)->alloc (GST_BASE_SRC (self),
+      offset, size, buf);
+}
+
+static GstPad *
+gst_wasapi_src_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (element);
+
+  return gst_wasapi_fanout_request_pad (self->fanout, templ, name, caps);
+}
+
+static void
+gst_wasapi_src_release_pad (GstElement * element, GstPad * pad)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (element);
+
+  gst_wasapi_fanout_release_pad (self->fanout, pad);
+}
+
+/* Linking a pad downstream sends a reconfigure event upstream, through
+ * tee as well. With on-demand, that is when read() checks again whether
+ * anybody takes the buffers. */
+static gboolean
+gst_wasapi_src_event (GstBaseSrc * bsrc, GstEvent * event)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_RECONFIGURE && self->on_demand)
+    SetEvent (self->demand_event);
+
+  return GST_BASE_SRC_CLASS (parent_class)->event (bsrc, event);
+}
+
+static gboolean
+gst_wasapi_src_query (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+  gboolean res;
+
+  res = GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+
+  if (res && GST_QUERY_TYPE (query) == GST_QUERY_LATENCY && self->mix_format) {
+    GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+    gint rate = self->mix_format->nSamplesPerSec;
+    GstClockTime extra = 0;
+
+    /* Timestamps are shifted by the history we start with */
+    if (self->preroll_segments > 0)
+      extra += self->preroll_time;
+    /* The base class only accounts for one segment per buffer */
+    if (ringbuffer != NULL && self->output_frames > ringbuffer->samples_per_seg)
+      extra += gst_util_uint64_scale_int (self->output_frames -
+          ringbuffer->samples_per_seg, GST_SECOND, rate);
+
+    gst_wasapi_util_add_device_latency (GST_ELEMENT (self), query,
+        self->stream_latency, self->device_period_us * GST_USECOND,
+        gst_util_uint64_scale_int (self->buffer_frame_count, GST_SECOND,
+            rate), extra);
+  }
+
+  return res;
+}
+
+/* Also offers a float mix format as the integer formats we convert it to
+ * while reading, which spares an audioconvert downstream */
+static GstCaps *
+gst_wasapi_src_add_convert_caps (GstCaps * caps)
+{
+  GstCaps *int_caps;
+  GValue formats = G_VALUE_INIT, val = G_VALUE_INIT;
+
+  if (g_strcmp0 (gst_structure_get_string (gst_caps_get_structure (caps, 0),
+              "format"), "F32LE") != 0)
+    return caps;
+
+  g_value_init (&formats, GST_TYPE_LIST);
+  g_value_init (&val, G_TYPE_STRING);
+  g_value_set_static_string (&val, "S16LE");
+  gst_value_list_append_value (&formats, &val);
+  g_value_set_static_string (&val, "S32LE");
+  gst_value_list_append_value (&formats, &val);
+  g_value_unset (&val);
+
+  int_caps = gst_caps_copy (caps);
+  for (guint ii = 0; ii < gst_caps_get_size (int_caps); ii++)
+    gst_structure_set_value (gst_caps_get_structure (int_caps, ii), "format",
+        &formats);
+  g_value_unset (&formats);
+
+  /* The mix format stays first, so it's preferred */
+  return gst_caps_merge (caps, int_caps);
+}
+
+/* Offers @channels instead of the channels of a float mix format, with
+ * the default positions for that count, which we downmix to while reading */
+static GstCaps *
+gst_wasapi_src_set_downmix_caps (GstCaps * caps, gint channels)
+{
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  gint device_channels = 0;
+
+  if (g_strcmp0 (gst_structure_get_string (s, "format"), "F32LE") != 0 ||
+      !gst_structure_get_int (s, "channels", &device_channels) ||
+      channels >= device_channels)
+    return caps;
+
+  caps = gst_caps_make_writable (caps);
+  for (guint ii = 0; ii < gst_caps_get_size (caps); ii++) {
+    s = gst_caps_get_structure (caps, ii);
+    gst_structure_set (s, "channels", G_TYPE_INT, channels, NULL);
+    if (channels > 1)
+      gst_structure_set (s, "channel-mask", GST_TYPE_BITMASK,
+          gst_audio_channel_get_fallback_mask (channels), NULL);
+    else
+      gst_structure_remove_field (s, "channel-mask");
+  }
+
+  return caps;
+}
+
+/* The device channels channel-select picks of @channels into @selected,
+ * from 0. Returns how many, 0 for all of them. */
+static gint
+gst_wasapi_src_parse_channel_select (GstWasapiSrc * self, gint channels,
+    gint * selected)
+{
+  if (self->autoconvert || self->direct || self->zero_copy)
+    return 0;
+
+  return gst_wasapi_util_parse_channel_select (self->channel_select,
+      channels, selected);
+}
+
+/* Offers the @n_selected channels of channel-select instead of those of the
+ * mix format, without positions */
+static GstCaps *
+gst_wasapi_src_set_select_caps (GstCaps * caps, gint n_selected)
+{
+  caps = gst_caps_make_writable (caps);
+  for (guint ii = 0; ii < gst_caps_get_size (caps); ii++) {
+    GstStructure *s = gst_caps_get_structure (caps, ii);
+
+    gst_structure_set (s, "channels", G_TYPE_INT, n_selected, NULL);
+    if (n_selected > 1)
+      gst_structure_set (s, "channel-mask", GST_TYPE_BITMASK,
+          G_GUINT64_CONSTANT (0), NULL);
+    else
+      gst_structure_remove_field (s, "channel-mask");
+  }
+
+  return caps;
+}
+
+/* With direct capture each buffer is one packet, which we can deinterleave
+ * into planes while copying it out of the capture buffer */
+static GstCaps *
+gst_wasapi_src_add_planar_caps (GstCaps * caps)
+{
+  GstCaps *planar_caps = gst_caps_copy (caps);
+
+  for (guint ii = 0; ii < gst_caps_get_size (planar_caps); ii++)
+    gst_structure_set (gst_caps_get_structure (planar_caps, ii), "layout",
+        G_TYPE_STRING, "non-interleaved", NULL);
+
+  /* Interleaved stays first, so it's preferred */
+  return gst_caps_merge (caps, planar_caps);
+}
+
+static GstCaps *
+gst_wasapi_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+  WAVEFORMATEX *format = NULL;
+  GstCaps *caps = NULL;
+
+  GST_DEBUG_OBJECT (self, "entering get caps");
+
+  gst_wasapi_src_finish_open (self);
+
+  /* Probe again, a running client keeps the mix format it was prepared
+   * with, which it then owns on its own */
+  if (g_atomic_int_compare_and_exchange (&self->format_changed, TRUE, FALSE)) {
+    g_clear_pointer (&self->cached_caps, gst_caps_unref);
+    if (self->mix_format != self->device_format)
+      CoTaskMemFree (self->device_format);
+    self->device_format = NULL;
+  }
+
+  if (self->cached_caps) {
+    caps = gst_caps_ref (self->cached_caps);
+  } else {
+    GstCaps *template_caps;
+    IAudioClient *client;
+    gboolean ret;
+
+    template_caps = gst_pad_get_pad_template_caps (bsrc->srcpad);
+
+    if (!self->client) {
+      caps = template_caps;
+      goto out;
+    }
+
+    /* A process loopback client has no mix format, the endpoint does */
+    client = self->client;
+    if (self->process_loopback &&
+        FAILED (IMMDevice_Activate (self->device, &IID_IAudioClient,
+                CLSCTX_ALL, NULL, (void **) &client)))
+      client = NULL;
+
+    g_clear_pointer (&self->positions, g_free);
+    ret = client != NULL &&
+        gst_wasapi_device_cache_get_format (GST_ELEMENT (self), self->device,
+        client, self->sharemode, &format, &caps, &self->positions);
+    if (client != NULL && client != self->client)
+      IUnknown_Release (client);
+    if (!ret) {
+      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+          ("failed to detect format"));
+      gst_caps_unref (template_caps);
+      return NULL;
+    }
+
+    {
+      gchar *pos_str = gst_audio_channel_positions_to_string (self->positions,
+          format->nChannels);
+      GST_INFO_OBJECT (self, "positions are: %s", pos_str);
+      g_free (pos_str);
+    }
+
+    if (self->autoconvert && self->sharemode == AUDCLNT_SHAREMODE_SHARED)
+      caps = gst_wasapi_util_add_autoconvert_caps (caps);
+    else if (!self->direct && !self->zero_copy) {
+      gint selected[64];
+      gint n_selected = gst_wasapi_src_parse_channel_select (self,
+          format->nChannels, selected);
+
+      if (self->channel_select != NULL && n_selected == 0)
+        GST_ELEMENT_WARNING (self, RESOURCE, SETTINGS, (NULL),
+            ("channel-select \"%s\" doesn't fit the %d channels of the "
+                "device, capturing all of them", self->channel_select,
+                format->nChannels));
+      if (n_selected > 0)
+        caps = gst_wasapi_src_set_select_caps (caps, n_selected);
+      else if (self->channels > 0)
+        caps = gst_wasapi_src_set_downmix_caps (caps, self->channels);
+      caps = gst_wasapi_src_add_convert_caps (caps);
+    }
+
+    if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE)
+      caps = gst_caps_merge (caps,
+          gst_wasapi_device_cache_get_exclusive_caps (GST_ELEMENT (self),
+              self->device, self->client));
+
+    if (self->direct && !self->zero_copy)
+      caps = gst_wasapi_src_add_planar_caps (caps);
+
+    if (self->mix_format == NULL)
+      self->mix_format = format;
+    self->device_format = format;
+    gst_caps_replace (&self->cached_caps, caps);
+    gst_caps_unref (template_caps);
+  }
+
+  if (filter) {
+    GstCaps *filtered =
+        gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = filtered;
+  }
+
+out:
+  GST_DEBUG_OBJECT (self, "returning caps %" GST_PTR_FORMAT, caps);
+  return caps;
+}
+
+
+static void
+gst_wasapi_src_default_device_changed (EDataFlow flow, ERole role,
+    const gchar * id, gpointer user_data)
+{
+  GstWasapiSrc *self = user_data;
+
+  if (flow != (self->loopback ? eRender : eCapture) ||
+      role != gst_wasapi_device_role_to_erole (self->role) ||
+      self->device_list != NULL)
+    return;
+
+  /* Our stream is on the new device already */
+  if (self->routed) {
+    GST_INFO_OBJECT (self, "default device changed to %s", GST_STR_NULL (id));
+    GST_OBJECT_LOCK (self);
+    g_free (self->device_id);
+    self->device_id = g_strdup (id);
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+
+  GST_WARNING_OBJECT (self, "default device changed");
+  g_atomic_int_set (&self->default_changed, TRUE);
+  SetEvent (self->event_handle);
+}
+
+/* Position of @id in device-list, -1 if it's not in there */
+static gint
+gst_wasapi_src_find_device (GstWasapiSrc * self, const gchar * id)
+{
+  gint i, index = -1;
+
+  if (id == NULL)
+    return -1;
+
+  GST_OBJECT_LOCK (self);
+  for (i = 0; self->device_list && self->device_list[i]; i++) {
+    if (g_ascii_strcasecmp (self->device_list[i], id) == 0) {
+      index = i;
+      break;
+    }
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return index;
+}
+
+/* A device came or went. If it is ours, wake up read() right away, it then
+ * gets AUDCLNT_E_DEVICE_INVALIDATED from GetBuffer instead of waiting for
+ * an event that never comes. It also moves back to a device of device-list
+ * that we prefer once that is there again. */
+static void
+gst_wasapi_src_device_changed (GstWasapiSrc * self, const gchar * id,
+    gboolean available)
+{
+  gint index, current;
+  gboolean ours;
+
+  if (id == NULL)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  ours = self->device_id && g_ascii_strcasecmp (self->device_id, id) == 0;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!available) {
+    /* The engine moves a routed stream to whatever device is left */
+    if (ours && !self->routed) {
+      GST_WARNING_OBJECT (self, "device %s went away", id);
+      SetEvent (self->event_handle);
+    }
+    return;
+  }
+
+  index = gst_wasapi_src_find_device (self, id);
+  current = g_atomic_int_get (&self->device_index);
+  if (index >= 0 && (current < 0 || index < current)) {
+    GST_INFO_OBJECT (self, "preferred device %s is available", id);
+    g_atomic_int_set (&self->device_list_changed, TRUE);
+    SetEvent (self->event_handle);
+  }
+}
+
+static void
+gst_wasapi_src_device_state_changed (const gchar * id, DWORD state,
+    gpointer user_data)
+{
+  gst_wasapi_src_device_changed (user_data, id, state == DEVICE_STATE_ACTIVE);
+}
+
+static void
+gst_wasapi_src_device_added (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_src_device_changed (user_data, id, TRUE);
+}
+
+static void
+gst_wasapi_src_device_removed (const gchar * id, gpointer user_data)
+{
+  gst_wasapi_src_device_changed (user_data, id, FALSE);
+}
+
+/* The user picked another shared mode format for our device. Drop the
+ * cached caps and have the streaming thread negotiate again, read() keeps
+ * the stream running in the old format meanwhile. */
+static void
+gst_wasapi_src_property_value_changed (const gchar * id,
+    const PROPERTYKEY * key, gpointer user_data)
+{
+  GstWasapiSrc *self = user_data;
+  gboolean ours;
+
+  if (id == NULL || !IsEqualGUID (&key->fmtid,
+          &PKEY_AudioEngine_DeviceFormat.fmtid) ||
+      key->pid != PKEY_AudioEngine_DeviceFormat.pid)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  ours = self->device_id && g_ascii_strcasecmp (self->device_id, id) == 0;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!ours)
+    return;
+
+  GST_INFO_OBJECT (self, "device format changed");
+  gst_wasapi_device_cache_invalidate (id);
+  g_atomic_int_set (&self->format_changed, TRUE);
+  gst_pad_mark_reconfigure (GST_BASE_SRC_PAD (self));
+  SetEvent (self->event_handle);
+}
+
+static const GstWasapiNotifyFuncs notify_funcs = {
+  .device_state_changed = gst_wasapi_src_device_state_changed,
+  .device_added = gst_wasapi_src_device_added,
+  .device_removed = gst_wasapi_src_device_removed,
+  .property_value_changed = gst_wasapi_src_property_value_changed,
+  .default_device_changed = gst_wasapi_src_default_device_changed,
+};
+
+/* The client is dead. Wakes up read(), which then gets
+ * AUDCLNT_E_DEVICE_INVALIDATED from GetBuffer right away and reopens the
+ * device, or fails over, instead of waiting for an event that never
+ * comes. */
+static void
+gst_wasapi_src_session_disconnected (AudioSessionDisconnectReason reason,
+    gpointer user_data)
+{
+  GstWasapiSrc *self = user_data;
+
+  SetEvent (self->event_handle);
+}
+
+/* Watches the session of the current client instead of the old one */
+static void
+gst_wasapi_src_watch_session (GstWasapiSrc * self)
+{
+  g_clear_pointer (&self->session, gst_wasapi_session_unwatch);
+  self->session = gst_wasapi_session_watch (GST_ELEMENT (self), self->client,
+      gst_wasapi_src_session_disconnected, self);
+}
+
+/* Opens the first device of device-list that is there */
+static gboolean
+gst_wasapi_src_open_device_list (GstWasapiSrc * self, IMMDevice ** device,
+    IAudioClient ** client)
+{
+  gchar **ids;
+  gint i;
+  gboolean res = FALSE;
+
+  GST_OBJECT_LOCK (self);
+  ids = g_strdupv (self->device_list);
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; ids && ids[i]; i++) {
+    wchar_t *strid = g_utf8_to_utf16 (ids[i], -1, NULL, NULL, NULL);
+
+    res = strid && gst_wasapi_util_get_device_client (GST_ELEMENT (self),
+        self->loopback ? eRender : eCapture, self->role, strid, device,
+        client);
+    g_free (strid);
+
+    if (res) {
+      GST_INFO_OBJECT (self, "opened device %i of device-list, %s", i, ids[i]);
+      g_atomic_int_set (&self->device_index, i);
+      break;
+    }
+  }
+  g_strfreev (ids);
+
+  return res;
+}
+
+/* Before anything depends on the share mode, the caps do */
+static void
+gst_wasapi_src_auto_tune (GstWasapiSrc * self, IMMDevice * device)
+{
+  GstWasapiAutoTuneConfig config;
+
+  if (!gst_wasapi_autotune_get_config (GST_ELEMENT (self), device,
+          self->loopback ? "loopback" : "capture", &config))
+    return;
+
+  self->sharemode = config.exclusive ? AUDCLNT_SHAREMODE_EXCLUSIVE :
+      AUDCLNT_SHAREMODE_SHARED;
+  self->low_latency = config.low_latency;
+  self->try_audioclient3 = config.audioclient3;
+}
+
+/* With device-name and no device, looks up the endpoint, which is then the
+ * device until the next open() */
+static gboolean
+gst_wasapi_src_resolve_device_name (GstWasapiSrc * self)
+{
+  gchar *id;
+
+  if (self->device_name_resolved) {
+    g_clear_pointer (&self->device_strid, g_free);
+    self->device_name_resolved = FALSE;
+  }
+  if (self->device_strid != NULL || self->device_name == NULL)
+    return TRUE;
+
+  id = gst_wasapi_device_cache_find_by_name (GST_ELEMENT (self),
+      self->loopback ? eRender : eCapture, self->device_name);
+  if (id == NULL)
+    return FALSE;
+
+  self->device_strid = g_utf8_to_utf16 (id, -1, NULL, NULL, NULL);
+  self->device_name_resolved = TRUE;
+  g_free (id);
+
+  return TRUE;
+}
+
+/* With stream-routing, the default capture device through the virtual
+ * default device, which the engine moves to a new default device itself */
+static gboolean
+gst_wasapi_src_open_routed (GstWasapiSrc * self, IMMDevice ** device,
+    IAudioClient ** client)
+{
+  self->routed = self->stream_routing && !self->device_strid &&
+      !self->loopback && self->sharemode == AUDCLNT_SHAREMODE_SHARED &&
+      !self->auto_tune && !self->use_device_clock && !self->share_client &&
+      gst_wasapi_util_get_routed_client (GST_ELEMENT (self), eCapture,
+      self->role, device, client);
+
+  return self->routed;
+}
+
+static gboolean
+gst_wasapi_src_open_device (GstWasapiSrc * self)
+{
+  gboolean res = FALSE;
+  IAudioClient *client = NULL;
+  IMMDevice *device = NULL;
+
+  self->routed = FALSE;
+
+  /* When the default device changes, read() switches to the new one with
+   * follow-default-device, see gst_wasapi_src_switch_device() */
+  if (self->device_list == NULL &&
+      !gst_wasapi_src_resolve_device_name (self)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND, (NULL),
+        ("No %s device named %s", self->loopback ? "playback" : "capture",
+            self->device_name));
+    goto beach;
+  } else if (self->device_list != NULL) {
+    if (!gst_wasapi_src_open_device_list (self, &device, &client)) {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+          ("None of the devices in device-list is available"));
+      goto beach;
+    }
+  } else if (!gst_wasapi_src_open_routed (self, &device, &client) &&
+      !gst_wasapi_util_get_device_client (GST_ELEMENT (self),
+          self->loopback ? eRender : eCapture, self->role, self->device_strid,
+          &device, &client)) {
+    if (!self->device_strid)
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+          ("Failed to get default device"));
+    else
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+          ("Failed to open device %S", self->device_strid));
+    goto beach;
+  }
+
+  /* The endpoint stays ours for the format, name and clock */
+  if (self->target_pid != 0 && !self->loopback)
+    GST_WARNING_OBJECT (self, "target-pid needs loopback=true, capturing the "
+        "endpoint");
+  self->process_loopback = self->loopback && self->target_pid != 0;
+  if (self->process_loopback) {
+    IUnknown_Release (client);
+    client = NULL;
+    if (self->sharemode != AUDCLNT_SHAREMODE_SHARED) {
+      GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS, (NULL),
+          ("target-pid only works in shared mode"));
+      IUnknown_Release (device);
+      goto beach;
+    }
+    if (!gst_wasapi_process_loopback_activate (GST_ELEMENT (self),
+            self->target_pid, self->target_mode, &client)) {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+          ("Failed to capture process %u, this needs Windows 10 2004 or "
+              "newer", self->target_pid));
+      IUnknown_Release (device);
+      goto beach;
+    }
+  }
+
+  /* Process loopback is always shared */
+  if (self->auto_tune && !self->process_loopback)
+    gst_wasapi_src_auto_tune (self, device);
+
+  /* Also for a selected device, to notice right away when it's gone */
+  g_atomic_int_set (&self->default_changed, FALSE);
+  g_atomic_int_set (&self->device_list_changed, FALSE);
+  GST_OBJECT_LOCK (self);
+  self->device_id = gst_wasapi_util_get_device_id (device);
+  GST_OBJECT_UNLOCK (self);
+  self->notify_id = gst_wasapi_notify_subscribe (GST_ELEMENT (self),
+      &notify_funcs, self);
+  self->client = client;
+  self->device = device;
+  res = TRUE;
+
+  /* Provide the clock of the endpoint instead of ours, it is the same for
+   * all elements on this device */
+  if (self->use_device_clock &&
+      (self->shared_clock = gst_wasapi_device_clock_get_shared (device))) {
+    GST_OBJECT_LOCK (self);
+    self->own_clock = GST_AUDIO_BASE_SRC (self)->clock;
+    GST_AUDIO_BASE_SRC (self)->clock = gst_object_ref (self->shared_clock);
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  self->device_description =
+      gst_wasapi_device_cache_get_description (GST_ELEMENT (self), device);
+  GST_INFO_OBJECT (self, "device description %s",
+      GST_STR_NULL (self->device_description));
+
+beach:
+  return res;
+}
+
+static gpointer
+gst_wasapi_src_open_thread_func (gpointer user_data)
+{
+  GstWasapiSrc *self = user_data;
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  gst_wasapi_src_open_device (self);
+  CoUninitialize ();
+
+  return NULL;
+}
+
+/* Waits for an async-open to be done, FALSE if it failed and posted the
+ * error. Everything it set up is ours once joined. */
+static gboolean
+gst_wasapi_src_finish_open (GstWasapiSrc * self)
+{
+  g_mutex_lock (&self->open_lock);
+  if (self->open_thread != NULL) {
+    GST_DEBUG_OBJECT (self, "waiting for the device to open");
+    g_thread_join (self->open_thread);
+    self->open_thread = NULL;
+  }
+  g_mutex_unlock (&self->open_lock);
+
+  return self->client != NULL;
+}
+
+/* Not in init(), elements that autoplugging only probes and discards never
+ * get here. They stay until dispose. */
+static void
+gst_wasapi_src_create_events (GstWasapiSrc * self)
+{
+  if (self->event_handle != NULL)
+    return;
+
+  self->event_handle = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->capture_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->first_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  self->demand_event = CreateEvent (NULL, FALSE, FALSE, NULL);
+  /* Manual-reset, set while the drain thread is to stop */
+  self->drain_stop = CreateEvent (NULL, TRUE, FALSE, NULL);
+  /* Manual-reset, stays signalled until unlock_stop() */
+  self->cancel_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  gst_wasapi_cancel_init (&self->stop);
+}
+
+static gboolean
 gst_wasapi_src_open (GstAudioSrc * asrc)
 {
-  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
-  gboolean res = FALSE;
-  IAudioClient *client = NULL;
-  IMMDevice *device = NULL;
-  IPropertyStore *prop_store = NULL;
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+
+  gst_wasapi_src_create_events (self);
+
+  if (self->client)
+    return TRUE;
+
+  gst_wasapi_startup_times_reset (&self->startup_times,
+      GST_WASAPI_STARTUP_ENUMERATOR);
+
+  if (!self->async_open)
+    return gst_wasapi_src_open_device (self);
+
+  GST_DEBUG_OBJECT (self, "opening the device in the background");
+  g_mutex_lock (&self->open_lock);
+  self->open_thread = g_thread_new ("wasapi-open",
+      gst_wasapi_src_open_thread_func, self);
+  g_mutex_unlock (&self->open_lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_src_close (GstAudioSrc * asrc)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+
+  gst_wasapi_src_finish_open (self);
+  gst_wasapi_src_release_warm_client (self);
+  /* After a failed prepare */
+  g_clear_pointer (&self->bus_queue, gst_wasapi_bus_queue_free);
+
+  gst_wasapi_src_release_warm_client (self);
+
+  if (self->notify_id != 0) {
+    gst_wasapi_notify_unsubscribe (self->notify_id);
+    self->notify_id = 0;
+  }
+  g_atomic_int_set (&self->device_index, -1);
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->device_id, g_free);
+  GST_OBJECT_UNLOCK (self);
+
+  /* The base class invalidates its clock when disposed, so never leave the
+   * shared one there */
+  if (self->shared_clock != NULL) {
+    GST_OBJECT_LOCK (self);
+    gst_object_unref (GST_AUDIO_BASE_SRC (self)->clock);
+    GST_AUDIO_BASE_SRC (self)->clock = self->own_clock;
+    self->own_clock = NULL;
+    GST_OBJECT_UNLOCK (self);
+    gst_object_unref (self->shared_clock);
+    self->shared_clock = NULL;
+  }
+
+  if (self->device != NULL) {
+    IUnknown_Release (self->device);
+    self->device = NULL;
+  }
+
+  if (self->client != NULL) {
+    IUnknown_Release (self->client);
+    self->client = NULL;
+  }
+  self->client_initialized = FALSE;
+
+  /* The next device may well be a different one */
+  gst_wasapi_src_clear_format (self);
+
+  return TRUE;
+}
+
+/* Whether @info is one of the probed exclusive formats, rather than one we
+ * convert the device format to */
+static gboolean
+gst_wasapi_src_is_exclusive_format (GstWasapiSrc * self, GstAudioInfo * info)
+{
+  GstCaps *exclusive_caps, *caps;
+  gboolean ret;
+
+  if (gst_wasapi_util_waveformatex_matches_info (self->device_format, info))
+    return FALSE;
+
+  exclusive_caps =
+      gst_wasapi_device_cache_get_exclusive_caps (GST_ELEMENT (self),
+      self->device, self->client);
+  caps = gst_audio_info_to_caps (info);
+  ret = gst_caps_can_intersect (caps, exclusive_caps);
+  gst_caps_unref (caps);
+  gst_caps_unref (exclusive_caps);
+
+  return ret;
+}
+
+/* Releases what belongs to the client kept by unprepare() */
+static void
+gst_wasapi_src_release_warm_client (GstWasapiSrc * self)
+{
+  if (self->capture_client != NULL) {
+    IUnknown_Release (self->capture_client);
+    self->capture_client = NULL;
+  }
+
+  if (self->client_clock != NULL) {
+    IUnknown_Release (self->client_clock);
+    self->client_clock = NULL;
+  }
+
+  gst_caps_replace (&self->warm_caps, NULL);
+}
+
+/* A client can only be initialized once, so we need a new one when we are
+ * prepared again, or if the one kept by unprepare() was initialized for
+ * other caps */
+static gboolean
+gst_wasapi_src_renew_client (GstWasapiSrc * self)
+{
+  HRESULT hr;
+
+  gst_wasapi_src_release_warm_client (self);
+  self->client_initialized = FALSE;
+  IUnknown_Release (self->client);
+  self->client = NULL;
+
+  if (self->process_loopback)
+    return gst_wasapi_process_loopback_activate (GST_ELEMENT (self),
+        self->target_pid, self->target_mode, &self->client);
+
+  if (gst_wasapi_util_have_audioclient3 ())
+    hr = IMMDevice_Activate (self->device, &IID_IAudioClient3, CLSCTX_ALL,
+        NULL, (void **) &self->client);
+  else
+    hr = IMMDevice_Activate (self->device, &IID_IAudioClient, CLSCTX_ALL,
+        NULL, (void **) &self->client);
+  HR_FAILED_RET (hr, IMMDevice::Activate (IID_IAudioClient), FALSE);
+
+  return TRUE;
+}
+
+static void
+gst_wasapi_src_clear_aec_ref (GstWasapiSrc * self)
+{
+  g_clear_pointer (&self->aec_ref, gst_wasapi_aec_ref_unref);
+  g_clear_pointer (&self->aec_data, g_free);
+  self->aec_data_frames = 0;
+}
+
+/* What the threads that read the device leave to the bus queue to post.
+ * The measurements are kept by their modules, the helper builds the
+ * structures from there. */
+enum
+{
+  SRC_NOTIFY_RESTART = 1,
+  SRC_NOTIFY_OVERRUN,
+  SRC_NOTIFY_WATERMARK,
+  SRC_NOTIFY_STARTUP,
+  SRC_NOTIFY_LEVEL,
+  SRC_NOTIFY_SPECTRUM,
+  SRC_NOTIFY_GLITCHES,
+  SRC_NOTIFY_PULSE,
+  SRC_NOTIFY_HEALTH,
+};
+
+static GstStructure *gst_wasapi_src_health_structure (GstWasapiSrc * self,
+    gint64 now);
+
+static void
+gst_wasapi_src_notified (GstElement * element,
+    const GstWasapiNotification * notification)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (element);
+  const guint64 *args = notification->args;
+  GstStructure *s = NULL;
+
+  switch (notification->kind) {
+    case SRC_NOTIFY_RESTART:
+      if (!gst_element_post_message (element,
+              gst_message_new_element (GST_OBJECT (self),
+                  gst_structure_new_empty ("wasapi_restart"))))
+        GST_WARNING_OBJECT (self, "Unable to send message");
+      return;
+    case SRC_NOTIFY_OVERRUN:
+      GST_ELEMENT_WARNING (self, CORE, CLOCK,
+          (_("Can't record audio fast enough")),
+          ("Dropped %" G_GUINT64_FORMAT " samples. This is most likely "
+              "because downstream can't keep up and is consuming samples too "
+              "slowly.", args[0]));
+      return;
+    case SRC_NOTIFY_WATERMARK:
+      s = gst_structure_new ("wasapi-ring-watermark",
+          "high", G_TYPE_BOOLEAN, (gboolean) args[0],
+          "fill", G_TYPE_UINT, (guint) args[1],
+          "overflow-fill", G_TYPE_UINT, (guint) args[2], NULL);
+      break;
+    case SRC_NOTIFY_STARTUP:
+      s = gst_wasapi_startup_times_to_structure (&self->startup_times,
+          "wasapi-startup");
+      break;
+    case SRC_NOTIFY_LEVEL:
+      s = gst_wasapi_level_take_structure (self->level);
+      break;
+    case SRC_NOTIFY_SPECTRUM:
+      s = gst_wasapi_spectrum_take_structure (self->spectrum);
+      break;
+    case SRC_NOTIFY_GLITCHES:
+      s = gst_wasapi_glitch_log_take (&self->glitch_log);
+      if (s != NULL && self->etw_tracker != NULL)
+        gst_wasapi_etw_tracker_to_structure (self->etw_tracker, s);
+      break;
+    case SRC_NOTIFY_PULSE:
+      GST_DEBUG_OBJECT (self, "round trip %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (args[0]));
+      s = gst_wasapi_latency_probe_add (self->latency_probe, args[0]);
+      break;
+    case SRC_NOTIFY_HEALTH:
+      s = gst_wasapi_src_health_structure (self, (gint64) args[0]);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+
+  /* Taken by a notification before it */
+  if (s == NULL)
+    return;
+
+  gst_element_post_message (element,
+      gst_message_new_element (GST_OBJECT (self), s));
+}
+
+/* Through the bus queue while prepared, so the threads that read the device
+ * neither format nor take the bus lock. Directly otherwise. */
+static void
+gst_wasapi_src_notify (GstWasapiSrc * self, guint kind, guint64 arg0,
+    guint64 arg1, guint64 arg2)
+{
+  GstWasapiNotification notification = { kind, {arg0, arg1, arg2} };
+
+  if (self->bus_queue != NULL)
+    gst_wasapi_bus_queue_push (self->bus_queue, kind, arg0, arg1, arg2);
+  else
+    gst_wasapi_src_notified (GST_ELEMENT (self), &notification);
+}
+
+/* What sources with share-client have to agree on to capture from the
+ * same stream, NULL if this one can't share */
+static gchar *
+gst_wasapi_src_share_key (GstWasapiSrc * self, guint64 latency_time,
+    guint64 buffer_time)
+{
+  WAVEFORMATEX *format = self->mix_format;
+  gchar *key;
+
+  if (!self->use_engine || !self->share_client || self->prewarm ||
+      self->sharemode != AUDCLNT_SHAREMODE_SHARED || self->process_loopback ||
+      self->shared_clock != NULL)
+    return NULL;
+
+  GST_OBJECT_LOCK (self);
+  key = self->device_id == NULL ? NULL :
+      g_strdup_printf ("%s|%d|%d|%d|%d|%d|%u|%u|%u|%u|%" G_GUINT64_FORMAT "|%"
+      G_GUINT64_FORMAT, self->device_id, self->loopback, self->low_latency,
+      self->autoconvert, self->raw, self->category, format->wFormatTag,
+      (guint) format->nSamplesPerSec, format->nChannels,
+      format->wBitsPerSample, latency_time, buffer_time);
+  GST_OBJECT_UNLOCK (self);
+
+  return key;
+}
+
+static gboolean
+gst_wasapi_src_prepare (GstAudioSrc * asrc, GstAudioRingBufferSpec * spec)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  GstWasapiCaptureStream *follower = NULL;
+  gchar *share_key = NULL;
+  gboolean res = FALSE, warm = FALSE, same_format;
+  REFERENCE_TIME latency_rt;
+  guint bpf, rate, devicep_frames, buffer_frames, segment_frames;
+  guint64 latency_time = spec->latency_time, buffer_time = spec->buffer_time;
+  guint64 start;
+  gsize overflow_size;
+  HRESULT hr;
+
+  /* Normally get_caps() waited already */
+  if (!gst_wasapi_src_finish_open (self))
+    return FALSE;
+
+  gst_wasapi_startup_times_reset (&self->startup_times,
+      GST_WASAPI_STARTUP_INITIALIZE);
+
+  if (self->bus_queue == NULL)
+    self->bus_queue = gst_wasapi_bus_queue_new (GST_ELEMENT (self),
+        gst_wasapi_src_notified);
+
+  /* What read() registers its thread with, so it never looks at the
+   * properties */
+  g_free (self->thread_task);
+  GST_OBJECT_LOCK (self);
+  self->thread_task = g_strdup (self->mmcss_task);
+  self->thread_priority = self->mmcss_priority;
+  self->thread_group = self->processor_group;
+  self->thread_mask = self->thread_affinity;
+  self->thread_flags =
+      (self->power_throttling ? 0 : GST_WASAPI_THREAD_NO_THROTTLING) |
+      (self->performance_cores ? GST_WASAPI_THREAD_PERFORMANCE_CORES : 0);
+  GST_OBJECT_UNLOCK (self);
+
+  /* create() talks to the capture client itself in those */
+  self->use_engine = self->shared_engine && !self->direct && !self->zero_copy;
+
+  /* Exclusive mode only double buffers, the timer would always be late */
+  self->power_saving = self->scheduling == GST_WASAPI_SCHEDULING_POWER_SAVING
+      && self->sharemode == AUDCLNT_SHAREMODE_SHARED && !self->use_engine &&
+      !self->direct && !self->zero_copy;
+  if (self->scheduling == GST_WASAPI_SCHEDULING_POWER_SAVING &&
+      !self->power_saving)
+    GST_WARNING_OBJECT (self, "no power saving in this mode, waiting for "
+        "events");
+
+  if (self->scheduling == GST_WASAPI_SCHEDULING_TIMER && !self->use_engine &&
+      !self->direct && !self->zero_copy) {
+    self->timer_handle = CreateWaitableTimerExW (NULL, NULL,
+        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    /* Before Windows 10 1803 */
+    if (self->timer_handle == NULL) {
+      GST_INFO_OBJECT (self, "no high resolution timers, using a regular one");
+      self->timer_handle = CreateWaitableTimer (NULL, FALSE, NULL);
+    }
+  } else if (self->power_saving) {
+    /* High resolution timers are never coalesced */
+    self->timer_handle = CreateWaitableTimer (NULL, FALSE, NULL);
+  }
+
+  /* Two segments in the device and one for the wakeups the system delays
+   * to coalesce them with others */
+  if (self->power_saving)
+    spec->buffer_time = MAX (spec->buffer_time, 3 * spec->latency_time);
+
+  if (GST_AUDIO_INFO_LAYOUT (&spec->info) == GST_AUDIO_LAYOUT_NON_INTERLEAVED
+      && (!self->direct || self->zero_copy)) {
+    GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+        ("non-interleaved output needs direct=true and zero-copy=false"));
+    goto beach;
+  }
+
+  /* From here on we work in the format of downstream, the engine converts
+   * to it or the device runs in it */
+  if (self->mix_format != self->device_format)
+    CoTaskMemFree (self->mix_format);
+  self->mix_format = self->device_format;
+  if ((self->autoconvert && self->sharemode == AUDCLNT_SHAREMODE_SHARED) ||
+      (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE &&
+          gst_wasapi_src_is_exclusive_format (self, &spec->info)))
+    self->mix_format =
+        gst_wasapi_util_audio_info_to_waveformatex (&spec->info,
+        self->device_format);
+
+  /* channel-select numbers the channels in device order */
+  self->n_selected = gst_wasapi_src_parse_channel_select (self,
+      self->mix_format->nChannels, self->selected);
+  if (self->n_selected > 0)
+    GST_INFO_OBJECT (self, "keeping %d of %d channels", self->n_selected,
+        self->mix_format->nChannels);
+
+  /* Zero-copy buffers are the device memory, those stay in device order */
+  self->reorder = FALSE;
+  if (!self->zero_copy && self->n_selected == 0 && self->positions != NULL &&
+      self->positions[0] != GST_AUDIO_CHANNEL_POSITION_NONE &&
+      self->mix_format->nChannels == self->device_format->nChannels &&
+      self->mix_format->nChannels <= 64) {
+    gint channels = self->mix_format->nChannels;
+
+    memcpy (self->valid_positions, self->positions,
+        channels * sizeof (GstAudioChannelPosition));
+    if (gst_audio_channel_positions_to_valid_order (self->valid_positions,
+            channels))
+      self->reorder = gst_wasapi_util_get_reorder_map (channels,
+          self->positions, self->valid_positions, self->reorder_map);
+  }
+
+  /* Otherwise caps other than the mix format are ours to convert to, after
+   * channel-select picked the channels */
+  g_clear_pointer (&self->convert, gst_wasapi_convert_free);
+  if (self->n_selected > 0) {
+    GstAudioInfo device_info = spec->info;
+
+    device_info.channels = self->mix_format->nChannels;
+    same_format = GST_AUDIO_INFO_CHANNELS (&spec->info) == self->n_selected &&
+        gst_wasapi_util_waveformatex_matches_info (self->mix_format,
+        &device_info);
+  } else {
+    same_format = gst_wasapi_util_waveformatex_matches_info (self->mix_format,
+        &spec->info);
+  }
+  if (!same_format) {
+    GstAudioInfo mix_info;
+
+    if (self->n_selected > 0)
+      gst_audio_info_set_format (&mix_info, GST_AUDIO_FORMAT_F32LE,
+          self->mix_format->nSamplesPerSec, self->n_selected, NULL);
+    else
+      gst_audio_info_set_format (&mix_info, GST_AUDIO_FORMAT_F32LE,
+          self->mix_format->nSamplesPerSec, self->mix_format->nChannels,
+          self->reorder ? self->valid_positions : self->positions);
+    if (!self->direct && !self->zero_copy)
+      self->convert = gst_wasapi_convert_new (&mix_info, &spec->info,
+          self->dither);
+    if (self->convert == NULL) {
+      GST_ELEMENT_ERROR (self, STREAM, FORMAT, (NULL),
+          ("can't convert the mix format to %s with %d channels",
+              GST_AUDIO_INFO_NAME (&spec->info),
+              GST_AUDIO_INFO_CHANNELS (&spec->info)));
+      goto beach;
+    }
+    GST_INFO_OBJECT (self, "converting the mix format to %s with %d "
+        "channels%s", GST_AUDIO_INFO_NAME (&spec->info),
+        GST_AUDIO_INFO_CHANNELS (&spec->info),
+        self->dither ? " with dither" : "");
+  }
+
+  g_clear_pointer (&self->level, gst_wasapi_level_free);
+  if (self->level_mode == GST_WASAPI_LEVEL_MODE_ENDPOINT)
+    self->level = gst_wasapi_level_new_endpoint (GST_ELEMENT (self),
+        self->device, &spec->info, self->level_interval);
+  else if (self->level_mode == GST_WASAPI_LEVEL_MODE_SAMPLES &&
+      !self->zero_copy)
+    self->level = gst_wasapi_level_new (&spec->info, self->level_interval);
+  if (self->level_mode != GST_WASAPI_LEVEL_MODE_NONE && self->level == NULL)
+    GST_WARNING_OBJECT (self, "can't measure the level, not posting messages");
+
+  g_clear_pointer (&self->spectrum, gst_wasapi_spectrum_free);
+  if (self->spectrum_enabled && !self->zero_copy)
+    self->spectrum = gst_wasapi_spectrum_new (&spec->info,
+        self->spectrum_bands, self->spectrum_interval);
+  if (self->spectrum_enabled && self->spectrum == NULL)
+    GST_WARNING_OBJECT (self, "can't analyze the spectrum, not posting "
+        "messages");
+
+  self->health_start = g_get_monotonic_time ();
+  self->health_next = 0;
+
+  gst_wasapi_glitch_log_reset (&self->glitch_log,
+      self->mix_format->nSamplesPerSec, self->glitch_interval);
+  if (self->etw_attribution) {
+    GstWasapiEtwTracker *tracker = gst_wasapi_etw_tracker_new (GST_ELEMENT
+        (self));
+
+    if (tracker == NULL)
+      GST_ELEMENT_WARNING (self, RESOURCE, SETTINGS, (NULL),
+          ("Can't consume the audio engine ETW events, not attributing "
+              "glitches"));
+    GST_OBJECT_LOCK (self);
+    self->etw_tracker = tracker;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  g_clear_pointer (&self->packet_log, gst_wasapi_packet_log_free);
+  if (self->packet_log_path != NULL && !self->direct && !self->zero_copy)
+    self->packet_log = gst_wasapi_packet_log_new (self->packet_log_path,
+        self->mix_format);
+  self->packet_log_wait_us = 0;
+
+  g_clear_pointer (&self->latency_probe, gst_wasapi_latency_probe_free);
+  if (self->probe_latency && !self->direct && !self->zero_copy) {
+    self->latency_probe = gst_wasapi_latency_probe_new (self->mix_format);
+    if (self->latency_probe == NULL)
+      GST_WARNING_OBJECT (self, "can't look for latency pulses in this "
+          "format");
+  }
+
+  g_clear_pointer (&self->vad_detector, gst_wasapi_vad_free);
+  if (self->vad && !self->direct && !self->zero_copy) {
+    self->vad_detector = gst_wasapi_vad_new (&spec->info, self->vad_threshold,
+        self->vad_hangover);
+    if (self->vad_detector == NULL)
+      GST_WARNING_OBJECT (self, "can't detect voice in %s, pushing everything",
+          GST_AUDIO_INFO_NAME (&spec->info));
+  }
+
+  /* On the packets, before any conversion */
+  g_clear_pointer (&self->silence, gst_wasapi_silence_free);
+  if (self->detect_silence) {
+    self->silence = gst_wasapi_silence_new (self->mix_format,
+        self->silence_threshold);
+    if (self->silence == NULL)
+      GST_INFO_OBJECT (self, "can't detect silence in the mix format");
+  }
+
+  if (self->warm_caps != NULL) {
+    if (gst_caps_is_equal (self->warm_caps, spec->caps) &&
+        self->warm_latency_time == latency_time &&
+        self->warm_buffer_time == buffer_time &&
+        self->warm_engine == self->use_engine) {
+      GST_INFO_OBJECT (self, "reusing the prewarmed client");
+      devicep_frames = self->warm_devicep_frames;
+      warm = TRUE;
+    } else {
+      GST_INFO_OBJECT (self, "caps changed, not reusing the prewarmed client");
+      if (!gst_wasapi_src_renew_client (self))
+        goto beach;
+    }
+  } else if (self->client_initialized && !gst_wasapi_src_renew_client (self)) {
+    goto beach;
+  }
+
+  /* Another source already captures the endpoint like this, its client is
+   * initialized and its events go to the capture thread */
+  self->client_shared = FALSE;
+  if (!warm)
+    share_key = gst_wasapi_src_share_key (self, latency_time, buffer_time);
+  if (share_key != NULL) {
+    IAudioClient *client;
+
+    follower = gst_wasapi_capture_follow (GST_ELEMENT (self), share_key,
+        self->event_handle, &client, &buffer_frames, &devicep_frames);
+    if (follower != NULL) {
+      IUnknown_Release (self->client);
+      self->client = client;
+    }
+    self->client_shared = TRUE;
+  }
+
+  if (!warm && follower == NULL)
+    gst_wasapi_src_set_client_properties (self, self->client);
+
+  /* The engine periods of IAudioClient3 are only valid for the mix format */
+  start = gst_wasapi_util_get_qpc_position ();
+  if (warm || follower != NULL) {
+    /* Initialized, with its event handle, clock and capture client */
+  } else if (self->process_loopback) {
+    if (!gst_wasapi_process_loopback_initialize (GST_ELEMENT (self), spec,
+            self->client, self->mix_format, &devicep_frames))
+      goto beach;
+  } else if (!self->autoconvert && gst_wasapi_src_can_audioclient3 (self)) {
+    if (gst_wasapi_util_initialize_audioclient3 (GST_ELEMENT (self), spec,
+            (IAudioClient3 *) self->client, self->mix_format, self->low_latency,
+            self->loopback, &devicep_frames)) {
+      if (self->loopback)
+        gst_wasapi_device_cache_set_loopback_engine_period (GST_ELEMENT (self),
+            self->device, TRUE);
+    } else if (self->loopback) {
+      GST_INFO_OBJECT (self, "no small engine periods for loopback on this "
+          "endpoint, falling back to the default period");
+      gst_wasapi_device_cache_set_loopback_engine_period (GST_ELEMENT (self),
+          self->device, FALSE);
+      if (!gst_wasapi_src_renew_client (self))
+        goto beach;
+      gst_wasapi_src_set_client_properties (self, self->client);
+      if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
+              self->device, &self->client, self->mix_format, self->sharemode,
+              gst_wasapi_src_low_latency (self), self->loopback,
+              self->autoconvert, gst_wasapi_src_rate_adjust (self),
+              &devicep_frames))
+        goto beach;
+    } else {
+      goto beach;
+    }
+  } else {
+    if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
+            self->device, &self->client, self->mix_format, self->sharemode,
+            gst_wasapi_src_low_latency (self), self->loopback,
+            self->autoconvert, gst_wasapi_src_rate_adjust (self),
+            &devicep_frames))
+      goto beach;
+  }
+  gst_wasapi_startup_times_add (GST_ELEMENT (self),
+      GST_WASAPI_STARTUP_INITIALIZE, start);
+  self->client_initialized = TRUE;
+  gst_wasapi_src_update_os_effects (self);
+
+  if (!warm && follower == NULL && gst_wasapi_src_rate_adjust (self) &&
+      gst_wasapi_util_get_clock_adjustment (GST_ELEMENT (self), self->client,
+          &self->clock_adjust))
+    GST_INFO_OBJECT (self, "the engine follows the pipeline clock");
+  self->engine_rate = self->mix_format->nSamplesPerSec;
+  self->engine_last_devpos = -1;
+
+  bpf = GST_AUDIO_INFO_BPF (&spec->info);
+  rate = GST_AUDIO_INFO_RATE (&spec->info);
+
+  /* Total size in frames of the allocated buffer that we will read from */
+  hr = IAudioClient_GetBufferSize (self->client, &buffer_frames);
+  HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
+
+  /* Event driven exclusive streams are double buffered with two buffers of
+   * one period, each event hands over exactly one of them */
+  if (self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE)
+    devicep_frames = buffer_frames;
+
+  GST_INFO_OBJECT (self, "buffer size is %i frames, device period is %i "
+      "frames, bpf is %i bytes, rate is %i Hz", buffer_frames,
+      devicep_frames, bpf, rate);
+  self->sample_rate = rate;
+
+  /* Whole periods of latency-time when power saving, one otherwise */
+  segment_frames = devicep_frames;
+  if (self->power_saving)
+    segment_frames *= MAX (gst_util_uint64_scale_int (spec->latency_time,
+            rate, G_USEC_PER_SEC) / devicep_frames, 1);
+  self->wakeup_us = gst_util_uint64_scale_int (segment_frames,
+      G_USEC_PER_SEC, rate);
+
+  /* Actual latency-time/buffer-time will be different now */
+  spec->segsize = segment_frames * bpf;
+
+  /* We need a minimum of 2 segments to ensure glitch-free playback */
+  spec->segtotal = MAX (buffer_frames * bpf / spec->segsize, 2) + 1;
+  if (self->adaptive_buffer) {
+    guint extra = gst_wasapi_device_cache_get_ring_extra (GST_ELEMENT (self),
+        self->device);
+
+    gst_wasapi_ring_sizer_reset (&self->ring_sizer, extra, self->wakeup_us);
+    g_atomic_int_set (&self->ring_overrun, FALSE);
+    spec->segtotal = 3 + extra;
+  }
+
+  /* Room for the history on top, the oldest segment is being overwritten */
+  self->preroll_segments = 0;
+  if (self->preroll_time > 0 && !self->direct && !self->zero_copy) {
+    self->preroll_segments = (gint) gst_util_uint64_scale_int_ceil
+        (self->preroll_time, rate, segment_frames * GST_SECOND);
+    spec->segtotal += self->preroll_segments;
+  }
+
+  GST_INFO_OBJECT (self, "segsize is %i, segtotal is %i (%i)", spec->segsize,
+      spec->segtotal,
+      buffer_frames * bpf / spec->segsize);
+
+  /* Room for two full device buffers, drivers can hand over bursts of up to
+   * a full buffer after a scheduling hiccup */
+  self->buffer_frame_count = buffer_frames;
+  overflow_size = (gsize) 1 << g_bit_storage (MAX (buffer_frames *
+          self->mix_format->nBlockAlign * 2, spec->segsize) - 1);
+  /* Kept from the last prepare while big enough, it may have been rounded
+   * up to the allocation granularity or grown */
+  if (self->overflow_buffer != NULL &&
+      (self->overflow_buffer_size < overflow_size ||
+          self->memory_locked != self->lock_memory)) {
+    gst_wasapi_src_overflow_free (self, self->overflow_buffer,
+        self->overflow_buffer_size, self->overflow_mirrored);
+    self->overflow_buffer = NULL;
+  }
+  self->memory_locked = self->lock_memory;
+  if (self->overflow_buffer == NULL) {
+    self->overflow_buffer = gst_wasapi_src_overflow_alloc (self,
+        &overflow_size, &self->overflow_mirrored);
+    self->overflow_buffer_size = overflow_size;
+  }
+  self->ring_fill = self->overflow_fill = 0;
+  self->above_high = FALSE;
+  self->overflow_buffer_ptr = 0;
+  self->overflow_buffer_length = 0;
+  self->overflow_timestamp = GST_CLOCK_TIME_NONE;
+
+  /* Room for a second of audio, the reader may be slow to wake up */
+  g_clear_pointer (&self->shm, gst_wasapi_shm_free);
+  if (self->shm_name != NULL) {
+    self->shm = gst_wasapi_shm_new (self->shm_name, self->mix_format,
+        MAX (self->mix_format->nSamplesPerSec, buffer_frames * 2));
+    if (self->shm == NULL)
+      GST_ELEMENT_WARNING (self, RESOURCE, OPEN_WRITE, (NULL),
+          ("Failed to create shared memory %s", self->shm_name));
+  }
+
+  gst_wasapi_src_clear_aec_ref (self);
+  if (self->aec_reference && self->loopback && !self->process_loopback &&
+      !self->direct && !self->zero_copy && self->device_id != NULL) {
+    self->aec_ref = gst_wasapi_aec_ref_get (self->device_id);
+    self->aec_data_frames = MAX (self->mix_format->nSamplesPerSec,
+        buffer_frames * 2);
+    self->aec_data = g_malloc (self->aec_data_frames * bpf);
+  }
+
+  if (self->record != NULL) {
+    self->record_sequence = gst_wasapi_record_free (self->record);
+    self->record = NULL;
+  }
+  if (self->record_location != NULL) {
+    self->record = gst_wasapi_record_new (self->record_location,
+        self->mix_format, self->record_max_size, self->record_max_time,
+        self->record_sequence);
+    if (self->record == NULL) {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+          ("Failed to start recording to %s", self->record_location));
+      goto beach;
+    }
+  }
+
+  if (self->replay_duration > 0) {
+    GstWasapiReplay *replay = gst_wasapi_replay_new (&spec->info,
+        self->replay_duration);
+
+    GST_OBJECT_LOCK (self);
+    g_clear_pointer (&self->replay, gst_wasapi_replay_free);
+    self->replay = replay;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  self->next_devpos = -1;
+  self->device_period_us = gst_util_uint64_scale_int (devicep_frames,
+      G_USEC_PER_SEC, rate);
+  self->watchdog_deadline = 0;
+  self->watchdog_active = FALSE;
+  self->watchdog_count = 0;
+  self->packets_pending = FALSE;
+  self->outage = FALSE;
+  self->idle = FALSE;
+
+  /* Shared zeroes for GAP buffers, big enough for a full device buffer */
+  {
+    gsize silence_size = MAX (buffer_frames * bpf, spec->segsize);
+    GstMapInfo info;
+
+    self->silence_memory = gst_allocator_alloc (NULL, silence_size, NULL);
+    gst_memory_map (self->silence_memory, &info, GST_MAP_WRITE);
+    memset (info.data, 0, silence_size);
+    gst_memory_unmap (self->silence_memory, &info);
+    GST_MINI_OBJECT_FLAG_SET (self->silence_memory, GST_MEMORY_FLAG_READONLY);
+
+    self->n_silent_segments = spec->segtotal;
+    self->silent_segments = g_new0 (gint, self->n_silent_segments);
+    self->add_qpc_meta = self->reference_timestamp_meta;
+    if (gst_wasapi_tracer_active () || self->add_qpc_meta ||
+        self->timestamp_mode == GST_WASAPI_TIMESTAMP_MODE_QPC)
+      self->segment_times = g_new0 (GstWasapiSegmentTimes,
+          self->n_silent_segments);
+    self->splice_energy_frames = spec->segtotal * (spec->segsize / bpf);
+    self->splice_energy = g_new (gdouble, self->splice_energy_frames);
+  }
+
+  if (self->drift_correction_method == GST_WASAPI_DRIFT_CORRECTION_RESAMPLE ||
+      (self->drift_correction_method == GST_WASAPI_DRIFT_CORRECTION_ENGINE &&
+          self->clock_adjust == NULL))
+    self->resampler = gst_wasapi_resampler_new (&spec->info);
+  self->resampler_needs_reset = FALSE;
+  GST_OBJECT_LOCK (self);
+  self->drift = gst_wasapi_drift_new (rate);
+  GST_OBJECT_UNLOCK (self);
+  {
+    gdouble ppm;
+
+    /* Seeds the resampler through its rate hint too */
+    if (self->device != NULL &&
+        gst_wasapi_device_cache_get_rate_ppm (GST_ELEMENT (self),
+            self->device, self->calibration_file, &ppm)) {
+      GST_INFO_OBJECT (self, "device measured at %.3f ppm before", ppm);
+      gst_wasapi_drift_seed (self->drift, ppm);
+    }
+  }
+  self->drift_needs_reset = FALSE;
+  self->drift_reference_time = GST_CLOCK_TIME_NONE;
+  self->smooth_mode = self->timestamp_mode;
+  if (self->smooth_mode != GST_WASAPI_TIMESTAMP_MODE_DEVICE)
+    self->dll = gst_wasapi_dll_new (rate, DLL_BANDWIDTH);
+  self->skew_offset = 0;
+  self->clock_cal_qpc = 0;
+
+  self->direct_next_sample = 0;
+  self->packet_outstanding = FALSE;
+
+  /* Neither thread runs yet */
+  gst_wasapi_stats_block_reset (self->device_stats);
+  gst_wasapi_stats_block_reset (self->streaming_stats);
+  gst_wasapi_histogram_reset (&self->wakeup_histogram);
+  gst_wasapi_histogram_reset (&self->hold_histogram);
+  gst_wasapi_counters_reset (self->create_counters);
+
+  g_clear_pointer (&self->stats_reporter, gst_wasapi_stats_reporter_free);
+  if (self->stats_interval > 0)
+    self->stats_reporter = gst_wasapi_stats_reporter_new (GST_ELEMENT (self),
+        self->stats_interval, rate, &self->wakeup_histogram,
+        gst_wasapi_src_stats_snapshot);
+
+  /* Get WASAPI latency for logging */
+  hr = IAudioClient_GetStreamLatency (self->client, &latency_rt);
+  HR_FAILED_GOTO (hr, IAudioClient::GetStreamLatency, beach);
+  self->stream_latency = latency_rt * 100;
+
+  GST_INFO_OBJECT (self, "wasapi stream latency: %" G_GINT64_FORMAT " (%"
+      G_GINT64_FORMAT " ms)", latency_rt, latency_rt / 10000);
+
+  if (!warm && follower == NULL) {
+    /* Set the event handler which will trigger reads, or the capture
+     * thread */
+    hr = IAudioClient_SetEventHandle (self->client,
+        self->use_engine ? self->capture_event : self->event_handle);
+    HR_FAILED_GOTO (hr, IAudioClient::SetEventHandle, beach);
+  }
+
+  /* Get the clock */
+  if (!warm && !gst_wasapi_util_get_clock (GST_ELEMENT (self), self->client,
+          &self->client_clock))
+    goto beach;
+
+  hr = IAudioClock_GetFrequency (self->client_clock, &self->client_clock_freq);
+  HR_FAILED_GOTO (hr, IAudioClock::GetFrequency, beach);
+
+  gst_wasapi_src_watch_session (self);
+
+  if (self->shared_clock != NULL &&
+      !gst_wasapi_device_clock_add_client (self->shared_clock,
+          self->client_clock, self->device_period_us * GST_USECOND))
+    goto beach;
+
+  GST_INFO_OBJECT (self, "wasapi clock freq is %" G_GUINT64_FORMAT,
+      self->client_clock_freq);
+
+  /* Get capture source client and start it up */
+  if (!warm && !gst_wasapi_util_get_capture_client (GST_ELEMENT (self),
+          self->client, &self->capture_client)) {
+    goto beach;
+  }
+
+  if (self->use_engine) {
+    GstWasapiCaptureStream *stream = follower;
+
+    if (stream == NULL && share_key != NULL)
+      stream = gst_wasapi_capture_attach_shared (GST_ELEMENT (self),
+          share_key, self->client, self->capture_client, self->capture_event,
+          self->event_handle, self->mix_format->nBlockAlign, buffer_frames,
+          devicep_frames, self->rtwq);
+    else if (stream == NULL)
+      stream = gst_wasapi_capture_attach (GST_ELEMENT (self),
+          self->capture_client, self->capture_event, self->event_handle,
+          self->mix_format->nBlockAlign, buffer_frames, self->rtwq);
+    follower = NULL;
+
+    if (stream == NULL)
+      goto beach;
+
+    GST_OBJECT_LOCK (self);
+    self->capture_stream = stream;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  start = gst_wasapi_util_get_qpc_position ();
+  if (self->client_shared)
+    hr = gst_wasapi_capture_stream_start (self->capture_stream);
+  else
+    hr = IAudioClient_Start (self->client);
+  gst_wasapi_startup_times_add (GST_ELEMENT (self), GST_WASAPI_STARTUP_START,
+      start);
+  HR_FAILED_GOTO (hr, IAudioClock::Start, beach);
+
+  gst_audio_ring_buffer_set_channel_positions (GST_AUDIO_BASE_SRC
+      (self)->ringbuffer,
+      self->reorder ? self->valid_positions : self->positions);
+
+  if (!warm && !self->client_shared) {
+    gst_caps_replace (&self->warm_caps, spec->caps);
+    self->warm_latency_time = latency_time;
+    self->warm_buffer_time = buffer_time;
+    self->warm_devicep_frames = devicep_frames;
+    self->warm_engine = self->use_engine;
+  }
+
+  /* Anything that needs to see or hold back packets takes the general
+   * path */
+  self->read_exclusive = self->sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE &&
+      self->convert == NULL && self->n_selected == 0 && !self->use_engine &&
+      self->timer_handle == NULL && self->packet_log == NULL &&
+      self->latency_probe == NULL && self->device_list == NULL;
+  GST_INFO_OBJECT (self, "reading %s", self->read_exclusive ?
+      "one device period per event" : "through the general path");
+
+  gst_wasapi_spin_clear (&self->spin);
+  if (self->scheduling == GST_WASAPI_SCHEDULING_SPIN) {
+    if (!self->read_exclusive)
+      GST_WARNING_OBJECT (self, "can only spin when reading device periods "
+          "in exclusive mode, waiting for events");
+    else if (gst_wasapi_spin_init (&self->spin,
+            gst_util_uint64_scale_int (devicep_frames, GST_SECOND, rate)))
+      GST_INFO_OBJECT (self, "spinning for the device periods");
+  }
+
+  GST_OBJECT_LOCK (self);
+  /* Only read_device() swaps clients */
+  self->live_device = !self->use_engine && !self->direct && !self->zero_copy &&
+      !self->read_exclusive && gst_wasapi_src_can_switch_device (self);
+  self->seam_sample = -1;
+  self->live_period = !self->autoconvert && !self->use_engine &&
+      !self->direct && !self->zero_copy && self->shared_clock == NULL &&
+      gst_wasapi_src_can_audioclient3 (self);
+  GST_OBJECT_UNLOCK (self);
+
+  res = TRUE;
+beach:
+  if (follower != NULL)
+    gst_wasapi_capture_detach (follower);
+  g_free (share_key);
+
+  /* unprepare() is not called if prepare() fails, but we want it to be, so call
+   * it manually when needed */
+  if (!res)
+    gst_wasapi_src_unprepare (asrc);
+
+  return res;
+}
+
+/* Hands a device glitch in the packet at @qpcpos to etw-attribution. It's
+ * ours if the device buffer could have filled up since the wakeup before
+ * the one at @wakeup, 0 if we didn't wait for this one. */
+static void
+gst_wasapi_src_etw_glitch (GstWasapiSrc * self, guint64 qpcpos,
+    gint64 wakeup)
+{
+  gint64 last, buffer_us;
+
+  if (self->etw_tracker == NULL)
+    return;
+
+  /* On the thread that updates them */
+  last = self->device_stats->stats.last_wakeup;
+
+  buffer_us = gst_util_uint64_scale_int (self->buffer_frame_count,
+      G_USEC_PER_SEC, self->sample_rate);
+  gst_wasapi_etw_tracker_glitch (self->etw_tracker, qpcpos,
+      2 * self->device_period_us * 10, wakeup != 0 && last != 0 &&
+      wakeup - last > buffer_us - self->device_period_us);
+}
+
+/* Waits for the background thread and drops what it built */
+static void
+gst_wasapi_src_clear_spare (GstWasapiSrc * self)
+{
+  GThread *thread;
+
+  GST_OBJECT_LOCK (self);
+  self->live_period = FALSE;
+  self->live_device = FALSE;
+  thread = self->spare_thread;
+  self->spare_thread = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (thread != NULL)
+    g_thread_join (thread);
+
+  if (self->spare_client != NULL) {
+    IAudioClient_Stop (self->spare_client);
+    IUnknown_Release (self->spare_capture_client);
+    IUnknown_Release (self->spare_clock);
+    IUnknown_Release (self->spare_client);
+    self->spare_client = NULL;
+    self->spare_clock = NULL;
+    self->spare_capture_client = NULL;
+  }
+  if (self->spare_device != NULL) {
+    IUnknown_Release (self->spare_device);
+    self->spare_device = NULL;
+  }
+  GST_OBJECT_LOCK (self);
+  self->spare_switch = FALSE;
+  g_clear_pointer (&self->spare_device_id, g_free);
+  GST_OBJECT_UNLOCK (self);
+  g_atomic_int_set (&self->spare_done, FALSE);
+  self->trim_qpc = 0;
+}
+
+/* For the wasapi-stats messages, on their thread */
+static void
+gst_wasapi_src_stats_snapshot (GstElement * element, GstWasapiStats * stats,
+    gdouble * drift_ppm)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (element);
+
+  gst_wasapi_src_get_stats (self, stats);
+  *drift_ppm = gst_wasapi_src_get_drift_ppm (self);
+}
+
+static gboolean
+gst_wasapi_src_unprepare (GstAudioSrc * asrc)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  gboolean keep = self->prewarm && self->warm_caps != NULL &&
+      self->capture_client != NULL;
+  guint64 stream[GST_WASAPI_N_COUNTERS], capture[GST_WASAPI_N_COUNTERS];
+
+  self->stream_latency = GST_CLOCK_TIME_NONE;
+
+  g_clear_pointer (&self->stats_reporter, gst_wasapi_stats_reporter_free);
+  g_clear_pointer (&self->session, gst_wasapi_session_unwatch);
+  gst_wasapi_src_clear_spare (self);
+  gst_wasapi_src_stop_drain (self);
+
+  if (self->client_shared) {
+    /* The others may still capture */
+    if (self->capture_stream != NULL)
+      gst_wasapi_capture_stream_stop (self->capture_stream);
+  } else if (self->client != NULL) {
+    IAudioClient_Stop (self->client);
+    /* Don't hand out stale packets once it's started again */
+    if (keep)
+      IAudioClient_Reset (self->client);
+  }
+
+  if (self->timer_handle != NULL) {
+    CloseHandle (self->timer_handle);
+    self->timer_handle = NULL;
+  }
+  self->power_saving = FALSE;
+  gst_wasapi_spin_clear (&self->spin);
+
+  if (self->capture_stream != NULL) {
+    GstWasapiCaptureStream *stream = self->capture_stream;
+
+    GST_OBJECT_LOCK (self);
+    self->capture_stream = NULL;
+    GST_OBJECT_UNLOCK (self);
+
+    gst_wasapi_capture_detach (stream);
+  }
+  self->client_shared = FALSE;
+
+  if (self->client_clock != NULL && self->shared_clock != NULL)
+    gst_wasapi_device_clock_remove_client (self->shared_clock,
+        self->client_clock);
+  gst_wasapi_src_clear_clock_adjust (self);
+
+  /* Don't keep the clock alive for the thread copies until the next
+   * prepare, they are taken again then */
+  gst_object_replace ((GstObject **) & self->device_clock.clock, NULL);
+  self->device_clock.cookie = 0;
+  gst_object_replace ((GstObject **) & self->streaming_clock.clock, NULL);
+  self->streaming_clock.cookie = 0;
+
+  if (!keep)
+    gst_wasapi_src_release_warm_client (self);
+
+  self->client_clock_freq = 0;
+  self->capture_too_many_frames_log_count = 0;
+
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->os_effects, gst_structure_free);
+  GST_OBJECT_UNLOCK (self);
+
+  if (self->silence_memory != NULL) {
+    gst_memory_unref (self->silence_memory);
+    self->silence_memory = NULL;
+  }
+  gst_wasapi_src_clear_pool (self);
+  g_clear_pointer (&self->silent_segments, g_free);
+  g_clear_pointer (&self->segment_times, g_free);
+  self->n_silent_segments = 0;
+  g_clear_pointer (&self->splice_energy, g_free);
+  self->splice_energy_frames = 0;
+  g_clear_pointer (&self->resampler, gst_wasapi_resampler_free);
+  g_clear_pointer (&self->dll, gst_wasapi_dll_free);
+  {
+    gdouble ppm;
+
+    /* For the next stream on the device */
+    if (self->drift != NULL && self->device != NULL &&
+        gst_wasapi_drift_get_measured_ppm (self->drift, &ppm))
+      gst_wasapi_device_cache_set_rate_ppm (GST_ELEMENT (self), self->device,
+          self->calibration_file, ppm);
+  }
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->drift, gst_wasapi_drift_free);
+  GST_OBJECT_UNLOCK (self);
+
+  /* Its helper builds the messages from the modules freed below, so it
+   * goes first. Nothing reads the device anymore. */
+  g_clear_pointer (&self->bus_queue, gst_wasapi_bus_queue_free);
+
+  g_clear_pointer (&self->convert, gst_wasapi_convert_free);
+  self->n_selected = 0;
+  g_clear_pointer (&self->level, gst_wasapi_level_free);
+  g_clear_pointer (&self->spectrum, gst_wasapi_spectrum_free);
+  g_clear_pointer (&self->vad_detector, gst_wasapi_vad_free);
+  g_clear_pointer (&self->silence, gst_wasapi_silence_free);
+  g_clear_pointer (&self->latency_probe, gst_wasapi_latency_probe_free);
+  g_clear_pointer (&self->packet_log, gst_wasapi_packet_log_free);
+  g_clear_pointer (&self->shm, gst_wasapi_shm_free);
+  gst_wasapi_src_clear_aec_ref (self);
+  if (self->record != NULL) {
+    self->record_sequence = gst_wasapi_record_free (self->record);
+    self->record = NULL;
+  }
+  GST_OBJECT_LOCK (self);
+  g_clear_pointer (&self->replay, gst_wasapi_replay_free);
+  GST_OBJECT_UNLOCK (self);
+  /* Without the bus queue now, posted right away */
+  gst_wasapi_src_notify (self, SRC_NOTIFY_GLITCHES, 0, 0, 0);
+  if (self->etw_tracker != NULL) {
+    GstWasapiEtwTracker *tracker = self->etw_tracker;
+
+    GST_OBJECT_LOCK (self);
+    self->etw_tracker = NULL;
+    GST_OBJECT_UNLOCK (self);
+    gst_wasapi_etw_tracker_free (tracker);
+  }
+
+  gst_wasapi_util_unlock_memory (self->locked_ring, self->locked_ring_size);
+  self->locked_ring = NULL;
+  self->locked_ring_size = 0;
+
+  /* The overflow buffer stays for the next prepare */
+  self->overflow_buffer_ptr = 0;
+  self->overflow_buffer_length = 0;
+
+  gst_wasapi_counters_snapshot (self->stream_counters, stream);
+  gst_wasapi_counters_snapshot (self->capture_counters, capture);
+  GST_INFO_OBJECT (self, "stats: drift_correction: %" G_GUINT64_FORMAT
+      ", timeshifted: %" G_GUINT64_FORMAT ", gaps: %" G_GUINT64_FORMAT
+      " (%" G_GUINT64_FORMAT " frames)",
+      stream[STREAM_COUNTER_DRIFT_CORRECTIONS],
+      stream[STREAM_COUNTER_TIMESHIFTED], capture[CAPTURE_COUNTER_GAPS],
+      capture[CAPTURE_COUNTER_GAP_FRAMES]);
+
+  /* Both threads are stopped */
+  gst_wasapi_counters_reset (self->stream_counters);
+  gst_wasapi_counters_reset (self->capture_counters);
+
+  if (self->watchdog_count > 0)
+    GST_INFO_OBJECT (self, "made up %" G_GUINT64_FORMAT " periods of silence "
+        "for the idle loopback device", self->watchdog_count);
+  self->watchdog_count = 0;
+
+  return TRUE;
+}
+
+/* Copies @n_frames frames in the mix format from @src to @dst, from the
+ * device channel order to the GStreamer one */
+static inline void
+gst_wasapi_src_reorder (GstWasapiSrc * self, guint8 * dst, const guint8 * src,
+    guint n_frames)
+{
+  gint channels = self->mix_format->nChannels;
+
+  gst_wasapi_util_reorder (dst, src, n_frames, channels,
+      self->mix_format->nBlockAlign / channels, self->reorder_map);
+}
+
+/* The overflow buffer is a ring with a power-of-two capacity, holding the
+ * frames we got from the driver that didn't fit into the segment being read.
+ * It grows instead of dropping data when a driver bursts more than expected.
+ * Mirrored, it continues past its end and nothing wraps. */
+static void
+gst_wasapi_src_overflow_push (GstWasapiSrc * self, const guint8 * data,
+    gsize length)
+{
+  gsize mask, write_ptr, n;
+
+  if (G_UNLIKELY (self->overflow_buffer_length + length >
+          self->overflow_buffer_size)) {
+    gsize new_size = self->overflow_buffer_size;
+    guint8 *new_buffer;
+    gboolean new_mirrored;
+
+    while (new_size < self->overflow_buffer_length + length)
+      new_size <<= 1;
+
+    GST_WARNING_OBJECT (self, "growing overflow buffer from %" G_GSIZE_FORMAT
+        " to %" G_GSIZE_FORMAT " bytes", self->overflow_buffer_size, new_size);
+
+    new_buffer = gst_wasapi_src_overflow_alloc (self, &new_size,
+        &new_mirrored);
+    n = self->overflow_buffer_length;
+    self->overflow_buffer_length = gst_wasapi_src_overflow_pop (self,
+        new_buffer, n, FALSE);
+    gst_wasapi_src_overflow_free (self, self->overflow_buffer,
+        self->overflow_buffer_size, self->overflow_mirrored);
+    self->overflow_buffer = new_buffer;
+    self->overflow_buffer_size = new_size;
+    self->overflow_mirrored = new_mirrored;
+    self->overflow_buffer_ptr = 0;
+  }
+
+  if (self->overflow_buffer_length == 0)
+    self->overflow_silent = TRUE;
+  if (data)
+    self->overflow_silent = FALSE;
+
+  gst_wasapi_stats_block_begin (self->device_stats)->overflow_saved += length;
+  gst_wasapi_stats_block_end (self->device_stats);
+
+  mask = self->overflow_buffer_size - 1;
+  write_ptr = (self->overflow_buffer_ptr + self->overflow_buffer_length) & mask;
+
+  /* First chunk up to the end of the buffer, then wrap around */
+  n = self->overflow_mirrored ? length :
+      MIN (length, self->overflow_buffer_size - write_ptr);
+  if (data) {
+    memcpy (self->overflow_buffer + write_ptr, data, n);
+    memcpy (self->overflow_buffer, data + n, length - n);
+  } else {
+    memset (self->overflow_buffer + write_ptr, 0, n);
+    memset (self->overflow_buffer, 0, length - n);
+  }
+
+  self->overflow_buffer_length += length;
+
+  gst_wasapi_trace_overflow (GST_ELEMENT (self), length,
+      self->overflow_buffer_length);
+}
+
+/* With @reorder into the GStreamer channel order, which takes no extra pass
+ * when mirrored */
+static guint
+gst_wasapi_src_overflow_pop (GstWasapiSrc * self, guint8 * data, guint length,
+    gboolean reorder)
+{
+  guint8 *src = self->overflow_buffer + self->overflow_buffer_ptr;
+  gsize n, first;
+
+  n = MIN (length, self->overflow_buffer_length);
+  if (reorder && self->overflow_mirrored) {
+    gst_wasapi_src_reorder (self, data, src,
+        n / self->mix_format->nBlockAlign);
+  } else {
+    first = self->overflow_mirrored ? n :
+        MIN (n, self->overflow_buffer_size - self->overflow_buffer_ptr);
+    memcpy (data, src, first);
+    memcpy (data + first, self->overflow_buffer, n - first);
+    /* Frames may have wrapped around in there */
+    if (reorder)
+      gst_wasapi_src_reorder (self, data, data,
+          n / self->mix_format->nBlockAlign);
+  }
+
+  self->overflow_buffer_ptr =
+      (self->overflow_buffer_ptr + n) & (self->overflow_buffer_size - 1);
+  self->overflow_buffer_length -= n;
+  if (self->overflow_buffer_length == 0)
+    self->overflow_buffer_ptr = 0;
+
+  return n;
+}
+
+/* Remembers whether the segment the ringbuffer thread is currently reading
+ * into contains nothing but silence, so create() can push it as a GAP */
+static void
+gst_wasapi_src_mark_segment (GstWasapiSrc * self, gboolean silent)
+{
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  gint segdone;
+
+  if (G_UNLIKELY (self->silent_segments == NULL))
+    return;
+
+  segdone = g_atomic_int_get (&ringbuffer->segdone) - ringbuffer->segbase;
+  g_atomic_int_set (&self->silent_segments[segdone % self->n_silent_segments],
+      silent);
+}
+
+/* Like the above, for the wasapilatency tracer and the QPC meta */
+static void
+gst_wasapi_src_mark_segment_times (GstWasapiSrc * self, guint64 capture_qpc)
+{
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  GstWasapiSegmentTimes *times;
+  gint segdone;
+
+  if (G_LIKELY (self->segment_times == NULL))
+    return;
+
+  segdone = g_atomic_int_get (&ringbuffer->segdone) - ringbuffer->segbase;
+  times = &self->segment_times[segdone % self->n_silent_segments];
+  times->capture_qpc = capture_qpc;
+  times->enqueue_qpc = gst_wasapi_util_get_qpc_position ();
+}
+
+static gboolean
+gst_wasapi_src_is_silent (GstWasapiSrc * self, guint64 sample, guint samples)
+{
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  guint64 seg, last_seg;
+  gint sps = ringbuffer->samples_per_seg;
+
+  if (self->silent_segments == NULL || samples == 0)
+    return FALSE;
+
+  last_seg = (sample + samples - 1) / sps;
+  for (seg = sample / sps; seg <= last_seg; seg++) {
+    if (!g_atomic_int_get (&self->silent_segments[seg %
+                self->n_silent_segments]))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Fades @buf of @samples from @sample out and back in around where read()
+ * moved to another device, if that is in there */
+static void
+gst_wasapi_src_fade_seam (GstWasapiSrc * self, GstBuffer * buf,
+    guint64 sample, guint samples)
+{
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  guint64 seam;
+
+  GST_OBJECT_LOCK (self);
+  seam = self->seam_sample;
+  if (seam != -1 && seam < sample + samples)
+    self->seam_sample = -1;
+  GST_OBJECT_UNLOCK (self);
+
+  if (seam == -1 || seam < sample || seam >= sample + samples)
+    return;
+
+  if (!gst_wasapi_fade_seam (buf, &ringbuffer->spec.info,
+          (gint) (seam - sample)))
+    GST_DEBUG_OBJECT (self, "can't fade over the device switch");
+}
+
+/* Returns a GAP buffer of @size bytes of silence, sharing the preallocated
+ * zero memory when it's big enough */
+static GstBuffer *
+gst_wasapi_src_new_silence_buffer (GstWasapiSrc * self, gsize size)
+{
+  GstBuffer *buf = gst_buffer_new ();
+
+  if (self->silence_memory && size <= self->silence_memory->size) {
+    gst_buffer_append_memory (buf, gst_memory_share (self->silence_memory, 0,
+            size));
+  } else {
+    GstMemory *mem = gst_allocator_alloc (NULL, size, NULL);
+    GstMapInfo info;
+
+    gst_memory_map (mem, &info, GST_MAP_WRITE);
+    memset (info.data, 0, size);
+    gst_memory_unmap (mem, &info);
+    gst_buffer_append_memory (buf, mem);
+  }
+
+  GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_GAP);
+
+  return buf;
+}
+
+/* In loopback mode WASAPI doesn't signal anything while nothing is being
+ * rendered. Returns how long to wait for the next event before we start
+ * making up silence, once per device period, to keep the clock going. */
+static DWORD
+gst_wasapi_src_watchdog_timeout (GstWasapiSrc * self)
+{
+  gint64 now;
+
+  if (!self->loopback || self->device_period_us == 0)
+    return INFINITE;
+
+  now = g_get_monotonic_time ();
+
+  /* Give the device two periods before deciding it went idle, or a period
+   * after the timer of power saving */
+  if (self->watchdog_deadline == 0)
+    self->watchdog_deadline = now + MAX (self->wakeup_us,
+        self->device_period_us) + self->device_period_us;
+
+  if (self->watchdog_deadline <= now)
+    return 0;
+
+  return (DWORD) ((self->watchdog_deadline - now + 999) / 1000);
+}
+
+/* The running ringbuffer can't change size, keep what adaptive-buffer
+ * learned for the next prepare */
+static void
+gst_wasapi_src_store_ring_extra (GstWasapiSrc * self, guint extra)
+{
+  GST_INFO_OBJECT (self, "ringbuffer wants %u extra segments, from the next "
+      "prepare on", extra);
+  gst_wasapi_device_cache_set_ring_extra (GST_ELEMENT (self), self->device,
+      extra);
+}
+
+/* Records one wakeup at @wakeup (0 if we didn't wait) that took @iterations
+ * GetBuffer() calls to drain @frames frames */
+static void
+gst_wasapi_src_update_stats (GstWasapiSrc * self, gint64 wakeup,
+    guint iterations, guint frames, guint glitches)
+{
+  GstWasapiStats *stats;
+  gint64 interval = -1;
+  gboolean resized = FALSE;
+
+  stats = gst_wasapi_stats_block_begin (self->device_stats);
+  if (wakeup != 0)
+    interval = gst_wasapi_stats_wakeup (stats, wakeup);
+  stats->max_drain_iterations = MAX (stats->max_drain_iterations,
+      iterations);
+  stats->max_padding = MAX (stats->max_padding, frames);
+  stats->glitches += glitches;
+  gst_wasapi_stats_block_end (self->device_stats);
+
+  if (self->adaptive_buffer) {
+    if (interval >= 0)
+      resized = gst_wasapi_ring_sizer_wakeup (&self->ring_sizer, wakeup,
+          interval);
+    /* create() lost samples since the last wakeup */
+    if (g_atomic_int_get (&self->ring_overrun)) {
+      g_atomic_int_set (&self->ring_overrun, FALSE);
+      resized |= gst_wasapi_ring_sizer_glitch (&self->ring_sizer,
+          wakeup != 0 ? wakeup : g_get_monotonic_time ());
+    }
+  }
+
+  if (resized)
+    gst_wasapi_src_store_ring_extra (self, self->ring_sizer.extra);
+
+  if (interval >= 0)
+    gst_wasapi_histogram_add (&self->wakeup_histogram, interval);
+
+  if (wakeup != 0 && gst_wasapi_startup_times_event (&self->startup_times))
+    gst_wasapi_src_notify (self, SRC_NOTIFY_STARTUP, 0, 0, 0);
+}
+
+/* Called when the watchdog fired, i.e. we're making up a period of silence */
+static void
+gst_wasapi_src_watchdog_fired (GstWasapiSrc * self)
+{
+  if (!self->watchdog_active)
+    GST_INFO_OBJECT (self, "no events from loopback device, inserting "
+        "silence");
 
-  if (self->client)
-    return TRUE;
+  self->watchdog_active = TRUE;
+  self->watchdog_count++;
 
-  /* FIXME: Switching the default device does not switch the stream to it,
-   * even if the old device was unplugged. We need to handle this somehow.
-   * For example, perhaps we should automatically switch to the new device if
-   * the default device is changed and a device isn't explicitly selected. */
-  if (!gst_wasapi_util_get_device_client (GST_ELEMENT (self),
-          self->loopback ? eRender : eCapture, self->role, self->device_strid,
-          &device, &client)) {
-    if (!self->device_strid)
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
-          ("Failed to get default device"));
-    else
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
-          ("Failed to open device %S", self->device_strid));
-    goto beach;
+  gst_wasapi_stats_block_begin (self->device_stats)->underruns++;
+  gst_wasapi_stats_block_end (self->device_stats);
+
+  gst_wasapi_trace_discont (GST_ELEMENT (self),
+      gst_util_uint64_scale_int (self->device_period_us,
+          self->mix_format->nSamplesPerSec, G_USEC_PER_SEC));
+
+  self->watchdog_deadline += self->device_period_us;
+  /* The device position is meaningless for the time we made up */
+  self->next_devpos = -1;
+}
+
+/* Returns the number of frames the device skipped before the packet at
+ * @devpos, and remembers where the next packet is expected */
+static guint64
+gst_wasapi_src_check_gap (GstWasapiSrc * self, guint64 devpos,
+    guint32 n_frames)
+{
+  guint64 missing = 0;
+
+  if (self->next_devpos != -1 && devpos > self->next_devpos) {
+    missing = devpos - self->next_devpos;
+
+    if (missing > (guint64) self->mix_format->nSamplesPerSec *
+        MAX_GAP_FILL_SECONDS) {
+      GST_WARNING_OBJECT (self, "device position jumped by %" G_GUINT64_FORMAT
+          " frames, not filling", missing);
+      missing = 0;
+    } else {
+      GST_WARNING_OBJECT (self, "device lost %" G_GUINT64_FORMAT " frames at "
+          "position %" G_GUINT64_FORMAT, missing, self->next_devpos);
+      gst_wasapi_trace_discont (GST_ELEMENT (self), missing);
+      gst_wasapi_counters_begin (self->capture_counters);
+      self->capture_counters->values[CAPTURE_COUNTER_GAPS]++;
+      self->capture_counters->values[CAPTURE_COUNTER_GAP_FRAMES] += missing;
+      gst_wasapi_counters_end (self->capture_counters);
+    }
   }
-  if (!self->device_strid) {
-    gst_wasapi_util_initialize_notification_client(self);
+
+  self->next_devpos = devpos + n_frames;
+
+  return missing;
+}
+
+/* Puts a client the engine resamples for back at the nominal rate, so one
+ * kept warm doesn't start off adjusted, and drops the adjustment. create()
+ * corrects the drift itself from then on. */
+static void
+gst_wasapi_src_clear_clock_adjust (GstWasapiSrc * self)
+{
+  if (self->clock_adjust == NULL)
+    return;
+
+  if (self->mix_format != NULL)
+    IAudioClockAdjustment_SetSampleRate (self->clock_adjust,
+        (float) self->mix_format->nSamplesPerSec);
+  IUnknown_Release (self->clock_adjust);
+  self->clock_adjust = NULL;
+}
+
+/* The position in frames of the device for @devpos of a stream the engine
+ * resamples, so the estimate keeps measuring the device and not what is
+ * left of the drift after our adjustment */
+static guint64
+gst_wasapi_src_engine_devpos (GstWasapiSrc * self, guint64 devpos)
+{
+  if (self->engine_last_devpos == -1 || devpos < self->engine_last_devpos)
+    self->engine_frames = devpos;
+  else
+    self->engine_frames += (devpos - self->engine_last_devpos) *
+        self->mix_format->nSamplesPerSec / self->engine_rate;
+  self->engine_last_devpos = devpos;
+
+  return (guint64) self->engine_frames;
+}
+
+/* Has the engine resample the device to what runs at the rate of the
+ * pipeline clock, or at the nominal rate again when we're not slaved */
+static void
+gst_wasapi_src_adjust_engine_rate (GstWasapiSrc * self)
+{
+  GstAudioBaseSrc *src = GST_AUDIO_BASE_SRC (self);
+  guint rate = self->mix_format->nSamplesPerSec;
+  gdouble ppm, target;
+  GstClock *clock;
+  gboolean slaved;
+  HRESULT hr;
+
+  clock = gst_wasapi_src_clock_copy (self, &self->device_clock);
+  slaved = clock != NULL && clock != src->clock;
+
+  if (!slaved || src->priv->slave_method != GST_AUDIO_BASE_SRC_SLAVE_RESAMPLE
+      || !gst_wasapi_drift_get_ppm (self->drift, &ppm))
+    ppm = 0;
+
+  /* A device running fast has to give fewer frames per second of its own */
+  target = rate / (1.0 + ppm / 1e6);
+  if (ABS (target - self->engine_rate) < rate * ENGINE_RATE_STEP_PPM / 1e6)
+    return;
+
+  hr = IAudioClockAdjustment_SetSampleRate (self->clock_adjust,
+      (float) target);
+  HR_FAILED_RET (hr, IAudioClockAdjustment::SetSampleRate,);
+
+  GST_LOG_OBJECT (self, "engine rate %.4f for %.3f ppm", target, ppm);
+  self->engine_rate = target;
+}
+
+/* Feeds the drift estimator, called for every packet with a valid QPC */
+static void
+gst_wasapi_src_push_drift_point (GstWasapiSrc * self, guint64 devpos,
+    GstClockTime capture_time)
+{
+  if (G_UNLIKELY (self->drift == NULL))
+    return;
+
+  if (g_atomic_int_compare_and_exchange (&self->drift_needs_reset, TRUE,
+          FALSE)) {
+    gst_wasapi_drift_reset (self->drift);
+    self->engine_last_devpos = -1;
   }
-  self->client = client;
-  self->device = device;
-  res = TRUE;
 
-  HRESULT hr = IMMDevice_OpenPropertyStore(device, STGM_READ, &prop_store);
-  if (hr != S_OK) {
-      goto beach;
+  if (self->clock_adjust == NULL) {
+    gst_wasapi_drift_push (self->drift, devpos, capture_time);
+    return;
   }
-  
-  PROPVARIANT var;
-  PropVariantInit (&var);
-  hr = IPropertyStore_GetValue (prop_store, &PKEY_Device_FriendlyName, &var);
-  if (hr != S_OK) {
+
+  gst_wasapi_drift_push (self->drift, gst_wasapi_src_engine_devpos (self,
+          devpos), capture_time);
+  gst_wasapi_src_adjust_engine_rate (self);
+}
+
+/* Reopens the stream on the device @id, the default one if NULL, from the
+ * ringbuffer thread, in the format we are already running in. Shared mode streams go through the
+ * engine, which converts if the new device has another mix format, so the
+ * caps never change. The samples lost while switching, at most a period of
+ * the old device plus the time it took, are made up with silence in
+ * @data_ptr and the overflow buffer, so the timeline stays continuous.
+ *
+ * The old client keeps running until the new one is started. Returns FALSE
+ * if the stream can't be moved there. */
+static gboolean
+gst_wasapi_src_can_switch_device (GstWasapiSrc * self)
+{
+  /* A process loopback client doesn't belong to an endpoint */
+  return self->sharemode == AUDCLNT_SHAREMODE_SHARED &&
+      self->shared_clock == NULL && !self->process_loopback &&
+      !self->client_shared;
+}
+
+static gboolean
+gst_wasapi_src_switch_device (GstWasapiSrc * self, const gchar * id,
+    guint8 ** data_ptr, guint * wanted)
+{
+  GstAudioRingBufferSpec *spec = &GST_AUDIO_BASE_SRC (self)->ringbuffer->spec;
+  IMMDevice *device = NULL;
+  IAudioClient *client = NULL;
+  IAudioClock *client_clock = NULL;
+  IAudioClockAdjustment *clock_adjust = NULL;
+  IAudioCaptureClient *capture_client = NULL;
+  GstWasapiCaptureStream *capture_stream = NULL;
+  guint bpf = self->mix_format->nBlockAlign;
+  guint rate = self->mix_format->nSamplesPerSec;
+  guint devicep_frames, buffer_frames;
+  guint64 freq, gap_frames;
+  gint64 start = g_get_monotonic_time ();
+  wchar_t *strid = NULL;
+  gchar *device_id = NULL;
+  gboolean res = FALSE;
+  HRESULT hr;
+
+  if (!gst_wasapi_src_can_switch_device (self))
+    return FALSE;
+
+  GST_INFO_OBJECT (self, "switching to %s", id ? id : "the default device");
+
+  if (id != NULL && !(strid = g_utf8_to_utf16 (id, -1, NULL, NULL, NULL)))
+    goto beach;
+
+  /* Also when reopening a routed stream */
+  if (!(self->routed && gst_wasapi_util_get_routed_client (GST_ELEMENT (self),
+              eCapture, self->role, &device, &client)) &&
+      !gst_wasapi_util_get_device_client (GST_ELEMENT (self),
+          self->loopback ? eRender : eCapture, self->role, strid, &device,
+          &client))
+    goto beach;
+  device_id = gst_wasapi_util_get_device_id (device);
+
+  gst_wasapi_src_set_client_properties (self, client);
+
+  if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
+          device, &client, self->mix_format, self->sharemode,
+          gst_wasapi_src_low_latency (self), self->loopback, TRUE,
+          self->clock_adjust != NULL, &devicep_frames))
+    goto beach;
+
+  /* Keep following the pipeline clock through the engine, or through
+   * create() again if the new one can't */
+  if (self->clock_adjust != NULL)
+    gst_wasapi_util_get_clock_adjustment (GST_ELEMENT (self), client,
+        &clock_adjust);
+
+  hr = IAudioClient_GetBufferSize (client, &buffer_frames);
+  HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
+
+  hr = IAudioClient_SetEventHandle (client,
+      self->capture_stream ? self->capture_event : self->event_handle);
+  HR_FAILED_GOTO (hr, IAudioClient::SetEventHandle, beach);
+
+  if (!gst_wasapi_util_get_clock (GST_ELEMENT (self), client, &client_clock))
     goto beach;
+
+  hr = IAudioClock_GetFrequency (client_clock, &freq);
+  HR_FAILED_GOTO (hr, IAudioClock::GetFrequency, beach);
+
+  if (!gst_wasapi_util_get_capture_client (GST_ELEMENT (self), client,
+          &capture_client))
+    goto beach;
+
+  if (self->capture_stream != NULL &&
+      !(capture_stream = gst_wasapi_capture_attach (GST_ELEMENT (self),
+              capture_client, self->capture_event, self->event_handle, bpf,
+              buffer_frames, self->rtwq)))
+    goto beach;
+
+  hr = IAudioClient_Start (client);
+  HR_FAILED_GOTO (hr, IAudioClient::Start, beach);
+
+  IAudioClient_Stop (self->client);
+
+  /* The old ones are released below */
+  GST_OBJECT_LOCK (self);
+  {
+    IMMDevice *old_device = self->device;
+    IAudioClient *old_client = self->client;
+    IAudioClock *old_clock = self->client_clock;
+    IAudioClockAdjustment *old_adjust = self->clock_adjust;
+    IAudioCaptureClient *old_capture_client = self->capture_client;
+    GstWasapiCaptureStream *old_stream = self->capture_stream;
+    gchar *old_id = self->device_id;
+
+    self->device_id = device_id;
+    device_id = old_id;
+    self->device = device;
+    self->client = client;
+    self->client_clock = client_clock;
+    self->clock_adjust = clock_adjust;
+    self->capture_client = capture_client;
+    self->capture_stream = capture_stream;
+    capture_stream = old_stream;
+    device = old_device;
+    client = old_client;
+    client_clock = old_clock;
+    clock_adjust = old_adjust;
+    capture_client = old_capture_client;
+  }
+  GST_OBJECT_UNLOCK (self);
+  gst_wasapi_src_watch_session (self);
+
+  gap_frames = gst_util_uint64_scale_int (g_get_monotonic_time () - start +
+      self->device_period_us, rate, G_USEC_PER_SEC);
+
+  self->client_clock_freq = freq;
+  self->engine_rate = rate;
+  self->buffer_frame_count = buffer_frames;
+  self->device_period_us = gst_util_uint64_scale_int (devicep_frames,
+      G_USEC_PER_SEC, rate);
+  self->warm_devicep_frames = devicep_frames;
+  self->next_devpos = -1;
+  self->watchdog_deadline = 0;
+  self->watchdog_active = FALSE;
+  self->packets_pending = FALSE;
+  g_atomic_int_set (&self->client_needs_restart, FALSE);
+  g_atomic_int_set (&self->resampler_needs_reset, TRUE);
+  g_atomic_int_set (&self->drift_needs_reset, TRUE);
+  self->drift_reference_time = GST_CLOCK_TIME_NONE;
+  self->skew_offset = 0;
+  self->clock_cal_qpc = 0;
+
+  if (self->level_mode == GST_WASAPI_LEVEL_MODE_ENDPOINT) {
+    g_clear_pointer (&self->level, gst_wasapi_level_free);
+    self->level = gst_wasapi_level_new_endpoint (GST_ELEMENT (self),
+        self->device, &spec->info, self->level_interval);
+  }
+
+  GST_INFO_OBJECT (self, "switched device in %" G_GINT64_FORMAT " us, making "
+      "up %" G_GUINT64_FORMAT " frames of silence",
+      g_get_monotonic_time () - start, gap_frames);
+
+  {
+    gsize gap = gap_frames * bpf;
+    gsize fill = MIN (gap, *wanted);
+
+    memset (*data_ptr, 0, fill);
+    *data_ptr += fill;
+    *wanted -= fill;
+
+    if (fill < gap) {
+      if (self->overflow_buffer_length == 0)
+        self->overflow_timestamp = GST_CLOCK_TIME_NONE;
+      gst_wasapi_src_overflow_push (self, NULL, gap - fill);
+    }
+
+    gst_wasapi_counters_begin (self->capture_counters);
+    self->capture_counters->values[CAPTURE_COUNTER_GAPS]++;
+    self->capture_counters->values[CAPTURE_COUNTER_GAP_FRAMES] += gap_frames;
+    gst_wasapi_counters_end (self->capture_counters);
   }
-  self->device_description = g_utf16_to_utf8 (var.pwszVal, -1, NULL, NULL, NULL);
-  PropVariantClear (&var);
-  GST_INFO_OBJECT (self, "device description %s", self->device_description);
-    
+
+  res = TRUE;
 
 beach:
+  if (!res)
+    GST_WARNING_OBJECT (self, "can't switch to %s",
+        id ? id : "the default device");
+
+  g_free (strid);
+  g_free (device_id);
+  if (capture_stream != NULL)
+    gst_wasapi_capture_detach (capture_stream);
+  if (capture_client != NULL)
+    IUnknown_Release (capture_client);
+  if (client_clock != NULL)
+    IUnknown_Release (client_clock);
+  if (clock_adjust != NULL)
+    IUnknown_Release (clock_adjust);
+  if (client != NULL)
+    IUnknown_Release (client);
+  if (device != NULL)
+    IUnknown_Release (device);
+
+  return res;
+}
+
+/* Opens our device again after the stream was invalidated. That also
+ * happens when the user picks another format for it, which the engine then
+ * converts to the one we run in until we are negotiated again. */
+static gboolean
+gst_wasapi_src_reopen_device (GstWasapiSrc * self, guint8 ** data_ptr,
+    guint * wanted)
+{
+  gchar *id;
+  gboolean res;
+
+  GST_OBJECT_LOCK (self);
+  id = g_strdup (self->device_id);
+  GST_OBJECT_UNLOCK (self);
+
+  res = id && gst_wasapi_src_switch_device (self, id, data_ptr, wanted);
+  g_free (id);
+
+  return res;
+}
+
+/* Switches to the new default device with follow-default-device */
+static gboolean
+gst_wasapi_src_follow_default (GstWasapiSrc * self, guint8 ** data_ptr,
+    guint * wanted)
+{
+  if (!self->follow_default || self->device_strid != NULL ||
+      self->device_list != NULL)
+    return FALSE;
+
+  g_atomic_int_set (&self->default_changed, FALSE);
+
+  return gst_wasapi_src_switch_device (self, NULL, data_ptr, wanted);
+}
+
+/* Moves to the first available device of device-list that we prefer over
+ * the current one, or to any other one once the current one is @lost.
+ * Returns TRUE if we switched. */
+static gboolean
+gst_wasapi_src_failover (GstWasapiSrc * self, gboolean lost,
+    guint8 ** data_ptr, guint * wanted)
+{
+  gint i, current = g_atomic_int_get (&self->device_index);
+  gboolean res = FALSE;
+  gchar **ids;
+
+  GST_OBJECT_LOCK (self);
+  ids = g_strdupv (self->device_list);
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; ids && ids[i]; i++) {
+    if (i == current) {
+      if (!lost)
+        break;
+      continue;
+    }
 
-  if (prop_store) {
-    IUnknown_Release (prop_store);
+    if (gst_wasapi_src_switch_device (self, ids[i], data_ptr, wanted)) {
+      g_atomic_int_set (&self->device_index, i);
+      res = TRUE;
+      break;
+    }
   }
+  g_strfreev (ids);
+
   return res;
 }
 
+/* Lost the client: opens our device again, fails over to another one of
+ * device-list, or follows the default device. Returns TRUE if we capture
+ * again. */
 static gboolean
-gst_wasapi_src_close (GstAudioSrc * asrc)
+gst_wasapi_src_recover (GstWasapiSrc * self, guint8 ** data_ptr,
+    guint * wanted)
 {
-  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  if (gst_wasapi_src_reopen_device (self, data_ptr, wanted))
+    return TRUE;
+  if (self->device_list != NULL)
+    return gst_wasapi_src_failover (self, TRUE, data_ptr, wanted);
+  /* The default device was unplugged, maybe before we heard that it
+   * changed */
+  return gst_wasapi_src_follow_default (self, data_ptr, wanted);
+}
 
-  if (self->device != NULL) {
-    IUnknown_Release (self->device);
-    self->device = NULL;
+/* Asks the application to rebuild the pipeline, once, when we can't go on
+ * by ourselves */
+static void
+gst_wasapi_src_post_restart (GstWasapiSrc * self)
+{
+  if (self->eos_sent)
+    return;
+
+  GST_INFO_OBJECT (self, "The audio device has been disconnected.");
+  gst_wasapi_src_notify (self, SRC_NOTIFY_RESTART, 0, 0, 0);
+  self->eos_sent = TRUE;
+}
+
+/* Waits until @n_frames more than @frames have passed since @start, or
+ * until stopped or @wake is set. Only a pause starts the count over. */
+static void
+gst_wasapi_src_wait_frames (GstWasapiSrc * self, HANDLE wake,
+    gint64 * start, guint64 * frames, guint n_frames)
+{
+  HANDLE events[2] = { self->stop.handle, wake };
+  guint rate = self->mix_format->nSamplesPerSec;
+  gint64 now = g_get_monotonic_time (), deadline;
+
+  *frames += n_frames;
+  deadline = *start + (gint64) gst_util_uint64_scale_int (*frames,
+      G_USEC_PER_SEC, rate);
+  if (now > deadline + G_USEC_PER_SEC) {
+    *start = now;
+    *frames = n_frames;
+    deadline = now + (gint64) gst_util_uint64_scale_int (n_frames,
+        G_USEC_PER_SEC, rate);
+  }
+  if (deadline > now)
+    WaitForMultipleObjects (wake != NULL ? 2 : 1, events, FALSE,
+        (DWORD) ((deadline - now + 999) / 1000));
+}
+
+/* Without a device: @wanted bytes of silence, returned once they would have
+ * been captured, so the gap in the stream is exactly as long as the outage
+ * and the timestamps continue. Only a pause starts the count over. */
+static void
+gst_wasapi_src_fill_outage (GstWasapiSrc * self, guint8 * data_ptr,
+    guint wanted)
+{
+  guint bpf = self->mix_format->nBlockAlign;
+  gint64 now = g_get_monotonic_time ();
+
+  if (!self->outage) {
+    GST_WARNING_OBJECT (self, "lost the device, making up silence until it "
+        "can be opened again");
+    self->outage = TRUE;
+    self->outage_start = now;
+    self->outage_frames = 0;
+    self->outage_retry = now + OUTAGE_RETRY_INTERVAL;
+
+    gst_wasapi_counters_begin (self->capture_counters);
+    self->capture_counters->values[CAPTURE_COUNTER_GAPS]++;
+    gst_wasapi_counters_end (self->capture_counters);
   }
 
-  if (self->client != NULL) {
-    IUnknown_Release (self->client);
-    self->client = NULL;
+  gst_wasapi_src_wait_frames (self, NULL, &self->outage_start,
+      &self->outage_frames, wanted / bpf);
+  memset (data_ptr, 0, wanted);
+
+  gst_wasapi_counters_begin (self->capture_counters);
+  self->capture_counters->values[CAPTURE_COUNTER_GAP_FRAMES] += wanted / bpf;
+  gst_wasapi_counters_end (self->capture_counters);
+}
+
+/* Whether the element we push to passes the buffers on, or is a sink. A
+ * tee without (linked) branches doesn't. Anything we can't tell about, like
+ * a bin, counts as a consumer. */
+static gboolean
+gst_wasapi_src_has_consumer (GstWasapiSrc * self)
+{
+  GstPad *peer = gst_pad_get_peer (GST_BASE_SRC_PAD (self));
+  GstElement *element;
+  gboolean consumer = TRUE;
+  GList *l;
+
+  if (peer == NULL)
+    return FALSE;
+
+  element = gst_pad_get_parent_element (peer);
+  gst_object_unref (peer);
+  if (element == NULL)
+    return TRUE;
+
+  if (!GST_IS_BIN (element) &&
+      !GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK)) {
+    consumer = FALSE;
+    GST_OBJECT_LOCK (element);
+    for (l = element->srcpads; l != NULL && !consumer; l = l->next)
+      consumer = gst_pad_is_linked (l->data);
+    GST_OBJECT_UNLOCK (element);
+  }
+  gst_object_unref (element);
+
+  return consumer;
+}
+
+/* With on-demand: whether read() should capture. Stops the client when
+ * the last consumer went away, the next read() starts it again once there
+ * is one. */
+static gboolean
+gst_wasapi_src_check_demand (GstWasapiSrc * self)
+{
+  gboolean demand;
+
+  if (!self->on_demand || self->use_engine)
+    demand = TRUE;
+  else
+    demand = gst_wasapi_src_has_consumer (self) ||
+        gst_wasapi_fanout_is_linked (self->fanout);
+
+  if (demand == !self->idle)
+    return demand;
+
+  if (demand) {
+    GST_INFO_OBJECT (self, "linked downstream again, capturing");
+    self->idle = FALSE;
+  } else {
+    GST_INFO_OBJECT (self, "nothing consumes our buffers, stopping capture");
+    gst_wasapi_src_reset_client (self, TRUE);
+    self->idle = TRUE;
+    self->idle_start = g_get_monotonic_time ();
+    self->idle_frames = 0;
   }
 
+  return demand;
+}
+
+/* Starts the client after reset(), through the stream if it is shared */
+static gboolean
+gst_wasapi_src_start_if_needed (GstWasapiSrc * self)
+{
+  HRESULT hr;
+
+  if (!self->client_shared)
+    return gst_wasapi_util_start_if_needed (GST_ELEMENT (self), self->client,
+        &self->client_needs_restart);
+
+  if (!g_atomic_int_compare_and_exchange (&self->client_needs_restart, TRUE,
+          FALSE))
+    return TRUE;
+
+  hr = gst_wasapi_capture_stream_start (self->capture_stream);
+  HR_FAILED_AND (hr, IAudioClient::Start,
+      g_atomic_int_set (&self->client_needs_restart, TRUE); return FALSE);
+
   return TRUE;
 }
 
-static gboolean
-gst_wasapi_src_prepare (GstAudioSrc * asrc, GstAudioRingBufferSpec * spec)
+/* The next packet of the capture client, or of what the capture thread
+ * queued from it with shared-engine */
+static inline HRESULT
+gst_wasapi_src_get_buffer (GstWasapiSrc * self, BYTE ** data,
+    UINT32 * n_frames, DWORD * flags, UINT64 * devpos, UINT64 * qpcpos)
+{
+  if (self->capture_stream != NULL)
+    return gst_wasapi_capture_stream_get_buffer (self->capture_stream, data,
+        n_frames, flags, devpos, qpcpos);
+
+  return IAudioCaptureClient_GetBuffer (self->capture_client, data, n_frames,
+      flags, devpos, qpcpos);
+}
+
+/* On the I/O thread, with the packet still held */
+static inline void
+gst_wasapi_src_emit_packet (GstWasapiSrc * self, const guint8 * data,
+    UINT32 n_frames, DWORD flags, UINT64 qpcpos)
+{
+  if (!g_atomic_int_get (&self->emit_packets))
+    return;
+
+  g_signal_emit (self, gst_wasapi_src_signals[SIGNAL_NEW_PACKET], 0, data,
+      (guint) n_frames, (guint) flags, (guint64) qpcpos);
+}
+
+static inline HRESULT
+gst_wasapi_src_release_buffer (GstWasapiSrc * self, UINT32 n_frames)
+{
+  if (self->capture_stream != NULL) {
+    gst_wasapi_capture_stream_release_buffer (self->capture_stream);
+    return S_OK;
+  }
+
+  return IAudioCaptureClient_ReleaseBuffer (self->capture_client, n_frames);
+}
+
+static inline HRESULT
+gst_wasapi_src_get_next_packet_size (GstWasapiSrc * self, UINT32 * n_frames)
+{
+  if (self->capture_stream != NULL)
+    return gst_wasapi_capture_stream_get_next_packet_size
+        (self->capture_stream, n_frames);
+
+  return IAudioCaptureClient_GetNextPacketSize (self->capture_client,
+      n_frames);
+}
+
+static void
+gst_wasapi_src_detect_pulse (GstWasapiSrc * self, const guint8 * data,
+    guint n_frames, guint64 qpcpos)
+{
+  GstClockTime latency;
+
+  latency = gst_wasapi_latency_probe_detect (self->latency_probe, data,
+      n_frames, qpcpos);
+  if (GST_CLOCK_TIME_IS_VALID (latency))
+    gst_wasapi_src_notify (self, SRC_NOTIFY_PULSE, latency, 0, 0);
+}
+
+/* Drops what the device captures while we're paused or flushing with
+ * keep-running, until read() or create() stop it */
+static gpointer
+gst_wasapi_src_drain_thread_func (gpointer user_data)
+{
+  GstWasapiSrc *self = user_data;
+  DWORD period_ms = (DWORD) MAX (self->device_period_us / 1000, 1);
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+
+  /* Polled, so the event stays with read(). Only after a period, a read()
+   * that was just cancelled may still be releasing its packet. */
+  while (WaitForSingleObject (self->drain_stop, period_ms) == WAIT_TIMEOUT) {
+    UINT32 next_frames, n_frames;
+    UINT64 devpos, qpcpos;
+    DWORD flags;
+    BYTE *data;
+
+    while (gst_wasapi_src_get_next_packet_size (self, &next_frames) == S_OK &&
+        next_frames > 0) {
+      if (gst_wasapi_src_get_buffer (self, &data, &n_frames, &flags, &devpos,
+              &qpcpos) != S_OK)
+        break;
+      gst_wasapi_src_release_buffer (self, n_frames);
+    }
+  }
+
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static void
+gst_wasapi_src_start_drain (GstWasapiSrc * self)
+{
+  if (self->drain_thread != NULL)
+    return;
+
+  GST_DEBUG_OBJECT (self, "keeping the stream running");
+  ResetEvent (self->drain_stop);
+  self->drain_thread = g_thread_new ("wasapi-drain",
+      gst_wasapi_src_drain_thread_func, self);
+}
+
+static void
+gst_wasapi_src_stop_drain (GstWasapiSrc * self)
+{
+  if (G_LIKELY (self->drain_thread == NULL))
+    return;
+
+  SetEvent (self->drain_stop);
+  g_thread_join (self->drain_thread);
+  self->drain_thread = NULL;
+}
+
+/* With scheduling=timer, whether a timer tick has anything to read. With
+ * spin, whether the device period is there. */
+static gboolean
+gst_wasapi_src_packet_ready (GstWasapiSrc * self)
+{
+  UINT32 n_frames = 0;
+  HRESULT hr;
+
+  hr = gst_wasapi_src_get_next_packet_size (self, &n_frames);
+
+  /* GetBuffer() reports the errors */
+  return FAILED (hr) || n_frames > 0;
+}
+
+static gpointer
+gst_wasapi_src_spare_thread_func (gpointer user_data)
 {
-  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
-  gboolean res = FALSE;
-  REFERENCE_TIME latency_rt;
-  guint bpf, rate, devicep_frames, buffer_frames;
+  GstWasapiSrc *self = user_data;
+  GstAudioRingBufferSpec *spec = &GST_AUDIO_BASE_SRC (self)->ringbuffer->spec;
+  IMMDevice *device = NULL;
+  IAudioClient *client = NULL;
+  IAudioClock *client_clock = NULL;
+  IAudioCaptureClient *capture_client = NULL;
+  guint devicep_frames, buffer_frames;
+  guint64 freq, start = gst_wasapi_util_get_qpc_position ();
+  gboolean res = FALSE, switching;
+  wchar_t *strid = NULL;
   HRESULT hr;
 
-  CoInitialize (NULL);
+  GST_OBJECT_LOCK (self);
+  switching = self->spare_switch;
+  if (switching && self->spare_device_id != NULL)
+    strid = g_utf8_to_utf16 (self->spare_device_id, -1, NULL, NULL, NULL);
+  if (!switching) {
+    device = self->device;
+    IUnknown_AddRef (device);
+  }
+  GST_OBJECT_UNLOCK (self);
 
-  if (gst_wasapi_src_can_audioclient3 (self)) {
-    if (!gst_wasapi_util_initialize_audioclient3 (GST_ELEMENT (self), spec,
-            (IAudioClient3 *) self->client, self->mix_format, self->low_latency,
-            self->loopback, &devicep_frames))
+  if (switching) {
+    /* Like switch_device(), the engine converts from the mix format of the
+     * new endpoint to the one we run in */
+    if (!gst_wasapi_util_get_device_client (GST_ELEMENT (self),
+            self->loopback ? eRender : eCapture, self->role, strid, &device,
+            &client))
       goto beach;
-  } else {
+
+    gst_wasapi_src_set_client_properties (self, client);
+
     if (!gst_wasapi_util_initialize_audioclient (GST_ELEMENT (self), spec,
-            self->client, self->mix_format, self->sharemode, self->low_latency,
+            device, &client, self->mix_format, self->sharemode,
+            gst_wasapi_src_low_latency (self), self->loopback, TRUE, FALSE,
+            &devicep_frames))
+      goto beach;
+  } else {
+    hr = IMMDevice_Activate (device, &IID_IAudioClient3, CLSCTX_ALL, NULL,
+        (void **) &client);
+    HR_FAILED_GOTO (hr, IMMDevice::Activate (IID_IAudioClient3), beach);
+
+    gst_wasapi_src_set_client_properties (self, client);
+
+    if (!gst_wasapi_util_initialize_audioclient3 (GST_ELEMENT (self), spec,
+            (IAudioClient3 *) client, self->mix_format, self->low_latency,
             self->loopback, &devicep_frames))
       goto beach;
   }
 
-  bpf = GST_AUDIO_INFO_BPF (&spec->info);
-  rate = GST_AUDIO_INFO_RATE (&spec->info);
-
-  /* Total size in frames of the allocated buffer that we will read from */
-  hr = IAudioClient_GetBufferSize (self->client, &buffer_frames);
+  hr = IAudioClient_GetBufferSize (client, &buffer_frames);
   HR_FAILED_GOTO (hr, IAudioClient::GetBufferSize, beach);
 
-  GST_INFO_OBJECT (self, "buffer size is %i frames, device period is %i "
-      "frames, bpf is %i bytes, rate is %i Hz", buffer_frames,
-      devicep_frames, bpf, rate);
-  self->sample_rate = rate;
-
-  /* Actual latency-time/buffer-time will be different now */
-  spec->segsize = devicep_frames * bpf;
-
-  /* We need a minimum of 2 segments to ensure glitch-free playback */
-  spec->segtotal = MAX (buffer_frames * bpf / spec->segsize, 2) + 1;
-
-  GST_INFO_OBJECT (self, "segsize is %i, segtotal is %i (%i)", spec->segsize,
-      spec->segtotal,
-      buffer_frames * bpf / spec->segsize);
-
-  self->overflow_buffer_size = spec->segsize * 4;
-  self->overflow_buffer_ptr = 0;
-  self->overflow_buffer_length = 0;
-  self->overflow_buffer = g_malloc(self->overflow_buffer_size);
-
-  /* Get WASAPI latency for logging */
-  hr = IAudioClient_GetStreamLatency (self->client, &latency_rt);
-  HR_FAILED_GOTO (hr, IAudioClient::GetStreamLatency, beach);
-
-  GST_INFO_OBJECT (self, "wasapi stream latency: %" G_GINT64_FORMAT " (%"
-      G_GINT64_FORMAT " ms)", latency_rt, latency_rt / 10000);
-
-  /* Set the event handler which will trigger reads */
-  hr = IAudioClient_SetEventHandle (self->client, self->event_handle);
+  /* Both clients signal the same event while they overlap, read() finds
+   * nothing for the spare wakeups */
+  hr = IAudioClient_SetEventHandle (client, self->event_handle);
   HR_FAILED_GOTO (hr, IAudioClient::SetEventHandle, beach);
 
-  /* Get the clock and the clock freq */
-  if (!gst_wasapi_util_get_clock (GST_ELEMENT (self), self->client,
-          &self->client_clock))
+  if (!gst_wasapi_util_get_clock (GST_ELEMENT (self), client, &client_clock))
     goto beach;
 
-  hr = IAudioClock_GetFrequency (self->client_clock, &self->client_clock_freq);
+  hr = IAudioClock_GetFrequency (client_clock, &freq);
   HR_FAILED_GOTO (hr, IAudioClock::GetFrequency, beach);
 
-  GST_INFO_OBJECT (self, "wasapi clock freq is %" G_GUINT64_FORMAT,
-      self->client_clock_freq);
-
-  /* Get capture source client and start it up */
-  if (!gst_wasapi_util_get_capture_client (GST_ELEMENT (self), self->client,
-          &self->capture_client)) {
+  if (!gst_wasapi_util_get_capture_client (GST_ELEMENT (self), client,
+          &capture_client))
     goto beach;
-  }
-
-  hr = IAudioClient_Start (self->client);
-  HR_FAILED_GOTO (hr, IAudioClock::Start, beach);
-
-  gst_audio_ring_buffer_set_channel_positions (GST_AUDIO_BASE_SRC
-      (self)->ringbuffer, self->positions);
-
-  /* Increase the thread priority to reduce glitches */
-  self->thread_priority_handle = gst_wasapi_util_set_thread_characteristics ();
 
+  hr = IAudioClient_Start (client);
+  HR_FAILED_GOTO (hr, IAudioClient::Start, beach);
+
+  GST_INFO_OBJECT (self, "client with a period of %u frames ready in %"
+      G_GUINT64_FORMAT " us", devicep_frames,
+      (gst_wasapi_util_get_qpc_position () - start) / 10);
+
+  self->spare_client = client;
+  self->spare_clock = client_clock;
+  self->spare_capture_client = capture_client;
+  self->spare_devicep_frames = devicep_frames;
+  self->spare_buffer_frames = buffer_frames;
+  self->spare_freq = freq;
+  if (switching) {
+    self->spare_device = device;
+    device = NULL;
+  }
+  client = NULL;
+  client_clock = NULL;
+  capture_client = NULL;
   res = TRUE;
-beach:
-  /* unprepare() is not called if prepare() fails, but we want it to be, so call
-   * it manually when needed */
-  if (!res)
-    gst_wasapi_src_unprepare (asrc);
 
-  return res;
+beach:
+  if (!res && switching)
+    GST_WARNING_OBJECT (self, "can't switch devices while running, the new "
+        "device is used from the next prepare");
+  else if (!res)
+    GST_WARNING_OBJECT (self, "can't change the period while running, "
+        "keeping the current one until the next prepare");
+
+  g_free (strid);
+  if (capture_client != NULL)
+    IUnknown_Release (capture_client);
+  if (client_clock != NULL)
+    IUnknown_Release (client_clock);
+  if (client != NULL)
+    IUnknown_Release (client);
+  if (device != NULL)
+    IUnknown_Release (device);
+
+  g_atomic_int_set (&self->spare_done, TRUE);
+
+  return NULL;
 }
 
-static gboolean
-gst_wasapi_src_unprepare (GstAudioSrc * asrc)
+/* low-latency changed, only shared AudioClient3 streams can take that
+ * while running */
+static void
+gst_wasapi_src_request_period_change (GstWasapiSrc * self)
 {
-  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
-
-  if (self->thread_priority_handle != NULL) {
-    gst_wasapi_util_revert_thread_characteristics
-        (self->thread_priority_handle);
-    self->thread_priority_handle = NULL;
+  GST_OBJECT_LOCK (self);
+  if (!self->live_period) {
+    /* Takes effect with the next prepare() */
+  } else if (self->spare_thread != NULL) {
+    GST_INFO_OBJECT (self, "still changing the period, ignoring this change");
+  } else {
+    self->spare_switch = FALSE;
+    self->spare_thread = g_thread_new ("wasapi-period",
+        gst_wasapi_src_spare_thread_func, self);
   }
+  GST_OBJECT_UNLOCK (self);
+}
 
-  if (self->client != NULL) {
-    IAudioClient_Stop (self->client);
+/* device changed, shared streams read through read_device() open the new
+ * one in the background and move there at the next segment. @id NULL is
+ * the default device. */
+static void
+gst_wasapi_src_request_device_change (GstWasapiSrc * self, const gchar * id)
+{
+  GST_OBJECT_LOCK (self);
+  if (!self->live_device) {
+    /* Takes effect with the next open() */
+  } else if (self->spare_thread != NULL) {
+    GST_WARNING_OBJECT (self, "still changing the client, the new device is "
+        "used from the next prepare");
+  } else {
+    self->spare_switch = TRUE;
+    g_free (self->spare_device_id);
+    self->spare_device_id = g_strdup (id);
+    self->spare_thread = g_thread_new ("wasapi-device",
+        gst_wasapi_src_spare_thread_func, self);
   }
+  GST_OBJECT_UNLOCK (self);
+}
 
-  if (self->capture_client != NULL) {
-    IUnknown_Release (self->capture_client);
-    self->capture_client = NULL;
+/* At the start of a segment, when the spare thread is done. What the old
+ * client still holds goes to the overflow buffer, which is read next, and
+ * the new client continues right after its last frame. */
+static void
+gst_wasapi_src_swap_client (GstWasapiSrc * self)
+{
+  guint bpf = self->mix_format->nBlockAlign;
+  guint rate = self->mix_format->nSamplesPerSec;
+  IAudioClient *old_client;
+  IAudioClock *old_clock;
+  IAudioCaptureClient *old_capture_client;
+  GThread *thread;
+  GstClock *clock;
+  guint64 end_qpc = 0;
+
+  GST_OBJECT_LOCK (self);
+  thread = self->spare_thread;
+  self->spare_thread = NULL;
+  GST_OBJECT_UNLOCK (self);
+  if (thread != NULL)
+    g_thread_join (thread);
+  g_atomic_int_set (&self->spare_done, FALSE);
+
+  if (self->spare_client == NULL)
+    return;
+
+  clock = gst_wasapi_src_clock_copy (self, &self->device_clock);
+
+  while (TRUE) {
+    BYTE *from;
+    UINT32 n_frames;
+    UINT64 devpos, qpcpos;
+    DWORD flags;
+    HRESULT hr;
+
+    hr = gst_wasapi_src_get_buffer (self, &from, &n_frames, &flags, &devpos,
+        &qpcpos);
+    if (hr != S_OK)
+      break;
+
+    if (!(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+      if (self->overflow_buffer_length == 0)
+        self->overflow_timestamp = clock ?
+            gst_wasapi_util_qpc_to_clock_time (clock, qpcpos) :
+            GST_CLOCK_TIME_NONE;
+      end_qpc = qpcpos + gst_util_uint64_scale_int (n_frames, 10000000, rate);
+    } else if (self->overflow_buffer_length == 0) {
+      self->overflow_timestamp = GST_CLOCK_TIME_NONE;
+    }
+
+    gst_wasapi_src_overflow_push (self, (flags & AUDCLNT_BUFFERFLAGS_SILENT) ?
+        NULL : from, (gsize) n_frames * bpf);
+    gst_wasapi_src_release_buffer (self, n_frames);
   }
 
-  if (self->client_clock != NULL) {
-    IUnknown_Release (self->client_clock);
-    self->client_clock = NULL;
+  IAudioClient_Stop (self->client);
+  /* The spare is initialized without rate adjustment */
+  gst_wasapi_src_clear_clock_adjust (self);
+
+  if (self->spare_device != NULL) {
+    GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+    IMMDevice *old_device;
+    gchar *old_id;
+
+    GST_OBJECT_LOCK (self);
+    old_device = self->device;
+    old_id = self->device_id;
+    self->device = self->spare_device;
+    self->device_id = gst_wasapi_util_get_device_id (self->device);
+    /* This segment continues with the new device after what the old one
+     * still had */
+    self->seam_sample = (guint64) (g_atomic_int_get (&ringbuffer->segdone) -
+        ringbuffer->segbase) * ringbuffer->samples_per_seg +
+        self->overflow_buffer_length / bpf;
+    GST_OBJECT_UNLOCK (self);
+    self->spare_device = NULL;
+
+    IUnknown_Release (old_device);
+    g_free (old_id);
+
+    if (self->level_mode == GST_WASAPI_LEVEL_MODE_ENDPOINT) {
+      g_clear_pointer (&self->level, gst_wasapi_level_free);
+      self->level = gst_wasapi_level_new_endpoint (GST_ELEMENT (self),
+          self->device, &GST_AUDIO_BASE_SRC (self)->ringbuffer->spec.info,
+          self->level_interval);
+    }
+    GST_INFO_OBJECT (self, "switched to device %s", self->device_id);
   }
 
-  self->client_clock_freq = 0;
-  self->capture_too_many_frames_log_count = 0;
+  GST_OBJECT_LOCK (self);
+  old_client = self->client;
+  old_clock = self->client_clock;
+  old_capture_client = self->capture_client;
+  self->client = self->spare_client;
+  self->client_clock = self->spare_clock;
+  self->capture_client = self->spare_capture_client;
+  GST_OBJECT_UNLOCK (self);
+  gst_wasapi_src_watch_session (self);
+
+  IUnknown_Release (old_capture_client);
+  IUnknown_Release (old_clock);
+  IUnknown_Release (old_client);
+  self->spare_client = NULL;
+  self->spare_clock = NULL;
+  self->spare_capture_client = NULL;
+
+  self->client_clock_freq = self->spare_freq;
+  self->buffer_frame_count = self->spare_buffer_frames;
+  self->device_period_us =
+      gst_util_uint64_scale_int (self->spare_devicep_frames, G_USEC_PER_SEC,
+      rate);
+  self->warm_devicep_frames = self->spare_devicep_frames;
+  self->next_devpos = -1;
+  self->packets_pending = FALSE;
+  self->trim_qpc = end_qpc;
+  /* The device positions start over, the audio doesn't */
+  g_atomic_int_set (&self->drift_needs_reset, TRUE);
+
+  GST_INFO_OBJECT (self, "switched to a period of %u frames, %"
+      G_GSIZE_FORMAT " bytes left over from the previous client",
+      self->spare_devicep_frames, self->overflow_buffer_length);
+}
 
-  if (self->overflow_buffer != NULL) {
-    g_free(self->overflow_buffer);
-    self->overflow_buffer = NULL;
-    self->overflow_buffer_size = 0;
-    self->overflow_buffer_ptr = 0;
-    self->overflow_buffer_length = 0;
+/* Drops the start of a packet of the new client that the previous one
+ * captured already */
+static void
+gst_wasapi_src_trim_packet (GstWasapiSrc * self, BYTE ** data,
+    guint * n_frames, UINT64 * devpos, UINT64 * qpcpos, DWORD flags)
+{
+  guint rate = self->mix_format->nSamplesPerSec;
+  guint64 skip;
+
+  if ((flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) ||
+      *qpcpos >= self->trim_qpc) {
+    self->trim_qpc = 0;
+    return;
   }
 
-  GST_INFO("stats: drift_correction: %d, timeshifted: %d", self->drift_correction_count, self->timeshifted_count);
+  skip = MIN (gst_util_uint64_scale_int_round (self->trim_qpc - *qpcpos,
+          rate, 10000000), *n_frames);
+  GST_DEBUG_OBJECT (self, "dropping %" G_GUINT64_FORMAT " frames the previous "
+      "client captured too", skip);
+
+  if (!(flags & AUDCLNT_BUFFERFLAGS_SILENT))
+    *data += skip * self->mix_format->nBlockAlign;
+  *n_frames -= skip;
+  *devpos += skip;
+  *qpcpos += gst_util_uint64_scale_int (skip, 10000000, rate);
+  if (*n_frames > 0)
+    self->trim_qpc = 0;
+}
 
-  self->drift_correction_count = 0;
-  self->timeshifted_count = 0;
+/* Adds the silent flag to a packet of @n_frames at @from that is digitally
+ * silent without it, see gstwasapisilence.h */
+static inline DWORD
+gst_wasapi_src_detect_silence (GstWasapiSrc * self, gconstpointer from,
+    guint n_frames, DWORD flags)
+{
+  if (self->silence == NULL)
+    return flags;
 
-  CoUninitialize ();
+  if (gst_wasapi_silence_process (self->silence,
+          (flags & AUDCLNT_BUFFERFLAGS_SILENT) ? NULL : from, n_frames))
+    flags |= AUDCLNT_BUFFERFLAGS_SILENT;
 
-  return TRUE;
+  return flags;
 }
 
 static guint
-gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data, guint length,
+gst_wasapi_src_read_device (GstAudioSrc * asrc, gpointer data, guint length,
     GstClockTime * timestamp)
 {
   GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
@@ -730,52 +5623,179 @@ gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data, guint length,
   guint wanted = length;
   DWORD flags;
   guint8 *data_ptr = data;
+  guint bpf = self->mix_format->nBlockAlign;
+  guint rate = self->mix_format->nSamplesPerSec;
+  GstClock *clock = NULL;
+  gboolean silent = TRUE;
+  guint64 capture_qpc = 0;
+
+  /* In direct mode create() talks to the capture client itself and the
+   * ringbuffer thread just idles here until it is stopped */
+  if (self->direct || self->zero_copy) {
+    if (gst_wasapi_cancel_prepare (&self->stop))
+      WaitForSingleObject (self->stop.handle, INFINITE);
+    memset (data, 0, length);
+    return length;
+  }
 
-  GST_OBJECT_LOCK (self);
-  if (self->client_needs_restart) {
-    hr = IAudioClient_Start (self->client);
-    HR_FAILED_AND (hr, IAudioClient::Start, length = 0; goto beach);
-    self->client_needs_restart = FALSE;
+  /* Reset while we weren't looking, this segment is flushed anyway */
+  if (!gst_wasapi_cancel_prepare (&self->stop)) {
+    *timestamp = GST_CLOCK_TIME_NONE;
+    memset (data, 0, length);
+    goto beach;
   }
-  GST_OBJECT_UNLOCK (self);
+
+  /* Nobody would see it, don't capture it */
+  if (G_UNLIKELY (!gst_wasapi_src_check_demand (self))) {
+    *timestamp = GST_CLOCK_TIME_NONE;
+    gst_wasapi_src_wait_frames (self, self->demand_event, &self->idle_start,
+        &self->idle_frames, wanted / bpf);
+    memset (data_ptr, 0, wanted);
+    goto beach;
+  }
+
+  /* Don't touch the dead client until we have a new one */
+  if (G_UNLIKELY (self->outage)) {
+    *timestamp = GST_CLOCK_TIME_NONE;
+    if (g_get_monotonic_time () < self->outage_retry ||
+        !gst_wasapi_src_recover (self, &data_ptr, &wanted)) {
+      self->outage_retry = MAX (self->outage_retry, g_get_monotonic_time () +
+          OUTAGE_RETRY_INTERVAL);
+      gst_wasapi_src_fill_outage (self, data_ptr, wanted);
+      goto beach;
+    }
+    GST_INFO_OBJECT (self, "capturing again after %" G_GINT64_FORMAT " ms",
+        (g_get_monotonic_time () - self->outage_start) / 1000);
+    self->outage = FALSE;
+  }
+
+  if (!gst_wasapi_src_start_if_needed (self)) {
+    length = 0;
+    goto beach;
+  }
+
+  /* Used to translate the QPC capture time of the packets */
+  clock = gst_wasapi_src_clock_copy (self, &self->device_clock);
+
+  *timestamp = GST_CLOCK_TIME_NONE;
+
+  if (G_UNLIKELY (g_atomic_int_get (&self->spare_done)))
+    gst_wasapi_src_swap_client (self);
 
   if (G_UNLIKELY(self->overflow_buffer_length > 0)) {
-      guint n = MIN(self->overflow_buffer_length, wanted);
+      guint n;
+
+      *timestamp = self->overflow_timestamp;
+      silent = self->overflow_silent;
+      /* Saved in device order */
+      n = gst_wasapi_src_overflow_pop (self, data_ptr, wanted, self->reorder);
+      if (GST_CLOCK_TIME_IS_VALID (self->overflow_timestamp))
+          self->overflow_timestamp += gst_util_uint64_scale_int (n / bpf,
+              GST_SECOND, rate);
 
-      gpointer ptr = &(self->overflow_buffer[self->overflow_buffer_ptr]);
-      memcpy(data_ptr, ptr, n);
       data_ptr += n;
       wanted -= n;
 
       GST_LOG_OBJECT(self, "restored %i bytes from overflow", n);
-      if (n == self->overflow_buffer_length) {
-          self->overflow_buffer_ptr = 0;
-          self->overflow_buffer_length = 0;
-      } else {
+      if (self->overflow_buffer_length > 0)
           GST_LOG_OBJECT(self, "WASAPI more in overflow that wanted");
-          self->overflow_buffer_ptr += n;
-          self->overflow_buffer_length -= n;
-      }
   }
 
   while (wanted > 0) {
     DWORD dwWaitResult;
-    guint have_frames, n_frames, want_frames, read_len;
+    guint have_frames, packet_frames, n_frames, want_frames, read_len;
+    UINT64 devpos, qpcpos;
+    guint64 hold_start, wait_start = 0;
+    GstClockTime packet_ts;
+    gint64 wakeup = 0;
+    guint drained_frames = 0, glitches = 0;
 
     /* Wait for data to become available */
 
     HANDLE events[2] = {
-      self->event_handle,
-      self->stop_handle
+      self->timer_handle ? self->timer_handle : self->event_handle,
+      self->stop.handle
     };
-    dwWaitResult = WaitForMultipleObjects (2, events, FALSE, INFINITE);
-    if (!self->device_strid && g_atomic_int_get(&(self->change.default_changed))) {
-      goto device_disappeared;
+
+    if (self->packets_pending) {
+      /* Their event is gone already */
+      self->packets_pending = FALSE;
+      dwWaitResult = WAIT_OBJECT_0;
+    } else {
+      if (self->power_saving) {
+        LARGE_INTEGER due;
+        gint64 left_us = gst_util_uint64_scale_int (wanted / bpf,
+            G_USEC_PER_SEC, rate);
+
+        /* Until the rest of the segment is in the device, the system may
+         * delay it by a quarter to wake up with other timers */
+        due.QuadPart = -(LONGLONG) MAX (left_us, self->device_period_us) * 10;
+        SetWaitableTimerEx (self->timer_handle, &due, 0, NULL, NULL, NULL,
+            (ULONG) MAX (self->wakeup_us / 4000, 1));
+      } else if (self->timer_handle != NULL) {
+        LARGE_INTEGER due;
+
+        /* Relative, in 100 ns. What is left after a tick is read without
+         * waiting, so it doesn't matter that the ticks drift. */
+        due.QuadPart = -(LONGLONG) self->device_period_us * 10;
+        SetWaitableTimer (self->timer_handle, &due, 0, NULL, NULL, FALSE);
+      }
+
+      if (self->packet_log != NULL)
+        wait_start = gst_wasapi_util_get_qpc_position ();
+      dwWaitResult = WaitForMultipleObjects (2, events, FALSE,
+          gst_wasapi_src_watchdog_timeout (self));
+      gst_wasapi_trace_wakeup (GST_ELEMENT (self), dwWaitResult);
+      if (self->packet_log != NULL)
+        self->packet_log_wait_us = (guint32) MIN (G_MAXUINT32,
+            (gst_wasapi_util_get_qpc_position () - wait_start) / 10);
+    }
+    if (!self->device_strid && g_atomic_int_get (&self->default_changed) &&
+        dwWaitResult != WAIT_OBJECT_0 + 1) {
+      if (gst_wasapi_src_follow_default (self, &data_ptr, &wanted))
+        continue;
+      if (!gst_wasapi_src_can_switch_device (self))
+        goto device_disappeared;
+      /* No default device right now */
+      gst_wasapi_src_fill_outage (self, data_ptr, wanted);
+      goto beach;
+    }
+    /* A device we prefer came back */
+    if (self->device_list != NULL && dwWaitResult != WAIT_OBJECT_0 + 1 &&
+        g_atomic_int_compare_and_exchange (&self->device_list_changed, TRUE,
+            FALSE) && gst_wasapi_src_failover (self, FALSE, &data_ptr,
+            &wanted))
+      continue;
+    /* A tick without packets doesn't count as an event, the watchdog still
+     * makes up for an idle loopback device */
+    if (self->timer_handle != NULL && dwWaitResult == WAIT_OBJECT_0 &&
+        !gst_wasapi_src_packet_ready (self)) {
+      if (gst_wasapi_src_watchdog_timeout (self) != 0)
+        continue;
+      dwWaitResult = WAIT_TIMEOUT;
     }
     switch (dwWaitResult) {
       case WAIT_OBJECT_0:
+        self->watchdog_deadline = 0;
+        self->watchdog_active = FALSE;
+        wakeup = g_get_monotonic_time ();
         break;
-      case WAIT_OBJECT_0 + 1: // Received a stop signal, going to fill data with silent
+      case WAIT_OBJECT_0 + 1:
+        /* Reset, don't wait for the rest. What we read is partial and
+         * belongs to what gets flushed, so the segment goes out as GAP
+         * rather than as samples padded with made up silence. */
+        memset (data_ptr, 0, wanted);
+        silent = TRUE;
+        goto beach;
+      case WAIT_TIMEOUT: // Idle loopback device, make up the rest of the segment
+        gst_wasapi_src_watchdog_fired (self);
+        if (!GST_CLOCK_TIME_IS_VALID (*timestamp) && clock) {
+            GstClockTime now = gst_clock_get_time (clock);
+            GstClockTime segment_duration = gst_util_uint64_scale_int (
+                length / bpf, GST_SECOND, rate);
+
+            *timestamp = now > segment_duration ? now - segment_duration : 0;
+        }
         memset (data_ptr, 0, wanted);
         goto beach;
       default:
@@ -787,41 +5807,139 @@ gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data, guint length,
 
     // fully drain the wasapi driver - we may not get a new signal for pending buffers
     // https://blogs.msdn.microsoft.com/matthew_van_eerde/2014/11/05/draining-the-wasapi-capture-buffer-fully/
+    // but only up to the end of the segment, what is left stays in the
+    // device until the next read(), which doesn't wait for the event then
     int i = 0;
     while (TRUE) {
+        UINT32 next_frames;
+
+        hr = gst_wasapi_src_get_next_packet_size (self, &next_frames);
+        if (hr == S_OK && (next_frames == 0 || wanted == 0)) {
+            self->packets_pending = next_frames > 0;
+            gst_wasapi_src_update_stats (self, wakeup, i, drained_frames,
+                glitches);
+            break;
+        }
 
-        hr = IAudioCaptureClient_GetBuffer(self->capture_client,
-            (BYTE **)& from, &have_frames, &flags, NULL, NULL);
-        if (hr == AUDCLNT_E_DEVICE_INVALIDATED) {
-            goto device_disappeared;
+        hr = gst_wasapi_src_get_buffer (self, (BYTE **) & from,
+            &have_frames, &flags, &devpos, &qpcpos);
+        hold_start = gst_wasapi_util_get_qpc_position ();
+        if (GST_WASAPI_CLIENT_LOST (hr)) {
+            if (gst_wasapi_src_recover (self, &data_ptr, &wanted))
+                break;
+            /* Nothing we could switch to, the application has to */
+            if (!gst_wasapi_src_can_switch_device (self))
+                goto device_disappeared;
+            /* None is there, make up silence until one comes back and
+             * try again with the next segments */
+            gst_wasapi_src_fill_outage (self, data_ptr, wanted);
+            goto beach;
         }
         else if (hr == AUDCLNT_S_BUFFER_EMPTY) {
-            gchar *msg = gst_wasapi_util_hresult_to_string(hr);
-            GST_LOG_OBJECT(self, "IAudioCaptureClient::GetBuffer failed: %s"
-                ", retrying later", msg);
+            /* Happens every period once drained, don't allocate here */
+            GST_LOG_OBJECT(self, "IAudioCaptureClient::GetBuffer returned "
+                "AUDCLNT_S_BUFFER_EMPTY, retrying later");
+            gst_wasapi_src_update_stats (self, wakeup, i, drained_frames,
+                glitches);
             break;
         }
         else if (hr != S_OK) {
-            gchar *msg = gst_wasapi_util_hresult_to_string(hr);
-            GST_ERROR_OBJECT(self, "IAudioCaptureClient::GetBuffer failed: %s", msg);
-            g_free(msg);
+            GST_ERROR_OBJECT(self, "IAudioCaptureClient::GetBuffer failed "
+                "(%x): %s", (guint) hr,
+                gst_wasapi_util_hresult_to_static_string (hr));
             length = 0;
             goto beach;
         }
+        gst_wasapi_trace_get_buffer (GST_ELEMENT (self), have_frames, flags,
+            devpos, qpcpos);
+        if (self->packet_log != NULL) {
+            gst_wasapi_packet_log_add (self->packet_log, qpcpos, devpos,
+                have_frames, flags, self->packet_log_wait_us);
+            self->packet_log_wait_us = 0;
+        }
+        packet_frames = have_frames;
+        if (G_UNLIKELY (self->trim_qpc != 0)) {
+            gst_wasapi_src_trim_packet (self, (BYTE **) & from, &have_frames,
+                &devpos, &qpcpos, flags);
+            if (have_frames == 0) {
+                gst_wasapi_src_release_buffer (self, packet_frames);
+                continue;
+            }
+        }
         if (i > 0) {
             GST_LOG_OBJECT(self, "draining WASAPI buffer %i", i);
         }
         i++;
 
         int mask_handled = MAXINT ^ (AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY | AUDCLNT_BUFFERFLAGS_SILENT);
+        drained_frames += have_frames;
         if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
             GST_WARNING_OBJECT(self, "WASAPI reported glitch in buffer");
+            glitches++;
         } 
         
         if ((flags & mask_handled) != 0) {
             GST_INFO_OBJECT(self, "buffer flags=%#08x", (guint)flags);
         }
 
+        /* Capture time of the first frame in this packet */
+        packet_ts = GST_CLOCK_TIME_NONE;
+        if (clock && !(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+            packet_ts = gst_wasapi_util_qpc_to_clock_time (clock, qpcpos);
+            gst_wasapi_src_push_drift_point (self, devpos, packet_ts);
+        }
+        if (self->segment_times != NULL && capture_qpc == 0 &&
+            !(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+            guint64 filled = gst_util_uint64_scale_int (
+                (data_ptr - (guint8 *) data) / bpf, 10000000, rate);
+
+            capture_qpc = qpcpos - MIN (qpcpos, filled);
+        }
+
+        /* Replace frames the device lost with silence so the timeline
+         * doesn't shrink */
+        {
+            guint64 missing = gst_wasapi_src_check_gap (self, devpos,
+                have_frames);
+
+            if (missing > 0 ||
+                (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY)) {
+                gst_wasapi_src_etw_glitch (self, qpcpos, wakeup);
+                if (gst_wasapi_glitch_log_add (&self->glitch_log,
+                        GST_WASAPI_GLITCH_DEVICE, devpos, missing))
+                  gst_wasapi_src_notify (self, SRC_NOTIFY_GLITCHES, 0, 0, 0);
+            }
+
+            if (missing > 0) {
+                gsize fill = MIN (missing * bpf, wanted);
+
+                memset (data_ptr, 0, fill);
+                data_ptr += fill;
+                wanted -= fill;
+
+                if (fill < missing * bpf) {
+                    if (self->overflow_buffer_length == 0) {
+                        self->overflow_timestamp = GST_CLOCK_TIME_NONE;
+                        if (GST_CLOCK_TIME_IS_VALID (packet_ts))
+                            self->overflow_timestamp = packet_ts -
+                                MIN (packet_ts, gst_util_uint64_scale_int (
+                                    missing - fill / bpf, GST_SECOND, rate));
+                    }
+                    gst_wasapi_src_overflow_push (self, NULL,
+                        missing * bpf - fill);
+                }
+            }
+        }
+
+        /* ... and from that of the first frame in the segment */
+        if (!GST_CLOCK_TIME_IS_VALID (*timestamp) &&
+            GST_CLOCK_TIME_IS_VALID (packet_ts)) {
+            GstClockTime filled = gst_util_uint64_scale_int (
+                (data_ptr - (guint8 *) data) / bpf, GST_SECOND, rate);
+
+            *timestamp = packet_ts > filled ? packet_ts - filled : 0;
+        }
+
         want_frames = wanted / self->mix_format->nBlockAlign;
 
         /* Only copy data that will fit into the allocated buffer of size @length */
@@ -835,10 +5953,40 @@ gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data, guint length,
               want_frames, wanted, n_frames, read_len);
         }
 
+        /* The whole packet, in device order */
+        if (self->latency_probe != NULL &&
+            !(flags & AUDCLNT_BUFFERFLAGS_SILENT))
+            gst_wasapi_src_detect_pulse (self, (const guint8 *) from,
+                have_frames, qpcpos);
+        if (self->shm != NULL)
+            gst_wasapi_shm_write (self->shm, (const guint8 *) from,
+                have_frames, qpcpos, flags);
+        if (self->record != NULL)
+            gst_wasapi_record_write (self->record, (const guint8 *) from,
+                have_frames, qpcpos, devpos, flags);
+        gst_wasapi_src_emit_packet (self, (const guint8 *) from, have_frames,
+            flags, qpcpos);
+
+        /* What was actually played while this was captured */
+        if (self->aec_ref != NULL &&
+            !(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) &&
+            have_frames <= self->aec_data_frames &&
+            gst_wasapi_aec_ref_read (self->aec_ref, self->mix_format,
+                self->aec_data, have_frames, qpcpos)) {
+            from = (gint16 *) self->aec_data;
+            flags &= ~AUDCLNT_BUFFERFLAGS_SILENT;
+        }
+
+        flags = gst_wasapi_src_detect_silence (self, from, have_frames, flags);
         if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
             memset(data_ptr, 0, read_len);
         } else {
-            memcpy(data_ptr, from, read_len);
+            if (self->reorder)
+                gst_wasapi_src_reorder (self, data_ptr, from, n_frames);
+            else
+                memcpy(data_ptr, from, read_len);
+            if (read_len > 0)
+                silent = FALSE;
         }
 
         data_ptr += read_len; // we loop - so we need to also advance data
@@ -849,28 +5997,36 @@ gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data, guint length,
             guint save_frames = have_frames - want_frames;
             gsize save_length = save_frames * self->mix_format->nBlockAlign;
 
-            if ((self->overflow_buffer_length + save_length + self->overflow_buffer_ptr) >
-                self->overflow_buffer_size) {
-                GST_ERROR_OBJECT(self, "can't save overflow at: %i length: %i bytes want %i more bytes space is %i",
-                                 self->overflow_buffer_ptr, self->overflow_buffer_length, save_length, self->overflow_buffer_size);
-            } else {
-                gpointer write_ptr = &(self->overflow_buffer[self->overflow_buffer_length]);
-                guint8 * from_buffer = (guint8 *) from;
-                gpointer from_ptr = &(from_buffer[read_len]);
-                memcpy(write_ptr, from_ptr, save_length);
-                self->overflow_buffer_length += (guint) save_length;
-                GST_LOG_OBJECT(self, "saved %i bytes to overflow", save_length);
+            if (self->overflow_buffer_length == 0) {
+                self->overflow_timestamp = GST_CLOCK_TIME_NONE;
+                if (GST_CLOCK_TIME_IS_VALID (packet_ts))
+                    self->overflow_timestamp = packet_ts +
+                        gst_util_uint64_scale_int (n_frames, GST_SECOND, rate);
             }
+
+            if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
+                gst_wasapi_src_overflow_push (self, NULL, save_length);
+            else
+                gst_wasapi_src_overflow_push (self, (guint8 *) from + read_len,
+                    save_length);
+            GST_LOG_OBJECT(self, "saved %i bytes to overflow", save_length);
         }
 
         /* Always release all captured buffers if we've captured any at all */
-        hr = IAudioCaptureClient_ReleaseBuffer (self->capture_client, have_frames);
-        HR_FAILED_AND (hr, IAudioClock::ReleaseBuffer, goto beach);
+        hr = gst_wasapi_src_release_buffer (self, packet_frames);
+        HR_FAILED_AND (hr, IAudioCaptureClient::ReleaseBuffer, goto beach);
+        gst_wasapi_trace_release_buffer (GST_ELEMENT (self), packet_frames);
+        /* QPC positions are in 100 ns */
+        gst_wasapi_histogram_add (&self->hold_histogram,
+            (gst_wasapi_util_get_qpc_position () - hold_start) / 10);
     }
   }
 
 
 beach:
+  gst_wasapi_src_mark_segment (self, silent && length > 0);
+  gst_wasapi_src_mark_segment_times (self, capture_qpc);
+
   // TODO: We need to properly buffer the results from GetBuffer because they return
   // an arbitrary amount of audio samples.  However, if we never empty this thing out
   // USB audio devices will glitch out after they fill up.  Right now, if there is 
@@ -891,130 +6047,1067 @@ beach:
   return length;
 device_disappeared:
   {
-    if (!self->eos_sent) {
-      GST_INFO_OBJECT(asrc, "The audio device has been disconnected.");
-      gboolean success = gst_element_post_message(GST_ELEMENT(self),
-        gst_message_new_element(GST_OBJECT(self),
-          gst_structure_new("wasapi_restart",
-            NULL)));
-      if (!success) {
-        GST_WARNING("Unable to send message");
-      }
-      self->eos_sent = TRUE;
-    }
+    gst_wasapi_src_post_restart (self);
+    /* Not what was left in there from the last time */
+    memset (data_ptr, 0, wanted);
     return (guint) length;
   }
 }
 
+/* Exclusive mode: each event signals one device period, which is exactly
+ * one segment, so it is copied once and nothing can be left over. Whatever
+ * doesn't fit that, a partial packet, a lost or changed device, goes back
+ * to gst_wasapi_src_read_device(). */
+static guint
+gst_wasapi_src_read_exclusive (GstAudioSrc * asrc, gpointer data,
+    guint length, GstClockTime * timestamp)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  guint bpf = self->mix_format->nBlockAlign;
+  HANDLE events[2] = { self->event_handle, self->stop.handle };
+  GstClock *clock;
+  BYTE *from;
+  UINT32 have_frames;
+  UINT64 devpos, qpcpos;
+  DWORD flags, dwWaitResult;
+  guint64 hold_start, missing;
+  guint glitches = 0;
+  gint64 wakeup;
+  HRESULT hr;
+
+  if (self->overflow_buffer_length > 0 || self->packets_pending ||
+      self->client_needs_restart ||
+      (!self->device_strid && g_atomic_int_get (&self->default_changed)))
+    return gst_wasapi_src_read_device (asrc, data, length, timestamp);
+
+  *timestamp = GST_CLOCK_TIME_NONE;
+
+  if (!gst_wasapi_cancel_prepare (&self->stop)) {
+    memset (data, 0, length);
+    gst_wasapi_src_mark_segment (self, TRUE);
+    return length;
+  }
+
+  if (self->spin.timer != NULL)
+    dwWaitResult = gst_wasapi_spin_wait (&self->spin, events, 2,
+        (GstWasapiSpinReadyFunc) gst_wasapi_src_packet_ready, self,
+        gst_wasapi_src_watchdog_timeout (self));
+  else
+    dwWaitResult = WaitForMultipleObjects (2, events, FALSE,
+        gst_wasapi_src_watchdog_timeout (self));
+  gst_wasapi_trace_wakeup (GST_ELEMENT (self), dwWaitResult);
+  switch (dwWaitResult) {
+    case WAIT_OBJECT_0:
+      self->watchdog_deadline = 0;
+      self->watchdog_active = FALSE;
+      wakeup = g_get_monotonic_time ();
+      break;
+    case WAIT_OBJECT_0 + 1:
+      memset (data, 0, length);
+      gst_wasapi_src_mark_segment (self, TRUE);
+      return length;
+    case WAIT_TIMEOUT:
+      /* The device stalled, create() stamps the silence from the clock */
+      gst_wasapi_src_watchdog_fired (self);
+      memset (data, 0, length);
+      gst_wasapi_src_mark_segment (self, TRUE);
+      return length;
+    default:
+      GST_ERROR_OBJECT (self, "Error waiting for event handle: %x",
+          (guint) dwWaitResult);
+      return 0;
+  }
+
+  hr = gst_wasapi_src_get_buffer (self, &from, &have_frames, &flags, &devpos,
+      &qpcpos);
+  hold_start = gst_wasapi_util_get_qpc_position ();
+  if (hr != S_OK || have_frames * bpf != length) {
+    /* The general path reads it again without waiting */
+    if (hr == S_OK) {
+      GST_DEBUG_OBJECT (self, "packet of %u frames, expected %u", have_frames,
+          length / bpf);
+      gst_wasapi_src_release_buffer (self, 0);
+    }
+    self->packets_pending = TRUE;
+    return gst_wasapi_src_read_device (asrc, data, length, timestamp);
+  }
+  gst_wasapi_trace_get_buffer (GST_ELEMENT (self), have_frames, flags, devpos,
+      qpcpos);
+
+  if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+    GST_WARNING_OBJECT (self, "WASAPI reported glitch in buffer");
+    glitches++;
+  }
+  /* Without an overflow buffer lost frames can't be made up for, the
+   * timestamps still follow the device */
+  missing = gst_wasapi_src_check_gap (self, devpos, have_frames);
+  if (missing > 0 || glitches > 0) {
+    gst_wasapi_src_etw_glitch (self, qpcpos, wakeup);
+    if (gst_wasapi_glitch_log_add (&self->glitch_log,
+            GST_WASAPI_GLITCH_DEVICE, devpos, missing))
+      gst_wasapi_src_notify (self, SRC_NOTIFY_GLITCHES, 0, 0, 0);
+  }
+
+  clock = gst_wasapi_src_clock_copy (self, &self->device_clock);
+  if (clock && !(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) {
+    *timestamp = gst_wasapi_util_qpc_to_clock_time (clock, qpcpos);
+    gst_wasapi_src_push_drift_point (self, devpos, *timestamp);
+  }
+
+  if (self->shm != NULL)
+    gst_wasapi_shm_write (self->shm, from, have_frames, qpcpos, flags);
+  if (self->record != NULL)
+    gst_wasapi_record_write (self->record, from, have_frames, qpcpos, devpos,
+        flags);
+  gst_wasapi_src_emit_packet (self, from, have_frames, flags, qpcpos);
+
+  flags = gst_wasapi_src_detect_silence (self, from, have_frames, flags);
+  if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
+    memset (data, 0, length);
+  else if (self->reorder)
+    gst_wasapi_src_reorder (self, data, from, have_frames);
+  else
+    memcpy (data, from, length);
+
+  hr = gst_wasapi_src_release_buffer (self, have_frames);
+  HR_FAILED_AND (hr, IAudioCaptureClient::ReleaseBuffer, glitches++);
+  gst_wasapi_trace_release_buffer (GST_ELEMENT (self), have_frames);
+  gst_wasapi_histogram_add (&self->hold_histogram,
+      (gst_wasapi_util_get_qpc_position () - hold_start) / 10);
+
+  gst_wasapi_src_update_stats (self, wakeup, 1, have_frames, glitches);
+  gst_wasapi_src_mark_segment (self, (flags & AUDCLNT_BUFFERFLAGS_SILENT) != 0);
+  gst_wasapi_src_mark_segment_times (self,
+      (flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) ? 0 : qpcpos);
+
+  return length;
+}
+
+static guint
+gst_wasapi_src_read_convert (GstAudioSrc * asrc, gpointer data, guint length,
+    GstClockTime * timestamp)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  guint in_bpf, out_bpf, n_frames;
+
+  /* Everything before channel-select and the conversion works in device
+   * frames */
+  in_bpf = self->mix_format->nBlockAlign;
+  out_bpf = GST_AUDIO_INFO_BPF (&GST_AUDIO_BASE_SRC (self)->ringbuffer->
+      spec.info);
+  n_frames = length / out_bpf;
+
+  if (self->convert_size < (gsize) n_frames * in_bpf) {
+    g_free (self->convert_data);
+    self->convert_size = (gsize) n_frames * in_bpf;
+    self->convert_data = g_malloc (self->convert_size);
+  }
+
+  n_frames = gst_wasapi_src_read_device (asrc, self->convert_data,
+      n_frames * in_bpf, timestamp) / in_bpf;
+  if (self->n_selected > 0) {
+    gint channels = self->mix_format->nChannels;
+
+    /* In place when it still gets converted */
+    gst_wasapi_util_select_channels (self->convert ? self->convert_data :
+        data, self->convert_data, n_frames, channels, in_bpf / channels,
+        self->n_selected, self->selected);
+  }
+  if (self->convert != NULL)
+    gst_wasapi_convert_process (self->convert,
+        (const gfloat *) self->convert_data, data, n_frames);
+
+  return n_frames * out_bpf;
+}
+
+static guint
+gst_wasapi_src_read_segment (GstAudioSrc * asrc, gpointer data, guint length,
+    GstClockTime * timestamp)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+
+  if (self->read_exclusive)
+    return gst_wasapi_src_read_exclusive (asrc, data, length, timestamp);
+  else if (self->convert == NULL && self->n_selected == 0)
+    return gst_wasapi_src_read_device (asrc, data, length, timestamp);
+  else
+    return gst_wasapi_src_read_convert (asrc, data, length, timestamp);
+}
+
+/* With fast-start, until create() pushed its first buffer. A period per
+ * segment is all it takes, the exclusive client reads whole segments
+ * anyway. */
+static gboolean
+gst_wasapi_src_wants_first_fill (GstWasapiSrc * self)
+{
+  return g_atomic_int_get (&self->fast_start) && !self->read_exclusive &&
+      !self->direct && !self->zero_copy && self->output_frames == 0 &&
+      self->device_period_us > 0 &&
+      GST_AUDIO_BASE_SRC (self)->next_sample == (guint64) - 1;
+}
+
+/* Fills the segment a device period at a time and publishes how far it
+ * got, so create() can push the first frames before the segment is full */
+static guint
+gst_wasapi_src_read_first (GstAudioSrc * asrc, gpointer data, guint length,
+    GstClockTime * timestamp)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  guint bpf = GST_AUDIO_INFO_BPF (&ringbuffer->spec.info);
+  guint chunk = MAX (gst_util_uint64_scale_int (self->device_period_us,
+          GST_AUDIO_INFO_RATE (&ringbuffer->spec.info), G_USEC_PER_SEC), 1) *
+      bpf;
+  gint segdone = g_atomic_int_get (&ringbuffer->segdone) -
+      ringbuffer->segbase;
+  gint *silent = self->silent_segments != NULL ?
+      &self->silent_segments[segdone % self->n_silent_segments] : NULL;
+  gboolean all_silent = TRUE;
+  GstClockTime ts;
+  guint done = 0;
+
+  g_atomic_int_set (&self->first_fill, 0);
+  g_atomic_int_set (&self->first_seg, segdone);
+
+  while (done < length) {
+    guint n = gst_wasapi_src_read_segment (asrc, (guint8 *) data + done,
+        MIN (chunk, length - done), &ts);
+
+    if (n == 0)
+      break;
+    /* The segment starts with the first chunk */
+    if (done == 0)
+      *timestamp = ts;
+    if (silent != NULL)
+      all_silent &= g_atomic_int_get (silent);
+    done += n;
+    g_atomic_int_set (&self->first_fill, done);
+    SetEvent (self->first_event);
+  }
+
+  /* Each chunk marked the segment, it's silent only if all of them were */
+  if (silent != NULL)
+    g_atomic_int_set (silent, all_silent);
+  g_atomic_int_set (&self->first_seg, -1);
+
+  return done;
+}
+
+/* From create() with the first sample it reads. The frames read() has put
+ * into its segment so far, after waiting for some, or 0 to read the
+ * segment as usual, e.g. when it is complete already. */
+static guint
+gst_wasapi_src_wait_first_fill (GstWasapiSrc * self, guint64 sample)
+{
+  GstAudioBaseSrc *src = GST_AUDIO_BASE_SRC (self);
+  GstAudioRingBuffer *ringbuffer = src->ringbuffer;
+  guint bpf = GST_AUDIO_INFO_BPF (&ringbuffer->spec.info);
+  gint seg = (gint) (sample / ringbuffer->samples_per_seg);
+  DWORD wait_ms = (DWORD) (self->device_period_us / 1000) + 1;
+  gboolean flushing;
+  gint fill;
+
+  if (!gst_wasapi_src_wants_first_fill (self) || ringbuffer->need_reorder ||
+      sample % ringbuffer->samples_per_seg != 0)
+    return 0;
+
+  if (g_atomic_int_get (&ringbuffer->state) !=
+      GST_AUDIO_RING_BUFFER_STATE_STARTED) {
+    if (!g_atomic_int_get (&ringbuffer->may_start))
+      return 0;
+    gst_audio_ring_buffer_start (ringbuffer);
+  }
+
+  for (;;) {
+    if (g_atomic_int_get (&ringbuffer->segdone) - ringbuffer->segbase > seg)
+      return 0;
+
+    fill = g_atomic_int_get (&self->first_fill);
+    if (g_atomic_int_get (&self->first_seg) == seg && fill > 0)
+      return fill / bpf;
+
+    GST_OBJECT_LOCK (ringbuffer);
+    flushing = ringbuffer->flushing || g_atomic_int_get (&ringbuffer->state)
+        != GST_AUDIO_RING_BUFFER_STATE_STARTED;
+    GST_OBJECT_UNLOCK (ringbuffer);
+    if (flushing)
+      return 0;
+
+    WaitForSingleObject (self->first_event, wait_ms);
+  }
+}
+
+static guint
+gst_wasapi_src_read (GstAudioSrc * asrc, gpointer data, guint length,
+    GstClockTime * timestamp)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
+  GstWasapiStats *stats;
+  guint ret, n_frames;
+  guint64 cycles = gst_wasapi_util_get_thread_cycles ();
+  gint rate;
+
+  /* Increase the priority of the ringbuffer thread to reduce glitches, with
+   * shared-engine only the capture thread is realtime */
+  if (self->thread_task != NULL && !self->use_engine)
+    gst_wasapi_util_ensure_thread_characteristics (self->thread_task,
+        self->thread_priority);
+  /* And keep it on the same cores */
+  if (!self->use_engine) {
+    gst_wasapi_util_ensure_thread_affinity (self->thread_group,
+        self->thread_mask);
+    gst_wasapi_util_ensure_thread_flags (self->thread_flags);
+  }
+
+  /* Capturing again after keep-running kept the device busy */
+  gst_wasapi_src_stop_drain (self);
+
+  if (G_UNLIKELY (gst_wasapi_src_wants_first_fill (self)))
+    ret = gst_wasapi_src_read_first (asrc, data, length, timestamp);
+  else
+    ret = gst_wasapi_src_read_segment (asrc, data, length, timestamp);
+
+  n_frames = ret / GST_AUDIO_INFO_BPF (&GST_AUDIO_BASE_SRC (self)->
+      ringbuffer->spec.info);
+  rate = GST_AUDIO_INFO_RATE (&GST_AUDIO_BASE_SRC (self)->ringbuffer->
+      spec.info);
+
+  /* Measured in the same pass that brings the samples into the cache */
+  if (self->level != NULL &&
+      gst_wasapi_level_process (self->level, data, n_frames, *timestamp))
+    gst_wasapi_src_notify (self, SRC_NOTIFY_LEVEL, 0, 0, 0);
+
+  if (self->spectrum != NULL &&
+      gst_wasapi_spectrum_process (self->spectrum, data, n_frames,
+          *timestamp))
+    gst_wasapi_src_notify (self, SRC_NOTIFY_SPECTRUM, 0, 0, 0);
+
+  /* Each read() fills one segment, create() pushes segments marked silent
+   * as GAP */
+  if (self->vad_detector != NULL &&
+      !gst_wasapi_vad_process (self->vad_detector, data, n_frames))
+    gst_wasapi_src_mark_segment (self, TRUE);
+
+  gst_wasapi_src_update_fill (self);
+
+  stats = gst_wasapi_stats_block_begin (self->device_stats);
+  stats->device_cycles += gst_wasapi_util_get_thread_cycles () - cycles;
+  stats->device_audio += gst_util_uint64_scale_int (n_frames, GST_SECOND,
+      rate);
+  gst_wasapi_stats_block_end (self->device_stats);
+
+  return ret;
+}
+
+/* From read(), with the segment it just filled. The ringbuffer thread keeps
+ * capturing when downstream stalls, so this stays current then, while
+ * create() doesn't run. */
+static void
+gst_wasapi_src_update_fill (GstWasapiSrc * self)
+{
+  GstAudioBaseSrc *src = GST_AUDIO_BASE_SRC (self);
+  GstAudioRingBuffer *ringbuffer = src->ringbuffer;
+  guint sps = ringbuffer->samples_per_seg;
+  guint64 captured, total = (guint64) ringbuffer->spec.segtotal * sps;
+  /* Written by the streaming thread, a buffer behind at worst */
+  guint64 read = src->next_sample;
+  guint fill = 0;
+  guint high, low;
+
+  captured = (guint64) (g_atomic_int_get (&ringbuffer->segdone) -
+      ringbuffer->segbase + 1) * sps;
+  if (read != (guint64) - 1 && total > 0 && captured > read)
+    fill = (guint) MIN ((captured - read) * 100 / total, 100);
+
+  g_atomic_int_set (&self->ring_fill, fill);
+  g_atomic_int_set (&self->overflow_fill, self->mix_format != NULL ?
+      self->overflow_buffer_length / self->mix_format->nBlockAlign : 0);
+
+  high = g_atomic_int_get (&self->high_watermark);
+  low = g_atomic_int_get (&self->low_watermark);
+  if (high == 0 || (self->above_high ? fill > low : fill < high))
+    return;
+
+  self->above_high = !self->above_high;
+  GST_INFO_OBJECT (self, "ringbuffer %u%% full, %s the %s watermark", fill,
+      self->above_high ? "above" : "below", self->above_high ? "high" : "low");
+  gst_wasapi_src_notify (self, SRC_NOTIFY_WATERMARK, self->above_high, fill,
+      (guint) g_atomic_int_get (&self->overflow_fill));
+}
+
 static guint
 gst_wasapi_src_delay (GstAudioSrc * asrc)
 {
   GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
-  guint delay = 0;
+  guint delay = 0, padding = 0;
   HRESULT hr;
 
-  hr = IAudioClient_GetCurrentPadding (self->client, &delay);
+  IAudioClient *client;
+
+  /* read() swaps the client when it follows the default device */
+  GST_OBJECT_LOCK (self);
+  if ((client = self->client))
+    IUnknown_AddRef (client);
+  /* Also not read yet */
+  if (self->capture_stream != NULL)
+    delay = gst_wasapi_capture_stream_get_queued (self->capture_stream);
+  GST_OBJECT_UNLOCK (self);
+
+  if (client == NULL)
+    return 0;
+
+  hr = IAudioClient_GetCurrentPadding (client, &padding);
+  IUnknown_Release (client);
   HR_FAILED_RET (hr, IAudioClock::GetCurrentPadding, 0);
 
-  return delay;
+  return delay + padding;
 }
 
 static void
 gst_wasapi_src_reset (GstAudioSrc * asrc)
 {
   GstWasapiSrc *self = GST_WASAPI_SRC (asrc);
-  HRESULT hr;
+  gboolean keep;
 
-  SetEvent (self->stop_handle);
+  gst_wasapi_cancel_trigger (&self->stop);
 
   if (!self->client)
     return;
 
-  GST_OBJECT_LOCK (self);
-  hr = IAudioClient_Stop (self->client);
-  HR_FAILED_RET (hr, IAudioClock::Stop,);
+  /* With keep-running the drain thread takes what is captured meanwhile.
+   * The device position continues, so the drift estimate stays valid. */
+  keep = self->keep_running &&
+      !g_atomic_int_get (&self->client_needs_restart);
+  if (keep)
+    gst_wasapi_src_start_drain (self);
 
-  hr = IAudioClient_Reset (self->client);
-  HR_FAILED_RET (hr, IAudioClock::Reset,);
+  gst_wasapi_src_reset_client (self, !keep);
+}
 
-  self->client_needs_restart = TRUE;
-  GST_OBJECT_UNLOCK (self);
+/* Forgets where we were in the stream. With @stop the client is stopped
+ * and reset as well, and started again by the next read(). */
+static void
+gst_wasapi_src_reset_client (GstWasapiSrc * self, gboolean stop)
+{
+  HRESULT hr;
+
+  if (stop && self->client_shared) {
+    gst_wasapi_capture_stream_stop (self->capture_stream);
+  } else if (stop) {
+    hr = IAudioClient_Stop (self->client);
+    HR_FAILED_RET (hr, IAudioClock::Stop,);
+
+    hr = IAudioClient_Reset (self->client);
+    HR_FAILED_RET (hr, IAudioClock::Reset,);
+  }
+
+  if (self->capture_stream != NULL)
+    gst_wasapi_capture_stream_reset (self->capture_stream);
+  gst_wasapi_spin_reset (&self->spin);
+
+  self->next_devpos = -1;
+  self->watchdog_deadline = 0;
+  self->packets_pending = FALSE;
+
+  g_atomic_int_set (&self->resampler_needs_reset, TRUE);
+  self->drift_reference_time = GST_CLOCK_TIME_NONE;
+  self->skew_offset = 0;
+  self->clock_cal_qpc = 0;
+
+  if (!stop)
+    return;
+
+  if (self->shared_clock != NULL && self->client_clock != NULL)
+    gst_wasapi_device_clock_client_reset (self->shared_clock,
+        self->client_clock);
+
+  g_atomic_int_set (&self->drift_needs_reset, TRUE);
+  g_atomic_int_set (&self->client_needs_restart, TRUE);
 }
 
-#ifdef DEFAULT_PROVIDE_CLOCK
+/* Like the GstAudioBaseSrc clock, from the samples read so far plus what is
+ * still queued in the device. Replaced by the shared clock of the endpoint
+ * while the device is open, with the device-clock property. */
 static GstClockTime
 gst_wasapi_src_get_time (GstClock * clock, gpointer user_data)
 {
   GstWasapiSrc *self = GST_WASAPI_SRC (user_data);
-  HRESULT hr;
-  guint64 devpos;
-  GstClockTime result;
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  guint64 samples;
+  gint rate;
 
-  if (G_UNLIKELY (self->client_clock == NULL))
+  if (ringbuffer == NULL || (rate = ringbuffer->spec.info.rate) == 0)
     return GST_CLOCK_TIME_NONE;
 
-  hr = IAudioClock_GetPosition (self->client_clock, &devpos, NULL);
-  HR_FAILED_RET (hr, IAudioClock::GetPosition, GST_CLOCK_TIME_NONE);
+  samples = gst_audio_ring_buffer_samples_done (ringbuffer);
+  samples += gst_audio_ring_buffer_delay (ringbuffer);
 
-  result = gst_util_uint64_scale_int (devpos, GST_SECOND,
-      self->client_clock_freq);
+  return gst_util_uint64_scale_int (samples, GST_SECOND, rate);
+}
 
-  /*
-     GST_DEBUG_OBJECT (self, "devpos = %" G_GUINT64_FORMAT
-     " frequency = %" G_GUINT64_FORMAT
-     " result = %" G_GUINT64_FORMAT " ms",
-     devpos, self->client_clock_freq, GST_TIME_AS_MSECONDS (result));
-   */
+guint64
+gst_wasapi_src_get_read_offset (guint64 next_sample, gint segdone,
+    gint segtotal, gint sps, gint preroll_segments)
+{
+  gint readseg;
+
+  if (next_sample != -1) {
+    /* See how far away the segment to read from is from the one being
+     * written. Normally, segdone is bigger than readseg. */
+    readseg = next_sample / sps;
+    if (segdone - readseg >= segtotal) {
+      /* sample would be dropped, position to next playable position */
+      return ((guint64) segdone) * sps;
+    }
+    /* assume we can append to the previous sample */
+    return next_sample;
+  }
 
-  return result;
+  /* no previous sample, go to the current position, or as far back as
+   * preroll-time asks for */
+  readseg = MAX (segdone - MIN (preroll_segments, segtotal - 1), 0);
+  return ((guint64) readseg) * sps;
 }
-#endif
 
 static guint64
 gst_audio_base_src_get_offset (GstAudioBaseSrc * src)
 {
   guint64 sample;
-  gint readseg, segdone, segtotal, sps;
-  gint diff;
-
-  /* assume we can append to the previous sample */
-  sample = src->next_sample;
-
-  sps = src->ringbuffer->samples_per_seg;
-  segtotal = src->ringbuffer->spec.segtotal;
+  gint segdone;
 
   /* get the currently processed segment */
   segdone = g_atomic_int_get (&src->ringbuffer->segdone)
       - src->ringbuffer->segbase;
 
-  if (sample != -1) {
-    GST_DEBUG_OBJECT (src, "at segment %d and sample %" G_GUINT64_FORMAT,
-        segdone, sample);
-    /* figure out the segment and the offset inside the segment where
-     * the sample should be read from. */
-    readseg = sample / sps;
-
-    /* See how far away it is from the read segment. Normally, segdone (where
-     * new data is written in the ringbuffer) is bigger than readseg
-     * (where we are reading). */
-    diff = segdone - readseg;
-    if (diff >= segtotal) {
-      GST_DEBUG_OBJECT (src, "dropped, align to segment %d", segdone);
-      /* sample would be dropped, position to next playable position */
-      sample = ((guint64) (segdone)) * sps;
+  sample = gst_wasapi_src_get_read_offset (src->next_sample, segdone,
+      src->ringbuffer->spec.segtotal, src->ringbuffer->samples_per_seg,
+      GST_WASAPI_SRC (src)->preroll_segments);
+
+  GST_DEBUG_OBJECT (src, "at segment %d, last sample %" G_GUINT64_FORMAT
+      ", reading from %" G_GUINT64_FORMAT, segdone, src->next_sample, sample);
+  if (src->next_sample != -1 && sample != src->next_sample)
+    GST_DEBUG_OBJECT (src, "dropped, align to segment %d", segdone);
+
+  return sample;
+}
+
+typedef struct
+{
+  GstWasapiSrc *self;
+  IAudioCaptureClient *capture_client;
+  guint32 n_frames;
+} GstWasapiSrcPacket;
+
+static void
+gst_wasapi_src_packet_free (gpointer user_data)
+{
+  GstWasapiSrcPacket *packet = user_data;
+  GstWasapiSrc *self = packet->self;
+  HRESULT hr;
+
+  hr = IAudioCaptureClient_ReleaseBuffer (packet->capture_client,
+      packet->n_frames);
+  gst_wasapi_trace_release_buffer (GST_ELEMENT (self), packet->n_frames);
+  if (FAILED (hr))
+    GST_WARNING_OBJECT (self, "IAudioCaptureClient::ReleaseBuffer failed "
+        "(%x): %s", (guint) hr, gst_wasapi_util_hresult_to_static_string (hr));
+  IUnknown_Release (packet->capture_client);
+
+  g_mutex_lock (&self->packet_lock);
+  self->packet_outstanding = FALSE;
+  g_cond_broadcast (&self->packet_cond);
+  g_mutex_unlock (&self->packet_lock);
+
+  gst_object_unref (self);
+  g_slice_free (GstWasapiSrcPacket, packet);
+}
+
+static gboolean
+gst_wasapi_src_unlock (GstBaseSrc * bsrc)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+
+  g_mutex_lock (&self->packet_lock);
+  self->flushing = TRUE;
+  SetEvent (self->cancel_handle);
+  g_cond_broadcast (&self->packet_cond);
+  g_mutex_unlock (&self->packet_lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_src_unlock_stop (GstBaseSrc * bsrc)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+
+  g_mutex_lock (&self->packet_lock);
+  self->flushing = FALSE;
+  ResetEvent (self->cancel_handle);
+  g_mutex_unlock (&self->packet_lock);
+
+  return TRUE;
+}
+
+/* Direct capture: produces one buffer per WASAPI packet right on the
+ * streaming thread, without going through the ringbuffer.
+ *
+ * In zero-copy mode the packet is handed out as is. It stays owned by the
+ * device until the last reference to the returned buffer is dropped, so we
+ * have to wait for the previous one to come back before we can ask for a
+ * new one. Otherwise the packet is copied and released right away. */
+/* Copies @n_frames interleaved frames of @in into the planes of @out. Each
+ * plane is @missing + @n_frames samples of @bps bytes and starts with
+ * @missing samples of silence. Channel i goes to plane @reorder_map[i], if
+ * there is a map. */
+static void
+gst_wasapi_src_deinterleave (guint8 * out, const guint8 * in, guint64 missing,
+    guint n_frames, gint channels, gint bps, const gint * reorder_map)
+{
+  gsize gap_size = (gsize) missing * bps;
+  gsize plane_size = gap_size + (gsize) n_frames * bps;
+
+#define DEINTERLEAVE(type) \
+  G_STMT_START { \
+    const type *src = (const type *) in + cc; \
+    type *dst = (type *) plane; \
+    \
+    for (guint ii = 0; ii < n_frames; ii++) \
+      dst[ii] = src[ii * channels]; \
+  } G_STMT_END
+
+  for (gint cc = 0; cc < channels; cc++) {
+    guint8 *plane = out + (reorder_map ? reorder_map[cc] : cc) * plane_size;
+
+    memset (plane, 0, gap_size);
+    plane += gap_size;
+
+    switch (bps) {
+      case 2:
+        DEINTERLEAVE (guint16);
+        break;
+      case 4:
+        DEINTERLEAVE (guint32);
+        break;
+      case 8:
+        DEINTERLEAVE (guint64);
+        break;
+      default:
+        for (guint ii = 0; ii < n_frames; ii++)
+          memcpy (plane + ii * bps, in + (ii * channels + cc) * bps, bps);
+        break;
+    }
+  }
+
+#undef DEINTERLEAVE
+}
+
+/* Has wasapi-health posted every health-interval, from create(). The
+ * structure and the process usage it needs are left to the bus queue. */
+static void
+gst_wasapi_src_check_health (GstWasapiSrc * self)
+{
+  GstClockTime interval;
+  gint64 now;
+
+  GST_OBJECT_LOCK (self);
+  interval = self->health_interval;
+  GST_OBJECT_UNLOCK (self);
+
+  if (G_LIKELY (interval == 0))
+    return;
+
+  now = g_get_monotonic_time ();
+  if (self->health_next == 0)
+    self->health_next = now + interval / GST_USECOND;
+  if (now < self->health_next)
+    return;
+  /* Late calls don't shift the next ones */
+  while (self->health_next <= now)
+    self->health_next += MAX (interval / GST_USECOND, 1);
+
+  gst_wasapi_src_notify (self, SRC_NOTIFY_HEALTH, (guint64) now, 0, 0);
+}
+
+/* wasapi-health as of @now */
+static GstStructure *
+gst_wasapi_src_health_structure (GstWasapiSrc * self, gint64 now)
+{
+  GstWasapiStats stats;
+  guint64 stream[GST_WASAPI_N_COUNTERS], capture[GST_WASAPI_N_COUNTERS];
+  guint64 resident = 0, private_bytes = 0;
+  guint handles = 0;
+
+  gst_wasapi_src_get_stats (self, &stats);
+  gst_wasapi_counters_snapshot (self->stream_counters, stream);
+  gst_wasapi_counters_snapshot (self->capture_counters, capture);
+  gst_wasapi_util_get_process_usage (&resident, &private_bytes, &handles);
+
+  return gst_structure_new ("wasapi-health",
+      "uptime", G_TYPE_UINT64,
+      (guint64) (now - self->health_start) * GST_USECOND,
+      "timeshifted", G_TYPE_UINT64, stream[STREAM_COUNTER_TIMESHIFTED],
+      "drift-corrections", G_TYPE_UINT64,
+      stream[STREAM_COUNTER_DRIFT_CORRECTIONS],
+      "drift-ppm", G_TYPE_DOUBLE, gst_wasapi_src_get_drift_ppm (self),
+      "gaps", G_TYPE_UINT64, capture[CAPTURE_COUNTER_GAPS],
+      "gap-frames", G_TYPE_UINT64, capture[CAPTURE_COUNTER_GAP_FRAMES],
+      "glitches", G_TYPE_UINT64, stats.glitches,
+      "overflow-dropped", G_TYPE_UINT64, stats.overflow_dropped,
+      "underruns", G_TYPE_UINT64, stats.underruns,
+      "resident-bytes", G_TYPE_UINT64, resident,
+      "private-bytes", G_TYPE_UINT64, private_bytes,
+      "handles", G_TYPE_UINT, handles, NULL);
+}
+
+/* @qpcpos is in 100 ns, the meta in ns like all GStreamer times */
+static void
+gst_wasapi_src_add_qpc_meta (GstBuffer * buf, guint64 qpcpos)
+{
+#if GST_CHECK_VERSION (1, 14, 0)
+  static GstStaticCaps qpc_caps = GST_STATIC_CAPS ("timestamp/x-qpc");
+  GstCaps *caps = gst_static_caps_get (&qpc_caps);
+
+  gst_buffer_add_reference_timestamp_meta (buf, caps, qpcpos * 100,
+      GST_CLOCK_TIME_NONE);
+  gst_caps_unref (caps);
+#else
+  /* The meta is 1.14 API, without it the property doesn't exist and
+   * add_qpc_meta is never set */
+  g_assert_not_reached ();
+#endif
+}
+
+static GstFlowReturn
+gst_wasapi_src_create_direct (GstWasapiSrc * self, GstBuffer ** outbuf)
+{
+  GstAudioBaseSrc *src = GST_AUDIO_BASE_SRC (self);
+  GstAudioRingBufferSpec *spec = &src->ringbuffer->spec;
+  GstBuffer *buf;
+  GstClock *clock;
+  GstClockTime timestamp = GST_CLOCK_TIME_NONE, duration;
+  GstWasapiSrcPacket *packet;
+  GstFlowReturn ret;
+  HANDLE event_handles[2];
+  gint64 wakeup = 0;
+  BYTE *data = NULL;
+  guint32 n_frames = 0;
+  guint64 missing;
+  DWORD flags = 0;
+  UINT64 devpos, qpcpos;
+  gsize size;
+  gint bpf, rate;
+  HRESULT hr;
+
+  bpf = GST_AUDIO_INFO_BPF (&spec->info);
+  rate = GST_AUDIO_INFO_RATE (&spec->info);
+
+  g_mutex_lock (&self->packet_lock);
+  while (self->packet_outstanding && !self->flushing)
+    g_cond_wait (&self->packet_cond, &self->packet_lock);
+  if (self->flushing) {
+    g_mutex_unlock (&self->packet_lock);
+    return GST_FLOW_FLUSHING;
+  }
+  g_mutex_unlock (&self->packet_lock);
+
+  if (!gst_wasapi_util_start_if_needed (GST_ELEMENT (self), self->client,
+          &self->client_needs_restart))
+    return GST_FLOW_ERROR;
+
+  event_handles[0] = self->event_handle;
+  event_handles[1] = self->cancel_handle;
+
+  while (TRUE) {
+    DWORD dwWaitResult;
+
+    hr = IAudioCaptureClient_GetBuffer (self->capture_client, &data,
+        &n_frames, &flags, &devpos, &qpcpos);
+    if (hr == S_OK && n_frames > 0) {
+      gst_wasapi_trace_get_buffer (GST_ELEMENT (self), n_frames, flags, devpos,
+          qpcpos);
+      if (self->shm != NULL)
+        gst_wasapi_shm_write (self->shm, data, n_frames, qpcpos, flags);
+      if (self->record != NULL)
+        gst_wasapi_record_write (self->record, data, n_frames, qpcpos, devpos,
+            flags);
+      gst_wasapi_src_emit_packet (self, data, n_frames, flags, qpcpos);
+      gst_wasapi_src_update_stats (self, wakeup, 1, n_frames,
+          (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) ? 1 : 0);
+      break;
+    }
+
+    if (hr == S_OK)
+      IAudioCaptureClient_ReleaseBuffer (self->capture_client, 0);
+
+    if (GST_WASAPI_CLIENT_LOST (hr)) {
+      GST_ELEMENT_ERROR (self, RESOURCE, READ, (NULL),
+          ("The audio device has been disconnected"));
+      return GST_FLOW_ERROR;
+    }
+    if (hr != S_OK && hr != AUDCLNT_S_BUFFER_EMPTY) {
+      GST_ERROR_OBJECT (self, "IAudioCaptureClient::GetBuffer failed (%x): %s",
+          (guint) hr, gst_wasapi_util_hresult_to_static_string (hr));
+      return GST_FLOW_ERROR;
+    }
+
+    dwWaitResult = WaitForMultipleObjects (2, event_handles, FALSE,
+        gst_wasapi_src_watchdog_timeout (self));
+    gst_wasapi_trace_wakeup (GST_ELEMENT (self), dwWaitResult);
+    if (dwWaitResult == WAIT_OBJECT_0 + 1)
+      return GST_FLOW_FLUSHING;
+    if (dwWaitResult == WAIT_TIMEOUT) {
+      /* Idle loopback device, make up one device period of silence */
+      gst_wasapi_src_watchdog_fired (self);
+      missing = 0;
+      n_frames = gst_util_uint64_scale_int (self->device_period_us, rate,
+          G_USEC_PER_SEC);
+      buf = gst_wasapi_src_new_silence_buffer (self, (gsize) n_frames * bpf);
+      flags = AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR;
+      goto push_buffer;
+    }
+    self->watchdog_deadline = 0;
+    self->watchdog_active = FALSE;
+    wakeup = g_get_monotonic_time ();
+    if (dwWaitResult != WAIT_OBJECT_0) {
+      GST_ERROR_OBJECT (self, "Error waiting for event handle: %x",
+          (guint) dwWaitResult);
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  missing = gst_wasapi_src_check_gap (self, devpos, n_frames);
+  size = (gsize) n_frames *bpf;
+  flags = gst_wasapi_src_detect_silence (self, data, n_frames, flags);
+
+  if (self->zero_copy && !(flags & AUDCLNT_BUFFERFLAGS_SILENT)) {
+    packet = g_slice_new (GstWasapiSrcPacket);
+    packet->self = gst_object_ref (self);
+    packet->capture_client = self->capture_client;
+    IUnknown_AddRef (packet->capture_client);
+    packet->n_frames = n_frames;
+
+    g_mutex_lock (&self->packet_lock);
+    self->packet_outstanding = TRUE;
+    g_mutex_unlock (&self->packet_lock);
+
+    buf = gst_buffer_new ();
+    gst_buffer_append_memory (buf,
+        gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, data, size, 0, size,
+            packet, gst_wasapi_src_packet_free));
+
+    /* We can't insert silence in front of device memory, so skip the
+     * offsets instead; the timestamps come from the device anyway */
+    if (missing > 0) {
+      self->direct_next_sample += missing;
+      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+      missing = 0;
     }
+  } else if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+    /* Silent packets have undefined contents, push shared zeroes instead */
+    buf = gst_wasapi_src_new_silence_buffer (self,
+        (gsize) (missing + n_frames) * bpf);
+
+    hr = IAudioCaptureClient_ReleaseBuffer (self->capture_client, n_frames);
+    HR_FAILED_AND (hr, IAudioCaptureClient::ReleaseBuffer,);
+    gst_wasapi_trace_release_buffer (GST_ELEMENT (self), n_frames);
   } else {
-    /* no previous sample, go to the current position */
-    GST_DEBUG_OBJECT (src, "first sample, align to current %d", segdone);
-    sample = ((guint64) (segdone)) * sps;
-    readseg = segdone;
+    GstMapInfo info;
+    gsize gap_size = (gsize) missing *bpf;
+
+    ret = gst_wasapi_src_alloc (self, -1, gap_size + size, &buf);
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      IAudioCaptureClient_ReleaseBuffer (self->capture_client, n_frames);
+      GST_DEBUG_OBJECT (self, "alloc failed: %s", gst_flow_get_name (ret));
+      return ret;
+    }
+
+    gst_buffer_map (buf, &info, GST_MAP_WRITE);
+    if (GST_AUDIO_INFO_LAYOUT (&spec->info) ==
+        GST_AUDIO_LAYOUT_NON_INTERLEAVED) {
+      gst_wasapi_src_deinterleave (info.data, data, missing, n_frames,
+          GST_AUDIO_INFO_CHANNELS (&spec->info),
+          GST_AUDIO_INFO_BPS (&spec->info),
+          self->reorder ? self->reorder_map : NULL);
+    } else {
+      memset (info.data, 0, gap_size);
+      if (self->reorder)
+        gst_wasapi_src_reorder (self, info.data + gap_size, data, n_frames);
+      else
+        memcpy (info.data + gap_size, data, size);
+    }
+    gst_buffer_unmap (buf, &info);
+
+    hr = IAudioCaptureClient_ReleaseBuffer (self->capture_client, n_frames);
+    HR_FAILED_AND (hr, IAudioCaptureClient::ReleaseBuffer,);
+    gst_wasapi_trace_release_buffer (GST_ELEMENT (self), n_frames);
+  }
+
+  if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+    GST_WARNING_OBJECT (self, "WASAPI reported glitch in buffer");
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
   }
 
-  GST_DEBUG_OBJECT (src,
-      "reading from %d, we are at %d, sample %" G_GUINT64_FORMAT, readseg,
-      segdone, sample);
+push_buffer:
+  duration = gst_util_uint64_scale_int (missing + n_frames, GST_SECOND, rate);
 
-  return sample;
+  if ((clock = gst_wasapi_src_clock_copy (self, &self->streaming_clock))) {
+    GstClockTime base_time = self->streaming_clock.base_time;
+    GstClockTime capture_time;
+
+    if (flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) {
+      /* Assume the packet was captured one packet duration ago */
+      capture_time = gst_clock_get_time (clock);
+      capture_time = capture_time > duration ? capture_time - duration : 0;
+    } else {
+      /* Any silence we inserted goes before the packet */
+      capture_time = gst_wasapi_util_qpc_to_clock_time (clock, qpcpos);
+      gst_wasapi_src_push_drift_point (self, devpos, capture_time);
+      capture_time -= MIN (capture_time,
+          gst_util_uint64_scale_int (missing, GST_SECOND, rate));
+    }
+
+    timestamp = capture_time > base_time ? capture_time - base_time : 0;
+  }
+
+  if (self->add_qpc_meta &&
+      !(flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR))
+    gst_wasapi_src_add_qpc_meta (buf, qpcpos -
+        MIN (qpcpos, gst_util_uint64_scale_int (missing, 10000000, rate)));
+
+  GST_BUFFER_TIMESTAMP (buf) = timestamp;
+  GST_BUFFER_DURATION (buf) = duration;
+  GST_BUFFER_OFFSET (buf) = self->direct_next_sample;
+  self->direct_next_sample += missing + n_frames;
+  GST_BUFFER_OFFSET_END (buf) = self->direct_next_sample;
+
+  *outbuf = buf;
+
+  GST_LOG_OBJECT (self, "Pushed packet of %u frames directly, timestamp %"
+      GST_TIME_FORMAT, n_frames, GST_TIME_ARGS (timestamp));
+
+  return GST_FLOW_OK;
+}
+
+/* The time of @clock now, for the skew algorithm in create(). Reading the
+ * pipeline clock takes its lock and, when it's slaved itself, does a few
+ * scales of its own, so we only do that every CLOCK_CALIBRATION_INTERVAL
+ * and extrapolate from the last reading with the QPC in between. The
+ * slope is that of the clock against the QPC over the last interval, so
+ * a drifting pipeline clock is followed within one interval. @force reads
+ * the clock, for the first sample. Called with the object lock. */
+static GstClockTime
+gst_wasapi_src_clock_time (GstWasapiSrc * self, GstClock * clock,
+    gboolean force)
+{
+  guint64 qpc = gst_wasapi_util_get_qpc_position ();
+  GstClockTime now;
+  gdouble slope;
+
+  if (!force && self->clock_cal_qpc != 0 && clock == self->clock_cal_clock &&
+      qpc >= self->clock_cal_qpc &&
+      qpc - self->clock_cal_qpc < CLOCK_CALIBRATION_INTERVAL / 100)
+    return self->clock_cal_time +
+        (GstClockTime) ((qpc - self->clock_cal_qpc) * self->clock_cal_slope);
+
+  now = gst_clock_get_time (clock);
+  qpc = gst_wasapi_util_get_qpc_position ();
+
+  /* QPC positions are in 100 ns. A slope way off means the clock jumped,
+   * take the next interval as it comes. */
+  slope = 100.0;
+  if (self->clock_cal_qpc != 0 && clock == self->clock_cal_clock &&
+      qpc > self->clock_cal_qpc && now > self->clock_cal_time) {
+    slope = (gdouble) (now - self->clock_cal_time) /
+        (qpc - self->clock_cal_qpc);
+    if (slope < 99.0 || slope > 101.0)
+      slope = 100.0;
+  }
+
+  self->clock_cal_clock = clock;
+  self->clock_cal_qpc = qpc;
+  self->clock_cal_time = now;
+  self->clock_cal_slope = slope;
+
+  return now;
+}
+
+/* With timestamp-mode qpc or system, the running time of the buffer at
+ * @sample from what we observed for it, through the DLL. Falls back to the
+ * prediction when nothing was observed, and to @timestamp before the first
+ * observation. Called with the object lock. */
+static GstClockTime
+gst_wasapi_src_smooth_timestamp (GstWasapiSrc * self, GstClock * clock,
+    guint64 sample, GstClockTime duration, guint64 capture_qpc,
+    GstClockTime timestamp)
+{
+  GstClockTime base_time = GST_ELEMENT_CAST (self)->base_time;
+  GstClockTime observed = GST_CLOCK_TIME_NONE, smoothed;
+
+  if (self->smooth_mode == GST_WASAPI_TIMESTAMP_MODE_QPC) {
+    if (capture_qpc != 0)
+      observed = gst_wasapi_util_qpc_to_clock_time (clock, capture_qpc);
+  } else {
+    /* The last frame was captured by now */
+    observed = gst_clock_get_time (clock);
+    observed = observed > duration ? observed - duration : 0;
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (observed))
+    smoothed = gst_wasapi_dll_update (self->dll, sample, observed);
+  else
+    smoothed = gst_wasapi_dll_predict (self->dll, sample);
+  if (!GST_CLOCK_TIME_IS_VALID (smoothed))
+    return timestamp;
+
+  /* Like the device timestamps */
+  if (self->preroll_segments > 0)
+    smoothed += self->preroll_time;
+
+  return smoothed > base_time ? smoothed - base_time : 0;
+}
+
+/* With catchup-policy=compress, drops up to a quarter of @buf while more
+ * than half the ringbuffer is still to be read after @next_sample, so a
+ * slow downstream catches up before the oldest segment is overwritten */
+static gboolean
+gst_wasapi_src_compress (GstWasapiSrc * self, GstBuffer ** buf,
+    guint64 next_sample)
+{
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (self)->ringbuffer;
+  GstAudioInfo *info = &ringbuffer->spec.info;
+  gint sps = ringbuffer->samples_per_seg;
+  guint64 written, half;
+  guint frames, drop;
+  gint spliced;
+
+  written = (guint64) (g_atomic_int_get (&ringbuffer->segdone) -
+      ringbuffer->segbase) * sps;
+  half = (guint64) ringbuffer->spec.segtotal * sps / 2;
+  if (written <= next_sample + half)
+    return FALSE;
+
+  frames = gst_buffer_get_size (*buf) / GST_AUDIO_INFO_BPF (info);
+  drop = (guint) MIN (written - next_sample - half, frames / 4);
+  if (drop == 0)
+    return FALSE;
+
+  spliced = gst_wasapi_splice_frames_quiet (*buf, info, -(gint) drop,
+      self->splice_energy, self->splice_energy_frames, buf);
+  if (spliced == 0)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (self, "%" G_GUINT64_FORMAT " frames behind, dropped %d",
+      written - next_sample, -spliced);
+  gst_wasapi_trace_correction (GST_ELEMENT (self), "compress",
+      (gint64) gst_util_uint64_scale_int (-spliced, GST_SECOND,
+          GST_AUDIO_INFO_RATE (info)));
+
+  gst_wasapi_stats_block_begin (self->streaming_stats)->overflow_dropped +=
+      (guint64) -spliced * GST_AUDIO_INFO_BPF (info);
+  gst_wasapi_stats_block_end (self->streaming_stats);
+
+  return TRUE;
 }
 
 static GstFlowReturn
@@ -1038,6 +7131,14 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
   GstClock *clock;
   gboolean first;
   gboolean first_sample = src->next_sample == -1;
+  guint64 first_sample_pos;
+  gboolean glitches;
+  guint64 qpc_start, ticks;
+  guint64 capture_qpc = 0;
+  guint64 cycles = gst_wasapi_util_get_thread_cycles ();
+  GstWasapiStats *stats;
+  GstWasapiCatchupPolicy catchup = self->catchup_policy;
+  guint first_fill = 0;
 
   ringbuffer = src->ringbuffer;
   spec = &ringbuffer->spec;
@@ -1045,15 +7146,47 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
   if (G_UNLIKELY (!gst_audio_ring_buffer_is_acquired (ringbuffer)))
     goto wrong_state;
 
+  gst_wasapi_src_check_health (self);
+
+  if (self->direct || self->zero_copy) {
+    gst_wasapi_src_stop_drain (self);
+    ret = gst_wasapi_src_create_direct (self, outbuf);
+
+    stats = gst_wasapi_stats_block_begin (self->streaming_stats);
+    stats->streaming_cycles += gst_wasapi_util_get_thread_cycles () - cycles;
+    if (ret == GST_FLOW_OK && GST_BUFFER_DURATION_IS_VALID (*outbuf))
+      stats->streaming_audio += GST_BUFFER_DURATION (*outbuf);
+    gst_wasapi_stats_block_end (self->streaming_stats);
+
+    if (ret == GST_FLOW_OK && self->replay != NULL)
+      gst_wasapi_replay_push (self->replay, *outbuf);
+    if (ret == GST_FLOW_OK &&
+        spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW)
+      gst_wasapi_fanout_push (self->fanout, *outbuf, &spec->info);
+
+    return ret;
+  }
+
   bpf = GST_AUDIO_INFO_BPF (&spec->info);
   rate = GST_AUDIO_INFO_RATE (&spec->info);
 
-  if ((length == 0 && bsrc->blocksize == 0) || length == -1)
+  if (self->output_frames > 0)
+    /* Exactly the frames the encoder downstream packs, the ringbuffer read
+     * just spans the segments */
+    length = self->output_frames * bpf;
+  else if (self->first_rest && !first_sample)
+    /* The rest of the segment fast-start pushed the beginning of */
+    length = (ringbuffer->samples_per_seg - src->next_sample %
+        ringbuffer->samples_per_seg) * bpf;
+  else if ((length == 0 && bsrc->blocksize == 0) || length == -1)
     /* no length given, use the default segment size */
     length = spec->segsize;
   else
     /* make sure we round down to an integral number of samples */
     length -= length % bpf;
+  self->first_rest = FALSE;
+
+  qpc_start = gst_wasapi_util_get_qpc_position ();
 
   /* figure out the offset in the ringbuffer */
   if (G_UNLIKELY (offset != -1)) {
@@ -1073,20 +7206,45 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
 
   /* get the number of samples to read */
   total_samples = samples = length / bpf;
+  first_sample_pos = sample;
+
+  /* With fast-start, the frames of the first segment that are there */
+  if (G_UNLIKELY (first_sample && offset == -1))
+    first_fill = MIN (gst_wasapi_src_wait_first_fill (self, sample), samples);
+  if (G_UNLIKELY (first_fill > 0)) {
+    GST_DEBUG_OBJECT (self, "pushing the first %u of %u frames early",
+        first_fill, ringbuffer->samples_per_seg);
+    total_samples = samples = first_fill;
+    length = first_fill * bpf;
+    self->first_rest = first_fill % ringbuffer->samples_per_seg != 0;
+  }
+  /* Waiting for the ringbuffer isn't our cost, restart after the read */
+  ticks = gst_wasapi_util_get_qpc_position () - qpc_start;
 
   /* use the basesrc allocation code to use bufferpools or custom allocators */
-  ret = GST_BASE_SRC_CLASS (parent_class)->alloc (bsrc, offset, length, &buf);
+  ret = gst_wasapi_src_alloc (self, offset, length, &buf);
   if (G_UNLIKELY (ret != GST_FLOW_OK))
     goto alloc_failed;
 
   gst_buffer_map (buf, &info, GST_MAP_WRITE);
   ptr = info.data;
   first = TRUE;
+  if (G_UNLIKELY (first_fill > 0)) {
+    /* Written by read() already, while the segment isn't done */
+    memcpy (ptr, ringbuffer->memory + (gsize) (sample /
+            ringbuffer->samples_per_seg % spec->segtotal) * spec->segsize,
+        length);
+    goto read_done;
+  }
   do {
     GstClockTime tmp_ts = GST_CLOCK_TIME_NONE;
 
-    read =
-        gst_audio_ring_buffer_read (ringbuffer, sample, ptr, samples, &tmp_ts);
+    if (GST_IS_WASAPI_SRC_RING_BUFFER (ringbuffer))
+      read = gst_wasapi_src_ring_buffer_read (ringbuffer, sample, ptr,
+          samples, &tmp_ts);
+    else
+      read = gst_audio_ring_buffer_read (ringbuffer, sample, ptr, samples,
+          &tmp_ts);
     if (first && GST_CLOCK_TIME_IS_VALID (tmp_ts)) {
       first = FALSE;
       rb_timestamp = tmp_ts;
@@ -1112,19 +7270,68 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
     samples -= read;
     ptr += read * bpf;
   } while (TRUE);
+read_done:
   gst_buffer_unmap (buf, &info);
 
+  qpc_start = gst_wasapi_util_get_qpc_position ();
+
+  /* Swap all-silent data for shared zeroes flagged as GAP, so downstream can
+   * skip processing it */
+  if (first_fill == 0 &&
+      gst_wasapi_src_is_silent (self, first_sample_pos, total_samples)) {
+    GstBuffer *silence = gst_wasapi_src_new_silence_buffer (self, length);
+
+    gst_buffer_copy_into (silence, buf, GST_BUFFER_COPY_FLAGS, 0, 0);
+    GST_BUFFER_FLAG_SET (silence, GST_BUFFER_FLAG_GAP);
+    gst_buffer_unref (buf);
+    buf = silence;
+  } else {
+    gst_wasapi_src_fade_seam (self, buf, first_sample_pos, total_samples);
+  }
+
+  /* Not known before the segment is done */
+  if (self->segment_times != NULL && first_fill == 0) {
+    guint sps = ringbuffer->samples_per_seg;
+    GstWasapiSegmentTimes *times = &self->segment_times[(first_sample_pos /
+            sps) % self->n_silent_segments];
+
+    if (gst_wasapi_tracer_active ())
+      gst_wasapi_tracer_buffer (GST_ELEMENT (self), times->capture_qpc,
+          times->enqueue_qpc, gst_wasapi_util_get_qpc_position ());
+    /* The buffer may start in the middle of the segment */
+    if (times->capture_qpc != 0)
+      capture_qpc = times->capture_qpc +
+          gst_util_uint64_scale_int (first_sample_pos % sps, 10000000, rate);
+  }
+
   /* mark discontinuity if needed */
   if (G_UNLIKELY (sample != src->next_sample) && src->next_sample != -1) {
     GST_WARNING_OBJECT (src,
         "create DISCONT of %" G_GUINT64_FORMAT " samples at sample %"
         G_GUINT64_FORMAT, sample - src->next_sample, sample);
-    GST_ELEMENT_WARNING (src, CORE, CLOCK,
-        (_("Can't record audio fast enough")),
-        ("Dropped %" G_GUINT64_FORMAT " samples. This is most likely because "
-            "downstream can't keep up and is consuming samples too slowly.",
-            sample - src->next_sample));
-    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+    gst_wasapi_trace_discont (GST_ELEMENT (self), sample - src->next_sample);
+    glitches = gst_wasapi_glitch_log_add (&self->glitch_log,
+        GST_WASAPI_GLITCH_OVERRUN, src->next_sample,
+        sample - src->next_sample);
+    /* Under sustained overload only once per glitch-interval */
+    if (glitches || self->glitch_interval == 0)
+      gst_wasapi_src_notify (self, SRC_NOTIFY_OVERRUN,
+          sample - src->next_sample, 0, 0);
+    if (glitches)
+      gst_wasapi_src_notify (self, SRC_NOTIFY_GLITCHES, 0, 0, 0);
+    /* Silence needs no fade, and a format that can't be faded has to be
+     * resynced downstream after all */
+    if (catchup == GST_WASAPI_CATCHUP_DISCONT ||
+        (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_GAP) &&
+            !gst_wasapi_fade_in (buf, &spec->info)))
+      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+
+    gst_wasapi_stats_block_begin (self->streaming_stats)->overflow_dropped +=
+        (sample - src->next_sample) * bpf;
+    gst_wasapi_stats_block_end (self->streaming_stats);
+    /* The sizer is the device thread's, it takes this at its next wakeup */
+    if (self->adaptive_buffer)
+      g_atomic_int_set (&self->ring_overrun, TRUE);
   }
 
   src->next_sample = sample + samples;
@@ -1134,17 +7341,60 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
   duration = gst_util_uint64_scale_int (src->next_sample, GST_SECOND,
       rate) - timestamp;
 
+  if (catchup == GST_WASAPI_CATCHUP_COMPRESS && !first_sample &&
+      !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_GAP) &&
+      gst_wasapi_src_compress (self, &buf, src->next_sample))
+    duration = gst_util_uint64_scale_int (gst_buffer_get_size (buf) / bpf,
+        GST_SECOND, rate);
+
+  /* Slaved with the resample method, absorb the drift by resampling */
+  if (src->priv->slave_method == GST_AUDIO_BASE_SRC_SLAVE_RESAMPLE &&
+      self->resampler != NULL) {
+    GstClockTime capture_time = GST_CLOCK_TIME_NONE;
+    GstClock *element_clock;
+    GstClockTime base_time;
+    gboolean slaved;
+    gdouble drift_ppm;
+
+    element_clock = gst_wasapi_src_clock_copy (self, &self->streaming_clock);
+    base_time = self->streaming_clock.base_time;
+    slaved = element_clock != NULL && element_clock != src->clock;
+    if (slaved && GST_CLOCK_TIME_IS_VALID (rb_timestamp))
+      capture_time = GST_CLOCK_DIFF (base_time, rb_timestamp) > 0 ?
+          rb_timestamp - base_time : 0;
+
+    if (slaved) {
+      if (g_atomic_int_compare_and_exchange (&self->resampler_needs_reset,
+              TRUE, FALSE))
+        gst_wasapi_resampler_reset (self->resampler);
+
+      if (self->drift && gst_wasapi_drift_get_ppm (self->drift, &drift_ppm))
+        gst_wasapi_resampler_set_rate_hint (self->resampler, drift_ppm);
+
+      buf = gst_wasapi_resampler_process (self->resampler, buf, capture_time);
+      GST_LOG_OBJECT (self, "resampled with ratio %.6f",
+          gst_wasapi_resampler_get_ratio (self->resampler));
+      goto resampled;
+    }
+  }
+
   GST_OBJECT_LOCK (src);
   if (!(clock = GST_ELEMENT_CLOCK (src)))
     goto no_sync;
 
+  /* The engine follows the pipeline clock for us, see
+   * gst_wasapi_src_adjust_engine_rate(), so there is nothing to splice or
+   * timeshift */
+  if (src->priv->slave_method == GST_AUDIO_BASE_SRC_SLAVE_RESAMPLE &&
+      self->clock_adjust != NULL)
+    goto no_sync;
+
   if (!GST_CLOCK_TIME_IS_VALID (rb_timestamp) && clock != src->clock) {
     /* we are slaved, check how to handle this */
     switch (src->priv->slave_method) {
       case GST_AUDIO_BASE_SRC_SLAVE_RESAMPLE:
-        /* Not implemented, use skew algorithm. This algorithm should
-         * work on the readout pointer and produce more or less samples based
-         * on the clock drift */
+        /* Formats the resampler can't handle end up here, use the skew
+         * algorithm */
       {
         GstClockTime running_time;
         GstClockTime base_time;
@@ -1157,6 +7407,12 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
         gint segments_written;
         gint last_written_segment;
         gboolean drift_correction = FALSE;
+        gboolean estimated = FALSE;
+        gboolean single_frame = FALSE;
+
+        /* Frames we spliced in or out so far shift our timeline */
+        sample += self->skew_offset;
+        timestamp = gst_util_uint64_scale_int (sample, GST_SECOND, rate);
 
         /* get the amount of segments written from the device by now */
         segments_written = g_atomic_int_get (&ringbuffer->segdone);
@@ -1169,8 +7425,8 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
         /* samples per segment */
         sps = ringbuffer->samples_per_seg;
 
-        /* get the current time */
-        current_time = gst_clock_get_time (clock);
+        /* get the current time, mostly from the calibration */
+        current_time = gst_wasapi_src_clock_time (self, clock, first_sample);
 
         /* get the basetime */
         base_time = GST_ELEMENT_CAST (src)->base_time;
@@ -1198,11 +7454,33 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
           self->initial_timestamp_diff = timestamp_diff;
         }
 
-        gint64 drift_ns = timestamp_diff > 0 ? ABS(self->initial_timestamp_diff - timestamp_diff) : 0; //nanoseconds
-        if (drift_ns > self->drift_correction_threshold) {
+        gint64 drift_ns;
+        gdouble drift_ppm;
+        if (self->drift && gst_wasapi_drift_get_ppm (self->drift, &drift_ppm) &&
+            GST_CLOCK_TIME_IS_VALID (self->drift_reference_time) &&
+            running_time > self->drift_reference_time) {
+          /* What the estimated rate difference added up to since we last
+           * lined up, single late buffers don't count */
+          drift_ns = (gint64) (drift_ppm *
+              (running_time - self->drift_reference_time) / 1e6);
+          estimated = TRUE;
+        } else {
+          drift_ns = timestamp_diff > 0 ? self->initial_timestamp_diff - timestamp_diff : 0; //nanoseconds
+        }
+        /* drift_ns is positive when our timeline runs ahead */
+        if (ABS (drift_ns) > (gint64) self->drift_correction_threshold) {
           drift_correction = TRUE;
           self->initial_timestamp_diff = 0;
-          self->drift_correction_count++;
+          gst_wasapi_counters_inc (self->stream_counters,
+              STREAM_COUNTER_DRIFT_CORRECTIONS);
+          gst_wasapi_trace_correction (GST_ELEMENT (self), "drift", ABS (drift_ns));
+        } else if (self->drift_correction_method ==
+            GST_WASAPI_DRIFT_CORRECTION_SPLICE && estimated &&
+            ABS (drift_ns) >= (gint64) (GST_SECOND / rate)) {
+          /* The estimate is smooth enough to keep up with the drift a
+           * frame at a time, before it adds up to anything audible */
+          drift_correction = TRUE;
+          single_frame = TRUE;
         }
 
         GST_DEBUG_OBJECT (bsrc,
@@ -1223,11 +7501,52 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
             GST_TIME_ARGS (running_time), GST_TIME_ARGS (timestamp),
             GST_TIME_ARGS (self->initial_timestamp_diff),
             GST_TIME_ARGS (timestamp_diff),
-            GST_TIME_ARGS (drift_ns),
+            GST_TIME_ARGS (ABS (drift_ns)),
             running_time_segment, last_written_segment, segment_skew,
             last_read_segment);
 
-        if ((segment_skew >= ringbuffer->spec.segtotal) ||
+        if (drift_correction && !first_sample && last_read_segment != 0 &&
+            segment_skew < ringbuffer->spec.segtotal) {
+          gint due, frames, spliced;
+
+          /* Only off by a little, splice exactly the frames we're off in or
+           * out of this buffer instead of jumping whole segments */
+          due = (gint) gst_util_uint64_scale_int (ABS (drift_ns), rate,
+              GST_SECOND);
+          if (drift_ns > 0)
+            due = -due;
+          frames = single_frame ? (drift_ns > 0 ? -1 : 1) : due;
+
+          if (self->drift_correction_method ==
+              GST_WASAPI_DRIFT_CORRECTION_SPLICE)
+            spliced = gst_wasapi_splice_frames_quiet (buf,
+                &ringbuffer->spec.info, frames, self->splice_energy,
+                self->splice_energy_frames, &buf);
+          else
+            spliced = gst_wasapi_splice_frames (buf, &ringbuffer->spec.info,
+                frames, &buf);
+          self->skew_offset += spliced;
+          samples = gst_buffer_get_size (buf) / bpf;
+          duration = gst_util_uint64_scale_int (samples, GST_SECOND, rate);
+
+          /* Whatever didn't fit in this buffer is still due */
+          if (due != 0 && GST_CLOCK_TIME_IS_VALID (self->drift_reference_time))
+            self->drift_reference_time +=
+                gst_util_uint64_scale (running_time - self->drift_reference_time,
+                ABS (spliced), ABS (due));
+          else
+            self->drift_reference_time = running_time;
+
+          GST_DEBUG_OBJECT (bsrc, "spliced %d of %d frames, timeline is now "
+              "%" G_GINT64_FORMAT " frames off the ringbuffer", spliced, frames,
+              self->skew_offset);
+
+          gst_wasapi_counters_inc (self->stream_counters,
+              STREAM_COUNTER_TIMESHIFTED);
+          gst_wasapi_trace_correction (GST_ELEMENT (self), "splice",
+              (gint64) gst_util_uint64_scale_int (ABS (spliced), GST_SECOND,
+                  rate));
+        } else if ((segment_skew >= ringbuffer->spec.segtotal) ||
             (last_read_segment == 0) || first_sample ||
             drift_correction) {
           gint new_read_segment = running_time_segment;
@@ -1254,6 +7573,8 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
 
           /* we update the next sample accordingly */
           src->next_sample = new_sample + samples;
+          self->skew_offset = 0;
+  self->clock_cal_qpc = 0;
 
           GST_DEBUG_OBJECT (bsrc,
               "Timeshifted the ringbuffer with %d segments: "
@@ -1261,7 +7582,12 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
               "and src->next_sample to %" G_GUINT64_FORMAT, segment_diff,
               GST_TIME_ARGS (timestamp), src->next_sample);
 
-          self->timeshifted_count++;
+          gst_wasapi_counters_inc (self->stream_counters,
+              STREAM_COUNTER_TIMESHIFTED);
+          self->drift_reference_time = running_time;
+          gst_wasapi_trace_correction (GST_ELEMENT (self), "timeshift",
+              (gint64) segment_diff * src->ringbuffer->spec.latency_time *
+              GST_USECOND);
         }
         break;
       }
@@ -1289,8 +7615,8 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
         /* samples per segment */
         sps = ringbuffer->samples_per_seg;
 
-        /* get the current time */
-        current_time = gst_clock_get_time (clock);
+        /* get the current time, mostly from the calibration */
+        current_time = gst_wasapi_src_clock_time (self, clock, first_sample);
 
         /* get the basetime */
         base_time = GST_ELEMENT_CAST (src)->base_time;
@@ -1367,7 +7693,11 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
               "and src->next_sample to %" G_GUINT64_FORMAT, segment_diff,
               GST_TIME_ARGS (timestamp), src->next_sample);
 
-          self->timeshifted_count++;
+          gst_wasapi_counters_inc (self->stream_counters,
+              STREAM_COUNTER_TIMESHIFTED);
+          gst_wasapi_trace_correction (GST_ELEMENT (self), "timeshift",
+              (gint64) segment_diff * src->ringbuffer->spec.latency_time *
+              GST_USECOND);
         }
         break;
       }
@@ -1409,6 +7739,10 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
       timestamp = gst_audio_clock_adjust (GST_AUDIO_CLOCK (clock), timestamp);
     }
 
+    /* The history from before PLAYING starts at running time 0 */
+    if (self->preroll_segments > 0)
+      timestamp += self->preroll_time;
+
     /* we are not slaved, subtract base_time */
     base_time = GST_ELEMENT_CAST (src)->base_time;
 
@@ -1427,6 +7761,9 @@ gst_audio_base_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
   }
 
 no_sync:
+  if (self->dll != NULL && clock != NULL)
+    timestamp = gst_wasapi_src_smooth_timestamp (self, clock, sample,
+        duration, capture_qpc, timestamp);
   GST_OBJECT_UNLOCK (src);
 
   GST_BUFFER_TIMESTAMP (buf) = timestamp;
@@ -1434,8 +7771,30 @@ no_sync:
   GST_BUFFER_OFFSET (buf) = sample;
   GST_BUFFER_OFFSET_END (buf) = sample + samples;
 
+resampled:
+  if (self->add_qpc_meta && capture_qpc != 0)
+    gst_wasapi_src_add_qpc_meta (buf, capture_qpc);
+
   *outbuf = buf;
 
+  ticks += gst_wasapi_util_get_qpc_position () - qpc_start;
+  gst_wasapi_counters_begin (self->create_counters);
+  self->create_counters->values[CREATE_COUNTER_BUFFERS]++;
+  self->create_counters->values[CREATE_COUNTER_TICKS] += ticks;
+  if (ticks > self->create_counters->values[CREATE_COUNTER_TICKS_MAX])
+    self->create_counters->values[CREATE_COUNTER_TICKS_MAX] = ticks;
+  gst_wasapi_counters_end (self->create_counters);
+  stats = gst_wasapi_stats_block_begin (self->streaming_stats);
+  stats->streaming_cycles += gst_wasapi_util_get_thread_cycles () - cycles;
+  stats->streaming_audio += gst_util_uint64_scale_int (total_samples,
+      GST_SECOND, rate);
+  gst_wasapi_stats_block_end (self->streaming_stats);
+
+  if (self->replay != NULL)
+    gst_wasapi_replay_push (self->replay, buf);
+  if (spec->type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW)
+    gst_wasapi_fanout_push (self->fanout, buf, &spec->info);
+
   GST_LOG_OBJECT (src, "Pushed buffer timestamp %" GST_TIME_FORMAT,
       GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buf)));
 
@@ -1475,4 +7834,78 @@ got_error:
   }
 }
 
+/* Frames captured into the ringbuffer that create() hasn't read yet */
+static guint64
+gst_wasapi_src_ready_frames (GstWasapiSrc * self)
+{
+  GstAudioBaseSrc *src = GST_AUDIO_BASE_SRC (self);
+  GstAudioRingBuffer *ringbuffer = src->ringbuffer;
+  guint64 captured;
+
+  if (src->next_sample == (guint64) - 1)
+    return 0;
+
+  captured = (guint64) (g_atomic_int_get (&ringbuffer->segdone) -
+      ringbuffer->segbase) * ringbuffer->samples_per_seg;
+
+  return captured > src->next_sample ? captured - src->next_sample : 0;
+}
+
+static GstFlowReturn
+gst_wasapi_src_create (GstBaseSrc * bsrc, guint64 offset, guint length,
+    GstBuffer ** outbuf)
+{
+  GstWasapiSrc *self = GST_WASAPI_SRC (bsrc);
+  GstAudioRingBuffer *ringbuffer = GST_AUDIO_BASE_SRC (bsrc)->ringbuffer;
+  guint threshold = g_atomic_int_get (&self->list_threshold);
+  GstBufferList *list;
+  GstFlowReturn ret;
+  guint frames, bpf;
+
+  /* A buffer given by the caller has to be filled, not replaced by a list */
+  if (threshold == 0 || *outbuf != NULL || self->direct || self->zero_copy ||
+      offset != -1)
+    return gst_audio_base_src_create (bsrc, offset, length, outbuf);
+
+  ret = gst_audio_base_src_create (bsrc, offset, length, outbuf);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  /* What each further create() takes out of the ringbuffer, so that none
+   * of them has to wait for the device */
+  bpf = GST_AUDIO_INFO_BPF (&ringbuffer->spec.info);
+  if (self->output_frames > 0)
+    frames = self->output_frames;
+  else if ((length == 0 && bsrc->blocksize == 0) || length == -1)
+    frames = ringbuffer->samples_per_seg;
+  else
+    frames = length / bpf;
+
+  if (frames == 0 || gst_wasapi_src_ready_frames (self) <
+      (guint64) threshold * ringbuffer->samples_per_seg)
+    return GST_FLOW_OK;
+
+  list = gst_buffer_list_new ();
+  gst_buffer_list_add (list, *outbuf);
+  *outbuf = NULL;
+
+  /* Bounded by the ringbuffer, the device can't outrun us forever */
+  while (gst_buffer_list_length (list) < (guint) ringbuffer->spec.segtotal &&
+      gst_wasapi_src_ready_frames (self) >= frames) {
+    GstBuffer *buf = NULL;
+
+    if (gst_audio_base_src_create (bsrc, -1, length, &buf) != GST_FLOW_OK)
+      break;
+    gst_buffer_list_add (list, buf);
+  }
+
+  GST_LOG_OBJECT (self, "pushing backlog of %u buffers as a list",
+      gst_buffer_list_length (list));
+
+  /* A failed create() after the first leaves its error to the next call */
+  gst_base_src_submit_buffer_list (bsrc, list);
+
+  return GST_FLOW_OK;
+}
+
 
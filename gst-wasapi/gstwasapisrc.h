@@ -21,6 +21,29 @@
 #define __GST_WASAPI_SRC_H__
 
 #include "gstwasapiutil.h"
+#include "gstwasapibusqueue.h"
+#include "gstwasapiresampler.h"
+#include "gstwasapiconvert.h"
+#include "gstwasapilevel.h"
+#include "gstwasapispectrum.h"
+#include "gstwasapivad.h"
+#include "gstwasapisilence.h"
+#include "gstwasapispin.h"
+#include "gstwasapidrift.h"
+#include "gstwasapidll.h"
+#include "gstwasapistats.h"
+#include "gstwasapietw.h"
+#include "gstwasapideviceclock.h"
+#include "gstwasapicapture.h"
+#include "gstwasapilatency.h"
+#include "gstwasapipacketlog.h"
+#include "gstwasapishm.h"
+#include "gstwasapireplay.h"
+#include "gstwasapirecord.h"
+#include "gstwasapiprocessloopback.h"
+#include "gstwasapiaecref.h"
+#include "gstwasapisession.h"
+#include "gstwasapifanout.h"
 
 G_BEGIN_DECLS
 #define GST_TYPE_WASAPI_SRC \
@@ -34,14 +57,25 @@ G_BEGIN_DECLS
 #define GST_IS_WASAPI_SRC_CLASS(klass) \
   (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_WASAPI_SRC))
 typedef struct _GstWasapiSrc GstWasapiSrc;
-typedef struct _GstWasapiSrcClass GstWasapiSrcClass;
 
-typedef struct change_notify {
-  IMMNotificationClient client; // this must be first in the structure!
-  IMMDeviceEnumerator *pEnumerator; // object where client is registered
-  LPWSTR monitored; // Monitored device
-  guint default_changed;
-} change_notify;
+/* QPC positions of the first frame the device captured into a segment and
+ * of when read() handed the segment over. Written by the ringbuffer thread
+ * before the segment is done, create() only looks at done segments. */
+typedef struct
+{
+  guint64 capture_qpc;
+  guint64 enqueue_qpc;
+} GstWasapiSegmentTimes;
+
+/* What one thread uses of the element clock and base time, taken again
+ * only when @clock_cookie of the element moved past @cookie */
+typedef struct
+{
+  gint cookie;
+  GstClock *clock;
+  GstClockTime base_time;
+} GstWasapiClockCopy;
+typedef struct _GstWasapiSrcClass GstWasapiSrcClass;
 
 struct _GstWasapiSrc
 {
@@ -49,42 +83,411 @@ struct _GstWasapiSrc
 
   IMMDevice *device;
   IAudioClient *client;
+  /* With async_open, open() leaves the device to @open_thread, which owns
+   * everything open() sets up until joined under @open_lock */
+  gboolean async_open;
+  GThread *open_thread;
+  GMutex open_lock;
   IAudioClock *client_clock;
   IMMNotificationClient notification_client;
   guint64 client_clock_freq;
   IAudioCaptureClient *capture_client;
   HANDLE event_handle;
-  HANDLE stop_handle;
-  HANDLE thread_priority_handle;
+  /* Triggered by reset(), read() then returns within microseconds */
+  GstWasapiCancel stop;
+  /* With shared-engine the event handle of the client, the capture thread
+   * signals event_handle once it queued packets into @capture_stream.
+   * @use_engine is what prepare() went with, @warm_engine that of the warm
+   * client. @rtwq services it from RTWQ instead. */
+  gboolean shared_engine;
+  gboolean rtwq;
+  /* With scheduling=timer or power-saving read() waits for @timer_handle
+   * instead of event_handle, it's created in prepare(). With @power_saving
+   * it fires about once per segment, which is @wakeup_us long. */
+  GstWasapiScheduling scheduling;
+  HANDLE timer_handle;
+  gboolean power_saving;
+  gint64 wakeup_us;
+  /* With scheduling=spin, how read_exclusive() waits. Has a timer while
+   * prepared that way. */
+  GstWasapiSpin spin;
+  /* read() stopped draining once the segment was full, the next one reads
+   * the rest without waiting for an event */
+  gboolean packets_pending;
+  /* Exclusive mode without anything in between, read() copies one device
+   * period per event, see gst_wasapi_src_read_exclusive() */
+  gboolean read_exclusive;
+  gboolean use_engine;
+  gboolean warm_engine;
+  HANDLE capture_event;
+  GstWasapiCaptureStream *capture_stream;
+  /* With share-client, @capture_stream is shared with other sources on
+   * the endpoint, @client_shared then. Its client is only started and
+   * stopped through the stream. */
+  gboolean share_client;
+  gboolean client_shared;
 
+  /* Ring of frames read from the device that didn't fit into the segment,
+   * size is always a power of two, ptr is the read position. Mirrored
+   * unless Windows wouldn't map it, see gst_wasapi_util_alloc_mirrored(),
+   * every push and pop is a single copy then. */
   gsize overflow_buffer_size;
   guint overflow_buffer_ptr;
   guint overflow_buffer_length;
   guint8 *overflow_buffer;
+  gboolean overflow_mirrored;
+  /* lock-memory when prepared, the overflow buffer is then from
+   * gst_wasapi_util_alloc_locked() and the ringbuffer memory is locked */
+  gboolean memory_locked;
+  gpointer locked_ring;
+  gsize locked_ring_size;
+  /* Capture time of the first frame in the overflow buffer */
+  GstClockTime overflow_timestamp;
+  /* Everything in the overflow buffer is silence */
+  gboolean overflow_silent;
+
+  /* Read-only zeroes shared by all GAP buffers */
+  GstMemory *silence_memory;
+  /* Recycles the output buffers of segsize bytes when downstream offers no
+   * pool, set up by decide_allocation() after prepare() */
+  GstBufferPool *pool;
+  guint pool_size;
+  /* Per ringbuffer segment, whether it only contains silence */
+  gint *silent_segments;
+  gint n_silent_segments;
+  /* Per ringbuffer segment, for the wasapilatency tracer and the QPC meta */
+  GstWasapiSegmentTimes *segment_times;
+  /* Scratch of gst_wasapi_splice_frames_quiet(), a whole ringbuffer of
+   * frames so the splices in create() don't allocate */
+  gdouble *splice_energy;
+  gint splice_energy_frames;
+  /* What prepare() went with for add-reference-timestamp-meta */
+  gboolean add_qpc_meta;
+
+  /* Direct capture, create() reads packets itself. With zero-copy the
+   * WASAPI packet is handed out as GstMemory and is only released back to
+   * the device once downstream frees it, so only one packet can be
+   * outstanding at a time. */
+  GMutex packet_lock;
+  GCond packet_cond;
+  gboolean packet_outstanding;
+  gboolean flushing;
+  HANDLE cancel_handle;
+  guint64 direct_next_sample;
 
   gint64 initial_timestamp_diff;
-  guint64 timeshifted_count;
-  guint64 drift_correction_count;
+  /* Timeshifts and drift corrections, written by the streaming thread */
+  GstWasapiCounters *stream_counters;
   guint64 drift_correction_threshold;
+  gint drift_correction_method;
+  gchar *calibration_file;
+  GstWasapiCatchupPolicy catchup_policy;
+  /* create() runs the timestamps of smooth_mode, the timestamp_mode we
+   * were prepared with, through @dll unless that is device */
+  GstWasapiTimestampMode timestamp_mode;
+  GstWasapiTimestampMode smooth_mode;
+  GstWasapiDll *dll;
+  /* Rate of the device against the pipeline clock, fed by the capture
+   * thread. The reference is where the skew algorithm last lined up. */
+  GstWasapiDrift *drift;
+  gint drift_needs_reset;
+  GstClockTime drift_reference_time;
+  /* With drift-correction-method=engine the rate adjustment of a shared
+   * mode client, NULL otherwise. The I/O thread has the engine resample to
+   * @engine_rate from the drift estimate, which it feeds the device frames
+   * the adjusted positions stand for. */
+  IAudioClockAdjustment *clock_adjust;
+  gdouble engine_rate;
+  guint64 engine_last_devpos;
+  gdouble engine_frames;
+  /* Frames the skew algorithm spliced in (positive) or out of the stream */
+  gint64 skew_offset;
+  /* Last reading of the pipeline clock by create() and its slope against
+   * the QPC, see gst_wasapi_src_clock_time(). Under the object lock. */
+  GstClock *clock_cal_clock;
+  guint64 clock_cal_qpc;
+  GstClockTime clock_cal_time;
+  gdouble clock_cal_slope;
+
+  /* Back the stats property, see gstwasapistats.h. @device_stats is
+   * updated by the thread that reads the device, @streaming_stats by
+   * create(). */
+  GstWasapiStatsBlock *device_stats;
+  GstWasapiStatsBlock *streaming_stats;
+  /* Time between wakeups and how long each packet was held between
+   * GetBuffer() and ReleaseBuffer(), lock-free for the stats property */
+  GstWasapiHistogram wakeup_histogram;
+  GstWasapiHistogram hold_histogram;
+  /* Posts wasapi-stats messages with stats-interval while prepared */
+  GstClockTime stats_interval;
+  GstWasapiStatsReporter *stats_reporter;
+  /* Extra ringbuffer segments with adaptive-buffer, only used by the
+   * thread that reads the device. create() sets @ring_overrun, ATOMIC, when
+   * it lost samples, for the sizer to take at the next wakeup. */
+  GstWasapiRingSizer ring_sizer;
+  gint ring_overrun;
+  /* Buffers and the time create() spent on offsets, timestamps and
+   * resampling, without the wait for the ringbuffer */
+  GstWasapiCounters *create_counters;
+  /* Behind the startup-times property */
+  GstWasapiStartupTimes startup_times;
+
+  /* Device position we expect the next packet at, -1 if unknown */
+  guint64 next_devpos;
+  /* Gaps, written by the thread that reads the device */
+  GstWasapiCounters *capture_counters;
 
-  /* Client was reset, so it needs to be started again */
-  gboolean client_needs_restart;
+  /* Loopback watchdog: when the next period of silence is due (monotonic
+   * time), or 0 if the device is delivering data */
+  gint64 device_period_us;
+  gint64 watchdog_deadline;
+  gboolean watchdog_active;
+  guint64 watchdog_count;
+
+  /* Client was reset, so it needs to be started again. Only accessed
+   * atomically, the realtime thread never takes the object lock */
+  gint client_needs_restart;
+
+  /* The element clock and base time, under clock_lock. Each change bumps
+   * @clock_cookie, ATOMIC, so the thread that reads the device and the
+   * streaming thread only take the lock to refresh their own copies once
+   * it did, not for every packet. */
+  GMutex clock_lock;
+  GstClock *clock;
+  GstClockTime base_time;
+  gint clock_cookie;
+  GstWasapiClockCopy device_clock;
+  GstWasapiClockCopy streaming_clock;
+
+  /* With use_device_clock we provide the clock shared by all elements on
+   * the endpoint while open, see gstwasapideviceclock.h */
+  gboolean use_device_clock;
+  gboolean autoconvert;
+  gboolean match_format;
+  gboolean dither;
+  /* Downmix to this many channels while reading, 0 to keep the mix format */
+  gint channels;
+  /* channel-select, and the device channels read() keeps of it while
+   * prepared, all if @n_selected is 0 */
+  gchar *channel_select;
+  gint selected[64];
+  gint n_selected;
+  /* Level messages are posted from the ringbuffer thread while prepared */
+  GstWasapiLevelMode level_mode;
+  GstClockTime level_interval;
+  GstWasapiLevel *level;
+  /* Spectrum messages too */
+  gboolean spectrum_enabled;
+  guint spectrum_bands;
+  GstClockTime spectrum_interval;
+  GstWasapiSpectrum *spectrum;
+  /* Segments without voice are pushed as GAP, like silent ones */
+  gboolean vad;
+  gdouble vad_threshold;
+  GstClockTime vad_hangover;
+  GstWasapiVad *vad_detector;
+  /* Packets quiet enough are treated like ones with the silent flag */
+  gboolean detect_silence;
+  gdouble silence_threshold;
+  GstWasapiSilence *silence;
+  /* Looks for the pulses of a wasapisink with latency-probe while prepared */
+  gboolean probe_latency;
+  GstWasapiLatencyProbe *latency_probe;
+  /* With aec_reference in loopback, read() replaces the packets with what
+   * the sink publishing on @device_id played meanwhile. @aec_data holds
+   * those frames, it has room for @aec_data_frames. */
+  gboolean aec_reference;
+  gboolean reference_timestamp_meta;
+  GstWasapiAecRef *aec_ref;
+  guint8 *aec_data;
+  guint aec_data_frames;
+  /* Rate limits the wasapi-glitch messages and the overrun warnings */
+  GstClockTime glitch_interval;
+  GstWasapiGlitchLog glitch_log;
+  /* Blames device glitches on us, the engine or the driver, with
+   * etw-attribution. Set under the object lock, for the stats. */
+  gboolean etw_attribution;
+  GstWasapiEtwTracker *etw_tracker;
+  /* Posts the messages of the threads that read the device while
+   * prepared */
+  GstWasapiBusQueue *bus_queue;
+  /* Records the packets read() gets while prepared, and how long the wait
+   * for the current wakeup took */
+  gchar *packet_log_path;
+  /* Every packet also goes here with shm-name */
+  GstWasapiShm *shm;
+  /* And here with record-location, the files of later prepares continue
+   * at record_sequence */
+  GstWasapiRecord *record;
+  guint record_sequence;
+  /* With replay-duration, what create() pushed. Freed with the object lock
+   * held, the replay actions hold it meanwhile. */
+  GstWasapiReplay *replay;
+  /* The request pads, fed from what create() pushed */
+  GstWasapiFanout *fanout;
+  /* Segments prepare() added to the ringbuffer for preroll-time, 0 when the
+   * ringbuffer only runs in PLAYING */
+  gint preroll_segments;
+  GstWasapiPacketLog *packet_log;
+  guint32 packet_log_wait_us;
+  /* Monotonic times of prepare() and of the next wasapi-health message */
+  GstClockTime health_interval;
+  gint64 health_start;
+  gint64 health_next;
+  /* Published by read() for the properties, atomic like the watermarks.
+   * @above_high is only touched there. */
+  gint ring_fill;
+  gint overflow_fill;
+  gint high_watermark;
+  gint low_watermark;
+  gboolean above_high;
+  /* Ready segments from which create() pushes the backlog as a list */
+  gint list_threshold;
+  /* Read by create_ringbuffer() when going to READY */
+  gboolean lockless_handoff;
+  /* With fast_start, read() fills the segment create() starts with a
+   * device period at a time. It publishes how many bytes of segment
+   * @first_seg it has in @first_fill and sets @first_event each time.
+   * @first_rest is set by create() when the next buffer is the rest of
+   * that segment. */
+  gint fast_start;
+  gint first_seg;
+  gint first_fill;
+  HANDLE first_event;
+  gboolean first_rest;
+  /* With keep_running, reset() leaves the client running and this thread
+   * drops what it captures until read() or create() stop it */
+  gboolean keep_running;
+  GThread *drain_thread;
+  HANDLE drain_stop;
+  /* With on_demand, read() stops the client while nothing downstream takes
+   * the buffers and makes up silence from @idle_start (monotonic time) on
+   * instead. @demand_event is set when a consumer may have been linked. */
+  gboolean on_demand;
+  gboolean idle;
+  gint64 idle_start;
+  guint64 idle_frames;
+  HANDLE demand_event;
+  /* The initialized client is kept across PAUSED->READY, and reused if the
+   * caps and buffer sizes are still @warm_caps, @warm_latency_time and
+   * @warm_buffer_time. @warm_caps is NULL while nothing is kept. */
+  gboolean prewarm;
+  gboolean follow_default;
+  /* With stream_routing, @client may be one of the virtual default device,
+   * @routed then, which the engine moves on its own */
+  gboolean stream_routing;
+  gboolean routed;
+  /* MMCSS task, priority, processors and power settings of the ringbuffer
+   * thread. The thread_* fields are the copies taken in prepare(). */
+  gchar *mmcss_task;
+  GstWasapiMmcssPriority mmcss_priority;
+  guint64 thread_affinity;
+  guint processor_group;
+  gboolean power_throttling;
+  gboolean performance_cores;
+  gchar *thread_task;
+  GstWasapiMmcssPriority thread_priority;
+  guint64 thread_mask;
+  guint thread_group;
+  GstWasapiThreadFlags thread_flags;
+  GstCaps *warm_caps;
+  guint64 warm_latency_time;
+  guint64 warm_buffer_time;
+  guint warm_devicep_frames;
+  GstClock *shared_clock;
+  GstClock *own_clock;
+
+  /* Engine and driver latency reported by GetStreamLatency, added to the
+   * LATENCY query answer. NONE while not prepared. */
+  GstClockTime stream_latency;
+
+  /* Drift compensation for the resample slave method, NULL for formats it
+   * can't handle. Only used by the streaming thread, reset() just flags it. */
+  GstWasapiResampler *resampler;
+  gint resampler_needs_reset;
+
+  /* Converts the float mix format when the caps want integers, the device
+   * samples are read into convert_data first. NULL otherwise. */
+  GstWasapiConvert *convert;
+  guint8 *convert_data;
+  gsize convert_size;
 
   /* Actual size of the allocated buffer */
   guint buffer_frame_count;
+  /* @client was initialized, prepare() needs a new one */
+  gboolean client_initialized;
+
+  /* Changing low-latency while running builds a client with the new period
+   * in the background, read() takes over from it at the next segment. The
+   * first three under the object lock, spare_done is ATOMIC and set when
+   * the thread is done, with or without a client. */
+  gboolean live_period;
+  GThread *spare_thread;
+  IAudioClient *spare_client;
+  gint spare_done;
+  IAudioClock *spare_clock;
+  IAudioCaptureClient *spare_capture_client;
+  guint spare_devicep_frames;
+  guint spare_buffer_frames;
+  guint64 spare_freq;
+  /* Setting device while running has the thread open that endpoint
+   * instead, when @live_device, with @spare_switch. Both and
+   * @spare_device_id are under the object lock, @spare_device is what the
+   * thread opened. create() fades over the seam at @seam_sample, also under
+   * the object lock, -1 if there is none. */
+  gboolean live_device;
+  gboolean spare_switch;
+  gchar *spare_device_id;
+  IMMDevice *spare_device;
+  guint64 seam_sample;
+  /* QPC position up to which the previous client captured, packets of the
+   * new one before that are dropped. 0 if there's nothing to trim. */
+  guint64 trim_qpc;
   /* The mix format that wasapi prefers in shared mode */
+  WAVEFORMATEX *device_format;
+  /* The format the client is initialized with, the device format unless
+   * prepared with autoconvert */
   WAVEFORMATEX *mix_format;
   /* The probed caps that we can accept */
   GstCaps *cached_caps;
-  /* The channel positions in the data read from the device
-   * we will pass this to GstAudioRingbuffer so it can
-   * translate it to the native GStreamer channel layout. */
+  /* The channel positions in the data read from the device */
   GstAudioChannelPosition *positions;
+  /* Set if those are not in the GStreamer channel order. The samples are
+   * then reordered to @valid_positions while they are copied out of the
+   * packets, instead of by GstAudioRingbuffer. */
+  gboolean reorder;
+  gint reorder_map[64];
+  GstAudioChannelPosition valid_positions[64];
 
-  // Default Audio Device changed
-  change_notify change;
-  gint change_initialized;
+  /* Subscribed to the endpoint notifications while open. They wake up
+   * read() when the open device, @device_id, goes away, and set
+   * @default_changed when the default device changes. ATOMIC. With
+   * @follow_default read() then switches to the new default device.
+   * @device_id is protected by the object lock. */
+  guint notify_id;
+  gchar *device_id;
+  /* Watches the session of @client while prepared, a disconnect wakes up
+   * read() the same way */
+  GstWasapiSession *session;
+  /* The shared mode format of the device changed, get_caps() probes it
+   * again. ATOMIC */
+  gint format_changed;
+  gint default_changed;
   gboolean eos_sent;
+  /* Lost the device and couldn't open it again yet. read() then makes up
+   * silence at the pace it would have been captured at, counted from
+   * @outage_start (monotonic time), and tries again from @outage_retry on.
+   * Ringbuffer thread only. */
+  gboolean outage;
+  gint64 outage_start;
+  guint64 outage_frames;
+  gint64 outage_retry;
+  /* With @device_list, the index of the open device in there and whether
+   * one we prefer became available. ATOMIC. The list itself is protected by
+   * the object lock. */
+  gchar **device_list;
+  gint device_index;
+  gint device_list_changed;
 
   /* properties */
   gint role;
@@ -92,9 +495,37 @@ struct _GstWasapiSrc
   gboolean loopback;
   gboolean low_latency;
   gboolean try_audioclient3;
+  gboolean raw;
+  GstWasapiStreamCategory category;
+  gboolean communications_effects;
+  /* What the OS runs on our stream, once prepared. Protected by the object
+   * lock. */
+  GstStructure *os_effects;
+  gboolean adaptive_buffer;
+  gboolean auto_tune;
+  gboolean lock_memory;
+  gchar *shm_name;
+  /* Read on the I/O thread, atomic */
+  gint emit_packets;
+  guint64 replay_duration;
+  gchar *record_location;
+  guint64 record_max_size;
+  guint64 record_max_time;
+  guint64 preroll_time;
+  guint output_frames;
+  guint target_pid;
+  GstWasapiTargetMode target_mode;
+  /* open() activated a process loopback client for target-pid */
+  gboolean process_loopback;
+  gboolean zero_copy;
+  gboolean direct;
   gint sample_rate;
   wchar_t *device_strid;
-  gchar *device_description;
+  gchar *device_name;
+  /* device_strid was looked up from device_name */
+  gboolean device_name_resolved;
+  /* Interned by the device cache, kept after close */
+  const gchar *device_description;
 
   guint64 capture_too_many_frames_log_count;
 };
@@ -102,9 +533,22 @@ struct _GstWasapiSrc
 struct _GstWasapiSrcClass
 {
   GstAudioSrcClass parent_class;
+
+  /* Actions */
+  GstBuffer *(*export_replay) (GstWasapiSrc * self, guint64 start,
+      guint64 stop);
+  gboolean (*save_replay) (GstWasapiSrc * self, guint64 start, guint64 stop,
+      const gchar * path);
 };
 
 GType gst_wasapi_src_get_type (void);
 
+/* The sample create() reads from next. @next_sample is where the last
+ * buffer ended, -1 before the first one, and @segdone how many segments
+ * are done since segbase. Skips to @segdone when @next_sample was already
+ * overwritten, and starts up to @preroll_segments back at first. */
+guint64 gst_wasapi_src_get_read_offset (guint64 next_sample, gint segdone,
+    gint segtotal, gint sps, gint preroll_segments);
+
 G_END_DECLS
 #endif /* __GST_WASAPI_SRC_H__ */
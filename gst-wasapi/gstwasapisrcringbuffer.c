@@ -0,0 +1,415 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapisrcringbuffer.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+#define GET_SRC(buf) GST_AUDIO_SRC (GST_OBJECT_PARENT (buf))
+
+/* How often the streaming thread looks at segdone before it sleeps. A
+ * few microseconds, the thread usually is that close behind */
+#define SPIN_COUNT 1000
+
+/* Resolved at runtime, Windows 7 has neither */
+static struct
+{
+  BOOL (WINAPI * WaitOnAddress) (volatile VOID *, PVOID, SIZE_T, DWORD);
+  VOID (WINAPI * WakeByAddressAll) (PVOID);
+} gst_wasapi_synch_tbl;
+
+static void gst_wasapi_src_ring_buffer_dispose (GObject * object);
+static void gst_wasapi_src_ring_buffer_finalize (GObject * object);
+
+static gboolean gst_wasapi_src_ring_buffer_open_device (GstAudioRingBuffer *
+    buf);
+static gboolean gst_wasapi_src_ring_buffer_close_device (GstAudioRingBuffer *
+    buf);
+static gboolean gst_wasapi_src_ring_buffer_acquire (GstAudioRingBuffer * buf,
+    GstAudioRingBufferSpec * spec);
+static gboolean gst_wasapi_src_ring_buffer_release (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_src_ring_buffer_start (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_src_ring_buffer_pause (GstAudioRingBuffer * buf);
+static gboolean gst_wasapi_src_ring_buffer_stop (GstAudioRingBuffer * buf);
+static guint gst_wasapi_src_ring_buffer_delay (GstAudioRingBuffer * buf);
+
+#define gst_wasapi_src_ring_buffer_parent_class parent_class
+G_DEFINE_TYPE (GstWasapiSrcRingBuffer, gst_wasapi_src_ring_buffer,
+    GST_TYPE_AUDIO_RING_BUFFER);
+
+static void
+gst_wasapi_src_ring_buffer_class_init (GstWasapiSrcRingBufferClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstAudioRingBufferClass *ringbuffer_class =
+      GST_AUDIO_RING_BUFFER_CLASS (klass);
+
+  gobject_class->dispose = gst_wasapi_src_ring_buffer_dispose;
+  gobject_class->finalize = gst_wasapi_src_ring_buffer_finalize;
+
+  ringbuffer_class->open_device =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_open_device);
+  ringbuffer_class->close_device =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_close_device);
+  ringbuffer_class->acquire =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_acquire);
+  ringbuffer_class->release =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_release);
+  ringbuffer_class->start = GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_start);
+  ringbuffer_class->resume =
+      GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_start);
+  ringbuffer_class->pause = GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_pause);
+  ringbuffer_class->stop = GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_stop);
+  ringbuffer_class->delay = GST_DEBUG_FUNCPTR (gst_wasapi_src_ring_buffer_delay);
+}
+
+static void
+gst_wasapi_src_ring_buffer_init (GstWasapiSrcRingBuffer * self)
+{
+  self->start_handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  g_mutex_init (&self->read_lock);
+  self->wait_ms = 10;
+}
+
+static void
+gst_wasapi_src_ring_buffer_dispose (GObject * object)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (object);
+
+  if (self->start_handle != NULL) {
+    CloseHandle (self->start_handle);
+    self->start_handle = NULL;
+  }
+
+  G_OBJECT_CLASS (parent_class)->dispose (object);
+}
+
+static void
+gst_wasapi_src_ring_buffer_finalize (GObject * object)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (object);
+
+  g_mutex_clear (&self->read_lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static gpointer
+gst_wasapi_src_ring_buffer_load_synch (gpointer user_data)
+{
+  HMODULE dll = LoadLibrary (TEXT ("api-ms-win-core-synch-l1-2-0.dll"));
+
+  if (dll == NULL) {
+    GST_INFO ("no WaitOnAddress(), needs Windows 8");
+    return GINT_TO_POINTER (FALSE);
+  }
+
+  gst_wasapi_synch_tbl.WaitOnAddress =
+      (gpointer) GetProcAddress (dll, "WaitOnAddress");
+  gst_wasapi_synch_tbl.WakeByAddressAll =
+      (gpointer) GetProcAddress (dll, "WakeByAddressAll");
+
+  return GINT_TO_POINTER (gst_wasapi_synch_tbl.WaitOnAddress != NULL &&
+      gst_wasapi_synch_tbl.WakeByAddressAll != NULL);
+}
+
+gboolean
+gst_wasapi_src_ring_buffer_is_supported (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  return GPOINTER_TO_INT (g_once (&once,
+          gst_wasapi_src_ring_buffer_load_synch, NULL));
+}
+
+static void
+gst_wasapi_src_ring_buffer_wake (GstAudioRingBuffer * buf)
+{
+  gst_wasapi_synch_tbl.WakeByAddressAll ((PVOID) & buf->segdone);
+}
+
+static gboolean
+gst_wasapi_src_ring_buffer_open_device (GstAudioRingBuffer * buf)
+{
+  GstAudioSrc *src = GET_SRC (buf);
+
+  return GST_AUDIO_SRC_GET_CLASS (src)->open (src);
+}
+
+static gboolean
+gst_wasapi_src_ring_buffer_close_device (GstAudioRingBuffer * buf)
+{
+  GstAudioSrc *src = GET_SRC (buf);
+
+  return GST_AUDIO_SRC_GET_CLASS (src)->close (src);
+}
+
+/* Like the ringbuffer thread of GstAudioSrc, but wakes the streaming
+ * thread through the address of segdone */
+static gpointer
+gst_wasapi_src_ring_buffer_thread_func (gpointer user_data)
+{
+  GstWasapiSrcRingBuffer *self = user_data;
+  GstAudioRingBuffer *buf = GST_AUDIO_RING_BUFFER (self);
+  GstAudioSrc *src = GET_SRC (buf);
+  GstAudioSrcClass *klass = GST_AUDIO_SRC_GET_CLASS (src);
+
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+
+  while (WaitForSingleObject (self->start_handle, INFINITE) == WAIT_OBJECT_0 &&
+      g_atomic_int_get (&self->running)) {
+    GstClockTime timestamp = GST_CLOCK_TIME_NONE;
+    guint8 *readptr;
+    gint readseg, len;
+
+    /* Paused since the wait, the event is reset already */
+    if (!gst_audio_ring_buffer_prepare_read (buf, &readseg, &readptr, &len))
+      continue;
+
+    g_mutex_lock (&self->read_lock);
+    while (len > 0) {
+      guint n = klass->read (src, readptr, len, &timestamp);
+
+      if (n == 0 || n > (guint) len) {
+        GST_WARNING_OBJECT (src, "error reading %d bytes, skipping segment",
+            len);
+        break;
+      }
+      len -= n;
+      readptr += n;
+    }
+    g_mutex_unlock (&self->read_lock);
+
+    gst_audio_ring_buffer_set_timestamp (buf, readseg, timestamp);
+    gst_audio_ring_buffer_advance (buf, 1);
+    gst_wasapi_src_ring_buffer_wake (buf);
+  }
+
+  CoUninitialize ();
+
+  return NULL;
+}
+
+static gboolean
+gst_wasapi_src_ring_buffer_acquire (GstAudioRingBuffer * buf,
+    GstAudioRingBufferSpec * spec)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (buf);
+  GstAudioSrc *src = GET_SRC (buf);
+
+  if (!GST_AUDIO_SRC_GET_CLASS (src)->prepare (src, spec))
+    return FALSE;
+
+  /* Like GstAudioSrc, prepare() may have changed the segments */
+  buf->size = spec->segtotal * spec->segsize;
+  buf->memory = g_malloc (buf->size);
+  gst_audio_format_info_fill_silence (spec->info.finfo, buf->memory,
+      buf->size);
+
+  /* A couple of segments, a wakeup that got lost costs no more than that */
+  self->wait_ms = (DWORD) (2 * spec->latency_time / 1000) + 1;
+
+  g_atomic_int_set (&self->running, TRUE);
+  self->thread = g_thread_new ("wasapi-src-ring",
+      gst_wasapi_src_ring_buffer_thread_func, self);
+
+  return TRUE;
+}
+
+static gboolean
+gst_wasapi_src_ring_buffer_release (GstAudioRingBuffer * buf)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (buf);
+  GstAudioSrc *src = GET_SRC (buf);
+
+  if (self->thread != NULL) {
+    g_atomic_int_set (&self->running, FALSE);
+    SetEvent (self->start_handle);
+    /* read() may still be waiting for the device */
+    GST_AUDIO_SRC_GET_CLASS (src)->reset (src);
+    g_thread_join (self->thread);
+    self->thread = NULL;
+  }
+  g_clear_pointer (&buf->memory, g_free);
+
+  return GST_AUDIO_SRC_GET_CLASS (src)->unprepare (src);
+}
+
+static gboolean
+gst_wasapi_src_ring_buffer_start (GstAudioRingBuffer * buf)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (buf);
+
+  SetEvent (self->start_handle);
+
+  return TRUE;
+}
+
+/* Called with the object lock of the ringbuffer, after the state changed */
+static gboolean
+gst_wasapi_src_ring_buffer_pause (GstAudioRingBuffer * buf)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (buf);
+  GstAudioSrc *src = GET_SRC (buf);
+
+  ResetEvent (self->start_handle);
+  GST_AUDIO_SRC_GET_CLASS (src)->reset (src);
+  /* The streaming thread sees the new state and stops waiting */
+  gst_wasapi_src_ring_buffer_wake (buf);
+
+  return TRUE;
+}
+
+/* Like GstAudioSrc, returns once the thread is done with read() */
+static gboolean
+gst_wasapi_src_ring_buffer_stop (GstAudioRingBuffer * buf)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (buf);
+
+  gst_wasapi_src_ring_buffer_pause (buf);
+  g_mutex_lock (&self->read_lock);
+  g_mutex_unlock (&self->read_lock);
+
+  return TRUE;
+}
+
+static guint
+gst_wasapi_src_ring_buffer_delay (GstAudioRingBuffer * buf)
+{
+  GstAudioSrc *src = GET_SRC (buf);
+
+  return GST_AUDIO_SRC_GET_CLASS (src)->delay (src);
+}
+
+/* Like wait_segment() of GstAudioRingBuffer: starts the ringbuffer if it
+ * may, then waits until segdone moves from @segdone. FALSE if flushing or
+ * not started. */
+static gboolean
+gst_wasapi_src_ring_buffer_wait (GstWasapiSrcRingBuffer * self, gint segdone)
+{
+  GstAudioRingBuffer *buf = GST_AUDIO_RING_BUFFER (self);
+  gboolean ok;
+  guint i;
+
+  if (G_UNLIKELY (g_atomic_int_get (&buf->state) !=
+          GST_AUDIO_RING_BUFFER_STATE_STARTED)) {
+    if (!g_atomic_int_get (&buf->may_start))
+      return FALSE;
+
+    GST_DEBUG_OBJECT (buf, "start!");
+    gst_audio_ring_buffer_start (buf);
+  }
+
+  for (i = 0; i < SPIN_COUNT; i++) {
+    if (g_atomic_int_get (&buf->segdone) != segdone)
+      return TRUE;
+    YieldProcessor ();
+  }
+
+  GST_OBJECT_LOCK (buf);
+  ok = !buf->flushing &&
+      g_atomic_int_get (&buf->state) == GST_AUDIO_RING_BUFFER_STATE_STARTED;
+  GST_OBJECT_UNLOCK (buf);
+  if (!ok)
+    return FALSE;
+
+  /* Returns right away if segdone moved since */
+  gst_wasapi_synch_tbl.WaitOnAddress (&buf->segdone, &segdone,
+      sizeof (segdone), self->wait_ms);
+
+  return TRUE;
+}
+
+guint
+gst_wasapi_src_ring_buffer_read (GstAudioRingBuffer * buf, guint64 sample,
+    guint8 * data, guint len, GstClockTime * timestamp)
+{
+  GstWasapiSrcRingBuffer *self = GST_WASAPI_SRC_RING_BUFFER (buf);
+  gint segsize = buf->spec.segsize;
+  gint segtotal = buf->spec.segtotal;
+  gint channels = GST_AUDIO_INFO_CHANNELS (&buf->spec.info);
+  gint bpf = GST_AUDIO_INFO_BPF (&buf->spec.info);
+  gint bps = bpf / channels;
+  gint sps = buf->samples_per_seg;
+  gint readseg = 0;
+  guint to_read = len;
+
+  while (to_read > 0) {
+    gint sampleslen, sampleoff;
+
+    readseg = (gint) (sample / sps);
+    sampleoff = (gint) (sample % sps);
+
+    for (;;) {
+      gint segdone = g_atomic_int_get (&buf->segdone);
+      gint diff = segdone - buf->segbase - readseg;
+
+      /* Reader too slow, like the default ringbuffer pretend the segment
+       * was empty */
+      if (G_UNLIKELY (diff >= segtotal)) {
+        sampleslen = MIN (sps - sampleoff, (gint) to_read);
+        memcpy (data, buf->empty_seg, (gsize) sampleslen * bpf);
+        goto next;
+      }
+
+      if (diff > 0)
+        break;
+
+      if (!gst_wasapi_src_ring_buffer_wait (self, segdone)) {
+        GST_DEBUG_OBJECT (buf, "stopped reading");
+        return len - to_read;
+      }
+    }
+
+    readseg %= segtotal;
+    sampleslen = MIN (sps - sampleoff, (gint) to_read);
+
+    if (buf->need_reorder) {
+      const guint8 *ptr = buf->memory + (gsize) readseg * segsize +
+          (gsize) sampleoff * bpf;
+      gint i, j;
+
+      /* From device order to GStreamer order */
+      for (i = 0; i < sampleslen; i++) {
+        for (j = 0; j < channels; j++)
+          memcpy (data + (gsize) i * bpf + buf->channel_reorder_map[j] * bps,
+              ptr + j * bps, bps);
+        ptr += bpf;
+      }
+    } else {
+      memcpy (data, buf->memory + (gsize) readseg * segsize +
+          (gsize) sampleoff * bpf, (gsize) sampleslen * bpf);
+    }
+
+  next:
+    to_read -= sampleslen;
+    sample += sampleslen;
+    data += (gsize) sampleslen * bpf;
+  }
+
+  if (buf->timestamps != NULL && timestamp != NULL)
+    *timestamp = buf->timestamps[readseg % segtotal];
+
+  return len;
+}
@@ -0,0 +1,79 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_SRC_RING_BUFFER_H__
+#define __GST_WASAPI_SRC_RING_BUFFER_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Ringbuffer of wasapisrc with lockless-handoff=true.
+ *
+ * Works like the one of GstAudioSrc: a thread of ours calls read() for
+ * one segment after the other while started. The streaming thread waits
+ * for segdone with WaitOnAddress() instead of the mutex and condition of
+ * GstAudioRingBuffer, after spinning on it for a bit, and the thread
+ * wakes it with WakeByAddressAll() for each segment. At device periods of
+ * a few milliseconds that's most wakeups without a kernel transition.
+ *
+ * gst_audio_ring_buffer_read() would still wait on the condition, so
+ * create() reads through gst_wasapi_src_ring_buffer_read() instead. */
+#define GST_TYPE_WASAPI_SRC_RING_BUFFER \
+  (gst_wasapi_src_ring_buffer_get_type())
+#define GST_WASAPI_SRC_RING_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_WASAPI_SRC_RING_BUFFER,GstWasapiSrcRingBuffer))
+#define GST_WASAPI_SRC_RING_BUFFER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_WASAPI_SRC_RING_BUFFER,GstWasapiSrcRingBufferClass))
+#define GST_IS_WASAPI_SRC_RING_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_WASAPI_SRC_RING_BUFFER))
+typedef struct _GstWasapiSrcRingBuffer GstWasapiSrcRingBuffer;
+typedef struct _GstWasapiSrcRingBufferClass GstWasapiSrcRingBufferClass;
+
+struct _GstWasapiSrcRingBuffer
+{
+  GstAudioRingBuffer parent;
+
+  /* Between acquire() and release(). The thread waits for @start_handle,
+   * set while started, and then reads a segment at a time. @running is
+   * cleared to stop it. */
+  GThread *thread;
+  HANDLE start_handle;
+  gint running;
+  /* Held around each read(), so stop() returns only once it's done */
+  GMutex read_lock;
+  /* Longest the streaming thread sleeps before it looks at the state
+   * again, in milliseconds */
+  DWORD wait_ms;
+};
+
+struct _GstWasapiSrcRingBufferClass
+{
+  GstAudioRingBufferClass parent_class;
+};
+
+GType gst_wasapi_src_ring_buffer_get_type (void);
+
+/* WaitOnAddress() is there, i.e. Windows 8 or later */
+gboolean gst_wasapi_src_ring_buffer_is_supported (void);
+
+/* Like gst_audio_ring_buffer_read() */
+guint gst_wasapi_src_ring_buffer_read (GstAudioRingBuffer * buf,
+    guint64 sample, guint8 * data, guint len, GstClockTime * timestamp);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_SRC_RING_BUFFER_H__ */
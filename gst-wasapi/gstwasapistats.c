@@ -0,0 +1,719 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapistats.h"
+#include "gstwasapiutil.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+G_STATIC_ASSERT (sizeof (GstWasapiCounters) <= CACHE_LINE_SIZE);
+
+void
+gst_wasapi_stats_reset (GstWasapiStats * stats)
+{
+  memset (stats, 0, sizeof (GstWasapiStats));
+}
+
+gint64
+gst_wasapi_stats_wakeup (GstWasapiStats * stats, gint64 now)
+{
+  gint64 interval = -1;
+
+  if (stats->last_wakeup != 0) {
+    interval = now - stats->last_wakeup;
+
+    if (stats->n_wakeups == 0 || interval < stats->wakeup_interval_min)
+      stats->wakeup_interval_min = interval;
+    if (interval > stats->wakeup_interval_max)
+      stats->wakeup_interval_max = interval;
+    stats->wakeup_interval_total += interval;
+    stats->n_wakeups++;
+  }
+
+  stats->last_wakeup = now;
+
+  return interval;
+}
+
+GstStructure *
+gst_wasapi_stats_to_structure (const GstWasapiStats * stats,
+    const gchar * name, gdouble drift_ppm)
+{
+  GstClockTime avg = 0;
+  guint64 device_cps = 0, streaming_cps = 0;
+
+  if (stats->n_wakeups > 0)
+    avg = stats->wakeup_interval_total / stats->n_wakeups * GST_USECOND;
+  if (stats->device_audio > 0)
+    device_cps = gst_util_uint64_scale (stats->device_cycles, GST_SECOND,
+        stats->device_audio);
+  if (stats->streaming_audio > 0)
+    streaming_cps = gst_util_uint64_scale (stats->streaming_cycles,
+        GST_SECOND, stats->streaming_audio);
+
+  return gst_structure_new (name,
+      "glitches", G_TYPE_UINT64, stats->glitches,
+      "overflow-saved", G_TYPE_UINT64, stats->overflow_saved,
+      "overflow-dropped", G_TYPE_UINT64, stats->overflow_dropped,
+      "max-drain-iterations", G_TYPE_UINT, stats->max_drain_iterations,
+      "wakeup-interval-min", G_TYPE_UINT64,
+      (guint64) stats->wakeup_interval_min * GST_USECOND,
+      "wakeup-interval-avg", G_TYPE_UINT64, (guint64) avg,
+      "wakeup-interval-max", G_TYPE_UINT64,
+      (guint64) stats->wakeup_interval_max * GST_USECOND,
+      "padding-high-water", G_TYPE_UINT, stats->max_padding,
+      "underruns", G_TYPE_UINT64, stats->underruns,
+      "underrun-time", G_TYPE_UINT64, stats->underrun_time * GST_USECOND,
+      "drift-ppm", G_TYPE_DOUBLE, drift_ppm,
+      "device-cycles-per-second", G_TYPE_UINT64, device_cps,
+      "streaming-cycles-per-second", G_TYPE_UINT64, streaming_cps, NULL);
+}
+
+GstWasapiStatsBlock *
+gst_wasapi_stats_block_new (void)
+{
+  gsize size = GST_ROUND_UP_N (sizeof (GstWasapiStatsBlock), CACHE_LINE_SIZE);
+  GstWasapiStatsBlock *block;
+
+  block = _aligned_malloc (size, CACHE_LINE_SIZE);
+  g_assert (block != NULL);
+  memset (block, 0, size);
+
+  return block;
+}
+
+void
+gst_wasapi_stats_block_free (GstWasapiStatsBlock * block)
+{
+  _aligned_free (block);
+}
+
+void
+gst_wasapi_stats_block_reset (GstWasapiStatsBlock * block)
+{
+  gst_wasapi_stats_reset (gst_wasapi_stats_block_begin (block));
+  gst_wasapi_stats_block_end (block);
+}
+
+void
+gst_wasapi_stats_block_add_to (const GstWasapiStatsBlock * block,
+    GstWasapiStats * stats)
+{
+  volatile gint *sequence = (volatile gint *) &block->sequence;
+  GstWasapiStats copy;
+  gint before;
+
+  /* Like gst_wasapi_counters_snapshot() */
+  do {
+    while ((before = g_atomic_int_get (sequence)) & 1)
+      g_thread_yield ();
+    memcpy (&copy, (const void *) &block->stats, sizeof (GstWasapiStats));
+  } while (g_atomic_int_get (sequence) != before);
+
+  stats->glitches += copy.glitches;
+  stats->overflow_saved += copy.overflow_saved;
+  stats->overflow_dropped += copy.overflow_dropped;
+  stats->max_drain_iterations = MAX (stats->max_drain_iterations,
+      copy.max_drain_iterations);
+  stats->max_padding = MAX (stats->max_padding, copy.max_padding);
+  stats->underruns += copy.underruns;
+  stats->underrun_time += copy.underrun_time;
+
+  if (copy.n_wakeups > 0) {
+    if (stats->n_wakeups == 0 ||
+        copy.wakeup_interval_min < stats->wakeup_interval_min)
+      stats->wakeup_interval_min = copy.wakeup_interval_min;
+    stats->wakeup_interval_max = MAX (stats->wakeup_interval_max,
+        copy.wakeup_interval_max);
+    stats->wakeup_interval_total += copy.wakeup_interval_total;
+    stats->n_wakeups += copy.n_wakeups;
+  }
+  stats->last_wakeup = MAX (stats->last_wakeup, copy.last_wakeup);
+
+  stats->device_cycles += copy.device_cycles;
+  stats->device_audio += copy.device_audio;
+  stats->streaming_cycles += copy.streaming_cycles;
+  stats->streaming_audio += copy.streaming_audio;
+}
+
+/* A window this long without getting close to the limit lets us shrink */
+#define RING_SIZER_STABLE_TIME (60 * G_USEC_PER_SEC)
+
+void
+gst_wasapi_ring_sizer_reset (GstWasapiRingSizer * sizer, guint extra,
+    gint64 period)
+{
+  sizer->extra = MIN (extra, GST_WASAPI_RING_SIZER_MAX_EXTRA);
+  sizer->period = MAX (period, 1);
+  sizer->window_start = 0;
+  sizer->window_max = 0;
+}
+
+static gboolean
+gst_wasapi_ring_sizer_grow (GstWasapiRingSizer * sizer, gint64 now)
+{
+  sizer->window_start = now;
+  sizer->window_max = 0;
+
+  if (sizer->extra >= GST_WASAPI_RING_SIZER_MAX_EXTRA)
+    return FALSE;
+
+  sizer->extra++;
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_ring_sizer_wakeup (GstWasapiRingSizer * sizer, gint64 now,
+    gint64 interval)
+{
+  gint64 late = interval - sizer->period;
+
+  if (sizer->window_start == 0)
+    sizer->window_start = now;
+  if (interval < 0)
+    return FALSE;
+
+  /* The ring covers (1 + extra) periods of lateness, don't wait for the
+   * wakeup that actually needs all of them */
+  if (late * 4 > (gint64) (1 + sizer->extra) * sizer->period * 3)
+    return gst_wasapi_ring_sizer_grow (sizer, now);
+
+  sizer->window_max = MAX (sizer->window_max, late);
+  if (now - sizer->window_start < RING_SIZER_STABLE_TIME)
+    return FALSE;
+
+  /* Half of what one segment less would cover, so we don't flap between
+   * two sizes */
+  if (sizer->extra > 0 &&
+      sizer->window_max * 2 < (gint64) sizer->extra * sizer->period) {
+    sizer->extra--;
+    sizer->window_start = now;
+    sizer->window_max = 0;
+    return TRUE;
+  }
+
+  sizer->window_start = now;
+  sizer->window_max = 0;
+  return FALSE;
+}
+
+gboolean
+gst_wasapi_ring_sizer_glitch (GstWasapiRingSizer * sizer, gint64 now)
+{
+  return gst_wasapi_ring_sizer_grow (sizer, now);
+}
+
+void
+gst_wasapi_histogram_reset (GstWasapiHistogram * histogram)
+{
+  guint i;
+
+  for (i = 0; i < GST_WASAPI_HISTOGRAM_BUCKETS; i++)
+    g_atomic_int_set (&histogram->buckets[i], 0);
+}
+
+/* Upper bound of the bucket with the sample at @fraction, in ns */
+static guint64
+gst_wasapi_histogram_percentile (const guint counts[], guint64 total,
+    gdouble fraction)
+{
+  guint64 rank = (guint64) (total * fraction), seen = 0;
+  guint i;
+
+  for (i = 0; i < GST_WASAPI_HISTOGRAM_BUCKETS - 1; i++) {
+    seen += counts[i];
+    if (seen > rank)
+      break;
+  }
+
+  return ((guint64) 1 << i) * GST_USECOND;
+}
+
+void
+gst_wasapi_histogram_to_structure (const GstWasapiHistogram * histogram,
+    GstStructure * s, const gchar * name)
+{
+  guint counts[GST_WASAPI_HISTOGRAM_BUCKETS];
+  GValue array = G_VALUE_INIT, v = G_VALUE_INIT;
+  guint64 total = 0;
+  guint i, n = 0;
+  gchar *field;
+
+  for (i = 0; i < GST_WASAPI_HISTOGRAM_BUCKETS; i++) {
+    counts[i] = g_atomic_int_get (&histogram->buckets[i]);
+    total += counts[i];
+    if (counts[i] > 0)
+      n = i + 1;
+  }
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+  g_value_init (&v, G_TYPE_UINT);
+  for (i = 0; i < n; i++) {
+    g_value_set_uint (&v, counts[i]);
+    gst_value_array_append_value (&array, &v);
+  }
+  g_value_unset (&v);
+  gst_structure_take_value (s, name, &array);
+
+  field = g_strconcat (name, "-p99", NULL);
+  gst_structure_set (s, field, G_TYPE_UINT64,
+      total > 0 ? gst_wasapi_histogram_percentile (counts, total, 0.99) : 0,
+      NULL);
+  g_free (field);
+  field = g_strconcat (name, "-p999", NULL);
+  gst_structure_set (s, field, G_TYPE_UINT64,
+      total > 0 ? gst_wasapi_histogram_percentile (counts, total, 0.999) : 0,
+      NULL);
+  g_free (field);
+}
+
+void
+gst_wasapi_glitch_log_init (GstWasapiGlitchLog * log)
+{
+  memset (log, 0, sizeof (GstWasapiGlitchLog));
+  g_mutex_init (&log->lock);
+}
+
+void
+gst_wasapi_glitch_log_clear (GstWasapiGlitchLog * log)
+{
+  g_mutex_clear (&log->lock);
+}
+
+void
+gst_wasapi_glitch_log_reset (GstWasapiGlitchLog * log, gint rate,
+    GstClockTime interval)
+{
+  g_mutex_lock (&log->lock);
+  log->rate = rate;
+  log->interval = interval;
+  log->last_post = 0;
+  log->due_time = 0;
+  log->total = 0;
+  memset (log->counts, 0, sizeof (log->counts));
+  memset (log->frames, 0, sizeof (log->frames));
+  g_mutex_unlock (&log->lock);
+}
+
+gboolean
+gst_wasapi_glitch_log_add (GstWasapiGlitchLog * log, GstWasapiGlitchKind kind,
+    guint64 frame, guint64 frames)
+{
+  gboolean due = FALSE;
+  gint64 now = g_get_monotonic_time ();
+  guint i, pending = 0;
+
+  g_mutex_lock (&log->lock);
+  if (log->interval == 0)
+    goto done;
+
+  for (i = 0; i < GST_WASAPI_N_GLITCH_KINDS; i++)
+    pending += log->counts[i];
+  if (pending == 0) {
+    log->first_time = now;
+    log->first_frame = frame;
+  }
+  log->counts[kind]++;
+  log->frames[kind] += frames;
+  log->last_frame = frame;
+  log->total++;
+
+  if (log->last_post == 0 ||
+      (guint64) (now - log->last_post) * GST_USECOND >= log->interval) {
+    /* The interval starts now, not when take() gets to it */
+    log->last_post = now;
+    log->due_time = now;
+    due = TRUE;
+  }
+
+done:
+  g_mutex_unlock (&log->lock);
+
+  return due;
+}
+
+GstStructure *
+gst_wasapi_glitch_log_take (GstWasapiGlitchLog * log)
+{
+  GstStructure *s = NULL;
+  guint64 lost = 0;
+  guint i, pending = 0;
+  gint64 now;
+
+  g_mutex_lock (&log->lock);
+  for (i = 0; i < GST_WASAPI_N_GLITCH_KINDS; i++) {
+    pending += log->counts[i];
+    lost += log->frames[i];
+  }
+  if (pending == 0)
+    goto done;
+
+  now = log->due_time != 0 ? log->due_time : g_get_monotonic_time ();
+  s = gst_structure_new ("wasapi-glitch",
+      "device-glitches", G_TYPE_UINT, log->counts[GST_WASAPI_GLITCH_DEVICE],
+      "device-frames", G_TYPE_UINT64, log->frames[GST_WASAPI_GLITCH_DEVICE],
+      "overruns", G_TYPE_UINT, log->counts[GST_WASAPI_GLITCH_OVERRUN],
+      "overrun-frames", G_TYPE_UINT64, log->frames[GST_WASAPI_GLITCH_OVERRUN],
+      "duration", G_TYPE_UINT64, log->rate > 0 ?
+      gst_util_uint64_scale_int (lost, GST_SECOND, log->rate) : 0,
+      "first-frame", G_TYPE_UINT64, log->first_frame,
+      "last-frame", G_TYPE_UINT64, log->last_frame,
+      "span", G_TYPE_UINT64, (guint64) (now - log->first_time) * GST_USECOND,
+      "total", G_TYPE_UINT64, log->total, NULL);
+
+  memset (log->counts, 0, sizeof (log->counts));
+  memset (log->frames, 0, sizeof (log->frames));
+  log->last_post = now;
+  log->due_time = 0;
+
+done:
+  g_mutex_unlock (&log->lock);
+
+  return s;
+}
+
+static const gchar *startup_phase_names[GST_WASAPI_N_STARTUP_PHASES] = {
+  "enumerator", "endpoint", "activate", "mix-format", "initialize",
+  "get-service", "start", "first-event"
+};
+
+static GQuark
+gst_wasapi_startup_times_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (quark == 0)
+    quark = g_quark_from_static_string ("gst-wasapi-startup-times");
+
+  return quark;
+}
+
+void
+gst_wasapi_startup_times_init (GstWasapiStartupTimes * times,
+    GstElement * element)
+{
+  memset (times, 0, sizeof (GstWasapiStartupTimes));
+  g_mutex_init (&times->lock);
+  g_object_set_qdata (G_OBJECT (element), gst_wasapi_startup_times_quark (),
+      times);
+}
+
+void
+gst_wasapi_startup_times_clear (GstWasapiStartupTimes * times)
+{
+  g_mutex_clear (&times->lock);
+}
+
+void
+gst_wasapi_startup_times_reset (GstWasapiStartupTimes * times,
+    GstWasapiStartupPhase first)
+{
+  guint i;
+
+  g_mutex_lock (&times->lock);
+  for (i = first; i < GST_WASAPI_N_STARTUP_PHASES; i++)
+    times->durations[i] = 0;
+  g_atomic_int_set (&times->pending, FALSE);
+  g_mutex_unlock (&times->lock);
+}
+
+guint64
+gst_wasapi_startup_times_add (GstElement * element,
+    GstWasapiStartupPhase phase, guint64 since)
+{
+  GstWasapiStartupTimes *times;
+  guint64 now = gst_wasapi_util_get_qpc_position ();
+
+  if (element == NULL)
+    return now;
+
+  times = g_object_get_qdata (G_OBJECT (element),
+      gst_wasapi_startup_times_quark ());
+  if (times == NULL)
+    return now;
+
+  g_mutex_lock (&times->lock);
+  times->durations[phase] += now - MIN (now, since);
+  if (phase == GST_WASAPI_STARTUP_START) {
+    times->started = now;
+    g_atomic_int_set (&times->pending, TRUE);
+  }
+  g_mutex_unlock (&times->lock);
+
+  return now;
+}
+
+gboolean
+gst_wasapi_startup_times_event (GstWasapiStartupTimes * times)
+{
+  guint64 now;
+
+  if (G_LIKELY (!g_atomic_int_get (&times->pending)))
+    return FALSE;
+
+  now = gst_wasapi_util_get_qpc_position ();
+  g_mutex_lock (&times->lock);
+  if (!g_atomic_int_compare_and_exchange (&times->pending, TRUE, FALSE)) {
+    g_mutex_unlock (&times->lock);
+    return FALSE;
+  }
+  times->durations[GST_WASAPI_STARTUP_FIRST_EVENT] =
+      now - MIN (now, times->started);
+  g_mutex_unlock (&times->lock);
+
+  return TRUE;
+}
+
+GstStructure *
+gst_wasapi_startup_times_to_structure (GstWasapiStartupTimes * times,
+    const gchar * name)
+{
+  GstStructure *s = gst_structure_new_empty (name);
+  guint64 total = 0;
+  guint i;
+
+  g_mutex_lock (&times->lock);
+  for (i = 0; i < GST_WASAPI_N_STARTUP_PHASES; i++) {
+    gst_structure_set (s, startup_phase_names[i], G_TYPE_UINT64,
+        times->durations[i] * 100, NULL);
+    total += times->durations[i];
+  }
+  g_mutex_unlock (&times->lock);
+  gst_structure_set (s, "total", G_TYPE_UINT64, total * 100, NULL);
+
+  return s;
+}
+
+GstWasapiCounters *
+gst_wasapi_counters_new (void)
+{
+  GstWasapiCounters *counters;
+
+  counters = _aligned_malloc (CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+  g_assert (counters != NULL);
+  memset (counters, 0, CACHE_LINE_SIZE);
+
+  return counters;
+}
+
+void
+gst_wasapi_counters_free (GstWasapiCounters * counters)
+{
+  _aligned_free (counters);
+}
+
+void
+gst_wasapi_counters_reset (GstWasapiCounters * counters)
+{
+  guint i;
+
+  gst_wasapi_counters_begin (counters);
+  for (i = 0; i < GST_WASAPI_N_COUNTERS; i++)
+    counters->values[i] = 0;
+  gst_wasapi_counters_end (counters);
+}
+
+void
+gst_wasapi_counters_snapshot (const GstWasapiCounters * counters,
+    guint64 values[GST_WASAPI_N_COUNTERS])
+{
+  volatile gint *sequence = (volatile gint *) &counters->sequence;
+  gint before;
+  guint i;
+
+  /* Both reads are full barriers, so the copy can't move out from between
+   * them. A 64 bit value may tear on 32 bit, that is caught the same way. */
+  do {
+    while ((before = g_atomic_int_get (sequence)) & 1)
+      g_thread_yield ();
+    for (i = 0; i < GST_WASAPI_N_COUNTERS; i++)
+      values[i] = counters->values[i];
+  } while (g_atomic_int_get (sequence) != before);
+}
+
+struct _GstWasapiStatsReporter
+{
+  GstElement *element;
+  GstClockTime interval;
+  gint rate;
+  const GstWasapiHistogram *wakeups;
+  GstWasapiStatsSnapshotFunc snapshot;
+  GThread *thread;
+
+  /* Protects @stop */
+  GMutex lock;
+  GCond cond;
+  gboolean stop;
+
+  /* Of the previous report, only the thread uses them */
+  GstWasapiStats last;
+  guint last_wakeups[GST_WASAPI_HISTOGRAM_BUCKETS];
+  gint64 last_time;
+  GstClockTime last_process_time;
+};
+
+/* Reporters running in the process, ATOMIC */
+static gint n_reporters;
+
+/* A counter that went backwards was reset meanwhile */
+#define DELTA(now, last) ((now) >= (last) ? (now) - (last) : (now))
+
+static GstStructure *
+gst_wasapi_stats_reporter_take (GstWasapiStatsReporter * reporter,
+    gint64 now)
+{
+  GstWasapiStats stats, *last = &reporter->last;
+  guint wakeups[GST_WASAPI_HISTOGRAM_BUCKETS];
+  guint counts[GST_WASAPI_HISTOGRAM_BUCKETS];
+  guint64 n_wakeups, interval_total, total = 0;
+  GstClockTime process_time = gst_wasapi_util_get_process_time ();
+  GstClockTime elapsed = (now - reporter->last_time) * GST_USECOND;
+  gdouble ppm = 0;
+  GstStructure *s;
+  guint i;
+
+  reporter->snapshot (reporter->element, &stats, &ppm);
+
+  for (i = 0; i < GST_WASAPI_HISTOGRAM_BUCKETS; i++) {
+    wakeups[i] = g_atomic_int_get (&reporter->wakeups->buckets[i]);
+    counts[i] = DELTA (wakeups[i], reporter->last_wakeups[i]);
+    total += counts[i];
+  }
+  n_wakeups = DELTA (stats.n_wakeups, last->n_wakeups);
+  interval_total = DELTA ((guint64) stats.wakeup_interval_total,
+      (guint64) last->wakeup_interval_total);
+
+  s = gst_structure_new ("wasapi-stats",
+      "interval", G_TYPE_UINT64, elapsed,
+      "frames", G_TYPE_UINT64, gst_util_uint64_scale_int (DELTA
+          (stats.device_audio, last->device_audio), reporter->rate,
+          GST_SECOND),
+      "glitches", G_TYPE_UINT64, DELTA (stats.glitches, last->glitches),
+      "overflow-saved", G_TYPE_UINT64, DELTA (stats.overflow_saved,
+          last->overflow_saved),
+      "overflow-dropped", G_TYPE_UINT64, DELTA (stats.overflow_dropped,
+          last->overflow_dropped),
+      "underruns", G_TYPE_UINT64, DELTA (stats.underruns, last->underruns),
+      "drift-ppm", G_TYPE_DOUBLE, ppm,
+      "wakeups", G_TYPE_UINT64, n_wakeups,
+      "wakeup-interval-avg", G_TYPE_UINT64, n_wakeups > 0 ?
+      interval_total / n_wakeups * GST_USECOND : 0,
+      "wakeup-interval-p99", G_TYPE_UINT64, total > 0 ?
+      gst_wasapi_histogram_percentile (counts, total, 0.99) : 0,
+      "wakeup-interval-p999", G_TYPE_UINT64, total > 0 ?
+      gst_wasapi_histogram_percentile (counts, total, 0.999) : 0,
+      "device-cycles", G_TYPE_UINT64, DELTA (stats.device_cycles,
+          last->device_cycles),
+      "streaming-cycles", G_TYPE_UINT64, DELTA (stats.streaming_cycles,
+          last->streaming_cycles),
+      "streams", G_TYPE_INT, g_atomic_int_get (&n_reporters),
+      "process-cpu", G_TYPE_DOUBLE, elapsed > 0 ? 100.0 * DELTA (process_time,
+          reporter->last_process_time) / elapsed : 0.0, NULL);
+
+  reporter->last = stats;
+  reporter->last_process_time = process_time;
+  memcpy (reporter->last_wakeups, wakeups, sizeof (wakeups));
+  reporter->last_time = now;
+
+  return s;
+}
+
+#undef DELTA
+
+static gpointer
+gst_wasapi_stats_reporter_thread_func (gpointer user_data)
+{
+  GstWasapiStatsReporter *reporter = user_data;
+  gint64 interval = reporter->interval / GST_USECOND;
+  gint64 next = reporter->last_time + interval;
+
+  g_mutex_lock (&reporter->lock);
+  while (!reporter->stop) {
+    GstStructure *s;
+    gint64 now;
+
+    /* Woken up early by free() */
+    if (g_cond_wait_until (&reporter->cond, &reporter->lock, next) ||
+        reporter->stop)
+      continue;
+    now = g_get_monotonic_time ();
+
+    /* Without the lock, the snapshot takes locks of the element */
+    g_mutex_unlock (&reporter->lock);
+    s = gst_wasapi_stats_reporter_take (reporter, now);
+    gst_element_post_message (reporter->element,
+        gst_message_new_element (GST_OBJECT (reporter->element), s));
+    g_mutex_lock (&reporter->lock);
+
+    /* Late reports don't pile up */
+    next = MAX (next + interval, now);
+  }
+  g_mutex_unlock (&reporter->lock);
+
+  return NULL;
+}
+
+GstWasapiStatsReporter *
+gst_wasapi_stats_reporter_new (GstElement * element, GstClockTime interval,
+    gint rate, const GstWasapiHistogram * wakeups,
+    GstWasapiStatsSnapshotFunc snapshot)
+{
+  GstWasapiStatsReporter *reporter = g_slice_new0 (GstWasapiStatsReporter);
+  gdouble ppm;
+
+  reporter->element = element;
+  reporter->interval = MAX (interval, GST_MSECOND);
+  reporter->rate = rate;
+  reporter->wakeups = wakeups;
+  reporter->snapshot = snapshot;
+  g_mutex_init (&reporter->lock);
+  g_cond_init (&reporter->cond);
+
+  snapshot (element, &reporter->last, &ppm);
+  for (guint ii = 0; ii < GST_WASAPI_HISTOGRAM_BUCKETS; ii++)
+    reporter->last_wakeups[ii] = g_atomic_int_get (&wakeups->buckets[ii]);
+  reporter->last_time = g_get_monotonic_time ();
+  reporter->last_process_time = gst_wasapi_util_get_process_time ();
+  g_atomic_int_inc (&n_reporters);
+
+  reporter->thread = g_thread_new ("wasapi-stats",
+      gst_wasapi_stats_reporter_thread_func, reporter);
+
+  return reporter;
+}
+
+void
+gst_wasapi_stats_reporter_free (GstWasapiStatsReporter * reporter)
+{
+  g_mutex_lock (&reporter->lock);
+  reporter->stop = TRUE;
+  g_cond_signal (&reporter->cond);
+  g_mutex_unlock (&reporter->lock);
+  g_thread_join (reporter->thread);
+  g_atomic_int_add (&n_reporters, -1);
+
+  g_mutex_clear (&reporter->lock);
+  g_cond_clear (&reporter->cond);
+  g_slice_free (GstWasapiStatsReporter, reporter);
+}
@@ -0,0 +1,361 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_STATS_H__
+#define __GST_WASAPI_STATS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Counters behind the "stats" property of the source and sink.
+ *
+ * The elements keep these in a GstWasapiStatsBlock per thread that updates
+ * them, the property adds those up. */
+typedef struct
+{
+  /* Packets the device flagged as discontinuous, or failed writes */
+  guint64 glitches;
+  /* Bytes kept in the overflow buffer, and bytes lost to overruns */
+  guint64 overflow_saved;
+  guint64 overflow_dropped;
+  /* Most GetBuffer() calls needed to drain the device in one wakeup */
+  guint max_drain_iterations;
+  /* Most frames queued in the device buffer at a wakeup */
+  guint max_padding;
+  /* The device ran out of data, or we ran out of data for the device */
+  guint64 underruns;
+  /* How long the device played silence for those, in microseconds, where
+   * that is known */
+  guint64 underrun_time;
+
+  /* Time between wakeups, in microseconds */
+  guint64 n_wakeups;
+  gint64 last_wakeup;
+  gint64 wakeup_interval_min;
+  gint64 wakeup_interval_max;
+  gint64 wakeup_interval_total;
+
+  /* CPU cycles the device thread spent in read() or write(), and the
+   * streaming thread in create() or the zero-copy commit(), with the
+   * duration of the audio they moved, in nanoseconds */
+  guint64 device_cycles;
+  guint64 device_audio;
+  guint64 streaming_cycles;
+  guint64 streaming_audio;
+} GstWasapiStats;
+
+void gst_wasapi_stats_reset (GstWasapiStats * stats);
+
+/* The realtime thread woke up at @now (monotonic time). Returns the time
+ * since the previous wakeup, or -1 for the first. */
+gint64 gst_wasapi_stats_wakeup (GstWasapiStats * stats, gint64 now);
+
+GstStructure *gst_wasapi_stats_to_structure (const GstWasapiStats * stats,
+    const gchar * name, gdouble drift_ppm);
+
+/* GstWasapiStats that one thread at a time updates, and any thread reads
+ * without a lock, a sequence lock like GstWasapiCounters below. The
+ * elements have one for the thread that reads or writes the device and one
+ * for the streaming thread, so neither waits for the other or for a
+ * property read. Allocated on cache lines of its own. */
+typedef struct
+{
+  volatile gint sequence;
+  GstWasapiStats stats;
+} GstWasapiStatsBlock;
+
+GstWasapiStatsBlock *gst_wasapi_stats_block_new (void);
+
+void gst_wasapi_stats_block_free (GstWasapiStatsBlock * block);
+
+/* Writer only, brackets updates of the stats it returns. The writer can
+ * read them without that. */
+static inline GstWasapiStats *
+gst_wasapi_stats_block_begin (GstWasapiStatsBlock * block)
+{
+  g_atomic_int_inc (&block->sequence);
+  return &block->stats;
+}
+
+static inline void
+gst_wasapi_stats_block_end (GstWasapiStatsBlock * block)
+{
+  g_atomic_int_inc (&block->sequence);
+}
+
+/* Writer only, or while there is none */
+void gst_wasapi_stats_block_reset (GstWasapiStatsBlock * block);
+
+/* Any thread, adds a consistent copy of @block to @stats */
+void gst_wasapi_stats_block_add_to (const GstWasapiStatsBlock * block,
+    GstWasapiStats * stats);
+
+#define GST_WASAPI_RING_SIZER_MAX_EXTRA 8
+
+/* Learns how many segments on top of the minimum the ringbuffer needs for
+ * the scheduling jitter of this machine, with adaptive-buffer=true.
+ *
+ * Each extra segment lets the realtime thread wake up one device period
+ * later without a glitch. The sizer grows when a wakeup comes close to
+ * that, or on a glitch, and shrinks again after a minute in which the
+ * wakeups would have fitted one segment less with room to spare. The
+ * ringbuffer can't be resized while it runs, so the elements keep the
+ * result per endpoint and use it the next time they prepare.
+ *
+ * Only used by the thread that reads or writes the device. */
+typedef struct
+{
+  guint extra;
+  /* Device period and the start of the current stable window, in
+   * microseconds of monotonic time */
+  gint64 period;
+  gint64 window_start;
+  /* Latest wakeup in the window, relative to the period */
+  gint64 window_max;
+} GstWasapiRingSizer;
+
+void gst_wasapi_ring_sizer_reset (GstWasapiRingSizer * sizer, guint extra,
+    gint64 period);
+
+/* The realtime thread woke up at @now, @interval after the previous wakeup.
+ * TRUE if the number of extra segments changed. */
+gboolean gst_wasapi_ring_sizer_wakeup (GstWasapiRingSizer * sizer,
+    gint64 now, gint64 interval);
+
+/* Samples were lost to an overrun or underrun. TRUE if the number of extra
+ * segments changed. */
+gboolean gst_wasapi_ring_sizer_glitch (GstWasapiRingSizer * sizer,
+    gint64 now);
+
+#define GST_WASAPI_HISTOGRAM_BUCKETS 24
+
+/* Durations in microseconds on a log2 scale: bucket 0 counts those below
+ * 1 us, bucket n those from 2^(n-1) up to 2^n us and the last one also
+ * everything longer.
+ *
+ * One thread adds to it and any thread reads it without a lock. Each bucket
+ * is atomic on its own, a reader may see one sample more or less across
+ * buckets, which doesn't matter for a histogram. */
+typedef struct
+{
+  volatile gint buckets[GST_WASAPI_HISTOGRAM_BUCKETS];
+} GstWasapiHistogram;
+
+static inline void
+gst_wasapi_histogram_add (GstWasapiHistogram * histogram, gint64 us)
+{
+  guint bucket = us > 0 ? g_bit_storage ((guint64) us) : 0;
+
+  g_atomic_int_inc (&histogram->buckets[MIN (bucket,
+              GST_WASAPI_HISTOGRAM_BUCKETS - 1)]);
+}
+
+void gst_wasapi_histogram_reset (GstWasapiHistogram * histogram);
+
+/* Sets @name to the bucket counts, up to the last non-empty one, and
+ * @name-p99 and @name-p999 to the upper bound of the bucket those
+ * percentiles fall in, in nanoseconds */
+void gst_wasapi_histogram_to_structure (const GstWasapiHistogram * histogram,
+    GstStructure * s, const gchar * name);
+
+typedef enum
+{
+  /* The device flagged a discontinuity or skipped device positions */
+  GST_WASAPI_GLITCH_DEVICE,
+  /* Samples were overwritten in the ringbuffer before create() read them */
+  GST_WASAPI_GLITCH_OVERRUN,
+  GST_WASAPI_N_GLITCH_KINDS
+} GstWasapiGlitchKind;
+
+/* Coalesces glitches into "wasapi-glitch" element messages, at most one
+ * per interval. The first glitch after a quiet interval is reported right
+ * away, those that follow within the interval go out with the next one
+ * after it, or with the last take(). add() only counts, the message is
+ * built by take(), on the thread that posts it. */
+typedef struct
+{
+  GMutex lock;
+  gint rate;
+  /* 0 disables the messages */
+  GstClockTime interval;
+  /* Monotonic time of the last message, of the first glitch since, and
+   * of the add() that asked for the next message, 0 if none did */
+  gint64 last_post;
+  gint64 first_time;
+  gint64 due_time;
+
+  guint counts[GST_WASAPI_N_GLITCH_KINDS];
+  guint64 frames[GST_WASAPI_N_GLITCH_KINDS];
+  guint64 first_frame;
+  guint64 last_frame;
+  guint64 total;
+} GstWasapiGlitchLog;
+
+void gst_wasapi_glitch_log_init (GstWasapiGlitchLog * log);
+
+void gst_wasapi_glitch_log_clear (GstWasapiGlitchLog * log);
+
+/* Starts over for a stream of @rate */
+void gst_wasapi_glitch_log_reset (GstWasapiGlitchLog * log, gint rate,
+    GstClockTime interval);
+
+/* Records a glitch of @kind at stream position @frame that lost or made up
+ * @frames. TRUE when it is time to post a message, without allocating. */
+gboolean gst_wasapi_glitch_log_add (GstWasapiGlitchLog * log,
+    GstWasapiGlitchKind kind, guint64 frame, guint64 frames);
+
+/* The message structure of the glitches not reported yet, or NULL */
+GstStructure *gst_wasapi_glitch_log_take (GstWasapiGlitchLog * log);
+
+typedef enum
+{
+  GST_WASAPI_STARTUP_ENUMERATOR,
+  /* GetDefaultAudioEndpoint() or GetDevice() */
+  GST_WASAPI_STARTUP_ENDPOINT,
+  GST_WASAPI_STARTUP_ACTIVATE,
+  GST_WASAPI_STARTUP_MIX_FORMAT,
+  /* Initialize() or InitializeSharedAudioStream() */
+  GST_WASAPI_STARTUP_INITIALIZE,
+  GST_WASAPI_STARTUP_GET_SERVICE,
+  GST_WASAPI_STARTUP_START,
+  /* From Start() until the device signalled for the first time */
+  GST_WASAPI_STARTUP_FIRST_EVENT,
+  GST_WASAPI_N_STARTUP_PHASES
+} GstWasapiStartupPhase;
+
+/* How long each phase of opening and starting the stream took, summed
+ * since open() for the device phases and since prepare() for the others.
+ *
+ * The util functions find the times of the element they are called for,
+ * the elements time what they call on the client themselves. */
+typedef struct
+{
+  GMutex lock;
+  /* In 100 ns */
+  guint64 durations[GST_WASAPI_N_STARTUP_PHASES];
+  /* QPC position of the last Start() while waiting for the first event,
+   * @pending is only accessed atomically */
+  guint64 started;
+  gint pending;
+} GstWasapiStartupTimes;
+
+/* Attaches @times to @element */
+void gst_wasapi_startup_times_init (GstWasapiStartupTimes * times,
+    GstElement * element);
+
+void gst_wasapi_startup_times_clear (GstWasapiStartupTimes * times);
+
+/* Forgets @first and the phases after it */
+void gst_wasapi_startup_times_reset (GstWasapiStartupTimes * times,
+    GstWasapiStartupPhase first);
+
+/* Adds the time since QPC position @since to @phase of @element, if it has
+ * startup times. Returns the current QPC position, for the next phase. */
+guint64 gst_wasapi_startup_times_add (GstElement * element,
+    GstWasapiStartupPhase phase, guint64 since);
+
+/* The device signalled. TRUE the first time after a Start(), the startup
+ * is complete then. Cheap enough for every wakeup. */
+gboolean gst_wasapi_startup_times_event (GstWasapiStartupTimes * times);
+
+GstStructure *gst_wasapi_startup_times_to_structure (GstWasapiStartupTimes *
+    times, const gchar * name);
+
+#define GST_WASAPI_N_COUNTERS 7
+
+/* Event counters that one thread at a time updates, and any thread reads
+ * without a lock, so a property read never blocks the realtime thread.
+ *
+ * A sequence lock: the writer makes @sequence odd while it updates @values,
+ * a reader copies them until it saw the same even sequence before and
+ * after. Allocated on a cache line of its own, so the writer never shares
+ * it with another thread. */
+typedef struct
+{
+  volatile gint sequence;
+  volatile guint64 values[GST_WASAPI_N_COUNTERS];
+} GstWasapiCounters;
+
+GstWasapiCounters *gst_wasapi_counters_new (void);
+
+void gst_wasapi_counters_free (GstWasapiCounters * counters);
+
+/* Writer only, brackets updates of @values that belong together */
+static inline void
+gst_wasapi_counters_begin (GstWasapiCounters * counters)
+{
+  g_atomic_int_inc (&counters->sequence);
+}
+
+static inline void
+gst_wasapi_counters_end (GstWasapiCounters * counters)
+{
+  g_atomic_int_inc (&counters->sequence);
+}
+
+static inline void
+gst_wasapi_counters_inc (GstWasapiCounters * counters, guint index)
+{
+  gst_wasapi_counters_begin (counters);
+  counters->values[index]++;
+  gst_wasapi_counters_end (counters);
+}
+
+/* Writer only, or while there is none */
+void gst_wasapi_counters_reset (GstWasapiCounters * counters);
+
+/* Any thread, a consistent copy of all the values */
+void gst_wasapi_counters_snapshot (const GstWasapiCounters * counters,
+    guint64 values[GST_WASAPI_N_COUNTERS]);
+
+static inline guint64
+gst_wasapi_counters_get (const GstWasapiCounters * counters, guint index)
+{
+  guint64 values[GST_WASAPI_N_COUNTERS];
+
+  gst_wasapi_counters_snapshot (counters, values);
+
+  return values[index];
+}
+
+/* Posts a "wasapi-stats" element message every stats-interval with what
+ * changed since the previous one: frames, glitches, overflow, underruns,
+ * wakeups with their p99 and p999 interval, the CPU cycles of both threads
+ * and the current drift. From a thread of its own, so the realtime threads
+ * never build or post them.
+ *
+ * For scaling runs with many elements in one process, each message also
+ * has how many reporters are running and the CPU time of the whole process
+ * over the interval, so per-stream cost is process-cpu / streams. */
+typedef struct _GstWasapiStatsReporter GstWasapiStatsReporter;
+
+/* Copies the current counters of @element, like its stats property */
+typedef void (*GstWasapiStatsSnapshotFunc) (GstElement * element,
+    GstWasapiStats * stats, gdouble * drift_ppm);
+
+/* Starts reporting on a stream of @rate from now on, with the wakeup
+ * intervals of @wakeups, which has to stay around */
+GstWasapiStatsReporter *gst_wasapi_stats_reporter_new (GstElement * element,
+    GstClockTime interval, gint rate, const GstWasapiHistogram * wakeups,
+    GstWasapiStatsSnapshotFunc snapshot);
+
+/* Stops the thread, nothing is posted after this returns */
+void gst_wasapi_stats_reporter_free (GstWasapiStatsReporter * reporter);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_STATS_H__ */
@@ -0,0 +1,118 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapitrace.h"
+
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DEFINE_PROVIDER (gst_wasapi_trace_provider, "GStreamer-WASAPI",
+    (0xdbb4d7de, 0xb4b1, 0x4ea8, 0xad, 0xf2, 0x2e, 0x84, 0xee, 0xbe, 0xea,
+        0x59));
+
+void
+gst_wasapi_trace_register (void)
+{
+  static gsize registered = 0;
+
+  if (g_once_init_enter (&registered)) {
+    TraceLoggingRegister (gst_wasapi_trace_provider);
+    g_once_init_leave (&registered, 1);
+  }
+}
+
+gboolean
+gst_wasapi_trace_enabled (void)
+{
+  return TraceLoggingProviderEnabled (gst_wasapi_trace_provider, 0, 0);
+}
+
+void
+gst_wasapi_trace_wakeup (GstElement * element, DWORD wait_result)
+{
+  if (!gst_wasapi_trace_enabled ())
+    return;
+
+  TraceLoggingWrite (gst_wasapi_trace_provider, "Wakeup",
+      TraceLoggingString (GST_ELEMENT_NAME (element), "Element"),
+      TraceLoggingUInt32 (wait_result, "WaitResult"));
+}
+
+void
+gst_wasapi_trace_get_buffer (GstElement * element, guint32 frames,
+    DWORD flags, guint64 devpos, guint64 qpcpos)
+{
+  if (!gst_wasapi_trace_enabled ())
+    return;
+
+  TraceLoggingWrite (gst_wasapi_trace_provider, "GetBuffer",
+      TraceLoggingString (GST_ELEMENT_NAME (element), "Element"),
+      TraceLoggingUInt32 (frames, "Frames"),
+      TraceLoggingHexUInt32 (flags, "Flags"),
+      TraceLoggingUInt64 (devpos, "DevicePosition"),
+      TraceLoggingUInt64 (qpcpos, "QPCPosition"));
+}
+
+void
+gst_wasapi_trace_release_buffer (GstElement * element, guint32 frames)
+{
+  if (!gst_wasapi_trace_enabled ())
+    return;
+
+  TraceLoggingWrite (gst_wasapi_trace_provider, "ReleaseBuffer",
+      TraceLoggingString (GST_ELEMENT_NAME (element), "Element"),
+      TraceLoggingUInt32 (frames, "Frames"));
+}
+
+void
+gst_wasapi_trace_overflow (GstElement * element, guint bytes, guint fill)
+{
+  if (!gst_wasapi_trace_enabled ())
+    return;
+
+  TraceLoggingWrite (gst_wasapi_trace_provider, "Overflow",
+      TraceLoggingString (GST_ELEMENT_NAME (element), "Element"),
+      TraceLoggingUInt32 (bytes, "Bytes"),
+      TraceLoggingUInt32 (fill, "Fill"));
+}
+
+void
+gst_wasapi_trace_discont (GstElement * element, guint64 frames)
+{
+  if (!gst_wasapi_trace_enabled ())
+    return;
+
+  TraceLoggingWrite (gst_wasapi_trace_provider, "Discont",
+      TraceLoggingString (GST_ELEMENT_NAME (element), "Element"),
+      TraceLoggingUInt64 (frames, "Frames"));
+}
+
+void
+gst_wasapi_trace_correction (GstElement * element, const gchar * kind,
+    gint64 amount)
+{
+  if (!gst_wasapi_trace_enabled ())
+    return;
+
+  TraceLoggingWrite (gst_wasapi_trace_provider, "Correction",
+      TraceLoggingString (GST_ELEMENT_NAME (element), "Element"),
+      TraceLoggingString (kind, "Kind"),
+      TraceLoggingInt64 (amount, "Amount"));
+}
@@ -0,0 +1,61 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_TRACE_H__
+#define __GST_WASAPI_TRACE_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* ETW TraceLogging provider "GStreamer-WASAPI"
+ * {dbb4d7de-b4b1-4ea8-adf2-2e84eebeea59}
+ *
+ * Events are cheap enough to be left in the realtime paths: when no trace
+ * session listens, each call is a single enabled check. The ETW timestamp of
+ * every event is QPC based, so they line up with the audio engine stacks in
+ * WPA. */
+
+/* Registers the provider. GStreamer keeps plugin modules resident, so the
+ * provider stays registered for the lifetime of the process */
+void gst_wasapi_trace_register (void);
+
+gboolean gst_wasapi_trace_enabled (void);
+
+/* The event handle (or timeout) woke up the read/write thread */
+void gst_wasapi_trace_wakeup (GstElement * element, DWORD wait_result);
+
+/* GetBuffer() returned a packet of @frames frames */
+void gst_wasapi_trace_get_buffer (GstElement * element, guint32 frames,
+    DWORD flags, guint64 devpos, guint64 qpcpos);
+
+/* ReleaseBuffer() of @frames frames */
+void gst_wasapi_trace_release_buffer (GstElement * element, guint32 frames);
+
+/* @bytes were stored in the overflow buffer, which now holds @fill bytes */
+void gst_wasapi_trace_overflow (GstElement * element, guint bytes,
+    guint fill);
+
+/* @frames were lost or made up */
+void gst_wasapi_trace_discont (GstElement * element, guint64 frames);
+
+/* Timestamps were corrected, @kind says how, by @amount nanoseconds */
+void gst_wasapi_trace_correction (GstElement * element, const gchar * kind,
+    gint64 amount);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_TRACE_H__ */
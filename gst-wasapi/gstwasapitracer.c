@@ -0,0 +1,293 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+/* The tracer API is still marked unstable */
+#define GST_USE_UNSTABLE_API
+
+#include "gstwasapitracer.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+#define GST_TYPE_WASAPI_TRACER (gst_wasapi_tracer_get_type ())
+#define GST_WASAPI_TRACER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_WASAPI_TRACER,GstWasapiTracer))
+
+typedef struct _GstWasapiTracer GstWasapiTracer;
+typedef struct _GstWasapiTracerClass GstWasapiTracerClass;
+
+enum
+{
+  STAGE_DEVICE,
+  STAGE_RINGBUFFER,
+  STAGE_TOTAL,
+  N_STAGES
+};
+
+static const gchar *stage_names[N_STAGES] = {
+  "device", "ringbuffer", "total"
+};
+
+/* Upper bounds of the buckets in ms, the last one takes everything else */
+static const guint bucket_limits[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500 };
+
+#define N_BUCKETS (G_N_ELEMENTS (bucket_limits) + 1)
+
+typedef struct
+{
+  guint64 count;
+  guint64 min;
+  guint64 max;
+  guint64 sum;
+  guint64 buckets[N_BUCKETS];
+} GstWasapiHistogram;
+
+typedef struct
+{
+  gchar *name;
+  GstWasapiHistogram stages[N_STAGES];
+} GstWasapiElementLatency;
+
+struct _GstWasapiTracer
+{
+  GstTracer parent;
+
+  GMutex lock;
+  /* GstElement * -> GstWasapiElementLatency * */
+  GHashTable *elements;
+};
+
+struct _GstWasapiTracerClass
+{
+  GstTracerClass parent_class;
+};
+
+static GType gst_wasapi_tracer_get_type (void);
+
+G_DEFINE_TYPE (GstWasapiTracer, gst_wasapi_tracer, GST_TYPE_TRACER);
+
+static GstTracerRecord *tr_latency;
+/* The one instance the elements report to */
+static GstWasapiTracer *active_tracer;
+
+static void
+gst_wasapi_element_latency_free (GstWasapiElementLatency * latency)
+{
+  g_free (latency->name);
+  g_slice_free (GstWasapiElementLatency, latency);
+}
+
+static void
+gst_wasapi_histogram_add (GstWasapiHistogram * histogram, guint64 value)
+{
+  guint64 ms = value / GST_MSECOND;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (bucket_limits); i++) {
+    if (ms < bucket_limits[i])
+      break;
+  }
+  histogram->buckets[i]++;
+
+  if (histogram->count == 0 || value < histogram->min)
+    histogram->min = value;
+  if (value > histogram->max)
+    histogram->max = value;
+  histogram->sum += value;
+  histogram->count++;
+}
+
+static void
+gst_wasapi_histogram_log (GstWasapiHistogram * histogram,
+    const gchar * element, const gchar * stage)
+{
+  GString *buckets;
+  guint i;
+
+  if (histogram->count == 0)
+    return;
+
+  buckets = g_string_new (NULL);
+  for (i = 0; i < N_BUCKETS; i++) {
+    if (i < G_N_ELEMENTS (bucket_limits))
+      g_string_append_printf (buckets, "%s<%ums:%" G_GUINT64_FORMAT,
+          i > 0 ? " " : "", bucket_limits[i], histogram->buckets[i]);
+    else
+      g_string_append_printf (buckets, " >=%ums:%" G_GUINT64_FORMAT,
+          bucket_limits[i - 1], histogram->buckets[i]);
+  }
+
+  gst_tracer_record_log (tr_latency, element, stage, histogram->count,
+      histogram->min, histogram->sum / histogram->count, histogram->max,
+      buckets->str);
+  g_string_free (buckets, TRUE);
+}
+
+static void
+gst_wasapi_element_latency_log (GstWasapiElementLatency * latency)
+{
+  gint i;
+
+  for (i = 0; i < N_STAGES; i++)
+    gst_wasapi_histogram_log (&latency->stages[i], latency->name,
+        stage_names[i]);
+}
+
+static void
+do_element_change_state_post (GstWasapiTracer * self, GstClockTime ts,
+    GstElement * element, GstStateChange transition,
+    GstStateChangeReturn result)
+{
+  GstWasapiElementLatency *latency;
+
+  if (transition != GST_STATE_CHANGE_PAUSED_TO_READY)
+    return;
+
+  g_mutex_lock (&self->lock);
+  latency = g_hash_table_lookup (self->elements, element);
+  if (latency != NULL) {
+    gst_wasapi_element_latency_log (latency);
+    g_hash_table_remove (self->elements, element);
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gst_wasapi_tracer_finalize (GObject * object)
+{
+  GstWasapiTracer *self = GST_WASAPI_TRACER (object);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_atomic_pointer_compare_and_exchange (&active_tracer, self, NULL);
+
+  /* Whatever didn't stop before the process exits */
+  g_hash_table_iter_init (&iter, self->elements);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    gst_wasapi_element_latency_log (value);
+  g_hash_table_unref (self->elements);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gst_wasapi_tracer_parent_class)->finalize (object);
+}
+
+static void
+gst_wasapi_tracer_class_init (GstWasapiTracerClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gst_wasapi_tracer_finalize;
+
+  tr_latency = gst_tracer_record_new ("wasapi-latency.class",
+      "element", GST_TYPE_STRUCTURE, gst_structure_new ("scope",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "related-to", GST_TYPE_TRACER_VALUE_SCOPE,
+          GST_TRACER_VALUE_SCOPE_ELEMENT, NULL),
+      "stage", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "description", G_TYPE_STRING,
+          "device: capture to ringbuffer, ringbuffer: ringbuffer to push, "
+          "total: capture to push", NULL),
+      "count", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "number of buffers",
+          "flags", GST_TYPE_TRACER_VALUE_FLAGS,
+          GST_TRACER_VALUE_FLAGS_AGGREGATED, NULL),
+      "min", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "smallest latency in ns",
+          "flags", GST_TYPE_TRACER_VALUE_FLAGS,
+          GST_TRACER_VALUE_FLAGS_AGGREGATED, NULL),
+      "mean", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "average latency in ns",
+          "flags", GST_TYPE_TRACER_VALUE_FLAGS,
+          GST_TRACER_VALUE_FLAGS_AGGREGATED, NULL),
+      "max", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "largest latency in ns",
+          "flags", GST_TYPE_TRACER_VALUE_FLAGS,
+          GST_TRACER_VALUE_FLAGS_AGGREGATED, NULL),
+      "histogram", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "description", G_TYPE_STRING, "number of buffers per bucket",
+          "flags", GST_TYPE_TRACER_VALUE_FLAGS,
+          GST_TRACER_VALUE_FLAGS_AGGREGATED, NULL), NULL);
+  GST_OBJECT_FLAG_SET (tr_latency, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+}
+
+static void
+gst_wasapi_tracer_init (GstWasapiTracer * self)
+{
+  g_mutex_init (&self->lock);
+  self->elements = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gst_wasapi_element_latency_free);
+
+  gst_tracing_register_hook (GST_TRACER (self), "element-change-state-post",
+      G_CALLBACK (do_element_change_state_post));
+
+  g_atomic_pointer_compare_and_exchange (&active_tracer, NULL, self);
+}
+
+gboolean
+gst_wasapi_tracer_register (GstPlugin * plugin)
+{
+  return gst_tracer_register (plugin, "wasapilatency", GST_TYPE_WASAPI_TRACER);
+}
+
+gboolean
+gst_wasapi_tracer_active (void)
+{
+  return g_atomic_pointer_get (&active_tracer) != NULL;
+}
+
+void
+gst_wasapi_tracer_buffer (GstElement * element, guint64 capture_qpc,
+    guint64 enqueue_qpc, guint64 push_qpc)
+{
+  GstWasapiTracer *self = g_atomic_pointer_get (&active_tracer);
+  GstWasapiElementLatency *latency;
+
+  if (self == NULL || enqueue_qpc == 0)
+    return;
+
+  g_mutex_lock (&self->lock);
+  latency = g_hash_table_lookup (self->elements, element);
+  if (latency == NULL) {
+    latency = g_slice_new0 (GstWasapiElementLatency);
+    latency->name = gst_element_get_name (element);
+    g_hash_table_insert (self->elements, element, latency);
+  }
+
+  /* Without a valid device timestamp only the ringbuffer stage is known */
+  if (capture_qpc != 0 && capture_qpc <= enqueue_qpc) {
+    gst_wasapi_histogram_add (&latency->stages[STAGE_DEVICE],
+        (enqueue_qpc - capture_qpc) * 100);
+    gst_wasapi_histogram_add (&latency->stages[STAGE_TOTAL],
+        (push_qpc - MIN (push_qpc, capture_qpc)) * 100);
+  }
+  gst_wasapi_histogram_add (&latency->stages[STAGE_RINGBUFFER],
+      (push_qpc - MIN (push_qpc, enqueue_qpc)) * 100);
+  g_mutex_unlock (&self->lock);
+}
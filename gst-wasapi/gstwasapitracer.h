@@ -0,0 +1,43 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_WASAPI_TRACER_H__
+#define __GST_WASAPI_TRACER_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Tracer "wasapilatency", enabled with GST_TRACERS=wasapilatency.
+ *
+ * wasapisrc reports, per pushed buffer, when the device captured its first
+ * frame, when read() handed the segment to the ringbuffer and when create()
+ * pushed it. The tracer keeps histograms of the three stages per element,
+ * device to ringbuffer, ringbuffer to push and the total, and logs them
+ * when the element goes back to READY. The elements only do the
+ * bookkeeping while a tracer instance exists. */
+gboolean gst_wasapi_tracer_register (GstPlugin * plugin);
+
+gboolean gst_wasapi_tracer_active (void);
+
+/* All times are QPC positions, in 100 ns units */
+void gst_wasapi_tracer_buffer (GstElement * element, guint64 capture_qpc,
+    guint64 enqueue_qpc, guint64 push_qpc);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_TRACER_H__ */
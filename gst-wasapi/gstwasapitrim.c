@@ -0,0 +1,317 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapitrim.h"
+#include "gstwasapicpu.h"
+
+#include <string.h>
+
+#ifdef GST_WASAPI_CPU_X86
+#include <immintrin.h>
+#elif defined(GST_WASAPI_CPU_ARM64)
+#include <arm_neon.h>
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+/* Frames the gains are repeated for, so that every run of that many
+ * samples from a frame on starts at the same place in the pattern. 8 is
+ * what an AVX2 register takes of float samples. */
+#define GAIN_LANES 8
+
+/* Scales the @n interleaved samples at @data by @pattern, which repeats
+ * every @period samples */
+typedef void (*GstWasapiTrimGainFunc) (gpointer data, gsize n,
+    const gfloat * pattern, gsize period);
+
+/* Delays the channel at @data, @stride samples apart, by @delay frames
+ * through @line, with @scratch for @n_frames of it */
+typedef void (*GstWasapiTrimDelayFunc) (gpointer data, guint n_frames,
+    gint stride, gpointer line, guint delay, gpointer scratch);
+
+struct _GstWasapiTrim
+{
+  /* Picked once in new(), for the format */
+  GstWasapiTrimGainFunc gain_func;
+  GstWasapiTrimDelayFunc delay_func;
+  gint channels;
+  guint width;
+
+  /* Per channel, the last @delays samples of it, oldest first */
+  guint *delays;
+  gpointer *lines;
+  /* One channel of the largest packet so far */
+  gpointer scratch;
+  guint scratch_frames;
+
+  /* The gains for GAIN_LANES frames, NULL while they are all 1 */
+  gfloat *pattern;
+};
+
+static void
+gain_f32 (gpointer data, gsize n, const gfloat * pattern, gsize period)
+{
+  gfloat *d = data;
+  gsize ii, jj;
+
+  for (ii = 0; ii < n; ii += period) {
+    gsize len = MIN (period, n - ii);
+
+    for (jj = 0; jj < len; jj++)
+      d[ii + jj] *= pattern[jj];
+  }
+}
+
+static void
+gain_s16 (gpointer data, gsize n, const gfloat * pattern, gsize period)
+{
+  gint16 *d = data;
+  gsize ii, jj;
+
+  for (ii = 0; ii < n; ii += period) {
+    gsize len = MIN (period, n - ii);
+
+    for (jj = 0; jj < len; jj++) {
+      gfloat v = d[ii + jj] * pattern[jj];
+
+      v = CLAMP (v, -32768.0f, 32767.0f);
+      d[ii + jj] = (gint16) (v + (v >= 0 ? 0.5f : -0.5f));
+    }
+  }
+}
+
+static void
+gain_s32 (gpointer data, gsize n, const gfloat * pattern, gsize period)
+{
+  gint32 *d = data;
+  gsize ii, jj;
+
+  /* In double, a float doesn't hold 24 bits and the rounding */
+  for (ii = 0; ii < n; ii += period) {
+    gsize len = MIN (period, n - ii);
+
+    for (jj = 0; jj < len; jj++) {
+      gdouble v = (gdouble) d[ii + jj] * pattern[jj];
+
+      v = CLAMP (v, -2147483648.0, 2147483647.0);
+      d[ii + jj] = (gint32) (v + (v >= 0 ? 0.5 : -0.5));
+    }
+  }
+}
+
+#ifdef GST_WASAPI_CPU_X86
+/* The period is a multiple of 8, every register of samples has one of
+ * factors */
+static GST_WASAPI_TARGET ("avx2") void
+gain_f32_avx2 (gpointer data, gsize n, const gfloat * pattern, gsize period)
+{
+  gfloat *d = data;
+  gsize ii = 0, jj;
+
+  for (; ii + period <= n; ii += period) {
+    for (jj = 0; jj < period; jj += 8) {
+      __m256 v = _mm256_loadu_ps (d + ii + jj);
+
+      _mm256_storeu_ps (d + ii + jj, _mm256_mul_ps (v,
+              _mm256_loadu_ps (pattern + jj)));
+    }
+  }
+
+  for (jj = 0; ii + jj < n; jj++)
+    d[ii + jj] *= pattern[jj];
+}
+#elif defined(GST_WASAPI_CPU_ARM64)
+/* NEON version, two registers of samples per 8 factors */
+static void
+gain_f32_neon (gpointer data, gsize n, const gfloat * pattern, gsize period)
+{
+  gfloat *d = data;
+  gsize ii = 0, jj;
+
+  for (; ii + period <= n; ii += period) {
+    for (jj = 0; jj < period; jj += 4) {
+      float32x4_t v = vld1q_f32 (d + ii + jj);
+
+      vst1q_f32 (d + ii + jj, vmulq_f32 (v, vld1q_f32 (pattern + jj)));
+    }
+  }
+
+  for (jj = 0; ii + jj < n; jj++)
+    d[ii + jj] *= pattern[jj];
+}
+#endif
+
+#define DEFINE_DELAY(name, type) \
+static void \
+delay_##name (gpointer data, guint n_frames, gint stride, gpointer line, \
+    guint delay, gpointer scratch) \
+{ \
+  type *d = data, *l = line, *s = scratch; \
+  guint ii; \
+  \
+  /* The channel as it came, its end is the next delay line */ \
+  for (ii = 0; ii < n_frames; ii++) \
+    s[ii] = d[(gsize) ii * stride]; \
+  \
+  for (ii = 0; ii < MIN (delay, n_frames); ii++) \
+    d[(gsize) ii * stride] = l[ii]; \
+  for (; ii < n_frames; ii++) \
+    d[(gsize) ii * stride] = s[ii - delay]; \
+  \
+  if (n_frames >= delay) { \
+    memcpy (l, s + n_frames - delay, delay * sizeof (type)); \
+  } else { \
+    memmove (l, l + n_frames, (delay - n_frames) * sizeof (type)); \
+    memcpy (l + delay - n_frames, s, n_frames * sizeof (type)); \
+  } \
+}
+
+DEFINE_DELAY (16, guint16);
+DEFINE_DELAY (32, guint32);
+
+GstWasapiTrim *
+gst_wasapi_trim_new (const WAVEFORMATEX * format, const guint * delays,
+    const gfloat * gains)
+{
+  GstWasapiTrim *self;
+  GstWasapiTrimGainFunc gain_func;
+  gboolean is_float;
+  gint i;
+
+  if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+    is_float = TRUE;
+  else if (format->wFormatTag == WAVE_FORMAT_PCM)
+    is_float = FALSE;
+  else if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    is_float = IsEqualGUID (&((WAVEFORMATEXTENSIBLE *) format)->SubFormat,
+        &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+  else
+    return NULL;
+
+  if (is_float && format->wBitsPerSample == 32)
+    gain_func = gain_f32;
+  else if (!is_float && format->wBitsPerSample == 16)
+    gain_func = gain_s16;
+  else if (!is_float && format->wBitsPerSample == 32)
+    gain_func = gain_s32;
+  else
+    return NULL;
+
+#ifdef GST_WASAPI_CPU_X86
+  if (gain_func == gain_f32 &&
+      (gst_wasapi_cpu_get_flags () & GST_WASAPI_CPU_AVX2))
+    gain_func = gain_f32_avx2;
+#elif defined(GST_WASAPI_CPU_ARM64)
+  if (gain_func == gain_f32 &&
+      (gst_wasapi_cpu_get_flags () & GST_WASAPI_CPU_NEON))
+    gain_func = gain_f32_neon;
+#endif
+
+  self = g_slice_new0 (GstWasapiTrim);
+  self->gain_func = gain_func;
+  self->channels = format->nChannels;
+  self->width = format->wBitsPerSample / 8;
+  self->delay_func = self->width == 2 ? delay_16 : delay_32;
+
+  self->delays = g_new0 (guint, self->channels);
+  self->lines = g_new0 (gpointer, self->channels);
+  for (i = 0; i < self->channels; i++) {
+    self->delays[i] = delays[i];
+    if (delays[i] > 0)
+      self->lines[i] = g_malloc0 ((gsize) delays[i] * self->width);
+    GST_DEBUG ("channel %d: delay %u frames, gain %f", i, delays[i],
+        gains[i]);
+  }
+  gst_wasapi_trim_set_gains (self, gains);
+
+  return self;
+}
+
+void
+gst_wasapi_trim_free (GstWasapiTrim * self)
+{
+  gint i;
+
+  for (i = 0; i < self->channels; i++)
+    g_free (self->lines[i]);
+  g_free (self->lines);
+  g_free (self->delays);
+  g_free (self->scratch);
+  g_free (self->pattern);
+  g_slice_free (GstWasapiTrim, self);
+}
+
+void
+gst_wasapi_trim_set_gains (GstWasapiTrim * self, const gfloat * gains)
+{
+  gboolean unity = TRUE;
+  gint i, j;
+
+  for (i = 0; i < self->channels; i++)
+    unity &= gains[i] == 1.0f;
+
+  if (unity) {
+    g_clear_pointer (&self->pattern, g_free);
+    return;
+  }
+
+  if (self->pattern == NULL)
+    self->pattern = g_new (gfloat, self->channels * GAIN_LANES);
+  for (j = 0; j < GAIN_LANES; j++)
+    for (i = 0; i < self->channels; i++)
+      self->pattern[j * self->channels + i] = gains[i];
+}
+
+void
+gst_wasapi_trim_reset (GstWasapiTrim * self)
+{
+  gint i;
+
+  for (i = 0; i < self->channels; i++)
+    if (self->delays[i] > 0)
+      memset (self->lines[i], 0, (gsize) self->delays[i] * self->width);
+}
+
+void
+gst_wasapi_trim_process (GstWasapiTrim * self, gpointer data, guint n_frames)
+{
+  guint8 *d = data;
+  gint i;
+
+  for (i = 0; i < self->channels; i++) {
+    if (self->delays[i] == 0)
+      continue;
+
+    /* Packets don't grow past the device buffer, this settles quickly */
+    if (n_frames > self->scratch_frames) {
+      g_free (self->scratch);
+      self->scratch = g_malloc ((gsize) n_frames * self->width);
+      self->scratch_frames = n_frames;
+    }
+    self->delay_func (d + i * self->width, n_frames, self->channels,
+        self->lines[i], self->delays[i], self->scratch);
+  }
+
+  if (self->pattern != NULL)
+    self->gain_func (data, (gsize) n_frames * self->channels, self->pattern,
+        (gsize) self->channels * GAIN_LANES);
+}
@@ -0,0 +1,54 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_TRIM_H__
+#define __GST_WASAPI_TRIM_H__
+
+#include "gstwasapiutil.h"
+
+G_BEGIN_DECLS
+
+/* Per-channel delay and gain of wasapisink with channel-delays or
+ * channel-gains, for aligning speakers at different distances.
+ *
+ * Works in place on the device buffer, after the samples were copied or
+ * converted into it, so it costs no copy of its own. A delayed channel
+ * keeps its last samples in a delay line and plays them at the start of
+ * the next packet. The gain is one pass over the packet with a factor per
+ * channel, in AVX2 for float samples where there is that. */
+typedef struct _GstWasapiTrim GstWasapiTrim;
+
+/* With a delay in frames and a linear gain for each channel of @format,
+ * in the order of the endpoint. NULL unless @format is 32 bit float or 16
+ * or 32 bit integer PCM. */
+GstWasapiTrim *gst_wasapi_trim_new (const WAVEFORMATEX * format,
+    const guint * delays, const gfloat * gains);
+
+void gst_wasapi_trim_free (GstWasapiTrim * trim);
+
+/* Takes new gains, as in new() */
+void gst_wasapi_trim_set_gains (GstWasapiTrim * trim, const gfloat * gains);
+
+/* Empties the delay lines, after a flush */
+void gst_wasapi_trim_reset (GstWasapiTrim * trim);
+
+/* Delays and scales the @n_frames at @data */
+void gst_wasapi_trim_process (GstWasapiTrim * trim, gpointer data,
+    guint n_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_TRIM_H__ */
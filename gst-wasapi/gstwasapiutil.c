@@ -24,11 +24,37 @@
 
 #include "gstwasapiutil.h"
 #include "gstwasapidevice.h"
-#include "gstwasapisrc.h"
+#include "gstwasapidevicecache.h"
+#include "gstwasapifake.h"
+#include "gstwasapinotify.h"
+#include "gstwasapistats.h"
+
+#include <psapi.h>
 
 GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
 #define GST_CAT_DEFAULT gst_wasapi_debug
 
+/* Buffer time we ask for with offloaded streams, in microseconds, so the CPU
+ * can sleep while the hardware plays */
+#define OFFLOAD_BUFFER_TIME   (G_USEC_PER_SEC)
+
+/* Attempts at mapping the two views of a mirrored ring next to each other
+ * without placeholders, another thread may take the address in between */
+#define MIRROR_ATTEMPTS 16
+
+#ifndef MEM_RESERVE_PLACEHOLDER
+#define MEM_RESERVE_PLACEHOLDER 0x00040000
+#define MEM_REPLACE_PLACEHOLDER 0x00004000
+#define MEM_PRESERVE_PLACEHOLDER 0x00000002
+#endif
+
+/* Endpoints described at once while enumerating */
+#define PROBE_THREADS 4
+
+/* The audio service answers within milliseconds, unless the process is
+ * being torn down */
+#define ACTIVATE_TIMEOUT_MS 5000
+
 /* This was only added to MinGW in ~2015 and our Cerbero toolchain is too old */
 #if defined(_MSC_VER)
 #include <functiondiscoverykeys_devpkey.h>
@@ -63,6 +89,52 @@ const IID IID_IAudioClient3 = { 0x7ed4ee07, 0x8e67, 0x4cd4,
   {0x8c, 0x1a, 0x2b, 0x7a, 0x59, 0x87, 0xad, 0x42}
 };
 
+/* IEC 61937 subtypes of ksmedia.h, which not all SDKs have */
+static const GUID gst_wasapi_subtype_iec61937_dolby_digital = { 0x00000092,
+  0x0000, 0x0010, {0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71}
+};
+
+static const GUID gst_wasapi_subtype_iec61937_dolby_digital_plus = {
+  0x0000000a, 0x0cea, 0x0010, {0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71}
+};
+
+static const GUID gst_wasapi_subtype_iec61937_dts = { 0x00000008, 0x0000,
+  0x0010, {0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71}
+};
+
+const IID IID_IAudioEffectsManager = { 0x4460b3ae, 0x4b44, 0x4527,
+  {0x86, 0x76, 0x75, 0x48, 0xa8, 0xac, 0xd2, 0x60}
+};
+
+/* The AUDIO_EFFECT_TYPE_* of ksmedia.h we report, in the order of the
+ * fields of gst_wasapi_util_get_audio_effects(). Only the first three are
+ * turned on by it. */
+static const struct
+{
+  GUID id;
+  const gchar *field;
+} gst_wasapi_audio_effects[] = {
+  {{0x6f64adbe, 0x8211, 0x11e2, {0x8c, 0x70, 0x2c, 0x27, 0xd7, 0xf0, 0x01,
+                  0xfa}}, "echo-cancellation"},
+  {{0x6f64adbf, 0x8211, 0x11e2, {0x8c, 0x70, 0x2c, 0x27, 0xd7, 0xf0, 0x01,
+                  0xfa}}, "noise-suppression"},
+  {{0x6f64adc0, 0x8211, 0x11e2, {0x8c, 0x70, 0x2c, 0x27, 0xd7, 0xf0, 0x01,
+                  0xfa}}, "automatic-gain-control"},
+  {{0x6f64adc1, 0x8211, 0x11e2, {0x8c, 0x70, 0x2c, 0x27, 0xd7, 0xf0, 0x01,
+                  0xfa}}, "beamforming"},
+};
+
+#define N_ENABLE_EFFECTS 3
+
+/* DEVINTERFACE_AUDIO_RENDER and _CAPTURE, the virtual default devices */
+static const GUID gst_wasapi_devinterface_audio_render = { 0xe6327cad,
+  0xdcec, 0x4949, {0xae, 0x8a, 0x99, 0x1e, 0x97, 0x6a, 0x79, 0xd2}
+};
+
+static const GUID gst_wasapi_devinterface_audio_capture = { 0x2eef81be,
+  0x33fa, 0x4800, {0x96, 0x70, 0x1c, 0xd4, 0x74, 0x97, 0x2c, 0x3f}
+};
+
 const IID IID_IAudioClock = { 0xcd63314f, 0x3fba, 0x4a1b,
   {0x81, 0x2c, 0xef, 0x96, 0x35, 0x87, 0x28, 0xe7}
 };
@@ -75,12 +147,21 @@ const IID IID_IAudioRenderClient = { 0xf294acfc, 0x3146, 0x4483,
   {0xa7, 0xbf, 0xad, 0xdc, 0xa7, 0xc2, 0x60, 0xe2}
 };
 
+const IID IID_IAudioClockAdjustment = { 0xf6e4c0a0, 0x46d9, 0x4fb8,
+  {0xbe, 0x21, 0x57, 0xa3, 0xef, 0x2b, 0x62, 0x6c}
+};
+
+const IID IID_IAudioStreamVolume = { 0x93014887, 0x242d, 0x4068,
+  {0x8a, 0x15, 0xcf, 0x5e, 0x93, 0xb9, 0x0f, 0xe3}
+};
+
 const IID IID_IMMNotificationClient = { 0x7991eec9, 0x7e89, 0x4d85,
   {0x83, 0x90, 0x6c, 0x70, 0x3c, 0xec, 0x60, 0xc0}
 };
 
+/* Indexed by the bit of the position in dwChannelMask */
 /* *INDENT-OFF* */
-static struct
+static const struct
 {
   guint64 wasapi_pos;
   GstAudioChannelPosition gst_pos;
@@ -96,7 +177,6 @@ static struct
   {SPEAKER_FRONT_RIGHT_OF_CENTER,
       GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT_OF_CENTER},
   {SPEAKER_BACK_CENTER, GST_AUDIO_CHANNEL_POSITION_REAR_CENTER},
-  /* Enum values diverge from this point onwards */
   {SPEAKER_SIDE_LEFT, GST_AUDIO_CHANNEL_POSITION_SIDE_LEFT},
   {SPEAKER_SIDE_RIGHT, GST_AUDIO_CHANNEL_POSITION_SIDE_RIGHT},
   {SPEAKER_TOP_CENTER, GST_AUDIO_CHANNEL_POSITION_TOP_CENTER},
@@ -107,6 +187,25 @@ static struct
   {SPEAKER_TOP_BACK_CENTER, GST_AUDIO_CHANNEL_POSITION_TOP_REAR_CENTER},
   {SPEAKER_TOP_BACK_RIGHT, GST_AUDIO_CHANNEL_POSITION_TOP_REAR_RIGHT}
 };
+
+/* Sample formats by subtype, container and valid bits. 8 bit PCM is
+ * unsigned in WAVE. */
+static const struct
+{
+  gboolean is_float;
+  WORD bits;
+  WORD valid_bits;
+  GstAudioFormat format;
+} wasapi_formats[] = {
+  {FALSE, 8, 8, GST_AUDIO_FORMAT_U8},
+  {FALSE, 16, 16, GST_AUDIO_FORMAT_S16LE},
+  {FALSE, 24, 20, GST_AUDIO_FORMAT_S20LE},
+  {FALSE, 24, 24, GST_AUDIO_FORMAT_S24LE},
+  {FALSE, 32, 24, GST_AUDIO_FORMAT_S24_32LE},
+  {FALSE, 32, 32, GST_AUDIO_FORMAT_S32LE},
+  {TRUE, 32, 32, GST_AUDIO_FORMAT_F32LE},
+  {TRUE, 64, 64, GST_AUDIO_FORMAT_F64LE}
+};
 /* *INDENT-ON* */
 
 static int windows_major_version = 0;
@@ -118,6 +217,7 @@ static struct
 
     HANDLE (WINAPI * AvSetMmThreadCharacteristics) (LPCSTR, LPDWORD);
     BOOL (WINAPI * AvRevertMmThreadCharacteristics) (HANDLE);
+    BOOL (WINAPI * AvSetMmThreadPriority) (HANDLE, gint);
 } gst_wasapi_avrt_tbl = {
 0};
 
@@ -127,7 +227,8 @@ gst_wasapi_util_have_audioclient3 (void)
   if (windows_major_version > 0)
     return windows_major_version == 10;
 
-  if (g_getenv ("GST_WASAPI_DISABLE_AUDIOCLIENT3") != NULL) {
+  if (g_getenv ("GST_WASAPI_DISABLE_AUDIOCLIENT3") != NULL ||
+      gst_wasapi_fake_enabled ()) {
     windows_major_version = 6;
     return FALSE;
   }
@@ -164,6 +265,196 @@ gst_wasapi_device_role_get_type (void)
   return id;
 }
 
+GType
+gst_wasapi_stream_category_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_STREAM_CATEGORY_OTHER, "Other", "other"},
+    {GST_WASAPI_STREAM_CATEGORY_COMMUNICATIONS,
+        "Real-time communications, like VoIP", "communications"},
+    {GST_WASAPI_STREAM_CATEGORY_ALERTS, "Alerts, like ring tones", "alerts"},
+    {GST_WASAPI_STREAM_CATEGORY_SOUND_EFFECTS, "Sound effects",
+        "sound-effects"},
+    {GST_WASAPI_STREAM_CATEGORY_GAME_EFFECTS, "Game sound effects",
+        "game-effects"},
+    {GST_WASAPI_STREAM_CATEGORY_GAME_MEDIA, "Background music of games",
+        "game-media"},
+    {GST_WASAPI_STREAM_CATEGORY_GAME_CHAT,
+        "Voice chat of games, doesn't duck other streams", "game-chat"},
+    {GST_WASAPI_STREAM_CATEGORY_SPEECH, "Speech recognition", "speech"},
+    {GST_WASAPI_STREAM_CATEGORY_MOVIE, "Movies", "movie"},
+    {GST_WASAPI_STREAM_CATEGORY_MEDIA, "Music and other media", "media"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiStreamCategory", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_wasapi_drift_correction_method_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_DRIFT_CORRECTION_RESAMPLE,
+        "Resample continuously, where the format allows it", "resample"},
+    {GST_WASAPI_DRIFT_CORRECTION_SPLICE,
+          "Drop or duplicate single frames at quiet points, with a crossfade",
+        "splice"},
+    {GST_WASAPI_DRIFT_CORRECTION_ENGINE,
+          "Have the audio engine adjust the sample rate of shared mode "
+          "streams, resample otherwise", "engine"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiDriftCorrectionMethod", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_wasapi_catchup_policy_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_CATCHUP_DISCONT,
+        "Skip to the newest segment and mark the buffer DISCONT", "discont"},
+    {GST_WASAPI_CATCHUP_FADE,
+          "Skip to the newest segment and fade that in, without DISCONT",
+        "fade"},
+    {GST_WASAPI_CATCHUP_COMPRESS,
+          "Drop frames at quiet points of each buffer while far behind, "
+          "skipping like fade only if that isn't enough", "compress"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiCatchupPolicy", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_wasapi_timestamp_mode_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_TIMESTAMP_MODE_DEVICE,
+        "From the device position, or the clock when slaved", "device"},
+    {GST_WASAPI_TIMESTAMP_MODE_QPC,
+        "QPC capture time of each packet, smoothed", "qpc"},
+    {GST_WASAPI_TIMESTAMP_MODE_SYSTEM,
+        "Pipeline clock when the buffer is taken, smoothed", "system"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiTimestampMode", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_wasapi_level_mode_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_LEVEL_MODE_NONE, "No level messages", "none"},
+    {GST_WASAPI_LEVEL_MODE_SAMPLES,
+        "Peak and RMS of the captured samples", "samples"},
+    {GST_WASAPI_LEVEL_MODE_ENDPOINT,
+        "Peak reported by the endpoint meter, samples are not looked at",
+        "endpoint"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiLevelMode", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_wasapi_scheduling_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_SCHEDULING_EVENT, "Events of the device", "event"},
+    {GST_WASAPI_SCHEDULING_TIMER,
+        "A high resolution timer at the device period, polling for packets",
+        "timer"},
+    {GST_WASAPI_SCHEDULING_POWER_SAVING,
+        "A coalescable timer once per segment of latency-time, reading "
+          "several periods per wakeup", "power-saving"},
+    {GST_WASAPI_SCHEDULING_SPIN,
+          "Sleep until shortly before the next device period and poll for it, "
+          "busy on one core", "spin"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiScheduling", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_wasapi_mmcss_priority_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {GST_WASAPI_MMCSS_PRIORITY_LOW, "Low", "low"},
+    {GST_WASAPI_MMCSS_PRIORITY_NORMAL, "Normal", "normal"},
+    {GST_WASAPI_MMCSS_PRIORITY_HIGH, "High", "high"},
+    {GST_WASAPI_MMCSS_PRIORITY_CRITICAL, "Critical", "critical"},
+    {0, NULL, NULL}
+  };
+  static volatile GType id = 0;
+
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+
+    _id = g_enum_register_static ("GstWasapiMmcssPriority", values);
+
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
 gint
 gst_wasapi_device_role_to_erole (gint role)
 {
@@ -194,8 +485,10 @@ gst_wasapi_erole_to_device_role (gint erole)
   }
 }
 
-static const gchar *
-hresult_to_string_fallback (HRESULT hr)
+/* Static name of the common WASAPI error codes, doesn't allocate so it can
+ * be used from the realtime threads */
+const gchar *
+gst_wasapi_util_hresult_to_static_string (HRESULT hr)
 {
   const gchar *s = "unknown error";
 
@@ -212,6 +505,9 @@ hresult_to_string_fallback (HRESULT hr)
     case AUDCLNT_E_DEVICE_INVALIDATED:
       s = "AUDCLNT_E_DEVICE_INVALIDATED";
       break;
+    case AUDCLNT_E_RESOURCES_INVALIDATED:
+      s = "AUDCLNT_E_RESOURCES_INVALIDATED";
+      break;
     case AUDCLNT_E_NOT_STOPPED:
       s = "AUDCLNT_E_NOT_STOPPED";
       break;
@@ -306,7 +602,7 @@ gst_wasapi_util_hresult_to_string (HRESULT hr)
 
   /* If we couldn't get the error msg, try the fallback switch statement */
   if (error_text == NULL)
-    return g_strdup (hresult_to_string_fallback (hr));
+    return g_strdup (gst_wasapi_util_hresult_to_static_string (hr));
 
 #ifdef UNICODE
   /* If UNICODE is defined, LPTSTR is LPWSTR which is UTF-16 */
@@ -319,35 +615,292 @@ gst_wasapi_util_hresult_to_string (HRESULT hr)
   return ret_text;
 }
 
-static IMMDeviceEnumerator *
-gst_wasapi_util_get_device_enumerator (GstElement * self)
+/* The engine mixes in 32 bit float at the rate and in the channels of the
+ * device format, which the property store has without activating the
+ * endpoint. That can wake up a bluetooth headset and take seconds. */
+static GstCaps *
+gst_wasapi_util_get_mix_caps_from_store (IPropertyStore * prop_store)
 {
+  static GstStaticCaps raw_caps = GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS);
+  WAVEFORMATEXTENSIBLE format = { 0, };
+  GstAudioChannelPosition *positions = NULL;
+  GstCaps *template_caps, *caps = NULL;
+  PROPVARIANT var;
   HRESULT hr;
-  IMMDeviceEnumerator *enumerator = NULL;
 
-  hr = CoCreateInstance (&CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
-      &IID_IMMDeviceEnumerator, (void **) &enumerator);
-  HR_FAILED_RET (hr, CoCreateInstance (MMDeviceEnumerator), NULL);
+  PropVariantInit (&var);
+
+  hr = IPropertyStore_GetValue (prop_store, &PKEY_AudioEngine_DeviceFormat,
+      &var);
+  if (hr != S_OK || var.vt != VT_BLOB ||
+      var.blob.cbSize < sizeof (WAVEFORMATEX))
+    goto out;
+
+  memcpy (&format, var.blob.pBlobData, MIN (var.blob.cbSize, sizeof (format)));
+  if (format.Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+      var.blob.cbSize < sizeof (WAVEFORMATEXTENSIBLE))
+    goto out;
+
+  template_caps = gst_static_caps_get (&raw_caps);
+  gst_wasapi_util_parse_waveformatex (&format, template_caps, &caps,
+      &positions);
+  gst_caps_unref (template_caps);
+  g_free (positions);
+
+  if (caps != NULL)
+    gst_caps_set_simple (caps, "format", G_TYPE_STRING,
+        GST_AUDIO_NE (F32), NULL);
+
+out:
+  PropVariantClear (&var);
+  return caps;
+}
+
+/* PKEY_AudioEndpoint_FormFactor, not every SDK declares it */
+static const PROPERTYKEY form_factor_key = {
+  {0x1da5d803, 0xd492, 0x4edd, {0x8c, 0x23, 0xe0, 0xc0, 0xff, 0xee, 0x7f,
+          0x0e}}, 0
+};
+
+/* Indexed by EndpointFormFactor */
+static const gchar *form_factors[] = {
+  "remote-network-device", "speakers", "line-level", "headphones",
+  "microphone", "headset", "handset", "unknown-digital-passthrough", "spdif",
+  "digital-audio-display-device"
+};
+
+static const gchar *
+gst_wasapi_util_get_form_factor (IPropertyStore * prop_store)
+{
+  const gchar *ret = "unknown";
+  PROPVARIANT var;
+  HRESULT hr;
+
+  PropVariantInit (&var);
+  hr = IPropertyStore_GetValue (prop_store, &form_factor_key, &var);
+  if (hr == S_OK && var.vt == VT_UI4 && var.ulVal < G_N_ELEMENTS (form_factors))
+    ret = form_factors[var.ulVal];
+  PropVariantClear (&var);
+
+  return ret;
+}
+
+/* What it takes to pick an endpoint and settings for low latency, without
+ * opening it. Activates @item unless it's cached already. */
+static void
+gst_wasapi_util_add_capabilities (GstElement * self, IMMDevice * item,
+    GstStructure * props)
+{
+  REFERENCE_TIME default_period, min_period;
+  guint engine_default, engine_fundamental, engine_min, engine_max;
+  GstCaps *exclusive_caps;
+  gboolean low_latency;
+
+  if (gst_wasapi_device_cache_get_periods (self, item, NULL, &default_period,
+          &min_period))
+    gst_structure_set (props,
+        "wasapi.device.default-period", G_TYPE_UINT64,
+        (guint64) default_period * 100,
+        "wasapi.device.min-period", G_TYPE_UINT64,
+        (guint64) min_period * 100, NULL);
+
+  low_latency = gst_wasapi_device_cache_get_engine_periods (self, item, NULL,
+      &engine_default, &engine_fundamental, &engine_min, &engine_max);
+  gst_structure_set (props, "wasapi.device.low-latency", G_TYPE_BOOLEAN,
+      low_latency, NULL);
+  if (low_latency)
+    gst_structure_set (props,
+        "wasapi.device.engine-default-frames", G_TYPE_UINT, engine_default,
+        "wasapi.device.engine-fundamental-frames", G_TYPE_UINT,
+        engine_fundamental,
+        "wasapi.device.engine-min-frames", G_TYPE_UINT, engine_min,
+        "wasapi.device.engine-max-frames", G_TYPE_UINT, engine_max, NULL);
+
+  exclusive_caps = gst_wasapi_device_cache_get_exclusive_caps (self, item,
+      NULL);
+  gst_structure_set (props, "wasapi.device.exclusive-caps", GST_TYPE_CAPS,
+      exclusive_caps, NULL);
+  gst_caps_unref (exclusive_caps);
+}
+
+GstDevice *
+gst_wasapi_util_new_device (GstElement * self, IMMDevice * item,
+    gboolean probe)
+{
+  IMMEndpoint *endpoint = NULL;
+  IPropertyStore *prop_store = NULL;
+  WAVEFORMATEX *format = NULL;
+  GstAudioChannelPosition *positions = NULL;
+  const gchar *device_class, *element_name;
+  gchar *description = NULL;
+  gchar *strid = NULL;
+  gchar *container_id;
+  GstDevice *device = NULL;
+  EDataFlow dataflow;
+  PROPVARIANT var;
+  wchar_t *wstrid;
+  GstStructure *props;
+  GstCaps *caps;
+  HRESULT hr;
+
+  PropVariantInit (&var);
+
+  hr = IMMDevice_QueryInterface (item, &IID_IMMEndpoint, (void **) &endpoint);
+  if (hr != S_OK)
+    goto out;
+
+  hr = IMMEndpoint_GetDataFlow (endpoint, &dataflow);
+  if (hr != S_OK)
+    goto out;
+
+  if (dataflow == eRender) {
+    device_class = "Audio/Sink";
+    element_name = "wasapisink";
+  } else {
+    device_class = "Audio/Source";
+    element_name = "wasapisrc";
+  }
+
+  hr = IMMDevice_GetId (item, &wstrid);
+  if (hr != S_OK)
+    goto out;
+  strid = g_utf16_to_utf8 (wstrid, -1, NULL, NULL, NULL);
+  CoTaskMemFree (wstrid);
+
+  hr = IMMDevice_OpenPropertyStore (item, STGM_READ, &prop_store);
+  if (hr != S_OK)
+    goto out;
+
+  /* NOTE: More properties can be added as needed from here:
+   * https://msdn.microsoft.com/en-us/library/windows/desktop/dd370794(v=vs.85).aspx */
+  hr = IPropertyStore_GetValue (prop_store, &PKEY_Device_FriendlyName, &var);
+  if (hr != S_OK)
+    goto out;
+  description = g_utf16_to_utf8 (var.pwszVal, -1, NULL, NULL, NULL);
+
+  /* Otherwise the caps of the mix format for shared mode, shared with the
+   * elements so the device is only activated when it's not cached yet */
+  caps = gst_wasapi_util_get_mix_caps_from_store (prop_store);
+  if (caps == NULL && !gst_wasapi_device_cache_get_format (self, item, NULL,
+          AUDCLNT_SHAREMODE_SHARED, &format, &caps, &positions)) {
+    GST_ERROR_OBJECT (self, "failed to get the mix format of %s", strid);
+    goto out;
+  }
+
+  /* Set some useful properties */
+  props = gst_structure_new ("wasapi-proplist",
+      "device.api", G_TYPE_STRING, "wasapi",
+      "device.strid", G_TYPE_STRING, GST_STR_NULL (strid),
+      "wasapi.device.description", G_TYPE_STRING, description,
+      "wasapi.device.form-factor", G_TYPE_STRING,
+      gst_wasapi_util_get_form_factor (prop_store), NULL);
+  if ((container_id = gst_wasapi_util_get_container_id (item))) {
+    gst_structure_set (props, "wasapi.device.container-id", G_TYPE_STRING,
+        container_id, NULL);
+    g_free (container_id);
+  }
+  if (probe)
+    gst_wasapi_util_add_capabilities (self, item, props);
+
+  device = g_object_new (GST_TYPE_WASAPI_DEVICE, "device", strid,
+      "display-name", description, "caps", caps,
+      "device-class", device_class, "properties", props, NULL);
+  GST_WASAPI_DEVICE (device)->element = element_name;
+
+  gst_structure_free (props);
+  gst_caps_unref (caps);
+
+out:
+  PropVariantClear (&var);
+  if (prop_store)
+    IUnknown_Release (prop_store);
+  if (endpoint)
+    IUnknown_Release (endpoint);
+  if (format)
+    CoTaskMemFree (format);
+  g_free (positions);
+  g_free (description);
+  g_free (strid);
+  return device;
+}
+
+GstDevice *
+gst_wasapi_util_new_loopback_device (GstDevice * device)
+{
+  GstWasapiDevice *render = GST_WASAPI_DEVICE (device);
+  GstDevice *loopback;
+  GstStructure *props;
+  GstCaps *caps;
+  gchar *name, *description;
+
+  if (render->loopback || g_strcmp0 (render->element, "wasapisink") != 0)
+    return NULL;
+
+  /* What describes the endpoint is the same, the mix format is what
+   * loopback captures in */
+  name = gst_device_get_display_name (device);
+  description = g_strdup_printf ("%s (loopback)", name);
+  caps = gst_device_get_caps (device);
+  props = gst_device_get_properties (device);
+  gst_structure_set (props, "wasapi.device.loopback", G_TYPE_BOOLEAN, TRUE,
+      NULL);
+
+  loopback = g_object_new (GST_TYPE_WASAPI_DEVICE, "device", render->strid,
+      "display-name", description, "caps", caps,
+      "device-class", "Audio/Source", "properties", props, NULL);
+  GST_WASAPI_DEVICE (loopback)->element = "wasapisrc";
+  GST_WASAPI_DEVICE (loopback)->loopback = TRUE;
+
+  gst_structure_free (props);
+  gst_caps_unref (caps);
+  g_free (description);
+  g_free (name);
+
+  return loopback;
+}
+
+typedef struct
+{
+  GstElement *element;
+  IMMDeviceEnumerator *enumerator;
+  LPWSTR wid;
+  gboolean probe;
+  GstDevice *device;
+} GstWasapiProbeTask;
+
+/* On a thread of the probe pool. The endpoint is opened again from the
+ * enumerator, which is free threaded, rather than passing the device of
+ * the collection between apartments. */
+static void
+gst_wasapi_util_probe_device (GstWasapiProbeTask * task, gpointer user_data)
+{
+  IMMDevice *item = NULL;
+  HRESULT hr;
 
-  return enumerator;
+  hr = IMMDeviceEnumerator_GetDevice (task->enumerator, task->wid, &item);
+  if (hr == S_OK) {
+    task->device = gst_wasapi_util_new_device (task->element, item,
+        task->probe);
+    IUnknown_Release (item);
+  }
 }
 
 gboolean
 gst_wasapi_util_get_devices (GstElement * self, gboolean active,
-    GList ** devices)
+    gboolean probe, GList ** devices)
 {
   gboolean res = FALSE;
-  static GstStaticCaps scaps = GST_STATIC_CAPS (GST_WASAPI_STATIC_CAPS);
   DWORD dwStateMask = active ? DEVICE_STATE_ACTIVE : DEVICE_STATEMASK_ALL;
   IMMDeviceCollection *device_collection = NULL;
   IMMDeviceEnumerator *enumerator = NULL;
-  const gchar *device_class, *element_name;
+  GstWasapiProbeTask *tasks = NULL;
+  GThreadPool *pool;
   guint ii, count;
   HRESULT hr;
 
   *devices = NULL;
 
-  enumerator = gst_wasapi_util_get_device_enumerator (self);
+  enumerator = gst_wasapi_notify_get_enumerator (self);
   if (!enumerator)
     return FALSE;
 
@@ -358,117 +911,52 @@ gst_wasapi_util_get_devices (GstElement * self, gboolean active,
   hr = IMMDeviceCollection_GetCount (device_collection, &count);
   HR_FAILED_GOTO (hr, IMMDeviceCollection::GetCount, err);
 
-  /* Create a GList of GstDevices* to return */
+  if (count == 0) {
+    res = TRUE;
+    goto err;
+  }
+
+  /* Reading the property stores, or activating endpoints that don't have
+   * a device format, can block for a while per endpoint, so describe a
+   * few of them at once */
+  tasks = g_new0 (GstWasapiProbeTask, count);
+  pool = g_thread_pool_new ((GFunc) gst_wasapi_util_probe_device, NULL,
+      MIN (count, PROBE_THREADS), FALSE, NULL);
+
   for (ii = 0; ii < count; ii++) {
     IMMDevice *item = NULL;
-    IMMEndpoint *endpoint = NULL;
-    IAudioClient *client = NULL;
-    IPropertyStore *prop_store = NULL;
-    WAVEFORMATEX *format = NULL;
-    gchar *description = NULL;
-    gchar *strid = NULL;
-    EDataFlow dataflow;
-    PROPVARIANT var;
-    wchar_t *wstrid;
-    GstDevice *device;
-    GstStructure *props;
-    GstCaps *caps;
 
     hr = IMMDeviceCollection_Item (device_collection, ii, &item);
     if (hr != S_OK)
       continue;
 
-    hr = IMMDevice_QueryInterface (item, &IID_IMMEndpoint, (void **) &endpoint);
-    if (hr != S_OK)
-      goto next;
-
-    hr = IMMEndpoint_GetDataFlow (endpoint, &dataflow);
-    if (hr != S_OK)
-      goto next;
-
-    if (dataflow == eRender) {
-      device_class = "Audio/Sink";
-      element_name = "wasapisink";
-    } else {
-      device_class = "Audio/Source";
-      element_name = "wasapisrc";
-    }
-
-    PropVariantInit (&var);
-
-    hr = IMMDevice_GetId (item, &wstrid);
+    hr = IMMDevice_GetId (item, &tasks[ii].wid);
+    IUnknown_Release (item);
     if (hr != S_OK)
-      goto next;
-    strid = g_utf16_to_utf8 (wstrid, -1, NULL, NULL, NULL);
-    CoTaskMemFree (wstrid);
+      continue;
 
-    hr = IMMDevice_OpenPropertyStore (item, STGM_READ, &prop_store);
-    if (hr != S_OK)
-      goto next;
+    tasks[ii].element = self;
+    tasks[ii].enumerator = enumerator;
+    tasks[ii].probe = probe;
+    g_thread_pool_push (pool, &tasks[ii], NULL);
+  }
 
-    /* NOTE: More properties can be added as needed from here:
-     * https://msdn.microsoft.com/en-us/library/windows/desktop/dd370794(v=vs.85).aspx */
-    hr = IPropertyStore_GetValue (prop_store, &PKEY_Device_FriendlyName, &var);
-    if (hr != S_OK)
-      goto next;
-    description = g_utf16_to_utf8 (var.pwszVal, -1, NULL, NULL, NULL);
-    PropVariantClear (&var);
+  g_thread_pool_free (pool, FALSE, TRUE);
 
-    /* Get the audio client so we can fetch the mix format for shared mode
-     * to get the device format for exclusive mode (or something close to that)
-     * fetch PKEY_AudioEngine_DeviceFormat from the property store. */
-    hr = IMMDevice_Activate (item, &IID_IAudioClient, CLSCTX_ALL, NULL,
-        (void **) &client);
-    if (hr != S_OK) {
-      gchar *msg = gst_wasapi_util_hresult_to_string (hr);
-      GST_ERROR_OBJECT (self, "IMMDevice::Activate (IID_IAudioClient) failed"
-          "on %s: %s", strid, msg);
-      g_free (msg);
-      goto next;
-    }
+  /* Create a GList of GstDevices* to return, in the same order as before.
+   * Each render endpoint can also be captured in loopback. */
+  for (ii = 0; ii < count; ii++) {
+    if (tasks[ii].device) {
+      GstDevice *loopback =
+          gst_wasapi_util_new_loopback_device (tasks[ii].device);
 
-    hr = IAudioClient_GetMixFormat (client, &format);
-    if (hr != S_OK || format == NULL) {
-      gchar *msg = gst_wasapi_util_hresult_to_string (hr);
-      GST_ERROR_OBJECT (self, "GetMixFormat failed on %s: %s", strid, msg);
-      g_free (msg);
-      goto next;
+      *devices = g_list_prepend (*devices, tasks[ii].device);
+      if (loopback != NULL)
+        *devices = g_list_prepend (*devices, loopback);
     }
-
-    if (!gst_wasapi_util_parse_waveformatex ((WAVEFORMATEXTENSIBLE *) format,
-            gst_static_caps_get (&scaps), &caps, NULL))
-      goto next;
-
-    /* Set some useful properties */
-    props = gst_structure_new ("wasapi-proplist",
-        "device.api", G_TYPE_STRING, "wasapi",
-        "device.strid", G_TYPE_STRING, GST_STR_NULL (strid),
-        "wasapi.device.description", G_TYPE_STRING, description, NULL);
-
-    device = g_object_new (GST_TYPE_WASAPI_DEVICE, "device", strid,
-        "display-name", description, "caps", caps,
-        "device-class", device_class, "properties", props, NULL);
-    GST_WASAPI_DEVICE (device)->element = element_name;
-
-    gst_structure_free (props);
-    gst_caps_unref (caps);
-    *devices = g_list_prepend (*devices, device);
-
-  next:
-    PropVariantClear (&var);
-    if (prop_store)
-      IUnknown_Release (prop_store);
-    if (endpoint)
-      IUnknown_Release (endpoint);
-    if (client)
-      IUnknown_Release (client);
-    if (item)
-      IUnknown_Release (item);
-    if (description)
-      g_free (description);
-    if (strid)
-      g_free (strid);
+    CoTaskMemFree (tasks[ii].wid);
   }
+  g_free (tasks);
 
   res = TRUE;
 
@@ -480,17 +968,74 @@ err:
   return res;
 }
 
-gboolean
-gst_wasapi_util_get_device_format (GstElement * self,
+gchar *
+gst_wasapi_util_get_device_id (IMMDevice * device)
+{
+  LPWSTR wid = NULL;
+  gchar *id;
+
+  if (FAILED (IMMDevice_GetId (device, &wid)))
+    return NULL;
+
+  id = g_utf16_to_utf8 (wid, -1, NULL, NULL, NULL);
+  CoTaskMemFree (wid);
+
+  return id;
+}
+
+/* PKEY_Device_ContainerId, not every SDK declares it */
+static const PROPERTYKEY container_id_key = {
+  {0x8c7ed206, 0x3f8a, 0x4827, {0xb3, 0xab, 0xae, 0x9e, 0x1f, 0xae, 0xfc,
+          0x6c}}, 2
+};
+
+/* Where the device is the computer itself, like the onboard codec and the
+ * display audio of the graphics card, which don't share a clock */
+static const GUID system_container_id = {
+  0x00000000, 0x0000, 0x0000, {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+};
+
+gchar *
+gst_wasapi_util_get_container_id (IMMDevice * device)
+{
+  IPropertyStore *prop_store = NULL;
+  gchar *id = NULL;
+  PROPVARIANT var;
+  HRESULT hr;
+
+  hr = IMMDevice_OpenPropertyStore (device, STGM_READ, &prop_store);
+  if (FAILED (hr))
+    return NULL;
+
+  PropVariantInit (&var);
+  hr = IPropertyStore_GetValue (prop_store, &container_id_key, &var);
+  if (hr == S_OK && var.vt == VT_CLSID && var.puuid != NULL &&
+      !IsEqualGUID (var.puuid, &system_container_id)) {
+    const GUID *g = var.puuid;
+
+    id = g_strdup_printf ("{%08lx-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}",
+        g->Data1, g->Data2, g->Data3, g->Data4[0], g->Data4[1], g->Data4[2],
+        g->Data4[3], g->Data4[4], g->Data4[5], g->Data4[6], g->Data4[7]);
+  }
+  PropVariantClear (&var);
+  IUnknown_Release (prop_store);
+
+  return id;
+}
+
+gboolean
+gst_wasapi_util_get_device_format (GstElement * self,
     gint device_mode, IMMDevice * device, IAudioClient * client,
     WAVEFORMATEX ** ret_format)
 {
   WAVEFORMATEX *format;
   HRESULT hr;
+  guint64 start = gst_wasapi_util_get_qpc_position ();
 
   *ret_format = NULL;
 
   hr = IAudioClient_GetMixFormat (client, &format);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_MIX_FORMAT, start);
   HR_FAILED_RET (hr, IAudioClient::GetMixFormat, FALSE);
 
   /* WASAPI always accepts the format returned by GetMixFormat in shared mode */
@@ -524,7 +1069,7 @@ gst_wasapi_util_get_device_format (GstElement * self,
       return FALSE;
     }
 
-    format = malloc (var.blob.cbSize);
+    format = CoTaskMemAlloc (var.blob.cbSize);
     memcpy (format, var.blob.pBlobData, var.blob.cbSize);
 
     PropVariantClear (&var);
@@ -538,7 +1083,7 @@ gst_wasapi_util_get_device_format (GstElement * self,
     goto out;
 
   GST_ERROR_OBJECT (self, "AudioEngine DeviceFormat not supported");
-  free (format);
+  CoTaskMemFree (format);
   return FALSE;
 
 out:
@@ -546,109 +1091,6 @@ out:
   return TRUE;
 }
 
-static HRESULT STDMETHODCALLTYPE sIMMNotificationClient_QueryInterface(
-  IMMNotificationClient* This, REFIID riid, void **ppvObject)
-{
-  // Compatible with IMMNotificationClient and IUnknown
-  if (IsEqualGUID(&IID_IMMNotificationClient, riid) ||
-    IsEqualGUID(&IID_IUnknown, riid))
-  {
-    *ppvObject = (void *)This;
-    return S_OK;
-  }
-  else {
-    *ppvObject = NULL;
-    return E_NOINTERFACE;
-  }
-}
-
-// these are required, but not actually used
-static ULONG STDMETHODCALLTYPE sIMMNotificationClient_AddRef(
-  IMMNotificationClient *This)
-{
-  return 1;
-}
-
-// MSDN says it should free itself, but we're static
-static ULONG STDMETHODCALLTYPE sIMMNotificationClient_Release(
-  IMMNotificationClient *This)
-{
-  return 1;
-}
-
-static HRESULT STDMETHODCALLTYPE sIMMNotificationClient_OnDeviceStateChanged(
-  IMMNotificationClient *This,
-  LPCWSTR pwstrDeviceId,
-  DWORD dwNewState)
-{
-  return S_OK;
-}
-
-static HRESULT STDMETHODCALLTYPE sIMMNotificationClient_OnDeviceAdded(
-  IMMNotificationClient *This,
-  LPCWSTR pwstrDeviceId)
-{
-  return S_OK;
-}
-
-// maybe MPV can go over to the preferred device once it is plugged in?
-static HRESULT STDMETHODCALLTYPE sIMMNotificationClient_OnDeviceRemoved(
-  IMMNotificationClient *This,
-  LPCWSTR pwstrDeviceId)
-{
-  return S_OK;
-}
-
-static HRESULT STDMETHODCALLTYPE sIMMNotificationClient_OnDefaultDeviceChanged(
-  IMMNotificationClient *This,
-  EDataFlow flow,
-  ERole role,
-  LPCWSTR pwstrDeviceId)
-{
-  change_notify *change = (change_notify *)This;
-  GST_WARNING("DefaultDeviceChanged");
-  g_atomic_int_set(&change->default_changed, 1);
-  return S_OK;
-}
-
-static HRESULT STDMETHODCALLTYPE sIMMNotificationClient_OnPropertyValueChanged(
-  IMMNotificationClient *This,
-  LPCWSTR pwstrDeviceId,
-  const PROPERTYKEY key)
-{
-  return S_OK;
-}
-
-static CONST_VTBL IMMNotificationClientVtbl sIMMNotificationClientVtbl = {
-  .QueryInterface = sIMMNotificationClient_QueryInterface,
-  .AddRef = sIMMNotificationClient_AddRef,
-  .Release = sIMMNotificationClient_Release,
-  .OnDeviceStateChanged = sIMMNotificationClient_OnDeviceStateChanged,
-  .OnDeviceAdded = sIMMNotificationClient_OnDeviceAdded,
-  .OnDeviceRemoved = sIMMNotificationClient_OnDeviceRemoved,
-  .OnDefaultDeviceChanged = sIMMNotificationClient_OnDefaultDeviceChanged,
-  .OnPropertyValueChanged = sIMMNotificationClient_OnPropertyValueChanged,
-};
-
-gboolean
-gst_wasapi_util_initialize_notification_client(GstElement * element) {
-  GstWasapiSrc * self = element;
-  change_notify * change = &self->change;
-
-  HRESULT hr = CoCreateInstance(&CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
-      &IID_IMMDeviceEnumerator,
-      (void **)&change->pEnumerator);
-  HR_FAILED_RET(hr, CoCreateInstance(MMDeviceEnumerator), FALSE);
-  change->client.lpVtbl = &sIMMNotificationClientVtbl;
-  hr = IMMDeviceEnumerator_RegisterEndpointNotificationCallback(
-    change->pEnumerator, (IMMNotificationClient *)change);
-  if (hr == S_OK) {
-    self->change_initialized = 1;
-    return TRUE;
-  }
-  return FALSE;
-}
-
 gboolean
 gst_wasapi_util_get_device_client (GstElement * self,
     gint data_flow, gint role, const wchar_t * device_strid,
@@ -659,15 +1101,20 @@ gst_wasapi_util_get_device_client (GstElement * self,
   IMMDeviceEnumerator *enumerator = NULL;
   IMMDevice *device = NULL;
   IAudioClient *client = NULL;
+  guint64 t = gst_wasapi_util_get_qpc_position ();
 
-  if (!(enumerator = gst_wasapi_util_get_device_enumerator (self)))
+  if (gst_wasapi_fake_enabled ()) {
+    /* Scripted endpoints, see gstwasapifake.h */
+    device = gst_wasapi_fake_device_new (data_flow);
+  } else if (!(enumerator = gst_wasapi_notify_get_enumerator (self))) {
     goto beach;
-
-  if (!device_strid) {
+  } else if (!device_strid) {
+    t = gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_ENUMERATOR, t);
     hr = IMMDeviceEnumerator_GetDefaultAudioEndpoint (enumerator, data_flow,
         role, &device);
     HR_FAILED_GOTO (hr, IMMDeviceEnumerator::GetDefaultAudioEndpoint, beach);
   } else {
+    t = gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_ENUMERATOR, t);
     hr = IMMDeviceEnumerator_GetDevice (enumerator, device_strid, &device);
     if (hr != S_OK) {
       gchar *msg = gst_wasapi_util_hresult_to_string (hr);
@@ -678,12 +1125,15 @@ gst_wasapi_util_get_device_client (GstElement * self,
     }
   }
 
+  t = gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_ENDPOINT, t);
+
   if (gst_wasapi_util_have_audioclient3 ())
     hr = IMMDevice_Activate (device, &IID_IAudioClient3, CLSCTX_ALL, NULL,
         (void **) &client);
   else
     hr = IMMDevice_Activate (device, &IID_IAudioClient, CLSCTX_ALL, NULL,
         (void **) &client);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_ACTIVATE, t);
   HR_FAILED_GOTO (hr, IMMDevice::Activate (IID_IAudioClient), beach);
 
   IUnknown_AddRef (client);
@@ -706,6 +1156,157 @@ beach:
   return res;
 }
 
+/* The completion handler, which must be agile: the activation completes on
+ * a worker thread of the audio service, while we wait on ours. Reference
+ * counted, the operation may hold on to it after we gave up waiting. */
+typedef struct
+{
+  IActivateAudioInterfaceCompletionHandler handler;
+  volatile gint refcount;
+  HANDLE done;
+} GstWasapiActivateHandler;
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_activate_handler_QueryInterface
+    (IActivateAudioInterfaceCompletionHandler * This, REFIID riid,
+    void **ppvObject)
+{
+  if (IsEqualGUID (&IID_IActivateAudioInterfaceCompletionHandler, riid) ||
+      IsEqualGUID (&IID_IAgileObject, riid) ||
+      IsEqualGUID (&IID_IUnknown, riid)) {
+    IUnknown_AddRef (This);
+    *ppvObject = (void *) This;
+    return S_OK;
+  }
+  *ppvObject = NULL;
+  return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_activate_handler_AddRef (IActivateAudioInterfaceCompletionHandler
+    * This)
+{
+  GstWasapiActivateHandler *self = (GstWasapiActivateHandler *) This;
+
+  return g_atomic_int_add (&self->refcount, 1) + 1;
+}
+
+static ULONG STDMETHODCALLTYPE
+gst_wasapi_activate_handler_Release (IActivateAudioInterfaceCompletionHandler
+    * This)
+{
+  GstWasapiActivateHandler *self = (GstWasapiActivateHandler *) This;
+
+  if (!g_atomic_int_dec_and_test (&self->refcount))
+    return 1;
+
+  CloseHandle (self->done);
+  g_slice_free (GstWasapiActivateHandler, self);
+  return 0;
+}
+
+static HRESULT STDMETHODCALLTYPE
+gst_wasapi_activate_handler_ActivateCompleted
+    (IActivateAudioInterfaceCompletionHandler * This,
+    IActivateAudioInterfaceAsyncOperation * operation)
+{
+  GstWasapiActivateHandler *self = (GstWasapiActivateHandler *) This;
+
+  SetEvent (self->done);
+  return S_OK;
+}
+
+static CONST_VTBL IActivateAudioInterfaceCompletionHandlerVtbl
+    activate_handler_vtbl = {
+  .QueryInterface = gst_wasapi_activate_handler_QueryInterface,
+  .AddRef = gst_wasapi_activate_handler_AddRef,
+  .Release = gst_wasapi_activate_handler_Release,
+  .ActivateCompleted = gst_wasapi_activate_handler_ActivateCompleted,
+};
+
+gboolean
+gst_wasapi_util_activate_async (GstElement * self, const wchar_t * path,
+    REFIID iid, PROPVARIANT * params, IAudioClient ** ret_client)
+{
+  GstWasapiActivateHandler *handler;
+  IActivateAudioInterfaceAsyncOperation *operation = NULL;
+  IUnknown *unknown = NULL;
+  HRESULT hr, activate_hr;
+  gboolean res = FALSE;
+  guint64 t = gst_wasapi_util_get_qpc_position ();
+
+  handler = g_slice_new0 (GstWasapiActivateHandler);
+  handler->handler.lpVtbl = &activate_handler_vtbl;
+  handler->refcount = 1;
+  handler->done = CreateEvent (NULL, TRUE, FALSE, NULL);
+
+  hr = ActivateAudioInterfaceAsync (path, iid, params, &handler->handler,
+      &operation);
+  HR_FAILED_GOTO (hr, ActivateAudioInterfaceAsync, beach);
+
+  if (WaitForSingleObject (handler->done, ACTIVATE_TIMEOUT_MS) !=
+      WAIT_OBJECT_0) {
+    GST_ERROR_OBJECT (self, "client of %S didn't activate in time", path);
+    goto beach;
+  }
+
+  hr = IActivateAudioInterfaceAsyncOperation_GetActivateResult (operation,
+      &activate_hr, &unknown);
+  HR_FAILED_GOTO (hr, IActivateAudioInterfaceAsyncOperation::GetActivateResult,
+      beach);
+  HR_FAILED_GOTO (activate_hr, ActivateAudioInterfaceAsync, beach);
+
+  hr = IUnknown_QueryInterface (unknown, iid, (void **) ret_client);
+  HR_FAILED_GOTO (hr, IUnknown::QueryInterface, beach);
+  res = TRUE;
+
+beach:
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_ACTIVATE, t);
+
+  if (unknown != NULL)
+    IUnknown_Release (unknown);
+
+  if (operation != NULL)
+    IUnknown_Release (operation);
+
+  IUnknown_Release (&handler->handler);
+
+  return res;
+}
+
+gboolean
+gst_wasapi_util_get_routed_client (GstElement * self, gint data_flow,
+    gint role, IMMDevice ** ret_device, IAudioClient ** ret_client)
+{
+  IAudioClient *client = NULL;
+  wchar_t path[40];
+
+  if (gst_wasapi_fake_enabled ())
+    return FALSE;
+
+  /* The endpoint is still what the format, the name and the periods come
+   * from, only its client is replaced */
+  if (!gst_wasapi_util_get_device_client (self, data_flow, role, NULL,
+          ret_device, &client))
+    return FALSE;
+  IUnknown_Release (client);
+
+  StringFromGUID2 (data_flow == eRender ? &gst_wasapi_devinterface_audio_render
+      : &gst_wasapi_devinterface_audio_capture, path, G_N_ELEMENTS (path));
+  if (!gst_wasapi_util_activate_async (self, path,
+          gst_wasapi_util_have_audioclient3 () ? &IID_IAudioClient3 :
+          &IID_IAudioClient, NULL, ret_client)) {
+    IUnknown_Release (*ret_device);
+    *ret_device = NULL;
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (self, "the audio engine routes the stream to the default "
+      "device");
+
+  return TRUE;
+}
+
 gboolean
 gst_wasapi_util_get_render_client (GstElement * self, IAudioClient * client,
     IAudioRenderClient ** ret_render_client)
@@ -713,9 +1314,11 @@ gst_wasapi_util_get_render_client (GstElement * self, IAudioClient * client,
   gboolean res = FALSE;
   HRESULT hr;
   IAudioRenderClient *render_client = NULL;
+  guint64 start = gst_wasapi_util_get_qpc_position ();
 
   hr = IAudioClient_GetService (client, &IID_IAudioRenderClient,
       (void **) &render_client);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_GET_SERVICE, start);
   HR_FAILED_GOTO (hr, IAudioClient::GetService, beach);
 
   *ret_render_client = render_client;
@@ -732,9 +1335,11 @@ gst_wasapi_util_get_capture_client (GstElement * self, IAudioClient * client,
   gboolean res = FALSE;
   HRESULT hr;
   IAudioCaptureClient *capture_client = NULL;
+  guint64 start = gst_wasapi_util_get_qpc_position ();
 
   hr = IAudioClient_GetService (client, &IID_IAudioCaptureClient,
       (void **) &capture_client);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_GET_SERVICE, start);
   HR_FAILED_GOTO (hr, IAudioClient::GetService, beach);
 
   *ret_capture_client = capture_client;
@@ -751,8 +1356,10 @@ gst_wasapi_util_get_clock (GstElement * self, IAudioClient * client,
   gboolean res = FALSE;
   HRESULT hr;
   IAudioClock *clock = NULL;
+  guint64 start = gst_wasapi_util_get_qpc_position ();
 
   hr = IAudioClient_GetService (client, &IID_IAudioClock, (void **) &clock);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_GET_SERVICE, start);
   HR_FAILED_GOTO (hr, IAudioClient::GetService, beach);
 
   *ret_clock = clock;
@@ -762,39 +1369,105 @@ beach:
   return res;
 }
 
+gboolean
+gst_wasapi_util_get_clock_adjustment (GstElement * self, IAudioClient * client,
+    IAudioClockAdjustment ** ret_adjustment)
+{
+  gboolean res = FALSE;
+  HRESULT hr;
+  IAudioClockAdjustment *adjustment = NULL;
+  guint64 start = gst_wasapi_util_get_qpc_position ();
+
+  hr = IAudioClient_GetService (client, &IID_IAudioClockAdjustment,
+      (void **) &adjustment);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_GET_SERVICE, start);
+  HR_FAILED_GOTO (hr, IAudioClient::GetService, beach);
+
+  *ret_adjustment = adjustment;
+  res = TRUE;
+
+beach:
+  return res;
+}
+
+gboolean
+gst_wasapi_util_get_stream_volume (GstElement * self, IAudioClient * client,
+    IAudioStreamVolume ** ret_volume)
+{
+  gboolean res = FALSE;
+  HRESULT hr;
+  IAudioStreamVolume *volume = NULL;
+  guint64 start = gst_wasapi_util_get_qpc_position ();
+
+  hr = IAudioClient_GetService (client, &IID_IAudioStreamVolume,
+      (void **) &volume);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_GET_SERVICE, start);
+  HR_FAILED_GOTO (hr, IAudioClient::GetService, beach);
+
+  *ret_volume = volume;
+  res = TRUE;
+
+beach:
+  return res;
+}
+
+/* Starts @client again if it was reset since the last call. @needs_restart
+ * is only ever accessed atomically, so this is safe to call from the
+ * realtime thread without taking any lock */
+gboolean
+gst_wasapi_util_start_if_needed (GstElement * self, IAudioClient * client,
+    gint * needs_restart)
+{
+  HRESULT hr;
+  guint64 start;
+
+  if (G_LIKELY (!g_atomic_int_compare_and_exchange (needs_restart, TRUE,
+              FALSE)))
+    return TRUE;
+
+  start = gst_wasapi_util_get_qpc_position ();
+  hr = IAudioClient_Start (client);
+  gst_wasapi_startup_times_add (self, GST_WASAPI_STARTUP_START, start);
+  /* A reset() racing with us already restarted it */
+  if (hr == AUDCLNT_E_NOT_STOPPED)
+    return TRUE;
+  HR_FAILED_AND (hr, IAudioClient::Start,
+      g_atomic_int_set (needs_restart, TRUE); return FALSE);
+
+  return TRUE;
+}
+
 static const gchar *
 gst_waveformatex_to_audio_format (WAVEFORMATEXTENSIBLE * format)
 {
-  const gchar *fmt_str = NULL;
-  GstAudioFormat fmt = GST_AUDIO_FORMAT_UNKNOWN;
+  WORD bits = format->Format.wBitsPerSample, valid_bits = bits;
+  gboolean is_float;
 
   if (format->Format.wFormatTag == WAVE_FORMAT_PCM) {
-    fmt = gst_audio_format_build_integer (TRUE, G_LITTLE_ENDIAN,
-        format->Format.wBitsPerSample, format->Format.wBitsPerSample);
+    is_float = FALSE;
   } else if (format->Format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT) {
-    if (format->Format.wBitsPerSample == 32)
-      fmt = GST_AUDIO_FORMAT_F32LE;
-    else if (format->Format.wBitsPerSample == 64)
-      fmt = GST_AUDIO_FORMAT_F64LE;
+    is_float = TRUE;
   } else if (format->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
-    if (IsEqualGUID (&format->SubFormat, &KSDATAFORMAT_SUBTYPE_PCM)) {
-      fmt = gst_audio_format_build_integer (TRUE, G_LITTLE_ENDIAN,
-          format->Format.wBitsPerSample, format->Samples.wValidBitsPerSample);
-    } else if (IsEqualGUID (&format->SubFormat,
-            &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)) {
-      if (format->Format.wBitsPerSample == 32
-          && format->Samples.wValidBitsPerSample == 32)
-        fmt = GST_AUDIO_FORMAT_F32LE;
-      else if (format->Format.wBitsPerSample == 64 &&
-          format->Samples.wValidBitsPerSample == 64)
-        fmt = GST_AUDIO_FORMAT_F64LE;
-    }
+    if (IsEqualGUID (&format->SubFormat, &KSDATAFORMAT_SUBTYPE_PCM))
+      is_float = FALSE;
+    else if (IsEqualGUID (&format->SubFormat,
+            &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT))
+      is_float = TRUE;
+    else
+      return NULL;
+    valid_bits = format->Samples.wValidBitsPerSample;
+  } else {
+    return NULL;
   }
 
-  if (fmt != GST_AUDIO_FORMAT_UNKNOWN)
-    fmt_str = gst_audio_format_to_string (fmt);
+  for (guint ii = 0; ii < G_N_ELEMENTS (wasapi_formats); ii++) {
+    if (wasapi_formats[ii].is_float == is_float &&
+        wasapi_formats[ii].bits == bits &&
+        wasapi_formats[ii].valid_bits == valid_bits)
+      return gst_audio_format_to_string (wasapi_formats[ii].format);
+  }
 
-  return fmt_str;
+  return NULL;
 }
 
 static void
@@ -807,79 +1480,60 @@ gst_wasapi_util_channel_position_all_none (guint channels,
 }
 
 /* Parse WAVEFORMATEX to get the gstreamer channel mask, and the wasapi channel
- * positions so GstAudioRingbuffer can reorder the audio data to match the
- * gstreamer channel order. */
+ * positions so the audio data can be reordered to match the gstreamer channel
+ * order with gst_wasapi_util_reorder().
+ *
+ * The channels are in the order of the bits set in dwChannelMask, lowest
+ * first, whatever the layout is called. A mask that doesn't cover every
+ * channel leaves all of them non-positional, GStreamer can't mix both.
+ * Without a mask (KSAUDIO_SPEAKER_DIRECTOUT), or with more channels than
+ * GStreamer can position, they are unpositioned from the start: channel
+ * mask 0, which is then copied straight through without any reorder. */
 static guint64
 gst_wasapi_util_waveformatex_to_channel_mask (WAVEFORMATEXTENSIBLE * format,
     GstAudioChannelPosition ** out_position)
 {
   guint64 mask = 0;
   WORD nChannels = format->Format.nChannels;
-  DWORD dwChannelMask = format->dwChannelMask;
+  DWORD dwChannelMask = 0;
   GstAudioChannelPosition *pos = NULL;
+  guint channel = 0;
 
   pos = g_new (GstAudioChannelPosition, nChannels);
   gst_wasapi_util_channel_position_all_none (nChannels, pos);
 
-  /* Too many channels, have to assume that they are all non-positional */
-  if (nChannels > G_N_ELEMENTS (wasapi_to_gst_pos)) {
-    GST_INFO ("Got too many (%i) channels, assuming non-positional", nChannels);
-    goto out;
-  }
+  if (format->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    dwChannelMask = format->dwChannelMask;
+  else if (nChannels <= 2)
+    /* Plain WAVEFORMATEX means mono or stereo */
+    dwChannelMask = nChannels == 1 ? KSAUDIO_SPEAKER_MONO :
+        KSAUDIO_SPEAKER_STEREO;
 
-  /* Too many bits in the channel mask, and the bits don't match nChannels */
-  if (dwChannelMask >> (G_N_ELEMENTS (wasapi_to_gst_pos) + 1) != 0) {
-    GST_WARNING ("Too many bits in channel mask (%lu), assuming "
-        "non-positional", dwChannelMask);
-    goto out;
+  if (dwChannelMask == KSAUDIO_SPEAKER_DIRECTOUT || nChannels > 64) {
+    GST_DEBUG ("%u unpositioned channels", nChannels);
+    goto done;
   }
 
-  /* Map WASAPI's channel mask to Gstreamer's channel mask and positions.
-   * If the no. of bits in the mask > nChannels, we will ignore the extra.
-   *
-   * KSAUDIO_SPEAKER_7POINT1_SURROUND, 8 channels has different mapping
-   * than the regular KSAUDIO_SPEAKER_7POINT1, so we have a special case to
-   * handle diverged mapping. */
-  for (int ii = 0; ii < nChannels; ii++) {
-    if (!(dwChannelMask & wasapi_to_gst_pos[ii].wasapi_pos)) {
-      gboolean is_valid_diverge_mapping = FALSE;
-
-      if ((dwChannelMask & KSAUDIO_SPEAKER_MONO) &&
-          (dwChannelMask & wasapi_to_gst_pos[ii + 2].wasapi_pos)) {
-        // SPEAKER_FRONT_CENTER
-        is_valid_diverge_mapping = TRUE;
-      } else if ((dwChannelMask & KSAUDIO_SPEAKER_QUAD) &&
-          (dwChannelMask & wasapi_to_gst_pos[ii + 2].wasapi_pos)) {
-        // SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT
-        is_valid_diverge_mapping = TRUE;
-      } else if ((dwChannelMask & KSAUDIO_SPEAKER_SURROUND) &&
-          (dwChannelMask & wasapi_to_gst_pos[ii + 5].wasapi_pos)) {
-        // SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_BACK_CENTER
-        is_valid_diverge_mapping = TRUE;
-      } else if ((dwChannelMask & KSAUDIO_SPEAKER_5POINT1_SURROUND) &&
-          (dwChannelMask & wasapi_to_gst_pos[ii + 6].wasapi_pos)) {
-        // SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
-        // SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT
-        is_valid_diverge_mapping = TRUE;
-      } else if ((dwChannelMask & KSAUDIO_SPEAKER_7POINT1_SURROUND) &&
-          (dwChannelMask & wasapi_to_gst_pos[ii + 3].wasapi_pos)) {
-        // SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
-        // SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT
-        is_valid_diverge_mapping = TRUE;
-      }
+  for (guint bit = 0; bit < G_N_ELEMENTS (wasapi_to_gst_pos) &&
+      channel < nChannels; bit++) {
+    if (!(dwChannelMask & wasapi_to_gst_pos[bit].wasapi_pos))
+      continue;
+    pos[channel++] = wasapi_to_gst_pos[bit].gst_pos;
+    mask |= G_GUINT64_CONSTANT (1) << wasapi_to_gst_pos[bit].gst_pos;
+  }
 
-      if (!is_valid_diverge_mapping) {
-        /* Non-positional or unknown position, warn? */
-        continue;
-      }
-    }
-    mask |= G_GUINT64_CONSTANT (1) << wasapi_to_gst_pos[ii].gst_pos;
-    pos[ii] = wasapi_to_gst_pos[ii].gst_pos;
+  if (channel < nChannels) {
+    GST_INFO ("channel mask 0x%lx doesn't cover %u channels, assuming "
+        "non-positional", (gulong) dwChannelMask, nChannels);
+    gst_wasapi_util_channel_position_all_none (nChannels, pos);
+    mask = 0;
   }
 
-out:
+done:
   if (out_position)
     *out_position = pos;
+  else
+    g_free (pos);
   return mask;
 }
 
@@ -929,91 +1583,693 @@ gst_wasapi_util_parse_waveformatex (WAVEFORMATEXTENSIBLE * format,
   return TRUE;
 }
 
-void
-gst_wasapi_util_get_best_buffer_sizes (GstAudioRingBufferSpec * spec,
-    gboolean exclusive, REFERENCE_TIME default_period,
-    REFERENCE_TIME min_period, REFERENCE_TIME * ret_period,
-    REFERENCE_TIME * ret_buffer_duration)
+gboolean
+gst_wasapi_util_waveformatex_matches_info (WAVEFORMATEX * format,
+    GstAudioInfo * info)
 {
-  REFERENCE_TIME use_period, use_buffer;
+  const gchar *afmt =
+      gst_waveformatex_to_audio_format ((WAVEFORMATEXTENSIBLE *) format);
 
-  /* Figure out what integral device period to use as the base */
-  if (exclusive) {
-    /* Exclusive mode can run at multiples of either the minimum period or the
-     * default period; these are on the hardware ringbuffer */
-    if (spec->latency_time * 10 > default_period)
-      use_period = default_period;
-    else
-      use_period = min_period;
-  } else {
-    /* Shared mode always runs at the default period, so if we want a larger
-     * period (for lower CPU usage), we do it as a multiple of that */
-    use_period = default_period;
+  return afmt != NULL &&
+      g_str_equal (afmt, GST_AUDIO_INFO_NAME (info)) &&
+      format->nSamplesPerSec == GST_AUDIO_INFO_RATE (info) &&
+      format->nChannels == GST_AUDIO_INFO_CHANNELS (info);
+}
+
+GstCaps *
+gst_wasapi_util_add_autoconvert_caps (GstCaps * caps)
+{
+  GstCaps *convert_caps;
+  GValue formats = G_VALUE_INIT;
+  const gchar *convert_formats[] = { "S16LE", "S24LE", "S24_32LE", "S32LE",
+    "F32LE"
+  };
+
+  g_value_init (&formats, GST_TYPE_LIST);
+  for (guint ii = 0; ii < G_N_ELEMENTS (convert_formats); ii++) {
+    GValue val = G_VALUE_INIT;
+
+    g_value_init (&val, G_TYPE_STRING);
+    g_value_set_static_string (&val, convert_formats[ii]);
+    gst_value_list_append_and_take_value (&formats, &val);
   }
 
-  /* Ensure that the period (latency_time) used is an integral multiple of
-   * either the default period or the minimum period */
-  use_period = use_period * MAX ((spec->latency_time * 10) / use_period, 1);
+  /* The engine converts the sample format and the rate, the channel layout
+   * stays the one of the mix format */
+  convert_caps = gst_caps_copy (caps);
+  for (guint ii = 0; ii < gst_caps_get_size (convert_caps); ii++) {
+    GstStructure *s = gst_caps_get_structure (convert_caps, ii);
 
-  if (exclusive) {
-    /* Buffer duration is the same as the period in exclusive mode. The
-     * hardware is always writing out one buffer (of size *ret_period), and
-     * we're writing to the other one. */
-    use_buffer = use_period;
-  } else {
-    /* Ask WASAPI to create a software ringbuffer of at least this size; it may
-     * be larger so the actual buffer time may be different, which is why after
-     * initialization we read the buffer duration actually in-use and set
-     * segsize/segtotal from that. */
-    use_buffer = spec->buffer_time * 10;
-    /* Has to be at least twice the period */
-    if (use_buffer < 2 * use_period)
-      use_buffer = 2 * use_period;
+    gst_structure_set_value (s, "format", &formats);
+    gst_structure_set (s, "rate", GST_TYPE_INT_RANGE, 8000, 384000, NULL);
   }
+  g_value_unset (&formats);
 
-  *ret_period = use_period;
-  *ret_buffer_duration = use_buffer;
+  /* Keeps the mix format first, so it's still preferred */
+  return gst_caps_merge (caps, convert_caps);
 }
 
 gboolean
-gst_wasapi_util_initialize_audioclient (GstElement * self,
-    GstAudioRingBufferSpec * spec, IAudioClient * client,
-    WAVEFORMATEX * format, guint sharemode, gboolean low_latency,
-    gboolean loopback, guint * ret_devicep_frames)
+gst_wasapi_util_get_reorder_map (gint channels,
+    const GstAudioChannelPosition * from, const GstAudioChannelPosition * to,
+    gint * reorder_map)
 {
-  REFERENCE_TIME default_period, min_period;
-  REFERENCE_TIME device_period, device_buffer_duration;
-  guint rate, stream_flags;
-  HRESULT hr;
+  if (channels < 2 || channels > 64 ||
+      from[0] == GST_AUDIO_CHANNEL_POSITION_NONE ||
+      to[0] == GST_AUDIO_CHANNEL_POSITION_NONE)
+    return FALSE;
 
-  hr = IAudioClient_GetDevicePeriod (client, &default_period, &min_period);
-  HR_FAILED_RET (hr, IAudioClient::GetDevicePeriod, FALSE);
+  if (!gst_audio_get_channel_reorder_map (channels, from, to, reorder_map))
+    return FALSE;
 
-  GST_INFO_OBJECT (self, "wasapi default period: %" G_GINT64_FORMAT
-      ", min period: %" G_GINT64_FORMAT, default_period, min_period);
+  for (gint ii = 0; ii < channels; ii++)
+    if (reorder_map[ii] != ii)
+      return TRUE;
 
-  rate = GST_AUDIO_INFO_RATE (&spec->info);
+  return FALSE;
+}
 
-  if (low_latency) {
-    if (sharemode == AUDCLNT_SHAREMODE_SHARED) {
-      device_period = default_period;
-      device_buffer_duration = 0;
-    } else {
-      device_period = min_period;
-      device_buffer_duration = min_period;
-    }
-  } else {
-    /* Clamp values to integral multiples of an appropriate period */
-    gst_wasapi_util_get_best_buffer_sizes (spec,
-        sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE, default_period,
-        min_period, &device_period, &device_buffer_duration);
-  }
+/* One kernel per sample size, the frame goes through @tmp so @dst may be
+ * @src. Usual layouts only have a handful of channels, so this stays in
+ * registers instead of the memcpy per sample of GstAudioRingbuffer. */
+#define DEFINE_REORDER(name, type) \
+static void \
+name (type * dst, const type * src, guint n_frames, gint channels, \
+    const gint * reorder_map) \
+{ \
+  type tmp[64]; \
+  \
+  for (guint ii = 0; ii < n_frames; ii++) { \
+    for (gint cc = 0; cc < channels; cc++) \
+      tmp[cc] = src[cc]; \
+    for (gint cc = 0; cc < channels; cc++) \
+      dst[reorder_map[cc]] = tmp[cc]; \
+    src += channels; \
+    dst += channels; \
+  } \
+}
 
-  stream_flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
-  if (loopback)
-    stream_flags |= AUDCLNT_STREAMFLAGS_LOOPBACK;
+DEFINE_REORDER (reorder_8, guint8);
+DEFINE_REORDER (reorder_16, guint16);
+DEFINE_REORDER (reorder_32, guint32);
+DEFINE_REORDER (reorder_64, guint64);
+
+#undef DEFINE_REORDER
+
+void
+gst_wasapi_util_reorder (gpointer dst, gconstpointer src, guint n_frames,
+    gint channels, gint bps, const gint * reorder_map)
+{
+  switch (bps) {
+    case 1:
+      reorder_8 (dst, src, n_frames, channels, reorder_map);
+      break;
+    case 2:
+      reorder_16 (dst, src, n_frames, channels, reorder_map);
+      break;
+    case 4:
+      reorder_32 (dst, src, n_frames, channels, reorder_map);
+      break;
+    case 8:
+      reorder_64 (dst, src, n_frames, channels, reorder_map);
+      break;
+    default:{
+      /* 24 bit packed samples */
+      guint8 tmp[64 * 8];
+      guint8 *d = dst;
+      const guint8 *s = src;
+      gint bpf = channels * bps;
+
+      for (guint ii = 0; ii < n_frames; ii++) {
+        memcpy (tmp, s, bpf);
+        for (gint cc = 0; cc < channels; cc++)
+          memcpy (d + reorder_map[cc] * bps, tmp + cc * bps, bps);
+        s += bpf;
+        d += bpf;
+      }
+      break;
+    }
+  }
+}
+
+/* Like the above. Frames only shrink, so in place the ones after the
+ * current one are never overwritten, @tmp keeps it from overwriting
+ * itself. */
+#define DEFINE_SELECT(name, type) \
+static void \
+name (type * dst, const type * src, guint n_frames, gint channels, \
+    gint n_selected, const gint * selected) \
+{ \
+  type tmp[64]; \
+  \
+  for (guint ii = 0; ii < n_frames; ii++) { \
+    for (gint cc = 0; cc < n_selected; cc++) \
+      tmp[cc] = src[selected[cc]]; \
+    for (gint cc = 0; cc < n_selected; cc++) \
+      dst[cc] = tmp[cc]; \
+    src += channels; \
+    dst += n_selected; \
+  } \
+}
+
+DEFINE_SELECT (select_8, guint8);
+DEFINE_SELECT (select_16, guint16);
+DEFINE_SELECT (select_32, guint32);
+DEFINE_SELECT (select_64, guint64);
+
+#undef DEFINE_SELECT
+
+void
+gst_wasapi_util_select_channels (gpointer dst, gconstpointer src,
+    guint n_frames, gint channels, gint bps, gint n_selected,
+    const gint * selected)
+{
+  switch (bps) {
+    case 1:
+      select_8 (dst, src, n_frames, channels, n_selected, selected);
+      break;
+    case 2:
+      select_16 (dst, src, n_frames, channels, n_selected, selected);
+      break;
+    case 4:
+      select_32 (dst, src, n_frames, channels, n_selected, selected);
+      break;
+    case 8:
+      select_64 (dst, src, n_frames, channels, n_selected, selected);
+      break;
+    default:{
+      /* 24 bit packed samples */
+      guint8 tmp[64 * 8];
+      guint8 *d = dst;
+      const guint8 *s = src;
+
+      for (guint ii = 0; ii < n_frames; ii++) {
+        for (gint cc = 0; cc < n_selected; cc++)
+          memcpy (tmp + cc * bps, s + selected[cc] * bps, bps);
+        memcpy (d, tmp, n_selected * bps);
+        s += channels * bps;
+        d += n_selected * bps;
+      }
+      break;
+    }
+  }
+}
+
+gint
+gst_wasapi_util_parse_channel_select (const gchar * str, gint channels,
+    gint * selected)
+{
+  gchar **parts;
+  gint n_selected = 0;
+
+  if (str == NULL)
+    return 0;
+
+  parts = g_strsplit (str, ",", -1);
+  for (guint ii = 0; parts[ii] != NULL; ii++) {
+    gchar *part = g_strstrip (parts[ii]), *end;
+    gint64 channel = g_ascii_strtoll (part, &end, 10);
+
+    if (end == part || *end != '\0' || channel < 1 || channel > channels ||
+        n_selected == 64) {
+      n_selected = 0;
+      break;
+    }
+    selected[n_selected++] = (gint) channel - 1;
+  }
+  g_strfreev (parts);
+
+  return n_selected;
+}
+
+WAVEFORMATEX *
+gst_wasapi_util_audio_info_to_waveformatex (GstAudioInfo * info,
+    WAVEFORMATEX * mix_format)
+{
+  WAVEFORMATEXTENSIBLE *format;
+
+  format = CoTaskMemAlloc (sizeof (WAVEFORMATEXTENSIBLE));
+  memset (format, 0, sizeof (WAVEFORMATEXTENSIBLE));
+
+  format->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format->Format.nChannels = GST_AUDIO_INFO_CHANNELS (info);
+  format->Format.nSamplesPerSec = GST_AUDIO_INFO_RATE (info);
+  format->Format.wBitsPerSample = GST_AUDIO_INFO_WIDTH (info);
+  format->Format.nBlockAlign = GST_AUDIO_INFO_BPF (info);
+  format->Format.nAvgBytesPerSec =
+      GST_AUDIO_INFO_RATE (info) * GST_AUDIO_INFO_BPF (info);
+  format->Format.cbSize =
+      sizeof (WAVEFORMATEXTENSIBLE) - sizeof (WAVEFORMATEX);
+  format->Samples.wValidBitsPerSample = GST_AUDIO_INFO_DEPTH (info);
+  if (mix_format->nChannels != GST_AUDIO_INFO_CHANNELS (info)) {
+    guint64 mask = 0;
+
+    if (!GST_AUDIO_INFO_IS_UNPOSITIONED (info))
+      gst_audio_channel_positions_to_mask (info->position,
+          GST_AUDIO_INFO_CHANNELS (info), FALSE, &mask);
+    format->dwChannelMask = (DWORD) mask;
+  } else if (mix_format->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+    format->dwChannelMask =
+        ((WAVEFORMATEXTENSIBLE *) mix_format)->dwChannelMask;
+  }
+  if (GST_AUDIO_INFO_IS_FLOAT (info))
+    format->SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+  else
+    format->SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+
+  return (WAVEFORMATEX *) format;
+}
+
+void
+gst_wasapi_util_get_best_buffer_sizes (GstAudioRingBufferSpec * spec,
+    gboolean exclusive, REFERENCE_TIME default_period,
+    REFERENCE_TIME min_period, REFERENCE_TIME * ret_period,
+    REFERENCE_TIME * ret_buffer_duration)
+{
+  REFERENCE_TIME use_period, use_buffer;
+
+  /* Figure out what integral device period to use as the base */
+  if (exclusive) {
+    /* Exclusive mode can run at multiples of either the minimum period or the
+     * default period; these are on the hardware ringbuffer */
+    if (spec->latency_time * 10 > default_period)
+      use_period = default_period;
+    else
+      use_period = min_period;
+  } else {
+    /* Shared mode always runs at the default period, so if we want a larger
+     * period (for lower CPU usage), we do it as a multiple of that */
+    use_period = default_period;
+  }
+
+  /* Ensure that the period (latency_time) used is an integral multiple of
+   * either the default period or the minimum period */
+  use_period = use_period * MAX ((spec->latency_time * 10) / use_period, 1);
+
+  if (exclusive) {
+    /* Buffer duration is the same as the period in exclusive mode. The
+     * hardware is always writing out one buffer (of size *ret_period), and
+     * we're writing to the other one. */
+    use_buffer = use_period;
+  } else {
+    /* Ask WASAPI to create a software ringbuffer of at least this size; it may
+     * be larger so the actual buffer time may be different, which is why after
+     * initialization we read the buffer duration actually in-use and set
+     * segsize/segtotal from that. */
+    use_buffer = spec->buffer_time * 10;
+    /* Has to be at least twice the period */
+    if (use_buffer < 2 * use_period)
+      use_buffer = 2 * use_period;
+  }
+
+  *ret_period = use_period;
+  *ret_buffer_duration = use_buffer;
+}
+
+void
+gst_wasapi_util_add_device_latency (GstElement * self, GstQuery * query,
+    GstClockTime stream_latency, GstClockTime period, GstClockTime buffer,
+    GstClockTime extra)
+{
+  GstClockTime min, max;
+  gboolean live;
+
+  if (!GST_CLOCK_TIME_IS_VALID (stream_latency))
+    return;
+
+  gst_query_parse_latency (query, &live, &min, &max);
+
+  min += stream_latency + period + extra;
+  if (GST_CLOCK_TIME_IS_VALID (max))
+    max += stream_latency + MAX (buffer, period) + extra;
+
+  GST_DEBUG_OBJECT (self, "adding %" GST_TIME_FORMAT " of device latency, "
+      "period %" GST_TIME_FORMAT " buffer %" GST_TIME_FORMAT ", min %"
+      GST_TIME_FORMAT " max %" GST_TIME_FORMAT, GST_TIME_ARGS (stream_latency),
+      GST_TIME_ARGS (period), GST_TIME_ARGS (buffer), GST_TIME_ARGS (min),
+      GST_TIME_ARGS (max));
+
+  gst_query_set_latency (query, live, min, max);
+}
+
+static const struct
+{
+  GstAudioRingBufferFormatType type;
+  const gchar *media_type;
+  const GUID *subformat;
+  /* IEC 61937 rate for one frame per second of the stream */
+  gint rate_multiplier;
+} passthrough_formats[] = {
+  {GST_AUDIO_RING_BUFFER_FORMAT_TYPE_AC3, "audio/x-ac3",
+      &gst_wasapi_subtype_iec61937_dolby_digital, 1},
+  {GST_AUDIO_RING_BUFFER_FORMAT_TYPE_EAC3, "audio/x-eac3",
+      &gst_wasapi_subtype_iec61937_dolby_digital_plus, 4},
+  {GST_AUDIO_RING_BUFFER_FORMAT_TYPE_DTS, "audio/x-dts",
+      &gst_wasapi_subtype_iec61937_dts, 1},
+};
+
+static const gint passthrough_rates[] = { 32000, 44100, 48000 };
+
+WAVEFORMATEX *
+gst_wasapi_util_get_passthrough_format (GstAudioRingBufferFormatType type,
+    gint rate)
+{
+  WAVEFORMATEXTENSIBLE *format;
+  guint ii;
+
+  for (ii = 0; ii < G_N_ELEMENTS (passthrough_formats); ii++)
+    if (passthrough_formats[ii].type == type)
+      break;
+
+  if (ii == G_N_ELEMENTS (passthrough_formats))
+    return NULL;
+
+  /* The bitstream is carried in 16 bit stereo frames. The ringbuffer spec
+   * of E-AC3 counts 16 byte frames at the stream rate, which are the same
+   * bytes per second. */
+  rate *= passthrough_formats[ii].rate_multiplier;
+
+  format = CoTaskMemAlloc (sizeof (WAVEFORMATEXTENSIBLE));
+  memset (format, 0, sizeof (WAVEFORMATEXTENSIBLE));
+
+  format->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format->Format.nChannels = 2;
+  format->Format.nSamplesPerSec = rate;
+  format->Format.wBitsPerSample = 16;
+  format->Format.nBlockAlign = 4;
+  format->Format.nAvgBytesPerSec = rate * 4;
+  format->Format.cbSize =
+      sizeof (WAVEFORMATEXTENSIBLE) - sizeof (WAVEFORMATEX);
+  format->Samples.wValidBitsPerSample = 16;
+  format->dwChannelMask = KSAUDIO_SPEAKER_STEREO;
+  format->SubFormat = *passthrough_formats[ii].subformat;
+
+  return (WAVEFORMATEX *) format;
+}
+
+GstCaps *
+gst_wasapi_util_get_passthrough_caps (GstElement * self, IAudioClient * client)
+{
+  GstCaps *caps = gst_caps_new_empty ();
+
+  for (guint ii = 0; ii < G_N_ELEMENTS (passthrough_formats); ii++) {
+    GValue rates = G_VALUE_INIT;
+
+    g_value_init (&rates, GST_TYPE_LIST);
+
+    for (guint jj = 0; jj < G_N_ELEMENTS (passthrough_rates); jj++) {
+      WAVEFORMATEX *format;
+      HRESULT hr;
+
+      format = gst_wasapi_util_get_passthrough_format
+          (passthrough_formats[ii].type, passthrough_rates[jj]);
+      hr = IAudioClient_IsFormatSupported (client,
+          AUDCLNT_SHAREMODE_EXCLUSIVE, format, NULL);
+      CoTaskMemFree (format);
+
+      if (hr == S_OK) {
+        GValue rate = G_VALUE_INIT;
+
+        g_value_init (&rate, G_TYPE_INT);
+        g_value_set_int (&rate, passthrough_rates[jj]);
+        gst_value_list_append_and_take_value (&rates, &rate);
+      }
+    }
+
+    if (gst_value_list_get_size (&rates) > 0) {
+      GstStructure *s = gst_structure_new (passthrough_formats[ii].media_type,
+          "framed", G_TYPE_BOOLEAN, TRUE, NULL);
+
+      gst_structure_take_value (s, "rate", &rates);
+      gst_caps_append_structure (caps, s);
+    } else {
+      g_value_unset (&rates);
+    }
+  }
+
+  GST_INFO_OBJECT (self, "passthrough caps: %" GST_PTR_FORMAT, caps);
+
+  return caps;
+}
+
+static const GstAudioFormat exclusive_formats[] = { GST_AUDIO_FORMAT_S16LE,
+  GST_AUDIO_FORMAT_S24LE, GST_AUDIO_FORMAT_S24_32LE, GST_AUDIO_FORMAT_S32LE,
+  GST_AUDIO_FORMAT_F32LE
+};
+
+static const gint exclusive_rates[] = { 44100, 48000, 88200, 96000, 176400,
+  192000
+};
+
+GstCaps *
+gst_wasapi_util_probe_exclusive_caps (GstElement * self, IAudioClient * client,
+    WAVEFORMATEX * device_format, GstAudioChannelPosition * positions)
+{
+  GstCaps *caps = gst_caps_new_empty ();
+  gint channels[2] = { device_format->nChannels, 2 };
+  guint n_channels = device_format->nChannels > 2 ? 2 : 1;
+
+  for (guint ii = 0; ii < n_channels; ii++) {
+    for (guint jj = 0; jj < G_N_ELEMENTS (exclusive_formats); jj++) {
+      GValue rates = G_VALUE_INIT;
+      GstAudioInfo info;
+
+      g_value_init (&rates, GST_TYPE_LIST);
+
+      for (guint kk = 0; kk < G_N_ELEMENTS (exclusive_rates); kk++) {
+        WAVEFORMATEX *format;
+        HRESULT hr;
+
+        gst_audio_info_set_format (&info, exclusive_formats[jj],
+            exclusive_rates[kk], channels[ii], ii == 0 ? positions : NULL);
+        if (gst_wasapi_util_waveformatex_matches_info (device_format, &info))
+          continue;
+
+        format = gst_wasapi_util_audio_info_to_waveformatex (&info,
+            device_format);
+        hr = IAudioClient_IsFormatSupported (client,
+            AUDCLNT_SHAREMODE_EXCLUSIVE, format, NULL);
+        CoTaskMemFree (format);
+
+        if (hr == S_OK) {
+          GValue rate = G_VALUE_INIT;
+
+          g_value_init (&rate, G_TYPE_INT);
+          g_value_set_int (&rate, exclusive_rates[kk]);
+          gst_value_list_append_and_take_value (&rates, &rate);
+        }
+      }
+
+      if (gst_value_list_get_size (&rates) > 0) {
+        GstCaps *format_caps = gst_audio_info_to_caps (&info);
+
+        gst_structure_take_value (gst_caps_get_structure (format_caps, 0),
+            "rate", &rates);
+        caps = gst_caps_merge (caps, format_caps);
+      } else {
+        g_value_unset (&rates);
+      }
+    }
+  }
+
+  GST_INFO_OBJECT (self, "exclusive caps: %" GST_PTR_FORMAT, caps);
+
+  return caps;
+}
+
+gboolean
+gst_wasapi_util_request_offload (GstElement * self, IAudioClient * client,
+    WAVEFORMATEX * format, GstAudioRingBufferSpec * spec,
+    GstWasapiStreamCategory category, gboolean raw)
+{
+  /* Only the vtable of IAudioClient2 is needed, which IAudioClient3 extends */
+  IAudioClient3 *client2 = (IAudioClient3 *) client;
+  AudioClientProperties props = { 0, };
+  REFERENCE_TIME min_buffer, max_buffer;
+  BOOL capable = FALSE;
+  HRESULT hr;
+
+  if (!gst_wasapi_util_have_audioclient3 ()) {
+    GST_INFO_OBJECT (self, "Offload needs the client of Windows 10");
+    return FALSE;
+  }
+
+  if (category == GST_WASAPI_STREAM_CATEGORY_OTHER)
+    category = GST_WASAPI_STREAM_CATEGORY_MEDIA;
+
+  hr = IAudioClient3_IsOffloadCapable (client2,
+      (AUDIO_STREAM_CATEGORY) category, &capable);
+  HR_FAILED_RET (hr, IAudioClient2::IsOffloadCapable, FALSE);
+
+  if (!capable) {
+    GST_INFO_OBJECT (self, "Endpoint can't offload, using the audio engine");
+    return FALSE;
+  }
+
+  props.cbSize = sizeof (props);
+  props.bIsOffload = TRUE;
+  props.eCategory = (AUDIO_STREAM_CATEGORY) category;
+  props.Options = raw ? AUDCLNT_STREAMOPTIONS_RAW : AUDCLNT_STREAMOPTIONS_NONE;
+  hr = IAudioClient3_SetClientProperties (client2, &props);
+  HR_FAILED_RET (hr, IAudioClient2::SetClientProperties, FALSE);
+
+  /* The stream is offloaded now, the default buffer sizes still work if
+   * we can't get the limits */
+  hr = IAudioClient3_GetBufferSizeLimits (client2, format, TRUE, &min_buffer,
+      &max_buffer);
+  HR_FAILED_AND (hr, IAudioClient2::GetBufferSizeLimits, return TRUE);
+
+  spec->buffer_time = MAX (spec->buffer_time, OFFLOAD_BUFFER_TIME);
+  spec->buffer_time = CLAMP (spec->buffer_time, (guint64) min_buffer / 10,
+      (guint64) max_buffer / 10);
+  spec->latency_time = spec->buffer_time / 2;
+
+  GST_INFO_OBJECT (self, "Offloading, buffer limits %" G_GINT64_FORMAT " - %"
+      G_GINT64_FORMAT ", using buffer-time %" G_GUINT64_FORMAT " latency-time %"
+      G_GUINT64_FORMAT, min_buffer, max_buffer, spec->buffer_time,
+      spec->latency_time);
+
+  return TRUE;
+}
+
+gboolean
+gst_wasapi_util_set_client_properties (GstElement * self,
+    IAudioClient * client, GstWasapiStreamCategory category, gboolean raw,
+    gboolean match_format)
+{
+  IAudioClient3 *client2 = (IAudioClient3 *) client;
+  AudioClientProperties props = { 0, };
+  HRESULT hr;
+
+  /* The Options of the properties came with Windows 8.1, but we only have
+   * the vtable of IAudioClient2 when we activated IAudioClient3 */
+  if (!gst_wasapi_util_have_audioclient3 ()) {
+    GST_INFO_OBJECT (self, "Client properties need the client of Windows 10");
+    return FALSE;
+  }
+
+  props.cbSize = sizeof (props);
+  props.eCategory = (AUDIO_STREAM_CATEGORY) category;
+  props.Options = raw ? AUDCLNT_STREAMOPTIONS_RAW : AUDCLNT_STREAMOPTIONS_NONE;
+  if (match_format)
+    props.Options |= AUDCLNT_STREAMOPTIONS_MATCH_FORMAT;
+  hr = IAudioClient3_SetClientProperties (client2, &props);
+  HR_FAILED_RET (hr, IAudioClient2::SetClientProperties, FALSE);
+
+  GST_INFO_OBJECT (self, "Requested a %s stream of category %d%s",
+      raw ? "raw" : "processed", category,
+      match_format ? ", matching the endpoint to its format" : "");
+
+  return TRUE;
+}
+
+GstStructure *
+gst_wasapi_util_get_audio_effects (GstElement * self, IAudioClient * client,
+    gboolean enable)
+{
+  IAudioEffectsManager *manager = NULL;
+  AUDIO_EFFECT *effects = NULL;
+  UINT32 n_effects = 0, i, j;
+  gboolean on[G_N_ELEMENTS (gst_wasapi_audio_effects)] = { FALSE, };
+  GstStructure *s;
+  HRESULT hr;
+
+  hr = IAudioClient_GetService (client, &IID_IAudioEffectsManager,
+      (void **) &manager);
+  if (FAILED (hr)) {
+    GST_INFO_OBJECT (self, "No IAudioEffectsManager, the OS doesn't tell "
+        "about its effects before Windows 11");
+    return NULL;
+  }
+
+  hr = IAudioEffectsManager_GetAudioEffects (manager, &effects, &n_effects);
+  HR_FAILED_AND (hr, IAudioEffectsManager::GetAudioEffects, goto beach);
+
+  for (i = 0; i < n_effects; i++) {
+    for (j = 0; j < G_N_ELEMENTS (gst_wasapi_audio_effects); j++) {
+      if (!IsEqualGUID (&effects[i].id, &gst_wasapi_audio_effects[j].id))
+        continue;
+
+      on[j] = effects[i].state == AUDIO_EFFECT_STATE_ON;
+      if (enable && !on[j] && j < N_ENABLE_EFFECTS && effects[i].canSetState) {
+        HRESULT set_hr = IAudioEffectsManager_SetAudioEffectState (manager,
+            effects[i].id, AUDIO_EFFECT_STATE_ON);
+
+        on[j] = SUCCEEDED (set_hr);
+        if (!on[j])
+          GST_WARNING_OBJECT (self, "Couldn't turn on %s (%x)",
+              gst_wasapi_audio_effects[j].field, (guint) set_hr);
+      }
+      break;
+    }
+  }
 
-  hr = IAudioClient_Initialize (client, sharemode, stream_flags,
+beach:
+  if (effects != NULL)
+    CoTaskMemFree (effects);
+  IAudioEffectsManager_Release (manager);
+
+  if (FAILED (hr))
+    return NULL;
+
+  s = gst_structure_new ("wasapi-effects", "n-effects", G_TYPE_UINT,
+      (guint) n_effects, NULL);
+  for (j = 0; j < G_N_ELEMENTS (gst_wasapi_audio_effects); j++)
+    gst_structure_set (s, gst_wasapi_audio_effects[j].field, G_TYPE_BOOLEAN,
+        on[j], NULL);
+
+  GST_INFO_OBJECT (self, "OS effects: %" GST_PTR_FORMAT, s);
+
+  return s;
+}
+
+gboolean
+gst_wasapi_util_initialize_audioclient (GstElement * self,
+    GstAudioRingBufferSpec * spec, IMMDevice * device, IAudioClient ** client,
+    WAVEFORMATEX * format, guint sharemode, gboolean low_latency,
+    gboolean loopback, gboolean autoconvert, gboolean rate_adjust,
+    guint * ret_devicep_frames)
+{
+  REFERENCE_TIME default_period, min_period;
+  REFERENCE_TIME device_period, device_buffer_duration;
+  guint rate, stream_flags;
+  HRESULT hr;
+
+  if (!gst_wasapi_device_cache_get_periods (self, device, *client,
+          &default_period, &min_period))
+    return FALSE;
+
+  GST_INFO_OBJECT (self, "wasapi default period: %" G_GINT64_FORMAT
+      ", min period: %" G_GINT64_FORMAT, default_period, min_period);
+
+  rate = GST_AUDIO_INFO_RATE (&spec->info);
+
+  if (low_latency) {
+    if (sharemode == AUDCLNT_SHAREMODE_SHARED) {
+      device_period = default_period;
+      device_buffer_duration = 0;
+    } else {
+      device_period = min_period;
+      device_buffer_duration = min_period;
+    }
+  } else {
+    /* Clamp values to integral multiples of an appropriate period */
+    gst_wasapi_util_get_best_buffer_sizes (spec,
+        sharemode == AUDCLNT_SHAREMODE_EXCLUSIVE, default_period,
+        min_period, &device_period, &device_buffer_duration);
+  }
+
+  stream_flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
+  if (loopback)
+    stream_flags |= AUDCLNT_STREAMFLAGS_LOOPBACK;
+  /* Only shared mode streams go through the audio engine */
+  if (autoconvert && sharemode == AUDCLNT_SHAREMODE_SHARED)
+    stream_flags |= AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+        AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+  if (rate_adjust && sharemode == AUDCLNT_SHAREMODE_SHARED)
+    stream_flags |= AUDCLNT_STREAMFLAGS_RATEADJUST;
+
+  hr = IAudioClient_Initialize (*client, sharemode, stream_flags,
       device_buffer_duration,
       /* This must always be 0 in shared mode */
       sharemode == AUDCLNT_SHAREMODE_SHARED ? 0 : device_period, format, NULL);
@@ -1026,15 +2282,25 @@ gst_wasapi_util_initialize_audioclient (GstElement * self,
         (int) device_period);
 
     /* Calculate a new aligned period. First get the aligned buffer size. */
-    hr = IAudioClient_GetBufferSize (client, &n_frames);
+    hr = IAudioClient_GetBufferSize (*client, &n_frames);
     HR_FAILED_RET (hr, IAudioClient::GetBufferSize, FALSE);
 
-    device_period = (GST_SECOND / 100) * n_frames / rate;
+    /* Rounded, truncating can land just below the aligned size again */
+    device_period = (REFERENCE_TIME) gst_util_uint64_scale_int_round (n_frames,
+        10000000, rate);
 
     GST_WARNING_OBJECT (self, "trying to re-initialize with period %i "
         "(%i frames, %i rate)", (int) device_period, n_frames, rate);
 
-    hr = IAudioClient_Initialize (client, sharemode, stream_flags,
+    /* A client that failed to initialize can't be initialized again */
+    IUnknown_Release (*client);
+    *client = NULL;
+    hr = IMMDevice_Activate (device, gst_wasapi_util_have_audioclient3 () ?
+        &IID_IAudioClient3 : &IID_IAudioClient, CLSCTX_ALL, NULL,
+        (void **) client);
+    HR_FAILED_RET (hr, IMMDevice::Activate, FALSE);
+
+    hr = IAudioClient_Initialize (*client, sharemode, stream_flags,
         device_period, device_period, format, NULL);
   }
   HR_FAILED_RET (hr, IAudioClient::Initialize, FALSE);
@@ -1044,6 +2310,23 @@ gst_wasapi_util_initialize_audioclient (GstElement * self,
   return TRUE;
 }
 
+guint
+gst_wasapi_util_round_engine_period (guint wanted_frames, guint fundp_frames,
+    guint minp_frames, guint maxp_frames)
+{
+  guint steps;
+
+  if (wanted_frames <= minp_frames || fundp_frames == 0)
+    return minp_frames;
+
+  /* Valid periods are the minimum plus multiples of the fundamental one */
+  steps = (wanted_frames - minp_frames + fundp_frames - 1) / fundp_frames;
+  if ((guint64) steps * fundp_frames >= (guint64) (maxp_frames - minp_frames))
+    return maxp_frames;
+
+  return minp_frames + steps * fundp_frames;
+}
+
 gboolean
 gst_wasapi_util_initialize_audioclient3 (GstElement * self,
     GstAudioRingBufferSpec * spec, IAudioClient3 * client,
@@ -1052,7 +2335,7 @@ gst_wasapi_util_initialize_audioclient3 (GstElement * self,
 {
   HRESULT hr;
   gint stream_flags;
-  guint devicep_frames;
+  guint devicep_frames, wanted_frames;
   guint defaultp_frames, fundp_frames, minp_frames, maxp_frames;
   WAVEFORMATEX *tmpf;
 
@@ -1064,12 +2347,21 @@ gst_wasapi_util_initialize_audioclient3 (GstElement * self,
       "fundamental period %i frames, minimum period %i frames, maximum period "
       "%i frames", defaultp_frames, fundp_frames, minp_frames, maxp_frames);
 
-  if (low_latency)
+  if (low_latency) {
     devicep_frames = minp_frames;
-  else
-    /* Just pick the max period, because lower values can cause glitches
-     * https://bugzilla.gnome.org/show_bug.cgi?id=794497 */
-    devicep_frames = maxp_frames;
+  } else {
+    /* The smallest period that still covers latency-time. The default of
+     * 10 ms ends up at the max period, because lower values can cause
+     * glitches https://bugzilla.gnome.org/show_bug.cgi?id=794497 */
+    wanted_frames = gst_util_uint64_scale_int_ceil (spec->latency_time,
+        format->nSamplesPerSec, G_USEC_PER_SEC);
+
+    devicep_frames = gst_wasapi_util_round_engine_period (wanted_frames,
+        fundp_frames, minp_frames, maxp_frames);
+  }
+  GST_INFO_OBJECT (self, "latency-time %" G_GUINT64_FORMAT " us, picked "
+      "period of %u frames", spec->latency_time, devicep_frames);
+  wanted_frames = devicep_frames;
 
   stream_flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
   if (loopback)
@@ -1084,17 +2376,116 @@ gst_wasapi_util_initialize_audioclient3 (GstElement * self,
   CoTaskMemFree (tmpf);
   HR_FAILED_RET (hr, IAudioClient3::GetCurrentSharedModeEnginePeriod, FALSE);
 
+  /* Loopback follows the engine of the render endpoint, which some drivers
+   * keep at their default period */
+  if (loopback && devicep_frames > wanted_frames) {
+    GST_WARNING_OBJECT (self, "loopback got an engine period of %u frames "
+        "instead of %u", devicep_frames, wanted_frames);
+    return FALSE;
+  }
+
   *ret_devicep_frames = devicep_frames;
   return TRUE;
 }
 
-static gboolean
-gst_wasapi_util_init_thread_priority (void)
+static gpointer
+gst_wasapi_util_mta_thread_func (gpointer user_data)
 {
-  if (gst_wasapi_avrt_tbl.tried_loading)
-    return gst_wasapi_avrt_tbl.dll != NULL;
+  HANDLE ready = user_data;
 
-  if (!gst_wasapi_avrt_tbl.dll)
+  CoInitializeEx (NULL, COINIT_MULTITHREADED);
+  SetEvent (ready);
+
+  /* Stays for the lifetime of the process, like the plugin */
+  for (;;)
+    Sleep (INFINITE);
+
+  return NULL;
+}
+
+static gpointer
+gst_wasapi_util_init_com_once (gpointer user_data)
+{
+  HRESULT (WINAPI * increment_mta_usage) (gpointer *);
+  gpointer cookie;
+  HANDLE ready;
+
+  /* Windows 8 can keep the MTA alive without a thread of ours */
+  increment_mta_usage = (gpointer) GetProcAddress (GetModuleHandle (TEXT
+          ("ole32.dll")), "CoIncrementMTAUsage");
+  if (increment_mta_usage != NULL &&
+      SUCCEEDED (increment_mta_usage (&cookie))) {
+    GST_DEBUG ("holding the MTA with CoIncrementMTAUsage");
+    return NULL;
+  }
+
+  ready = CreateEvent (NULL, TRUE, FALSE, NULL);
+  g_thread_unref (g_thread_new ("wasapi-mta", gst_wasapi_util_mta_thread_func,
+          ready));
+  WaitForSingleObject (ready, INFINITE);
+  CloseHandle (ready);
+  GST_DEBUG ("holding the MTA with a thread");
+
+  return NULL;
+}
+
+void
+gst_wasapi_util_init_com (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, gst_wasapi_util_init_com_once, NULL);
+}
+
+void
+gst_wasapi_cancel_init (GstWasapiCancel * cancel)
+{
+  cancel->handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+  cancel->generation = 0;
+  cancel->seen = 0;
+}
+
+void
+gst_wasapi_cancel_clear (GstWasapiCancel * cancel)
+{
+  if (cancel->handle != NULL) {
+    CloseHandle (cancel->handle);
+    cancel->handle = NULL;
+  }
+}
+
+void
+gst_wasapi_cancel_trigger (GstWasapiCancel * cancel)
+{
+  /* Counted first, so prepare() either sees it or misses the SetEvent() */
+  g_atomic_int_inc (&cancel->generation);
+  SetEvent (cancel->handle);
+}
+
+gboolean
+gst_wasapi_cancel_prepare (GstWasapiCancel * cancel)
+{
+  gint generation = g_atomic_int_get (&cancel->generation);
+
+  /* Nothing set the handle since we last reset it, no syscall */
+  if (G_LIKELY (generation == cancel->seen))
+    return TRUE;
+
+  ResetEvent (cancel->handle);
+  cancel->seen = generation;
+
+  /* Its SetEvent() may be the one we just reset, the next call resets the
+   * handle again */
+  return g_atomic_int_get (&cancel->generation) == generation;
+}
+
+static gboolean
+gst_wasapi_util_init_thread_priority (void)
+{
+  if (gst_wasapi_avrt_tbl.tried_loading)
+    return gst_wasapi_avrt_tbl.dll != NULL;
+
+  if (!gst_wasapi_avrt_tbl.dll)
     gst_wasapi_avrt_tbl.dll = LoadLibrary (TEXT ("avrt.dll"));
 
   if (!gst_wasapi_avrt_tbl.dll) {
@@ -1108,22 +2499,48 @@ gst_wasapi_util_init_thread_priority (void)
   gst_wasapi_avrt_tbl.AvRevertMmThreadCharacteristics =
       GetProcAddress (gst_wasapi_avrt_tbl.dll,
       "AvRevertMmThreadCharacteristics");
+  gst_wasapi_avrt_tbl.AvSetMmThreadPriority =
+      GetProcAddress (gst_wasapi_avrt_tbl.dll, "AvSetMmThreadPriority");
 
   gst_wasapi_avrt_tbl.tried_loading = TRUE;
 
   return TRUE;
 }
 
+static void
+gst_wasapi_util_set_thread_priority (HANDLE handle,
+    GstWasapiMmcssPriority priority)
+{
+  if (gst_wasapi_avrt_tbl.AvSetMmThreadPriority == NULL ||
+      gst_wasapi_avrt_tbl.AvSetMmThreadPriority (handle, priority))
+    return;
+
+  GST_WARNING ("AvSetMmThreadPriority (%d) failed: %lu", priority,
+      GetLastError ());
+}
+
 HANDLE
-gst_wasapi_util_set_thread_characteristics (void)
+gst_wasapi_util_set_thread_characteristics (const gchar * task,
+    GstWasapiMmcssPriority priority)
 {
   DWORD taskIndex = 0;
+  HANDLE handle;
 
   if (!gst_wasapi_util_init_thread_priority ())
     return NULL;
 
-  return gst_wasapi_avrt_tbl.AvSetMmThreadCharacteristics (TEXT ("Pro Audio"),
-      &taskIndex);
+  handle = gst_wasapi_avrt_tbl.AvSetMmThreadCharacteristics (task, &taskIndex);
+  if (handle == NULL) {
+    GST_WARNING ("AvSetMmThreadCharacteristics (%s) failed: %lu", task,
+        GetLastError ());
+    return NULL;
+  }
+
+  /* Threads start out at normal priority */
+  if (priority != GST_WASAPI_MMCSS_PRIORITY_NORMAL)
+    gst_wasapi_util_set_thread_priority (handle, priority);
+
+  return handle;
 }
 
 void
@@ -1134,3 +2551,619 @@ gst_wasapi_util_revert_thread_characteristics (HANDLE handle)
 
   gst_wasapi_avrt_tbl.AvRevertMmThreadCharacteristics (handle);
 }
+
+/* What a thread is registered with. @handle stays NULL when registering
+ * failed, so we don't retry on every call. @affinity is what the thread is
+ * pinned to, and @orig_affinity what it ran on before, valid if @pinned. */
+typedef struct
+{
+  HANDLE handle;
+  gchar *task;
+  GstWasapiMmcssPriority priority;
+
+  gboolean pinned;
+  guint group;
+  guint64 mask;
+  GROUP_AFFINITY orig_affinity;
+
+  GstWasapiThreadFlags flags;
+} GstWasapiMmcssThread;
+
+static void
+gst_wasapi_util_mmcss_thread_exit (gpointer data)
+{
+  GstWasapiMmcssThread *thread = data;
+
+  if (thread->handle != NULL)
+    gst_wasapi_util_revert_thread_characteristics (thread->handle);
+  g_free (thread->task);
+  g_slice_free (GstWasapiMmcssThread, thread);
+}
+
+static GPrivate mmcss_thread =
+G_PRIVATE_INIT (gst_wasapi_util_mmcss_thread_exit);
+
+void
+gst_wasapi_util_ensure_thread_characteristics (const gchar * task,
+    GstWasapiMmcssPriority priority)
+{
+  GstWasapiMmcssThread *thread = g_private_get (&mmcss_thread);
+
+  if (G_LIKELY (thread != NULL && thread->task != NULL &&
+          thread->priority == priority &&
+          g_strcmp0 (thread->task, task) == 0))
+    return;
+
+  if (thread == NULL) {
+    thread = g_slice_new0 (GstWasapiMmcssThread);
+    g_private_set (&mmcss_thread, thread);
+  } else if (thread->handle != NULL && g_strcmp0 (thread->task, task) == 0) {
+    gst_wasapi_util_set_thread_priority (thread->handle, priority);
+    thread->priority = priority;
+    return;
+  } else if (thread->handle != NULL) {
+    gst_wasapi_util_revert_thread_characteristics (thread->handle);
+  }
+
+  g_free (thread->task);
+  thread->task = g_strdup (task);
+  thread->priority = priority;
+  thread->handle = gst_wasapi_util_set_thread_characteristics (task, priority);
+  if (thread->handle != NULL)
+    GST_INFO ("registered thread %p with MMCSS task %s", g_thread_self (),
+        task);
+  else
+    GST_WARNING ("failed to register thread %p with MMCSS task %s",
+        g_thread_self (), task);
+}
+
+static gboolean
+gst_wasapi_util_pin_thread (guint group, guint64 mask,
+    GROUP_AFFINITY * orig_affinity)
+{
+  GROUP_AFFINITY affinity = { 0, };
+  PROCESSOR_NUMBER ideal = { 0, };
+  DWORD active;
+  guint i;
+
+  active = GetActiveProcessorCount ((WORD) group);
+  if (active == 0) {
+    GST_WARNING ("processor group %u does not exist", group);
+    return FALSE;
+  }
+
+  /* Drop the processors that group doesn't have */
+  if (active < 64)
+    mask &= (G_GUINT64_CONSTANT (1) << active) - 1;
+  if (sizeof (KAFFINITY) < sizeof (guint64))
+    mask &= G_MAXUINT32;
+  if (mask == 0) {
+    GST_WARNING ("no processor of group %u (%lu active) in the affinity mask",
+        group, active);
+    return FALSE;
+  }
+
+  affinity.Group = (WORD) group;
+  affinity.Mask = (KAFFINITY) mask;
+  if (!SetThreadGroupAffinity (GetCurrentThread (), &affinity, orig_affinity)) {
+    GST_WARNING ("SetThreadGroupAffinity failed: %lu", GetLastError ());
+    return FALSE;
+  }
+
+  /* Also prefer the first of them, so the scheduler doesn't move us around
+   * between the allowed processors either */
+  for (i = 0; !(mask & (G_GUINT64_CONSTANT (1) << i)); i++);
+  ideal.Group = (WORD) group;
+  ideal.Number = (BYTE) i;
+  if (!SetThreadIdealProcessorEx (GetCurrentThread (), &ideal, NULL))
+    GST_WARNING ("SetThreadIdealProcessorEx failed: %lu", GetLastError ());
+
+  GST_INFO ("pinned thread %p to group %u, mask 0x%" G_GINT64_MODIFIER "x, "
+      "ideal processor %u", g_thread_self (), group, mask, i);
+
+  return TRUE;
+}
+
+void
+gst_wasapi_util_ensure_thread_affinity (guint group, guint64 mask)
+{
+  GstWasapiMmcssThread *thread = g_private_get (&mmcss_thread);
+
+  if (G_LIKELY (thread != NULL ? (thread->group == group &&
+              thread->mask == mask) : mask == 0))
+    return;
+
+  if (thread == NULL) {
+    thread = g_slice_new0 (GstWasapiMmcssThread);
+    g_private_set (&mmcss_thread, thread);
+  }
+
+  thread->group = group;
+  thread->mask = mask;
+
+  if (mask == 0) {
+    /* Back to where the thread was allowed to run before */
+    if (thread->pinned && !SetThreadGroupAffinity (GetCurrentThread (),
+            &thread->orig_affinity, NULL))
+      GST_WARNING ("SetThreadGroupAffinity failed: %lu", GetLastError ());
+    thread->pinned = FALSE;
+  } else if (thread->pinned) {
+    gst_wasapi_util_pin_thread (group, mask, NULL);
+  } else {
+    thread->pinned =
+        gst_wasapi_util_pin_thread (group, mask, &thread->orig_affinity);
+  }
+}
+
+/* Not in every SDK. THREAD_POWER_THROTTLING_STATE, and the CpuSet member
+ * of SYSTEM_CPU_SET_INFORMATION. */
+#define THREAD_INFORMATION_POWER_THROTTLING 3
+#define POWER_THROTTLING_VERSION 1
+#define POWER_THROTTLING_EXECUTION_SPEED 0x1
+
+typedef struct
+{
+  ULONG Version;
+  ULONG ControlMask;
+  ULONG StateMask;
+} GstWasapiPowerThrottlingState;
+
+typedef struct
+{
+  DWORD Size;
+  DWORD Type;
+  DWORD Id;
+  WORD Group;
+  BYTE LogicalProcessorIndex;
+  BYTE CoreIndex;
+  BYTE LastLevelCacheIndex;
+  BYTE NumaNodeIndex;
+  BYTE EfficiencyClass;
+  BYTE AllFlags;
+  DWORD Reserved;
+  DWORD64 AllocationTag;
+} GstWasapiCpuSet;
+
+typedef BOOL (WINAPI * SetThreadInformationFunc) (HANDLE thread,
+    gint information_class, gpointer information, DWORD size);
+typedef BOOL (WINAPI * GetSystemCpuSetInformationFunc) (gpointer information,
+    ULONG length, PULONG returned_length, HANDLE process, ULONG flags);
+typedef BOOL (WINAPI * SetThreadSelectedCpuSetsFunc) (HANDLE thread,
+    const ULONG * ids, ULONG count);
+
+static struct
+{
+  SetThreadInformationFunc SetThreadInformation;
+  SetThreadSelectedCpuSetsFunc SetThreadSelectedCpuSets;
+  /* The CPU sets of the highest efficiency class, none unless there are
+   * several classes */
+  ULONG *performance_ids;
+  ULONG n_performance_ids;
+} gst_wasapi_thread_tbl;
+
+static void
+gst_wasapi_util_load_cpu_sets (HMODULE dll)
+{
+  GetSystemCpuSetInformationFunc get_info;
+  guint8 *info, *p;
+  ULONG len = 0, n = 0;
+  BYTE min_class = G_MAXUINT8, max_class = 0;
+
+  get_info = (GetSystemCpuSetInformationFunc) GetProcAddress (dll,
+      "GetSystemCpuSetInformation");
+  if (get_info == NULL || gst_wasapi_thread_tbl.SetThreadSelectedCpuSets ==
+      NULL) {
+    GST_INFO ("no CPU sets before Windows 10");
+    return;
+  }
+
+  get_info (NULL, 0, &len, GetCurrentProcess (), 0);
+  if (len == 0)
+    return;
+  info = g_malloc0 (len);
+  if (!get_info (info, len, &len, GetCurrentProcess (), 0)) {
+    GST_WARNING ("GetSystemCpuSetInformation failed: %lu", GetLastError ());
+    g_free (info);
+    return;
+  }
+
+  for (p = info; p < info + len; p += ((GstWasapiCpuSet *) p)->Size) {
+    GstWasapiCpuSet *set = (GstWasapiCpuSet *) p;
+
+    min_class = MIN (min_class, set->EfficiencyClass);
+    max_class = MAX (max_class, set->EfficiencyClass);
+    n++;
+  }
+
+  if (min_class < max_class) {
+    gst_wasapi_thread_tbl.performance_ids = g_new (ULONG, n);
+    for (p = info; p < info + len; p += ((GstWasapiCpuSet *) p)->Size) {
+      GstWasapiCpuSet *set = (GstWasapiCpuSet *) p;
+
+      if (set->EfficiencyClass == max_class)
+        gst_wasapi_thread_tbl.performance_ids[gst_wasapi_thread_tbl.
+            n_performance_ids++] = set->Id;
+    }
+  }
+  GST_INFO ("%lu of %lu CPU sets in the highest efficiency class %u",
+      gst_wasapi_thread_tbl.n_performance_ids, n, max_class);
+
+  g_free (info);
+}
+
+static gpointer
+gst_wasapi_util_load_thread_once (gpointer user_data)
+{
+  HMODULE dll = GetModuleHandle (TEXT ("kernel32.dll"));
+
+  gst_wasapi_thread_tbl.SetThreadInformation = (SetThreadInformationFunc)
+      GetProcAddress (dll, "SetThreadInformation");
+  gst_wasapi_thread_tbl.SetThreadSelectedCpuSets =
+      (SetThreadSelectedCpuSetsFunc) GetProcAddress (dll,
+      "SetThreadSelectedCpuSets");
+  gst_wasapi_util_load_cpu_sets (dll);
+
+  return NULL;
+}
+
+static void
+gst_wasapi_util_set_power_throttling (gboolean allowed)
+{
+  /* Without the control bit the system decides again */
+  GstWasapiPowerThrottlingState state = { POWER_THROTTLING_VERSION,
+    allowed ? 0 : POWER_THROTTLING_EXECUTION_SPEED, 0
+  };
+
+  if (gst_wasapi_thread_tbl.SetThreadInformation == NULL) {
+    GST_INFO ("no SetThreadInformation() before Windows 8");
+    return;
+  }
+
+  /* Windows before 10 1709 don't know the class and fail */
+  if (!gst_wasapi_thread_tbl.SetThreadInformation (GetCurrentThread (),
+          THREAD_INFORMATION_POWER_THROTTLING, &state, sizeof (state)))
+    GST_INFO ("can't set power throttling: %lu", GetLastError ());
+  else
+    GST_INFO ("power throttling of thread %p %s", g_thread_self (),
+        allowed ? "allowed" : "disabled");
+}
+
+static void
+gst_wasapi_util_select_performance_cores (gboolean selected)
+{
+  if (gst_wasapi_thread_tbl.n_performance_ids == 0)
+    return;
+
+  if (!gst_wasapi_thread_tbl.SetThreadSelectedCpuSets (GetCurrentThread (),
+          selected ? gst_wasapi_thread_tbl.performance_ids : NULL,
+          selected ? gst_wasapi_thread_tbl.n_performance_ids : 0))
+    GST_WARNING ("SetThreadSelectedCpuSets failed: %lu", GetLastError ());
+  else
+    GST_INFO ("thread %p %s the performance cores", g_thread_self (),
+        selected ? "on" : "no longer restricted to");
+}
+
+void
+gst_wasapi_util_ensure_thread_flags (GstWasapiThreadFlags flags)
+{
+  static GOnce once = G_ONCE_INIT;
+  GstWasapiMmcssThread *thread = g_private_get (&mmcss_thread);
+  GstWasapiThreadFlags changed;
+
+  if (G_LIKELY (thread != NULL ? thread->flags == flags : flags == 0))
+    return;
+
+  if (thread == NULL) {
+    thread = g_slice_new0 (GstWasapiMmcssThread);
+    g_private_set (&mmcss_thread, thread);
+  }
+
+  changed = thread->flags ^ flags;
+  thread->flags = flags;
+
+  g_once (&once, gst_wasapi_util_load_thread_once, NULL);
+  if (changed & GST_WASAPI_THREAD_NO_THROTTLING)
+    gst_wasapi_util_set_power_throttling (!(flags &
+            GST_WASAPI_THREAD_NO_THROTTLING));
+  if (changed & GST_WASAPI_THREAD_PERFORMANCE_CORES)
+    gst_wasapi_util_select_performance_cores (flags &
+        GST_WASAPI_THREAD_PERFORMANCE_CORES);
+}
+
+/* Current QPC value in 100ns units, like the positions WASAPI returns */
+guint64
+gst_wasapi_util_get_qpc_position (void)
+{
+  static gint64 qpc_freq = 0;
+  LARGE_INTEGER now;
+
+  if (G_UNLIKELY (qpc_freq == 0)) {
+    LARGE_INTEGER freq;
+
+    QueryPerformanceFrequency (&freq);
+    qpc_freq = freq.QuadPart;
+  }
+
+  QueryPerformanceCounter (&now);
+
+  return gst_util_uint64_scale (now.QuadPart, 10000000, qpc_freq);
+}
+
+guint64
+gst_wasapi_util_get_thread_cycles (void)
+{
+  ULONG64 cycles = 0;
+
+  QueryThreadCycleTime (GetCurrentThread (), &cycles);
+
+  return cycles;
+}
+
+gboolean
+gst_wasapi_util_lock_memory (gpointer mem, gsize size)
+{
+  HANDLE process = GetCurrentProcess ();
+  SYSTEM_INFO info;
+  SIZE_T min_ws, max_ws;
+  volatile guint8 *p;
+  gsize i;
+
+  if (mem == NULL || size == 0)
+    return TRUE;
+
+  if (!VirtualLock (mem, size)) {
+    /* Locked pages count against the minimum working set, 200 KB by
+     * default. Make room for these and try again. */
+    if (GetLastError () != ERROR_WORKING_SET_QUOTA ||
+        !GetProcessWorkingSetSize (process, &min_ws, &max_ws) ||
+        !SetProcessWorkingSetSize (process, min_ws + size, max_ws + size) ||
+        !VirtualLock (mem, size)) {
+      GST_WARNING ("VirtualLock of %" G_GSIZE_FORMAT " bytes failed: %lu",
+          size, GetLastError ());
+      return FALSE;
+    }
+  }
+
+  /* Locking doesn't fault in pages that were never touched */
+  GetSystemInfo (&info);
+  p = mem;
+  for (i = 0; i < size; i += info.dwPageSize)
+    p[i] = p[i];
+  p[size - 1] = p[size - 1];
+
+  return TRUE;
+}
+
+void
+gst_wasapi_util_unlock_memory (gpointer mem, gsize size)
+{
+  if (mem != NULL && size != 0)
+    VirtualUnlock (mem, size);
+}
+
+gpointer
+gst_wasapi_util_alloc_locked (gsize size)
+{
+  gpointer mem;
+
+  mem = VirtualAlloc (NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (mem == NULL)
+    g_error ("VirtualAlloc of %" G_GSIZE_FORMAT " bytes failed: %lu", size,
+        GetLastError ());
+
+  gst_wasapi_util_lock_memory (mem, size);
+
+  return mem;
+}
+
+void
+gst_wasapi_util_free_locked (gpointer mem, gsize size)
+{
+  if (mem == NULL)
+    return;
+
+  VirtualUnlock (mem, size);
+  VirtualFree (mem, 0, MEM_RELEASE);
+}
+
+typedef PVOID (WINAPI * VirtualAlloc2Func) (HANDLE process, PVOID address,
+    SIZE_T size, ULONG type, ULONG protect, gpointer params, ULONG n_params);
+typedef PVOID (WINAPI * MapViewOfFile3Func) (HANDLE mapping, HANDLE process,
+    PVOID address, ULONG64 offset, SIZE_T size, ULONG type, ULONG protect,
+    gpointer params, ULONG n_params);
+
+static struct
+{
+  VirtualAlloc2Func VirtualAlloc2;
+  MapViewOfFile3Func MapViewOfFile3;
+} gst_wasapi_mirror_tbl;
+
+static gpointer
+gst_wasapi_util_load_mirror_once (gpointer user_data)
+{
+  HMODULE dll = LoadLibrary (TEXT ("kernelbase.dll"));
+
+  /* Windows 10 1803, placeholders reserve the address range for both views
+   * so nothing can take it in between */
+  if (dll != NULL) {
+    gst_wasapi_mirror_tbl.VirtualAlloc2 =
+        (VirtualAlloc2Func) GetProcAddress (dll, "VirtualAlloc2");
+    gst_wasapi_mirror_tbl.MapViewOfFile3 =
+        (MapViewOfFile3Func) GetProcAddress (dll, "MapViewOfFile3");
+  }
+  if (gst_wasapi_mirror_tbl.VirtualAlloc2 == NULL ||
+      gst_wasapi_mirror_tbl.MapViewOfFile3 == NULL) {
+    GST_INFO ("no placeholders, mapping mirrored rings the old way");
+    gst_wasapi_mirror_tbl.VirtualAlloc2 = NULL;
+    gst_wasapi_mirror_tbl.MapViewOfFile3 = NULL;
+  }
+
+  return NULL;
+}
+
+static guint8 *
+gst_wasapi_util_map_mirrored_placeholder (HANDLE mapping, gsize size)
+{
+  guint8 *mem, *view1 = NULL, *view2 = NULL;
+
+  mem = gst_wasapi_mirror_tbl.VirtualAlloc2 (NULL, NULL, 2 * size,
+      MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+  if (mem == NULL)
+    return NULL;
+
+  /* Two placeholders, one for each view */
+  if (!VirtualFree (mem, size, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER)) {
+    VirtualFree (mem, 0, MEM_RELEASE);
+    return NULL;
+  }
+
+  view1 = gst_wasapi_mirror_tbl.MapViewOfFile3 (mapping, NULL, mem, 0, size,
+      MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+  if (view1 != NULL)
+    view2 = gst_wasapi_mirror_tbl.MapViewOfFile3 (mapping, NULL, mem + size,
+        0, size, MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+
+  if (view2 == NULL) {
+    if (view1 != NULL)
+      UnmapViewOfFile (view1);
+    else
+      VirtualFree (mem, 0, MEM_RELEASE);
+    VirtualFree (mem + size, 0, MEM_RELEASE);
+    return NULL;
+  }
+
+  return mem;
+}
+
+static guint8 *
+gst_wasapi_util_map_mirrored_fixed (HANDLE mapping, gsize size)
+{
+  gint i;
+
+  for (i = 0; i < MIRROR_ATTEMPTS; i++) {
+    guint8 *mem, *view1, *view2;
+
+    /* Find a free range for both, and map into it right away */
+    mem = VirtualAlloc (NULL, 2 * size, MEM_RESERVE, PAGE_NOACCESS);
+    if (mem == NULL)
+      return NULL;
+    VirtualFree (mem, 0, MEM_RELEASE);
+
+    view1 = MapViewOfFileEx (mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, mem);
+    if (view1 == NULL)
+      continue;
+    view2 = MapViewOfFileEx (mapping, FILE_MAP_ALL_ACCESS, 0, 0, size,
+        mem + size);
+    if (view2 != NULL)
+      return mem;
+    UnmapViewOfFile (view1);
+  }
+
+  return NULL;
+}
+
+gpointer
+gst_wasapi_util_alloc_mirrored (gsize * size, gsize unit)
+{
+  static GOnce once = G_ONCE_INIT;
+  SYSTEM_INFO info;
+  HANDLE mapping;
+  gsize granularity, a, b, align;
+  guint8 *mem;
+
+  g_once (&once, gst_wasapi_util_load_mirror_once, NULL);
+
+  /* Rounded up to the least common multiple */
+  GetSystemInfo (&info);
+  granularity = info.dwAllocationGranularity;
+  for (a = granularity, b = MAX (unit, 1); b != 0;) {
+    gsize t = a % b;
+
+    a = b;
+    b = t;
+  }
+  align = granularity / a * MAX (unit, 1);
+  *size = (MAX (*size, 1) + align - 1) / align * align;
+
+  mapping = CreateFileMapping (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      (DWORD) ((guint64) * size >> 32), (DWORD) * size, NULL);
+  if (mapping == NULL) {
+    GST_WARNING ("CreateFileMapping of %" G_GSIZE_FORMAT " bytes failed: %lu",
+        *size, GetLastError ());
+    return NULL;
+  }
+
+  if (gst_wasapi_mirror_tbl.VirtualAlloc2 != NULL)
+    mem = gst_wasapi_util_map_mirrored_placeholder (mapping, *size);
+  else
+    mem = gst_wasapi_util_map_mirrored_fixed (mapping, *size);
+  /* The views keep it */
+  CloseHandle (mapping);
+
+  if (mem == NULL)
+    GST_WARNING ("mapping a mirrored ring of %" G_GSIZE_FORMAT " bytes "
+        "failed: %lu", *size, GetLastError ());
+
+  return mem;
+}
+
+void
+gst_wasapi_util_free_mirrored (gpointer mem, gsize size)
+{
+  if (mem == NULL)
+    return;
+
+  UnmapViewOfFile ((guint8 *) mem + size);
+  UnmapViewOfFile (mem);
+}
+
+/* Converts a QPC position as returned by GetBuffer() (in 100ns units) into
+ * the time of @clock, by measuring how long ago the packet was captured */
+GstClockTime
+gst_wasapi_util_qpc_to_clock_time (GstClock * clock, guint64 qpc_pos)
+{
+  GstClockTime clock_now, age;
+
+  clock_now = gst_clock_get_time (clock);
+  age = gst_wasapi_util_get_qpc_position ();
+  age = age > qpc_pos ? (age - qpc_pos) * 100 : 0;
+
+  if (clock_now > age)
+    return clock_now - age;
+  return 0;
+}
+
+gboolean
+gst_wasapi_util_get_process_usage (guint64 * resident, guint64 * private_bytes,
+    guint * handles)
+{
+  PROCESS_MEMORY_COUNTERS_EX counters;
+  DWORD n_handles = 0;
+  HANDLE process = GetCurrentProcess ();
+
+  memset (&counters, 0, sizeof (counters));
+  counters.cb = sizeof (counters);
+  if (!GetProcessMemoryInfo (process, (PROCESS_MEMORY_COUNTERS *) & counters,
+          sizeof (counters)) || !GetProcessHandleCount (process, &n_handles))
+    return FALSE;
+
+  *resident = counters.WorkingSetSize;
+  *private_bytes = counters.PrivateUsage;
+  *handles = n_handles;
+
+  return TRUE;
+}
+
+GstClockTime
+gst_wasapi_util_get_process_time (void)
+{
+  FILETIME creation, exit, kernel, user;
+
+  if (!GetProcessTimes (GetCurrentProcess (), &creation, &exit, &kernel,
+          &user))
+    return 0;
+
+  /* In 100 ns */
+  return (((guint64) kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+      ((guint64) user.dwHighDateTime << 32 | user.dwLowDateTime)) * 100;
+}
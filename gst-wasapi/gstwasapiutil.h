@@ -34,6 +34,7 @@
 #include <audioclient.h>
 
 #include "gstaudioclient3.h"
+#include "gstaudioeffectsmanager.h"
 
 /* Static Caps shared between source, sink, and device provider */
 #define GST_WASAPI_STATIC_CAPS "audio/x-raw, " \
@@ -42,13 +43,37 @@
         "rate = " GST_AUDIO_RATE_RANGE ", " \
         "channels = " GST_AUDIO_CHANNELS_RANGE
 
-/* Standard error path */
+/* Stream flags for conversion inside the audio engine, older SDKs lack them */
+#ifndef AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM
+#define AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM 0x80000000
+#endif
+#ifndef AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY
+#define AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY 0x08000000
+#endif
+#ifndef AUDCLNT_E_RESOURCES_INVALIDATED
+#define AUDCLNT_E_RESOURCES_INVALIDATED AUDCLNT_ERR (0x026)
+#endif
+
+/* The client is dead and the device has to be activated again */
+#define GST_WASAPI_CLIENT_LOST(hr) ((hr) == AUDCLNT_E_DEVICE_INVALIDATED || \
+    (hr) == AUDCLNT_E_RESOURCES_INVALIDATED)
+
+/* Compressed formats that wasapisink can pass through as IEC 61937 */
+#define GST_WASAPI_PASSTHROUGH_CAPS \
+        "audio/x-ac3, framed = (boolean) true; " \
+        "audio/x-eac3, framed = (boolean) true; " \
+        "audio/x-dts, framed = (boolean) true"
+
+/* Standard error path, only formats the message if it will be logged */
 #define HR_FAILED_AND(hr,func,and) \
   do { \
     if (FAILED (hr)) { \
-      gchar *msg = gst_wasapi_util_hresult_to_string (hr); \
-      GST_ERROR_OBJECT (self, #func " failed (%x): %s", (guint) hr, msg); \
-      g_free (msg); \
+      if (gst_debug_category_get_threshold (GST_CAT_DEFAULT) >= \
+          GST_LEVEL_ERROR) { \
+        gchar *msg = gst_wasapi_util_hresult_to_string (hr); \
+        GST_ERROR_OBJECT (self, #func " failed (%x): %s", (guint) hr, msg); \
+        g_free (msg); \
+      } \
       and; \
     } \
   } while (0)
@@ -57,6 +82,23 @@
 
 #define HR_FAILED_GOTO(hr,func,where) HR_FAILED_AND(hr,func,res = FALSE; goto where)
 
+/* Stream category enum property, the values of AUDIO_STREAM_CATEGORY */
+typedef enum
+{
+  GST_WASAPI_STREAM_CATEGORY_OTHER = AudioCategory_Other,
+  GST_WASAPI_STREAM_CATEGORY_COMMUNICATIONS = AudioCategory_Communications,
+  GST_WASAPI_STREAM_CATEGORY_ALERTS = AudioCategory_Alerts,
+  GST_WASAPI_STREAM_CATEGORY_SOUND_EFFECTS = AudioCategory_SoundEffects,
+  GST_WASAPI_STREAM_CATEGORY_GAME_EFFECTS = AudioCategory_GameEffects,
+  GST_WASAPI_STREAM_CATEGORY_GAME_MEDIA = AudioCategory_GameMedia,
+  GST_WASAPI_STREAM_CATEGORY_GAME_CHAT = AudioCategory_GameChat,
+  GST_WASAPI_STREAM_CATEGORY_SPEECH = AudioCategory_Speech,
+  GST_WASAPI_STREAM_CATEGORY_MOVIE = AudioCategory_Movie,
+  GST_WASAPI_STREAM_CATEGORY_MEDIA = AudioCategory_Media
+} GstWasapiStreamCategory;
+#define GST_WASAPI_TYPE_STREAM_CATEGORY (gst_wasapi_stream_category_get_type())
+GType gst_wasapi_stream_category_get_type (void);
+
 /* Device role enum property */
 typedef enum
 {
@@ -67,6 +109,81 @@ typedef enum
 #define GST_WASAPI_DEVICE_TYPE_ROLE (gst_wasapi_device_role_get_type())
 GType gst_wasapi_device_role_get_type (void);
 
+/* How wasapisrc corrects drift when slaved with the resample method */
+typedef enum
+{
+  GST_WASAPI_DRIFT_CORRECTION_RESAMPLE,
+  GST_WASAPI_DRIFT_CORRECTION_SPLICE,
+  GST_WASAPI_DRIFT_CORRECTION_ENGINE
+} GstWasapiDriftCorrectionMethod;
+#define GST_WASAPI_TYPE_DRIFT_CORRECTION_METHOD \
+    (gst_wasapi_drift_correction_method_get_type())
+GType gst_wasapi_drift_correction_method_get_type (void);
+
+/* What wasapisrc does when downstream fell behind the ringbuffer */
+typedef enum
+{
+  GST_WASAPI_CATCHUP_DISCONT,
+  GST_WASAPI_CATCHUP_FADE,
+  GST_WASAPI_CATCHUP_COMPRESS
+} GstWasapiCatchupPolicy;
+#define GST_WASAPI_TYPE_CATCHUP_POLICY (gst_wasapi_catchup_policy_get_type())
+GType gst_wasapi_catchup_policy_get_type (void);
+
+/* What wasapisrc timestamps its buffers with */
+typedef enum
+{
+  GST_WASAPI_TIMESTAMP_MODE_DEVICE,
+  GST_WASAPI_TIMESTAMP_MODE_QPC,
+  GST_WASAPI_TIMESTAMP_MODE_SYSTEM
+} GstWasapiTimestampMode;
+#define GST_WASAPI_TYPE_TIMESTAMP_MODE (gst_wasapi_timestamp_mode_get_type())
+GType gst_wasapi_timestamp_mode_get_type (void);
+
+/* What wasapisrc measures for its level messages */
+typedef enum
+{
+  GST_WASAPI_LEVEL_MODE_NONE,
+  GST_WASAPI_LEVEL_MODE_SAMPLES,
+  GST_WASAPI_LEVEL_MODE_ENDPOINT
+} GstWasapiLevelMode;
+#define GST_WASAPI_TYPE_LEVEL_MODE (gst_wasapi_level_mode_get_type())
+GType gst_wasapi_level_mode_get_type (void);
+
+/* What wakes up wasapisrc to read */
+typedef enum
+{
+  GST_WASAPI_SCHEDULING_EVENT,
+  GST_WASAPI_SCHEDULING_TIMER,
+  GST_WASAPI_SCHEDULING_POWER_SAVING,
+  GST_WASAPI_SCHEDULING_SPIN
+} GstWasapiScheduling;
+#define GST_WASAPI_TYPE_SCHEDULING (gst_wasapi_scheduling_get_type())
+GType gst_wasapi_scheduling_get_type (void);
+
+/* Priority of the realtime threads within their MMCSS task, the values of
+ * AVRT_PRIORITY */
+typedef enum
+{
+  GST_WASAPI_MMCSS_PRIORITY_LOW = -1,
+  GST_WASAPI_MMCSS_PRIORITY_NORMAL = 0,
+  GST_WASAPI_MMCSS_PRIORITY_HIGH = 1,
+  GST_WASAPI_MMCSS_PRIORITY_CRITICAL = 2
+} GstWasapiMmcssPriority;
+
+/* What else the realtime threads ask of the scheduler, besides MMCSS */
+typedef enum
+{
+  /* Never throttled to save power (EcoQoS), e.g. in the background */
+  GST_WASAPI_THREAD_NO_THROTTLING = (1 << 0),
+  /* Only on the most performant cores of a hybrid CPU */
+  GST_WASAPI_THREAD_PERFORMANCE_CORES = (1 << 1),
+} GstWasapiThreadFlags;
+#define GST_WASAPI_TYPE_MMCSS_PRIORITY (gst_wasapi_mmcss_priority_get_type())
+GType gst_wasapi_mmcss_priority_get_type (void);
+
+#define GST_WASAPI_DEFAULT_MMCSS_TASK "Pro Audio"
+
 /* Utilities */
 
 gboolean gst_wasapi_util_have_audioclient3 (void);
@@ -77,13 +194,47 @@ gint gst_wasapi_erole_to_device_role (gint erole);
 
 gchar *gst_wasapi_util_hresult_to_string (HRESULT hr);
 
+const gchar *gst_wasapi_util_hresult_to_static_string (HRESULT hr);
+
+/* The GstWasapiDevice for @device, NULL if it can't be described. With
+ * @probe the properties also have the periods, the low latency support
+ * and the exclusive caps, which takes activating the endpoint. */
+GstDevice *gst_wasapi_util_new_device (GstElement * element,
+    IMMDevice * device, gboolean probe);
+
+/* The Audio/Source that creates a loopback wasapisrc on the render
+ * endpoint of @device, NULL if @device is a capture endpoint */
+GstDevice *gst_wasapi_util_new_loopback_device (GstDevice * device);
+
 gboolean gst_wasapi_util_get_devices (GstElement * element, gboolean active,
-    GList ** devices);
+    gboolean probe, GList ** devices);
 
 gboolean gst_wasapi_util_get_device_client (GstElement * element,
     gint data_flow, gint role, const wchar_t * device_strid,
     IMMDevice ** ret_device, IAudioClient ** ret_client);
 
+/* Activates @iid on the virtual device @path with ActivateAudioInterfaceAsync()
+ * and waits for it */
+gboolean gst_wasapi_util_activate_async (GstElement * element,
+    const wchar_t * path, REFIID iid, PROPVARIANT * params,
+    IAudioClient ** ret_client);
+
+/* Like get_device_client() for the default device, but the client is one
+ * of the virtual default device, which the audio engine moves to the new
+ * default device by itself. Shared mode only, Windows 10 and newer, FALSE
+ * where there is no such device. */
+gboolean gst_wasapi_util_get_routed_client (GstElement * element,
+    gint data_flow, gint role, IMMDevice ** ret_device,
+    IAudioClient ** ret_client);
+
+/* The endpoint id of @device in UTF-8, as the notifications have it */
+gchar *gst_wasapi_util_get_device_id (IMMDevice * device);
+
+/* PKEY_Device_ContainerId of @device as a GUID string, or NULL when it has
+ * none or is part of the computer itself. Endpoints in one container, like
+ * the microphone and the speakers of a USB headset, run off one clock. */
+gchar *gst_wasapi_util_get_container_id (IMMDevice * device);
+
 gboolean gst_wasapi_util_get_device_format (GstElement * element,
     gint device_mode, IMMDevice * device, IAudioClient * client,
     WAVEFORMATEX ** ret_format);
@@ -97,29 +248,232 @@ gboolean gst_wasapi_util_get_capture_client (GstElement * element,
 gboolean gst_wasapi_util_get_clock (GstElement * element,
     IAudioClient * client, IAudioClock ** ret_clock);
 
+/* Only there for shared mode clients initialized with rate_adjust */
+gboolean gst_wasapi_util_get_clock_adjustment (GstElement * element,
+    IAudioClient * client, IAudioClockAdjustment ** ret_adjustment);
+
+gboolean gst_wasapi_util_get_stream_volume (GstElement * element,
+    IAudioClient * client, IAudioStreamVolume ** ret_volume);
+
+gboolean gst_wasapi_util_start_if_needed (GstElement * self,
+    IAudioClient * client, gint * needs_restart);
+
 gboolean gst_wasapi_util_parse_waveformatex (WAVEFORMATEXTENSIBLE * format,
     GstCaps * template_caps, GstCaps ** out_caps,
     GstAudioChannelPosition ** out_positions);
 
+/* Whether samples of @info can be written as @format as they are */
+gboolean gst_wasapi_util_waveformatex_matches_info (WAVEFORMATEX * format,
+    GstAudioInfo * info);
+
 void gst_wasapi_util_get_best_buffer_sizes (GstAudioRingBufferSpec * spec,
     gboolean exclusive, REFERENCE_TIME default_period,
     REFERENCE_TIME min_period, REFERENCE_TIME * ret_period,
     REFERENCE_TIME * ret_buffer_duration);
 
+/* Adds what the device holds on top of the ringbuffer to the answer the
+ * base class gave to a LATENCY @query: the engine's @stream_latency plus
+ * one device @period to the minimum and the whole device @buffer to the
+ * maximum, and @extra to both. Unlike the padding these don't change while
+ * prepared, so the pipeline latency doesn't depend on when it was asked.
+ * Leaves @query alone while @stream_latency is NONE. */
+void gst_wasapi_util_add_device_latency (GstElement * element,
+    GstQuery * query, GstClockTime stream_latency, GstClockTime period,
+    GstClockTime buffer, GstClockTime extra);
+
+/* Appends to @caps what the audio engine can convert from and to @caps,
+ * which are the caps of the mix format */
+GstCaps *gst_wasapi_util_add_autoconvert_caps (GstCaps * caps);
+
+/* Fills @reorder_map like gst_audio_get_channel_reorder_map(). FALSE if the
+ * channels of @from are already in the order of @to, or have no positions. */
+gboolean gst_wasapi_util_get_reorder_map (gint channels,
+    const GstAudioChannelPosition * from, const GstAudioChannelPosition * to,
+    gint * reorder_map);
+
+/* Copies @n_frames interleaved frames of @src to @dst, channel i going to
+ * channel @reorder_map[i]. @dst may be @src. */
+void gst_wasapi_util_reorder (gpointer dst, gconstpointer src, guint n_frames,
+    gint channels, gint bps, const gint * reorder_map);
+
+/* Copies channels @selected[0] to @selected[n_selected - 1] of @n_frames
+ * interleaved frames of @channels from @src to @dst, as frames of
+ * @n_selected channels. @dst may be @src. */
+void gst_wasapi_util_select_channels (gpointer dst, gconstpointer src,
+    guint n_frames, gint channels, gint bps, gint n_selected,
+    const gint * selected);
+
+/* Parses a channel list like "3,4", numbered from 1, into @selected, from
+ * 0. Returns how many, 0 if @str is NULL or doesn't fit @channels. */
+gint gst_wasapi_util_parse_channel_select (const gchar * str, gint channels,
+    gint * selected);
+
+/* The format for @info, with the channel mask of @mix_format if the channel
+ * count is the same, else the one of the positions of @info. Free with
+ * CoTaskMemFree(). */
+WAVEFORMATEX *gst_wasapi_util_audio_info_to_waveformatex (GstAudioInfo * info,
+    WAVEFORMATEX * mix_format);
+
+/* Asks for a hardware offloaded stream if the endpoint can do that, before
+ * @client is initialized. Then raises the buffer and latency time of @spec to
+ * the large buffers offloading is about. @category and @raw like below, the
+ * other category is offloaded as media. */
+gboolean gst_wasapi_util_request_offload (GstElement * element,
+    IAudioClient * client, WAVEFORMATEX * format,
+    GstAudioRingBufferSpec * spec, GstWasapiStreamCategory category,
+    gboolean raw);
+
+/* Sets the category of the stream, which decides about ducking and the
+ * processing modes of the endpoint, before @client is initialized. With
+ * @raw the stream also bypasses the effects (APOs) of the endpoint. With
+ * @match_format the engine switches the endpoint to the format of the
+ * stream if nothing else holds it, instead of converting. Shared mode only,
+ * exclusive streams never have them. */
+gboolean gst_wasapi_util_set_client_properties (GstElement * element,
+    IAudioClient * client, GstWasapiStreamCategory category, gboolean raw,
+    gboolean match_format);
+
+/* The effects the OS runs on the stream of the initialized @client, as
+ * wasapi-effects structure with the booleans echo-cancellation,
+ * noise-suppression, automatic-gain-control and beamforming, TRUE when
+ * on, and the number of all effects in n-effects. With @enable first turns
+ * on the first three where the OS lets us. NULL if the OS can't tell, before
+ * Windows 11. */
+GstStructure *gst_wasapi_util_get_audio_effects (GstElement * element,
+    IAudioClient * client, gboolean enable);
+
+/* The IEC 61937 format to pass @type at @rate through in exclusive mode, or
+ * NULL if it can't be. Free with CoTaskMemFree(). */
+WAVEFORMATEX *gst_wasapi_util_get_passthrough_format
+    (GstAudioRingBufferFormatType type, gint rate);
+
+/* The passthrough caps the endpoint accepts in exclusive mode, maybe empty */
+GstCaps *gst_wasapi_util_get_passthrough_caps (GstElement * element,
+    IAudioClient * client);
+
+/* The PCM caps @client accepts in exclusive mode besides @device_format,
+ * probed with IsFormatSupported for common rates and sample formats, in the
+ * channels of @device_format with @positions and in stereo. Maybe empty.
+ * Cached by gst_wasapi_device_cache_get_exclusive_caps(). */
+GstCaps *gst_wasapi_util_probe_exclusive_caps (GstElement * element,
+    IAudioClient * client, WAVEFORMATEX * device_format,
+    GstAudioChannelPosition * positions);
+
+/* In exclusive mode a period the driver can't align to makes us activate a
+ * new client on @device, which replaces the one in @client. With
+ * @rate_adjust a shared mode client lets IAudioClockAdjustment change its
+ * sample rate. */
 gboolean gst_wasapi_util_initialize_audioclient (GstElement * element,
-    GstAudioRingBufferSpec * spec, IAudioClient * client,
+    GstAudioRingBufferSpec * spec, IMMDevice * device, IAudioClient ** client,
     WAVEFORMATEX * format, guint sharemode, gboolean low_latency,
-    gboolean loopback, guint * ret_devicep_frames);
+    gboolean loopback, gboolean autoconvert, gboolean rate_adjust,
+    guint * ret_devicep_frames);
 
-gboolean gst_wasapi_util_initialize_notification_client (GstElement * self);
+/* The smallest engine period of at least @wanted_frames that
+ * GetSharedModeEnginePeriod() allows, the minimum or maximum outside of
+ * the range */
+guint gst_wasapi_util_round_engine_period (guint wanted_frames,
+    guint fundp_frames, guint minp_frames, guint maxp_frames);
 
+/* With @loopback also fails when the engine didn't take the period, the
+ * client has to be renewed before falling back then */
 gboolean gst_wasapi_util_initialize_audioclient3 (GstElement * element,
     GstAudioRingBufferSpec * spec, IAudioClient3 * client,
     WAVEFORMATEX * format, gboolean low_latency, gboolean loopback,
     guint * ret_devicep_frames);
 
-HANDLE gst_wasapi_util_set_thread_characteristics (void);
+/* Keeps the multithreaded apartment of the process alive, from
+ * plugin_init. Threads that never initialize COM themselves, like the
+ * streaming and ringbuffer threads and those of the application, then
+ * implicitly belong to it, and all we use is free threaded. So nothing
+ * else calls CoInitialize, except our own threads that enter the MTA
+ * explicitly. */
+void gst_wasapi_util_init_com (void);
+
+/* Wakes the waits of a ringbuffer thread from reset(), so it returns right
+ * away. @handle is manual reset and stays set, @generation counts the
+ * triggers and @seen is how far the I/O thread got, so a reset done while
+ * nothing waits doesn't cancel the first read or write after it. */
+typedef struct
+{
+  HANDLE handle;
+  gint generation;
+  gint seen;
+} GstWasapiCancel;
+
+void gst_wasapi_cancel_init (GstWasapiCancel * cancel);
+
+void gst_wasapi_cancel_clear (GstWasapiCancel * cancel);
+
+/* Any thread, cancels what the I/O thread waits for now or next */
+void gst_wasapi_cancel_trigger (GstWasapiCancel * cancel);
+
+/* I/O thread, before it waits on @handle. Forgets the earlier triggers,
+ * FALSE if one came in the meantime and this call is cancelled already. */
+gboolean gst_wasapi_cancel_prepare (GstWasapiCancel * cancel);
+
+/* Registers the calling thread with the MMCSS @task, a subkey of
+ * HKLM\SOFTWARE\Microsoft\Windows NT\CurrentVersion\Multimedia\
+ * SystemProfile\Tasks, at @priority. NULL on errors. */
+HANDLE gst_wasapi_util_set_thread_characteristics (const gchar * task,
+    GstWasapiMmcssPriority priority);
 
 void gst_wasapi_util_revert_thread_characteristics (HANDLE handle);
 
+/* Registers the calling thread with the MMCSS @task the first time, and
+ * reverts that on the same thread when it exits. Later calls only do
+ * something if @task or @priority differ. For the ringbuffer threads of the
+ * base classes, which we don't create. */
+void gst_wasapi_util_ensure_thread_characteristics (const gchar * task,
+    GstWasapiMmcssPriority priority);
+
+/* Pins the calling thread to the processors in @mask of processor @group,
+ * and makes the first of them its ideal processor. A @mask of 0 undoes
+ * that. Like the above, only does something when the values change. */
+void gst_wasapi_util_ensure_thread_affinity (guint group, guint64 mask);
+
+/* Opts the calling thread out of power throttling and restricts it to the
+ * CPU sets of the highest efficiency class, as @flags say. Neither is there
+ * before Windows 10, and the latter does nothing on CPUs with only one
+ * kind of core. Like the above, only does something when @flags change. */
+void gst_wasapi_util_ensure_thread_flags (GstWasapiThreadFlags flags);
+
+guint64 gst_wasapi_util_get_qpc_position (void);
+
+/* CPU cycles the calling thread used so far, waits don't count */
+guint64 gst_wasapi_util_get_thread_cycles (void);
+
+/* Keeps the pages of @mem in RAM and touches them, so a real-time thread
+ * never faults on them. Grows the working set of the process when needed.
+ * FALSE if Windows wouldn't, the memory stays usable then. */
+gboolean gst_wasapi_util_lock_memory (gpointer mem, gsize size);
+
+void gst_wasapi_util_unlock_memory (gpointer mem, gsize size);
+
+/* Zeroed memory of its own pages, locked like above. Free it with
+ * gst_wasapi_util_free_locked(). */
+gpointer gst_wasapi_util_alloc_locked (gsize size);
+
+void gst_wasapi_util_free_locked (gpointer mem, gsize size);
+
+/* A ring of at least *@size bytes whose pages are mapped a second time
+ * right behind it, so anything of up to *@size bytes from any position in
+ * the first half is contiguous, wrapping or not. *@size is rounded up to a
+ * multiple of @unit and of the allocation granularity. NULL if Windows
+ * won't map it, a plain allocation has to do then. Free it with
+ * gst_wasapi_util_free_mirrored(). */
+gpointer gst_wasapi_util_alloc_mirrored (gsize * size, gsize unit);
+
+void gst_wasapi_util_free_mirrored (gpointer mem, gsize size);
+
+/* Working set and private bytes of the process, and its open handles */
+gboolean gst_wasapi_util_get_process_usage (guint64 * resident,
+    guint64 * private_bytes, guint * handles);
+
+/* Kernel and user time of all threads of the process so far, in ns */
+GstClockTime gst_wasapi_util_get_process_time (void);
+
+GstClockTime gst_wasapi_util_qpc_to_clock_time (GstClock * clock,
+    guint64 qpc_pos);
+
 #endif /* __GST_WASAPI_UTIL_H__ */
@@ -0,0 +1,127 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstwasapivad.h"
+
+#include <math.h>
+
+GST_DEBUG_CATEGORY_EXTERN (gst_wasapi_debug);
+#define GST_CAT_DEFAULT gst_wasapi_debug
+
+typedef gdouble (*GstWasapiVadEnergyFunc) (gconstpointer data, guint n);
+
+struct _GstWasapiVad
+{
+  GstWasapiVadEnergyFunc energy;
+  gint channels;
+  /* Mean square of a sample at the threshold */
+  gdouble threshold;
+  guint64 hangover_frames;
+  /* Frames of hangover left, 0 while not in voice */
+  guint64 hangover_left;
+  gboolean voice;
+};
+
+/* Sum of the squares of @n samples, normalized to [-1, 1] */
+#define DEFINE_ENERGY(name, type, scale) \
+static gdouble \
+gst_wasapi_vad_energy_##name (gconstpointer data, guint n) \
+{ \
+  const type *in = data; \
+  gdouble sum = 0; \
+  \
+  for (guint ii = 0; ii < n; ii++) { \
+    gdouble s = in[ii] * (scale); \
+    \
+    sum += s * s; \
+  } \
+  \
+  return sum; \
+}
+
+DEFINE_ENERGY (s16, gint16, 1.0 / 32768.0);
+DEFINE_ENERGY (s32, gint32, 1.0 / 2147483648.0);
+DEFINE_ENERGY (f32, gfloat, 1.0);
+
+GstWasapiVad *
+gst_wasapi_vad_new (const GstAudioInfo * info, gdouble threshold_db,
+    GstClockTime hangover)
+{
+  GstWasapiVadEnergyFunc energy;
+  GstWasapiVad *self;
+
+  switch (GST_AUDIO_INFO_FORMAT (info)) {
+    case GST_AUDIO_FORMAT_S16LE:
+      energy = gst_wasapi_vad_energy_s16;
+      break;
+    case GST_AUDIO_FORMAT_S32LE:
+      energy = gst_wasapi_vad_energy_s32;
+      break;
+    case GST_AUDIO_FORMAT_F32LE:
+      energy = gst_wasapi_vad_energy_f32;
+      break;
+    default:
+      GST_INFO ("can't detect voice in %s", GST_AUDIO_INFO_NAME (info));
+      return NULL;
+  }
+
+  self = g_slice_new0 (GstWasapiVad);
+  self->energy = energy;
+  self->channels = GST_AUDIO_INFO_CHANNELS (info);
+  self->threshold = pow (10.0, threshold_db / 10.0);
+  self->hangover_frames = gst_util_uint64_scale_int (hangover,
+      GST_AUDIO_INFO_RATE (info), GST_SECOND);
+
+  return self;
+}
+
+void
+gst_wasapi_vad_free (GstWasapiVad * self)
+{
+  g_slice_free (GstWasapiVad, self);
+}
+
+gboolean
+gst_wasapi_vad_process (GstWasapiVad * self, gconstpointer data,
+    guint n_frames)
+{
+  guint n = n_frames * self->channels;
+  gboolean voice;
+
+  if (n == 0)
+    return self->voice;
+
+  if (self->energy (data, n) / n >= self->threshold) {
+    self->hangover_left = self->hangover_frames;
+    voice = TRUE;
+  } else if (self->hangover_left > 0) {
+    self->hangover_left -= MIN (self->hangover_left, n_frames);
+    voice = TRUE;
+  } else {
+    voice = FALSE;
+  }
+
+  if (voice != self->voice)
+    GST_DEBUG ("voice %s", voice ? "started" : "ended");
+  self->voice = voice;
+
+  return voice;
+}
@@ -0,0 +1,44 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_WASAPI_VAD_H__
+#define __GST_WASAPI_VAD_H__
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+G_BEGIN_DECLS
+
+/* Energy based voice activity detection of wasapisrc.
+ *
+ * A block counts as voice when its RMS over all channels is above the
+ * threshold. Voice is held for the hangover time after the last such block,
+ * so word endings and short pauses are not cut off. */
+typedef struct _GstWasapiVad GstWasapiVad;
+
+/* NULL if the samples of @info can't be measured */
+GstWasapiVad *gst_wasapi_vad_new (const GstAudioInfo * info,
+    gdouble threshold_db, GstClockTime hangover);
+
+void gst_wasapi_vad_free (GstWasapiVad * vad);
+
+/* Whether @n_frames frames of @data are voice, or within the hangover */
+gboolean gst_wasapi_vad_process (GstWasapiVad * vad, gconstpointer data,
+    guint n_frames);
+
+G_END_DECLS
+#endif /* __GST_WASAPI_VAD_H__ */